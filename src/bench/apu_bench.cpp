@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include "openxbox/hw/audio/vp.h"
+#include "openxbox/hw/audio/mix.h"
+#include "openxbox/hw/audio/sink.h"
+
+using namespace openxbox;
+using namespace openxbox::hw::audio;
+
+// Guest memory layout
+#define RAM_SIZE        (16 * 1024 * 1024)
+#define VOICES_ADDR     0x10000
+#define SGE_ADDR        0x20000
+#define BUFFERS_ADDR    0x100000
+#define BUFFER_PAGES    1024
+
+// Every voice plays one second of samples in a loop
+#define BUFFER_SAMPLES  NV_PAPU_SAMPLE_RATE
+
+typedef void(*MixFunc)(float *dest, const float *src, float gain);
+typedef void(*RampFunc)(float *block, float start, float end);
+typedef void(*InterleaveFunc)(const float *left, const float *right, int16_t *out);
+
+struct KernelSet {
+    const char *name;
+    MixFunc mix;
+    RampFunc ramp;
+    InterleaveFunc interleave;
+};
+
+static const KernelSet kKernels[] = {
+    { "sse", apu_mix_block, apu_ramp_block, apu_interleave_s16 },
+    { "scalar", apu_mix_block_scalar, apu_ramp_block_scalar, apu_interleave_s16_scalar },
+};
+
+/*!
+ * Mixes a frame of 256 voices into eight bins each, the way the voice
+ * processor does, using the given kernels. Returns frames per second.
+ */
+static double BenchKernels(const KernelSet& kernels, uint32_t frameCount, float *checksum) {
+    alignas(16) static float voices[NV_PAPU_MAX_VOICES][NV_PAPU_FRAME_SAMPLES];
+    alignas(16) static float block[NV_PAPU_FRAME_SAMPLES];
+    alignas(16) static APUMixBins mixbins;
+    alignas(16) static int16_t output[NV_PAPU_FRAME_SAMPLES * 2];
+
+    for (uint32_t v = 0; v < NV_PAPU_MAX_VOICES; v++) {
+        for (uint32_t i = 0; i < NV_PAPU_FRAME_SAMPLES; i++) {
+            voices[v][i] = (float)(((v * 7919 + i * 104729) % 65536) - 32768) / 16.0f;
+        }
+    }
+
+    *checksum = 0.0f;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (uint32_t frame = 0; frame < frameCount; frame++) {
+        memset(mixbins, 0, sizeof(mixbins));
+        for (uint32_t v = 0; v < NV_PAPU_MAX_VOICES; v++) {
+            memcpy(block, voices[v], sizeof(block));
+            kernels.ramp(block, 0.5f, 0.75f);
+            for (uint32_t b = 0; b < NV_PAPU_VOICE_BINS; b++) {
+                kernels.mix(mixbins[(v + b) % NV_PAPU_MIXBINS], block, 0.125f);
+            }
+        }
+        kernels.interleave(mixbins[0], mixbins[1], output);
+        *checksum += output[frame % (NV_PAPU_FRAME_SAMPLES * 2)];
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    return frameCount / std::chrono::duration<double>(end - start).count();
+}
+
+/*!
+ * Sets up 256 looping voices in guest memory, alternating between 16-bit PCM
+ * and ADPCM at various pitches.
+ */
+class BenchGuest {
+public:
+    BenchGuest()
+        : m_ram(RAM_SIZE)
+        , m_regs(NV_PAPU_SIZE / 4)
+        , m_vp(&m_ram[0], RAM_SIZE, &m_regs[0])
+    {
+        m_regs[NV_PAPU_VPVADDR / 4] = VOICES_ADDR;
+        m_regs[NV_PAPU_VPSGEADDR / 4] = SGE_ADDR;
+        for (uint32_t i = 0; i < BUFFER_PAGES; i++) {
+            uint32_t page = BUFFERS_ADDR + i * NV_PAPU_PAGE_SIZE;
+            memcpy(&m_ram[SGE_ADDR + i * 8], &page, sizeof(page));
+        }
+
+        // A sine wave in 16-bit PCM, followed by ADPCM blocks that decode to
+        // alternating rising and falling ramps
+        for (uint32_t i = 0; i < BUFFER_SAMPLES; i++) {
+            int16_t sample = (int16_t)(sin(i * 2 * 3.14159265 * 440 / NV_PAPU_SAMPLE_RATE) * 8000);
+            memcpy(&m_ram[BUFFERS_ADDR + i * 2], &sample, sizeof(sample));
+        }
+        m_adpcmBase = BUFFER_SAMPLES * 2;
+        for (uint32_t b = 0; b < BUFFER_SAMPLES / NV_PAPU_ADPCM_BLOCK_SAMPLES; b++) {
+            uint8_t *block = &m_ram[BUFFERS_ADDR + m_adpcmBase + b * NV_PAPU_ADPCM_BLOCK_SIZE];
+            block[0] = 0;
+            block[1] = 0;
+            block[2] = 40;
+            block[3] = 0;
+            memset(block + 4, (b & 1) ? 0x99 : 0x11, NV_PAPU_ADPCM_BLOCK_SIZE - 4);
+        }
+
+        for (uint32_t v = 0; v < NV_PAPU_MAX_VOICES; v++) {
+            bool adpcm = (v & 1) != 0;
+            uint32_t fmt = NV_PAVS_VOICE_CFG_FMT_LOOP
+                | (NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_S16 << 28)
+                | ((adpcm ? NV_PAVS_VOICE_CFG_FMT_CONTAINER_SIZE_ADPCM : NV_PAVS_VOICE_CFG_FMT_CONTAINER_SIZE_B16) << 30);
+            int16_t pitch = (int16_t)((int)(v % 16) * 512 - 4096);
+
+            Method(NV1BA0_PIO_SET_ANTECEDENT_VOICE, NV1BA0_PIO_SET_ANTECEDENT_VOICE_LIST_2D_TOP << 16);
+            Method(NV1BA0_PIO_SET_CURRENT_VOICE, v);
+            Method(NV1BA0_PIO_SET_VOICE_CFG_VBIN, 0 | (1 << 5) | ((v % 30 + 2) << 10));
+            Method(NV1BA0_PIO_SET_VOICE_CFG_FMT, fmt);
+            Method(NV1BA0_PIO_SET_VOICE_TAR_VOLA, (0x200 << 4) | (0x200u << 20));
+            Method(NV1BA0_PIO_SET_VOICE_TAR_VOLB, (0x100 << 4) | (0xFFFu << 20));
+            Method(NV1BA0_PIO_SET_VOICE_TAR_VOLC, (0xFFF << 4) | (0xFFFu << 20) | 0xF000F);
+            Method(NV1BA0_PIO_SET_VOICE_TAR_PITCH, (uint32_t)(uint16_t)pitch << 16);
+            Method(NV1BA0_PIO_SET_VOICE_CFG_BUF_BASE, adpcm ? m_adpcmBase : 0);
+            Method(NV1BA0_PIO_SET_VOICE_CFG_BUF_LBO, 0);
+            Method(NV1BA0_PIO_SET_VOICE_CFG_BUF_EBO, BUFFER_SAMPLES - 1);
+            Method(NV1BA0_PIO_SET_VOICE_BUF_CBO, (v * 97) % BUFFER_SAMPLES);
+            Method(NV1BA0_PIO_VOICE_ON, v);
+        }
+    }
+
+    void Method(uint32_t method, uint32_t argument) {
+        m_vp.Method(method, argument);
+    }
+
+    unsigned int ProcessFrame(int16_t *output) {
+        memset(m_mixbins, 0, sizeof(m_mixbins));
+        unsigned int voices = m_vp.ProcessFrame(m_mixbins);
+        apu_interleave_s16(m_mixbins[0], m_mixbins[1], output);
+        return voices;
+    }
+
+private:
+    std::vector<uint8_t> m_ram;
+    std::vector<uint32_t> m_regs;
+    VoiceProcessor m_vp;
+    uint32_t m_adpcmBase;
+    alignas(16) APUMixBins m_mixbins;
+};
+
+/*!
+ * Measures the throughput of the APU mixing kernels and of the voice
+ * processor with all 256 voices playing. The output of the voice processor
+ * can be written to a WAV file for inspection.
+ *
+ * Usage: apu-bench [frames [output.wav]]
+ */
+int main(int argc, const char *argv[]) {
+    uint32_t frameCount = 15000;
+    if (argc > 1) {
+        frameCount = (uint32_t)atoi(argv[1]);
+    }
+
+    const double realTimeFrames = (double)NV_PAPU_SAMPLE_RATE / NV_PAPU_FRAME_SAMPLES;
+
+    printf("%-20s %12s %10s %12s\n", "test", "frames/s", "realtime", "checksum");
+    for (const KernelSet& kernels : kKernels) {
+        float checksum;
+        double framesPerSec = BenchKernels(kernels, frameCount, &checksum);
+        printf("%-20s %12.0f %9.1fx %12.0f\n", kernels.name, framesPerSec, framesPerSec / realTimeFrames, checksum);
+    }
+
+    AudioSink *sink = nullptr;
+    if (argc > 2) {
+        sink = new WavAudioSink(argv[2]);
+    }
+    else {
+        sink = new NullAudioSink();
+    }
+    if (!sink->Start(NV_PAPU_SAMPLE_RATE, 2)) {
+        fprintf(stderr, "Could not open the audio output\n");
+        delete sink;
+        return 1;
+    }
+
+    BenchGuest *guest = new BenchGuest();
+    alignas(16) int16_t output[NV_PAPU_FRAME_SAMPLES * 2];
+    uint64_t voiceFrames = 0;
+    std::chrono::high_resolution_clock::duration elapsed(0);
+    for (uint32_t frame = 0; frame < frameCount; frame++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        voiceFrames += guest->ProcessFrame(output);
+        elapsed += std::chrono::high_resolution_clock::now() - start;
+
+        // Wait for the sink instead of dropping audio
+        while (sink->GetFreeFrames() < NV_PAPU_FRAME_SAMPLES) {
+            std::this_thread::yield();
+        }
+        sink->Write(output, NV_PAPU_FRAME_SAMPLES);
+    }
+    sink->Stop();
+
+    double framesPerSec = frameCount / std::chrono::duration<double>(elapsed).count();
+    printf("%-20s %12.0f %9.1fx\n", "voice processor", framesPerSec, framesPerSec / realTimeFrames);
+    printf("%.1f voices per frame, %llu frames written to the sink, %llu dropped\n",
+        (double)voiceFrames / frameCount, (unsigned long long)sink->GetConsumedFrames(), (unsigned long long)sink->GetDroppedFrames());
+
+    delete guest;
+    delete sink;
+    return 0;
+}
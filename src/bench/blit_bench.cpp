@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "openxbox/hw/nv2a/blit.h"
+#include "openxbox/hw/nv2a/nv2a_int.h"
+
+using namespace openxbox;
+
+struct BenchSize {
+    unsigned int width;
+    unsigned int height;
+};
+
+struct BenchFormat {
+    unsigned int format;
+    const char *name;
+};
+
+struct BenchOperation {
+    unsigned int operation;
+    const char *name;
+};
+
+static const BenchSize kSizes[] = {
+    { 64, 64 }, { 256, 256 }, { 640, 480 }, { 1280, 720 },
+};
+
+static const BenchFormat kFormats[] = {
+    { NV062_SET_COLOR_FORMAT_LE_Y8, "Y8" },
+    { NV062_SET_COLOR_FORMAT_LE_R5G6B5, "R5G6B5" },
+    { NV062_SET_COLOR_FORMAT_LE_X1R5G5B5_Z1R5G5B5, "X1R5G5B5" },
+    { NV062_SET_COLOR_FORMAT_LE_X8R8G8B8_Z8R8G8B8, "X8R8G8B8" },
+    { NV062_SET_COLOR_FORMAT_LE_A8R8G8B8, "A8R8G8B8" },
+};
+
+static const BenchOperation kOperations[] = {
+    { NV09F_SET_OPERATION_SRCCOPY, "SRCCOPY" },
+    { NV09F_SET_OPERATION_ROP_AND, "ROP_AND" },
+    { NV09F_SET_OPERATION_BLEND_AND, "BLEND_AND" },
+    { NV09F_SET_OPERATION_SRCCOPY_PREMULT, "SRCCOPY_PREM" },
+    { NV09F_SET_OPERATION_BLEND_PREMULT, "BLEND_PREMULT" },
+};
+
+static double TimeBlits(void (*blit)(const BlitParams&), const BlitParams& params, unsigned int iterations) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (unsigned int i = 0; i < iterations; i++) {
+        blit(params);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / iterations;
+}
+
+/*!
+ * Compares the vectorized NV_IMAGE_BLIT path against the scalar reference
+ * over common blit sizes, and checks that both produce the same pixels.
+ */
+int main(int argc, const char *argv[]) {
+    unsigned int iterations = 20;
+    if (argc > 1) {
+        iterations = (unsigned int)atoi(argv[1]);
+    }
+
+    printf("%-14s %-9s %-10s %12s %12s %8s\n", "operation", "format", "size", "scalar (us)", "simd (us)", "speedup");
+
+    int failures = 0;
+    for (const BenchOperation& op : kOperations) {
+        for (const BenchFormat& fmt : kFormats) {
+            for (const BenchSize& size : kSizes) {
+                unsigned int bpp = nv2a_blit_bytes_per_pixel(fmt.format);
+                unsigned int pitch = size.width * bpp;
+                std::vector<uint8_t> source(pitch * size.height);
+                std::vector<uint8_t> destScalar(pitch * size.height);
+                std::vector<uint8_t> destSimd(pitch * size.height);
+
+                uint32_t seed = 12345;
+                for (size_t i = 0; i < source.size(); i++) {
+                    seed = seed * 1103515245 + 12345;
+                    source[i] = seed >> 24;
+                    destScalar[i] = destSimd[i] = seed >> 16;
+                }
+
+                BlitParams params;
+                params.source = &source[0];
+                params.sourcePitch = pitch;
+                params.destPitch = pitch;
+                params.width = size.width;
+                params.height = size.height;
+                params.colorFormat = fmt.format;
+                params.operation = op.operation;
+                params.rop = 0x66; // S ^ D
+                params.beta1 = 0x40000000;
+                params.beta4 = 0x80C0A060;
+
+                // One pass on identical inputs for the correctness check
+                params.dest = &destScalar[0];
+                nv2a_blit_scalar(params);
+                params.dest = &destSimd[0];
+                nv2a_blit(params);
+                bool match = memcmp(&destScalar[0], &destSimd[0], destScalar.size()) == 0;
+                if (!match) {
+                    failures++;
+                }
+
+                params.dest = &destScalar[0];
+                double scalarTime = TimeBlits(nv2a_blit_scalar, params, iterations);
+                params.dest = &destSimd[0];
+                double simdTime = TimeBlits(nv2a_blit, params, iterations);
+
+                char sizeText[16];
+                snprintf(sizeText, sizeof(sizeText), "%ux%u", size.width, size.height);
+                printf("%-14s %-9s %-10s %12.1f %12.1f %7.2fx%s\n", op.name, fmt.name, sizeText,
+                    scalarTime, simdTime, scalarTime / simdTime, match ? "" : "  MISMATCH");
+            }
+        }
+    }
+
+    return failures ? 1 : 0;
+}
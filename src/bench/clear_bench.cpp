@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "openxbox/hw/nv2a/clear.h"
+
+using namespace openxbox;
+
+struct BenchSurface {
+    unsigned int width;
+    unsigned int height;
+    bool swizzled;
+};
+
+struct BenchPixel {
+    unsigned int bytesPerPixel;
+    uint32_t mask;
+    const char *name;
+};
+
+struct BenchRect {
+    bool full;
+    const char *name;
+};
+
+static const BenchSurface kSurfaces[] = {
+    { 64, 64, false }, { 640, 480, false }, { 1280, 720, false }, { 1920, 1080, false },
+    { 256, 256, true }, { 1024, 1024, true },
+};
+
+static const BenchPixel kPixels[] = {
+    { 1, 0xFF, "B8" },
+    { 2, 0xFFFF, "R5G6B5" },
+    { 4, 0xFFFFFFFF, "A8R8G8B8" },
+    { 4, 0xFFFFFF00, "Z24" },
+    { 4, 0x000000FF, "S8" },
+};
+
+static const BenchRect kRects[] = {
+    { true, "full" },
+    { false, "inset" },
+};
+
+// Same swizzle layout as the surface cache
+static void SwizzleMasks(uint32_t width, uint32_t height, uint32_t *maskX, uint32_t *maskY) {
+    uint32_t x = 0, y = 0;
+    uint32_t bit = 1, maskBit = 1;
+    bool done;
+    do {
+        done = true;
+        if (bit < width) { x |= maskBit; maskBit <<= 1; done = false; }
+        if (bit < height) { y |= maskBit; maskBit <<= 1; done = false; }
+        bit <<= 1;
+    } while (!done);
+    *maskX = x;
+    *maskY = y;
+}
+
+template <typename F>
+static double TimeClears(F clear, unsigned int iterations) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (unsigned int i = 0; i < iterations; i++) {
+        clear();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / iterations;
+}
+
+/*!
+ * Compares the vectorized and threaded NV097_CLEAR_SURFACE paths against
+ * the scalar reference over common render target sizes, and checks that all
+ * of them produce the same memory contents.
+ */
+int main(int argc, const char *argv[]) {
+    unsigned int iterations = 20;
+    if (argc > 1) {
+        iterations = (unsigned int)atoi(argv[1]);
+    }
+
+    int workers = -1;
+    if (argc > 2) {
+        workers = atoi(argv[2]);
+    }
+
+    ClearEngine engine(workers);
+    printf("clear workers: %u\n", engine.GetWorkerCount());
+    printf("%-9s %-10s %-6s %-6s %12s %12s %12s %8s\n", "format", "size", "layout", "rect", "scalar (us)", "simd (us)", "engine (us)", "speedup");
+
+    int failures = 0;
+    for (const BenchSurface& surf : kSurfaces) {
+        for (const BenchPixel& pixel : kPixels) {
+            for (const BenchRect& rect : kRects) {
+                ClearParams params;
+                params.bytesPerPixel = pixel.bytesPerPixel;
+                params.width = surf.width;
+                params.height = surf.height;
+                params.swizzled = surf.swizzled;
+                if (surf.swizzled) {
+                    SwizzleMasks(surf.width, surf.height, &params.swizzleMaskX, &params.swizzleMaskY);
+                }
+                else {
+                    // Leave some padding at the end of each line
+                    params.pitch = (surf.width * pixel.bytesPerPixel + 63) & ~63;
+                }
+                params.size = surf.swizzled ? surf.width * surf.height * pixel.bytesPerPixel : params.pitch * surf.height;
+                params.value = 0x89ABCDEF;
+                params.mask = pixel.mask;
+                if (rect.full) {
+                    params.xmax = surf.width;
+                    params.ymax = surf.height;
+                }
+                else {
+                    params.xmin = 3;
+                    params.ymin = 5;
+                    params.xmax = surf.width - 7;
+                    params.ymax = surf.height - 2;
+                }
+
+                std::vector<uint8_t> reference(params.size);
+                uint32_t seed = 12345;
+                for (size_t i = 0; i < reference.size(); i++) {
+                    seed = seed * 1103515245 + 12345;
+                    reference[i] = seed >> 24;
+                }
+                std::vector<uint8_t> simd(reference), threaded(reference);
+
+                // One pass on identical inputs for the correctness check
+                params.dest = &reference[0];
+                nv2a_clear_scalar(params);
+                params.dest = &simd[0];
+                nv2a_clear(params);
+                params.dest = &threaded[0];
+                engine.Clear(params);
+                bool match = reference == simd && reference == threaded;
+                if (!match) {
+                    failures++;
+                }
+
+                params.dest = &reference[0];
+                double scalarTime = TimeClears([&]() { nv2a_clear_scalar(params); }, iterations);
+                params.dest = &simd[0];
+                double simdTime = TimeClears([&]() { nv2a_clear(params); }, iterations);
+                params.dest = &threaded[0];
+                double engineTime = TimeClears([&]() { engine.Clear(params); }, iterations);
+
+                char sizeText[16];
+                snprintf(sizeText, sizeof(sizeText), "%ux%u", surf.width, surf.height);
+                printf("%-9s %-10s %-6s %-6s %12.1f %12.1f %12.1f %7.2fx%s\n", pixel.name, sizeText,
+                    surf.swizzled ? "swz" : "pitch", rect.name, scalarTime, simdTime, engineTime,
+                    scalarTime / engineTime, match ? "" : "  MISMATCH");
+            }
+        }
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include "openxbox/hw/audio/apu_defs.h"
+#include "openxbox/hw/audio/dsp.h"
+#include "openxbox/hw/audio/sink.h"
+
+using namespace openxbox;
+using namespace openxbox::hw::audio;
+
+// Registers used by the program, as numbered in instructions
+enum {
+    REG_X0 = 0x04,
+    REG_X1 = 0x05,
+    REG_Y0 = 0x06,
+    REG_A = 0x0E,
+    REG_B = 0x0F,
+    REG_R0 = 0x10,
+    REG_M0 = 0x20,
+};
+
+// Data ALU operations
+#define ALU_MOVE        0x00
+#define ALU_ADD_B_A     0x10
+#define ALU_CLR_B       0x1B
+#define ALU_ASR_A       0x22
+#define ALU_ASR_B       0x2A
+#define ALU_ADD_Y0_B    0x58
+#define ALU_TFR_X1_A    0x61
+#define ALU_MACR_Y0X0_A 0xD3
+
+// Effective addresses
+#define EA_IND(n)       (0x20 | (n))    // (Rn)
+#define EA_POSTINC(n)   (0x18 | (n))    // (Rn)+
+#define EA_IMMEDIATE    0x34
+
+// Comb filters of the reverb, in Y memory; each buffer is aligned to 512
+// words for modulo addressing
+static const uint32_t kCombLengths[] = { 307, 353, 419, 467 };
+#define COMB_COUNT      4
+#define COMB_ALIGN      512
+#define COMB_FEEDBACK   0.7
+
+// X memory layout
+#define DMA_BLOCK_ADDR  0x40
+#define OUTPUT_ADDR     0x100
+
+// Minimal assembler for the instructions the program needs
+class Program {
+public:
+    uint32_t Here() const { return (uint32_t)m_words.size(); }
+
+    void Emit(uint32_t op) { m_words.push_back(op); }
+    void Emit(uint32_t op, uint32_t ext) { m_words.push_back(op); m_words.push_back(ext & 0xFFFFFF); }
+    void Patch(uint32_t addr, uint32_t value) { m_words[addr] = value; }
+
+    // X:ea or Y:ea <-> D with a data ALU operation
+    void MoveMem(bool y, bool toReg, uint32_t ea, uint32_t reg, uint32_t alu = ALU_MOVE) {
+        Emit(0x404000 | ((reg & 0x18) << 17) | ((reg & 7) << 16) | (y ? 0x80000 : 0) | (toReg ? 0x8000 : 0) | (ea << 8) | alu);
+    }
+
+    // MOVE #xxxxxx,D
+    void MoveImm(uint32_t reg, uint32_t value) {
+        Emit(0x404000 | ((reg & 0x18) << 17) | ((reg & 7) << 16) | 0x8000 | (EA_IMMEDIATE << 8), value);
+    }
+
+    // MOVE S,D with a data ALU operation
+    void MoveReg(uint32_t src, uint32_t dst, uint32_t alu = ALU_MOVE) { Emit(0x200000 | (src << 13) | (dst << 8) | alu); }
+
+    // Data ALU operation without a move
+    void Alu(uint32_t alu) { Emit(0x200000 | alu); }
+
+    // MOVEC #xxxxxx,Mn
+    void MovecImm(uint32_t ctrl, uint32_t value) { Emit(0x05C020 | (EA_IMMEDIATE << 8) | (ctrl & 0x1F), value); }
+
+    // MOVEP #xxxxxx,X:pp
+    void MovepImm(uint32_t addr, uint32_t value) { Emit(0x08C080 | (EA_IMMEDIATE << 8) | (addr & 0x3F), value); }
+
+    // DO #count,end; returns the address of the extension word to patch
+    uint32_t Do(uint32_t count) {
+        Emit(0x060080 | ((count & 0xFF) << 8) | ((count >> 8) & 0xF), 0);
+        return Here() - 1;
+    }
+
+    void Jmp(uint32_t addr) { Emit(0x0C0000 | (addr & 0xFFF)); }
+    void Wait() { Emit(0x000086); }
+
+    const std::vector<uint32_t>& Words() const { return m_words; }
+
+private:
+    std::vector<uint32_t> m_words;
+};
+
+static uint32_t toFraction(double value) {
+    return (uint32_t)(int32_t)lround(value * 8388608.0) & 0xFFFFFF;
+}
+
+/*!
+ * Builds a reverb made of four feedback comb filters in parallel. Every
+ * frame, the program mixes the first two mixbins down to mono, runs the
+ * combs over the 32 samples, writes the averaged result to both channels and
+ * sends the frame to output FIFO 0 with the DMA controller.
+ */
+static Program BuildReverb() {
+    Program p;
+    for (int k = 0; k < COMB_COUNT; k++) {
+        p.MoveImm(REG_R0 + 4 + k, k * COMB_ALIGN);
+        p.MovecImm(REG_M0 + 4 + k, kCombLengths[k] - 1);
+    }
+    p.MoveImm(REG_X0, toFraction(COMB_FEEDBACK));
+
+    uint32_t frame = p.Here();
+    p.MoveImm(REG_R0 + 0, NV_PAPU_GP_MIXBUF_BASE);
+    p.MoveImm(REG_R0 + 1, NV_PAPU_GP_MIXBUF_BASE + NV_PAPU_FRAME_SAMPLES);
+    p.MoveImm(REG_R0 + 2, OUTPUT_ADDR);
+    uint32_t loopEnd = p.Do(NV_PAPU_FRAME_SAMPLES);
+    {
+        // x1 = (left + right) / 2
+        p.MoveMem(false, true, EA_POSTINC(0), REG_A);
+        p.MoveMem(false, true, EA_POSTINC(1), REG_B);
+        p.Alu(ALU_ADD_B_A);
+        p.Alu(ALU_ASR_A);
+        p.MoveReg(REG_A, REG_X1, ALU_CLR_B);
+
+        // b += delayed; delayed = input + feedback * delayed
+        for (int k = 0; k < COMB_COUNT; k++) {
+            p.MoveMem(true, true, EA_IND(4 + k), REG_Y0, ALU_TFR_X1_A);
+            p.Alu(ALU_ADD_Y0_B);
+            p.Alu(ALU_MACR_Y0X0_A);
+            p.MoveMem(true, false, EA_POSTINC(4 + k), REG_A);
+        }
+
+        p.Alu(ALU_ASR_B);
+        p.Alu(ALU_ASR_B);
+        p.MoveMem(false, false, EA_POSTINC(2), REG_B);
+        p.MoveMem(false, false, EA_POSTINC(2), REG_B);
+    }
+    p.Patch(loopEnd, p.Here() - 1);
+
+    p.MovepImm(DSP_DMA_NEXT_BLOCK, DMA_BLOCK_ADDR);
+    p.MovepImm(DSP_DMA_CONTROL, DSP_DMA_CONTROL_ACTION_START);
+    p.Wait();
+    p.Jmp(frame);
+    return p;
+}
+
+/*!
+ * The same reverb in floating point, for checking the output of the DSP.
+ */
+class ReferenceReverb {
+public:
+    ReferenceReverb() {
+        for (int k = 0; k < COMB_COUNT; k++) {
+            m_combs[k].assign(kCombLengths[k], 0.0);
+            m_pos[k] = 0;
+        }
+    }
+
+    double Process(double left, double right) {
+        double input = (left + right) / 2;
+        double output = 0;
+        for (int k = 0; k < COMB_COUNT; k++) {
+            double delayed = m_combs[k][m_pos[k]];
+            output += delayed;
+            m_combs[k][m_pos[k]] = input + COMB_FEEDBACK * delayed;
+            m_pos[k] = (m_pos[k] + 1) % kCombLengths[k];
+        }
+        return output / 4;
+    }
+
+private:
+    std::vector<double> m_combs[COMB_COUNT];
+    uint32_t m_pos[COMB_COUNT];
+};
+
+/*!
+ * Runs a reference reverb program on a GP-sized DSP56300 the way the APU
+ * does every frame: the mixbins are copied into X memory, the program runs
+ * for the frame and the output FIFO is drained. Reports the throughput, the
+ * share of the 160 MHz cycle budget used, and the largest difference from a
+ * floating point model of the same reverb. The output can be written to a
+ * WAV file for inspection.
+ *
+ * Usage: apu-dsp-bench [frames [output.wav]]
+ */
+int main(int argc, const char *argv[]) {
+    uint32_t frameCount = 15000;
+    if (argc > 1) {
+        frameCount = (uint32_t)atoi(argv[1]);
+    }
+
+    const double realTimeFrames = (double)NV_PAPU_SAMPLE_RATE / NV_PAPU_FRAME_SAMPLES;
+    const uint32_t cycleBudget = NV_PAPU_DSP_CLOCK / NV_PAPU_SAMPLE_RATE * NV_PAPU_FRAME_SAMPLES;
+
+    std::vector<uint8_t> ram(NV_PAPU_PAGE_SIZE);
+    uint32_t sgeAddr = 0;
+    uint32_t sgeMax = 0;
+    DSP56300 *dsp = new DSP56300("GP", NV_PAPU_GP_XMEM_SIZE, NV_PAPU_GP_YMEM_SIZE, NV_PAPU_GP_PMEM_SIZE,
+        &ram[0], (uint32_t)ram.size(), &sgeAddr, &sgeMax);
+
+    Program program = BuildReverb();
+    for (uint32_t i = 0; i < program.Words().size(); i++) {
+        dsp->WriteMemory(DSP_SpaceP, i, program.Words()[i]);
+    }
+
+    // The block that sends the output to FIFO 0
+    dsp->WriteMemory(DSP_SpaceX, DMA_BLOCK_ADDR + DSP_DMA_BLOCK_NEXT, DSP_DMA_BLOCK_NEXT_EOL);
+    dsp->WriteMemory(DSP_SpaceX, DMA_BLOCK_ADDR + DSP_DMA_BLOCK_CONTROL,
+        DSP_DMA_BLOCK_CONTROL_TO_MEMORY | (DSP_DMA_FORMAT_24BIT << 10));
+    dsp->WriteMemory(DSP_SpaceX, DMA_BLOCK_ADDR + DSP_DMA_BLOCK_COUNT, NV_PAPU_FRAME_SAMPLES * 2);
+    dsp->WriteMemory(DSP_SpaceX, DMA_BLOCK_ADDR + DSP_DMA_BLOCK_DSP_OFFSET, OUTPUT_ADDR);
+
+    AudioSink *sink = nullptr;
+    if (argc > 2) {
+        sink = new WavAudioSink(argv[2]);
+        if (!sink->Start(NV_PAPU_SAMPLE_RATE, 2)) {
+            fprintf(stderr, "Could not open the audio output\n");
+            delete sink;
+            delete dsp;
+            return 1;
+        }
+    }
+
+    ReferenceReverb reference;
+    std::deque<uint32_t>& fifo = dsp->GetOutputFIFO(0);
+    int16_t output[NV_PAPU_FRAME_SAMPLES * 2];
+    uint64_t cycles = 0;
+    int maxError = 0;
+    uint64_t samples = 0;
+    std::chrono::high_resolution_clock::duration elapsed(0);
+    for (uint32_t frame = 0; frame < frameCount; frame++) {
+        // Two tones with a burst every second to excite the combs
+        int32_t left[NV_PAPU_FRAME_SAMPLES];
+        int32_t right[NV_PAPU_FRAME_SAMPLES];
+        for (uint32_t i = 0; i < NV_PAPU_FRAME_SAMPLES; i++) {
+            uint32_t t = frame * NV_PAPU_FRAME_SAMPLES + i;
+            double burst = ((t % NV_PAPU_SAMPLE_RATE) < 2400) ? 1.0 : 0.25;
+            left[i] = (int32_t)(sin(t * 2 * 3.14159265 * 440 / NV_PAPU_SAMPLE_RATE) * 6000 * burst) * 256;
+            right[i] = (int32_t)(sin(t * 2 * 3.14159265 * 660 / NV_PAPU_SAMPLE_RATE) * 5000 * burst) * 256;
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (uint32_t bin = 0; bin < NV_PAPU_MIXBINS; bin++) {
+            const int32_t *src = (bin == 0) ? left : (bin == 1) ? right : nullptr;
+            for (uint32_t i = 0; i < NV_PAPU_FRAME_SAMPLES; i++) {
+                dsp->WriteMemory(DSP_SpaceX, NV_PAPU_GP_MIXBUF_BASE + bin * NV_PAPU_FRAME_SAMPLES + i, src ? (uint32_t)src[i] : 0);
+            }
+        }
+        cycles += dsp->RunFrame(cycleBudget);
+        for (uint32_t i = 0; i < NV_PAPU_FRAME_SAMPLES * 2; i++) {
+            int32_t sample = 0;
+            if (!fifo.empty()) {
+                sample = (int32_t)(fifo.front() << 8) >> 16;
+                fifo.pop_front();
+            }
+            output[i] = (int16_t)sample;
+        }
+        elapsed += std::chrono::high_resolution_clock::now() - start;
+
+        for (uint32_t i = 0; i < NV_PAPU_FRAME_SAMPLES; i++) {
+            double expected = reference.Process(left[i] / 8388608.0, right[i] / 8388608.0) * 32768.0;
+            for (int ch = 0; ch < 2; ch++) {
+                int error = abs(output[i * 2 + ch] - (int)lround(expected));
+                if (error > maxError) {
+                    maxError = error;
+                }
+            }
+            samples++;
+        }
+
+        if (sink != nullptr) {
+            while (sink->GetFreeFrames() < NV_PAPU_FRAME_SAMPLES) {
+                std::this_thread::yield();
+            }
+            sink->Write(output, NV_PAPU_FRAME_SAMPLES);
+        }
+    }
+    if (sink != nullptr) {
+        sink->Stop();
+        delete sink;
+    }
+
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    double framesPerSec = frameCount / seconds;
+    double cyclesPerFrame = (double)cycles / frameCount;
+    printf("%-20s %12s %10s %14s %10s\n", "test", "frames/s", "realtime", "cycles/frame", "budget");
+    printf("%-20s %12.0f %9.1fx %14.0f %9.1f%%\n", "reverb", framesPerSec, framesPerSec / realTimeFrames,
+        cyclesPerFrame, cyclesPerFrame * 100 / cycleBudget);
+    printf("%.1f M DSP cycles/s emulated, %llu samples, max error %d LSB\n",
+        cycles / seconds / 1000000.0, (unsigned long long)samples, maxError);
+
+    delete dsp;
+    return (maxError <= 4) ? 0 : 1;
+}
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "openxbox/hw/ata/drvs/drv_compressed_image_hd.h"
+#include "openxbox/hw/ata/drvs/drv_raw_image_hd.h"
+
+using namespace openxbox::hw::ata;
+
+// Sequential reads use the largest transfer of a READ MULTIPLE or DMA
+// command issued by the Xbox kernel; random reads are single 4 KiB clusters
+static const uint32_t kSequentialSectors = 256;
+static const uint32_t kRandomSectors = 8;
+
+struct Result {
+    double sequentialMBps;
+    double randomIOPS;
+};
+
+static Result Measure(IATADeviceDriver& drive, uint64_t sectorLimit, unsigned int randomReads, std::vector<uint8_t>& scratch) {
+    Result result;
+    uint64_t sectors = std::min(drive.GetSectorCount(), sectorLimit);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (uint64_t lba = 0; lba + kSequentialSectors <= sectors; lba += kSequentialSectors) {
+        drive.ReadSectors(lba, &scratch[0], kSequentialSectors);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    result.sequentialMBps = (sectors / kSequentialSectors) * kSequentialSectors * kSectorSize / std::chrono::duration<double>(end - start).count() / 1e6;
+
+    uint32_t seed = 12345;
+    start = std::chrono::high_resolution_clock::now();
+    for (unsigned int i = 0; i < randomReads; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint64_t lba = ((uint64_t)seed * (sectors / kRandomSectors) >> 32) * kRandomSectors;
+        drive.ReadSectors(lba, &scratch[0], kRandomSectors);
+    }
+    end = std::chrono::high_resolution_clock::now();
+    result.randomIOPS = randomReads / std::chrono::duration<double>(end - start).count();
+    return result;
+}
+
+/*!
+ * Compares the sector throughput of a raw image and the compressed image
+ * made from it, reading through the hard drive drivers, and checks that
+ * both images contain the same data. For meaningful sequential numbers,
+ * drop the host page cache between runs or use images larger than RAM.
+ */
+int main(int argc, const char *argv[]) {
+    if (argc < 3) {
+        printf("usage: ata-image-bench raw_image compressed_image [max_mb] [random_reads]\n");
+        return 1;
+    }
+    uint64_t sectorLimit = ~0ull;
+    if (argc > 3) {
+        sectorLimit = strtoull(argv[3], nullptr, 0) * 1024 * 1024 / kSectorSize;
+    }
+    unsigned int randomReads = 20000;
+    if (argc > 4) {
+        randomReads = (unsigned int)atoi(argv[4]);
+    }
+
+    RawImageHardDriveATADeviceDriver raw;
+    if (!raw.Open(argv[1], 0, true)) {
+        return 1;
+    }
+    CompressedImageHardDriveATADeviceDriver compressed;
+    if (!compressed.Open(argv[2])) {
+        return 1;
+    }
+    if (raw.GetSectorCount() != compressed.GetSectorCount()) {
+        printf("images have different sizes\n");
+        return 1;
+    }
+
+    // Verify the contents first; this also warms up the host page cache for
+    // both files so that neither side is penalized by cold reads
+    std::vector<uint8_t> rawData(kSequentialSectors * kSectorSize), compressedData(kSequentialSectors * kSectorSize);
+    uint64_t sectors = std::min(raw.GetSectorCount(), sectorLimit);
+    for (uint64_t lba = 0; lba < sectors; lba += kSequentialSectors) {
+        uint32_t count = (uint32_t)std::min<uint64_t>(kSequentialSectors, sectors - lba);
+        if (!raw.ReadSectors(lba, &rawData[0], count) || !compressed.ReadSectors(lba, &compressedData[0], count)
+            || memcmp(&rawData[0], &compressedData[0], count * kSectorSize) != 0) {
+            printf("images differ at LBA %llu\n", (unsigned long long)lba);
+            return 1;
+        }
+    }
+
+    // Measure the compressed image with a fresh cache
+    compressed.Open(argv[2]);
+    Result rawResult = Measure(raw, sectorLimit, randomReads, rawData);
+    Result compressedResult = Measure(compressed, sectorLimit, randomReads, compressedData);
+    BlockCacheStats stats = compressed.GetCacheStats();
+
+    printf("%-12s %16s %16s\n", "image", "sequential MB/s", "random 4K IOPS");
+    printf("%-12s %16.1f %16.0f\n", "raw", rawResult.sequentialMBps, rawResult.randomIOPS);
+    printf("%-12s %16.1f %16.0f\n", "compressed", compressedResult.sequentialMBps, compressedResult.randomIOPS);
+    printf("cache: %llu hits, %llu readahead hits, %llu misses, %llu chunks prefetched\n", (unsigned long long)stats.hits,
+        (unsigned long long)stats.readaheadHits, (unsigned long long)stats.misses, (unsigned long long)stats.prefetched);
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "openxbox/hw/ata/drvs/compressed_image.h"
+
+using namespace openxbox::hw::ata;
+
+static void PrintUsage() {
+    printf("usage: ata-image-convert [-c chunk_size] [-t threads] input output\n");
+    printf("       ata-image-convert -d input output\n");
+    printf("\n");
+    printf("Converts a raw disk or XISO image into a compressed image, or back with -d.\n");
+    printf("  -c chunk_size   size of the compressed chunks in bytes (default %u)\n", kDefaultCompressedChunkSize);
+    printf("  -t threads      number of compression threads (default: all cores)\n");
+}
+
+static int Compress(const char *inputPath, const char *outputPath, uint32_t chunkSize, unsigned int threads) {
+    FILE *input = fopen(inputPath, "rb");
+    if (input == nullptr) {
+        fprintf(stderr, "Could not open %s\n", inputPath);
+        return 1;
+    }
+
+    CompressedImageWriter writer;
+    if (!writer.Create(outputPath, chunkSize, threads)) {
+        fclose(input);
+        return 1;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<uint8_t> buffer(4 * 1024 * 1024);
+    size_t length;
+    bool ok = true;
+    while (ok && (length = fread(&buffer[0], 1, buffer.size(), input)) > 0) {
+        ok = writer.Write(&buffer[0], length);
+    }
+    ok = ok && !ferror(input) && writer.Finish();
+    fclose(input);
+    if (!ok) {
+        fprintf(stderr, "Could not convert %s\n", inputPath);
+        return 1;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    printf("%llu bytes -> %llu bytes (%.1f%%) in %.2f s, %.1f MB/s\n", (unsigned long long)writer.GetImageSize(), (unsigned long long)writer.GetFileSize(),
+        writer.GetImageSize() ? writer.GetFileSize() * 100.0 / writer.GetImageSize() : 100.0, seconds, writer.GetImageSize() / seconds / 1e6);
+    return 0;
+}
+
+static int Decompress(const char *inputPath, const char *outputPath) {
+    CompressedImage image;
+    if (!image.Open(inputPath)) {
+        return 1;
+    }
+    FILE *output = fopen(outputPath, "wb");
+    if (output == nullptr) {
+        fprintf(stderr, "Could not create %s\n", outputPath);
+        return 1;
+    }
+
+    std::vector<uint8_t> chunk(image.GetChunkSize());
+    uint64_t remaining = image.GetSize();
+    for (uint64_t i = 0; i < image.GetChunkCount(); i++) {
+        size_t length = (size_t)std::min<uint64_t>(remaining, chunk.size());
+        if (!image.ReadChunk(i, &chunk[0]) || fwrite(&chunk[0], 1, length, output) != length) {
+            fprintf(stderr, "Could not decompress chunk %llu\n", (unsigned long long)i);
+            fclose(output);
+            return 1;
+        }
+        remaining -= length;
+    }
+    fclose(output);
+    return 0;
+}
+
+/*!
+ * Converts disk and XISO images to and from the compressed image format.
+ */
+int main(int argc, const char *argv[]) {
+    uint32_t chunkSize = kDefaultCompressedChunkSize;
+    unsigned int threads = std::max(std::thread::hardware_concurrency(), 1u);
+    bool decompress = false;
+
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-d") == 0) {
+            decompress = true;
+        }
+        else if (strcmp(argv[arg], "-c") == 0 && arg + 1 < argc) {
+            chunkSize = (uint32_t)strtoul(argv[++arg], nullptr, 0);
+        }
+        else if (strcmp(argv[arg], "-t") == 0 && arg + 1 < argc) {
+            threads = (unsigned int)atoi(argv[++arg]);
+        }
+        else {
+            PrintUsage();
+            return 1;
+        }
+    }
+    if (argc - arg != 2) {
+        PrintUsage();
+        return 1;
+    }
+
+    return decompress ? Decompress(argv[arg], argv[arg + 1]) : Compress(argv[arg], argv[arg + 1], chunkSize, threads);
+}
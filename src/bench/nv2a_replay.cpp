@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#include "openxbox/hw/pci/nv2a.h"
+#include "openxbox/hw/nv2a/trace.h"
+
+using namespace openxbox;
+
+// PGRAPH raises interrupts while executing some methods; there is no CPU to
+// deliver them to, so they are simply counted.
+class ReplayIRQHandler : public IRQHandler {
+public:
+    void HandleIRQ(uint8_t irqNum, bool level) override {
+        if (level) {
+            m_count++;
+        }
+    }
+
+    uint64_t m_count = 0;
+};
+
+/*!
+ * Replays an NV2A pushbuffer trace captured by the emulator against a
+ * standalone NV2A device, without a CPU module or the rest of the system.
+ *
+ * Traces assume they start with zeroed memory and a freshly reset GPU, so
+ * every iteration replays against a new device. The profile, if requested,
+ * covers the first iteration.
+ */
+int main(int argc, const char *argv[]) {
+    if (argc < 2) {
+        printf("usage: %s <trace file> [iterations] [profile.csv|profile.json]\n", argv[0]);
+        return 1;
+    }
+
+    unsigned int iterations = 1;
+    if (argc > 2) {
+        iterations = (unsigned int)atoi(argv[2]);
+    }
+
+    NV2ATraceReader reader;
+    if (!reader.Open(argv[1])) {
+        printf("Could not open trace %s\n", argv[1]);
+        return 1;
+    }
+
+    const NV2ATraceHeader *header = reader.GetHeader();
+    uint8_t *ram = (uint8_t *)calloc(header->ramSize, 1);
+    if (ram == nullptr) {
+        printf("Could not allocate %u bytes of RAM\n", header->ramSize);
+        return 1;
+    }
+
+    ReplayIRQHandler irqHandler;
+    printf("%-10s %12s %12s %14s\n", "iteration", "methods", "time (ms)", "methods/sec");
+
+    uint64_t totalMethods = 0;
+    double totalTime = 0.0;
+    uint64_t surfaceHits = 0, surfaceMisses = 0, surfaceConversions = 0, surfaceSkippedUploads = 0;
+    for (unsigned int i = 0; i < iterations; i++) {
+        memset(ram, 0, header->ramSize);
+        NV2ADevice *nv2a = new NV2ADevice(0x10DE, 0x02A0, 0xA1, ram, header->ramSize, &irqHandler);
+        if (i == 0 && argc > 3 && !nv2a->StartProfile(argv[3])) {
+            printf("Could not create profile %s\n", argv[3]);
+            delete nv2a;
+            free(ram);
+            return 1;
+        }
+        nv2a->Init();
+        reader.Rewind();
+
+        auto start = std::chrono::high_resolution_clock::now();
+        uint64_t methods = nv2a->ReplayTrace(reader);
+        auto end = std::chrono::high_resolution_clock::now();
+        double time = std::chrono::duration<double, std::milli>(end - start).count();
+
+        printf("%-10u %12llu %12.2f %14.0f\n", i, (unsigned long long)methods, time, methods * 1000.0 / time);
+        totalMethods += methods;
+        totalTime += time;
+
+        const SurfaceManager& surfaces = nv2a->GetSurfaces();
+        surfaceHits += surfaces.GetHits();
+        surfaceMisses += surfaces.GetMisses();
+        surfaceConversions += surfaces.GetConversions();
+        surfaceSkippedUploads += surfaces.GetSkippedUploads();
+        delete nv2a;
+    }
+
+    printf("total      %12llu %12.2f %14.0f\n", (unsigned long long)totalMethods, totalTime, totalMethods * 1000.0 / totalTime);
+    printf("interrupts raised: %llu\n", (unsigned long long)irqHandler.m_count);
+
+    printf("surfaces: %llu hits, %llu misses, %llu conversions, %llu skipped uploads\n",
+        (unsigned long long)surfaceHits, (unsigned long long)surfaceMisses,
+        (unsigned long long)surfaceConversions, (unsigned long long)surfaceSkippedUploads);
+
+    free(ram);
+    return 0;
+}
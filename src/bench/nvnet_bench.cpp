@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "openxbox/hw/pci/nvnet.h"
+#include "openxbox/hw/net/net_loopback.h"
+
+using namespace openxbox;
+
+// Guest memory layout
+#define RAM_SIZE        (4 * 1024 * 1024)
+#define TX_RING_ADDR    0x1000
+#define RX_RING_ADDR    0x2000
+#define TX_BUFFERS_ADDR 0x10000
+#define RX_BUFFERS_ADDR 0x100000
+#define RING_SIZE       64
+#define BUFFER_SIZE     2048
+
+// Registers and descriptor bits used by the simulated driver
+#define REG_IRQ_STATUS   0x000
+#define REG_IRQ_MASK     0x004
+#define REG_TX_RING      0x100
+#define REG_RX_RING      0x104
+#define REG_RING_SIZES   0x108
+#define REG_TXRX_CONTROL 0x144
+#define IRQ_RX           0x0002
+#define IRQ_TX           0x0010
+#define TX_VALID         0x8000
+#define TX_LASTPACKET    0x0001
+#define RX_AVAIL         0x8000
+
+struct Desc {
+    uint32_t buffer;
+    uint16_t length;
+    uint16_t flags;
+};
+
+struct BenchConfig {
+    uint32_t coalesceFrames;
+    uint32_t coalesceMicros;
+};
+
+static const BenchConfig kConfigs[] = {
+    { 0, 0 }, { 4, 50 }, { 8, 100 }, { 32, 250 },
+};
+
+static const uint32_t kFrameSizes[] = { 64, 512, 1514 };
+
+class BenchIRQHandler : public IRQHandler {
+public:
+    void HandleIRQ(uint8_t irqNum, bool level) override {
+        m_level = level;
+    }
+    std::atomic<bool> m_level{ false };
+};
+
+/*!
+ * Simulates a driver that keeps a window of frames in flight through the
+ * loopback backend, servicing both rings from its interrupt handler.
+ */
+class BenchGuest {
+public:
+    BenchGuest(const BenchConfig& config)
+        : m_ram(RAM_SIZE)
+        , m_nvnet(0x10DE, 0x01C3, 0xD2, &m_ram[0], RAM_SIZE, &m_irq)
+    {
+        m_nvnet.Init();
+        m_nvnet.Reset();
+        m_nvnet.SetInterruptCoalescing(config.coalesceFrames, std::chrono::microseconds(config.coalesceMicros));
+        Write(REG_IRQ_MASK, IRQ_RX | IRQ_TX);
+        Write(REG_TX_RING, TX_RING_ADDR);
+        Write(REG_RX_RING, RX_RING_ADDR);
+        Write(REG_RING_SIZES, ((RING_SIZE - 1) << 16) | (RING_SIZE - 1));
+        for (uint32_t i = 0; i < RING_SIZE; i++) {
+            Desc *desc = RxDesc(i);
+            desc->buffer = RX_BUFFERS_ADDR + i * BUFFER_SIZE;
+            desc->length = BUFFER_SIZE;
+            desc->flags = RX_AVAIL;
+        }
+        m_nvnet.SetBackend(&m_loopback);
+    }
+
+    ~BenchGuest() {
+        m_nvnet.SetBackend(nullptr);
+    }
+
+    // Transmits frames one at a time, kicking the controller for each, and
+    // runs the interrupt handler whenever the interrupt line is asserted.
+    // Returns false if the frames did not make it through.
+    bool Run(uint32_t frameSize, uint32_t frameCount) {
+        const uint32_t window = RING_SIZE * 3 / 4;
+        uint32_t sent = 0, received = 0, reclaimed = 0;
+        while (received < frameCount) {
+            if (sent < frameCount && sent - reclaimed < RING_SIZE && sent - received < window) {
+                Desc *desc = TxDesc(sent % RING_SIZE);
+                desc->buffer = TX_BUFFERS_ADDR + (sent % RING_SIZE) * BUFFER_SIZE;
+                memset(&m_ram[desc->buffer], 0xFF, 12);
+                memcpy(&m_ram[desc->buffer + 12], &sent, sizeof(sent));
+                desc->length = frameSize - 1;
+                desc->flags = TX_VALID | TX_LASTPACKET;
+                sent++;
+                Write(REG_TXRX_CONTROL, 1);
+            }
+            else {
+                // Out of room; wait for the interrupt
+                auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+                while (!m_irq.m_level) {
+                    if (std::chrono::steady_clock::now() > deadline) {
+                        return false;
+                    }
+                    std::this_thread::yield();
+                }
+            }
+            if (!m_irq.m_level) {
+                continue;
+            }
+
+            // Interrupt handler: acknowledge, then service both rings
+            Write(REG_IRQ_STATUS, Read(REG_IRQ_STATUS));
+            while (reclaimed < sent && !(TxDesc(reclaimed % RING_SIZE)->flags & TX_VALID)) {
+                reclaimed++;
+            }
+            for (;;) {
+                Desc *desc = RxDesc(received % RING_SIZE);
+                if (desc->flags & RX_AVAIL) {
+                    break;
+                }
+                uint32_t seq;
+                memcpy(&seq, &m_ram[desc->buffer + 12], sizeof(seq));
+                if (desc->length != frameSize || seq != received) {
+                    return false;
+                }
+                desc->length = BUFFER_SIZE;
+                desc->flags = RX_AVAIL;
+                received++;
+            }
+        }
+        return true;
+    }
+
+    NVNetStats GetStats() { return m_nvnet.GetStats(); }
+
+private:
+    Desc *TxDesc(uint32_t index) { return (Desc *)&m_ram[TX_RING_ADDR + index * sizeof(Desc)]; }
+    Desc *RxDesc(uint32_t index) { return (Desc *)&m_ram[RX_RING_ADDR + index * sizeof(Desc)]; }
+
+    uint32_t Read(uint32_t reg) {
+        uint32_t value;
+        m_nvnet.PCIMMIORead(0, reg, &value, 4);
+        return value;
+    }
+
+    void Write(uint32_t reg, uint32_t value) {
+        m_nvnet.PCIMMIOWrite(0, reg, value, 4);
+    }
+
+    std::vector<uint8_t> m_ram;
+    BenchIRQHandler m_irq;
+    NVNetDevice m_nvnet;
+    hw::net::LoopbackNetBackend m_loopback;
+};
+
+/*!
+ * Measures NVNet throughput and interrupt rate through the loopback backend
+ * with different interrupt moderation settings.
+ */
+int main(int argc, const char *argv[]) {
+    uint32_t frameCount = 200000;
+    if (argc > 1) {
+        frameCount = (uint32_t)atoi(argv[1]);
+    }
+
+    printf("%-12s %6s %12s %10s %10s %12s %8s\n", "coalescing", "size", "frames/s", "MB/s", "IRQs/s", "frames/IRQ", "drops");
+
+    int failures = 0;
+    for (const BenchConfig& config : kConfigs) {
+        for (uint32_t frameSize : kFrameSizes) {
+            BenchGuest guest(config);
+            auto start = std::chrono::high_resolution_clock::now();
+            bool ok = guest.Run(frameSize, frameCount);
+            auto end = std::chrono::high_resolution_clock::now();
+            double seconds = std::chrono::duration<double>(end - start).count();
+            if (!ok) {
+                failures++;
+            }
+
+            NVNetStats stats = guest.GetStats();
+            char configText[32];
+            if (config.coalesceFrames > 1 && config.coalesceMicros > 0) {
+                snprintf(configText, sizeof(configText), "%u/%uus", config.coalesceFrames, config.coalesceMicros);
+            }
+            else {
+                snprintf(configText, sizeof(configText), "off");
+            }
+            printf("%-12s %6u %12.0f %10.1f %10.0f %12.2f %8llu%s\n", configText, frameSize,
+                stats.rxFrames / seconds, stats.rxBytes / seconds / (1024 * 1024), stats.irqs / seconds,
+                stats.irqs ? (double)stats.rxFrames / stats.irqs : 0.0,
+                (unsigned long long)(stats.txDrops + stats.rxDrops), ok ? "" : "  FAILED");
+        }
+    }
+
+    return failures ? 1 : 0;
+}
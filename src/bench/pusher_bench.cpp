@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "openxbox/hw/pci/nv2a.h"
+#include "openxbox/hw/nv2a/nv2a_int.h"
+
+using namespace openxbox;
+
+class BenchIRQHandler : public IRQHandler {
+public:
+    void HandleIRQ(uint8_t irqNum, bool level) override {}
+};
+
+static const uint32_t kDMAObjectInstance = 0x1000;  // in RAMIN
+static const uint32_t kPushbufferAddress = 0x100000; // in RAM
+static const unsigned int kMethodsPerCommand = 32;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+// CPU time consumed by the calling thread, in microseconds. Unlike wall
+// time, this is not inflated by other threads preempting the vCPU thread.
+static double ThreadCPUTime() {
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+    uint64_t k = ((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+    uint64_t u = ((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime;
+    return (k + u) / 10.0;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+#endif
+}
+
+static void PrintStats(const char *name, std::vector<double>& times) {
+    std::sort(times.begin(), times.end());
+    double total = 0.0;
+    for (double time : times) {
+        total += time;
+    }
+    printf("%-22s %10.2f %10.2f %10.2f\n", name, total / times.size(),
+        times[times.size() / 2], times[times.size() * 99 / 100]);
+}
+
+/*!
+ * Measures how long the vCPU is held up by NV_USER_DMA_PUT doorbell writes,
+ * and how long it takes for the DMA pusher to drain the submitted commands.
+ *
+ * The puller is left disabled so that only the pusher is measured.
+ */
+int main(int argc, const char *argv[]) {
+    unsigned int doorbells = 256;
+    unsigned int commandsPerDoorbell = 128;
+    if (argc > 1) {
+        doorbells = (unsigned int)atoi(argv[1]);
+    }
+    if (argc > 2) {
+        commandsPerDoorbell = (unsigned int)atoi(argv[2]);
+    }
+
+    const uint32_t ramSize = 64 * 1024 * 1024;
+    const uint32_t doorbellSize = commandsPerDoorbell * (kMethodsPerCommand + 1) * 4;
+    uint8_t *ram = (uint8_t *)calloc(ramSize, 1);
+
+    // Fill the pushbuffer with increasing method commands followed by their
+    // parameters. Each doorbell replays the same stretch of the pushbuffer.
+    uint32_t *pb = (uint32_t *)(ram + kPushbufferAddress);
+    for (unsigned int i = 0; i < commandsPerDoorbell; i++) {
+        *pb++ = (kMethodsPerCommand << 18) | (0 << 13) | 0x100;
+        for (unsigned int j = 0; j < kMethodsPerCommand; j++) {
+            *pb++ = i * kMethodsPerCommand + j;
+        }
+    }
+
+    BenchIRQHandler irqHandler;
+    NV2ADevice *nv2a = new NV2ADevice(0x10DE, 0x02A0, 0xA1, ram, ramSize, &irqHandler);
+    nv2a->Init();
+
+    // DMA object covering the pushbuffer
+    nv2a->PCIMMIOWrite(0, NV_PRAMIN_ADDR + kDMAObjectInstance + 0, NV_DMA_TARGET_AGP | 0x3D, 4);
+    nv2a->PCIMMIOWrite(0, NV_PRAMIN_ADDR + kDMAObjectInstance + 4, kPushbufferAddress + doorbellSize, 4);
+    nv2a->PCIMMIOWrite(0, NV_PRAMIN_ADDR + kDMAObjectInstance + 8, kPushbufferAddress, 4);
+
+    // Put channel 0 in DMA mode and enable the pusher
+    nv2a->PCIMMIOWrite(0, NV_PFIFO_ADDR + NV_PFIFO_MODE, 1, 4);
+    nv2a->PCIMMIOWrite(0, NV_PFIFO_ADDR + NV_PFIFO_CACHE1_PUSH1, NV_PFIFO_CACHE1_PUSH1_MODE, 4);
+    nv2a->PCIMMIOWrite(0, NV_PFIFO_ADDR + NV_PFIFO_CACHE1_DMA_INSTANCE, kDMAObjectInstance >> 4, 4);
+    nv2a->PCIMMIOWrite(0, NV_PFIFO_ADDR + NV_PFIFO_CACHE1_DMA_PUSH, NV_PFIFO_CACHE1_DMA_PUSH_ACCESS, 4);
+    nv2a->PCIMMIOWrite(0, NV_PFIFO_ADDR + NV_PFIFO_CACHE1_PUSH0, NV_PFIFO_CACHE1_PUSH0_ACCESS, 4);
+
+    std::vector<double> writeCPUTimes;
+    std::vector<double> writeTimes;
+    std::vector<double> drainTimes;
+    for (unsigned int i = 0; i < doorbells; i++) {
+        nv2a->PCIMMIOWrite(0, NV_USER_ADDR + NV_USER_DMA_GET, 0, 4);
+
+        double cpuStart = ThreadCPUTime();
+        auto start = Clock::now();
+        nv2a->PCIMMIOWrite(0, NV_USER_ADDR + NV_USER_DMA_PUT, doorbellSize, 4);
+        auto written = Clock::now();
+        double cpuWritten = ThreadCPUTime();
+
+        uint32_t get;
+        do {
+            nv2a->PCIMMIORead(0, NV_USER_ADDR + NV_USER_DMA_GET, &get, 4);
+        } while (get != doorbellSize);
+        auto drained = Clock::now();
+
+        writeCPUTimes.push_back(cpuWritten - cpuStart);
+        writeTimes.push_back(std::chrono::duration<double, std::micro>(written - start).count());
+        drainTimes.push_back(std::chrono::duration<double, std::micro>(drained - start).count());
+    }
+
+    printf("\n%u doorbells of %u bytes (%u methods each)\n", doorbells, doorbellSize, commandsPerDoorbell * kMethodsPerCommand);
+    printf("%-22s %10s %10s %10s\n", "", "mean (us)", "p50 (us)", "p99 (us)");
+    PrintStats("USERWrite (vCPU time)", writeCPUTimes);
+    PrintStats("USERWrite (wall)", writeTimes);
+    PrintStats("doorbell to drained", drainTimes);
+
+    delete nv2a;
+    free(ram);
+    return 0;
+}
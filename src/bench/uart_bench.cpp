@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "openxbox/hw/basic/serial.h"
+
+using namespace openxbox;
+
+// UART registers and bits used by the simulated driver
+#define REG_DATA         0
+#define REG_IER          1
+#define REG_IIR          2
+#define REG_FCR          2
+#define REG_LCR          3
+#define REG_MCR          4
+#define REG_LSR          5
+#define IER_RDI          0x01
+#define IER_THRI         0x02
+#define FCR_ENABLE_14    0xC7
+#define LCR_8N1          0x03
+#define LCR_DLAB         0x80
+#define MCR_OUT2         0x08
+#define LSR_DR           0x01
+#define LSR_THRE         0x20
+
+#define FIFO_SIZE        16
+
+struct BenchConfig {
+    bool burstMode;
+    int baudBase;        // with a divisor of 1
+    uint32_t bytesShift; // fraction of the requested bytes to transfer
+};
+
+static const BenchConfig kConfigs[] = {
+    // Practically unthrottled line
+    { false, 1000000000, 0 },
+    { true, 1000000000, 0 },
+    // 921600 baud, paced by the emulated transmit time
+    { false, 921600, 6 },
+    { true, 921600, 6 },
+};
+
+class BenchIRQHandler : public IRQHandler {
+public:
+    void HandleIRQ(uint8_t irqNum, bool level) override {
+        if (level && !m_level) {
+            m_raised++;
+        }
+        m_level = level;
+    }
+    std::atomic<bool> m_level{ false };
+    std::atomic<uint64_t> m_raised{ 0 };
+};
+
+/*!
+ * Character driver that sends everything written to it back to the UART
+ * from its own thread, delivering as much as the UART accepts at a time.
+ */
+class LoopbackCharDriver : public CharDriver {
+public:
+    ~LoopbackCharDriver() {
+        Stop();
+    }
+
+    bool Init() override {
+        m_running = true;
+        m_thread = std::thread(PumpThread, this);
+        return true;
+    }
+
+    int Write(const uint8_t *buf, int len) override {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_pending.insert(m_pending.end(), buf, buf + len);
+        m_writes++;
+        m_wakeups++;
+        m_cond.notify_one();
+        return len;
+    }
+
+    void AcceptInput() override {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_wakeups++;
+        m_cond.notify_one();
+    }
+
+    void Stop() override {
+        {
+            std::lock_guard<std::mutex> lk(m_mutex);
+            if (!m_running) {
+                return;
+            }
+            m_running = false;
+            m_cond.notify_one();
+        }
+        m_thread.join();
+    }
+
+    void SetBreakEnable(bool breakEnable) override {}
+    void SetSerialParameters(SerialParams *params) override {}
+
+    uint64_t m_writes = 0;
+    uint64_t m_receives = 0;
+
+private:
+    static void PumpThread(LoopbackCharDriver *driver) {
+        driver->Pump();
+    }
+
+    void Pump() {
+        std::vector<uint8_t> data;
+        size_t pos = 0;
+        std::unique_lock<std::mutex> lk(m_mutex);
+        while (m_running) {
+            if (pos == data.size()) {
+                if (m_pending.empty()) {
+                    m_cond.wait(lk);
+                    continue;
+                }
+                data.swap(m_pending);
+                m_pending.clear();
+                pos = 0;
+            }
+
+            // The UART may make room while we're not looking; remember which
+            // wake up we've seen so that none is missed
+            uint64_t wakeups = m_wakeups;
+            lk.unlock();
+            int len = CanReceive();
+            if (len > 0) {
+                if ((size_t)len > data.size() - pos) {
+                    len = (int)(data.size() - pos);
+                }
+                Receive(&data[pos], len);
+                pos += len;
+            }
+            lk.lock();
+            if (len > 0) {
+                m_receives++;
+            }
+            else {
+                m_cond.wait(lk, [&] { return m_wakeups != wakeups || !m_running; });
+            }
+        }
+    }
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::vector<uint8_t> m_pending;
+    uint64_t m_wakeups = 0;
+    bool m_running = false;
+};
+
+/*!
+ * Simulates an interrupt driven driver that sends a stream of bytes through
+ * the loopback driver and checks that it comes back intact, refilling the
+ * transmit FIFO and draining the receive FIFO from its interrupt handler.
+ */
+class BenchGuest {
+public:
+    BenchGuest(const BenchConfig& config)
+        : m_serial(&m_irq, PORT_SERIAL_BASE_1)
+    {
+        m_serial.SetBaudBase(config.baudBase);
+        m_serial.SetBurstMode(config.burstMode);
+        m_chr.Init();
+        m_serial.Init(&m_chr);
+
+        Write(REG_LCR, LCR_DLAB);
+        Write(REG_DATA, 1);
+        Write(REG_IER, 0);
+        Write(REG_LCR, LCR_8N1);
+        Write(REG_FCR, FCR_ENABLE_14);
+        Write(REG_MCR, MCR_OUT2);
+        Write(REG_IER, IER_RDI | IER_THRI);
+    }
+
+    ~BenchGuest() {
+        m_serial.Stop();
+    }
+
+    // Returns false if the data did not make it through
+    bool Run(uint32_t byteCount) {
+        uint32_t sent = 0, received = 0;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (received < byteCount) {
+            if (!m_irq.m_level) {
+                if (std::chrono::steady_clock::now() > deadline) {
+                    return false;
+                }
+                std::this_thread::yield();
+                continue;
+            }
+
+            // Interrupt handler: identify, then service both directions
+            Read(REG_IIR);
+            uint32_t lsr = Read(REG_LSR);
+            while (lsr & LSR_DR) {
+                if (Read(REG_DATA) != Pattern(received)) {
+                    return false;
+                }
+                received++;
+                lsr = Read(REG_LSR);
+            }
+            if ((lsr & LSR_THRE) && sent < byteCount) {
+                for (int i = 0; i < FIFO_SIZE && sent < byteCount; i++) {
+                    Write(REG_DATA, Pattern(sent++));
+                }
+            }
+            deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        }
+        return true;
+    }
+
+    uint64_t GetIRQs() const { return m_irq.m_raised; }
+    uint64_t GetPortAccesses() const { return m_accesses; }
+    uint64_t GetDriverWrites() const { return m_chr.m_writes; }
+    uint64_t GetDriverReceives() const { return m_chr.m_receives; }
+
+private:
+    static uint8_t Pattern(uint32_t index) {
+        return (uint8_t)(index ^ (index >> 8) ^ (index >> 16));
+    }
+
+    uint32_t Read(uint32_t reg) {
+        uint32_t value;
+        m_serial.IORead(PORT_SERIAL_BASE_1 + reg, &value, 1);
+        m_accesses++;
+        return value;
+    }
+
+    void Write(uint32_t reg, uint32_t value) {
+        m_serial.IOWrite(PORT_SERIAL_BASE_1 + reg, value, 1);
+        m_accesses++;
+    }
+
+    BenchIRQHandler m_irq;
+    LoopbackCharDriver m_chr;
+    Serial m_serial;
+    uint64_t m_accesses = 0;
+};
+
+/*!
+ * Measures the 16550 UART throughput through a loopback character driver,
+ * moving data one character at a time and in FIFO-sized bursts.
+ *
+ * Usage: uart-bench [bytes]
+ */
+int main(int argc, const char *argv[]) {
+    uint32_t byteCount = 4 * 1024 * 1024;
+    if (argc > 1) {
+        byteCount = (uint32_t)atoi(argv[1]);
+    }
+
+    printf("%-6s %10s %10s %10s %10s %12s %12s %12s\n", "mode", "baud", "bytes", "MB/s", "IRQs/s", "bytes/write", "bytes/recv", "I/O per byte");
+
+    int failures = 0;
+    for (const BenchConfig& config : kConfigs) {
+        uint32_t bytes = byteCount >> config.bytesShift;
+        BenchGuest guest(config);
+        auto start = std::chrono::high_resolution_clock::now();
+        bool ok = guest.Run(bytes);
+        auto end = std::chrono::high_resolution_clock::now();
+        double seconds = std::chrono::duration<double>(end - start).count();
+        if (!ok) {
+            failures++;
+        }
+
+        printf("%-6s %10d %10u %10.2f %10.0f %12.2f %12.2f %12.2f%s\n", config.burstMode ? "burst" : "char",
+            config.baudBase, bytes, bytes / seconds / (1024 * 1024), guest.GetIRQs() / seconds,
+            guest.GetDriverWrites() ? (double)bytes / guest.GetDriverWrites() : 0.0,
+            guest.GetDriverReceives() ? (double)bytes / guest.GetDriverReceives() : 0.0,
+            (double)guest.GetPortAccesses() / bytes, ok ? "" : "  FAILED");
+    }
+
+    return failures ? 1 : 0;
+}
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <string>
 #include <iostream>
@@ -24,6 +25,68 @@ char *basename(char *path)
 }
 #endif
 
+/*!
+ * Configures the character driver of a serial port from a specification of
+ * the form type[:parameters]. The settings point into the strings in path
+ * and host, which must outlive them.
+ */
+static bool ParseCharDriver(const std::string& spec, std::string& path, std::string& host, openxbox::OpenXBOXSettings *settings, int port)
+{
+	using namespace openxbox;
+
+	auto& driver = settings->hw_charDrivers[port];
+	std::string type = spec;
+	std::string param;
+	size_t sep = spec.find(':');
+	if (sep != std::string::npos) {
+		type = spec.substr(0, sep);
+		param = spec.substr(sep + 1);
+	}
+
+	if (type == "null") {
+		driver.type = CHD_Null;
+	}
+	else if (type == "host") {
+		driver.type = CHD_HostSerialPort;
+		driver.params.hostSerialPort.portNum = (uint8_t)atoi(param.c_str());
+	}
+	else if (type == "pty") {
+		driver.type = CHD_Pty;
+	}
+	else if (type == "tcp" || type == "tcp-listen") {
+		// [host:]port
+		size_t portSep = param.rfind(':');
+		host = (portSep != std::string::npos) ? param.substr(0, portSep) : "";
+		int tcpPort = atoi(param.substr(portSep != std::string::npos ? portSep + 1 : 0).c_str());
+		if (tcpPort <= 0 || tcpPort > 65535) {
+			return false;
+		}
+		driver.type = (type == "tcp") ? CHD_TcpClient : CHD_TcpServer;
+		driver.params.tcp.host = host.empty() ? (type == "tcp" ? "localhost" : nullptr) : host.c_str();
+		driver.params.tcp.port = (uint16_t)tcpPort;
+	}
+	else if (type == "unix" || type == "unix-listen") {
+		if (param.empty()) {
+			return false;
+		}
+		path = param;
+		driver.type = (type == "unix") ? CHD_UnixClient : CHD_UnixServer;
+		driver.params.unixSocket.path = path.c_str();
+	}
+	else if (type == "file") {
+		if (param.empty()) {
+			return false;
+		}
+		path = param;
+		driver.type = CHD_File;
+		driver.params.file.path = path.c_str();
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
 /*!
  * Program entry point
  */
@@ -42,6 +105,29 @@ int main(int argc, const char *argv[]) {
 		("c, mcpx", "MCPX path", cxxopts::value<std::string>(), "mcpx_path")
 		("b, bios", "BIOS path", cxxopts::value<std::string>(), "bios_path")
 		("m, model", "XBOX Model (retail | debug)", cxxopts::value<std::string>(), "xbox_model")
+		("t, nv2a-trace", "Capture NV2A command stream to file", cxxopts::value<std::string>(), "trace_path")
+		("scanout-shm", "Publish displayed frames to shared memory", cxxopts::value<std::string>(), "shm_name")
+		("scanout-images", "Write displayed frames as PPM images", cxxopts::value<std::string>(), "path_prefix")
+		("scanout-video", "Write displayed frames as raw BGRA video", cxxopts::value<std::string>(), "video_path")
+		("nv2a-profile", "Write per-frame NV2A statistics to a CSV or JSON file", cxxopts::value<std::string>(), "profile_path")
+		("hdd", "Hard drive image path (created as a sparse file if missing)", cxxopts::value<std::string>(), "image_path")
+		("hdd-dir", "Serve a host directory as the FATX partitions of the hard drive", cxxopts::value<std::string>(), "host_path")
+		("hdd-overlay", "Write hard drive changes to a copy-on-write overlay instead of the image", cxxopts::value<std::string>(), "overlay_path")
+		("hdd-overlay-block-size", "Block size of a new hard drive overlay in bytes", cxxopts::value<uint32_t>(), "bytes")
+		("hdd-overlay-reset", "Discard the contents of the hard drive overlay on startup")
+		("dvd", "XISO image to insert in the DVD drive", cxxopts::value<std::string>(), "xiso_path")
+		("net", "Network backend (none | loopback | switch[:name] | pcap:path | tap[:ifname])", cxxopts::value<std::string>(), "backend")
+		("net-pcap-realtime", "Replay pcap captures at the pace they were captured")
+		("net-coalesce-frames", "Frames completed before the network interrupt is raised (0 to disable moderation)", cxxopts::value<uint32_t>(), "frames")
+		("net-coalesce-usecs", "Maximum delay of the network interrupt in microseconds (0 to disable moderation)", cxxopts::value<uint32_t>(), "usecs")
+		("net-capture", "Capture network traffic to a pcapng file", cxxopts::value<std::string>(), "pcapng_path")
+		("net-capture-snaplen", "Bytes of each frame kept in the network capture (0 for whole frames)", cxxopts::value<uint32_t>(), "bytes")
+		("net-capture-rotate", "Start a new network capture file every this many MiB (0 to disable)", cxxopts::value<uint32_t>(), "mib")
+		("apu-wav", "Write the audio output to a WAV file", cxxopts::value<std::string>(), "wav_path")
+		("ac97-wav", "Write the AC'97 PCM output to a WAV file", cxxopts::value<std::string>(), "wav_path")
+		("serial1", "Host end of the first serial port (null | host:n | pty | tcp:[host:]port | tcp-listen:[host:]port | unix:path | unix-listen:path | file:path)", cxxopts::value<std::string>(), "driver")
+		("serial2", "Host end of the second serial port (same as --serial1)", cxxopts::value<std::string>(), "driver")
+		("serial-burst", "Transfer serial port data in FIFO-sized bursts")
 		("h, help", "Shows this message");
 
 	auto args = options.parse(argc, argv);
@@ -59,8 +145,45 @@ int main(int argc, const char *argv[]) {
 	const char *mcpx_path = args["mcpx"].as<std::string>().c_str();
 	const char *bios_path = args["bios"].as<std::string>().c_str();
 	const char *model = args["model"].as<std::string>().c_str();
+	std::string trace_path = args.count("nv2a-trace") ? args["nv2a-trace"].as<std::string>() : "";
+	std::string scanout_shm = args.count("scanout-shm") ? args["scanout-shm"].as<std::string>() : "";
+	std::string scanout_images = args.count("scanout-images") ? args["scanout-images"].as<std::string>() : "";
+	std::string scanout_video = args.count("scanout-video") ? args["scanout-video"].as<std::string>() : "";
+	std::string profile_path = args.count("nv2a-profile") ? args["nv2a-profile"].as<std::string>() : "";
+	std::string hdd_path = args.count("hdd") ? args["hdd"].as<std::string>() : "";
+	std::string hdd_dir = args.count("hdd-dir") ? args["hdd-dir"].as<std::string>() : "";
+	std::string hdd_overlay_path = args.count("hdd-overlay") ? args["hdd-overlay"].as<std::string>() : "";
+	std::string dvd_path = args.count("dvd") ? args["dvd"].as<std::string>() : "";
+	std::string net = args.count("net") ? args["net"].as<std::string>() : "none";
+	std::string net_capture_path = args.count("net-capture") ? args["net-capture"].as<std::string>() : "";
+	std::string apu_wav_path = args.count("apu-wav") ? args["apu-wav"].as<std::string>() : "";
+	std::string ac97_wav_path = args.count("ac97-wav") ? args["ac97-wav"].as<std::string>() : "";
+#ifdef _WIN32
+	const char *default_serial1 = "host:5";
+#else
+	const char *default_serial1 = "null";
+#endif
+	std::string serial_specs[2] = {
+		args.count("serial1") ? args["serial1"].as<std::string>() : default_serial1,
+		args.count("serial2") ? args["serial2"].as<std::string>() : "null",
+	};
+	std::string serial_paths[2];
+	std::string serial_hosts[2];
 	bool is_debug;
 
+	// Split the network backend from its parameter
+	std::string net_param;
+	size_t net_sep = net.find(':');
+	if (net_sep != std::string::npos) {
+		net_param = net.substr(net_sep + 1);
+		net = net.substr(0, net_sep);
+	}
+	if (net != "none" && net != "loopback" && net != "switch" && net != "pcap" && net != "tap") {
+		printf("Invalid network backend specified.\n");
+		std::cout << options.help();
+		return 1;
+	}
+
 	if (strcmp(model, "debug") == 0) {
 		is_debug = true;
 		printf("Emulating debug console.\n");
@@ -75,6 +198,16 @@ int main(int argc, const char *argv[]) {
 		return 1;
 	}
 
+	// Validate the serial port drivers before creating the emulator
+	OpenXBOXSettings charDriverSettings;
+	for (int i = 0; i < 2; i++) {
+		if (!ParseCharDriver(serial_specs[i], serial_paths[i], serial_hosts[i], &charDriverSettings, i)) {
+			printf("Invalid serial port %d driver specified.\n", i + 1);
+			std::cout << options.help();
+			return 1;
+		}
+	}
+
 	// Locate and instantiate modules
 	ModuleRepository moduleRepo;
 	moduleRepo.Enumerate();
@@ -116,12 +249,58 @@ int main(int argc, const char *argv[]) {
     settings->hw_model = is_debug ? DebugKit : Revision1_0;
     settings->hw_sysclock_tickRate = 1000.0f;
     settings->hw_enableSuperIO = true;
-    settings->hw_charDrivers[0].type = CHD_HostSerialPort;
-    settings->hw_charDrivers[0].params.hostSerialPort.portNum = 5;
-    //settings->hw_charDrivers[0].type = CHD_Null;
-    settings->hw_charDrivers[1].type = CHD_Null;
+    for (int i = 0; i < 2; i++) {
+        settings->hw_charDrivers[i] = charDriverSettings.hw_charDrivers[i];
+    }
+    settings->hw_serialBurstMode = args.count("serial-burst") > 0;
     settings->rom_mcpx = mcpx_path;
     settings->rom_bios = bios_path;
+    settings->nv2a_tracePath = trace_path.empty() ? nullptr : trace_path.c_str();
+    settings->nv2a_scanoutShmName = scanout_shm.empty() ? nullptr : scanout_shm.c_str();
+    settings->nv2a_scanoutImagePrefix = scanout_images.empty() ? nullptr : scanout_images.c_str();
+    settings->nv2a_scanoutVideoPath = scanout_video.empty() ? nullptr : scanout_video.c_str();
+    settings->nv2a_profilePath = profile_path.empty() ? nullptr : profile_path.c_str();
+    settings->hdd_imagePath = hdd_path.empty() ? nullptr : hdd_path.c_str();
+    settings->hdd_hostDirectory = hdd_dir.empty() ? nullptr : hdd_dir.c_str();
+    settings->hdd_overlayPath = hdd_overlay_path.empty() ? nullptr : hdd_overlay_path.c_str();
+    if (args.count("hdd-overlay-block-size")) {
+        settings->hdd_overlayBlockSize = args["hdd-overlay-block-size"].as<uint32_t>();
+    }
+    settings->hdd_resetOverlay = args.count("hdd-overlay-reset") > 0;
+    settings->dvd_imagePath = dvd_path.empty() ? nullptr : dvd_path.c_str();
+    if (net == "loopback") {
+        settings->net_backend = NBT_Loopback;
+    }
+    else if (net == "switch") {
+        settings->net_backend = NBT_Switch;
+        if (!net_param.empty()) {
+            settings->net_switchName = net_param.c_str();
+        }
+    }
+    else if (net == "pcap") {
+        settings->net_backend = NBT_PcapReplay;
+        settings->net_pcapReplayPath = net_param.empty() ? nullptr : net_param.c_str();
+    }
+    else if (net == "tap") {
+        settings->net_backend = NBT_Tap;
+        settings->net_tapInterface = net_param.empty() ? nullptr : net_param.c_str();
+    }
+    settings->net_pcapReplayRealTime = args.count("net-pcap-realtime") > 0;
+    if (args.count("net-coalesce-frames")) {
+        settings->net_irqCoalesceFrames = args["net-coalesce-frames"].as<uint32_t>();
+    }
+    if (args.count("net-coalesce-usecs")) {
+        settings->net_irqCoalesceTime = args["net-coalesce-usecs"].as<uint32_t>();
+    }
+    settings->net_capturePath = net_capture_path.empty() ? nullptr : net_capture_path.c_str();
+    if (args.count("net-capture-snaplen")) {
+        settings->net_captureSnapLen = args["net-capture-snaplen"].as<uint32_t>();
+    }
+    if (args.count("net-capture-rotate")) {
+        settings->net_captureMaxFileSize = (uint64_t)args["net-capture-rotate"].as<uint32_t>() * 1024 * 1024;
+    }
+    settings->apu_wavPath = apu_wav_path.empty() ? nullptr : apu_wav_path.c_str();
+    settings->ac97_wavPath = ac97_wav_path.empty() ? nullptr : ac97_wav_path.c_str();
 
     EmulatorStatus status = xbox->Run();
     if (status == EMUS_OK) {
@@ -143,6 +322,13 @@ int main(int argc, const char *argv[]) {
         case EMUS_INIT_CPU_INIT_FAILED: log_fatal("CPU initialization failed"); break;
         case EMUS_INIT_CPU_MEM_MAP_FAILED: log_fatal("Memory mapping failed"); break;
         case EMUS_INIT_DEBUGGER_FAILED: log_fatal("Debugger initialization failed"); break;
+        case EMUS_INIT_HDD_IMAGE_FAILED: log_fatal("Could not open or create the hard drive image"); break;
+        case EMUS_INIT_DVD_IMAGE_FAILED: log_fatal("Could not open the DVD image"); break;
+        case EMUS_INIT_HDD_OVERLAY_FAILED: log_fatal("Could not open or create the hard drive overlay"); break;
+        case EMUS_INIT_HDD_DIRECTORY_FAILED: log_fatal("Could not open the hard drive host directory"); break;
+        case EMUS_INIT_NET_BACKEND_FAILED: log_fatal("Could not open the network backend"); break;
+        case EMUS_INIT_AUDIO_SINK_FAILED: log_fatal("Could not open the audio output"); break;
+        case EMUS_INIT_CHAR_DRIVER_FAILED: log_fatal("Could not open the host end of a serial port"); break;
         default: log_fatal("Unspecified error\n"); break;
         }
     }
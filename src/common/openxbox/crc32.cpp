@@ -0,0 +1,45 @@
+#include "crc32.h"
+
+namespace openxbox {
+
+// Lookup tables for slicing-by-8: table 0 is the classic byte-wise table,
+// and table n advances the CRC of a byte followed by n zero bytes
+struct CRC32Tables {
+    uint32_t table[8][256];
+
+    CRC32Tables() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+            }
+            table[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int n = 1; n < 8; n++) {
+                table[n][i] = (table[n - 1][i] >> 8) ^ table[0][table[n - 1][i] & 0xFF];
+            }
+        }
+    }
+};
+
+static const CRC32Tables kTables;
+
+uint32_t CRC32_Compute(const void *data, size_t length, uint32_t crc) {
+    const uint8_t *p = (const uint8_t *)data;
+    crc = ~crc;
+    while (length >= 8) {
+        uint32_t lo = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24));
+        uint32_t hi = p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32_t)p[7] << 24);
+        crc = kTables.table[7][lo & 0xFF] ^ kTables.table[6][(lo >> 8) & 0xFF] ^ kTables.table[5][(lo >> 16) & 0xFF] ^ kTables.table[4][lo >> 24]
+            ^ kTables.table[3][hi & 0xFF] ^ kTables.table[2][(hi >> 8) & 0xFF] ^ kTables.table[1][(hi >> 16) & 0xFF] ^ kTables.table[0][hi >> 24];
+        p += 8;
+        length -= 8;
+    }
+    while (length-- > 0) {
+        crc = (crc >> 8) ^ kTables.table[0][(crc ^ *p++) & 0xFF];
+    }
+    return ~crc;
+}
+
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace openxbox {
+
+/*!
+ * Computes the CRC-32 (IEEE 802.3 polynomial, as used by zlib and PNG) of a
+ * block of data. Pass the result of a previous call as crc to continue the
+ * checksum over multiple blocks.
+ */
+uint32_t CRC32_Compute(const void *data, size_t length, uint32_t crc = 0);
+
+}
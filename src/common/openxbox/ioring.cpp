@@ -0,0 +1,8 @@
+#include "openxbox/ioring.h"
+
+namespace openxbox {
+
+IORing::~IORing() {
+}
+
+}
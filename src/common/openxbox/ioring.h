@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+
+#include "openxbox/iovec.h"
+
+namespace openxbox {
+
+/*!
+ * A queue of asynchronous file I/O requests executed by the host kernel.
+ *
+ * Requests are queued with the Queue* methods, handed to the kernel by Submit
+ * and reaped with WaitCompletion. Each request
+ * carries an opaque value that is returned with its completion. Completions
+ * report the number of bytes transferred, or a negated error code.
+ *
+ * A ring must only be used by one thread at a time.
+ */
+class IORing {
+public:
+    virtual ~IORing();
+
+    // These functions return false if the submission queue is full
+    virtual bool QueueRead(int fd, const IoVec *iov, unsigned int iovCount, uint64_t offset, uint64_t userData) = 0;
+    virtual bool QueueWrite(int fd, const IoVec *iov, unsigned int iovCount, uint64_t offset, uint64_t userData) = 0;
+    virtual bool QueueSync(int fd, uint64_t userData) = 0;
+
+    // Submits all queued requests, entering the kernel as many times as it
+    // takes for it to accept them. Returns false if the kernel rejected them.
+    virtual bool Submit() = 0;
+
+    // Retrieves the next completion, waiting for one if none are available
+    virtual bool WaitCompletion(uint64_t *userData, int32_t *result) = 0;
+};
+
+/*!
+ * Creates an I/O ring with room for the specified number of requests in
+ * flight. Returns nullptr if the host does not support I/O rings, in which
+ * case the caller should fall back to synchronous I/O.
+ */
+IORing *IORing_Create(unsigned int entries);
+
+}
@@ -0,0 +1,269 @@
+#if defined(__linux__) || defined(LINUX)
+
+#include "openxbox/ioring.h"
+#include "openxbox/log.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+
+namespace openxbox {
+
+static_assert(sizeof(IoVec) == sizeof(struct iovec), "IoVec must be interchangeable with struct iovec");
+
+/*!
+ * io_uring driven directly through its system calls and the rings shared
+ * with the kernel, without liburing.
+ */
+class LinuxIORing : public IORing {
+public:
+    LinuxIORing();
+    ~LinuxIORing();
+
+    bool Init(unsigned int entries);
+
+    bool QueueRead(int fd, const IoVec *iov, unsigned int iovCount, uint64_t offset, uint64_t userData) override;
+    bool QueueWrite(int fd, const IoVec *iov, unsigned int iovCount, uint64_t offset, uint64_t userData) override;
+    bool QueueSync(int fd, uint64_t userData) override;
+
+    bool Submit() override;
+    bool WaitCompletion(uint64_t *userData, int32_t *result) override;
+
+private:
+    struct io_uring_sqe *NextSQE();
+    bool Enter(unsigned int toSubmit, unsigned int minComplete, unsigned int *submitted = nullptr);
+
+    int m_fd = -1;
+
+    void *m_sqRing = MAP_FAILED;
+    size_t m_sqRingSize = 0;
+    void *m_cqRing = MAP_FAILED;
+    size_t m_cqRingSize = 0;
+    struct io_uring_sqe *m_sqes = (struct io_uring_sqe *)MAP_FAILED;
+    size_t m_sqesSize = 0;
+
+    // Submission queue; the kernel advances the head, we advance the tail
+    unsigned int *m_sqHead = nullptr;
+    unsigned int *m_sqTail = nullptr;
+    unsigned int m_sqMask = 0;
+    unsigned int m_sqEntries = 0;
+    unsigned int *m_sqArray = nullptr;
+    unsigned int m_sqQueued = 0;
+
+    // Completion queue; the kernel advances the tail, we advance the head
+    unsigned int *m_cqHead = nullptr;
+    unsigned int *m_cqTail = nullptr;
+    unsigned int m_cqMask = 0;
+    struct io_uring_cqe *m_cqes = nullptr;
+};
+
+LinuxIORing::LinuxIORing() {
+}
+
+LinuxIORing::~LinuxIORing() {
+    if (m_sqes != MAP_FAILED) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if (m_sqRing != MAP_FAILED) {
+        munmap(m_sqRing, m_sqRingSize);
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool LinuxIORing::Init(unsigned int entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    m_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (m_fd < 0) {
+        log_debug("IORing: io_uring_setup failed (errno %d)\n", errno);
+        return false;
+    }
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    // Newer kernels share a single mapping between both rings
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap) {
+        if (m_cqRingSize > m_sqRingSize) {
+            m_sqRingSize = m_cqRingSize;
+        }
+        m_cqRingSize = m_sqRingSize;
+    }
+
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED) {
+        return false;
+    }
+    if (singleMap) {
+        m_cqRing = m_sqRing;
+    }
+    else {
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if (m_cqRing == MAP_FAILED) {
+            return false;
+        }
+    }
+
+    m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    m_sqes = (struct io_uring_sqe *)mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED) {
+        return false;
+    }
+
+    uint8_t *sq = (uint8_t *)m_sqRing;
+    m_sqHead = (unsigned int *)(sq + params.sq_off.head);
+    m_sqTail = (unsigned int *)(sq + params.sq_off.tail);
+    m_sqMask = *(unsigned int *)(sq + params.sq_off.ring_mask);
+    m_sqEntries = *(unsigned int *)(sq + params.sq_off.ring_entries);
+    m_sqArray = (unsigned int *)(sq + params.sq_off.array);
+
+    uint8_t *cq = (uint8_t *)m_cqRing;
+    m_cqHead = (unsigned int *)(cq + params.cq_off.head);
+    m_cqTail = (unsigned int *)(cq + params.cq_off.tail);
+    m_cqMask = *(unsigned int *)(cq + params.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    return true;
+}
+
+struct io_uring_sqe *LinuxIORing::NextSQE() {
+    unsigned int head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    unsigned int tail = *m_sqTail + m_sqQueued;
+    if (tail - head >= m_sqEntries) {
+        return nullptr;
+    }
+
+    unsigned int index = tail & m_sqMask;
+    struct io_uring_sqe *sqe = &m_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    m_sqArray[index] = index;
+    m_sqQueued++;
+    return sqe;
+}
+
+bool LinuxIORing::QueueRead(int fd, const IoVec *iov, unsigned int iovCount, uint64_t offset, uint64_t userData) {
+    struct io_uring_sqe *sqe = NextSQE();
+    if (sqe == nullptr) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = iovCount;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool LinuxIORing::QueueWrite(int fd, const IoVec *iov, unsigned int iovCount, uint64_t offset, uint64_t userData) {
+    struct io_uring_sqe *sqe = NextSQE();
+    if (sqe == nullptr) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = iovCount;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool LinuxIORing::QueueSync(int fd, uint64_t userData) {
+    struct io_uring_sqe *sqe = NextSQE();
+    if (sqe == nullptr) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool LinuxIORing::Enter(unsigned int toSubmit, unsigned int minComplete, unsigned int *submitted) {
+    unsigned int flags = (minComplete > 0) ? IORING_ENTER_GETEVENTS : 0;
+    for (;;) {
+        long result = syscall(__NR_io_uring_enter, m_fd, toSubmit, minComplete, flags, nullptr, 0);
+        if (result >= 0) {
+            if (submitted != nullptr) {
+                *submitted = (unsigned int)result;
+            }
+            return true;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            log_warning("IORing: io_uring_enter failed (errno %d)\n", errno);
+            return false;
+        }
+    }
+}
+
+bool LinuxIORing::Submit() {
+    if (m_sqQueued == 0) {
+        return true;
+    }
+
+    // Publish the new entries to the kernel before entering. The kernel may
+    // consume only part of them, so enter again until all are submitted.
+    unsigned int toSubmit = m_sqQueued;
+    __atomic_store_n(m_sqTail, *m_sqTail + toSubmit, __ATOMIC_RELEASE);
+    m_sqQueued = 0;
+    while (toSubmit > 0) {
+        unsigned int submitted;
+        if (!Enter(toSubmit, 0, &submitted)) {
+            return false;
+        }
+        if (submitted == 0) {
+            log_warning("IORing: io_uring_enter accepted none of %u requests\n", toSubmit);
+            return false;
+        }
+        toSubmit -= (submitted < toSubmit) ? submitted : toSubmit;
+    }
+    return true;
+}
+
+bool LinuxIORing::WaitCompletion(uint64_t *userData, int32_t *result) {
+    for (;;) {
+        unsigned int head = *m_cqHead;
+        if (head != __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &m_cqes[head & m_cqMask];
+            *userData = cqe->user_data;
+            *result = cqe->res;
+            __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+        if (!Enter(0, 1)) {
+            return false;
+        }
+    }
+}
+
+IORing *IORing_Create(unsigned int entries) {
+    LinuxIORing *ring = new LinuxIORing();
+    if (!ring->Init(entries)) {
+        delete ring;
+        return nullptr;
+    }
+    return ring;
+}
+
+}
+
+#endif // LINUX
@@ -0,0 +1,206 @@
+#include "lz.h"
+
+#include <cstring>
+
+namespace openxbox {
+
+static const unsigned int kMinMatch = 4;
+static const unsigned int kMaxDistance = 0xFFFF;
+static const unsigned int kHashBits = 14;
+
+// Matches are not searched for in the last few bytes of the block, so that
+// the compressor can always read 4 bytes at a time and the stream always
+// ends with literals
+static const size_t kLastLiterals = 5;
+static const size_t kMatchSearchLimit = 12;
+
+static inline uint32_t Read32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t Hash(uint32_t value) {
+    return (value * 2654435761u) >> (32 - kHashBits);
+}
+
+static inline uint8_t *WriteLength(uint8_t *op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+size_t LZ_CompressBound(size_t srcLength) {
+    return srcLength + srcLength / 255 + 16;
+}
+
+size_t LZ_Compress(const uint8_t *src, size_t srcLength, uint8_t *dest, size_t destCapacity) {
+    if (destCapacity < LZ_CompressBound(srcLength)) {
+        return 0;
+    }
+
+    // Positions of the last occurrence of each hashed 4-byte sequence,
+    // relative to src. Entries are only trusted after comparing the bytes.
+    uint32_t table[1 << kHashBits];
+    memset(table, 0, sizeof(table));
+
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *end = src + srcLength;
+    uint8_t *op = dest;
+
+    if (srcLength >= kMatchSearchLimit) {
+        const uint8_t *matchLimit = end - kLastLiterals;
+        const uint8_t *searchLimit = end - kMatchSearchLimit;
+        ip++;
+        while (ip < searchLimit) {
+            uint32_t sequence = Read32(ip);
+            uint32_t h = Hash(sequence);
+            const uint8_t *ref = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+            if (ref >= ip || (size_t)(ip - ref) > kMaxDistance || Read32(ref) != sequence) {
+                ip++;
+                continue;
+            }
+
+            // Extend the match backwards over pending literals and forwards
+            // as far as it goes
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t *matchEnd = ip + kMinMatch;
+            const uint8_t *refEnd = ref + kMinMatch;
+            while (matchEnd < matchLimit && *matchEnd == *refEnd) {
+                matchEnd++;
+                refEnd++;
+            }
+
+            size_t literals = (size_t)(ip - anchor);
+            size_t matchLength = (size_t)(matchEnd - ip) - kMinMatch;
+            uint8_t *token = op++;
+            *token = (uint8_t)(((literals < 15) ? literals : 15) << 4 | ((matchLength < 15) ? matchLength : 15));
+            if (literals >= 15) {
+                op = WriteLength(op, literals - 15);
+            }
+            memcpy(op, anchor, literals);
+            op += literals;
+            uint16_t distance = (uint16_t)(ip - ref);
+            *op++ = distance & 0xFF;
+            *op++ = distance >> 8;
+            if (matchLength >= 15) {
+                op = WriteLength(op, matchLength - 15);
+            }
+
+            // Index a position inside the match to improve the odds on the
+            // next search
+            if (matchEnd - 2 > src) {
+                table[Hash(Read32(matchEnd - 2))] = (uint32_t)(matchEnd - 2 - src);
+            }
+            ip = anchor = matchEnd;
+        }
+    }
+
+    // Emit the remaining bytes as literals
+    size_t literals = (size_t)(end - anchor);
+    *op++ = (uint8_t)(((literals < 15) ? literals : 15) << 4);
+    if (literals >= 15) {
+        op = WriteLength(op, literals - 15);
+    }
+    memcpy(op, anchor, literals);
+    op += literals;
+    return (size_t)(op - dest);
+}
+
+static inline bool ReadLength(const uint8_t *&ip, const uint8_t *end, size_t *length) {
+    uint8_t b;
+    do {
+        if (ip >= end) {
+            return false;
+        }
+        b = *ip++;
+        *length += b;
+    } while (b == 255);
+    return true;
+}
+
+bool LZ_Decompress(const uint8_t *src, size_t srcLength, uint8_t *dest, size_t destLength) {
+    const uint8_t *ip = src;
+    const uint8_t *end = src + srcLength;
+    uint8_t *op = dest;
+    uint8_t *opEnd = dest + destLength;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+
+        size_t literals = token >> 4;
+        if (literals == 15 && !ReadLength(ip, end, &literals)) {
+            return false;
+        }
+        if (literals > (size_t)(end - ip) || literals > (size_t)(opEnd - op)) {
+            return false;
+        }
+        if (literals <= 16 && end - ip >= 16 && opEnd - op >= 16) {
+            // Short runs are copied 16 bytes at a time; the bytes past the
+            // run are overwritten later on
+            memcpy(op, ip, 16);
+        }
+        else {
+            memcpy(op, ip, literals);
+        }
+        ip += literals;
+        op += literals;
+
+        // The last command has no match
+        if (ip == end) {
+            break;
+        }
+
+        if (end - ip < 2) {
+            return false;
+        }
+        size_t distance = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !ReadLength(ip, end, &matchLength)) {
+            return false;
+        }
+        matchLength += kMinMatch;
+        if (distance == 0 || distance > (size_t)(op - dest) || matchLength > (size_t)(opEnd - op)) {
+            return false;
+        }
+
+        // Matches may overlap the bytes they produce; copy in 8-byte steps
+        // when they are far enough apart, and byte by byte otherwise. Away
+        // from the end of the output, the last step may run past the match.
+        const uint8_t *ref = op - distance;
+        uint8_t *matchEnd = op + matchLength;
+        if (distance >= 8 && (size_t)(opEnd - matchEnd) >= 8) {
+            do {
+                memcpy(op, ref, 8);
+                op += 8;
+                ref += 8;
+            } while (op < matchEnd);
+            op = matchEnd;
+        }
+        else {
+            if (distance >= 8) {
+                while (matchLength >= 8) {
+                    memcpy(op, ref, 8);
+                    op += 8;
+                    ref += 8;
+                    matchLength -= 8;
+                }
+            }
+            while (op < matchEnd) {
+                *op++ = *ref++;
+            }
+        }
+    }
+    return op == opEnd;
+}
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace openxbox {
+
+/*!
+ * Returns the size of the buffer required to compress srcLength bytes in
+ * the worst case, where the data does not compress at all.
+ */
+size_t LZ_CompressBound(size_t srcLength);
+
+/*!
+ * Compresses a block of data with a byte-oriented LZ77 codec tuned for
+ * decompression speed. The block is compressed independently of any other
+ * data.
+ *
+ * The compressed stream is a sequence of commands, each made of a token
+ * byte, a run of literals and a match. The high nibble of the token is the
+ * number of literals and the low nibble is the match length minus 4; a
+ * nibble of 15 is followed by extra length bytes, each adding up to 255,
+ * ending with a byte smaller than 255. The literals follow, then the
+ * distance to the start of the match as a 16-bit little-endian value. The
+ * last command of the stream has literals only.
+ *
+ * Returns the compressed size, or 0 if dest is too small.
+ */
+size_t LZ_Compress(const uint8_t *src, size_t srcLength, uint8_t *dest, size_t destCapacity);
+
+/*!
+ * Decompresses a block produced by LZ_Compress. The decompressed size must
+ * be known in advance. Returns false if the stream is malformed or does not
+ * decompress to exactly destLength bytes.
+ */
+bool LZ_Decompress(const uint8_t *src, size_t srcLength, uint8_t *dest, size_t destLength);
+
+}
@@ -23,6 +23,14 @@ enum EmulatorStatus {
     EMUS_INIT_CPU_MEM_MAP_FAILED,     // Memory mapping failed
 
     EMUS_INIT_DEBUGGER_FAILED,        // Debugger initialization failed
+
+    EMUS_INIT_HDD_IMAGE_FAILED,       // Could not open or create the hard drive image
+    EMUS_INIT_DVD_IMAGE_FAILED,       // Could not open the DVD image
+    EMUS_INIT_HDD_OVERLAY_FAILED,     // Could not open or create the hard drive overlay
+    EMUS_INIT_HDD_DIRECTORY_FAILED,   // Could not open the hard drive host directory
+    EMUS_INIT_NET_BACKEND_FAILED,     // Could not open the network backend
+    EMUS_INIT_AUDIO_SINK_FAILED,      // Could not open the audio output
+    EMUS_INIT_CHAR_DRIVER_FAILED,     // Could not open the host end of a serial port
 };
 
 enum CPUInitStatus {
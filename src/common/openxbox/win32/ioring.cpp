@@ -0,0 +1,16 @@
+#ifdef _WIN32
+
+#include "openxbox/ioring.h"
+
+namespace openxbox {
+
+IORing *IORing_Create(unsigned int entries) {
+    // I/O rings operate on file descriptors, which don't map to the handles
+    // used by overlapped I/O. Disk images are served through the synchronous
+    // and memory-mapped paths on Windows instead.
+    return nullptr;
+}
+
+}
+
+#endif // _WIN32
@@ -0,0 +1,203 @@
+// ATA/ATAPI-4 emulation for the Original Xbox
+// (C) Ivan "StrikerX3" Oliveira
+//
+// This code aims to implement a subset of the ATA/ATAPI-4 specification
+// that satisifies the requirements of an IDE interface for the Original Xbox.
+//
+// Specification:
+// http://www.t13.org/documents/UploadedDocuments/project/d1153r18-ATA-ATAPI-4.pdf
+//
+// References to particular items in the specification are denoted between brackets
+// optionally followed by a quote from the specification.
+#include "ata_bus_master.h"
+
+#include <cstring>
+
+#include "openxbox/log.h"
+
+namespace openxbox {
+namespace hw {
+namespace ata {
+
+ATABusMaster::ATABusMaster() {
+}
+
+ATABusMaster::~ATABusMaster() {
+}
+
+void ATABusMaster::SetMemory(uint8_t *ram, uint32_t ramSize) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_ram = ram;
+    m_ramSize = ramSize;
+}
+
+void ATABusMaster::ReadRegister(uint8_t reg, uint32_t *value, uint8_t size) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+
+    // Registers may be accessed with any size; assemble the value byte by byte
+    *value = 0;
+    for (uint8_t i = 0; i < size && reg + i < kBusMasterChannelStride; i++) {
+        *value |= ReadByte(reg + i) << (i * 8);
+    }
+}
+
+void ATABusMaster::WriteRegister(uint8_t reg, uint32_t value, uint8_t size) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+
+    for (uint8_t i = 0; i < size && reg + i < kBusMasterChannelStride; i++) {
+        WriteByte(reg + i, (value >> (i * 8)) & 0xFF);
+    }
+}
+
+uint8_t ATABusMaster::ReadByte(uint8_t reg) {
+    switch (reg) {
+    case BMRegCommand: return m_command;
+    case BMRegStatus: return m_status;
+    case BMRegPRDTable + 0: return m_prdTableAddress & 0xFF;
+    case BMRegPRDTable + 1: return (m_prdTableAddress >> 8) & 0xFF;
+    case BMRegPRDTable + 2: return (m_prdTableAddress >> 16) & 0xFF;
+    case BMRegPRDTable + 3: return (m_prdTableAddress >> 24) & 0xFF;
+    default: return 0;
+    }
+}
+
+void ATABusMaster::WriteByte(uint8_t reg, uint8_t value) {
+    switch (reg) {
+    case BMRegCommand:
+    {
+        bool wasStarted = (m_command & BMCmdStart) != 0;
+        bool start = (value & BMCmdStart) != 0;
+
+        // The direction may only be changed while the engine is stopped
+        if (wasStarted) {
+            value = (value & ~BMCmdWriteToMemory) | (m_command & BMCmdWriteToMemory);
+        }
+        m_command = value & (BMCmdStart | BMCmdWriteToMemory);
+
+        if (start && !wasStarted) {
+            m_status |= BMStActive;
+            m_startCond.notify_all();
+        }
+        else if (!start && wasStarted) {
+            // Stopping the engine makes it idle regardless of the PRD table
+            m_status &= ~BMStActive;
+            m_prdRemaining = false;
+        }
+        break;
+    }
+    case BMRegStatus:
+        // Interrupt and Error are cleared by writing ones; the DMA capable bits are plain storage
+        m_status &= ~(value & (BMStInterrupt | BMStError));
+        m_status = (m_status & ~(BMStDrive0DMACapable | BMStDrive1DMACapable)) | (value & (BMStDrive0DMACapable | BMStDrive1DMACapable));
+        break;
+    case BMRegPRDTable + 0: m_prdTableAddress = (m_prdTableAddress & 0xFFFFFF00) | (value & 0xFC); break;
+    case BMRegPRDTable + 1: m_prdTableAddress = (m_prdTableAddress & 0xFFFF00FF) | (value << 8); break;
+    case BMRegPRDTable + 2: m_prdTableAddress = (m_prdTableAddress & 0xFF00FFFF) | (value << 16); break;
+    case BMRegPRDTable + 3: m_prdTableAddress = (m_prdTableAddress & 0x00FFFFFF) | ((uint32_t)value << 24); break;
+    default:
+        break;
+    }
+}
+
+bool ATABusMaster::BeginTransfer(bool toMemory, uint32_t length, std::vector<IoVec>& buffers) {
+    std::unique_lock<std::mutex> lk(m_mutex);
+
+    // The guest usually issues the command before starting the engine
+    m_startCond.wait(lk, [&]() -> bool { return (m_command & BMCmdStart) || m_shutdown || m_abort; });
+    if (m_shutdown || m_abort) {
+        return false;
+    }
+
+    if (((m_command & BMCmdWriteToMemory) != 0) != toMemory) {
+        log_debug("ATABusMaster::BeginTransfer:  Engine programmed for the wrong direction\n");
+        m_status = (m_status & ~BMStActive) | BMStError;
+        return false;
+    }
+
+    if (!MapPRDTable(length, buffers)) {
+        m_status = (m_status & ~BMStActive) | BMStError;
+        return false;
+    }
+    return true;
+}
+
+bool ATABusMaster::MapPRDTable(uint32_t length, std::vector<IoVec>& buffers) {
+    buffers.clear();
+    m_prdRemaining = false;
+
+    uint32_t address = m_prdTableAddress;
+    uint32_t remaining = length;
+    for (uint32_t i = 0; i < kMaxPRDEntries; i++) {
+        if (m_ram == nullptr || (uint64_t)address + 8 > m_ramSize) {
+            log_debug("ATABusMaster::MapPRDTable:  PRD table at 0x%x is outside of RAM\n", address);
+            return false;
+        }
+
+        uint32_t base, control;
+        memcpy(&base, m_ram + address, sizeof(base));
+        memcpy(&control, m_ram + address + 4, sizeof(control));
+        address += 8;
+
+        uint32_t count = control & kPRDByteCountMask;
+        if (count == 0) {
+            count = 0x10000;
+        }
+        base &= ~1;
+        if ((uint64_t)base + count > m_ramSize) {
+            log_debug("ATABusMaster::MapPRDTable:  Region 0x%x-0x%x is outside of RAM\n", base, base + count - 1);
+            return false;
+        }
+
+        uint32_t used = (count < remaining) ? count : remaining;
+        IoVec buffer = { m_ram + base, used };
+        buffers.push_back(buffer);
+        remaining -= used;
+
+        bool last = (control & kPRDEndOfTable) != 0;
+        if (remaining == 0) {
+            m_prdRemaining = !last || used < count;
+            return true;
+        }
+        if (last) {
+            break;
+        }
+    }
+
+    log_debug("ATABusMaster::MapPRDTable:  PRD table describes less than the %u bytes to transfer\n", length);
+    return false;
+}
+
+void ATABusMaster::EndTransfer() {
+    std::lock_guard<std::mutex> lk(m_mutex);
+
+    // The engine only goes idle once the PRD table has been exhausted
+    if (!m_prdRemaining) {
+        m_status &= ~BMStActive;
+    }
+}
+
+void ATABusMaster::SignalInterrupt() {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_status |= BMStInterrupt;
+}
+
+void ATABusMaster::Abort() {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_abort = true;
+    m_startCond.notify_all();
+}
+
+void ATABusMaster::ClearAbort() {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_abort = false;
+}
+
+void ATABusMaster::Shutdown() {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_shutdown = true;
+    m_startCond.notify_all();
+}
+
+}
+}
+}
@@ -0,0 +1,100 @@
+// ATA/ATAPI-4 emulation for the Original Xbox
+// (C) Ivan "StrikerX3" Oliveira
+//
+// This code aims to implement a subset of the ATA/ATAPI-4 specification
+// that satisifies the requirements of an IDE interface for the Original Xbox.
+//
+// Specification:
+// http://www.t13.org/documents/UploadedDocuments/project/d1153r18-ATA-ATAPI-4.pdf
+//
+// References to particular items in the specification are denoted between brackets
+// optionally followed by a quote from the specification.
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "openxbox/iovec.h"
+#include "../ata/defs.h"
+
+namespace openxbox {
+namespace hw {
+namespace ata {
+
+/*!
+ * The bus master IDE engine of one ATA channel.
+ *
+ * The guest programs the engine through the registers mapped by BAR4 of the
+ * IDE controller. DMA commands executed by the channel's command processor
+ * thread wait for the guest to start the engine, then receive the regions
+ * described by the PRD table as pointers into guest RAM, so that device
+ * drivers transfer sectors straight to and from guest memory.
+ */
+class ATABusMaster {
+public:
+    ATABusMaster();
+    ~ATABusMaster();
+
+    void SetMemory(uint8_t *ram, uint32_t ramSize);
+
+    // ----- Register access --------------------------------------------------
+
+    void ReadRegister(uint8_t reg, uint32_t *value, uint8_t size);
+    void WriteRegister(uint8_t reg, uint32_t value, uint8_t size);
+
+    // ----- Transfers --------------------------------------------------------
+
+    /*!
+     * Waits for the guest to start the engine, then maps the first length
+     * bytes described by the PRD table onto guest memory. Returns false if
+     * the wait was aborted, or if the engine was programmed in the wrong
+     * direction or given an invalid or short PRD table, in which case the
+     * transfer must not be performed.
+     */
+    bool BeginTransfer(bool toMemory, uint32_t length, std::vector<IoVec>& buffers);
+
+    // Completes a transfer started with BeginTransfer
+    void EndTransfer();
+
+    // Latches the rising edge of the channel's INTRQ into the status register
+    void SignalInterrupt();
+
+    // Fails the transfer of the command in progress, releasing a command
+    // processor thread waiting for the engine to start. Used when the host
+    // resets the device while a DMA command is executing.
+    void Abort();
+
+    // Clears an abort request once the command in progress has completed
+    void ClearAbort();
+
+    // Releases a command processor thread waiting for the engine to start
+    void Shutdown();
+
+private:
+    uint8_t ReadByte(uint8_t reg);
+    void WriteByte(uint8_t reg, uint8_t value);
+
+    bool MapPRDTable(uint32_t length, std::vector<IoVec>& buffers);
+
+    std::mutex m_mutex;
+    std::condition_variable m_startCond;
+    bool m_shutdown = false;
+    bool m_abort = false;
+
+    uint8_t m_command = 0;
+    uint8_t m_status = 0;
+    uint32_t m_prdTableAddress = 0;
+
+    // Whether the PRD table of the transfer in progress describes more bytes
+    // than the transfer; the engine then remains active after completion
+    bool m_prdRemaining = false;
+
+    uint8_t *m_ram = nullptr;
+    uint32_t m_ramSize = 0;
+};
+
+}
+}
+}
@@ -13,6 +13,7 @@
 
 #include "openxbox/log.h"
 #include "openxbox/io.h"
+#include "openxbox/thread.h"
 
 namespace openxbox {
 namespace hw {
@@ -26,9 +27,21 @@ ATAChannel::ATAChannel(Channel channel, IRQHandler *irqHandler, uint8_t irqNum)
     for (uint8_t i = 0; i < 2; i++) {
         m_devs[i] = new ATADevice(m_channel, i, m_regs);
     }
+
+    m_commandThread = std::thread(CommandThread, this);
 }
 
 ATAChannel::~ATAChannel() {
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_running = false;
+    }
+    m_commandCond.notify_one();
+    m_busMaster.Shutdown();
+    if (m_commandThread.joinable()) {
+        m_commandThread.join();
+    }
+
     for (uint8_t i = 0; i < 2; i++) {
         delete m_devs[i];
     }
@@ -48,6 +61,15 @@ bool ATAChannel::ReadCommandPort(Register reg, uint32_t *value, uint8_t size) {
         log_debug("ATAChannel::ReadCommandPort: Unexpected read of size %d from register %d for channel %d\n", size, reg, m_channel);
     }
 
+    std::lock_guard<std::mutex> lk(m_mutex);
+
+    // [7.15.6.1] While the device is busy, the other registers belong to the
+    // command in progress; return the contents of the Status register instead
+    if (m_regs.status & StBusy) {
+        *value = m_regs.status;
+        return true;
+    }
+
     // Check that there is an attached device
     bool attached = m_devs[GetSelectedDeviceIndex()]->IsAttached();
 
@@ -57,13 +79,16 @@ bool ATAChannel::ReadCommandPort(Register reg, uint32_t *value, uint8_t size) {
         *value = 0;
     }
     else {
+        // (ATA/ATAPI-6) HOB=1 selects the previous contents of the 48-bit address registers
+        bool hob = (m_regs.control & DevCtlHighOrderByte) != 0;
+        uint16_t cylinder = hob ? m_regs.prevCylinder : m_regs.cylinder;
         switch (reg) {
         case RegData: ReadData(value, size); break;
         case RegError: *value = m_regs.error; break;
-        case RegSectorCount: *value = m_regs.sectorCount ; break;
-        case RegSectorNumber: *value = m_regs.sectorNumber ; break;
-        case RegCylinderLow: *value = m_regs.cylinder & 0xFF ; break;
-        case RegCylinderHigh: *value = (m_regs.cylinder >> 8) & 0xFF ; break;
+        case RegSectorCount: *value = hob ? m_regs.prevSectorCount : m_regs.sectorCount; break;
+        case RegSectorNumber: *value = hob ? m_regs.prevSectorNumber : m_regs.sectorNumber; break;
+        case RegCylinderLow: *value = cylinder & 0xFF ; break;
+        case RegCylinderHigh: *value = (cylinder >> 8) & 0xFF ; break;
         case RegDeviceHead: *value = m_regs.deviceHead ; break;
         case RegStatus: ReadStatus(reinterpret_cast<uint8_t*>(value)); break;
         }
@@ -85,6 +110,8 @@ bool ATAChannel::WriteCommandPort(Register reg, uint32_t value, uint8_t size) {
         log_debug("ATAChannel::WriteCommandPort: Unexpected write of size %d to register %d for channel %d\n", size, reg, m_channel);
     }
 
+    std::lock_guard<std::mutex> lk(m_mutex);
+
     // [7.15.6.1] While the device is busy, writes to any command register are ignored,
     // except if sending the Device Reset command
     if (m_regs.status & StBusy) {
@@ -92,15 +119,31 @@ bool ATAChannel::WriteCommandPort(Register reg, uint32_t value, uint8_t size) {
             log_spew("ATAChannel::WriteCommandPort: Attempted to write register while device is busy\n");
             return true;
         }
+
+        // Device Reset stops the command in progress
+        m_busMaster.Abort();
+    }
+
+    // (ATA/ATAPI-6) Writing to any Command Block register clears HOB
+    if (reg != RegData) {
+        m_regs.control &= ~DevCtlHighOrderByte;
     }
 
+    // (ATA/ATAPI-6) The 48-bit address registers keep their previous value,
+    // which holds the upper half of the address or sector count
     switch (reg) {
     case RegData: WriteData(value, size); break;
-    case RegFeatures: m_regs.features = value; break;
-    case RegSectorCount: m_regs.sectorCount = value; break;
-    case RegSectorNumber: m_regs.sectorNumber = value; break;
-    case RegCylinderLow: m_regs.cylinder = (m_regs.cylinder & 0xFF00) | (value & 0xFF); break;
-    case RegCylinderHigh: m_regs.cylinder = (m_regs.cylinder & 0x00FF) | ((value & 0xFF) << 8); break;
+    case RegFeatures: m_regs.prevFeatures = m_regs.features; m_regs.features = value; break;
+    case RegSectorCount: m_regs.prevSectorCount = m_regs.sectorCount; m_regs.sectorCount = value; break;
+    case RegSectorNumber: m_regs.prevSectorNumber = m_regs.sectorNumber; m_regs.sectorNumber = value; break;
+    case RegCylinderLow:
+        m_regs.prevCylinder = (m_regs.prevCylinder & 0xFF00) | (m_regs.cylinder & 0xFF);
+        m_regs.cylinder = (m_regs.cylinder & 0xFF00) | (value & 0xFF);
+        break;
+    case RegCylinderHigh:
+        m_regs.prevCylinder = (m_regs.prevCylinder & 0x00FF) | (m_regs.cylinder & 0xFF00);
+        m_regs.cylinder = (m_regs.cylinder & 0x00FF) | ((value & 0xFF) << 8);
+        break;
     case RegDeviceHead: m_regs.deviceHead = value; break;
     case RegCommand: WriteCommand(value); break;
     }
@@ -114,8 +157,10 @@ bool ATAChannel::ReadControlPort(uint32_t *value, uint8_t size) {
         log_debug("ATAChannel::ReadControlPort: Unexpected read of size %d for channel %d\n", size, m_channel);
     }
 
-    // Reading from this port returns the contents of the Status register
-    ReadStatus(reinterpret_cast<uint8_t *>(value));
+    // Reading from this port returns the contents of the Status register.
+    // [7.3] Unlike reading the Status register, this does not clear a pending
+    // interrupt, so the guest may poll it while a command executes.
+    *value = m_regs.status;
     return true;
 }
 
@@ -125,6 +170,8 @@ bool ATAChannel::WriteControlPort(uint32_t value, uint8_t size) {
         log_debug("ATAChannel::WriteControlPort: Unexpected write of size %d for channel %d\n", size, m_channel);
     }
     
+    std::lock_guard<std::mutex> lk(m_mutex);
+
     // Make sure to update the INTRQ state if nIEN is enabled before updating the register
     // to ensure we send a low state to the IRQ handler
     if (value & DevCtlNegateInterruptEnable) {
@@ -133,6 +180,12 @@ bool ATAChannel::WriteControlPort(uint32_t value, uint8_t size) {
 
     if (value & DevCtlSoftwareReset) {
         log_debug("ATAChannel::WriteControlPort: Software reset triggered on channel %d\n", m_channel);
+
+        // Don't leave a DMA command waiting for a bus master that the host
+        // will never start
+        if (m_regs.status & StBusy) {
+            m_busMaster.Abort();
+        }
         // TODO: implement [9.3.1] for device 0 and [9.3.2] for device 1
     }
 
@@ -154,13 +207,28 @@ void ATAChannel::ReadData(uint32_t *value, uint8_t size) {
         log_warning("ATAChannel::ReadData:  Buffer underflow!  channel = %d  device = %d  size = %d  read = %d\n", m_channel, devIndex, size, lenRead);
     }
 
-    // TODO: multiblock transfer
-    // - device should provide a method to request the next block of data
-    // - returns true if there is a next block, false if not
-    // - when true, set BSY=1 in addition to clearing DRQ=0
+    if (dev->GetRemainingBufferLength() == 0) {
+        // [9.7] The last data block has been transferred; clear DRQ=0
+        m_regs.status &= ~StDataRequest;
 
-    // Clear DRQ=0
-    m_regs.status &= ~StDataRequest;
+        // [9.11] PACKET commands then enter the status phase and assert INTRQ
+        if (dev->IsPacketCommand()) {
+            dev->EndPacketCommand();
+            if (AreInterruptsEnabled()) {
+                SetInterrupt(true);
+            }
+        }
+    }
+    else if (dev->IsDataBlockComplete()) {
+        // [9.7] The next data block was prefetched with the rest of the command,
+        // so it is immediately available. Keep DRQ=1 and assert INTRQ if nIEN=0.
+        if (dev->IsPacketCommand()) {
+            dev->NextPacketDataBlock();
+        }
+        if (AreInterruptsEnabled()) {
+            SetInterrupt(true);
+        }
+    }
 }
 
 void ATAChannel::ReadStatus(uint8_t *value) {
@@ -171,7 +239,35 @@ void ATAChannel::ReadStatus(uint8_t *value) {
 }
 
 void ATAChannel::WriteData(uint32_t value, uint8_t size) {
-    log_warning("ATAChannel::WriteData:  Unimplemented!  (channel = %d  device = %d  size = %d, value = 0x%x)\n", m_channel, GetSelectedDeviceIndex(), size, value);
+    auto devIndex = GetSelectedDeviceIndex();
+    auto dev = m_devs[devIndex];
+
+    // Data can only be written while the device requests it
+    if ((m_regs.status & StDataRequest) == 0) {
+        log_debug("ATAChannel::WriteData:  Unexpected write while DRQ=0  (channel = %d  device = %d  size = %d, value = 0x%x)\n", m_channel, devIndex, size, value);
+        return;
+    }
+
+    // Write to device buffer
+    uint32_t lenWritten = dev->WriteBuffer(reinterpret_cast<uint8_t *>(&value), size);
+    if (lenWritten != size) {
+        log_warning("ATAChannel::WriteData:  Buffer overflow!  channel = %d  device = %d  size = %d  written = %d\n", m_channel, devIndex, size, lenWritten);
+    }
+
+    if (dev->GetRemainingBufferLength() == 0) {
+        // [9.8] The last data block has been received: clear DRQ=0, set BSY=1
+        // and let the command processor write the data
+        m_regs.status = (m_regs.status & (uint8_t)~StDataRequest) | StBusy;
+        m_dataOutPending = true;
+        m_commandCond.notify_one();
+    }
+    else if (dev->IsDataBlockComplete()) {
+        // [9.8] The block is kept in the buffer until the whole command has been
+        // received. Keep DRQ=1 to request the next block and assert INTRQ if nIEN=0.
+        if (AreInterruptsEnabled()) {
+            SetInterrupt(true);
+        }
+    }
 }
 
 void ATAChannel::WriteCommand(uint8_t value) {
@@ -183,57 +279,173 @@ void ATAChannel::WriteCommand(uint8_t value) {
         return;
     }
 
-    // Determine which protocol is used by the command and collect all data needed for execution
-    auto protocol = kCmdProtocols.at(cmd);
-    auto devIndex = GetSelectedDeviceIndex();
-    auto dev = m_devs[devIndex];
-    bool succeeded;
-
     // Every protocol starts by setting BSY=1
     m_regs.status |= StBusy;
-    
-    // TODO: submit this entire block as a job to the command processor thread
-    {
-        switch (cmd) {
-        case CmdSetFeatures:
-            succeeded = dev->SetFeatures();
-            break;
-        case CmdIdentifyDevice:
-            succeeded = dev->IdentifyDevice();
-            break;
-        default:
-            log_warning("ATAChannel::WriteCommand:  Unhandled command 0x%x for channel %d, device %d\n", cmd, m_channel, devIndex);
-            succeeded = false;
+
+    // Hand the command over to the command processor thread
+    m_pendingCommand = cmd;
+    m_commandPending = true;
+    m_commandCond.notify_one();
+}
+
+void ATAChannel::CommandThread(ATAChannel *channel) {
+    Thread_SetName(channel->m_channel == ChanPrimary ? "[HW] ATA primary channel" : "[HW] ATA secondary channel");
+
+    std::unique_lock<std::mutex> lk(channel->m_mutex);
+    for (;;) {
+        channel->m_commandCond.wait(lk, [&]() -> bool { return channel->m_commandPending || channel->m_dataOutPending || !channel->m_running; });
+        if (!channel->m_running) {
             break;
         }
 
-        if (succeeded) {
-            // On PIO data in, DRQ is asserted if the device has successfully executed the command
-            // On PIO data out, DRQ is asserted when the device is ready to accept data
-            if (protocol == CmdProtoPIODataIn || protocol == CmdProtoPIODataOut) {
-                m_regs.status |= StDataRequest;
-            }
+        // The guest cannot touch the registers used by the command while BSY=1,
+        // so the command runs without holding the lock
+        bool interrupt = true;
+        if (channel->m_dataOutPending) {
+            channel->m_dataOutPending = false;
+            lk.unlock();
+            channel->CompleteDataOut();
+            lk.lock();
         }
         else {
-            // Set Error status if the device reported an error
-            m_regs.status |= StError;
+            Command cmd = channel->m_pendingCommand;
+            channel->m_commandPending = false;
+            lk.unlock();
+            interrupt = channel->ExecuteCommand(cmd);
+            lk.lock();
         }
 
+        // A reset issued while the command executed only applies to that command
+        channel->m_busMaster.ClearAbort();
+
         // Clear BSY=0
-        m_regs.status &= ~StBusy;
+        channel->m_regs.status &= (uint8_t)~StBusy;
 
         // Assert INTRQ if nIEN=0
         // INTRQ will be negated when the host reads the Status register
-        if (AreInterruptsEnabled()) {
-            SetInterrupt(true);
+        if (interrupt && channel->AreInterruptsEnabled()) {
+            channel->SetInterrupt(true);
         }
     }
 }
 
+bool ATAChannel::ExecuteCommand(Command cmd) {
+    // Determine which protocol is used by the command and collect all data needed for execution
+    auto protocol = kCmdProtocols.at(cmd);
+    auto devIndex = GetSelectedDeviceIndex();
+    auto dev = m_devs[devIndex];
+    bool succeeded;
+
+    // Errors are reported for the command being executed
+    m_regs.error = 0;
+    m_regs.status &= (uint8_t)~StError;
+
+    switch (cmd) {
+    case CmdDeviceReset:
+        succeeded = dev->DeviceReset();
+        break;
+    case CmdFlushCache:
+    case CmdFlushCacheExt:
+        succeeded = dev->FlushCache();
+        break;
+    case CmdReadDMA:
+    case CmdReadDMANoRetry:
+        succeeded = dev->ReadDMA(m_busMaster);
+        break;
+    case CmdReadDMAExt:
+        succeeded = dev->ReadDMAExt(m_busMaster);
+        break;
+    case CmdReadMultiple:
+        succeeded = dev->ReadMultiple();
+        break;
+    case CmdReadMultipleExt:
+        succeeded = dev->ReadMultipleExt();
+        break;
+    case CmdReadSectors:
+    case CmdReadSectorsNoRetry:
+        succeeded = dev->ReadSectors();
+        break;
+    case CmdReadSectorsExt:
+        succeeded = dev->ReadSectorsExt();
+        break;
+    case CmdSetMultipleMode:
+        succeeded = dev->SetMultipleMode();
+        break;
+    case CmdWriteDMA:
+    case CmdWriteDMANoRetry:
+        succeeded = dev->WriteDMA(m_busMaster);
+        break;
+    case CmdWriteDMAExt:
+        succeeded = dev->WriteDMAExt(m_busMaster);
+        break;
+    case CmdWriteMultiple:
+        succeeded = dev->WriteMultiple();
+        break;
+    case CmdWriteMultipleExt:
+        succeeded = dev->WriteMultipleExt();
+        break;
+    case CmdWriteSectors:
+    case CmdWriteSectorsNoRetry:
+        succeeded = dev->WriteSectors();
+        break;
+    case CmdWriteSectorsExt:
+        succeeded = dev->WriteSectorsExt();
+        break;
+    case CmdSetFeatures:
+        succeeded = dev->SetFeatures();
+        break;
+    case CmdIdentifyDevice:
+        succeeded = dev->IdentifyDevice();
+        break;
+    case CmdIdentifyPacketDevice:
+        succeeded = dev->IdentifyPacketDevice();
+        break;
+    case CmdPacket:
+        succeeded = dev->Packet();
+        break;
+    default:
+        log_warning("ATAChannel::ExecuteCommand:  Unhandled command 0x%x for channel %d, device %d\n", cmd, m_channel, devIndex);
+        succeeded = false;
+        break;
+    }
+
+    if (succeeded) {
+        // On PIO data in, DRQ is asserted if the device has successfully executed the command
+        // On PIO data out, DRQ is asserted when the device is ready to accept data
+        // On PACKET, DRQ is asserted when the device is ready to accept the command packet
+        if (protocol == CmdProtoPIODataIn || protocol == CmdProtoPIODataOut || protocol == CmdProtoPACKET) {
+            m_regs.status |= StDataRequest;
+        }
+
+        // [9.8] [9.11] The device does not assert INTRQ when it becomes ready to
+        // receive the first data block of a PIO data out command or the command
+        // packet of a PACKET command. [9.2] Device Reset does not assert INTRQ.
+        return protocol != CmdProtoPIODataOut && protocol != CmdProtoPACKET && protocol != CmdProtoDeviceReset;
+    }
+
+    // Set Error status if the device reported an error
+    m_regs.status |= StError;
+    return true;
+}
+
+void ATAChannel::CompleteDataOut() {
+    auto devIndex = GetSelectedDeviceIndex();
+    auto dev = m_devs[devIndex];
+
+    // The data is either the command packet of a PACKET command or the sectors of a PIO data out command
+    bool succeeded = dev->IsPacketCommand() ? dev->ProcessPacket(m_busMaster) : dev->EndPIODataOut();
+    if (!succeeded) {
+        m_regs.status |= StError;
+    }
+}
+
 void ATAChannel::SetInterrupt(bool asserted) {
     if (asserted != m_interrupt && AreInterruptsEnabled()) {
         m_interrupt = asserted;
         m_irqHandler->HandleIRQ(m_irqNum, m_interrupt);
+        if (asserted) {
+            m_busMaster.SignalInterrupt();
+        }
     }
 }
 
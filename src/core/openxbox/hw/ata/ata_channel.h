@@ -11,12 +11,16 @@
 // optionally followed by a quote from the specification.
 #pragma once
 
+#include <condition_variable>
 #include <cstdint>
+#include <mutex>
+#include <thread>
 
 #include "openxbox/cpu.h"
 #include "../basic/irq.h"
 #include "ata_device.h"
 #include "ata_common.h"
+#include "ata_bus_master.h"
 
 namespace openxbox {
 namespace hw {
@@ -26,6 +30,17 @@ namespace ata {
  * Represents one of the two ATA channels in a machine (primary or secondary).
  *
  * An ATA channel contains two devices, typically called master and slave.
+ *
+ * Commands are executed by a command processor thread owned by the channel,
+ * so that slow block I/O never stalls the virtual CPU. The register write
+ * that issues a command sets BSY=1 and hands the command to the thread,
+ * which clears BSY and asserts INTRQ when the command completes. While BSY
+ * is set, the guest can only observe the Status register.
+ *
+ * PIO sector transfers move all sectors of a command between the device
+ * driver and a buffer in a single request. The guest then transfers the
+ * buffer through the Data register one DRQ data block at a time, and the
+ * channel signals each subsequent block without further host I/O.
  */
 class ATAChannel {
 public:
@@ -33,6 +48,7 @@ public:
     ~ATAChannel();
 
     ATADevice& GetDevice(uint8_t deviceIndex) { return *m_devs[deviceIndex]; }
+    ATABusMaster& GetBusMaster() { return m_busMaster; }
 
     // ----- Basic I/O --------------------------------------------------------
 
@@ -51,6 +67,10 @@ private:
 
     ATADevice *m_devs[2];
 
+    // ----- Bus master DMA ---------------------------------------------------
+
+    ATABusMaster m_busMaster;
+
     // ----- Registers --------------------------------------------------------
 
     ATARegisters m_regs;
@@ -66,6 +86,30 @@ private:
     IRQHandler *m_irqHandler;
     uint8_t m_irqNum;
 
+    // ----- Command processor ------------------------------------------------
+
+    // Guards every register except Status against concurrent access from the
+    // guest and the command processor, and serializes INTRQ updates
+    std::mutex m_mutex;
+
+    std::thread m_commandThread;
+    std::condition_variable m_commandCond;
+    bool m_running = true;
+
+    bool m_commandPending = false;
+    Command m_pendingCommand;
+
+    // Set when the guest has written the last data block of a PIO data out
+    // command or the command packet of a PACKET command, which is then
+    // processed by the command processor
+    bool m_dataOutPending = false;
+
+    static void CommandThread(ATAChannel *channel);
+
+    // Executes the command and returns whether INTRQ should be asserted
+    bool ExecuteCommand(Command cmd);
+    void CompleteDataOut();
+
     // ----- Command port operations ------------------------------------------
 
     void ReadData(uint32_t *value, uint8_t size);
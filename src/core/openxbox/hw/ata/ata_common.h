@@ -11,6 +11,7 @@
 // optionally followed by a quote from the specification.
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 
 #include "openxbox/cpu.h"
@@ -26,7 +27,8 @@ enum Channel {
 };
 
 struct ATARegisters {
-    uint8_t status = StReady;
+    // Read by the guest while commands execute on the command processor thread
+    std::atomic<uint8_t> status{ StReady };
     uint8_t error = 0;
     uint8_t features = 0;
     uint8_t sectorCount = 0;
@@ -34,6 +36,14 @@ struct ATARegisters {
     uint16_t cylinder = 0;
     uint8_t deviceHead = 0;
     uint8_t control = 0;
+
+    // (ATA/ATAPI-6) Previous contents of the registers that hold the upper
+    // halves of 48-bit addresses and sector counts. Every write to one of
+    // these registers moves its current value here.
+    uint8_t prevFeatures = 0;
+    uint8_t prevSectorCount = 0;
+    uint8_t prevSectorNumber = 0;
+    uint16_t prevCylinder = 0;
 };
 
 }
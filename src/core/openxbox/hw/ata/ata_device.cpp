@@ -11,9 +11,13 @@
 // optionally followed by a quote from the specification.
 #include "ata.h"
 
+#include "atapi_defs.h"
+
 #include "openxbox/log.h"
 #include "openxbox/io.h"
 
+#include <algorithm>
+
 namespace openxbox {
 namespace hw {
 namespace ata {
@@ -41,6 +45,7 @@ void ATADevice::InitDataBuffer(uint32_t dataBufferSize) {
     }
     m_dataBufferSize = dataBufferSize;
     m_dataBufferPos = 0;
+    m_dataBlockSize = dataBufferSize;
 }
 
 uint32_t ATADevice::ReadBuffer(uint8_t *dest, uint32_t length) {
@@ -54,15 +59,56 @@ uint32_t ATADevice::ReadBuffer(uint8_t *dest, uint32_t length) {
     return lenToRead;
 }
 
+uint32_t ATADevice::WriteBuffer(const uint8_t *src, uint32_t length) {
+    uint32_t lenToWrite = length;
+    if (m_dataBufferPos + length > m_dataBufferSize) {
+        lenToWrite = GetRemainingBufferLength();
+    }
+
+    memcpy(m_dataBuffer + m_dataBufferPos, src, lenToWrite);
+    m_dataBufferPos += lenToWrite;
+    return lenToWrite;
+}
+
 uint32_t ATADevice::GetRemainingBufferLength() {
     return m_dataBufferSize - m_dataBufferPos;
 }
 
+bool ATADevice::FlushCache() {
+    // Ask the device driver to commit all written sectors to its backing store.
+    // This may block on host I/O; it runs on the channel's command processor thread.
+    bool succeeded = m_driver->Flush();
+
+    // Device/Head register:
+    //  "DEV shall indicate the selected device."
+    m_regs.deviceHead = (m_regs.deviceHead & ~(1 << kDevSelectorBit)) | (m_devIndex << kDevSelectorBit);
+
+    // Status register:
+    //  "DRDY shall be set to one."
+    m_regs.status |= StReady;
+
+    if (!succeeded) {
+        // Error register:
+        //  "ABRT shall be set to one if this command is not supported or if the device is not able to complete the action requested by the command."
+        m_regs.error |= ErrAbort;
+    }
+
+    return succeeded;
+}
+
 bool ATADevice::IdentifyDevice() {
+    // [8.12.5.2] Devices that implement the PACKET command feature set abort
+    // this command and place their signature in the Command Block registers
+    if (m_driver->IsATAPIDevice()) {
+        SetPacketDeviceSignature();
+        m_regs.status |= StReady;
+        m_regs.error |= ErrAbort;
+        return false;
+    }
+
     bool succeeded = __doIdentifyDevice();
 
     // Handle normal output as specified in [8.12.5.1]
-    // TODO: support PACKET commands and implement [8.12.5.2]
     if (succeeded) {
         // Device/Head register:
         //  "DEV shall indicate the selected device."
@@ -96,11 +142,441 @@ bool ATADevice::__doIdentifyDevice() {
 
     // Ask the device driver to identify itself
     InitDataBuffer(sizeof(IdentifyDeviceData));
-    m_driver->IdentifyDevice(reinterpret_cast<IdentifyDeviceData *>(m_dataBuffer));
+    auto identify = reinterpret_cast<IdentifyDeviceData *>(m_dataBuffer);
+    m_driver->IdentifyDevice(identify);
+
+    // [8.12.8 table 11 word 59] Report the current Set Multiple Mode setting
+    if (identify->maxTransferPerInterrupt != 0 && m_multipleSectors != 0) {
+        identify->currentMultiSectorSettings = IDMultiSectValid | m_multipleSectors;
+    }
     
     return true;
 }
 
+bool ATADevice::IdentifyPacketDevice() {
+    // [8.13] Only devices that implement the PACKET command feature set support this command
+    if (!m_driver->IsATAPIDevice()) {
+        //  "ABRT shall be set to one if the device does not support this command."
+        m_regs.error |= ErrAbort;
+        return false;
+    }
+
+    // Ask the device driver to identify itself
+    InitDataBuffer(sizeof(IdentifyDeviceData));
+    m_driver->IdentifyDevice(reinterpret_cast<IdentifyDeviceData *>(m_dataBuffer));
+
+    // Handle normal output as specified in [8.13.5]
+    m_regs.deviceHead = (m_regs.deviceHead & ~(1 << kDevSelectorBit)) | (m_devIndex << kDevSelectorBit);
+    m_regs.status |= StReady;
+    m_regs.status &= ~(StBit5 | StDataRequest | StError);
+
+    return true;
+}
+
+bool ATADevice::DeviceReset() {
+    // [8.7] Only devices that implement the PACKET command feature set support this command
+    if (!m_driver->IsATAPIDevice()) {
+        m_regs.error |= ErrAbort;
+        return false;
+    }
+
+    log_debug("ATADevice::DeviceReset:  Resetting channel %d, device %d\n", m_channel, m_devIndex);
+
+    // Abandon the packet command in progress, if any
+    m_packetCommand = false;
+    InitDataBuffer(0);
+
+    // [9.2] The device places its signature in the Command Block registers
+    SetPacketDeviceSignature();
+    m_regs.status &= ~(StBit5 | StDataRequest);
+
+    // [9.2] Diagnostic code: no error detected
+    m_regs.error = 0x01;
+    return true;
+}
+
+bool ATADevice::Packet() {
+    // [8.21] Only devices that implement the PACKET command feature set support this command
+    if (!m_driver->IsATAPIDevice()) {
+        m_regs.error |= ErrAbort;
+        return false;
+    }
+
+    // [8.21.4] The Features register selects the transfer method and the
+    // Cylinder registers hold the maximum number of bytes per DRQ data block.
+    // Overlapped commands are not supported, so the OVL bit is ignored.
+    m_packetDMA = (m_regs.features & PktFeatDMA) != 0;
+    m_byteCountLimit = m_regs.cylinder & ~1;
+    if (m_byteCountLimit == 0) {
+        m_byteCountLimit = 0xFFFE;
+    }
+
+    // [9.11] Request the command packet from the host
+    InitDataBuffer(kPacketSize);
+    m_packetCommand = true;
+    m_regs.sectorCount = IRCommandOrData;
+    m_regs.deviceHead = (m_regs.deviceHead & ~(1 << kDevSelectorBit)) | (m_devIndex << kDevSelectorBit);
+    m_regs.status |= StReady;
+
+    // DRQ is set by the caller
+    return true;
+}
+
+bool ATADevice::ProcessPacket(ATABusMaster& busMaster) {
+    uint8_t packet[kPacketSize];
+    memcpy(packet, m_dataBuffer, kPacketSize);
+
+    uint8_t senseKey = SenseNone;
+    bool succeeded = m_driver->ProcessATAPIPacket(packet, m_packetData, &senseKey);
+    if (succeeded && !m_packetData.empty()) {
+        uint32_t length = (uint32_t)m_packetData.size();
+        if (m_packetDMA) {
+            // Wait for the guest to start the bus master and copy the response
+            // into the guest memory described by the PRD table
+            if (busMaster.BeginTransfer(true, length, m_dmaBuffers)) {
+                IoVecFromBuffer(m_dmaBuffers.data(), (unsigned int)m_dmaBuffers.size(), 0, m_packetData.data(), length);
+                busMaster.EndTransfer();
+            }
+            else {
+                succeeded = false;
+                senseKey = SenseIllegalRequest;
+            }
+        }
+        else {
+            // [9.11] Transfer the response through the Data register in blocks
+            // of up to the byte count limit, reported in the Cylinder registers
+            InitDataBuffer(length);
+            memcpy(m_dataBuffer, m_packetData.data(), length);
+            m_dataBlockSize = m_byteCountLimit;
+            m_regs.cylinder = (uint16_t)std::min<uint32_t>(m_byteCountLimit, length);
+            m_regs.sectorCount = IRInputOutput;
+            m_regs.status |= StDataRequest;
+            return true;
+        }
+    }
+
+    if (!succeeded) {
+        // [8.21.6] The sense key is reported in the upper nibble of the Error register
+        m_regs.error |= (senseKey << kSenseKeyShift) | ErrAbort;
+    }
+    EndPacketCommand();
+    return succeeded;
+}
+
+void ATADevice::NextPacketDataBlock() {
+    // [9.11] Report the size of the next DRQ data block
+    m_regs.cylinder = (uint16_t)std::min<uint32_t>(m_dataBlockSize, GetRemainingBufferLength());
+}
+
+void ATADevice::EndPacketCommand() {
+    // [9.11] Status phase: I/O and C/D are set and DRQ is cleared
+    m_packetCommand = false;
+    m_regs.sectorCount = IRInputOutput | IRCommandOrData;
+    m_regs.status |= StReady;
+    m_regs.status &= ~(StBit5 | StDataRequest);
+}
+
+void ATADevice::SetPacketDeviceSignature() {
+    m_regs.sectorCount = 0x01;
+    m_regs.sectorNumber = 0x01;
+    m_regs.cylinder = kPacketDeviceSignature;
+    m_regs.deviceHead &= (1 << kDevSelectorBit);
+}
+
+bool ATADevice::ReadDMA(ATABusMaster& busMaster) {
+    return ReadDMAImpl(busMaster, false);
+}
+
+bool ATADevice::ReadDMAExt(ATABusMaster& busMaster) {
+    return ReadDMAImpl(busMaster, true);
+}
+
+bool ATADevice::ReadDMAImpl(ATABusMaster& busMaster, bool ext) {
+    bool succeeded = __doDMATransfer(busMaster, false, ext);
+
+    // Handle outputs as specified in [8.23.5] and [8.23.6]
+    // Device/Head register:
+    //  "DEV shall indicate the selected device."
+    m_regs.deviceHead = (m_regs.deviceHead & ~(1 << kDevSelectorBit)) | (m_devIndex << kDevSelectorBit);
+
+    // Status register:
+    //  "DRDY shall be set to one."
+    m_regs.status |= StReady;
+
+    //  "DF (Device Fault) shall be cleared to zero."
+    //  "DRQ shall be cleared to zero."
+    m_regs.status &= ~(StBit5 | StDataRequest);
+
+    // Error bits are set by __doDMATransfer; the caller sets ERR on failure
+    return succeeded;
+}
+
+bool ATADevice::WriteDMA(ATABusMaster& busMaster) {
+    return WriteDMAImpl(busMaster, false);
+}
+
+bool ATADevice::WriteDMAExt(ATABusMaster& busMaster) {
+    return WriteDMAImpl(busMaster, true);
+}
+
+bool ATADevice::WriteDMAImpl(ATABusMaster& busMaster, bool ext) {
+    bool succeeded = __doDMATransfer(busMaster, true, ext);
+
+    // Handle outputs as specified in [8.45.5] and [8.45.6]
+    m_regs.deviceHead = (m_regs.deviceHead & ~(1 << kDevSelectorBit)) | (m_devIndex << kDevSelectorBit);
+    m_regs.status |= StReady;
+    m_regs.status &= ~(StBit5 | StDataRequest);
+
+    return succeeded;
+}
+
+bool ATADevice::__doDMATransfer(ATABusMaster& busMaster, bool write, bool ext) {
+    uint64_t lba;
+    uint32_t count;
+    if (!GetTransferRange(&lba, &count, ext)) {
+        //  "IDNF shall be set to one if a user-accessible address could not be found."
+        m_regs.error |= ErrIDNotFound;
+        return false;
+    }
+
+    // Wait for the guest to start the bus master, then move the data directly
+    // between the device driver and the guest memory described by the PRD table
+    if (!busMaster.BeginTransfer(!write, count * kSectorSize, m_dmaBuffers)) {
+        m_regs.error |= ErrAbort;
+        return false;
+    }
+
+    bool succeeded;
+    if (write) {
+        succeeded = m_driver->WriteSectorsV(lba, count, m_dmaBuffers.data(), (unsigned int)m_dmaBuffers.size());
+    }
+    else {
+        succeeded = m_driver->ReadSectorsV(lba, count, m_dmaBuffers.data(), (unsigned int)m_dmaBuffers.size());
+    }
+    busMaster.EndTransfer();
+
+    if (!succeeded) {
+        log_debug("ATADevice::__doDMATransfer:  %s of %u sectors at LBA %llu failed for channel %d, device %d\n", write ? "Write" : "Read", count, (unsigned long long)lba, m_channel, m_devIndex);
+        m_regs.error |= write ? ErrAbort : ErrUncorrectable;
+    }
+    return succeeded;
+}
+
+bool ATADevice::ReadMultiple() {
+    return ReadMultipleImpl(false);
+}
+
+bool ATADevice::ReadMultipleExt() {
+    return ReadMultipleImpl(true);
+}
+
+bool ATADevice::ReadMultipleImpl(bool ext) {
+    // [8.25.6] "ABRT shall be set to one if ... the Read Multiple command is not enabled"
+    if (m_multipleSectors == 0) {
+        log_debug("ATADevice::ReadMultiple:  Multiple mode is disabled for channel %d, device %d\n", m_channel, m_devIndex);
+        m_regs.error |= ErrAbort;
+        return false;
+    }
+
+    return ReadSectorsImpl(m_multipleSectors, ext);
+}
+
+bool ATADevice::ReadSectors() {
+    // [8.26] Read Sector(s) transfers one sector per DRQ data block
+    return ReadSectorsImpl(1, false);
+}
+
+bool ATADevice::ReadSectorsExt() {
+    return ReadSectorsImpl(1, true);
+}
+
+bool ATADevice::ReadSectorsImpl(uint32_t sectorsPerBlock, bool ext) {
+    bool succeeded = __doPIODataIn(sectorsPerBlock, ext);
+
+    // Handle outputs as specified in [8.26.5] and [8.26.6]
+    // Device/Head register:
+    //  "DEV shall indicate the selected device."
+    m_regs.deviceHead = (m_regs.deviceHead & ~(1 << kDevSelectorBit)) | (m_devIndex << kDevSelectorBit);
+
+    // Status register:
+    //  "DRDY shall be set to one."
+    m_regs.status |= StReady;
+
+    //  "DF (Device Fault) shall be cleared to zero."
+    m_regs.status &= ~StBit5;
+
+    // DRQ is set by the caller when the first data block is ready
+    return succeeded;
+}
+
+bool ATADevice::__doPIODataIn(uint32_t sectorsPerBlock, bool ext) {
+    uint64_t lba;
+    uint32_t count;
+    if (!GetTransferRange(&lba, &count, ext)) {
+        //  "IDNF shall be set to one if a user-accessible address could not be found."
+        m_regs.error |= ErrIDNotFound;
+        return false;
+    }
+
+    // Prefetch every sector of the command with a single request to the device
+    // driver. The host then reads the buffer one block at a time.
+    InitDataBuffer(count * kSectorSize);
+    m_dataBlockSize = sectorsPerBlock * kSectorSize;
+    if (!m_driver->ReadSectors(lba, m_dataBuffer, count)) {
+        log_debug("ATADevice::__doPIODataIn:  Read of %u sectors at LBA %llu failed for channel %d, device %d\n", count, (unsigned long long)lba, m_channel, m_devIndex);
+
+        //  "UNC shall be set to one if data is uncorrectable."
+        m_regs.error |= ErrUncorrectable;
+        InitDataBuffer(0);
+        return false;
+    }
+
+    return true;
+}
+
+bool ATADevice::SetMultipleMode() {
+    // [8.38.4] The number of sectors per block is specified in the Sector Count register
+    uint8_t sectorsPerBlock = m_regs.sectorCount;
+
+    IdentifyDeviceData identify;
+    m_driver->IdentifyDevice(&identify);
+
+    // [8.38.1] "If the value is not supported by the device, the command shall be aborted."
+    // A value of zero disables Read/Write Multiple commands.
+    bool supported = identify.maxTransferPerInterrupt != 0 && sectorsPerBlock <= identify.maxTransferPerInterrupt
+        && (sectorsPerBlock & (sectorsPerBlock - 1)) == 0;
+
+    // Handle outputs as specified in [8.38.5] and [8.38.6]
+    m_regs.deviceHead = (m_regs.deviceHead & ~(1 << kDevSelectorBit)) | (m_devIndex << kDevSelectorBit);
+    m_regs.status |= StReady;
+    m_regs.status &= ~(StBit5 | StDataRequest);
+
+    if (!supported) {
+        log_debug("ATADevice::SetMultipleMode:  Unsupported block size of %u sectors for channel %d, device %d\n", sectorsPerBlock, m_channel, m_devIndex);
+
+        // Error register:
+        //  "ABRT shall be set to one if the block count is not supported."
+        m_regs.error |= ErrAbort;
+        return false;
+    }
+
+    log_debug("ATADevice::SetMultipleMode:  Setting %u sectors per block for channel %d, device %d\n", sectorsPerBlock, m_channel, m_devIndex);
+    m_multipleSectors = sectorsPerBlock;
+    return true;
+}
+
+bool ATADevice::WriteMultiple() {
+    return WriteMultipleImpl(false);
+}
+
+bool ATADevice::WriteMultipleExt() {
+    return WriteMultipleImpl(true);
+}
+
+bool ATADevice::WriteMultipleImpl(bool ext) {
+    // [8.47.6] "ABRT shall be set to one if ... the Write Multiple command is not enabled"
+    if (m_multipleSectors == 0) {
+        log_debug("ATADevice::WriteMultiple:  Multiple mode is disabled for channel %d, device %d\n", m_channel, m_devIndex);
+        m_regs.error |= ErrAbort;
+        return false;
+    }
+
+    return WriteSectorsImpl(m_multipleSectors, ext);
+}
+
+bool ATADevice::WriteSectors() {
+    // [8.48] Write Sector(s) transfers one sector per DRQ data block
+    return WriteSectorsImpl(1, false);
+}
+
+bool ATADevice::WriteSectorsExt() {
+    return WriteSectorsImpl(1, true);
+}
+
+bool ATADevice::WriteSectorsImpl(uint32_t sectorsPerBlock, bool ext) {
+    bool succeeded = __doPIODataOut(sectorsPerBlock, ext);
+
+    // Handle outputs as specified in [8.48.5] and [8.48.6]
+    m_regs.deviceHead = (m_regs.deviceHead & ~(1 << kDevSelectorBit)) | (m_devIndex << kDevSelectorBit);
+    m_regs.status |= StReady;
+    m_regs.status &= ~StBit5;
+
+    // DRQ is set by the caller when the device is ready to accept the first data block
+    return succeeded;
+}
+
+bool ATADevice::__doPIODataOut(uint32_t sectorsPerBlock, bool ext) {
+    if (!GetTransferRange(&m_pioLBA, &m_pioSectorCount, ext)) {
+        //  "IDNF shall be set to one if a user-accessible address could not be found."
+        m_regs.error |= ErrIDNotFound;
+        return false;
+    }
+
+    // The host fills the buffer one block at a time; the data is written
+    // to the device driver at once when the last block is received
+    InitDataBuffer(m_pioSectorCount * kSectorSize);
+    m_dataBlockSize = sectorsPerBlock * kSectorSize;
+    return true;
+}
+
+bool ATADevice::EndPIODataOut() {
+    bool succeeded = m_driver->WriteSectors(m_pioLBA, m_dataBuffer, m_pioSectorCount);
+    if (!succeeded) {
+        log_debug("ATADevice::EndPIODataOut:  Write of %u sectors at LBA %llu failed for channel %d, device %d\n", m_pioSectorCount, (unsigned long long)m_pioLBA, m_channel, m_devIndex);
+
+        // Error register:
+        //  "ABRT shall be set to one if ... the device is not able to complete the action requested by the command."
+        m_regs.error |= ErrAbort;
+    }
+
+    m_regs.status |= StReady;
+    m_regs.status &= ~(StBit5 | StDataRequest);
+
+    return succeeded;
+}
+
+bool ATADevice::GetTransferRange(uint64_t *lba, uint32_t *count, bool ext) {
+    if (ext) {
+        // (ATA/ATAPI-6) The previous contents of the Sector Count, Sector Number
+        // and Cylinder registers hold the upper halves of the sector count and
+        // of the 48-bit address. A sector count of 0000h transfers 65536 sectors.
+        // These commands only use LBA addressing.
+        *count = ((uint32_t)m_regs.prevSectorCount << 8) | m_regs.sectorCount;
+        if (*count == 0) {
+            *count = 65536;
+        }
+        *lba = ((uint64_t)m_regs.prevCylinder << 32) | ((uint64_t)m_regs.prevSectorNumber << 24)
+            | ((uint64_t)m_regs.cylinder << 8) | m_regs.sectorNumber;
+        if ((m_regs.deviceHead & (1 << kDevLBABit)) == 0) {
+            return false;
+        }
+        return *lba + *count <= m_driver->GetSectorCount();
+    }
+
+    // [7.13] "A value of 00h specifies that 256 sectors are to be transferred."
+    *count = (m_regs.sectorCount == 0) ? 256 : m_regs.sectorCount;
+
+    if (m_regs.deviceHead & (1 << kDevLBABit)) {
+        // [7.10.6] In LBA mode, the Device/Head register holds bits 27-24 of the address,
+        // Cylinder High/Low hold bits 23-8 and Sector Number holds bits 7-0
+        *lba = ((uint64_t)(m_regs.deviceHead & 0x0F) << 24) | ((uint64_t)m_regs.cylinder << 8) | m_regs.sectorNumber;
+    }
+    else {
+        // Translate the CHS address using the current geometry reported by the device
+        IdentifyDeviceData identify;
+        m_driver->IdentifyDevice(&identify);
+        uint32_t heads = identify.numCurrentLogicalHeads;
+        uint32_t sectorsPerTrack = identify.numCurrentLogicalSectorsPerTrack;
+        uint32_t head = m_regs.deviceHead & 0x0F;
+        if (heads == 0 || sectorsPerTrack == 0 || head >= heads || m_regs.sectorNumber == 0 || m_regs.sectorNumber > sectorsPerTrack) {
+            return false;
+        }
+        *lba = ((uint64_t)m_regs.cylinder * heads + head) * sectorsPerTrack + (m_regs.sectorNumber - 1);
+    }
+
+    return *lba + *count <= m_driver->GetSectorCount();
+}
+
 bool ATADevice::SetFeatures() {
     bool succeeded = __doSetFeatures();
 
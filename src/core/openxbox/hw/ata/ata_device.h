@@ -12,10 +12,12 @@
 #pragma once
 
 #include <cstdint>
+#include <vector>
 
 #include "openxbox/cpu.h"
 #include "../ata/defs.h"
 #include "ata_common.h"
+#include "ata_bus_master.h"
 #include "drvs/ata_device_driver.h"
 #include "drvs/drv_null.h"
 
@@ -40,14 +42,56 @@ public:
     // ----- PIO data buffer --------------------------------------------------
 
     uint32_t ReadBuffer(uint8_t *dest, uint32_t length);
+    uint32_t WriteBuffer(const uint8_t *src, uint32_t length);
     uint32_t GetRemainingBufferLength();
 
+    // Determines if the host has transferred a whole DRQ data block [9.7] [9.8]
+    bool IsDataBlockComplete() const { return m_dataBlockSize != 0 && (m_dataBufferPos % m_dataBlockSize) == 0; }
+
     // ----- Command handlers -------------------------------------------------
     // These functions must return false on error
 
+    bool DeviceReset();        // [8.7]  0x08   Device Reset
+    bool FlushCache();         // [8.10] 0xE7   Flush Cache
     bool IdentifyDevice();     // [8.12] 0xEC   Identify Device
+    bool IdentifyPacketDevice();  // [8.13] 0xA1   Identify Packet Device
+    bool Packet();             // [8.21] 0xA0   Packet
+    bool ReadDMA(ATABusMaster& busMaster);    // [8.23] 0xC8   Read DMA
+    bool ReadMultiple();       // [8.25] 0xC4   Read Multiple
+    bool ReadSectors();        // [8.26] 0x20   Read Sector(s)
+    bool SetMultipleMode();    // [8.38] 0xC6   Set Multiple Mode
+    bool WriteDMA(ATABusMaster& busMaster);   // [8.45] 0xCA   Write DMA
+    bool WriteMultiple();      // [8.47] 0xC5   Write Multiple
+    bool WriteSectors();       // [8.48] 0x30   Write Sector(s)
     bool SetFeatures();        // [8.37] 0xEF   Set Features
 
+    // (ATA/ATAPI-6) 48-bit Address feature set
+    bool ReadDMAExt(ATABusMaster& busMaster);    // 0x25   Read DMA Ext
+    bool ReadMultipleExt();    // 0x29   Read Multiple Ext
+    bool ReadSectorsExt();     // 0x24   Read Sector(s) Ext
+    bool WriteDMAExt(ATABusMaster& busMaster);   // 0x35   Write DMA Ext
+    bool WriteMultipleExt();   // 0x39   Write Multiple Ext
+    bool WriteSectorsExt();    // 0x34   Write Sector(s) Ext
+
+    // Commits the data written by the host during a PIO data out command to
+    // the device driver. Called once the last data block has been received.
+    bool EndPIODataOut();
+
+    // ----- PACKET command phases [9.11] -------------------------------------
+
+    // Whether a PACKET command is waiting for its command packet or transferring data
+    bool IsPacketCommand() const { return m_packetCommand; }
+
+    // Executes the command packet received from the host. Responses are either
+    // copied to guest memory via DMA or prepared for transfer through the Data register.
+    bool ProcessPacket(ATABusMaster& busMaster);
+
+    // Updates the byte count when the host starts reading the next data block
+    void NextPacketDataBlock();
+
+    // Enters the status phase once all data has been transferred
+    void EndPacketCommand();
+
     // ----- Set Features subcommand handlers ---------------------------------
 
     bool SetTransferMode();
@@ -67,6 +111,25 @@ private:
     
     bool __doIdentifyDevice();
     bool __doSetFeatures();
+    bool ReadDMAImpl(ATABusMaster& busMaster, bool ext);
+    bool WriteDMAImpl(ATABusMaster& busMaster, bool ext);
+    bool __doDMATransfer(ATABusMaster& busMaster, bool write, bool ext);
+    bool ReadMultipleImpl(bool ext);
+    bool WriteMultipleImpl(bool ext);
+    bool ReadSectorsImpl(uint32_t sectorsPerBlock, bool ext);
+    bool WriteSectorsImpl(uint32_t sectorsPerBlock, bool ext);
+    bool __doPIODataIn(uint32_t sectorsPerBlock, bool ext);
+    bool __doPIODataOut(uint32_t sectorsPerBlock, bool ext);
+
+    // ----- Utility functions ------------------------------------------------
+
+    // Determines the address and number of sectors to transfer from the command
+    // block registers, using 48-bit addressing for the Ext commands.
+    // Returns false if the range is not accessible.
+    bool GetTransferRange(uint64_t *lba, uint32_t *count, bool ext);
+
+    // [9.1] Places the signature of PACKET devices in the Command Block registers
+    void SetPacketDeviceSignature();
 
     // ----- Registers --------------------------------------------------------
 
@@ -80,16 +143,40 @@ private:
     DMATransferType m_dmaTransferType = XferTypeMultiWordDMA;
     uint8_t m_dmaTransferMode = 0;
 
+    // [8.38] Number of sectors per block for Read/Write Multiple, or 0 if disabled
+    uint8_t m_multipleSectors = 0;
+
     // ----- Data buffer ------------------------------------------------------
 
     uint8_t *m_dataBuffer = nullptr;
     uint32_t m_dataBufferSize = 0;
     uint32_t m_dataBufferPos = 0;
 
+    // Size of each DRQ data block in the buffer. The host must transfer a
+    // whole block before the device reports the next one.
+    uint32_t m_dataBlockSize = 0;
+
+    // Sectors to be written once the host fills the buffer in a PIO data out command
+    uint64_t m_pioLBA = 0;
+    uint32_t m_pioSectorCount = 0;
+
+    // Guest memory regions of the DMA transfer in progress
+    std::vector<IoVec> m_dmaBuffers;
+
+    // ----- PACKET command state ---------------------------------------------
+
+    bool m_packetCommand = false;
+    bool m_packetDMA = false;
+    uint16_t m_byteCountLimit = 0;
+
+    // Response to the command packet being executed
+    std::vector<uint8_t> m_packetData;
+
     /*!
      * Initializes a data buffer of the specified size. If the current buffer
      * is not large enough to fit the requested number of bytes, a new buffer
-     * is allocated in memory, replacing the existing buffer.
+     * is allocated in memory, replacing the existing buffer. The whole buffer
+     * is transferred as a single DRQ data block.
      */
     void InitDataBuffer(uint32_t dataBufferSize);
 };
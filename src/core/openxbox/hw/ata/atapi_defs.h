@@ -0,0 +1,108 @@
+// ATA/ATAPI-4 emulation for the Original Xbox
+// (C) Ivan "StrikerX3" Oliveira
+//
+// This code aims to implement a subset of the ATA/ATAPI-4 specification
+// that satisifies the requirements of an IDE interface for the Original Xbox.
+//
+// Specification:
+// http://www.t13.org/documents/UploadedDocuments/project/d1153r18-ATA-ATAPI-4.pdf
+//
+// References to particular items in the specification are denoted between brackets
+// optionally followed by a quote from the specification.
+//
+// The command packets sent to ATAPI devices are defined by the SCSI Primary
+// Commands (SPC) and SCSI Multimedia Commands (MMC) specifications.
+#pragma once
+
+#include <cstdint>
+
+namespace openxbox {
+namespace hw {
+namespace ata {
+
+// --- Packet commands ----------------------------------------------------------------------------
+
+// Operation codes of the packet commands (first byte of the command packet)
+enum PacketCommand : uint8_t {
+    PktCmdTestUnitReady = 0x00,          // Test Unit Ready
+    PktCmdRequestSense = 0x03,           // Request Sense
+    PktCmdInquiry = 0x12,                // Inquiry
+    PktCmdStartStopUnit = 0x1B,          // Start/Stop Unit
+    PktCmdPreventAllowRemoval = 0x1E,    // Prevent/Allow Medium Removal
+    PktCmdReadCapacity = 0x25,           // Read Capacity
+    PktCmdRead10 = 0x28,                 // Read (10)
+    PktCmdSeek10 = 0x2B,                 // Seek (10)
+    PktCmdModeSelect10 = 0x55,           // Mode Select (10)
+    PktCmdModeSense10 = 0x5A,            // Mode Sense (10)
+    PktCmdSendKey = 0xA3,                // Send Key
+    PktCmdReportKey = 0xA4,              // Report Key
+    PktCmdRead12 = 0xA8,                 // Read (12)
+    PktCmdReadDVDStructure = 0xAD,       // Read DVD Structure
+};
+
+// --- Sense data ---------------------------------------------------------------------------------
+
+// Sense keys reported in the Error register and by Request Sense
+enum SenseKey : uint8_t {
+    SenseNone = 0x0,
+    SenseNotReady = 0x2,
+    SenseMediumError = 0x3,
+    SenseIllegalRequest = 0x5,
+    SenseUnitAttention = 0x6,
+};
+
+// Additional sense codes
+enum AdditionalSenseCode : uint8_t {
+    ASCNone = 0x00,
+    ASCUnrecoveredReadError = 0x11,
+    ASCInvalidCommandOperationCode = 0x20,
+    ASCLogicalBlockAddressOutOfRange = 0x21,
+    ASCInvalidFieldInCDB = 0x24,
+    ASCMediumMayHaveChanged = 0x28,
+    ASCMediumNotPresent = 0x3A,
+};
+
+// Response code of fixed format sense data for current errors
+const uint8_t kSenseResponseCurrent = 0x70;
+
+// Length of the fixed format sense data returned by Request Sense
+const uint8_t kSenseDataLength = 18;
+
+// Length of the standard Inquiry data
+const uint8_t kInquiryDataLength = 36;
+
+// Peripheral device type reported by Inquiry for CD-ROM and DVD devices
+const uint8_t kInquiryDeviceTypeCDROM = 0x05;
+
+// --- Mode pages ---------------------------------------------------------------------------------
+
+// Length of the mode parameter header returned by Mode Sense (10)
+const uint8_t kModeParameterHeader10Length = 8;
+
+enum ModePage : uint8_t {
+    ModePageXboxSecurity = 0x3E,   // Xbox DVD drive authentication status (vendor specific)
+    ModePageAll = 0x3F,            // Return all supported pages
+};
+
+/*!
+ * The vendor specific mode page through which the Xbox kernel checks whether
+ * the drive has authenticated the disc and switched to the game partition.
+ */
+struct XboxSecurityModePage {
+    uint8_t pageCode;          // ModePageXboxSecurity
+    uint8_t pageLength;        // Number of bytes that follow this field
+    uint8_t partitionArea;     // 1 when the game partition is accessible
+    uint8_t cdfValid;          // 1 when the disc security data is valid
+    uint8_t authentication;    // 1 when the disc has been authenticated
+    uint8_t _reserved_1[3];
+    uint32_t _reserved_2[3];
+};
+
+// --- Sectors ------------------------------------------------------------------------------------
+
+// Size of a logical block on CD and DVD media in bytes
+const uint32_t kCDSectorSize = 2048;
+
+}
+}
+}
@@ -12,6 +12,7 @@
 #pragma once
 
 #include <cstdint>
+#include <unordered_map>
 
 namespace openxbox {
 namespace hw {
@@ -88,17 +89,37 @@ enum StatusBits : uint8_t {
 
 // Error bits (read from the Error register)
 enum ErrorBits : uint8_t {
-    ErrAbort = (1 << 2),        // [7.11.6] (ABRT) Previous command was aborted due to an error or invalid parameter
+    ErrUncorrectable = (1 << 6),   // [7.11.6] (UNC) Data was uncorrectable
+    ErrIDNotFound = (1 << 4),      // [7.11.6] (IDNF) The requested address is not accessible
+    ErrAbort = (1 << 2),           // [7.11.6] (ABRT) Previous command was aborted due to an error or invalid parameter
 };
 
 
 // Device control bits (written to the Device Control register)
 enum DeviceControlBits : uint8_t {
+    DevCtlHighOrderByte = (1 << 7),          // (ATA/ATAPI-6) (HOB) Read the previous contents of the 48-bit address registers
     DevCtlSoftwareReset = (1 << 2),          // [7.9.6] (SRST) Execute a software reset
     DevCtlNegateInterruptEnable = (1 << 1),  // [7.9.6] (nIEN) When set, INTRQ signal is effectively disabled
 };
 
 const uint8_t kDevSelectorBit = 4;  // [7.10.6] (DEV) Selects Device 0 when cleared or Device 1 when set
+const uint8_t kDevLBABit = 6;       // [7.10.6] (L) Selects LBA addressing when set or CHS addressing when cleared
+
+// [9.11] Interrupt reason bits (read from the Sector Count register during PACKET commands)
+enum InterruptReasonBits : uint8_t {
+    IRRelease = (1 << 2),         // (REL) The device released the bus during an overlapped command
+    IRInputOutput = (1 << 1),     // (I/O) The transfer is directed to the host
+    IRCommandOrData = (1 << 0),   // (C/D) The device expects a command packet, or the command has completed when I/O is set
+};
+
+// [8.21.4] PACKET command bits (written to the Features register)
+enum PacketFeatureBits : uint8_t {
+    PktFeatOverlapped = (1 << 1),   // (OVL) The command may be overlapped
+    PktFeatDMA = (1 << 0),          // (DMA) Data is transferred via DMA
+};
+
+// [8.21.6] ATAPI devices report the sense key of a failed command in the upper nibble of the Error register
+const uint8_t kSenseKeyShift = 4;
 
 // --- Transfer modes -----------------------------------------------------------------------------
 
@@ -135,10 +156,33 @@ const uint8_t kMaximumUltraDMATransferMode = 4;
 
 // [8] Commands
 enum Command : uint8_t {
-    CmdDeviceReset = 0x08,      // [8.7]  Device Reset
-    CmdIdentifyDevice = 0xEC,   // [8.12] Identify Device
-    CmdSetFeatures = 0xEF,      // [8.37] Set Features
-    CmdSecurityUnlock = 0xF2,   // [8.34] Security Unlock
+    CmdDeviceReset = 0x08,          // [8.7]  Device Reset
+    CmdFlushCache = 0xE7,           // [8.10] Flush Cache
+    CmdReadDMA = 0xC8,              // [8.23] Read DMA (with retries)
+    CmdReadDMANoRetry = 0xC9,       // [8.23] Read DMA (without retries)
+    CmdReadMultiple = 0xC4,         // [8.25] Read Multiple
+    CmdReadSectors = 0x20,          // [8.26] Read Sector(s) (with retries)
+    CmdReadSectorsNoRetry = 0x21,   // [8.26] Read Sector(s) (without retries)
+    CmdSetMultipleMode = 0xC6,      // [8.38] Set Multiple Mode
+    CmdWriteDMA = 0xCA,             // [8.45] Write DMA (with retries)
+    CmdWriteDMANoRetry = 0xCB,      // [8.45] Write DMA (without retries)
+    CmdWriteMultiple = 0xC5,        // [8.47] Write Multiple
+    CmdWriteSectors = 0x30,         // [8.48] Write Sector(s) (with retries)
+    CmdWriteSectorsNoRetry = 0x31,  // [8.48] Write Sector(s) (without retries)
+    CmdIdentifyDevice = 0xEC,       // [8.12] Identify Device
+    CmdIdentifyPacketDevice = 0xA1, // [8.13] Identify Packet Device
+    CmdPacket = 0xA0,               // [8.21] Packet
+    CmdSetFeatures = 0xEF,          // [8.37] Set Features
+    CmdSecurityUnlock = 0xF2,       // [8.34] Security Unlock
+
+    // (ATA/ATAPI-6) 48-bit Address feature set
+    CmdFlushCacheExt = 0xEA,        // Flush Cache Ext
+    CmdReadDMAExt = 0x25,           // Read DMA Ext
+    CmdReadMultipleExt = 0x29,      // Read Multiple Ext
+    CmdReadSectorsExt = 0x24,       // Read Sector(s) Ext
+    CmdWriteDMAExt = 0x35,          // Write DMA Ext
+    CmdWriteMultipleExt = 0x39,     // Write Multiple Ext
+    CmdWriteSectorsExt = 0x34,      // Write Sector(s) Ext
 };
 
 // [8.37.8] Set Features subcommands (specified in the Features register)
@@ -161,13 +205,97 @@ enum CommandProtocol : uint8_t {
 
 // Map commands to their protocols
 const std::unordered_map<Command, CommandProtocol, std::hash<uint8_t>> kCmdProtocols = {
+    { CmdDeviceReset, CmdProtoDeviceReset },
+    { CmdFlushCache, CmdProtoNonData },
+    { CmdReadDMA, CmdProtoDMA },
+    { CmdReadDMANoRetry, CmdProtoDMA },
+    { CmdReadMultiple, CmdProtoPIODataIn },
+    { CmdReadSectors, CmdProtoPIODataIn },
+    { CmdReadSectorsNoRetry, CmdProtoPIODataIn },
+    { CmdSetMultipleMode, CmdProtoNonData },
+    { CmdWriteDMA, CmdProtoDMA },
+    { CmdWriteDMANoRetry, CmdProtoDMA },
+    { CmdWriteMultiple, CmdProtoPIODataOut },
+    { CmdWriteSectors, CmdProtoPIODataOut },
+    { CmdWriteSectorsNoRetry, CmdProtoPIODataOut },
     { CmdIdentifyDevice, CmdProtoPIODataIn },
+    { CmdIdentifyPacketDevice, CmdProtoPIODataIn },
+    { CmdPacket, CmdProtoPACKET },
     { CmdSetFeatures, CmdProtoNonData },
-    { CmdSecurityUnlock, CmdProtoPIODataOut }
+    { CmdSecurityUnlock, CmdProtoPIODataOut },
+    { CmdFlushCacheExt, CmdProtoNonData },
+    { CmdReadDMAExt, CmdProtoDMA },
+    { CmdReadMultipleExt, CmdProtoPIODataIn },
+    { CmdReadSectorsExt, CmdProtoPIODataIn },
+    { CmdWriteDMAExt, CmdProtoDMA },
+    { CmdWriteMultipleExt, CmdProtoPIODataOut },
+    { CmdWriteSectorsExt, CmdProtoPIODataOut },
+};
+
+// --- Bus master IDE -----------------------------------------------------------------------------
+
+// Registers of the bus master IDE function, as specified by SFF-8038i
+// (Programming Interface for Bus Master IDE Controller), mapped by BAR4 of the
+// IDE controller. Each channel has a block of 8 bytes; the secondary channel's
+// block follows the primary's.
+const uint8_t kBusMasterChannelStride = 8;
+
+enum BusMasterRegister : uint8_t {
+    BMRegCommand = 0,      // Read/write
+    BMRegStatus = 2,       // Read/write-clear
+    BMRegPRDTable = 4,     // Read/write  Physical address of the PRD table (4 bytes, dword aligned)
 };
 
+// Bus master command bits
+enum BusMasterCommandBits : uint8_t {
+    BMCmdWriteToMemory = (1 << 3),   // (R/W) Set for transfers from the device to memory
+    BMCmdStart = (1 << 0),           // Start/Stop Bus Master
+};
+
+// Bus master status bits
+enum BusMasterStatusBits : uint8_t {
+    BMStSimplex = (1 << 7),           // Only one channel may perform DMA at a time
+    BMStDrive1DMACapable = (1 << 6),  // Set by the host once device 1 is configured for DMA
+    BMStDrive0DMACapable = (1 << 5),  // Set by the host once device 0 is configured for DMA
+    BMStInterrupt = (1 << 2),         // The device asserted INTRQ; write 1 to clear
+    BMStError = (1 << 1),             // The transfer failed; write 1 to clear
+    BMStActive = (1 << 0),            // The bus master is active
+};
+
+// A Physical Region Descriptor is made of two little-endian dwords: the
+// physical address of a memory region and its byte count. A byte count of
+// zero means 64 KiB. The last descriptor of the table has the EOT bit set.
+const uint32_t kPRDByteCountMask = 0xFFFE;
+const uint32_t kPRDEndOfTable = (1u << 31);
+
+// PRD tables must not cross a 64 KiB boundary, which limits their length
+const uint32_t kMaxPRDEntries = 0x10000 / 8;
+
 // --- Command data -------------------------------------------------------------------------------
 
+// Size of a sector in bytes
+const uint32_t kSectorSize = 512;
+
+// [8.38] The largest number of sectors per DRQ data block that can be selected
+// with Set Multiple Mode for Read/Write Multiple commands
+const uint8_t kMaxMultipleSectors = 16;
+
+// The highest sector count addressable with 28-bit LBA
+const uint32_t kMaxLBA28Sectors = 0x0FFFFFFF;
+
+// The CHS geometry reported by devices larger than 8.4 GB. Smaller devices
+// report fewer cylinders.
+const uint16_t kMaxCHSCylinders = 16383;
+const uint16_t kDefaultCHSHeads = 16;
+const uint16_t kDefaultCHSSectorsPerTrack = 63;
+
+// [8.21] Length of the command packet sent with the PACKET command, in bytes
+const uint8_t kPacketSize = 12;
+
+// [9.1] Signature placed in the Cylinder registers by PACKET devices after a
+// reset or when aborting the Identify Device command
+const uint16_t kPacketDeviceSignature = 0xEB14;
+
 // [8.12.8] Length of the data structure returned by the Identify Device command, in words
 const uint16_t kIdentifyDeviceWords = 256;
 
@@ -237,7 +365,9 @@ struct IdentifyDeviceData {
     uint16_t timeToCompleteSecurityErase;            // word 89
     uint16_t timeToCompleteEnhancedSecurityErase;    // word 90
     uint16_t currentAdvancedPowerMgmtValue;          // word 91
-    uint16_t _reserved_9[35];                        // word 92-126
+    uint16_t _reserved_9[8];                         // word 92-99
+    uint64_t maxLBA48;                               // word 100-103 (ATA/ATAPI-6) Maximum user LBA for 48-bit Address feature set
+    uint16_t _reserved_11[23];                       // word 104-126
     uint16_t remMediaStatusNotificationFeatureSets;  // word 127
     uint16_t securityStatus;                         // word 128
     uint16_t _vendor[31];                            // word 129-159
@@ -256,11 +386,22 @@ enum IdentifyDeviceGeneralConfiguration : uint16_t {
     IDGenConfNotRemovableController = (1 << 6),  // Not removable controller and/or device
 };
 
+// [8.13.8 table 12 word 0] Bits for the generalConfiguration field returned by the Identify Packet Device command
+enum IdentifyPacketDeviceGeneralConfiguration : uint16_t {
+    IDPktGenConfATAPIDevice = (0b10 << 14),      // ATAPI device
+    IDPktGenConfCDROMDevice = (0x05 << 8),       // Command packet set used by the device: CD-ROM device
+    IDPktGenConfRemovableMedia = (1 << 7),       // Removable media device
+    IDPktGenConfAcceleratedDRQ = (0b10 << 5),    // Device sets DRQ within 50 us of receiving the PACKET command
+    IDPktGenConf12BytePackets = (0b00 << 0),     // Command packets are 12 bytes long
+};
+
 // [8.12.8 table 11 word 49] Bits for the capabilities1 field in the IdentifyDeviceData struct
 enum IdentifyDeviceCapabilities1 : uint16_t {
     IDCaps1StanbyTimerValuesSupported = (1 << 13),   // Standby timer values as specified in the standard are supported
     IDCaps1IORDYSupported = (1 << 11),               // IORDY supported
     IDCaps1CanDisableIODRY = (1 << 10),              // IORDY may be disabled
+    IDCaps1LBASupported = (1 << 9),                  // LBA supported
+    IDCaps1DMASupported = (1 << 8),                  // DMA supported
 };
 
 // [8.12.8 table 11 word 50] Bits for the capabilities2 field in the IdentifyDeviceData struct
@@ -365,6 +506,7 @@ enum IdentifyDeviceCommandSets2 : uint16_t {
     IDCmdSet2NoReportAlt = 0xFFFF,                              // Command set notification not supported
     IDCmdSet2Bit15AlwaysZero = (1 << 15),                       // This bit must always be zero
     IDCmdSet2Bit14AlwaysOne = (1 << 14),                        // This bit must always be one
+    IDCmdSet2LBA48 = (1 << 10),                                 // (ATA/ATAPI-6) 48-bit Address feature set supported
     IDCmdSet2RemMediaStatusNotificationFeatureSet = (1 << 4),   // Removable Media Status Notification feature set supported
     IDCmdSet2AdvancedPowerMgmtFeatureSet = (1 << 3),            // Advanced Power Management feature set supported
     IDCmdSet2CFAFeatureSet = (1 << 2),                          // CFA feature set supported
@@ -10,10 +10,14 @@
 // References to particular items in the specification are denoted between brackets
 // optionally followed by a quote from the specification.
 #include "ata_device_driver.h"
+#include "../atapi_defs.h"
 
 #include "openxbox/log.h"
 #include "openxbox/io.h"
 
+#include <algorithm>
+#include <cstring>
+
 namespace openxbox {
 namespace hw {
 namespace ata {
@@ -21,6 +25,96 @@ namespace ata {
 IATADeviceDriver::~IATADeviceDriver() {
 }
 
+bool IATADeviceDriver::ReadSectorsV(uint64_t lba, uint32_t count, const IoVec *buffers, unsigned int bufferCount) {
+    size_t length = (size_t)count * kSectorSize;
+    uint8_t *bounce = new uint8_t[length];
+    bool succeeded = ReadSectors(lba, bounce, count);
+    if (succeeded) {
+        IoVecFromBuffer(buffers, bufferCount, 0, bounce, length);
+    }
+    delete[] bounce;
+    return succeeded;
+}
+
+bool IATADeviceDriver::WriteSectorsV(uint64_t lba, uint32_t count, const IoVec *buffers, unsigned int bufferCount) {
+    size_t length = (size_t)count * kSectorSize;
+    uint8_t *bounce = new uint8_t[length];
+    IoVecTobuffer(buffers, bufferCount, 0, bounce, length);
+    bool succeeded = WriteSectors(lba, bounce, count);
+    delete[] bounce;
+    return succeeded;
+}
+
+bool IATADeviceDriver::ProcessATAPIPacket(const uint8_t *packet, std::vector<uint8_t>& data, uint8_t *senseKey) {
+    data.clear();
+    *senseKey = SenseIllegalRequest;
+    return false;
+}
+
+void padString(uint8_t *dest, const char *src, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++) {
+        if (*src) {
+            dest[i ^ 1] = *src++;
+        }
+        else {
+            dest[i ^ 1] = ' ';
+        }
+    }
+}
+
+void identifyImageHardDrive(IdentifyDeviceData *data, uint64_t sectorCount, const char *modelNumber) {
+    memset(data, 0, sizeof(IdentifyDeviceData));
+
+    // Derive the default CHS translation from the image size. Drives larger
+    // than 8.4 GB report the maximum geometry and must be addressed with LBA.
+    uint64_t cylinders = sectorCount / (kDefaultCHSHeads * kDefaultCHSSectorsPerTrack);
+    cylinders = std::min<uint64_t>(std::max<uint64_t>(cylinders, 1), kMaxCHSCylinders);
+
+    data->generalConfiguration = IDGenConfATADevice;
+    data->numLogicalCylinders = (uint16_t)cylinders;
+    data->numLogicalHeads = kDefaultCHSHeads;
+    data->numLogicalSectorsPerTrack = kDefaultCHSSectorsPerTrack;
+
+    padString((uint8_t *)data->serialNumber, "OXHD00000001", kSerialNumberLength);
+    padString((uint8_t *)data->firmwareRevision, "1.00", kFirmwareRevLength);
+    padString((uint8_t *)data->modelNumber, modelNumber, kModelNumberLength);
+
+    data->maxTransferPerInterrupt = kMaxMultipleSectors;
+    data->capabilities1 = IDCaps1LBASupported | IDCaps1DMASupported | IDCaps1IORDYSupported;
+    data->capabilities2 = IDCaps2Bit14AlwaysOne;
+    data->validTranslationFields = IDValidXlatUltraDMA | IDValidXlatTransferCycles | IDValidXlatCHS;
+
+    data->numCurrentLogicalCylinders = data->numLogicalCylinders;
+    data->numCurrentLogicalHeads = data->numLogicalHeads;
+    data->numCurrentLogicalSectorsPerTrack = data->numLogicalSectorsPerTrack;
+    data->currentSectorCapacity = data->numCurrentLogicalCylinders * data->numCurrentLogicalHeads * data->numCurrentLogicalSectorsPerTrack;
+    data->numAddressableSectors = (uint32_t)std::min<uint64_t>(sectorCount, kMaxLBA28Sectors);
+    data->maxLBA48 = sectorCount;
+
+    data->multiwordDMASettings = IDMultiwordDMA0Supported | IDMultiwordDMA1Supported | IDMultiwordDMA2Supported | IDMultiwordDMA0Selected;
+    data->advancedPIOModesSupported = 2; // Up to PIO mode 4
+    data->minMDMATransferCyclePerWord = 120;
+    data->recommendedMDMATransferCycleTime = 120;
+    data->minPIOTransferCycleNoFlowCtl = 120;
+    data->minPIOTransferCycleIORDYFlowCtl = 120;
+
+    data->majorVersionNumber = IDMajorVerATAPI4 | IDMajorVerATA3 | IDMajorVerATA2 | IDMajorVerATA1;
+    data->minorVersionNumber = IDMinorVerATAPI4_T13_1153D_rev17;
+
+    data->commandSetsSupported1 = IDCmdSet1PowerMgmtFeatureSet | IDCmdSet1WriteCache | IDCmdSet1LookAhead;
+    data->commandSetsSupported2 = IDCmdSet2Bit14AlwaysOne | IDCmdSet2LBA48;
+    data->commandSetsSupported3 = IDCmdSet3Bit14AlwaysOne;
+
+    data->commandSetsEnabled1 = IDCmdSet1PowerMgmtFeatureSet | IDCmdSet1WriteCache | IDCmdSet1LookAhead;
+    data->commandSetsEnabled2 = IDCmdSet2Bit14AlwaysOne | IDCmdSet2LBA48;
+    data->commandSetsEnabled3 = IDCmdSet3Bit14AlwaysOne;
+
+    data->ultraDMASettings = IDUltraDMA0Supported | IDUltraDMA1Supported | IDUltraDMA2Supported;
+
+    // Xbox hard drive must be locked
+    data->securityStatus |= IDSecStatusSupported | IDSecStatusEnabled/* | IDSecStatusLocked*/;
+}
+
 }
 }
 }
@@ -12,7 +12,9 @@
 #pragma once
 
 #include <cstdint>
+#include <vector>
 
+#include "openxbox/iovec.h"
 #include "../../ata/defs.h"
 #include "../ata_common.h"
 
@@ -31,8 +33,58 @@ public:
     virtual ~IATADeviceDriver();
     virtual bool IsAttached() = 0;
     virtual void IdentifyDevice(IdentifyDeviceData *data) = 0;
+
+    // ----- Sector access ----------------------------------------------------
+    // Sectors are kSectorSize bytes long and addressed by their LBA.
+    // These functions must return false if any of the sectors could not be
+    // transferred.
+
+    virtual uint64_t GetSectorCount() = 0;
+    virtual bool ReadSectors(uint64_t lba, uint8_t *buffer, uint32_t count) = 0;
+    virtual bool WriteSectors(uint64_t lba, const uint8_t *buffer, uint32_t count) = 0;
+
+    // Scatter/gather variants used by DMA transfers. The buffers add up to
+    // exactly count sectors, but may split sectors at any byte boundary.
+    // The default implementations go through a bounce buffer.
+    virtual bool ReadSectorsV(uint64_t lba, uint32_t count, const IoVec *buffers, unsigned int bufferCount);
+    virtual bool WriteSectorsV(uint64_t lba, uint32_t count, const IoVec *buffers, unsigned int bufferCount);
+
+    // Commits all previously written sectors to the backing store
+    virtual bool Flush() = 0;
+
+    // Identifies the arrangement of the data on drives whose sectors are
+    // derived from host state that can change between runs, so that layers
+    // storing copies of those sectors can tell when they no longer match.
+    // Drives with a fixed layout return zero.
+    virtual uint64_t GetLayoutFingerprint() { return 0; }
+
+    // ----- PACKET devices ---------------------------------------------------
+    // Drivers for ATAPI devices return the Identify Packet Device data from
+    // IdentifyDevice and execute the command packets sent with the PACKET
+    // command instead of sector transfers. The default implementations
+    // describe a device that does not implement the PACKET command feature set.
+
+    virtual bool IsATAPIDevice() { return false; }
+
+    // Executes a command packet of kPacketSize bytes. The data to be
+    // transferred to the host, if any, is placed in data. On failure, returns
+    // false and sets senseKey to the sense key to report in the Error register.
+    virtual bool ProcessATAPIPacket(const uint8_t *packet, std::vector<uint8_t>& data, uint8_t *senseKey);
 };
 
+/*!
+ * Copies a string into an Identify Device data field, padding it with spaces
+ * and swapping the bytes of each word as required by [8.12.8].
+ */
+void padString(uint8_t *dest, const char *src, uint32_t length);
+
+/*!
+ * Fills in the Identify Device data of a hard drive backed by a disk image
+ * with the specified number of sectors. The CHS, LBA28 and LBA48 geometry
+ * is derived from the size of the image.
+ */
+void identifyImageHardDrive(IdentifyDeviceData *data, uint64_t sectorCount, const char *modelNumber);
+
 }
 }
 }
@@ -0,0 +1,228 @@
+// ATA/ATAPI-4 emulation for the Original Xbox
+// (C) Ivan "StrikerX3" Oliveira
+//
+// This code aims to implement a subset of the ATA/ATAPI-4 specification
+// that satisifies the requirements of an IDE interface for the Original Xbox.
+//
+// Specification:
+// http://www.t13.org/documents/UploadedDocuments/project/d1153r18-ATA-ATAPI-4.pdf
+//
+// References to particular items in the specification are denoted between brackets
+// optionally followed by a quote from the specification.
+#include "block_cache.h"
+
+#include "openxbox/thread.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace openxbox {
+namespace hw {
+namespace ata {
+
+BlockCache::BlockCache(uint32_t blockSize, uint64_t blockCount, uint32_t capacity, unsigned int workerCount, FetchFunction fetch)
+    : m_blockSize(blockSize)
+    , m_blockCount(blockCount)
+    , m_capacity(std::max<uint32_t>(capacity, 1))
+    , m_fetch(fetch)
+{
+    SetReadahead(2, m_capacity / 2);
+
+    for (unsigned int i = 0; i < workerCount; i++) {
+        m_workers.emplace_back(ReadaheadThread, this);
+    }
+}
+
+BlockCache::~BlockCache() {
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_running = false;
+    }
+    m_readaheadCond.notify_all();
+    for (auto& worker : m_workers) {
+        worker.join();
+    }
+
+    for (auto& it : m_entries) {
+        delete[] it.second->data;
+        delete it.second;
+    }
+    for (uint8_t *buffer : m_freeBuffers) {
+        delete[] buffer;
+    }
+}
+
+void BlockCache::SetReadahead(uint32_t minBlocks, uint32_t maxBlocks) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_maxReadahead = std::min(maxBlocks, m_capacity / 2);
+    m_minReadahead = std::min(std::max<uint32_t>(minBlocks, 1), m_maxReadahead);
+    m_readaheadWindow = 0;
+}
+
+BlockCacheStats BlockCache::GetStats() {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return m_stats;
+}
+
+bool BlockCache::Read(uint64_t offset, uint8_t *dest, uint32_t length) {
+    uint64_t position = offset;
+    uint32_t remaining = length;
+    while (remaining > 0) {
+        uint64_t block = position / m_blockSize;
+        uint32_t blockOffset = (uint32_t)(position % m_blockSize);
+        uint32_t chunk = std::min(m_blockSize - blockOffset, remaining);
+        if (!ReadBlock(block, blockOffset, dest, chunk)) {
+            return false;
+        }
+        position += chunk;
+        dest += chunk;
+        remaining -= chunk;
+    }
+
+    ScheduleReadahead(offset, length);
+    return true;
+}
+
+bool BlockCache::ReadBlock(uint64_t block, uint32_t offset, uint8_t *dest, uint32_t length) {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    for (;;) {
+        auto it = m_entries.find(block);
+        if (it == m_entries.end()) {
+            // Fetch the block on this thread
+            m_stats.misses++;
+            Entry *entry = InsertEntry(block);
+            lk.unlock();
+            bool succeeded = m_fetch(block, entry->data);
+            lk.lock();
+            CompleteEntry(entry, succeeded);
+            if (!succeeded) {
+                return false;
+            }
+            memcpy(dest, entry->data + offset, length);
+            return true;
+        }
+
+        Entry *entry = it->second;
+        if (!entry->ready) {
+            // The block is being fetched by another thread; look it up again
+            // once it is done, as it is dropped if the fetch fails
+            m_fetchedCond.wait(lk);
+            continue;
+        }
+
+        if (entry->prefetched) {
+            entry->prefetched = false;
+            m_stats.readaheadHits++;
+        }
+        else {
+            m_stats.hits++;
+        }
+        m_lru.splice(m_lru.begin(), m_lru, entry->lruPos);
+        memcpy(dest, entry->data + offset, length);
+        return true;
+    }
+}
+
+void BlockCache::ScheduleReadahead(uint64_t offset, uint32_t length) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (m_maxReadahead == 0 || m_workers.empty()) {
+        return;
+    }
+
+    // Grow the window while reads continue where the previous one ended
+    if (offset == m_nextSequentialOffset) {
+        m_readaheadWindow = (m_readaheadWindow == 0) ? m_minReadahead : std::min(m_readaheadWindow * 2, m_maxReadahead);
+    }
+    else {
+        m_readaheadWindow = 0;
+    }
+    m_nextSequentialOffset = offset + length;
+
+    // Replace any pending readahead with the blocks following this read
+    m_readaheadQueue.clear();
+    if (m_readaheadWindow == 0) {
+        return;
+    }
+    uint64_t first = (m_nextSequentialOffset + m_blockSize - 1) / m_blockSize;
+    uint64_t last = std::min<uint64_t>(first + m_readaheadWindow, m_blockCount);
+    for (uint64_t block = first; block < last; block++) {
+        if (m_entries.count(block) == 0) {
+            m_readaheadQueue.push_back(block);
+        }
+    }
+    if (!m_readaheadQueue.empty()) {
+        m_readaheadCond.notify_all();
+    }
+}
+
+BlockCache::Entry *BlockCache::InsertEntry(uint64_t block) {
+    Entry *entry;
+    if (m_entries.size() >= m_capacity && !m_lru.empty()) {
+        // Reuse the least recently used block
+        entry = m_lru.back();
+        m_lru.pop_back();
+        m_entries.erase(entry->block);
+    }
+    else {
+        entry = new Entry();
+        if (!m_freeBuffers.empty()) {
+            entry->data = m_freeBuffers.back();
+            m_freeBuffers.pop_back();
+        }
+        else {
+            entry->data = new uint8_t[m_blockSize];
+        }
+    }
+
+    entry->block = block;
+    entry->ready = false;
+    entry->prefetched = false;
+    m_entries[block] = entry;
+    return entry;
+}
+
+void BlockCache::CompleteEntry(Entry *entry, bool succeeded) {
+    if (succeeded) {
+        entry->ready = true;
+        m_lru.push_front(entry);
+        entry->lruPos = m_lru.begin();
+    }
+    else {
+        m_entries.erase(entry->block);
+        m_freeBuffers.push_back(entry->data);
+        delete entry;
+    }
+    m_fetchedCond.notify_all();
+}
+
+void BlockCache::ReadaheadThread(BlockCache *cache) {
+    Thread_SetName("[HW] ATA readahead");
+
+    std::unique_lock<std::mutex> lk(cache->m_mutex);
+    for (;;) {
+        cache->m_readaheadCond.wait(lk, [&]() -> bool { return !cache->m_readaheadQueue.empty() || !cache->m_running; });
+        if (!cache->m_running) {
+            break;
+        }
+
+        uint64_t block = cache->m_readaheadQueue.front();
+        cache->m_readaheadQueue.pop_front();
+        if (cache->m_entries.count(block) != 0) {
+            continue;
+        }
+
+        Entry *entry = cache->InsertEntry(block);
+        entry->prefetched = true;
+        lk.unlock();
+        bool succeeded = cache->m_fetch(block, entry->data);
+        lk.lock();
+        cache->CompleteEntry(entry, succeeded);
+        if (succeeded) {
+            cache->m_stats.prefetched++;
+        }
+    }
+}
+
+}
+}
+}
@@ -0,0 +1,123 @@
+// ATA/ATAPI-4 emulation for the Original Xbox
+// (C) Ivan "StrikerX3" Oliveira
+//
+// This code aims to implement a subset of the ATA/ATAPI-4 specification
+// that satisifies the requirements of an IDE interface for the Original Xbox.
+//
+// Specification:
+// http://www.t13.org/documents/UploadedDocuments/project/d1153r18-ATA-ATAPI-4.pdf
+//
+// References to particular items in the specification are denoted between brackets
+// optionally followed by a quote from the specification.
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace openxbox {
+namespace hw {
+namespace ata {
+
+struct BlockCacheStats {
+    uint64_t hits = 0;            // Reads served from blocks already in the cache
+    uint64_t readaheadHits = 0;   // Reads served from blocks loaded by readahead
+    uint64_t misses = 0;          // Reads that had to fetch the block themselves
+    uint64_t prefetched = 0;      // Blocks loaded by readahead
+};
+
+/*!
+ * A least recently used cache of fixed-size blocks of a read-only medium,
+ * with adaptive sequential readahead.
+ *
+ * Blocks are loaded through a fetch function supplied by the owner. Reads
+ * that miss the cache fetch the block on the calling thread. When the owner
+ * reads sequentially, worker threads prefetch the blocks that follow the
+ * last read into the cache; the readahead window doubles with every
+ * sequential read up to a maximum and is dropped as soon as the access
+ * pattern becomes random.
+ *
+ * The fetch function is called concurrently from the reading thread and the
+ * workers, and must be thread-safe.
+ */
+class BlockCache {
+public:
+    // Loads the block with the specified index into dest, which is blockSize
+    // bytes long. Returns false on failure.
+    typedef std::function<bool(uint64_t block, uint8_t *dest)> FetchFunction;
+
+    // capacity is the maximum number of blocks kept in memory. Readahead is
+    // limited to half the capacity.
+    BlockCache(uint32_t blockSize, uint64_t blockCount, uint32_t capacity, unsigned int workerCount, FetchFunction fetch);
+    ~BlockCache();
+
+    // Copies length bytes starting at the byte offset into dest. The range
+    // must lie within the medium. Returns false if a block could not be fetched.
+    bool Read(uint64_t offset, uint8_t *dest, uint32_t length);
+
+    // Sets the range of the readahead window, in blocks. A maximum of zero
+    // disables readahead.
+    void SetReadahead(uint32_t minBlocks, uint32_t maxBlocks);
+
+    BlockCacheStats GetStats();
+
+    uint32_t GetBlockSize() const { return m_blockSize; }
+
+private:
+    struct Entry {
+        uint64_t block;
+        uint8_t *data;
+        bool ready;         // false while the block is being fetched
+        bool prefetched;    // loaded by readahead and not read yet
+        std::list<Entry *>::iterator lruPos;
+    };
+
+    bool ReadBlock(uint64_t block, uint32_t offset, uint8_t *dest, uint32_t length);
+    void ScheduleReadahead(uint64_t offset, uint32_t length);
+
+    // These must be called with the mutex held
+    Entry *InsertEntry(uint64_t block);
+    void CompleteEntry(Entry *entry, bool succeeded);
+
+    static void ReadaheadThread(BlockCache *cache);
+
+    const uint32_t m_blockSize;
+    const uint64_t m_blockCount;
+    const uint32_t m_capacity;
+    FetchFunction m_fetch;
+
+    std::mutex m_mutex;
+    std::condition_variable m_fetchedCond;
+    std::condition_variable m_readaheadCond;
+    bool m_running = true;
+
+    // Cached blocks and blocks being fetched. Only the cached blocks are in the
+    // LRU list, ordered from the most to the least recently used.
+    std::unordered_map<uint64_t, Entry *> m_entries;
+    std::list<Entry *> m_lru;
+    std::vector<uint8_t *> m_freeBuffers;
+
+    // ----- Readahead --------------------------------------------------------
+
+    std::vector<std::thread> m_workers;
+    std::deque<uint64_t> m_readaheadQueue;
+
+    uint32_t m_minReadahead;
+    uint32_t m_maxReadahead;
+    uint32_t m_readaheadWindow = 0;
+
+    // Offset where a read continuing the previous one would start
+    uint64_t m_nextSequentialOffset = ~0ull;
+
+    BlockCacheStats m_stats;
+};
+
+}
+}
+}
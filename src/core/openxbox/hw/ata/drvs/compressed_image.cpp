@@ -0,0 +1,297 @@
+// ATA/ATAPI-4 emulation for the Original Xbox
+// (C) Ivan "StrikerX3" Oliveira
+//
+// This code aims to implement a subset of the ATA/ATAPI-4 specification
+// that satisifies the requirements of an IDE interface for the Original Xbox.
+//
+// Specification:
+// http://www.t13.org/documents/UploadedDocuments/project/d1153r18-ATA-ATAPI-4.pdf
+//
+// References to particular items in the specification are denoted between brackets
+// optionally followed by a quote from the specification.
+#include "compressed_image.h"
+
+#include "openxbox/crc32.h"
+#include "openxbox/log.h"
+#include "openxbox/lz.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+namespace openxbox {
+namespace hw {
+namespace ata {
+
+static const char kCompressedImageMagic[8] = { 'O', 'X', 'C', 'I', 'M', 'G', 0, 0 };
+static const uint32_t kCompressedImageVersion = 1;
+
+// Chunks compressed per thread in each batch written by CompressedImageWriter
+static const unsigned int kChunksPerThread = 4;
+
+static bool IsValidChunkSize(uint32_t chunkSize) {
+    return chunkSize >= kMinCompressedChunkSize && chunkSize <= kMaxCompressedChunkSize && (chunkSize & (chunkSize - 1)) == 0;
+}
+
+// ----- Reader -----------------------------------------------------------------------------------------------------------
+
+CompressedImage::~CompressedImage() {
+    Close();
+}
+
+bool CompressedImage::IsCompressedImage(const char *path) {
+    HostFile file;
+    char magic[sizeof(kCompressedImageMagic)];
+    return file.Open(path, false) && file.ReadAt(0, magic, sizeof(magic)) && memcmp(magic, kCompressedImageMagic, sizeof(magic)) == 0;
+}
+
+bool CompressedImage::Open(const char *path) {
+    Close();
+
+    if (!m_file.Open(path, false)) {
+        log_warning("CompressedImage: Could not open %s\n", path);
+        return false;
+    }
+
+    CompressedImageHeader header;
+    if (!m_file.ReadAt(0, &header, sizeof(header)) || memcmp(header.magic, kCompressedImageMagic, sizeof(header.magic)) != 0) {
+        log_warning("CompressedImage: %s is not a compressed image\n", path);
+        Close();
+        return false;
+    }
+    if (header.version != kCompressedImageVersion) {
+        log_warning("CompressedImage: %s has unsupported version %u\n", path, header.version);
+        Close();
+        return false;
+    }
+    if (!IsValidChunkSize(header.chunkSize) || header.chunkCount != (header.imageSize + header.chunkSize - 1) / header.chunkSize) {
+        log_warning("CompressedImage: %s has an invalid header\n", path);
+        Close();
+        return false;
+    }
+
+    uint64_t fileSize = m_file.GetSize();
+    uint64_t indexSize = header.chunkCount * sizeof(CompressedImageIndexEntry);
+    if (header.indexOffset > fileSize || indexSize > fileSize - header.indexOffset) {
+        log_warning("CompressedImage: %s is truncated\n", path);
+        Close();
+        return false;
+    }
+    m_index.resize((size_t)header.chunkCount);
+    if (indexSize > 0 && (!m_file.ReadAt(header.indexOffset, &m_index[0], (size_t)indexSize) || CRC32_Compute(&m_index[0], (size_t)indexSize) != header.indexCRC)) {
+        log_warning("CompressedImage: %s has a corrupt index\n", path);
+        Close();
+        return false;
+    }
+
+    // Validate the index up front so that reads only have to check the data
+    for (size_t i = 0; i < m_index.size(); i++) {
+        const CompressedImageIndexEntry& entry = m_index[i];
+        uint32_t storedSize = entry.storedSize & ~kChunkStored;
+        uint64_t chunkLength = std::min<uint64_t>(header.chunkSize, header.imageSize - (uint64_t)i * header.chunkSize);
+        bool stored = (entry.storedSize & kChunkStored) != 0;
+        if (entry.offset > header.indexOffset || storedSize > header.indexOffset - entry.offset
+            || (stored && storedSize != chunkLength) || storedSize > LZ_CompressBound(header.chunkSize)) {
+            log_warning("CompressedImage: %s has an invalid index entry for chunk %zu\n", path, i);
+            Close();
+            return false;
+        }
+    }
+
+    m_chunkSize = header.chunkSize;
+    m_imageSize = header.imageSize;
+
+    log_info("CompressedImage: Opened %s with %llu bytes in %zu chunks of %u bytes (%.1f%% of the original size)\n", path,
+        (unsigned long long)m_imageSize, m_index.size(), m_chunkSize, m_imageSize ? fileSize * 100.0 / m_imageSize : 100.0);
+    return true;
+}
+
+void CompressedImage::Close() {
+    m_file.Close();
+    m_index.clear();
+    m_chunkSize = 0;
+    m_imageSize = 0;
+}
+
+bool CompressedImage::ReadChunk(uint64_t chunk, uint8_t *dest) {
+    if (chunk >= m_index.size()) {
+        return false;
+    }
+
+    const CompressedImageIndexEntry& entry = m_index[(size_t)chunk];
+    uint32_t storedSize = entry.storedSize & ~kChunkStored;
+    uint32_t chunkLength = (uint32_t)std::min<uint64_t>(m_chunkSize, m_imageSize - chunk * m_chunkSize);
+    if (chunkLength < m_chunkSize) {
+        memset(dest + chunkLength, 0, m_chunkSize - chunkLength);
+    }
+
+    if (entry.storedSize & kChunkStored) {
+        if (!m_file.ReadAt(entry.offset, dest, storedSize)) {
+            return false;
+        }
+    }
+    else {
+        // Each thread keeps its own buffer for the compressed data
+        static thread_local std::vector<uint8_t> compressed;
+        if (compressed.size() < storedSize) {
+            compressed.resize(storedSize);
+        }
+        if (!m_file.ReadAt(entry.offset, &compressed[0], storedSize)) {
+            return false;
+        }
+        if (!LZ_Decompress(&compressed[0], storedSize, dest, chunkLength)) {
+            log_warning("CompressedImage: Chunk %llu is corrupt\n", (unsigned long long)chunk);
+            return false;
+        }
+    }
+
+    if (CRC32_Compute(dest, chunkLength) != entry.crc) {
+        log_warning("CompressedImage: Checksum mismatch on chunk %llu\n", (unsigned long long)chunk);
+        return false;
+    }
+    return true;
+}
+
+// ----- Writer -----------------------------------------------------------------------------------------------------------
+
+CompressedImageWriter::~CompressedImageWriter() {
+    m_file.Close();
+}
+
+bool CompressedImageWriter::Create(const char *path, uint32_t chunkSize, unsigned int threadCount) {
+    if (!IsValidChunkSize(chunkSize)) {
+        log_warning("CompressedImageWriter: Invalid chunk size %u; must be a power of two between %u and %u bytes\n", chunkSize, kMinCompressedChunkSize, kMaxCompressedChunkSize);
+        return false;
+    }
+    if (!m_file.Open(path, true) || !m_file.Truncate(0)) {
+        log_warning("CompressedImageWriter: Could not create %s\n", path);
+        return false;
+    }
+
+    m_chunkSize = chunkSize;
+    m_threadCount = std::max(threadCount, 1u);
+    m_imageSize = 0;
+    m_fileOffset = sizeof(CompressedImageHeader);
+    m_index.clear();
+    m_batch.resize((size_t)m_chunkSize * m_threadCount * kChunksPerThread);
+    m_batchLength = 0;
+
+    // The header is written by Finish; until then the file has no magic
+    // number and is not recognized as an image
+    CompressedImageHeader header;
+    memset(&header, 0, sizeof(header));
+    return m_file.WriteAt(0, &header, sizeof(header));
+}
+
+bool CompressedImageWriter::Write(const uint8_t *data, size_t length) {
+    while (length > 0) {
+        size_t count = std::min(length, m_batch.size() - m_batchLength);
+        memcpy(&m_batch[m_batchLength], data, count);
+        m_batchLength += count;
+        m_imageSize += count;
+        data += count;
+        length -= count;
+        if (m_batchLength == m_batch.size() && !FlushBatch()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CompressedImageWriter::FlushBatch() {
+    size_t chunkCount = (m_batchLength + m_chunkSize - 1) / m_chunkSize;
+    if (chunkCount == 0) {
+        return true;
+    }
+
+    struct Result {
+        std::vector<uint8_t> data;
+        size_t length;
+        uint32_t crc;
+    };
+    std::vector<Result> results(chunkCount);
+
+    // Chunk i of the batch is compressed by thread i % threadCount
+    auto compress = [&](size_t first) {
+        for (size_t i = first; i < chunkCount; i += m_threadCount) {
+            const uint8_t *chunk = &m_batch[i * m_chunkSize];
+            size_t chunkLength = std::min<size_t>(m_chunkSize, m_batchLength - i * m_chunkSize);
+            Result& result = results[i];
+            result.data.resize(LZ_CompressBound(chunkLength));
+            result.length = LZ_Compress(chunk, chunkLength, &result.data[0], result.data.size());
+            result.crc = CRC32_Compute(chunk, chunkLength);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < m_threadCount && i < chunkCount; i++) {
+        threads.emplace_back(compress, i);
+    }
+    compress(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (size_t i = 0; i < chunkCount; i++) {
+        size_t chunkLength = std::min<size_t>(m_chunkSize, m_batchLength - i * m_chunkSize);
+        Result& result = results[i];
+
+        CompressedImageIndexEntry entry;
+        entry.offset = m_fileOffset;
+        entry.crc = result.crc;
+        bool ok;
+        if (result.length == 0 || result.length >= chunkLength) {
+            entry.storedSize = (uint32_t)chunkLength | kChunkStored;
+            ok = m_file.WriteAt(m_fileOffset, &m_batch[i * m_chunkSize], chunkLength);
+            m_fileOffset += chunkLength;
+        }
+        else {
+            entry.storedSize = (uint32_t)result.length;
+            ok = m_file.WriteAt(m_fileOffset, &result.data[0], result.length);
+            m_fileOffset += result.length;
+        }
+        if (!ok) {
+            log_warning("CompressedImageWriter: Could not write chunk %zu\n", m_index.size());
+            return false;
+        }
+        m_index.push_back(entry);
+    }
+    m_batchLength = 0;
+    return true;
+}
+
+bool CompressedImageWriter::Finish() {
+    if (!m_file.IsOpen() || !FlushBatch()) {
+        return false;
+    }
+
+    CompressedImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kCompressedImageMagic, sizeof(header.magic));
+    header.version = kCompressedImageVersion;
+    header.chunkSize = m_chunkSize;
+    header.imageSize = m_imageSize;
+    header.chunkCount = m_index.size();
+    header.indexOffset = m_fileOffset;
+
+    size_t indexSize = m_index.size() * sizeof(CompressedImageIndexEntry);
+    if (indexSize > 0) {
+        header.indexCRC = CRC32_Compute(&m_index[0], indexSize);
+        if (!m_file.WriteAt(m_fileOffset, &m_index[0], indexSize)) {
+            log_warning("CompressedImageWriter: Could not write the index\n");
+            return false;
+        }
+        m_fileOffset += indexSize;
+    }
+
+    // Make sure everything else is on disk before the header makes the image valid
+    bool ok = m_file.Sync() && m_file.WriteAt(0, &header, sizeof(header)) && m_file.Sync();
+    m_file.Close();
+    if (!ok) {
+        log_warning("CompressedImageWriter: Could not write the header\n");
+    }
+    return ok;
+}
+
+}
+}
+}
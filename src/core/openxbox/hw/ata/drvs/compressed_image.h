@@ -0,0 +1,134 @@
+// ATA/ATAPI-4 emulation for the Original Xbox
+// (C) Ivan "StrikerX3" Oliveira
+//
+// This code aims to implement a subset of the ATA/ATAPI-4 specification
+// that satisifies the requirements of an IDE interface for the Original Xbox.
+//
+// Specification:
+// http://www.t13.org/documents/UploadedDocuments/project/d1153r18-ATA-ATAPI-4.pdf
+//
+// References to particular items in the specification are denoted between brackets
+// optionally followed by a quote from the specification.
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "host_file.h"
+
+namespace openxbox {
+namespace hw {
+namespace ata {
+
+// Chunk sizes accepted by compressed images. Chunks are a power of two
+// between these sizes, so that they hold whole 512-byte and 2048-byte sectors.
+const uint32_t kMinCompressedChunkSize = 4 * 1024;
+const uint32_t kMaxCompressedChunkSize = 1024 * 1024;
+const uint32_t kDefaultCompressedChunkSize = 64 * 1024;
+
+/*!
+ * Layout of a compressed image file:
+ *
+ *   header                       CompressedImageHeader, 64 bytes
+ *   chunk data                   chunks in order, compressed or stored
+ *   index                        one CompressedImageIndexEntry per chunk
+ *
+ * The image is split into chunks of chunkSize bytes, each compressed
+ * independently with LZ_Compress; the last chunk may be shorter. Chunks that
+ * do not compress are stored as is. The index is written after the chunks,
+ * so that images can be converted in a single pass, and locates every chunk
+ * in the file, allowing any sector to be read with one seek.
+ *
+ * All values are little-endian.
+ */
+struct CompressedImageHeader {
+    char magic[8];          // "OXCIMG" followed by two zeros
+    uint32_t version;
+    uint32_t chunkSize;
+    uint64_t imageSize;     // uncompressed size in bytes
+    uint64_t chunkCount;
+    uint64_t indexOffset;
+    uint32_t indexCRC;      // CRC-32 of the index
+    uint32_t reserved[5];
+};
+
+struct CompressedImageIndexEntry {
+    uint64_t offset;        // position of the chunk in the file
+    uint32_t storedSize;    // size of the chunk in the file, plus kChunkStored if not compressed
+    uint32_t crc;           // CRC-32 of the uncompressed chunk
+};
+
+const uint32_t kChunkStored = 0x80000000;
+
+/*!
+ * Read access to a compressed image.
+ *
+ * Chunks are decompressed on demand and verified against their checksum.
+ * ReadChunk may be called concurrently from multiple threads, so the
+ * image can be read through a BlockCache with one block per chunk and have
+ * the readahead workers decompress several chunks in parallel.
+ */
+class CompressedImage {
+public:
+    ~CompressedImage();
+
+    // Determines if the file at the specified path is a compressed image
+    static bool IsCompressedImage(const char *path);
+
+    bool Open(const char *path);
+    void Close();
+    bool IsOpen() const { return m_file.IsOpen(); }
+
+    uint64_t GetSize() const { return m_imageSize; }
+    uint32_t GetChunkSize() const { return m_chunkSize; }
+    uint64_t GetChunkCount() const { return m_index.size(); }
+
+    // Decompresses the chunk into dest, which must be GetChunkSize() bytes
+    // long. The bytes past the end of the last chunk are zeroed.
+    bool ReadChunk(uint64_t chunk, uint8_t *dest);
+
+private:
+    HostFile m_file;
+    uint32_t m_chunkSize = 0;
+    uint64_t m_imageSize = 0;
+    std::vector<CompressedImageIndexEntry> m_index;
+};
+
+/*!
+ * Creates compressed images from a stream of uncompressed data. Chunks are
+ * compressed in batches by a number of threads and written in order.
+ */
+class CompressedImageWriter {
+public:
+    ~CompressedImageWriter();
+
+    bool Create(const char *path, uint32_t chunkSize, unsigned int threadCount);
+
+    // Appends data to the image
+    bool Write(const uint8_t *data, size_t length);
+
+    // Writes the last chunk, the index and the header, and closes the file.
+    // Images that are not finished are invalid.
+    bool Finish();
+
+    uint64_t GetImageSize() const { return m_imageSize; }
+    uint64_t GetFileSize() const { return m_fileOffset; }
+
+private:
+    bool FlushBatch();
+
+    HostFile m_file;
+    uint32_t m_chunkSize = 0;
+    unsigned int m_threadCount = 1;
+    uint64_t m_imageSize = 0;
+    uint64_t m_fileOffset = 0;
+    std::vector<CompressedImageIndexEntry> m_index;
+
+    // Uncompressed data of the chunks in the current batch
+    std::vector<uint8_t> m_batch;
+    size_t m_batchLength = 0;
+};
+
+}
+}
+}
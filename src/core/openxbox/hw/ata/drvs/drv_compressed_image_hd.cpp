@@ -0,0 +1,101 @@
+// ATA/ATAPI-4 emulation for the Original Xbox
+// (C) Ivan "StrikerX3" Oliveira
+//
+// This code aims to implement a subset of the ATA/ATAPI-4 specification
+// that satisifies the requirements of an IDE interface for the Original Xbox.
+//
+// Specification:
+// http://www.t13.org/documents/UploadedDocuments/project/d1153r18-ATA-ATAPI-4.pdf
+//
+// References to particular items in the specification are denoted between brackets
+// optionally followed by a quote from the specification.
+#include "drv_compressed_image_hd.h"
+
+#include "openxbox/log.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace openxbox {
+namespace hw {
+namespace ata {
+
+// Up to 32 MiB of decompressed chunks are kept in memory
+static const uint32_t kCacheSize = 32 * 1024 * 1024;
+static const uint32_t kMaxReadaheadSize = 4 * 1024 * 1024;
+static const unsigned int kMaxDecompressionWorkers = 4;
+
+CompressedImageHardDriveATADeviceDriver::CompressedImageHardDriveATADeviceDriver() {
+}
+
+CompressedImageHardDriveATADeviceDriver::~CompressedImageHardDriveATADeviceDriver() {
+    Close();
+}
+
+bool CompressedImageHardDriveATADeviceDriver::Open(const char *path) {
+    Close();
+
+    if (!m_image.Open(path)) {
+        return false;
+    }
+    if (m_image.GetSize() < kSectorSize) {
+        log_warning("CompressedImageHardDriveATADeviceDriver: %s is too small to be a disk image\n", path);
+        m_image.Close();
+        return false;
+    }
+    if (m_image.GetSize() % kSectorSize) {
+        log_warning("CompressedImageHardDriveATADeviceDriver: %s is not a multiple of %u bytes; ignoring the last %u bytes\n", path, kSectorSize, (uint32_t)(m_image.GetSize() % kSectorSize));
+    }
+    m_sectorCount = m_image.GetSize() / kSectorSize;
+
+    // Leave one core for the emulated CPU
+    unsigned int workers = std::max(1u, std::min(std::thread::hardware_concurrency() - 1, kMaxDecompressionWorkers));
+    uint32_t chunkSize = m_image.GetChunkSize();
+    m_cache = new BlockCache(chunkSize, m_image.GetChunkCount(), std::max(kCacheSize / chunkSize, 16u), workers,
+        [this](uint64_t block, uint8_t *dest) -> bool { return m_image.ReadChunk(block, dest); });
+    m_cache->SetReadahead(2, std::max(kMaxReadaheadSize / chunkSize, 2u));
+
+    log_info("CompressedImageHardDriveATADeviceDriver: Opened image %s with %llu sectors (read-only)\n", path, (unsigned long long)m_sectorCount);
+    return true;
+}
+
+void CompressedImageHardDriveATADeviceDriver::Close() {
+    // Stop the readahead workers before closing the image
+    if (m_cache != nullptr) {
+        BlockCacheStats stats = m_cache->GetStats();
+        log_debug("CompressedImageHardDriveATADeviceDriver: %llu hits, %llu readahead hits, %llu misses, %llu chunks prefetched\n",
+            (unsigned long long)stats.hits, (unsigned long long)stats.readaheadHits, (unsigned long long)stats.misses, (unsigned long long)stats.prefetched);
+        delete m_cache;
+        m_cache = nullptr;
+    }
+    m_image.Close();
+    m_sectorCount = 0;
+}
+
+BlockCacheStats CompressedImageHardDriveATADeviceDriver::GetCacheStats() {
+    if (m_cache == nullptr) {
+        return BlockCacheStats();
+    }
+    return m_cache->GetStats();
+}
+
+void CompressedImageHardDriveATADeviceDriver::IdentifyDevice(IdentifyDeviceData *data) {
+    identifyImageHardDrive(data, m_sectorCount, "OpenXBOX Compressed Image");
+}
+
+bool CompressedImageHardDriveATADeviceDriver::ReadSectors(uint64_t lba, uint8_t *buffer, uint32_t count) {
+    if (m_cache == nullptr || lba > m_sectorCount || count > m_sectorCount - lba) {
+        log_debug("CompressedImageHardDriveATADeviceDriver::ReadSectors:  Out of range read of %u sectors at LBA %llu\n", count, (unsigned long long)lba);
+        return false;
+    }
+    return m_cache->Read(lba * kSectorSize, buffer, count * kSectorSize);
+}
+
+bool CompressedImageHardDriveATADeviceDriver::WriteSectors(uint64_t lba, const uint8_t *buffer, uint32_t count) {
+    log_debug("CompressedImageHardDriveATADeviceDriver::WriteSectors:  Rejected write of %u sectors at LBA %llu to a read-only image\n", count, (unsigned long long)lba);
+    return false;
+}
+
+}
+}
+}
@@ -0,0 +1,58 @@
+// ATA/ATAPI-4 emulation for the Original Xbox
+// (C) Ivan "StrikerX3" Oliveira
+//
+// This code aims to implement a subset of the ATA/ATAPI-4 specification
+// that satisifies the requirements of an IDE interface for the Original Xbox.
+//
+// Specification:
+// http://www.t13.org/documents/UploadedDocuments/project/d1153r18-ATA-ATAPI-4.pdf
+//
+// References to particular items in the specification are denoted between brackets
+// optionally followed by a quote from the specification.
+#pragma once
+
+#include <cstdint>
+
+#include "ata_device_driver.h"
+#include "block_cache.h"
+#include "compressed_image.h"
+
+namespace openxbox {
+namespace hw {
+namespace ata {
+
+/*!
+ * A read-only hard drive backed by a compressed disk image.
+ *
+ * Sectors are read through a BlockCache holding one decompressed chunk per
+ * block. Sequential reads are prefetched by several readahead workers, which
+ * decompress chunks in parallel. Writes are rejected; layer an
+ * OverlayHardDriveATADeviceDriver on top of the drive to make it writable.
+ */
+class CompressedImageHardDriveATADeviceDriver : public IATADeviceDriver {
+public:
+    CompressedImageHardDriveATADeviceDriver();
+    ~CompressedImageHardDriveATADeviceDriver() override;
+
+    bool Open(const char *path);
+    void Close();
+
+    BlockCacheStats GetCacheStats();
+
+    bool IsAttached() override { return m_cache != nullptr; }
+    void IdentifyDevice(IdentifyDeviceData *data) override;
+
+    uint64_t GetSectorCount() override { return m_sectorCount; }
+    bool ReadSectors(uint64_t lba, uint8_t *buffer, uint32_t count) override;
+    bool WriteSectors(uint64_t lba, const uint8_t *buffer, uint32_t count) override;
+    bool Flush() override { return true; }
+
+private:
+    CompressedImage m_image;
+    BlockCache *m_cache = nullptr;
+    uint64_t m_sectorCount = 0;
+};
+
+}
+}
+}
@@ -20,16 +20,10 @@ namespace ata {
 
 DummyHardDriveATADeviceDriver g_dummyATADeviceDriver;
 
-static void padString(uint8_t *dest, const char *src, uint32_t length) {
-    for (uint32_t i = 0; i < length; i++) {
-        if (*src) {
-            dest[i ^ 1] = *src++;
-        }
-        else {
-            dest[i ^ 1] = ' ';
-        }
-    }
-}
+// Geometry of the 10 GB dummy hard drive
+static const uint16_t kDummyCylinders = 5120;
+static const uint16_t kDummyHeads = 15;
+static const uint16_t kDummySectorsPerTrack = 255;
 
 DummyHardDriveATADeviceDriver::~DummyHardDriveATADeviceDriver() {
 }
@@ -40,14 +34,15 @@ void DummyHardDriveATADeviceDriver::IdentifyDevice(IdentifyDeviceData *data) {
 
     // Adapted from https://github.com/mirror/vbox/blob/master/src/VBox/Devices/Storage/DevATA.cpp
     data->generalConfiguration = IDGenConfATADevice;
-    data->numLogicalCylinders = 5120;
-    data->numLogicalHeads = 15;
-    data->numLogicalSectorsPerTrack = 255;
+    data->numLogicalCylinders = kDummyCylinders;
+    data->numLogicalHeads = kDummyHeads;
+    data->numLogicalSectorsPerTrack = kDummySectorsPerTrack;
     
     padString((uint8_t *)data->serialNumber, "1234567890", kSerialNumberLength);
     padString((uint8_t *)data->firmwareRevision, "1.00", kFirmwareRevLength);
     padString((uint8_t *)data->modelNumber, "DMY987654321", kModelNumberLength);
     
+    data->maxTransferPerInterrupt = kMaxMultipleSectors;
     data->validTranslationFields = IDValidXlatUltraDMA | IDValidXlatTransferCycles | IDValidXlatCHS;
     
     data->numCurrentLogicalCylinders = data->numLogicalCylinders;
@@ -80,6 +75,23 @@ void DummyHardDriveATADeviceDriver::IdentifyDevice(IdentifyDeviceData *data) {
     data->securityStatus |= IDSecStatusSupported | IDSecStatusEnabled/* | IDSecStatusLocked*/;
 }
 
+uint64_t DummyHardDriveATADeviceDriver::GetSectorCount() {
+    return (uint64_t)kDummyCylinders * kDummyHeads * kDummySectorsPerTrack;
+}
+
+bool DummyHardDriveATADeviceDriver::ReadSectors(uint64_t lba, uint8_t *buffer, uint32_t count) {
+    if (lba + count > GetSectorCount()) {
+        return false;
+    }
+    memset(buffer, 0, (size_t)count * kSectorSize);
+    return true;
+}
+
+bool DummyHardDriveATADeviceDriver::WriteSectors(uint64_t lba, const uint8_t *buffer, uint32_t count) {
+    // Writes are discarded; the drive always reads back zeros
+    return lba + count <= GetSectorCount();
+}
+
 }
 }
 }
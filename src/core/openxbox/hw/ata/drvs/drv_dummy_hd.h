@@ -27,6 +27,11 @@ public:
     ~DummyHardDriveATADeviceDriver() override;
     bool IsAttached() override { return true; }
     void IdentifyDevice(IdentifyDeviceData *data) override;
+
+    uint64_t GetSectorCount() override;
+    bool ReadSectors(uint64_t lba, uint8_t *buffer, uint32_t count) override;
+    bool WriteSectors(uint64_t lba, const uint8_t *buffer, uint32_t count) override;
+    bool Flush() override { return true; }
 };
 
 extern DummyHardDriveATADeviceDriver g_dummyATADeviceDriver;
@@ -27,6 +27,11 @@ public:
     ~NullATADeviceDriver() override;
     bool IsAttached() override { return true; }
     void IdentifyDevice(IdentifyDeviceData *data) override;
+
+    uint64_t GetSectorCount() override { return 0; }
+    bool ReadSectors(uint64_t lba, uint8_t *buffer, uint32_t count) override { return false; }
+    bool WriteSectors(uint64_t lba, const uint8_t *buffer, uint32_t count) override { return false; }
+    bool Flush() override { return false; }
 };
 
 extern NullATADeviceDriver g_nullATADeviceDriver;
@@ -0,0 +1,299 @@
+// ATA/ATAPI-4 emulation for the Original Xbox
+// (C) Ivan "StrikerX3" Oliveira
+//
+// This code aims to implement a subset of the ATA/ATAPI-4 specification
+// that satisifies the requirements of an IDE interface for the Original Xbox.
+//
+// Specification:
+// http://www.t13.org/documents/UploadedDocuments/project/d1153r18-ATA-ATAPI-4.pdf
+//
+// References to particular items in the specification are denoted between brackets
+// optionally followed by a quote from the specification.
+#include "drv_overlay_hd.h"
+
+#include "openxbox/log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+namespace openxbox {
+namespace hw {
+namespace ata {
+
+static const char kSidecarMagic[8] = { 'O', 'X', 'O', 'V', 'L', '1', 0, 0 };
+static const uint32_t kSidecarVersion = 2;
+
+OverlayHardDriveATADeviceDriver::OverlayHardDriveATADeviceDriver(IATADeviceDriver *base)
+    : m_base(base)
+{
+}
+
+OverlayHardDriveATADeviceDriver::~OverlayHardDriveATADeviceDriver() {
+    Close();
+}
+
+bool OverlayHardDriveATADeviceDriver::Open(const char *path, uint32_t blockSize, bool reset) {
+    Close();
+
+    if (blockSize < kSectorSize || (blockSize & (blockSize - 1)) != 0) {
+        log_warning("OverlayHardDriveATADeviceDriver: Invalid block size %u; must be a power of two of at least %u bytes\n", blockSize, kSectorSize);
+        return false;
+    }
+    if (!m_base->IsAttached()) {
+        log_warning("OverlayHardDriveATADeviceDriver: No base drive for overlay %s\n", path);
+        return false;
+    }
+
+    std::string sidecarPath = std::string(path) + ".map";
+    if (!m_dataFile.Open(path, true) || !m_sidecarFile.Open(sidecarPath.c_str(), true)) {
+        log_warning("OverlayHardDriveATADeviceDriver: Could not open overlay %s\n", path);
+        Close();
+        return false;
+    }
+
+    m_sectorCount = m_base->GetSectorCount();
+    m_layoutFingerprint = m_base->GetLayoutFingerprint();
+    m_blockSize = blockSize;
+
+    bool created = reset || m_sidecarFile.GetSize() == 0;
+    bool ok = created ? CreateSidecar() : LoadSidecar();
+    if (!ok) {
+        Close();
+        return false;
+    }
+
+    log_info("OverlayHardDriveATADeviceDriver: %s overlay %s with %u-byte blocks, %u of %llu blocks in use\n", created ? "Created" : "Opened", path, m_blockSize, m_stats.allocatedBlocks, (unsigned long long)m_blockCount);
+    return true;
+}
+
+void OverlayHardDriveATADeviceDriver::Close() {
+    if (m_dataFile.IsOpen()) {
+        uint64_t reads = m_stats.overlayReadSectors + m_stats.baseReadSectors;
+        log_info("OverlayHardDriveATADeviceDriver: %llu sectors read (%.1f%% from the overlay), %llu sectors written, %u blocks in the overlay\n",
+            (unsigned long long)reads, m_stats.OverlayHitRatio() * 100.0, (unsigned long long)m_stats.writtenSectors, m_stats.allocatedBlocks);
+        Flush();
+    }
+    m_dataFile.Close();
+    m_sidecarFile.Close();
+    m_bitmap.clear();
+    m_map.clear();
+    m_blockBuffer.clear();
+    m_stats = OverlayStats();
+}
+
+bool OverlayHardDriveATADeviceDriver::CreateSidecar() {
+    m_sectorsPerBlock = m_blockSize / kSectorSize;
+    m_blockCount = (m_sectorCount + m_sectorsPerBlock - 1) / m_sectorsPerBlock;
+    m_bitmap.assign((size_t)((m_blockCount + 7) / 8), 0);
+    m_map.assign((size_t)m_blockCount, 0);
+    m_blockBuffer.resize(m_blockSize);
+    m_stats = OverlayStats();
+
+    // Drop the old contents before writing the new header, so that a reset
+    // interrupted halfway leaves an empty overlay behind
+    if (!m_dataFile.Truncate(0) || !m_sidecarFile.Truncate(0)) {
+        log_warning("OverlayHardDriveATADeviceDriver: Could not truncate the overlay\n");
+        return false;
+    }
+
+    // The bitmap and the map are all zeros, so extending the file writes them
+    SidecarHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kSidecarMagic, sizeof(header.magic));
+    header.version = kSidecarVersion;
+    header.blockSize = m_blockSize;
+    header.sectorCount = m_sectorCount;
+    header.blockCount = m_blockCount;
+    header.layoutFingerprint = m_layoutFingerprint;
+    if (!m_sidecarFile.WriteAt(0, &header, sizeof(header)) || !m_sidecarFile.Truncate(GetMapOffset() + m_map.size() * sizeof(uint32_t))) {
+        log_warning("OverlayHardDriveATADeviceDriver: Could not write the overlay map\n");
+        return false;
+    }
+    return true;
+}
+
+bool OverlayHardDriveATADeviceDriver::LoadSidecar() {
+    SidecarHeader header;
+    if (!m_sidecarFile.ReadAt(0, &header, sizeof(header)) || memcmp(header.magic, kSidecarMagic, sizeof(header.magic)) != 0 || header.version != kSidecarVersion) {
+        log_warning("OverlayHardDriveATADeviceDriver: Overlay map is corrupt or has an unknown format\n");
+        return false;
+    }
+    if (header.sectorCount != m_sectorCount) {
+        log_warning("OverlayHardDriveATADeviceDriver: Overlay was created for a drive with %llu sectors, but the base drive has %llu sectors\n", (unsigned long long)header.sectorCount, (unsigned long long)m_sectorCount);
+        return false;
+    }
+    if (header.layoutFingerprint != m_layoutFingerprint) {
+        // The blocks in the overlay hold sectors of a layout that no longer exists
+        log_warning("OverlayHardDriveATADeviceDriver: The layout of the base drive changed since the overlay was created; reset the overlay to use it\n");
+        return false;
+    }
+    if (header.blockSize < kSectorSize || (header.blockSize & (header.blockSize - 1)) != 0) {
+        log_warning("OverlayHardDriveATADeviceDriver: Overlay map has an invalid block size\n");
+        return false;
+    }
+    if (header.blockSize != m_blockSize) {
+        log_info("OverlayHardDriveATADeviceDriver: Using the overlay's block size of %u bytes\n", header.blockSize);
+    }
+
+    m_blockSize = header.blockSize;
+    m_sectorsPerBlock = m_blockSize / kSectorSize;
+    m_blockCount = (m_sectorCount + m_sectorsPerBlock - 1) / m_sectorsPerBlock;
+    if (header.blockCount != m_blockCount) {
+        log_warning("OverlayHardDriveATADeviceDriver: Overlay map has an invalid block count\n");
+        return false;
+    }
+    m_bitmap.resize((size_t)((m_blockCount + 7) / 8));
+    m_map.resize((size_t)m_blockCount);
+    m_blockBuffer.resize(m_blockSize);
+    if (!m_sidecarFile.ReadAt(GetBitmapOffset(), &m_bitmap[0], m_bitmap.size()) || !m_sidecarFile.ReadAt(GetMapOffset(), &m_map[0], m_map.size() * sizeof(uint32_t))) {
+        log_warning("OverlayHardDriveATADeviceDriver: Overlay map is truncated\n");
+        return false;
+    }
+
+    // Blocks are appended to the data file in allocation order, so the
+    // number of blocks present is also the next free slot
+    uint64_t dataSize = m_dataFile.GetSize();
+    uint32_t allocated = 0;
+    for (uint64_t block = 0; block < m_blockCount; block++) {
+        if (!IsBlockPresent(block)) {
+            continue;
+        }
+        if ((uint64_t)(m_map[block] + 1) * m_blockSize > dataSize) {
+            log_warning("OverlayHardDriveATADeviceDriver: Block %llu is past the end of the overlay data\n", (unsigned long long)block);
+            return false;
+        }
+        allocated++;
+    }
+    m_stats.allocatedBlocks = allocated;
+    return true;
+}
+
+bool OverlayHardDriveATADeviceDriver::Reset() {
+    if (!m_dataFile.IsOpen()) {
+        return false;
+    }
+    if (!CreateSidecar()) {
+        return false;
+    }
+    log_info("OverlayHardDriveATADeviceDriver: Overlay reset\n");
+    return true;
+}
+
+bool OverlayHardDriveATADeviceDriver::ReadSectors(uint64_t lba, uint8_t *buffer, uint32_t count) {
+    if (!m_dataFile.IsOpen() || lba > m_sectorCount || count > m_sectorCount - lba) {
+        log_debug("OverlayHardDriveATADeviceDriver::ReadSectors:  Out of range read of %u sectors at LBA %llu\n", count, (unsigned long long)lba);
+        return false;
+    }
+
+    // Split the request into runs of consecutive blocks coming from the same
+    // place; runs from the base drive are read with a single request
+    while (count > 0) {
+        uint64_t block = lba / m_sectorsPerBlock;
+        bool present = IsBlockPresent(block);
+        uint32_t runSectors = 0;
+        do {
+            uint32_t offsetInBlock = (uint32_t)((lba + runSectors) % m_sectorsPerBlock);
+            runSectors += std::min(m_sectorsPerBlock - offsetInBlock, count - runSectors);
+            block++;
+            // Blocks in the overlay are only contiguous if they were allocated in order
+        } while (runSectors < count && IsBlockPresent(block) == present && (!present || m_map[block] == m_map[block - 1] + 1));
+
+        if (present) {
+            uint64_t first = lba / m_sectorsPerBlock;
+            uint64_t offset = (uint64_t)m_map[first] * m_blockSize + (lba % m_sectorsPerBlock) * kSectorSize;
+            if (!m_dataFile.ReadAt(offset, buffer, (size_t)runSectors * kSectorSize)) {
+                log_warning("OverlayHardDriveATADeviceDriver: Could not read %u sectors at LBA %llu from the overlay\n", runSectors, (unsigned long long)lba);
+                return false;
+            }
+            m_stats.overlayReadSectors += runSectors;
+        }
+        else {
+            if (!m_base->ReadSectors(lba, buffer, runSectors)) {
+                return false;
+            }
+            m_stats.baseReadSectors += runSectors;
+        }
+
+        lba += runSectors;
+        buffer += (size_t)runSectors * kSectorSize;
+        count -= runSectors;
+    }
+    return true;
+}
+
+bool OverlayHardDriveATADeviceDriver::AllocateBlock(uint64_t block, uint32_t firstSector, uint32_t sectorCount, const uint8_t *data) {
+    uint32_t slot = m_stats.allocatedBlocks;
+    uint64_t blockLBA = block * m_sectorsPerBlock;
+    uint32_t blockSectors = (uint32_t)std::min<uint64_t>(m_sectorsPerBlock, m_sectorCount - blockLBA);
+
+    // Fetch the parts of the block the write does not cover. The last block
+    // of the drive may be shorter than the others; pad it with zeros.
+    memset(&m_blockBuffer[0], 0, m_blockSize);
+    memcpy(&m_blockBuffer[(size_t)firstSector * kSectorSize], data, (size_t)sectorCount * kSectorSize);
+    if (firstSector > 0 && !m_base->ReadSectors(blockLBA, &m_blockBuffer[0], firstSector)) {
+        return false;
+    }
+    uint32_t tail = firstSector + sectorCount;
+    if (tail < blockSectors && !m_base->ReadSectors(blockLBA + tail, &m_blockBuffer[(size_t)tail * kSectorSize], blockSectors - tail)) {
+        return false;
+    }
+    if (!m_dataFile.WriteAt((uint64_t)slot * m_blockSize, &m_blockBuffer[0], m_blockSize)) {
+        log_warning("OverlayHardDriveATADeviceDriver: Could not write block %llu to the overlay\n", (unsigned long long)block);
+        return false;
+    }
+
+    // Only publish the block once its data is in place
+    m_map[block] = slot;
+    m_bitmap[block >> 3] |= 1 << (block & 7);
+    if (!m_sidecarFile.WriteAt(GetMapOffset() + block * sizeof(uint32_t), &m_map[block], sizeof(uint32_t))
+        || !m_sidecarFile.WriteAt(GetBitmapOffset() + (block >> 3), &m_bitmap[block >> 3], 1)) {
+        log_warning("OverlayHardDriveATADeviceDriver: Could not update the overlay map\n");
+        return false;
+    }
+    m_stats.allocatedBlocks++;
+    return true;
+}
+
+bool OverlayHardDriveATADeviceDriver::WriteSectors(uint64_t lba, const uint8_t *buffer, uint32_t count) {
+    if (!m_dataFile.IsOpen() || lba > m_sectorCount || count > m_sectorCount - lba) {
+        log_debug("OverlayHardDriveATADeviceDriver::WriteSectors:  Rejected write of %u sectors at LBA %llu\n", count, (unsigned long long)lba);
+        return false;
+    }
+
+    m_stats.writtenSectors += count;
+    while (count > 0) {
+        uint64_t block = lba / m_sectorsPerBlock;
+        uint32_t offsetInBlock = (uint32_t)(lba % m_sectorsPerBlock);
+        uint32_t sectors = std::min(m_sectorsPerBlock - offsetInBlock, count);
+
+        if (!IsBlockPresent(block)) {
+            if (!AllocateBlock(block, offsetInBlock, sectors, buffer)) {
+                return false;
+            }
+        }
+        else {
+            uint64_t offset = (uint64_t)m_map[block] * m_blockSize + (uint64_t)offsetInBlock * kSectorSize;
+            if (!m_dataFile.WriteAt(offset, buffer, (size_t)sectors * kSectorSize)) {
+                log_warning("OverlayHardDriveATADeviceDriver: Could not write %u sectors at LBA %llu to the overlay\n", sectors, (unsigned long long)lba);
+                return false;
+            }
+        }
+
+        lba += sectors;
+        buffer += (size_t)sectors * kSectorSize;
+        count -= sectors;
+    }
+    return true;
+}
+
+bool OverlayHardDriveATADeviceDriver::Flush() {
+    if (!m_dataFile.IsOpen()) {
+        return false;
+    }
+    return m_dataFile.Sync() && m_sidecarFile.Sync();
+}
+
+}
+}
+}
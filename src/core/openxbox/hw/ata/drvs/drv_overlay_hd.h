@@ -0,0 +1,123 @@
+// ATA/ATAPI-4 emulation for the Original Xbox
+// (C) Ivan "StrikerX3" Oliveira
+//
+// This code aims to implement a subset of the ATA/ATAPI-4 specification
+// that satisifies the requirements of an IDE interface for the Original Xbox.
+//
+// Specification:
+// http://www.t13.org/documents/UploadedDocuments/project/d1153r18-ATA-ATAPI-4.pdf
+//
+// References to particular items in the specification are denoted between brackets
+// optionally followed by a quote from the specification.
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "ata_device_driver.h"
+#include "host_file.h"
+
+namespace openxbox {
+namespace hw {
+namespace ata {
+
+struct OverlayStats {
+    uint64_t overlayReadSectors = 0;  // Sectors read from blocks in the overlay
+    uint64_t baseReadSectors = 0;     // Sectors read from the base drive
+    uint64_t writtenSectors = 0;      // Sectors written by the guest
+    uint32_t allocatedBlocks = 0;     // Blocks copied into the overlay
+
+    // Fraction of the sectors read that were served by the overlay
+    double OverlayHitRatio() const {
+        uint64_t total = overlayReadSectors + baseReadSectors;
+        return total ? (double)overlayReadSectors / total : 0.0;
+    }
+};
+
+/*!
+ * A hard drive that layers a copy-on-write overlay over another drive.
+ *
+ * The base drive is only ever read from, so any number of emulator instances
+ * can share one pristine image. The drive is divided into fixed-size blocks;
+ * the first write to a block copies it from the base drive into the overlay,
+ * and every later access to the block goes to the overlay.
+ *
+ * The overlay consists of two host files: the data file, to which blocks are
+ * appended in the order they are first written, and a sidecar file holding a
+ * header, a bitmap of the blocks present in the overlay and a map from each
+ * block to its position in the data file. Resetting the drive to the
+ * contents of the base image only truncates both files.
+ */
+class OverlayHardDriveATADeviceDriver : public IATADeviceDriver {
+public:
+    // The base drive must outlive this driver
+    OverlayHardDriveATADeviceDriver(IATADeviceDriver *base);
+    ~OverlayHardDriveATADeviceDriver() override;
+
+    // Opens the overlay at the specified path, with the sidecar at path.map.
+    // A new overlay is created with the specified block size if the files do
+    // not exist, or if reset is set; the block size must be a power of two
+    // multiple of kSectorSize. Existing overlays keep their block size.
+    bool Open(const char *path, uint32_t blockSize, bool reset);
+    void Close();
+
+    // Discards all blocks written to the overlay
+    bool Reset();
+
+    OverlayStats GetStats() const { return m_stats; }
+
+    bool IsAttached() override { return m_dataFile.IsOpen() && m_base->IsAttached(); }
+    void IdentifyDevice(IdentifyDeviceData *data) override { m_base->IdentifyDevice(data); }
+
+    uint64_t GetSectorCount() override { return m_sectorCount; }
+    bool ReadSectors(uint64_t lba, uint8_t *buffer, uint32_t count) override;
+    bool WriteSectors(uint64_t lba, const uint8_t *buffer, uint32_t count) override;
+    bool Flush() override;
+
+private:
+    struct SidecarHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t blockSize;
+        uint64_t sectorCount;
+        uint64_t blockCount;
+        uint64_t layoutFingerprint;  // of the base drive
+    };
+
+    bool CreateSidecar();
+    bool LoadSidecar();
+
+    bool IsBlockPresent(uint64_t block) const { return (m_bitmap[block >> 3] >> (block & 7)) & 1; }
+    uint64_t GetBitmapOffset() const { return sizeof(SidecarHeader); }
+    uint64_t GetMapOffset() const { return (GetBitmapOffset() + m_bitmap.size() + 7) & ~7ull; }
+
+    // Copies the block into the overlay with the specified sectors replaced
+    // by the data being written
+    bool AllocateBlock(uint64_t block, uint32_t firstSector, uint32_t sectorCount, const uint8_t *data);
+
+    IATADeviceDriver *m_base;
+
+    HostFile m_dataFile;
+    HostFile m_sidecarFile;
+
+    uint32_t m_blockSize = 0;
+    uint32_t m_sectorsPerBlock = 0;
+    uint64_t m_sectorCount = 0;
+    uint64_t m_blockCount = 0;
+    uint64_t m_layoutFingerprint = 0;
+
+    // One bit per block, set when the block is in the overlay
+    std::vector<uint8_t> m_bitmap;
+
+    // Position of each block in the data file, in blocks
+    std::vector<uint32_t> m_map;
+
+    // Scratch buffer for copying blocks from the base drive
+    std::vector<uint8_t> m_blockBuffer;
+
+    OverlayStats m_stats;
+};
+
+}
+}
+}
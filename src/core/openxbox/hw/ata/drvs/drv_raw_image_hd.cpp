@@ -0,0 +1,419 @@
+// ATA/ATAPI-4 emulation for the Original Xbox
+// (C) Ivan "StrikerX3" Oliveira
+//
+// This code aims to implement a subset of the ATA/ATAPI-4 specification
+// that satisifies the requirements of an IDE interface for the Original Xbox.
+//
+// Specification:
+// http://www.t13.org/documents/UploadedDocuments/project/d1153r18-ATA-ATAPI-4.pdf
+//
+// References to particular items in the specification are denoted between brackets
+// optionally followed by a quote from the specification.
+#include "drv_raw_image_hd.h"
+
+#include "openxbox/log.h"
+#include "openxbox/io.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <winioctl.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace openxbox {
+namespace hw {
+namespace ata {
+
+// Transfers are split into requests of up to this many buffers, which is the
+// limit of a single vectored request on Linux (IOV_MAX)
+static const unsigned int kMaxBuffersPerRequest = 1024;
+
+// Enough requests for the largest PRD table to be submitted at once
+static const unsigned int kRingEntries = (kMaxPRDEntries + kMaxBuffersPerRequest - 1) / kMaxBuffersPerRequest;
+
+RawImageHardDriveATADeviceDriver::RawImageHardDriveATADeviceDriver() {
+}
+
+RawImageHardDriveATADeviceDriver::~RawImageHardDriveATADeviceDriver() {
+    Close();
+}
+
+bool RawImageHardDriveATADeviceDriver::Open(const char *path, uint64_t newImageSize, bool readOnly) {
+    Close();
+
+#ifdef _WIN32
+    bool created = false;
+    HANDLE file = CreateFileA(path, readOnly ? GENERIC_READ : (GENERIC_READ | GENERIC_WRITE), FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE && !readOnly && GetLastError() == ERROR_FILE_NOT_FOUND) {
+        file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+        created = true;
+    }
+    else if (file == INVALID_HANDLE_VALUE && !readOnly) {
+        file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        readOnly = true;
+    }
+    if (file == INVALID_HANDLE_VALUE) {
+        log_warning("RawImageHardDriveATADeviceDriver: Could not open %s\n", path);
+        return false;
+    }
+
+    if (created) {
+        // Mark the file as sparse before extending it so that no clusters are allocated
+        DWORD bytesReturned;
+        DeviceIoControl(file, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &bytesReturned, NULL);
+
+        LARGE_INTEGER end;
+        end.QuadPart = (LONGLONG)newImageSize;
+        if (!SetFilePointerEx(file, end, NULL, FILE_BEGIN) || !SetEndOfFile(file)) {
+            CloseHandle(file);
+            log_warning("RawImageHardDriveATADeviceDriver: Could not create %s\n", path);
+            return false;
+        }
+    }
+
+    LARGE_INTEGER size;
+    GetFileSizeEx(file, &size);
+    uint64_t fileSize = (uint64_t)size.QuadPart;
+    if (fileSize < kSectorSize) {
+        CloseHandle(file);
+        log_warning("RawImageHardDriveATADeviceDriver: %s is too small to be a disk image\n", path);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, readOnly ? PAGE_READONLY : PAGE_READWRITE, 0, 0, NULL);
+    if (mapping == NULL) {
+        CloseHandle(file);
+        log_warning("RawImageHardDriveATADeviceDriver: Could not map %s\n", path);
+        return false;
+    }
+    void *data = MapViewOfFile(mapping, readOnly ? FILE_MAP_READ : FILE_MAP_WRITE, 0, 0, 0);
+    if (data == NULL) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        log_warning("RawImageHardDriveATADeviceDriver: Could not map %s\n", path);
+        return false;
+    }
+    m_fileHandle = file;
+    m_mapping = mapping;
+#else
+    bool created = false;
+    int fd = open(path, readOnly ? O_RDONLY : O_RDWR);
+    if (fd < 0 && !readOnly && errno == ENOENT) {
+        fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+        created = true;
+    }
+    else if (fd < 0 && !readOnly) {
+        fd = open(path, O_RDONLY);
+        readOnly = true;
+    }
+    if (fd < 0) {
+        log_warning("RawImageHardDriveATADeviceDriver: Could not open %s\n", path);
+        return false;
+    }
+
+    // Extending the file with ftruncate leaves a hole that allocates no blocks
+    if (created && ftruncate(fd, (off_t)newImageSize) != 0) {
+        close(fd);
+        unlink(path);
+        log_warning("RawImageHardDriveATADeviceDriver: Could not create %s\n", path);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < kSectorSize) {
+        close(fd);
+        log_warning("RawImageHardDriveATADeviceDriver: %s is too small to be a disk image\n", path);
+        return false;
+    }
+    uint64_t fileSize = (uint64_t)st.st_size;
+
+    // Prefer the I/O ring when the host supports it and only map the image
+    // when transfers have to fall back to copies
+    void *data = nullptr;
+    m_ring = IORing_Create(kRingEntries);
+    if (m_ring == nullptr) {
+        log_debug("RawImageHardDriveATADeviceDriver: I/O rings not available; using a memory mapping\n");
+        data = mmap(nullptr, fileSize, readOnly ? PROT_READ : (PROT_READ | PROT_WRITE), MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            log_warning("RawImageHardDriveATADeviceDriver: Could not map %s\n", path);
+            return false;
+        }
+    }
+    m_fd = fd;
+#endif
+
+    if (fileSize % kSectorSize) {
+        log_warning("RawImageHardDriveATADeviceDriver: %s is not a multiple of %u bytes; ignoring the last %u bytes\n", path, kSectorSize, (uint32_t)(fileSize % kSectorSize));
+    }
+
+    m_data = (uint8_t *)data;
+    m_size = fileSize;
+    m_sectorCount = fileSize / kSectorSize;
+    m_readOnly = readOnly;
+
+    log_info("RawImageHardDriveATADeviceDriver: %s image %s with %llu sectors%s\n", created ? "Created" : "Opened", path, (unsigned long long)m_sectorCount, readOnly ? " (read-only)" : "");
+    return true;
+}
+
+void RawImageHardDriveATADeviceDriver::Close() {
+#ifdef _WIN32
+    if (m_data != nullptr) {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mapping != nullptr) {
+        CloseHandle((HANDLE)m_mapping);
+        m_mapping = nullptr;
+    }
+    if (m_fileHandle != nullptr) {
+        CloseHandle((HANDLE)m_fileHandle);
+        m_fileHandle = nullptr;
+    }
+#else
+    if (m_data != nullptr) {
+        munmap(m_data, m_size);
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+    if (m_ring != nullptr) {
+        delete m_ring;
+        m_ring = nullptr;
+    }
+#endif
+    m_data = nullptr;
+    m_size = 0;
+    m_sectorCount = 0;
+    m_readOnly = false;
+}
+
+void RawImageHardDriveATADeviceDriver::IdentifyDevice(IdentifyDeviceData *data) {
+    identifyImageHardDrive(data, m_sectorCount, "OpenXBOX Raw Image");
+}
+
+bool RawImageHardDriveATADeviceDriver::CheckRange(uint64_t lba, uint32_t count) const {
+    return m_sectorCount != 0 && lba <= m_sectorCount && count <= m_sectorCount - lba;
+}
+
+bool RawImageHardDriveATADeviceDriver::ReadSectors(uint64_t lba, uint8_t *buffer, uint32_t count) {
+    if (!CheckRange(lba, count)) {
+        log_debug("RawImageHardDriveATADeviceDriver::ReadSectors:  Out of range read of %u sectors at LBA %llu\n", count, (unsigned long long)lba);
+        return false;
+    }
+
+    // Holes in the sparse file read back as zeros without allocating blocks
+#ifndef _WIN32
+    if (m_ring != nullptr) {
+        return RingTransfer(false, buffer, lba * kSectorSize, (size_t)count * kSectorSize);
+    }
+#endif
+    memcpy(buffer, m_data + lba * kSectorSize, (size_t)count * kSectorSize);
+    return true;
+}
+
+bool RawImageHardDriveATADeviceDriver::WriteSectors(uint64_t lba, const uint8_t *buffer, uint32_t count) {
+    if (m_readOnly || !CheckRange(lba, count)) {
+        log_debug("RawImageHardDriveATADeviceDriver::WriteSectors:  Rejected write of %u sectors at LBA %llu\n", count, (unsigned long long)lba);
+        return false;
+    }
+
+#ifndef _WIN32
+    if (m_ring != nullptr) {
+        return RingTransfer(true, const_cast<uint8_t *>(buffer), lba * kSectorSize, (size_t)count * kSectorSize);
+    }
+#endif
+    memcpy(m_data + lba * kSectorSize, buffer, (size_t)count * kSectorSize);
+    return true;
+}
+
+bool RawImageHardDriveATADeviceDriver::ReadSectorsV(uint64_t lba, uint32_t count, const IoVec *buffers, unsigned int bufferCount) {
+    if (!CheckRange(lba, count)) {
+        log_debug("RawImageHardDriveATADeviceDriver::ReadSectorsV:  Out of range read of %u sectors at LBA %llu\n", count, (unsigned long long)lba);
+        return false;
+    }
+
+#ifndef _WIN32
+    if (m_ring != nullptr) {
+        return RingTransferV(false, buffers, bufferCount, lba * kSectorSize);
+    }
+#endif
+    IoVecFromBuffer(buffers, bufferCount, 0, m_data + lba * kSectorSize, (size_t)count * kSectorSize);
+    return true;
+}
+
+bool RawImageHardDriveATADeviceDriver::WriteSectorsV(uint64_t lba, uint32_t count, const IoVec *buffers, unsigned int bufferCount) {
+    if (m_readOnly || !CheckRange(lba, count)) {
+        log_debug("RawImageHardDriveATADeviceDriver::WriteSectorsV:  Rejected write of %u sectors at LBA %llu\n", count, (unsigned long long)lba);
+        return false;
+    }
+
+#ifndef _WIN32
+    if (m_ring != nullptr) {
+        return RingTransferV(true, buffers, bufferCount, lba * kSectorSize);
+    }
+#endif
+    IoVecTobuffer(buffers, bufferCount, 0, m_data + lba * kSectorSize, (size_t)count * kSectorSize);
+    return true;
+}
+
+bool RawImageHardDriveATADeviceDriver::Flush() {
+    if (!IsAttached()) {
+        return false;
+    }
+    if (m_readOnly) {
+        return true;
+    }
+
+#ifdef _WIN32
+    return FlushViewOfFile(m_data, 0) && FlushFileBuffers((HANDLE)m_fileHandle);
+#else
+    if (m_ring != nullptr) {
+        uint64_t userData;
+        int32_t result;
+        if (!m_ring->QueueSync(m_fd, 0) || !m_ring->Submit() || !m_ring->WaitCompletion(&userData, &result)) {
+            return false;
+        }
+        return result == 0;
+    }
+    return msync(m_data, m_size, MS_SYNC) == 0;
+#endif
+}
+
+#ifndef _WIN32
+
+bool RawImageHardDriveATADeviceDriver::RingTransfer(bool write, uint8_t *buffer, uint64_t offset, size_t length) {
+    // Regular files only return short transfers at the end of the file, which
+    // CheckRange rules out, or when interrupted; resubmit the remainder then
+    while (length > 0) {
+        IoVec iov = { buffer, length };
+        bool queued = write
+            ? m_ring->QueueWrite(m_fd, &iov, 1, offset, 0)
+            : m_ring->QueueRead(m_fd, &iov, 1, offset, 0);
+        uint64_t userData;
+        int32_t result;
+        if (!queued || !m_ring->Submit() || !m_ring->WaitCompletion(&userData, &result)) {
+            return false;
+        }
+        if (result <= 0) {
+            log_warning("RawImageHardDriveATADeviceDriver: %s of %zu bytes at offset 0x%llx failed (error %d)\n", write ? "Write" : "Read", length, (unsigned long long)offset, -result);
+            return false;
+        }
+        buffer += result;
+        offset += result;
+        length -= result;
+    }
+    return true;
+}
+
+bool RawImageHardDriveATADeviceDriver::RingTransferV(bool write, const IoVec *buffers, unsigned int bufferCount, uint64_t offset) {
+    // Queue all requests of the transfer and submit them together.
+    // The user data of each request is its index in the list below.
+    struct Request {
+        const IoVec *buffers;
+        unsigned int bufferCount;
+        uint64_t offset;
+        uint64_t length;
+    };
+    Request requests[kRingEntries];
+    unsigned int queued = 0;
+    while (bufferCount > 0) {
+        unsigned int batch = (bufferCount < kMaxBuffersPerRequest) ? bufferCount : kMaxBuffersPerRequest;
+        uint64_t length = 0;
+        for (unsigned int i = 0; i < batch; i++) {
+            length += buffers[i].Iov_Len;
+        }
+
+        bool ok = queued < kRingEntries && (write
+            ? m_ring->QueueWrite(m_fd, buffers, batch, offset, queued)
+            : m_ring->QueueRead(m_fd, buffers, batch, offset, queued));
+        if (!ok) {
+            return false;
+        }
+        requests[queued].buffers = buffers;
+        requests[queued].bufferCount = batch;
+        requests[queued].offset = offset;
+        requests[queued].length = length;
+        queued++;
+        buffers += batch;
+        bufferCount -= batch;
+        offset += length;
+    }
+    if (!m_ring->Submit()) {
+        return false;
+    }
+
+    // Reap every completion, even after a failure, so the ring is left empty.
+    // Short transfers are recorded and finished once the ring is drained.
+    uint64_t transferred[kRingEntries];
+    bool succeeded = true;
+    for (unsigned int i = 0; i < queued; i++) {
+        uint64_t index;
+        int32_t result;
+        if (!m_ring->WaitCompletion(&index, &result)) {
+            return false;
+        }
+        const Request& request = requests[index];
+        if (result <= 0 && request.length > 0) {
+            log_warning("RawImageHardDriveATADeviceDriver: Vectored %s of %llu bytes at offset 0x%llx failed (error %d)\n", write ? "write" : "read", (unsigned long long)request.length, (unsigned long long)request.offset, -result);
+            succeeded = false;
+        }
+        transferred[index] = (result > 0) ? (uint64_t)result : 0;
+    }
+
+    for (unsigned int i = 0; succeeded && i < queued; i++) {
+        if (transferred[i] < requests[i].length) {
+            succeeded = RingTransferRemainder(write, requests[i].buffers, requests[i].bufferCount, requests[i].offset, transferred[i]);
+        }
+    }
+    return succeeded;
+}
+
+bool RawImageHardDriveATADeviceDriver::RingTransferRemainder(bool write, const IoVec *buffers, unsigned int bufferCount, uint64_t offset, uint64_t done) {
+    // Like RingTransfer, resubmit what is left of the request until it completes.
+    // The buffer list is copied since the first remaining buffer is trimmed.
+    std::vector<IoVec> rest(buffers, buffers + bufferCount);
+    size_t first = 0;
+    offset += done;
+    for (;;) {
+        while (first < rest.size() && done >= rest[first].Iov_Len) {
+            done -= rest[first].Iov_Len;
+            first++;
+        }
+        if (first == rest.size()) {
+            return true;
+        }
+        rest[first].Iov_Base = (uint8_t *)rest[first].Iov_Base + done;
+        rest[first].Iov_Len -= (size_t)done;
+
+        bool queued = write
+            ? m_ring->QueueWrite(m_fd, &rest[first], (unsigned int)(rest.size() - first), offset, 0)
+            : m_ring->QueueRead(m_fd, &rest[first], (unsigned int)(rest.size() - first), offset, 0);
+        uint64_t userData;
+        int32_t result;
+        if (!queued || !m_ring->Submit() || !m_ring->WaitCompletion(&userData, &result)) {
+            return false;
+        }
+        if (result <= 0) {
+            log_warning("RawImageHardDriveATADeviceDriver: Vectored %s at offset 0x%llx failed (error %d)\n", write ? "write" : "read", (unsigned long long)offset, -result);
+            return false;
+        }
+        done = (uint64_t)result;
+        offset += done;
+    }
+}
+
+#endif
+
+}
+}
+}
@@ -0,0 +1,88 @@
+// ATA/ATAPI-4 emulation for the Original Xbox
+// (C) Ivan "StrikerX3" Oliveira
+//
+// This code aims to implement a subset of the ATA/ATAPI-4 specification
+// that satisifies the requirements of an IDE interface for the Original Xbox.
+//
+// Specification:
+// http://www.t13.org/documents/UploadedDocuments/project/d1153r18-ATA-ATAPI-4.pdf
+//
+// References to particular items in the specification are denoted between brackets
+// optionally followed by a quote from the specification.
+#pragma once
+
+#include <cstdint>
+
+#include "ata_device_driver.h"
+#include "openxbox/ioring.h"
+
+namespace openxbox {
+namespace hw {
+namespace ata {
+
+/*!
+ * A hard drive backed by a raw disk image on the host, with one sector per
+ * 512 bytes of the file.
+ *
+ * On hosts with I/O rings, sector transfers and flushes are submitted to the
+ * host kernel through an IORing. Otherwise the image is mapped into memory, with transfers being plain copies to or from the
+ * mapping; both paths go through the host page cache. Scatter/gather
+ * transfers are submitted as vectored requests, so DMA transfers move data
+ * between the image and guest memory without intermediate copies. New images are
+ * created as sparse files: blocks are only allocated on the host file system
+ * once the guest writes to them, so a freshly formatted 10 GB drive takes up
+ * little more than the file system metadata.
+ *
+ * The CHS, LBA28 and LBA48 geometry reported by Identify Device is derived
+ * from the size of the image.
+ */
+class RawImageHardDriveATADeviceDriver : public IATADeviceDriver {
+public:
+    RawImageHardDriveATADeviceDriver();
+    ~RawImageHardDriveATADeviceDriver() override;
+
+    // Opens the image at the specified path. If the file does not exist, a
+    // sparse image of newImageSize bytes is created. Images that cannot be
+    // opened for writing, or that are opened with readOnly set, are attached
+    // as read-only drives.
+    bool Open(const char *path, uint64_t newImageSize, bool readOnly = false);
+    void Close();
+
+    bool IsAttached() override { return m_sectorCount != 0; }
+    void IdentifyDevice(IdentifyDeviceData *data) override;
+
+    uint64_t GetSectorCount() override { return m_sectorCount; }
+    bool ReadSectors(uint64_t lba, uint8_t *buffer, uint32_t count) override;
+    bool WriteSectors(uint64_t lba, const uint8_t *buffer, uint32_t count) override;
+    bool ReadSectorsV(uint64_t lba, uint32_t count, const IoVec *buffers, unsigned int bufferCount) override;
+    bool WriteSectorsV(uint64_t lba, uint32_t count, const IoVec *buffers, unsigned int bufferCount) override;
+    bool Flush() override;
+
+    bool IsReadOnly() const { return m_readOnly; }
+
+private:
+    bool CheckRange(uint64_t lba, uint32_t count) const;
+
+    uint8_t *m_data = nullptr;
+    uint64_t m_size = 0;
+    uint64_t m_sectorCount = 0;
+    bool m_readOnly = false;
+
+#ifdef _WIN32
+    void *m_fileHandle = nullptr;
+    void *m_mapping = nullptr;
+#else
+    int m_fd = -1;
+
+    // Only used from the thread that executes commands for the drive
+    IORing *m_ring = nullptr;
+
+    bool RingTransfer(bool write, uint8_t *buffer, uint64_t offset, size_t length);
+    bool RingTransferV(bool write, const IoVec *buffers, unsigned int bufferCount, uint64_t offset);
+    bool RingTransferRemainder(bool write, const IoVec *buffers, unsigned int bufferCount, uint64_t offset, uint64_t done);
+#endif
+};
+
+}
+}
+}
@@ -0,0 +1,609 @@
+// ATA/ATAPI-4 emulation for the Original Xbox
+// (C) Ivan "StrikerX3" Oliveira
+//
+// This code aims to implement a subset of the ATA/ATAPI-4 specification
+// that satisifies the requirements of an IDE interface for the Original Xbox.
+//
+// Specification:
+// http://www.t13.org/documents/UploadedDocuments/project/d1153r18-ATA-ATAPI-4.pdf
+//
+// References to particular items in the specification are denoted between brackets
+// optionally followed by a quote from the specification.
+#include "drv_virtual_fatx_hd.h"
+
+#include "openxbox/log.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+namespace openxbox {
+namespace hw {
+namespace ata {
+
+// ----- Xbox hard drive layout -------------------------------------------------------------------------------------------
+
+// The first 512 KiB of the disk hold the configuration area, which the
+// kernel does not require to be initialized
+struct PartitionLayout {
+    char letter;
+    uint64_t offset;
+    uint64_t size;
+};
+
+static const PartitionLayout kPartitionLayout[] = {
+    { 'X', 0x00080000, 0x2EE00000 },   // Partition3, game cache
+    { 'Y', 0x2EE80000, 0x2EE00000 },   // Partition4, game cache
+    { 'Z', 0x5DC80000, 0x2EE00000 },   // Partition5, game cache
+    { 'C', 0x8CA80000, 0x1F400000 },   // Partition2, system
+    { 'E', 0xABE80000, 0x131F00000 },  // Partition1, data
+};
+
+static const uint64_t kDiskSize = 0x1DDD80000;
+
+// ----- FATX on-disk format ----------------------------------------------------------------------------------------------
+
+static const uint32_t kSuperblockSize = 0x1000;
+static const uint32_t kSectorsPerCluster = 32;
+static const uint32_t kClusterSize = kSectorsPerCluster * kSectorSize;
+static const uint32_t kRootDirCluster = 1;
+
+// The FAT is padded to a multiple of this size
+static const uint32_t kFATAlignment = 0x1000;
+
+// Partitions with at least this many clusters use 32-bit FAT entries
+static const uint32_t kMinFAT32Clusters = 65525;
+
+static const uint32_t kFAT16Media = 0xFFF8;
+static const uint32_t kFAT16EndOfChain = 0xFFFF;
+static const uint32_t kFAT32Media = 0xFFFFFFF8;
+static const uint32_t kFAT32EndOfChain = 0xFFFFFFFF;
+
+static const uint32_t kMaxFileNameLength = 42;
+static const uint32_t kDirEntrySize = 64;
+
+static const uint8_t kAttrDirectory = 0x10;
+
+#pragma pack(push, 1)
+struct FATXSuperblock {
+    char magic[4];                  // "FATX"
+    uint32_t volumeID;
+    uint32_t sectorsPerCluster;
+    uint32_t rootDirCluster;
+    uint16_t unknown;
+};
+
+struct FATXDirEntry {
+    uint8_t fileNameLength;         // 0xFF marks the end of the directory
+    uint8_t attributes;
+    char fileName[kMaxFileNameLength];
+    uint32_t firstCluster;
+    uint32_t fileSize;
+    uint16_t createdTime;
+    uint16_t createdDate;
+    uint16_t modifiedTime;
+    uint16_t modifiedDate;
+    uint16_t accessedTime;
+    uint16_t accessedDate;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(FATXDirEntry) == kDirEntrySize, "FATXDirEntry must be 64 bytes");
+
+// FATX timestamps count years from 2000
+static void ToFATXTime(time_t t, uint16_t *time, uint16_t *date) {
+    // Directory tables may be generated by any thread; avoid gmtime's static buffer
+    struct tm tm;
+#ifdef _WIN32
+    bool valid = gmtime_s(&tm, &t) == 0;
+#else
+    bool valid = gmtime_r(&t, &tm) != nullptr;
+#endif
+    if (!valid || tm.tm_year < 100) {
+        *time = 0;
+        *date = (1 << 5) | 1;  // January 1, 2000
+        return;
+    }
+    *time = (uint16_t)((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2));
+    *date = (uint16_t)(((tm.tm_year - 100) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday);
+}
+
+// Files larger than this cannot be represented in a directory entry
+static const uint64_t kMaxFileSize = 0xFFFFFFFF;
+
+// Number of host files kept open for reading
+static const size_t kMaxOpenFiles = 16;
+
+// ----- Host directories -------------------------------------------------------------------------------------------------
+
+struct HostDirEntry {
+    std::string name;
+    bool directory;
+    uint64_t size;
+    time_t modifiedTime;
+};
+
+// Lists the regular files and directories in a host directory, sorted by
+// name. Symbolic links and other reparse points are skipped so that a link
+// back up the tree cannot make the scan recurse forever. Returns false if
+// the directory could not be opened.
+static bool ListHostDirectory(const std::string& path, std::vector<HostDirEntry>& entries) {
+    entries.clear();
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA((path + "\\*").c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    do {
+        if (strcmp(data.cFileName, ".") == 0 || strcmp(data.cFileName, "..") == 0
+            || (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0)
+        {
+            continue;
+        }
+        HostDirEntry entry;
+        entry.name = data.cFileName;
+        entry.directory = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        entry.size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+
+        // FILETIME counts 100 ns intervals since 1601
+        uint64_t fileTime = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+        entry.modifiedTime = (time_t)(fileTime / 10000000 - 11644473600ull);
+        entries.push_back(entry);
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+#else
+    DIR *dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        return false;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != nullptr) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        struct stat st;
+        if (lstat((path + "/" + ent->d_name).c_str(), &st) != 0 || !(S_ISDIR(st.st_mode) || S_ISREG(st.st_mode))) {
+            continue;
+        }
+        HostDirEntry entry;
+        entry.name = ent->d_name;
+        entry.directory = S_ISDIR(st.st_mode);
+        entry.size = (uint64_t)st.st_size;
+        entry.modifiedTime = st.st_mtime;
+        entries.push_back(entry);
+    }
+    closedir(dir);
+#endif
+    std::sort(entries.begin(), entries.end(), [](const HostDirEntry& a, const HostDirEntry& b) -> bool { return a.name < b.name; });
+    return true;
+}
+
+static bool IsValidFATXName(const std::string& name) {
+    if (name.empty() || name.size() > kMaxFileNameLength) {
+        return false;
+    }
+    for (char c : name) {
+        if ((uint8_t)c < 0x20 || (uint8_t)c >= 0x7F || strchr("\"*+,/:;<=>?\\|", c) != nullptr) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#ifdef _WIN32
+static const char kPathSeparator = '\\';
+#else
+static const char kPathSeparator = '/';
+#endif
+
+// ----- Driver -----------------------------------------------------------------------------------------------------------
+
+VirtualFATXHardDriveATADeviceDriver::VirtualFATXHardDriveATADeviceDriver() {
+}
+
+VirtualFATXHardDriveATADeviceDriver::~VirtualFATXHardDriveATADeviceDriver() {
+    Close();
+}
+
+bool VirtualFATXHardDriveATADeviceDriver::Open(const char *hostPath) {
+    Close();
+
+    std::vector<HostDirEntry> entries;
+    if (!ListHostDirectory(hostPath, entries)) {
+        log_warning("VirtualFATXHardDriveATADeviceDriver: Could not open directory %s\n", hostPath);
+        return false;
+    }
+    m_hostPath = hostPath;
+
+    for (const PartitionLayout& layout : kPartitionLayout) {
+        Partition part;
+        part.letter = layout.letter;
+        part.offset = layout.offset;
+        part.size = layout.size;
+
+        // Cluster numbers start at 1; entry 0 of the FAT holds the media type
+        part.clusterCount = (uint32_t)(layout.size / kClusterSize);
+        part.fat32 = part.clusterCount + 1 >= kMinFAT32Clusters;
+        uint32_t fatSize = (part.clusterCount + 1) * (part.fat32 ? 4 : 2);
+        part.fatSize = (fatSize + kFATAlignment - 1) & ~(kFATAlignment - 1);
+        part.clusterOffset = kSuperblockSize + part.fatSize;
+
+        // Clusters that would extend past the end of the partition are unusable
+        part.clusterCount = (uint32_t)std::min<uint64_t>(part.clusterCount, (layout.size - part.clusterOffset) / kClusterSize);
+        m_partitions.push_back(part);
+    }
+
+    log_info("VirtualFATXHardDriveATADeviceDriver: Serving FATX partitions from %s\n", hostPath);
+    return true;
+}
+
+void VirtualFATXHardDriveATADeviceDriver::Close() {
+    for (auto& file : m_openFiles) {
+        delete file.second;
+    }
+    m_openFiles.clear();
+    m_partitions.clear();
+    m_hostPath.clear();
+}
+
+void VirtualFATXHardDriveATADeviceDriver::IdentifyDevice(IdentifyDeviceData *data) {
+    identifyImageHardDrive(data, GetSectorCount(), "OpenXBOX Virtual FATX");
+}
+
+uint64_t VirtualFATXHardDriveATADeviceDriver::GetSectorCount() {
+    return IsAttached() ? kDiskSize / kSectorSize : 0;
+}
+
+// ----- Layout -----------------------------------------------------------------------------------------------------------
+
+uint64_t VirtualFATXHardDriveATADeviceDriver::GetLayoutFingerprint() {
+    // FNV-1a over the tree structure and the cluster runs of every node.
+    // Modification times only change directory entries, not the layout.
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    auto mix = [&hash](const void *data, size_t length) {
+        const uint8_t *bytes = (const uint8_t *)data;
+        for (size_t i = 0; i < length; i++) {
+            hash ^= bytes[i];
+            hash *= 0x100000001B3ULL;
+        }
+    };
+
+    for (Partition& part : m_partitions) {
+        if (!part.built) {
+            BuildPartition(part);
+        }
+        mix(&part.letter, sizeof(part.letter));
+        for (const Node& node : part.nodes) {
+            uint32_t words[] = {
+                (uint32_t)node.name.size(), (uint32_t)node.directory, node.size,
+                node.firstCluster, node.clusterCount, (uint32_t)node.children.size(),
+            };
+            mix(words, sizeof(words));
+            mix(node.name.data(), node.name.size());
+            mix(node.children.data(), node.children.size() * sizeof(uint32_t));
+        }
+    }
+    return hash;
+}
+
+void VirtualFATXHardDriveATADeviceDriver::BuildPartition(Partition& part) {
+    part.built = true;
+    part.nextFreeCluster = kRootDirCluster;
+
+    Node root;
+    root.hostPath = m_hostPath + kPathSeparator + part.letter;
+    root.directory = true;
+    root.size = 0;
+    root.modifiedTime = 0;
+    root.firstCluster = 0;
+    root.clusterCount = 0;
+    part.nodes.push_back(root);
+
+    // Allocate the root directory table first so that it lands on the root
+    // directory cluster, then lay out the tree
+    ScanDirectory(part, 0);
+
+    uint64_t files = 0;
+    for (const Node& node : part.nodes) {
+        files += node.directory ? 0 : 1;
+    }
+    log_debug("VirtualFATXHardDriveATADeviceDriver: Partition %c: %llu files and %llu directories in %u of %u clusters\n", part.letter,
+        (unsigned long long)files, (unsigned long long)(part.nodes.size() - files), part.nextFreeCluster - 1, part.clusterCount);
+}
+
+bool VirtualFATXHardDriveATADeviceDriver::ScanDirectory(Partition& part, uint32_t dirNode) {
+    std::vector<HostDirEntry> entries;
+    std::string dirPath = part.nodes[dirNode].hostPath;
+    ListHostDirectory(dirPath, entries);
+
+    // Create the children first so that the directory table can be sized
+    for (const HostDirEntry& entry : entries) {
+        if (!IsValidFATXName(entry.name)) {
+            log_warning("VirtualFATXHardDriveATADeviceDriver: Skipping %s%c%s: name is not valid on FATX\n", dirPath.c_str(), kPathSeparator, entry.name.c_str());
+            continue;
+        }
+        if (!entry.directory && entry.size > kMaxFileSize) {
+            log_warning("VirtualFATXHardDriveATADeviceDriver: Skipping %s%c%s: file is too large for FATX\n", dirPath.c_str(), kPathSeparator, entry.name.c_str());
+            continue;
+        }
+        Node node;
+        node.hostPath = dirPath + kPathSeparator + entry.name;
+        node.name = entry.name;
+        node.directory = entry.directory;
+        node.size = entry.directory ? 0 : (uint32_t)entry.size;
+        node.modifiedTime = entry.modifiedTime;
+        node.firstCluster = 0;
+        node.clusterCount = 0;
+        part.nodes[dirNode].children.push_back((uint32_t)part.nodes.size());
+        part.nodes.push_back(node);
+    }
+
+    // Directories take at least one cluster, even when empty
+    uint32_t tableSize = (uint32_t)part.nodes[dirNode].children.size() * kDirEntrySize;
+    if (!AllocateClusters(part, dirNode, std::max((tableSize + kClusterSize - 1) / kClusterSize, 1u))) {
+        log_warning("VirtualFATXHardDriveATADeviceDriver: Partition %c is full; skipping %s\n", part.letter, dirPath.c_str());
+        part.nodes[dirNode].children.clear();
+        return false;
+    }
+
+    // Allocate the files, then descend into the subdirectories. Children that
+    // do not fit are dropped from the directory, whose table is only
+    // generated once the whole partition is laid out.
+    std::vector<uint32_t> children;
+    children.swap(part.nodes[dirNode].children);
+    for (uint32_t child : children) {
+        Node& node = part.nodes[child];
+        if (!node.directory && !AllocateClusters(part, child, (uint32_t)(((uint64_t)node.size + kClusterSize - 1) / kClusterSize))) {
+            log_warning("VirtualFATXHardDriveATADeviceDriver: Partition %c is full; skipping %s\n", part.letter, node.hostPath.c_str());
+            continue;
+        }
+        part.nodes[dirNode].children.push_back(child);
+    }
+    children.clear();
+    children.swap(part.nodes[dirNode].children);
+    for (uint32_t child : children) {
+        if (!part.nodes[child].directory || ScanDirectory(part, child)) {
+            part.nodes[dirNode].children.push_back(child);
+        }
+    }
+    return true;
+}
+
+bool VirtualFATXHardDriveATADeviceDriver::AllocateClusters(Partition& part, uint32_t node, uint32_t count) {
+    if (count == 0) {
+        return true;
+    }
+    if (count > part.clusterCount + 1 - part.nextFreeCluster) {
+        return false;
+    }
+    part.nodes[node].firstCluster = part.nextFreeCluster;
+    part.nodes[node].clusterCount = count;
+    part.runs.push_back({ part.nextFreeCluster, count, node });
+    part.nextFreeCluster += count;
+    return true;
+}
+
+const VirtualFATXHardDriveATADeviceDriver::ClusterRun *VirtualFATXHardDriveATADeviceDriver::FindRun(const Partition& part, uint32_t cluster) const {
+    auto it = std::upper_bound(part.runs.begin(), part.runs.end(), cluster, [](uint32_t c, const ClusterRun& run) -> bool { return c < run.firstCluster; });
+    if (it == part.runs.begin()) {
+        return nullptr;
+    }
+    --it;
+    return (cluster < it->firstCluster + it->clusterCount) ? &*it : nullptr;
+}
+
+void VirtualFATXHardDriveATADeviceDriver::BuildDirectoryTable(Partition& part, Node& dir) {
+    // Unused entries are filled with 0xFF, which also marks the end of the directory
+    dir.table.assign((size_t)dir.clusterCount * kClusterSize, 0xFF);
+    uint8_t *pos = dir.table.data();
+    for (uint32_t child : dir.children) {
+        const Node& node = part.nodes[child];
+        FATXDirEntry entry;
+        memset(&entry, 0xFF, sizeof(entry));
+        entry.fileNameLength = (uint8_t)node.name.size();
+        entry.attributes = node.directory ? kAttrDirectory : 0;
+        memcpy(entry.fileName, node.name.data(), node.name.size());
+        entry.firstCluster = node.firstCluster;
+        entry.fileSize = node.size;
+        ToFATXTime(node.modifiedTime, &entry.modifiedTime, &entry.modifiedDate);
+        entry.createdTime = entry.accessedTime = entry.modifiedTime;
+        entry.createdDate = entry.accessedDate = entry.modifiedDate;
+        memcpy(pos, &entry, sizeof(entry));
+        pos += sizeof(entry);
+    }
+}
+
+HostFile *VirtualFATXHardDriveATADeviceDriver::GetHostFile(const std::string& path) {
+    for (auto it = m_openFiles.begin(); it != m_openFiles.end(); ++it) {
+        if (it->first == path) {
+            m_openFiles.splice(m_openFiles.begin(), m_openFiles, it);
+            return it->second;
+        }
+    }
+
+    HostFile *file = new HostFile();
+    if (!file->Open(path.c_str(), false)) {
+        log_warning("VirtualFATXHardDriveATADeviceDriver: Could not open %s\n", path.c_str());
+        delete file;
+        return nullptr;
+    }
+    if (m_openFiles.size() >= kMaxOpenFiles) {
+        delete m_openFiles.back().second;
+        m_openFiles.pop_back();
+    }
+    m_openFiles.emplace_front(path, file);
+    return file;
+}
+
+// ----- Sector reads -----------------------------------------------------------------------------------------------------
+
+bool VirtualFATXHardDriveATADeviceDriver::ReadSectors(uint64_t lba, uint8_t *buffer, uint32_t count) {
+    uint64_t sectorCount = GetSectorCount();
+    if (lba > sectorCount || count > sectorCount - lba) {
+        log_debug("VirtualFATXHardDriveATADeviceDriver::ReadSectors:  Out of range read of %u sectors at LBA %llu\n", count, (unsigned long long)lba);
+        return false;
+    }
+
+    uint64_t offset = lba * kSectorSize;
+    size_t length = (size_t)count * kSectorSize;
+    while (length > 0) {
+        // Find the partition containing the offset; anything outside the
+        // partitions reads back as zeros
+        Partition *part = nullptr;
+        uint64_t pieceEnd = kDiskSize;
+        for (Partition& p : m_partitions) {
+            if (offset >= p.offset && offset < p.offset + p.size) {
+                part = &p;
+                pieceEnd = p.offset + p.size;
+                break;
+            }
+            if (p.offset > offset) {
+                pieceEnd = std::min(pieceEnd, p.offset);
+            }
+        }
+        size_t piece = (size_t)std::min<uint64_t>(length, pieceEnd - offset);
+
+        if (part == nullptr) {
+            memset(buffer, 0, piece);
+        }
+        else {
+            if (!part->built) {
+                BuildPartition(*part);
+            }
+            if (!ReadPartition(*part, offset - part->offset, buffer, piece)) {
+                return false;
+            }
+        }
+        offset += piece;
+        buffer += piece;
+        length -= piece;
+    }
+    return true;
+}
+
+bool VirtualFATXHardDriveATADeviceDriver::WriteSectors(uint64_t lba, const uint8_t *buffer, uint32_t count) {
+    log_debug("VirtualFATXHardDriveATADeviceDriver::WriteSectors:  Rejected write of %u sectors at LBA %llu to a read-only volume\n", count, (unsigned long long)lba);
+    return false;
+}
+
+bool VirtualFATXHardDriveATADeviceDriver::ReadPartition(Partition& part, uint64_t offset, uint8_t *dest, size_t length) {
+    while (length > 0) {
+        size_t piece;
+        if (offset < kSuperblockSize) {
+            piece = (size_t)std::min<uint64_t>(length, kSuperblockSize - offset);
+            ReadSuperblock(part, offset, dest, piece);
+        }
+        else if (offset < part.clusterOffset) {
+            piece = (size_t)std::min<uint64_t>(length, part.clusterOffset - offset);
+            ReadFAT(part, offset - kSuperblockSize, dest, piece);
+        }
+        else {
+            piece = length;
+            if (!ReadClusters(part, offset - part.clusterOffset, dest, piece)) {
+                return false;
+            }
+        }
+        offset += piece;
+        dest += piece;
+        length -= piece;
+    }
+    return true;
+}
+
+void VirtualFATXHardDriveATADeviceDriver::ReadSuperblock(Partition& part, uint64_t offset, uint8_t *dest, size_t length) {
+    uint8_t superblock[kSuperblockSize];
+    memset(superblock, 0xFF, sizeof(superblock));
+
+    FATXSuperblock header;
+    memcpy(header.magic, "FATX", sizeof(header.magic));
+    header.volumeID = 0x4F580000 | (uint8_t)part.letter;
+    header.sectorsPerCluster = kSectorsPerCluster;
+    header.rootDirCluster = kRootDirCluster;
+    header.unknown = 0;
+    memcpy(superblock, &header, sizeof(header));
+
+    memcpy(dest, superblock + offset, length);
+}
+
+void VirtualFATXHardDriveATADeviceDriver::ReadFAT(Partition& part, uint64_t offset, uint8_t *dest, size_t length) {
+    uint32_t entrySize = part.fat32 ? 4 : 2;
+    uint32_t endOfChain = part.fat32 ? kFAT32EndOfChain : kFAT16EndOfChain;
+
+    // Generate every entry overlapping the range; partial entries at the
+    // edges are generated into a temporary and clipped
+    uint64_t first = offset / entrySize;
+    uint64_t last = (offset + length - 1) / entrySize;
+    const ClusterRun *run = nullptr;
+    for (uint64_t index = first; index <= last; index++) {
+        uint32_t value = 0;
+        if (index == 0) {
+            value = part.fat32 ? kFAT32Media : kFAT16Media;
+        }
+        else if (index <= part.clusterCount) {
+            if (run == nullptr || index < run->firstCluster || index >= run->firstCluster + run->clusterCount) {
+                run = FindRun(part, (uint32_t)index);
+            }
+            if (run != nullptr) {
+                value = (index + 1 < run->firstCluster + run->clusterCount) ? (uint32_t)index + 1 : endOfChain;
+            }
+        }
+
+        uint8_t entry[4] = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+        uint64_t entryOffset = index * entrySize;
+        uint64_t start = std::max(entryOffset, offset);
+        uint64_t end = std::min(entryOffset + entrySize, offset + length);
+        memcpy(dest + (start - offset), entry + (start - entryOffset), (size_t)(end - start));
+    }
+}
+
+bool VirtualFATXHardDriveATADeviceDriver::ReadClusters(Partition& part, uint64_t offset, uint8_t *dest, size_t length) {
+    while (length > 0) {
+        uint64_t clusterIndex = offset / kClusterSize;
+        const ClusterRun *run = (clusterIndex < part.clusterCount) ? FindRun(part, (uint32_t)clusterIndex + 1) : nullptr;
+
+        // Clusters are allocated without gaps, so everything past the last
+        // run is free and reads back as zeros
+        if (run == nullptr) {
+            memset(dest, 0, length);
+            break;
+        }
+
+        // Offset of the range within the run and the bytes left in the run
+        uint64_t runOffset = offset - (uint64_t)(run->firstCluster - 1) * kClusterSize;
+        size_t piece = (size_t)std::min<uint64_t>(length, (uint64_t)run->clusterCount * kClusterSize - runOffset);
+        Node& node = part.nodes[run->node];
+        if (node.directory) {
+            if (node.table.empty()) {
+                BuildDirectoryTable(part, node);
+            }
+            memcpy(dest, &node.table[(size_t)runOffset], piece);
+        }
+        else {
+            // The slack at the end of the last cluster of a file reads back as zeros
+            size_t dataLength = (runOffset < node.size) ? (size_t)std::min<uint64_t>(piece, node.size - runOffset) : 0;
+            if (dataLength > 0) {
+                HostFile *file = GetHostFile(node.hostPath);
+                if (file == nullptr || !file->ReadAt(runOffset, dest, dataLength)) {
+                    log_warning("VirtualFATXHardDriveATADeviceDriver: Could not read %s\n", node.hostPath.c_str());
+                    return false;
+                }
+            }
+            memset(dest + dataLength, 0, piece - dataLength);
+        }
+        offset += piece;
+        dest += piece;
+        length -= piece;
+    }
+    return true;
+}
+
+}
+}
+}
@@ -0,0 +1,135 @@
+// ATA/ATAPI-4 emulation for the Original Xbox
+// (C) Ivan "StrikerX3" Oliveira
+//
+// This code aims to implement a subset of the ATA/ATAPI-4 specification
+// that satisifies the requirements of an IDE interface for the Original Xbox.
+//
+// Specification:
+// http://www.t13.org/documents/UploadedDocuments/project/d1153r18-ATA-ATAPI-4.pdf
+//
+// References to particular items in the specification are denoted between brackets
+// optionally followed by a quote from the specification.
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <string>
+#include <vector>
+
+#include "ata_device_driver.h"
+#include "host_file.h"
+
+namespace openxbox {
+namespace hw {
+namespace ata {
+
+/*!
+ * A read-only hard drive with the standard Xbox partition layout, whose FATX
+ * file systems are synthesized from a directory tree on the host.
+ *
+ * Each partition is populated from the subdirectory of the host directory
+ * named after its drive letter (C, E, X, Y and Z); missing subdirectories
+ * produce empty partitions. A partition is laid out the first time any of
+ * its sectors is read: the host directory tree is scanned, and every file
+ * and directory is assigned a contiguous run of clusters, in name order so
+ * that the layout is the same on every run. Nothing else is kept in memory.
+ * The superblock, the FAT and directory tables are generated from the
+ * cluster runs when they are read, and file data is read straight from the
+ * host files through the cluster-to-file index.
+ *
+ * The drive never writes to the host directory. Layer an
+ * OverlayHardDriveATADeviceDriver on top of it to make it writable. Since
+ * the overlay stores sectors of the synthesized layout, it must be reset
+ * whenever files are added to or removed from the host directory. The
+ * layout fingerprint covers the file names, sizes and cluster runs of every
+ * partition, which lets the overlay detect such changes. Computing it lays
+ * out every partition at once, so a drive with an overlay on top scans the
+ * whole host tree when the overlay is opened rather than on first read.
+ *
+ * Symbolic links in the host tree are not followed.
+ */
+class VirtualFATXHardDriveATADeviceDriver : public IATADeviceDriver {
+public:
+    VirtualFATXHardDriveATADeviceDriver();
+    ~VirtualFATXHardDriveATADeviceDriver() override;
+
+    bool Open(const char *hostPath);
+    void Close();
+
+    bool IsAttached() override { return !m_hostPath.empty(); }
+    void IdentifyDevice(IdentifyDeviceData *data) override;
+
+    uint64_t GetSectorCount() override;
+    bool ReadSectors(uint64_t lba, uint8_t *buffer, uint32_t count) override;
+    bool WriteSectors(uint64_t lba, const uint8_t *buffer, uint32_t count) override;
+    bool Flush() override { return true; }
+
+    // Lays out every partition that has not been read yet
+    uint64_t GetLayoutFingerprint() override;
+
+private:
+    // A file or directory in a partition
+    struct Node {
+        std::string hostPath;
+        std::string name;
+        bool directory;
+        uint32_t size;              // files only
+        time_t modifiedTime;
+        uint32_t firstCluster;      // zero for empty files
+        uint32_t clusterCount;
+        std::vector<uint32_t> children;
+
+        // Directory table, generated the first time it is read
+        std::vector<uint8_t> table;
+    };
+
+    // A run of consecutive clusters owned by a node. Runs are sorted by
+    // cluster number and cover every allocated cluster.
+    struct ClusterRun {
+        uint32_t firstCluster;
+        uint32_t clusterCount;
+        uint32_t node;
+    };
+
+    struct Partition {
+        char letter;
+        uint64_t offset;            // byte offsets on the disk
+        uint64_t size;
+
+        uint32_t clusterCount;
+        bool fat32;
+        uint32_t fatSize;
+        uint64_t clusterOffset;     // relative to the start of the partition
+
+        bool built = false;
+        std::vector<Node> nodes;    // node 0 is the root directory
+        std::vector<ClusterRun> runs;
+        uint32_t nextFreeCluster;
+    };
+
+    void BuildPartition(Partition& part);
+    // Returns false if the directory does not fit in the partition
+    bool ScanDirectory(Partition& part, uint32_t dirNode);
+    bool AllocateClusters(Partition& part, uint32_t node, uint32_t count);
+
+    // These read from the partition at the specified offset within it
+    bool ReadPartition(Partition& part, uint64_t offset, uint8_t *dest, size_t length);
+    void ReadSuperblock(Partition& part, uint64_t offset, uint8_t *dest, size_t length);
+    void ReadFAT(Partition& part, uint64_t offset, uint8_t *dest, size_t length);
+    bool ReadClusters(Partition& part, uint64_t offset, uint8_t *dest, size_t length);
+
+    const ClusterRun *FindRun(const Partition& part, uint32_t cluster) const;
+    void BuildDirectoryTable(Partition& part, Node& dir);
+    HostFile *GetHostFile(const std::string& path);
+
+    std::string m_hostPath;
+    std::vector<Partition> m_partitions;
+
+    // Recently used host files, most recent first
+    std::list<std::pair<std::string, HostFile *>> m_openFiles;
+};
+
+}
+}
+}
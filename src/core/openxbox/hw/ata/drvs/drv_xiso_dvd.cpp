@@ -0,0 +1,328 @@
+// ATA/ATAPI-4 emulation for the Original Xbox
+// (C) Ivan "StrikerX3" Oliveira
+//
+// This code aims to implement a subset of the ATA/ATAPI-4 specification
+// that satisifies the requirements of an IDE interface for the Original Xbox.
+//
+// Specification:
+// http://www.t13.org/documents/UploadedDocuments/project/d1153r18-ATA-ATAPI-4.pdf
+//
+// References to particular items in the specification are denoted between brackets
+// optionally followed by a quote from the specification.
+#include "drv_xiso_dvd.h"
+#include "../atapi_defs.h"
+
+#include "openxbox/log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+namespace openxbox {
+namespace hw {
+namespace ata {
+
+// The cache holds blocks of 16 sectors, up to 16 MiB in total. Readahead
+// starts at 64 KiB and grows up to 2 MiB during sequential reads.
+static const uint32_t kCacheBlockSize = 16 * kCDSectorSize;
+static const uint32_t kCacheCapacity = 512;
+static const uint32_t kMinReadaheadBlocks = 2;
+static const uint32_t kMaxReadaheadBlocks = 64;
+
+// Compressed images are cached one chunk per block, with the same amount
+// of memory, and decompressed by up to this many readahead workers
+static const uint32_t kCacheSize = kCacheBlockSize * kCacheCapacity;
+static const uint32_t kMaxReadaheadSize = kCacheBlockSize * kMaxReadaheadBlocks;
+static const unsigned int kMaxDecompressionWorkers = 4;
+
+// Largest number of sectors transferred by a single read command
+static const uint32_t kMaxReadSectors = 0x10000;
+
+static inline uint16_t ReadBE16(const uint8_t *p) {
+    return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t ReadBE32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline void WriteBE16(uint8_t *p, uint16_t value) {
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+static inline void WriteBE32(uint8_t *p, uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = (value >> 16) & 0xFF;
+    p[2] = (value >> 8) & 0xFF;
+    p[3] = value & 0xFF;
+}
+
+XISODVDDriveATADeviceDriver::XISODVDDriveATADeviceDriver() {
+}
+
+XISODVDDriveATADeviceDriver::~XISODVDDriveATADeviceDriver() {
+    Close();
+}
+
+bool XISODVDDriveATADeviceDriver::Open(const char *path) {
+    Close();
+
+    bool compressed = CompressedImage::IsCompressedImage(path);
+    if (compressed) {
+        if (!m_compressedImage.Open(path)) {
+            return false;
+        }
+        m_size = m_compressedImage.GetSize();
+    }
+    else {
+        if (!m_file.Open(path, false)) {
+            log_warning("XISODVDDriveATADeviceDriver: Could not open %s\n", path);
+            return false;
+        }
+        m_size = m_file.GetSize();
+    }
+
+    m_sectorCount = (uint32_t)std::min<uint64_t>(m_size / kCDSectorSize, 0xFFFFFFFF);
+    if (m_sectorCount == 0) {
+        log_warning("XISODVDDriveATADeviceDriver: %s is too small to be an XISO image\n", path);
+        Close();
+        return false;
+    }
+
+    if (compressed) {
+        // Leave one core for the emulated CPU
+        unsigned int workers = std::max(1u, std::min(std::thread::hardware_concurrency() - 1, kMaxDecompressionWorkers));
+        uint32_t chunkSize = m_compressedImage.GetChunkSize();
+        m_cache = new BlockCache(chunkSize, m_compressedImage.GetChunkCount(), std::max(kCacheSize / chunkSize, 16u), workers,
+            [this](uint64_t block, uint8_t *dest) -> bool { return m_compressedImage.ReadChunk(block, dest); });
+        m_cache->SetReadahead(std::max(kMinReadaheadBlocks * kCacheBlockSize / chunkSize, 1u), std::max(kMaxReadaheadSize / chunkSize, 2u));
+    }
+    else {
+        uint64_t blockCount = ((uint64_t)m_sectorCount * kCDSectorSize + kCacheBlockSize - 1) / kCacheBlockSize;
+        m_cache = new BlockCache(kCacheBlockSize, blockCount, kCacheCapacity, 1, [this](uint64_t block, uint8_t *dest) -> bool { return FetchBlock(block, dest); });
+        m_cache->SetReadahead(kMinReadaheadBlocks, kMaxReadaheadBlocks);
+    }
+
+    log_info("XISODVDDriveATADeviceDriver: Inserted %s%s with %u sectors\n", compressed ? "compressed image " : "", path, m_sectorCount);
+    return true;
+}
+
+void XISODVDDriveATADeviceDriver::Close() {
+    // Stop the readahead thread before closing the file
+    if (m_cache != nullptr) {
+        delete m_cache;
+        m_cache = nullptr;
+    }
+
+    m_file.Close();
+    m_compressedImage.Close();
+
+    m_size = 0;
+    m_sectorCount = 0;
+}
+
+BlockCacheStats XISODVDDriveATADeviceDriver::GetCacheStats() {
+    if (m_cache == nullptr) {
+        return BlockCacheStats();
+    }
+    return m_cache->GetStats();
+}
+
+bool XISODVDDriveATADeviceDriver::FetchBlock(uint64_t block, uint8_t *dest) {
+    uint64_t offset = block * kCacheBlockSize;
+    uint32_t length = (uint32_t)std::min<uint64_t>(kCacheBlockSize, m_size - offset);
+
+    // The last block of the image may be partial
+    if (length < kCacheBlockSize) {
+        memset(dest + length, 0, kCacheBlockSize - length);
+    }
+
+    return m_file.ReadAt(offset, dest, length);
+}
+
+void XISODVDDriveATADeviceDriver::IdentifyDevice(IdentifyDeviceData *data) {
+    // Identify Packet Device data
+    memset(data, 0, sizeof(IdentifyDeviceData));
+
+    data->generalConfiguration = IDPktGenConfATAPIDevice | IDPktGenConfCDROMDevice | IDPktGenConfRemovableMedia | IDPktGenConfAcceleratedDRQ | IDPktGenConf12BytePackets;
+
+    padString((uint8_t *)data->serialNumber, "OXDVD0000001", kSerialNumberLength);
+    padString((uint8_t *)data->firmwareRevision, "1.00", kFirmwareRevLength);
+    padString((uint8_t *)data->modelNumber, "OpenXBOX XISO DVD-ROM", kModelNumberLength);
+
+    data->capabilities1 = IDCaps1LBASupported | IDCaps1DMASupported | IDCaps1IORDYSupported;
+    data->validTranslationFields = IDValidXlatUltraDMA | IDValidXlatTransferCycles;
+
+    data->multiwordDMASettings = IDMultiwordDMA0Supported | IDMultiwordDMA1Supported | IDMultiwordDMA2Supported | IDMultiwordDMA0Selected;
+    data->advancedPIOModesSupported = 2; // Up to PIO mode 4
+    data->minMDMATransferCyclePerWord = 120;
+    data->recommendedMDMATransferCycleTime = 120;
+    data->minPIOTransferCycleNoFlowCtl = 120;
+    data->minPIOTransferCycleIORDYFlowCtl = 120;
+
+    data->majorVersionNumber = IDMajorVerATAPI4 | IDMajorVerATA3 | IDMajorVerATA2 | IDMajorVerATA1;
+    data->minorVersionNumber = IDMinorVerATAPI4_T13_1153D_rev17;
+
+    data->commandSetsSupported1 = IDCmdSet1PacketCommandFeatureSet | IDCmdSet1RemovableMediaFeatureSet;
+    data->commandSetsSupported2 = IDCmdSet2Bit14AlwaysOne;
+    data->commandSetsSupported3 = IDCmdSet3Bit14AlwaysOne;
+
+    data->commandSetsEnabled1 = IDCmdSet1PacketCommandFeatureSet | IDCmdSet1RemovableMediaFeatureSet;
+    data->commandSetsEnabled2 = IDCmdSet2Bit14AlwaysOne;
+    data->commandSetsEnabled3 = IDCmdSet3Bit14AlwaysOne;
+
+    data->ultraDMASettings = IDUltraDMA0Supported | IDUltraDMA1Supported | IDUltraDMA2Supported;
+}
+
+bool XISODVDDriveATADeviceDriver::ProcessATAPIPacket(const uint8_t *packet, std::vector<uint8_t>& data, uint8_t *senseKey) {
+    data.clear();
+
+    bool succeeded;
+    switch (packet[0]) {
+    case PktCmdRequestSense:
+        // Reports the sense data of the previous command, so it must not be reset
+        return RequestSense(packet, data);
+    case PktCmdInquiry:
+        succeeded = Inquiry(packet, data);
+        break;
+    case PktCmdTestUnitReady:
+    case PktCmdStartStopUnit:
+    case PktCmdPreventAllowRemoval:
+    case PktCmdSeek10:
+        succeeded = HasMedium() || Fail(SenseNotReady, ASCMediumNotPresent);
+        break;
+    case PktCmdReadCapacity:
+        succeeded = ReadCapacity(data);
+        break;
+    case PktCmdRead10:
+        succeeded = Read(ReadBE32(&packet[2]), ReadBE16(&packet[7]), data);
+        break;
+    case PktCmdRead12:
+        succeeded = Read(ReadBE32(&packet[2]), ReadBE32(&packet[6]), data);
+        break;
+    case PktCmdModeSense10:
+        succeeded = ModeSense10(packet, data);
+        break;
+    case PktCmdReadDVDStructure:
+    case PktCmdReportKey:
+        // Disc security: the disc is always reported as authenticated, so these
+        // only need to complete without errors
+        succeeded = ZeroResponse(ReadBE16(&packet[8]), data);
+        break;
+    default:
+        // Includes Mode Select and Send Key, which transfer data from the host
+        log_debug("XISODVDDriveATADeviceDriver::ProcessATAPIPacket:  Unsupported packet command 0x%02x\n", packet[0]);
+        succeeded = Fail(SenseIllegalRequest, ASCInvalidCommandOperationCode);
+        break;
+    }
+
+    if (succeeded) {
+        m_senseKey = SenseNone;
+        m_asc = ASCNone;
+    }
+    else {
+        data.clear();
+        *senseKey = m_senseKey;
+    }
+    return succeeded;
+}
+
+bool XISODVDDriveATADeviceDriver::Fail(uint8_t senseKey, uint8_t asc) {
+    m_senseKey = senseKey;
+    m_asc = asc;
+    return false;
+}
+
+bool XISODVDDriveATADeviceDriver::RequestSense(const uint8_t *packet, std::vector<uint8_t>& data) {
+    data.assign(kSenseDataLength, 0);
+    data[0] = kSenseResponseCurrent;
+    data[2] = m_senseKey;
+    data[7] = kSenseDataLength - 8;  // Additional sense length
+    data[12] = m_asc;
+    data.resize(std::min<uint32_t>(kSenseDataLength, packet[4]));
+
+    m_senseKey = SenseNone;
+    m_asc = ASCNone;
+    return true;
+}
+
+bool XISODVDDriveATADeviceDriver::Inquiry(const uint8_t *packet, std::vector<uint8_t>& data) {
+    data.assign(kInquiryDataLength, 0);
+    data[0] = kInquiryDeviceTypeCDROM;
+    data[1] = 0x80;                         // Removable medium
+    data[3] = 0x32;                         // ATAPI version 3, response data format 2
+    data[4] = kInquiryDataLength - 5;       // Additional length
+    memcpy(&data[8], "OpenXBOX", 8);        // Vendor identification
+    memcpy(&data[16], "XISO DVD-ROM    ", 16); // Product identification
+    memcpy(&data[32], "1.00", 4);           // Product revision level
+    data.resize(std::min<uint32_t>(kInquiryDataLength, packet[4]));
+    return true;
+}
+
+bool XISODVDDriveATADeviceDriver::ReadCapacity(std::vector<uint8_t>& data) {
+    if (!HasMedium()) {
+        return Fail(SenseNotReady, ASCMediumNotPresent);
+    }
+
+    data.assign(8, 0);
+    WriteBE32(&data[0], m_sectorCount - 1);  // Address of the last logical block
+    WriteBE32(&data[4], kCDSectorSize);      // Block length
+    return true;
+}
+
+bool XISODVDDriveATADeviceDriver::Read(uint32_t lba, uint32_t count, std::vector<uint8_t>& data) {
+    if (!HasMedium()) {
+        return Fail(SenseNotReady, ASCMediumNotPresent);
+    }
+    if ((uint64_t)lba + count > m_sectorCount) {
+        return Fail(SenseIllegalRequest, ASCLogicalBlockAddressOutOfRange);
+    }
+    if (count > kMaxReadSectors) {
+        return Fail(SenseIllegalRequest, ASCInvalidFieldInCDB);
+    }
+
+    data.resize((size_t)count * kCDSectorSize);
+    if (count > 0 && !m_cache->Read((uint64_t)lba * kCDSectorSize, data.data(), count * kCDSectorSize)) {
+        log_warning("XISODVDDriveATADeviceDriver::Read:  Could not read %u sectors at LBA %u\n", count, lba);
+        return Fail(SenseMediumError, ASCUnrecoveredReadError);
+    }
+    return true;
+}
+
+bool XISODVDDriveATADeviceDriver::ModeSense10(const uint8_t *packet, std::vector<uint8_t>& data) {
+    uint8_t pageCode = packet[2] & 0x3F;
+    uint16_t allocationLength = ReadBE16(&packet[7]);
+
+    if (pageCode != ModePageXboxSecurity && pageCode != ModePageAll) {
+        return Fail(SenseIllegalRequest, ASCInvalidFieldInCDB);
+    }
+
+    // The security page reports the disc as authenticated, with the game
+    // partition (the contents of the XISO) selected
+    XboxSecurityModePage page;
+    memset(&page, 0, sizeof(page));
+    page.pageCode = ModePageXboxSecurity;
+    page.pageLength = sizeof(page) - 2;
+    page.partitionArea = 1;
+    page.cdfValid = 1;
+    page.authentication = 1;
+
+    data.assign(kModeParameterHeader10Length + sizeof(page), 0);
+    WriteBE16(&data[0], (uint16_t)(data.size() - 2));  // Mode data length
+    memcpy(&data[kModeParameterHeader10Length], &page, sizeof(page));
+    data.resize(std::min<size_t>(data.size(), allocationLength));
+    return true;
+}
+
+bool XISODVDDriveATADeviceDriver::ZeroResponse(uint32_t allocationLength, std::vector<uint8_t>& data) {
+    if (!HasMedium()) {
+        return Fail(SenseNotReady, ASCMediumNotPresent);
+    }
+    data.assign(allocationLength, 0);
+    return true;
+}
+
+}
+}
+}
@@ -0,0 +1,108 @@
+// ATA/ATAPI-4 emulation for the Original Xbox
+// (C) Ivan "StrikerX3" Oliveira
+//
+// This code aims to implement a subset of the ATA/ATAPI-4 specification
+// that satisifies the requirements of an IDE interface for the Original Xbox.
+//
+// Specification:
+// http://www.t13.org/documents/UploadedDocuments/project/d1153r18-ATA-ATAPI-4.pdf
+//
+// References to particular items in the specification are denoted between brackets
+// optionally followed by a quote from the specification.
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "ata_device_driver.h"
+#include "block_cache.h"
+#include "compressed_image.h"
+#include "host_file.h"
+
+namespace openxbox {
+namespace hw {
+namespace ata {
+
+/*!
+ * A DVD drive that plays XISO images: dumps of the game partition of Xbox
+ * discs, with one 2048-byte sector per 2048 bytes of the file.
+ *
+ * The drive implements the PACKET command feature set and executes the
+ * subset of packet commands used by the Xbox kernel. The disc security
+ * checks are stubbed out: the drive reports the disc as authenticated with
+ * the game partition selected, so that sector 0 is the first sector of the
+ * image.
+ *
+ * Sectors are read through a BlockCache, so that streaming game assets
+ * sequentially is served from memory by a readahead thread instead of
+ * waiting on the host disk.
+ *
+ * Compressed XISO images are also accepted. Their chunks are decompressed
+ * into the cache, in parallel by several readahead workers.
+ *
+ * The drive is attached even when no image is inserted; packet commands
+ * that access the medium then fail with NOT READY.
+ */
+class XISODVDDriveATADeviceDriver : public IATADeviceDriver {
+public:
+    XISODVDDriveATADeviceDriver();
+    ~XISODVDDriveATADeviceDriver() override;
+
+    // Inserts the XISO image or compressed XISO image at the specified path
+    bool Open(const char *path);
+
+    // Ejects the image, if any
+    void Close();
+
+    bool HasMedium() const { return m_cache != nullptr; }
+    BlockCacheStats GetCacheStats();
+
+    bool IsAttached() override { return true; }
+    void IdentifyDevice(IdentifyDeviceData *data) override;
+
+    // The drive does not support ATA sector transfers; use PACKET commands instead
+    uint64_t GetSectorCount() override { return 0; }
+    bool ReadSectors(uint64_t lba, uint8_t *buffer, uint32_t count) override { return false; }
+    bool WriteSectors(uint64_t lba, const uint8_t *buffer, uint32_t count) override { return false; }
+    bool Flush() override { return true; }
+
+    bool IsATAPIDevice() override { return true; }
+    bool ProcessATAPIPacket(const uint8_t *packet, std::vector<uint8_t>& data, uint8_t *senseKey) override;
+
+private:
+    // ----- Packet command handlers ------------------------------------------
+
+    bool Inquiry(const uint8_t *packet, std::vector<uint8_t>& data);
+    bool ModeSense10(const uint8_t *packet, std::vector<uint8_t>& data);
+    bool Read(uint32_t lba, uint32_t count, std::vector<uint8_t>& data);
+    bool ReadCapacity(std::vector<uint8_t>& data);
+    bool RequestSense(const uint8_t *packet, std::vector<uint8_t>& data);
+
+    // Fills data with zeros up to the allocation length. Used by the stubbed
+    // out disc security commands.
+    bool ZeroResponse(uint32_t allocationLength, std::vector<uint8_t>& data);
+
+    // Records the sense data of a failed command. Always returns false.
+    bool Fail(uint8_t senseKey, uint8_t asc);
+
+    bool FetchBlock(uint64_t block, uint8_t *dest);
+
+    // ----- Medium -----------------------------------------------------------
+
+    uint64_t m_size = 0;
+    uint32_t m_sectorCount = 0;
+    BlockCache *m_cache = nullptr;
+
+    // Only one of these is open at a time
+    HostFile m_file;
+    CompressedImage m_compressedImage;
+
+    // ----- Sense data of the last command -----------------------------------
+
+    uint8_t m_senseKey = 0;
+    uint8_t m_asc = 0;
+};
+
+}
+}
+}
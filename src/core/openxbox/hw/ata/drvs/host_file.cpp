@@ -0,0 +1,162 @@
+// ATA/ATAPI-4 emulation for the Original Xbox
+// (C) Ivan "StrikerX3" Oliveira
+//
+// This code aims to implement a subset of the ATA/ATAPI-4 specification
+// that satisifies the requirements of an IDE interface for the Original Xbox.
+//
+// Specification:
+// http://www.t13.org/documents/UploadedDocuments/project/d1153r18-ATA-ATAPI-4.pdf
+//
+// References to particular items in the specification are denoted between brackets
+// optionally followed by a quote from the specification.
+#include "host_file.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace openxbox {
+namespace hw {
+namespace ata {
+
+bool HostFile::Open(const char *path, bool writable) {
+    Close();
+#ifdef _WIN32
+    HANDLE file = writable
+        ? CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL)
+        : CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    m_handle = file;
+#else
+    m_fd = writable ? open(path, O_RDWR | O_CREAT, 0644) : open(path, O_RDONLY);
+    if (m_fd < 0) {
+        return false;
+    }
+#endif
+    return true;
+}
+
+void HostFile::Close() {
+#ifdef _WIN32
+    if (m_handle != nullptr) {
+        CloseHandle((HANDLE)m_handle);
+        m_handle = nullptr;
+    }
+#else
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+#endif
+}
+
+bool HostFile::IsOpen() const {
+#ifdef _WIN32
+    return m_handle != nullptr;
+#else
+    return m_fd >= 0;
+#endif
+}
+
+bool HostFile::ReadAt(uint64_t offset, void *buffer, size_t length) {
+    uint8_t *dest = (uint8_t *)buffer;
+    while (length > 0) {
+#ifdef _WIN32
+        OVERLAPPED overlapped = { 0 };
+        overlapped.Offset = (DWORD)offset;
+        overlapped.OffsetHigh = (DWORD)(offset >> 32);
+        DWORD chunk = (DWORD)std::min<size_t>(length, 0x40000000);
+        DWORD result;
+        if (!ReadFile((HANDLE)m_handle, dest, chunk, &result, &overlapped) || result == 0) {
+            return false;
+        }
+#else
+        ssize_t result = pread(m_fd, dest, length, (off_t)offset);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return false;
+        }
+#endif
+        dest += result;
+        offset += result;
+        length -= result;
+    }
+    return true;
+}
+
+bool HostFile::WriteAt(uint64_t offset, const void *buffer, size_t length) {
+    const uint8_t *src = (const uint8_t *)buffer;
+    while (length > 0) {
+#ifdef _WIN32
+        OVERLAPPED overlapped = { 0 };
+        overlapped.Offset = (DWORD)offset;
+        overlapped.OffsetHigh = (DWORD)(offset >> 32);
+        DWORD chunk = (DWORD)std::min<size_t>(length, 0x40000000);
+        DWORD result;
+        if (!WriteFile((HANDLE)m_handle, src, chunk, &result, &overlapped) || result == 0) {
+            return false;
+        }
+#else
+        ssize_t result = pwrite(m_fd, src, length, (off_t)offset);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return false;
+        }
+#endif
+        src += result;
+        offset += result;
+        length -= result;
+    }
+    return true;
+}
+
+bool HostFile::Truncate(uint64_t size) {
+#ifdef _WIN32
+    LARGE_INTEGER end;
+    end.QuadPart = (LONGLONG)size;
+    return SetFilePointerEx((HANDLE)m_handle, end, NULL, FILE_BEGIN) && SetEndOfFile((HANDLE)m_handle);
+#else
+    return ftruncate(m_fd, (off_t)size) == 0;
+#endif
+}
+
+bool HostFile::Sync() {
+#ifdef _WIN32
+    return FlushFileBuffers((HANDLE)m_handle) != 0;
+#else
+    return fsync(m_fd) == 0;
+#endif
+}
+
+uint64_t HostFile::GetSize() {
+#ifdef _WIN32
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx((HANDLE)m_handle, &size)) {
+        return 0;
+    }
+    return (uint64_t)size.QuadPart;
+#else
+    struct stat st;
+    if (fstat(m_fd, &st) != 0) {
+        return 0;
+    }
+    return (uint64_t)st.st_size;
+#endif
+}
+
+}
+}
+}
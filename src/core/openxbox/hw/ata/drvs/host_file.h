@@ -0,0 +1,56 @@
+// ATA/ATAPI-4 emulation for the Original Xbox
+// (C) Ivan "StrikerX3" Oliveira
+//
+// This code aims to implement a subset of the ATA/ATAPI-4 specification
+// that satisifies the requirements of an IDE interface for the Original Xbox.
+//
+// Specification:
+// http://www.t13.org/documents/UploadedDocuments/project/d1153r18-ATA-ATAPI-4.pdf
+//
+// References to particular items in the specification are denoted between brackets
+// optionally followed by a quote from the specification.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace openxbox {
+namespace hw {
+namespace ata {
+
+/*!
+ * A host file accessed with positioned reads and writes, which may be
+ * issued concurrently from multiple threads.
+ */
+class HostFile {
+public:
+    HostFile() {}
+    HostFile(const HostFile&) = delete;
+    HostFile& operator=(const HostFile&) = delete;
+    ~HostFile() { Close(); }
+
+    // Opens the file at the specified path. Writable files are created if
+    // they do not exist.
+    bool Open(const char *path, bool writable);
+    void Close();
+    bool IsOpen() const;
+
+    // These transfer the whole length or fail
+    bool ReadAt(uint64_t offset, void *buffer, size_t length);
+    bool WriteAt(uint64_t offset, const void *buffer, size_t length);
+
+    bool Truncate(uint64_t size);
+    bool Sync();
+    uint64_t GetSize();
+
+private:
+#ifdef _WIN32
+    void *m_handle = nullptr;
+#else
+    int m_fd = -1;
+#endif
+};
+
+}
+}
+}
@@ -0,0 +1,76 @@
+#include "adpcm.h"
+#include "apu_defs.h"
+
+#include <algorithm>
+
+namespace openxbox {
+namespace hw {
+namespace audio {
+
+static const int16_t kStepTable[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767,
+};
+
+static const int8_t kIndexTable[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8,
+};
+
+struct AdpcmChannel {
+    int predictor;
+    int index;
+};
+
+static inline int16_t decodeNibble(AdpcmChannel& ch, uint8_t nibble) {
+    int step = kStepTable[ch.index];
+    int diff = step >> 3;
+    if (nibble & 1) diff += step >> 2;
+    if (nibble & 2) diff += step >> 1;
+    if (nibble & 4) diff += step;
+    if (nibble & 8) {
+        ch.predictor -= diff;
+    }
+    else {
+        ch.predictor += diff;
+    }
+    ch.predictor = std::min(std::max(ch.predictor, -32768), 32767);
+    ch.index = std::min(std::max(ch.index + kIndexTable[nibble], 0), 88);
+    return (int16_t)ch.predictor;
+}
+
+void apu_adpcm_decode_block(const uint8_t *block, unsigned int channels, int16_t *out) {
+    AdpcmChannel state[2];
+    for (unsigned int c = 0; c < channels; c++) {
+        const uint8_t *header = block + c * 4;
+        state[c].predictor = (int16_t)(header[0] | (header[1] << 8));
+        state[c].index = std::min<int>(header[2], 88);
+        out[c] = (int16_t)state[c].predictor;
+    }
+
+    // The header sample is the first sample of the block, so only the first
+    // 63 of the 64 encoded samples are needed
+    const uint8_t *data = block + channels * 4;
+    for (unsigned int group = 0; group < (NV_PAPU_ADPCM_BLOCK_SIZE - 4) / 4; group++) {
+        for (unsigned int c = 0; c < channels; c++) {
+            const uint8_t *bytes = data + (group * channels + c) * 4;
+            for (unsigned int i = 0; i < 8; i++) {
+                unsigned int sample = 1 + group * 8 + i;
+                if (sample >= NV_PAPU_ADPCM_BLOCK_SAMPLES) {
+                    break;
+                }
+                uint8_t nibble = (i & 1) ? (bytes[i / 2] >> 4) : (bytes[i / 2] & 0xF);
+                out[sample * channels + c] = decodeNibble(state[c], nibble);
+            }
+        }
+    }
+}
+
+}
+}
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+namespace openxbox {
+namespace hw {
+namespace audio {
+
+/*!
+ * Decodes one Xbox ADPCM block into NV_PAPU_ADPCM_BLOCK_SAMPLES samples per
+ * channel.
+ *
+ * Xbox ADPCM is IMA ADPCM with fixed 36-byte blocks per channel. Each channel
+ * starts with a 4-byte header holding the first sample and the initial step
+ * index; the remaining nibbles are interleaved between channels every 4
+ * bytes. Output samples are interleaved as well.
+ */
+void apu_adpcm_decode_block(const uint8_t *block, unsigned int channels, int16_t *out);
+
+}
+}
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+// MCPX APU register and voice structure definitions, based on the
+// documentation gathered by the XQEMU project.
+
+// ----- Global registers -----------------------------------------------------
+
+#define NV_PAPU_ISTS                                     0x00001000
+#   define NV_PAPU_ISTS_GINTSTS                               (1 << 0)
+#   define NV_PAPU_ISTS_FETINTSTS                             (1 << 4)
+#   define NV_PAPU_ISTS_FEVINTSTS                             (1 << 6)
+#   define NV_PAPU_ISTS_GPMINTSTS                             (1 << 9)
+#   define NV_PAPU_ISTS_GPNINTSTS                             (1 << 10)
+#   define NV_PAPU_ISTS_EPMINTSTS                             (1 << 11)
+#   define NV_PAPU_ISTS_EPNINTSTS                             (1 << 12)
+#define NV_PAPU_IEN                                      0x00001004
+#define NV_PAPU_FECTL                                    0x00001100
+#define NV_PAPU_FECV                                     0x00001110
+#define NV_PAPU_FEAV                                     0x00001118
+#   define NV_PAPU_FEAV_VALUE                                 0x0000FFFF
+#   define NV_PAPU_FEAV_LST                                   0x00030000
+#define NV_PAPU_SECTL                                    0x00002000
+#   define NV_PAPU_SECTL_XCNTMODE                             (3 << 3)
+#       define NV_PAPU_SECTL_XCNTMODE_OFF                          0
+#define NV_PAPU_XGSCNT                                   0x0000200C
+#define NV_PAPU_VPVADDR                                  0x0000202C
+#define NV_PAPU_VPSGEADDR                                0x00002030
+#define NV_PAPU_GPSADDR                                  0x00002040
+#define NV_PAPU_GPFADDR                                  0x00002044
+#define NV_PAPU_EPSADDR                                  0x00002048
+#define NV_PAPU_EPFADDR                                  0x0000204C
+#define NV_PAPU_TVL2D                                    0x00002054
+#define NV_PAPU_CVL2D                                    0x00002058
+#define NV_PAPU_NVL2D                                    0x0000205C
+#define NV_PAPU_TVL3D                                    0x00002060
+#define NV_PAPU_CVL3D                                    0x00002064
+#define NV_PAPU_NVL3D                                    0x00002068
+#define NV_PAPU_TVLMP                                    0x0000206C
+#define NV_PAPU_CVLMP                                    0x00002070
+#define NV_PAPU_NVLMP                                    0x00002074
+#define NV_PAPU_GPSMAXSGE                                0x000020D4
+#define NV_PAPU_GPFMAXSGE                                0x000020D8
+#define NV_PAPU_EPSMAXSGE                                0x000020DC
+#define NV_PAPU_EPFMAXSGE                                0x000020E0
+
+// Size of the global register space, which is followed by the VP, GP and EP
+#define NV_PAPU_SIZE                                     0x00020000
+
+// ----- Voice processor methods ----------------------------------------------
+
+#define NV1BA0_PIO_FREE                                  0x00000010
+#define NV1BA0_PIO_SET_ANTECEDENT_VOICE                  0x00000120
+#   define NV1BA0_PIO_SET_ANTECEDENT_VOICE_HANDLE             0x0000FFFF
+#   define NV1BA0_PIO_SET_ANTECEDENT_VOICE_LIST               0x00030000
+#       define NV1BA0_PIO_SET_ANTECEDENT_VOICE_LIST_INHERIT        0
+#       define NV1BA0_PIO_SET_ANTECEDENT_VOICE_LIST_2D_TOP         1
+#       define NV1BA0_PIO_SET_ANTECEDENT_VOICE_LIST_3D_TOP         2
+#       define NV1BA0_PIO_SET_ANTECEDENT_VOICE_LIST_MP_TOP         3
+#define NV1BA0_PIO_VOICE_ON                              0x00000124
+#   define NV1BA0_PIO_VOICE_ON_HANDLE                         0x0000FFFF
+#   define NV1BA0_PIO_VOICE_ON_ENVA                           0xF0000000
+#define NV1BA0_PIO_VOICE_OFF                             0x00000128
+#   define NV1BA0_PIO_VOICE_OFF_HANDLE                        0x0000FFFF
+#define NV1BA0_PIO_VOICE_RELEASE                         0x0000012C
+#   define NV1BA0_PIO_VOICE_RELEASE_HANDLE                    0x0000FFFF
+#define NV1BA0_PIO_VOICE_PAUSE                           0x00000140
+#   define NV1BA0_PIO_VOICE_PAUSE_HANDLE                      0x0000FFFF
+#   define NV1BA0_PIO_VOICE_PAUSE_ACTION                      (1 << 18)
+#define NV1BA0_PIO_SET_CURRENT_VOICE                     0x000002F8
+#define NV1BA0_PIO_SET_VOICE_CFG_VBIN                    0x00000300
+#define NV1BA0_PIO_SET_VOICE_CFG_FMT                     0x00000304
+#define NV1BA0_PIO_SET_VOICE_CFG_ENV0                    0x00000308
+#define NV1BA0_PIO_SET_VOICE_CFG_ENVA                    0x0000030C
+#define NV1BA0_PIO_SET_VOICE_CFG_MISC                    0x00000318
+#define NV1BA0_PIO_SET_VOICE_TAR_VOLA                    0x00000360
+#define NV1BA0_PIO_SET_VOICE_TAR_VOLB                    0x00000364
+#define NV1BA0_PIO_SET_VOICE_TAR_VOLC                    0x00000368
+#define NV1BA0_PIO_SET_VOICE_TAR_PITCH                   0x0000037C
+#define NV1BA0_PIO_SET_VOICE_CFG_BUF_BASE                0x000003A0
+#define NV1BA0_PIO_SET_VOICE_CFG_BUF_LBO                 0x000003A4
+#define NV1BA0_PIO_SET_VOICE_BUF_CBO                     0x000003D8
+#define NV1BA0_PIO_SET_VOICE_CFG_BUF_EBO                 0x000003DC
+
+// Methods from SET_VOICE_CFG_VBIN to SET_VOICE_TAR_PITCH write straight into
+// the voice structure at the method offset minus this value
+#define NV1BA0_PIO_SET_VOICE_BASE                        0x00000300
+
+// ----- Voice structure ------------------------------------------------------
+
+#define NV_PAVS_SIZE                                     0x00000080
+#define NV_PAVS_VOICE_CFG_VBIN                           0x00000000
+#define NV_PAVS_VOICE_CFG_FMT                            0x00000004
+#   define NV_PAVS_VOICE_CFG_FMT_V6BIN                        (0x1F << 0)
+#   define NV_PAVS_VOICE_CFG_FMT_V7BIN                        (0x1F << 5)
+#   define NV_PAVS_VOICE_CFG_FMT_SAMPLES_PER_BLOCK            (0x1F << 16)
+#   define NV_PAVS_VOICE_CFG_FMT_MULTIPACKET                  (1 << 21)
+#   define NV_PAVS_VOICE_CFG_FMT_LOOP                         (1 << 25)
+#   define NV_PAVS_VOICE_CFG_FMT_STEREO                       (1 << 27)
+#   define NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE                  (3 << 28)
+#       define NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_U8                0
+#       define NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_S16               1
+#       define NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_S24               2
+#       define NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_S32               3
+#   define NV_PAVS_VOICE_CFG_FMT_CONTAINER_SIZE               (3u << 30)
+#       define NV_PAVS_VOICE_CFG_FMT_CONTAINER_SIZE_B8             0
+#       define NV_PAVS_VOICE_CFG_FMT_CONTAINER_SIZE_B16            1
+#       define NV_PAVS_VOICE_CFG_FMT_CONTAINER_SIZE_ADPCM          2
+#       define NV_PAVS_VOICE_CFG_FMT_CONTAINER_SIZE_B32            3
+#define NV_PAVS_VOICE_CFG_ENV0                           0x00000008
+#   define NV_PAVS_VOICE_CFG_ENV0_EA_ATTACKRATE               (0xFFF << 0)
+#   define NV_PAVS_VOICE_CFG_ENV0_EA_DELAYTIME                (0xFFF << 12)
+#define NV_PAVS_VOICE_CFG_ENVA                           0x0000000C
+#   define NV_PAVS_VOICE_CFG_ENVA_EA_DECAYRATE                (0xFFF << 0)
+#   define NV_PAVS_VOICE_CFG_ENVA_EA_HOLDTIME                 (0xFFF << 12)
+#   define NV_PAVS_VOICE_CFG_ENVA_EA_SUSTAINLEVEL             (0xFFu << 24)
+#define NV_PAVS_VOICE_CFG_MISC                           0x00000018
+#   define NV_PAVS_VOICE_CFG_MISC_EA_RELEASERATE              (0xFFF << 0)
+#define NV_PAVS_VOICE_CUR_PSL_START                      0x00000020
+#   define NV_PAVS_VOICE_CUR_PSL_START_BA                     0x00FFFFFF
+#define NV_PAVS_VOICE_CUR_PSH_SAMPLE                     0x00000024
+#   define NV_PAVS_VOICE_CUR_PSH_SAMPLE_LBO                   0x00FFFFFF
+#define NV_PAVS_VOICE_CUR_ECNT                           0x00000040
+#   define NV_PAVS_VOICE_CUR_ECNT_EACOUNT                     0x0000FFFF
+#define NV_PAVS_VOICE_PAR_STATE                          0x00000054
+#   define NV_PAVS_VOICE_PAR_STATE_PAUSED                     (1 << 18)
+#   define NV_PAVS_VOICE_PAR_STATE_NEW_VOICE                  (1 << 20)
+#   define NV_PAVS_VOICE_PAR_STATE_ACTIVE_VOICE               (1 << 21)
+#   define NV_PAVS_VOICE_PAR_STATE_EACUR                      (0xFu << 28)
+#define NV_PAVS_VOICE_PAR_OFFSET                         0x00000058
+#   define NV_PAVS_VOICE_PAR_OFFSET_CBO                       0x00FFFFFF
+#   define NV_PAVS_VOICE_PAR_OFFSET_EALVL                     0xFF000000
+#define NV_PAVS_VOICE_PAR_NEXT                           0x0000005C
+#   define NV_PAVS_VOICE_PAR_NEXT_EBO                         0x00FFFFFF
+#define NV_PAVS_VOICE_TAR_VOLA                           0x00000060
+#   define NV_PAVS_VOICE_TAR_VOLA_VOLUME6_B3_0                0x0000000F
+#   define NV_PAVS_VOICE_TAR_VOLA_VOLUME0                     0x0000FFF0
+#   define NV_PAVS_VOICE_TAR_VOLA_VOLUME7_B3_0                0x000F0000
+#   define NV_PAVS_VOICE_TAR_VOLA_VOLUME1                     0xFFF00000
+#define NV_PAVS_VOICE_TAR_VOLB                           0x00000064
+#   define NV_PAVS_VOICE_TAR_VOLB_VOLUME6_B7_4                0x0000000F
+#   define NV_PAVS_VOICE_TAR_VOLB_VOLUME2                     0x0000FFF0
+#   define NV_PAVS_VOICE_TAR_VOLB_VOLUME7_B7_4                0x000F0000
+#   define NV_PAVS_VOICE_TAR_VOLB_VOLUME3                     0xFFF00000
+#define NV_PAVS_VOICE_TAR_VOLC                           0x00000068
+#   define NV_PAVS_VOICE_TAR_VOLC_VOLUME6_B11_8               0x0000000F
+#   define NV_PAVS_VOICE_TAR_VOLC_VOLUME4                     0x0000FFF0
+#   define NV_PAVS_VOICE_TAR_VOLC_VOLUME7_B11_8               0x000F0000
+#   define NV_PAVS_VOICE_TAR_VOLC_VOLUME5                     0xFFF00000
+#define NV_PAVS_VOICE_TAR_PITCH_LINK                     0x0000007C
+#   define NV_PAVS_VOICE_TAR_PITCH_LINK_NEXT_VOICE_HANDLE     0x0000FFFF
+#   define NV_PAVS_VOICE_TAR_PITCH_LINK_PITCH                 0xFFFF0000
+
+// Amplitude envelope states (NV_PAVS_VOICE_PAR_STATE_EACUR)
+#define NV_PAVS_VOICE_ENV_OFF                            0
+#define NV_PAVS_VOICE_ENV_DELAY                          1
+#define NV_PAVS_VOICE_ENV_ATTACK                         2
+#define NV_PAVS_VOICE_ENV_HOLD                           3
+#define NV_PAVS_VOICE_ENV_DECAY                          4
+#define NV_PAVS_VOICE_ENV_SUSTAIN                        5
+#define NV_PAVS_VOICE_ENV_RELEASE                        6
+#define NV_PAVS_VOICE_ENV_FORCE_RELEASE                  7
+
+// ----- Global and encode processors -----------------------------------------
+
+// Offsets within the GP and EP register spaces; DSP memories are mapped as
+// one 24-bit word per 32-bit register
+#define NV_PAPU_GPXMEM                                   0x00000000
+#define NV_PAPU_GPMIXBUF                                 0x00005000
+#define NV_PAPU_GPYMEM                                   0x00006000
+#define NV_PAPU_GPPMEM                                   0x0000A000
+#define NV_PAPU_GPRST                                    0x0000FFFC
+#   define NV_PAPU_GPRST_GPRST                                (1 << 0)
+#   define NV_PAPU_GPRST_GPDSPRST                             (1 << 1)
+#define NV_PAPU_EPXMEM                                   0x00000000
+#define NV_PAPU_EPYMEM                                   0x00006000
+#define NV_PAPU_EPPMEM                                   0x0000A000
+#define NV_PAPU_EPRST                                    0x0000FFFC
+#   define NV_PAPU_EPRST_EPRST                                (1 << 0)
+#   define NV_PAPU_EPRST_EPDSPRST                             (1 << 1)
+
+// DSP memory sizes in words
+#define NV_PAPU_GP_XMEM_SIZE    0x1800
+#define NV_PAPU_GP_YMEM_SIZE    0x800
+#define NV_PAPU_GP_PMEM_SIZE    0x1000
+#define NV_PAPU_EP_XMEM_SIZE    0xC00
+#define NV_PAPU_EP_YMEM_SIZE    0x100
+#define NV_PAPU_EP_PMEM_SIZE    0x1000
+
+// The mixbins are placed in GP X memory, one after the other, before every
+// frame
+#define NV_PAPU_GP_MIXBUF_BASE  0x1400
+#define NV_PAPU_GP_MIXBUF_SIZE  (NV_PAPU_MIXBINS * NV_PAPU_FRAME_SAMPLES)
+
+// The DSPs run at 160 MHz
+#define NV_PAPU_DSP_CLOCK       160000000
+
+// ----- Processing parameters ------------------------------------------------
+
+#define NV_PAPU_SAMPLE_RATE     48000
+#define NV_PAPU_FRAME_SAMPLES   32
+#define NV_PAPU_MIXBINS         32
+#define NV_PAPU_MAX_VOICES      256
+#define NV_PAPU_VOICE_BINS      8
+#define NV_PAPU_PAGE_SIZE       4096
+#define NV_PAPU_NO_VOICE        0xFFFF
+
+// Xbox ADPCM blocks hold 64 samples in 36 bytes per channel
+#define NV_PAPU_ADPCM_BLOCK_SIZE     36
+#define NV_PAPU_ADPCM_BLOCK_SAMPLES  64
@@ -0,0 +1,1604 @@
+#include "dsp.h"
+#include "apu_defs.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "openxbox/log.h"
+
+namespace openxbox {
+namespace hw {
+namespace audio {
+
+// Register numbers as encoded in instructions
+#define DSP_REG_X0      0x04
+#define DSP_REG_X1      0x05
+#define DSP_REG_Y0      0x06
+#define DSP_REG_Y1      0x07
+#define DSP_REG_A0      0x08
+#define DSP_REG_B0      0x09
+#define DSP_REG_A2      0x0A
+#define DSP_REG_B2      0x0B
+#define DSP_REG_A1      0x0C
+#define DSP_REG_B1      0x0D
+#define DSP_REG_A       0x0E
+#define DSP_REG_B       0x0F
+#define DSP_REG_R0      0x10
+#define DSP_REG_N0      0x18
+#define DSP_REG_M0      0x20
+#define DSP_REG_EP      0x2A
+#define DSP_REG_VBA     0x30
+#define DSP_REG_SC      0x31
+#define DSP_REG_SZ      0x38
+#define DSP_REG_SR      0x39
+#define DSP_REG_OMR     0x3A
+#define DSP_REG_SP      0x3B
+#define DSP_REG_SSH     0x3C
+#define DSP_REG_SSL     0x3D
+#define DSP_REG_LA      0x3E
+#define DSP_REG_LC      0x3F
+
+// Status register bits
+#define DSP_SR_C        (1 << 0)
+#define DSP_SR_V        (1 << 1)
+#define DSP_SR_Z        (1 << 2)
+#define DSP_SR_N        (1 << 3)
+#define DSP_SR_U        (1 << 4)
+#define DSP_SR_E        (1 << 5)
+#define DSP_SR_L        (1 << 6)
+#define DSP_SR_LF       (1 << 15)
+
+// Parallel moves to and from L: memory
+#define DSP_SPACE_L     3
+
+// Effective address modes
+#define DSP_EA_ABSOLUTE 0x30
+#define DSP_EA_SHORT    0x40  // short absolute address in the low 6 bits
+
+#define DSP_WORD_MASK   0xFFFFFF
+#define DSP_ACC_MASK    0xFFFFFFFFFFFFFFull
+
+// Addresses of the peripherals reachable with the short pp encoding
+#define DSP_PP_BASE     0xFFFFC0
+
+// Output FIFOs are drained by the device every frame; cap them in case a
+// program keeps writing to a FIFO nobody reads
+#define DSP_FIFO_LIMIT  0x10000
+
+static inline int64_t sext24(uint32_t value) {
+    return (int32_t)(value << 8) >> 8;
+}
+
+static inline int64_t sext56(uint64_t value) {
+    return (int64_t)(value << 8) >> 8;
+}
+
+// Places a 24-bit word in the most significant portion of an accumulator
+static inline int64_t toAccumulator(uint32_t value) {
+    return sext24(value) * 0x1000000;
+}
+
+static inline uint32_t bitReverse(uint32_t value, uint32_t bits) {
+    uint32_t result = 0;
+    for (uint32_t i = 0; i < bits; i++) {
+        result = (result << 1) | ((value >> i) & 1);
+    }
+    return result;
+}
+
+DSP56300::DSP56300(const char *name, uint32_t xSize, uint32_t ySize, uint32_t pSize, uint8_t *ram, uint32_t ramSize,
+    const uint32_t *sgeAddr, const uint32_t *sgeMax)
+    : m_name(name)
+    , m_ram(ram)
+    , m_ramSize(ramSize)
+    , m_sgeAddr(sgeAddr)
+    , m_sgeMax(sgeMax)
+    , m_xram(xSize)
+    , m_yram(ySize)
+    , m_pram(pSize)
+    , m_cache(pSize)
+{
+    Reset();
+}
+
+void DSP56300::Reset() {
+    m_x0 = m_x1 = m_y0 = m_y1 = 0;
+    m_a = m_b = 0;
+    for (int i = 0; i < 8; i++) {
+        m_r[i] = 0;
+        m_n[i] = 0;
+        m_m[i] = DSP_WORD_MASK;
+    }
+
+    m_pc = 0;
+    m_sr = 0xC00300;
+    m_omr = 0;
+    m_sp = 0;
+    m_la = 0;
+    m_lc = 0;
+    memset(m_ssh, 0, sizeof(m_ssh));
+    memset(m_ssl, 0, sizeof(m_ssl));
+    m_vba = m_sc = m_sz = m_ep = 0;
+
+    m_cycles = 0;
+    m_jumped = false;
+    m_waiting = false;
+    m_stopped = false;
+
+    m_dmaNextBlock = DSP_DMA_BLOCK_NEXT_EOL;
+    m_dmaStartBlock = 0;
+    m_dmaControl = DSP_DMA_CONTROL_STOPPED;
+    m_dmaConfiguration = 0;
+
+    for (int i = 0; i < DSP_FIFO_COUNT; i++) {
+        m_outputFifos[i].clear();
+        m_inputFifos[i].clear();
+    }
+}
+
+uint32_t DSP56300::ReadMemory(DSPSpace space, uint32_t addr) {
+    std::vector<uint32_t>& mem = (space == DSP_SpaceX) ? m_xram : (space == DSP_SpaceY) ? m_yram : m_pram;
+    return (addr < mem.size()) ? mem[addr] : 0;
+}
+
+void DSP56300::WriteMemory(DSPSpace space, uint32_t addr, uint32_t value) {
+    std::vector<uint32_t>& mem = (space == DSP_SpaceX) ? m_xram : (space == DSP_SpaceY) ? m_yram : m_pram;
+    if (addr >= mem.size()) {
+        return;
+    }
+    mem[addr] = value & DSP_WORD_MASK;
+
+    // The instruction at the address and the one before it, whose extension
+    // word may live there, have to be decoded again
+    if (space == DSP_SpaceP) {
+        m_cache[addr].exec = nullptr;
+        if (addr > 0) {
+            m_cache[addr - 1].exec = nullptr;
+        }
+    }
+}
+
+uint32_t DSP56300::RunFrame(uint32_t cycleBudget) {
+    m_cycles = 0;
+    m_waiting = false;
+    while (!m_stopped && !m_waiting && m_cycles < cycleBudget) {
+        if (m_pc >= m_pram.size()) {
+            log_warning("%s: Program counter out of range: 0x%06x\n", m_name, m_pc);
+            m_stopped = true;
+            break;
+        }
+        Execute(Fetch(m_pc));
+    }
+    return m_cycles;
+}
+
+// ----- Memory ---------------------------------------------------------------
+
+uint32_t DSP56300::Read(DSPSpace space, uint32_t addr) {
+    if (space == DSP_SpaceX && addr >= DSP_PERIPHERAL_BASE) {
+        return ReadPeripheral(addr);
+    }
+    return ReadMemory(space, addr);
+}
+
+void DSP56300::Write(DSPSpace space, uint32_t addr, uint32_t value) {
+    if (space == DSP_SpaceX && addr >= DSP_PERIPHERAL_BASE) {
+        WritePeripheral(addr, value & DSP_WORD_MASK);
+        return;
+    }
+    WriteMemory(space, addr, value);
+}
+
+uint32_t DSP56300::ReadPeripheral(uint32_t addr) {
+    switch (addr) {
+    case DSP_DMA_NEXT_BLOCK: return m_dmaNextBlock;
+    case DSP_DMA_START_BLOCK: return m_dmaStartBlock;
+    case DSP_DMA_CONTROL: return m_dmaControl;
+    case DSP_DMA_CONFIGURATION: return m_dmaConfiguration;
+    default:
+        log_spew("%s: Unhandled peripheral read 0x%06x\n", m_name, addr);
+        return 0;
+    }
+}
+
+void DSP56300::WritePeripheral(uint32_t addr, uint32_t value) {
+    switch (addr) {
+    case DSP_DMA_NEXT_BLOCK:
+        m_dmaNextBlock = value;
+        break;
+    case DSP_DMA_START_BLOCK:
+        m_dmaStartBlock = value;
+        break;
+    case DSP_DMA_CONTROL:
+        switch (value & DSP_DMA_CONTROL_ACTION) {
+        case DSP_DMA_CONTROL_ACTION_START:
+            if (!(m_dmaControl & DSP_DMA_CONTROL_FROZEN)) {
+                RunDMA();
+            }
+            break;
+        case DSP_DMA_CONTROL_ACTION_STOP:
+        case DSP_DMA_CONTROL_ACTION_ABORT:
+            m_dmaControl = (m_dmaControl & ~DSP_DMA_CONTROL_RUNNING) | DSP_DMA_CONTROL_STOPPED;
+            break;
+        case DSP_DMA_CONTROL_ACTION_FREEZE:
+            m_dmaControl |= DSP_DMA_CONTROL_FROZEN;
+            break;
+        case DSP_DMA_CONTROL_ACTION_UNFREEZE:
+            m_dmaControl &= ~DSP_DMA_CONTROL_FROZEN;
+            break;
+        }
+        break;
+    case DSP_DMA_CONFIGURATION:
+        m_dmaConfiguration = value;
+        break;
+    default:
+        log_spew("%s: Unhandled peripheral write 0x%06x = 0x%06x\n", m_name, addr, value);
+        break;
+    }
+}
+
+// ----- DMA ------------------------------------------------------------------
+
+void DSP56300::RunDMA() {
+    m_dmaControl = (m_dmaControl & ~DSP_DMA_CONTROL_STOPPED) | DSP_DMA_CONTROL_RUNNING;
+
+    // Bound the walk in case the program builds a circular list
+    uint32_t block = m_dmaNextBlock;
+    for (uint32_t i = 0; i < m_xram.size() && !(block & DSP_DMA_BLOCK_NEXT_EOL); i++) {
+        block = TransferBlock(block & DSP_DMA_BLOCK_NEXT_ADDRESS);
+    }
+    if (!(block & DSP_DMA_BLOCK_NEXT_EOL)) {
+        log_warning("%s: DMA block list does not end\n", m_name);
+    }
+
+    m_dmaNextBlock = block;
+    m_dmaControl = (m_dmaControl & ~DSP_DMA_CONTROL_RUNNING) | DSP_DMA_CONTROL_STOPPED;
+}
+
+uint32_t DSP56300::TransferBlock(uint32_t block) {
+    uint32_t next = ReadMemory(DSP_SpaceX, block + DSP_DMA_BLOCK_NEXT);
+    uint32_t control = ReadMemory(DSP_SpaceX, block + DSP_DMA_BLOCK_CONTROL);
+    uint32_t count = ReadMemory(DSP_SpaceX, block + DSP_DMA_BLOCK_COUNT);
+    uint32_t dspOffset = ReadMemory(DSP_SpaceX, block + DSP_DMA_BLOCK_DSP_OFFSET);
+    uint32_t scratchOffset = ReadMemory(DSP_SpaceX, block + DSP_DMA_BLOCK_SCRATCH_OFFSET);
+    uint32_t scratchBase = ReadMemory(DSP_SpaceX, block + DSP_DMA_BLOCK_SCRATCH_BASE);
+    uint32_t scratchSize = ReadMemory(DSP_SpaceX, block + DSP_DMA_BLOCK_SCRATCH_SIZE) + 1;
+
+    bool toMemory = (control & DSP_DMA_BLOCK_CONTROL_TO_MEMORY) != 0;
+    uint32_t buffer = (control & DSP_DMA_BLOCK_CONTROL_BUFFER) >> 5;
+    uint32_t format = (control & DSP_DMA_BLOCK_CONTROL_FORMAT) >> 10;
+
+    uint32_t itemSize;
+    switch (format) {
+    case DSP_DMA_FORMAT_16BIT: itemSize = 2; break;
+    case DSP_DMA_FORMAT_24BIT: itemSize = 4; break;
+    case DSP_DMA_FORMAT_32BIT: itemSize = 4; break;
+    default:
+        log_spew("%s: Unsupported DMA format %u\n", m_name, format);
+        itemSize = 4;
+        break;
+    }
+
+    if (buffer == DSP_DMA_BUFFER_SCRATCH) {
+        uint32_t position = scratchOffset % scratchSize;
+        for (uint32_t i = 0; i < count; i++) {
+            uint8_t *ptr;
+            if (!ScratchAddress(scratchBase + position, itemSize, &ptr)) {
+                log_warning("%s: DMA to unmapped scratch offset 0x%x\n", m_name, scratchBase + position);
+                break;
+            }
+
+            if (toMemory) {
+                uint32_t word = ReadMemory(DSP_SpaceX, dspOffset + i);
+                if (format == DSP_DMA_FORMAT_16BIT) {
+                    uint16_t sample = (uint16_t)(word >> 8);
+                    memcpy(ptr, &sample, sizeof(sample));
+                }
+                else {
+                    uint32_t sample = (format == DSP_DMA_FORMAT_32BIT) ? (word << 8) : word;
+                    memcpy(ptr, &sample, sizeof(sample));
+                }
+            }
+            else {
+                uint32_t word;
+                if (format == DSP_DMA_FORMAT_16BIT) {
+                    int16_t sample;
+                    memcpy(&sample, ptr, sizeof(sample));
+                    word = (uint32_t)(sample * 256);
+                }
+                else {
+                    memcpy(&word, ptr, sizeof(word));
+                    if (format == DSP_DMA_FORMAT_32BIT) {
+                        word >>= 8;
+                    }
+                }
+                WriteMemory(DSP_SpaceX, dspOffset + i, word);
+            }
+
+            position = (position + itemSize) % scratchSize;
+        }
+
+        if (control & DSP_DMA_BLOCK_CONTROL_WRITEBACK) {
+            WriteMemory(DSP_SpaceX, block + DSP_DMA_BLOCK_SCRATCH_OFFSET, position);
+        }
+    }
+    else if (buffer < DSP_FIFO_COUNT) {
+        if (toMemory) {
+            std::deque<uint32_t>& fifo = m_outputFifos[buffer];
+            for (uint32_t i = 0; i < count; i++) {
+                fifo.push_back(ReadMemory(DSP_SpaceX, dspOffset + i));
+            }
+            while (fifo.size() > DSP_FIFO_LIMIT) {
+                fifo.pop_front();
+            }
+        }
+        else {
+            // Underruns read silence
+            std::deque<uint32_t>& fifo = m_inputFifos[buffer];
+            for (uint32_t i = 0; i < count; i++) {
+                uint32_t word = 0;
+                if (!fifo.empty()) {
+                    word = fifo.front();
+                    fifo.pop_front();
+                }
+                WriteMemory(DSP_SpaceX, dspOffset + i, word);
+            }
+        }
+    }
+    else {
+        log_spew("%s: Unsupported DMA buffer %u\n", m_name, buffer);
+    }
+
+    // The controller moves one word per cycle
+    m_cycles += count;
+    return next;
+}
+
+bool DSP56300::ScratchAddress(uint32_t offset, uint32_t length, uint8_t **ptr) {
+    uint32_t page = offset / NV_PAPU_PAGE_SIZE;
+    uint32_t pageOffset = offset % NV_PAPU_PAGE_SIZE;
+    if (page > *m_sgeMax || pageOffset + length > NV_PAPU_PAGE_SIZE) {
+        return false;
+    }
+
+    uint32_t entry = *m_sgeAddr + page * 8;
+    if (entry + 4 > m_ramSize) {
+        return false;
+    }
+    uint32_t pageAddr;
+    memcpy(&pageAddr, &m_ram[entry], sizeof(pageAddr));
+
+    uint32_t addr = (pageAddr & ~(NV_PAPU_PAGE_SIZE - 1)) + pageOffset;
+    if (addr + length > m_ramSize) {
+        return false;
+    }
+    *ptr = &m_ram[addr];
+    return true;
+}
+
+// ----- Registers ------------------------------------------------------------
+
+uint32_t DSP56300::ReadAccumulator(int64_t acc) {
+    // Moves out of an accumulator saturate when the value doesn't fit in 48
+    // bits and set the limit flag
+    if (acc > 0x7FFFFFFFFFFFll) {
+        m_sr |= DSP_SR_L;
+        return 0x7FFFFF;
+    }
+    if (acc < -0x800000000000ll) {
+        m_sr |= DSP_SR_L;
+        return 0x800000;
+    }
+    return (uint32_t)(acc >> 24) & DSP_WORD_MASK;
+}
+
+uint32_t DSP56300::ReadRegister(uint32_t reg) {
+    switch (reg) {
+    case DSP_REG_X0: return m_x0;
+    case DSP_REG_X1: return m_x1;
+    case DSP_REG_Y0: return m_y0;
+    case DSP_REG_Y1: return m_y1;
+    case DSP_REG_A0: return (uint32_t)m_a & DSP_WORD_MASK;
+    case DSP_REG_B0: return (uint32_t)m_b & DSP_WORD_MASK;
+    case DSP_REG_A2: return (uint32_t)(m_a >> 48) & DSP_WORD_MASK;
+    case DSP_REG_B2: return (uint32_t)(m_b >> 48) & DSP_WORD_MASK;
+    case DSP_REG_A1: return (uint32_t)(m_a >> 24) & DSP_WORD_MASK;
+    case DSP_REG_B1: return (uint32_t)(m_b >> 24) & DSP_WORD_MASK;
+    case DSP_REG_A: return ReadAccumulator(m_a);
+    case DSP_REG_B: return ReadAccumulator(m_b);
+    case DSP_REG_EP: return m_ep;
+    case DSP_REG_VBA: return m_vba;
+    case DSP_REG_SC: return m_sc;
+    case DSP_REG_SZ: return m_sz;
+    case DSP_REG_SR: return m_sr;
+    case DSP_REG_OMR: return m_omr;
+    case DSP_REG_SP: return m_sp;
+    case DSP_REG_SSH:
+    {
+        // Reading SSH pops the stack
+        uint32_t high, low;
+        PopStack(&high, &low);
+        return high;
+    }
+    case DSP_REG_SSL: return m_ssl[m_sp & 0xF];
+    case DSP_REG_LA: return m_la;
+    case DSP_REG_LC: return m_lc;
+    }
+
+    if (reg >= DSP_REG_R0 && reg < DSP_REG_R0 + 8) {
+        return m_r[reg - DSP_REG_R0];
+    }
+    if (reg >= DSP_REG_N0 && reg < DSP_REG_N0 + 8) {
+        return m_n[reg - DSP_REG_N0];
+    }
+    if (reg >= DSP_REG_M0 && reg < DSP_REG_M0 + 8) {
+        return m_m[reg - DSP_REG_M0];
+    }
+
+    log_spew("%s: Read from invalid register 0x%x\n", m_name, reg);
+    return 0;
+}
+
+void DSP56300::WriteRegister(uint32_t reg, uint32_t value) {
+    value &= DSP_WORD_MASK;
+    switch (reg) {
+    case DSP_REG_X0: m_x0 = value; return;
+    case DSP_REG_X1: m_x1 = value; return;
+    case DSP_REG_Y0: m_y0 = value; return;
+    case DSP_REG_Y1: m_y1 = value; return;
+    case DSP_REG_A0: m_a = sext56(((uint64_t)m_a & ~0xFFFFFFull) | value); return;
+    case DSP_REG_B0: m_b = sext56(((uint64_t)m_b & ~0xFFFFFFull) | value); return;
+    case DSP_REG_A2: m_a = sext56(((uint64_t)m_a & 0xFFFFFFFFFFFFull) | ((uint64_t)(value & 0xFF) << 48)); return;
+    case DSP_REG_B2: m_b = sext56(((uint64_t)m_b & 0xFFFFFFFFFFFFull) | ((uint64_t)(value & 0xFF) << 48)); return;
+    case DSP_REG_A1: m_a = sext56(((uint64_t)m_a & ~(0xFFFFFFull << 24)) | ((uint64_t)value << 24)); return;
+    case DSP_REG_B1: m_b = sext56(((uint64_t)m_b & ~(0xFFFFFFull << 24)) | ((uint64_t)value << 24)); return;
+    case DSP_REG_A: m_a = toAccumulator(value); return;
+    case DSP_REG_B: m_b = toAccumulator(value); return;
+    case DSP_REG_EP: m_ep = value; return;
+    case DSP_REG_VBA: m_vba = value; return;
+    case DSP_REG_SC: m_sc = value; return;
+    case DSP_REG_SZ: m_sz = value; return;
+    case DSP_REG_SR: m_sr = value; return;
+    case DSP_REG_OMR: m_omr = value; return;
+    case DSP_REG_SP: m_sp = value & 0xF; return;
+    case DSP_REG_SSH:
+        // Writing SSH pushes the stack
+        PushStack(value, m_ssl[(m_sp + 1) & 0xF]);
+        return;
+    case DSP_REG_SSL: m_ssl[m_sp & 0xF] = value; return;
+    case DSP_REG_LA: m_la = value; return;
+    case DSP_REG_LC: m_lc = value; return;
+    }
+
+    if (reg >= DSP_REG_R0 && reg < DSP_REG_R0 + 8) {
+        m_r[reg - DSP_REG_R0] = value;
+    }
+    else if (reg >= DSP_REG_N0 && reg < DSP_REG_N0 + 8) {
+        m_n[reg - DSP_REG_N0] = value;
+    }
+    else if (reg >= DSP_REG_M0 && reg < DSP_REG_M0 + 8) {
+        m_m[reg - DSP_REG_M0] = value;
+    }
+    else {
+        log_spew("%s: Write to invalid register 0x%x\n", m_name, reg);
+    }
+}
+
+// L: registers are pairs of words moved to and from X and Y memory at once
+void DSP56300::ReadLong(uint32_t reg, uint32_t *x, uint32_t *y) {
+    switch (reg) {
+    case 0: *x = ReadRegister(DSP_REG_A1); *y = ReadRegister(DSP_REG_A0); break;
+    case 1: *x = ReadRegister(DSP_REG_B1); *y = ReadRegister(DSP_REG_B0); break;
+    case 2: *x = m_x1; *y = m_x0; break;
+    case 3: *x = m_y1; *y = m_y0; break;
+    case 4:
+    case 5:
+    {
+        int64_t acc = (reg == 4) ? m_a : m_b;
+        *x = ReadAccumulator(acc);
+        if (*x != ((uint32_t)(acc >> 24) & DSP_WORD_MASK)) {
+            *y = (*x == 0x7FFFFF) ? DSP_WORD_MASK : 0;
+        }
+        else {
+            *y = (uint32_t)acc & DSP_WORD_MASK;
+        }
+        break;
+    }
+    case 6: *x = ReadAccumulator(m_a); *y = ReadAccumulator(m_b); break;
+    case 7: *x = ReadAccumulator(m_b); *y = ReadAccumulator(m_a); break;
+    }
+}
+
+void DSP56300::WriteLong(uint32_t reg, uint32_t x, uint32_t y) {
+    switch (reg) {
+    case 0: WriteRegister(DSP_REG_A1, x); WriteRegister(DSP_REG_A0, y); break;
+    case 1: WriteRegister(DSP_REG_B1, x); WriteRegister(DSP_REG_B0, y); break;
+    case 2: m_x1 = x; m_x0 = y; break;
+    case 3: m_y1 = x; m_y0 = y; break;
+    case 4: m_a = toAccumulator(x) + y; break;
+    case 5: m_b = toAccumulator(x) + y; break;
+    case 6: m_a = toAccumulator(x); m_b = toAccumulator(y); break;
+    case 7: m_b = toAccumulator(x); m_a = toAccumulator(y); break;
+    }
+}
+
+void DSP56300::PushStack(uint32_t high, uint32_t low) {
+    if (m_sp >= 15) {
+        log_warning("%s: Stack overflow at 0x%06x\n", m_name, m_pc);
+    }
+    m_sp = (m_sp + 1) & 0xF;
+    m_ssh[m_sp] = high;
+    m_ssl[m_sp] = low;
+}
+
+void DSP56300::PopStack(uint32_t *high, uint32_t *low) {
+    if (m_sp == 0) {
+        log_warning("%s: Stack underflow at 0x%06x\n", m_name, m_pc);
+    }
+    *high = m_ssh[m_sp];
+    *low = m_ssl[m_sp];
+    m_sp = (m_sp - 1) & 0xF;
+}
+
+// ----- Address generation ---------------------------------------------------
+
+uint32_t DSP56300::UpdateAddress(uint32_t reg, int32_t offset) {
+    uint32_t r = m_r[reg];
+    uint32_t m = m_m[reg] & DSP_WORD_MASK;
+
+    if (m == 0) {
+        // Reverse-carry addition, used by FFTs
+        uint32_t sum = bitReverse(r, 24) + bitReverse((uint32_t)offset & DSP_WORD_MASK, 24);
+        return bitReverse(sum, 24);
+    }
+
+    if (m <= 0x7FFF) {
+        // Modulo addressing within a buffer of M+1 words aligned to the next
+        // power of two
+        uint32_t size = m + 1;
+        uint32_t align = 1;
+        while (align < size) {
+            align <<= 1;
+        }
+        uint32_t base = r & ~(align - 1);
+        int64_t pos = ((int64_t)(r - base) + offset) % size;
+        if (pos < 0) {
+            pos += size;
+        }
+        return (base + (uint32_t)pos) & DSP_WORD_MASK;
+    }
+
+    return (r + offset) & DSP_WORD_MASK;
+}
+
+uint32_t DSP56300::EffectiveAddress(uint32_t mode, uint32_t ext) {
+    if (mode & DSP_EA_SHORT) {
+        return mode & 0x3F;
+    }
+
+    uint32_t reg = mode & 7;
+    uint32_t addr = m_r[reg];
+    int32_t n = (int32_t)sext24(m_n[reg]);
+    switch ((mode >> 3) & 7) {
+    case 0: m_r[reg] = UpdateAddress(reg, -n); break;   // (Rn)-Nn
+    case 1: m_r[reg] = UpdateAddress(reg, n); break;    // (Rn)+Nn
+    case 2: m_r[reg] = UpdateAddress(reg, -1); break;   // (Rn)-
+    case 3: m_r[reg] = UpdateAddress(reg, 1); break;    // (Rn)+
+    case 4: break;                                      // (Rn)
+    case 5: addr = UpdateAddress(reg, n); break;        // (Rn+Nn)
+    case 6: addr = ext & DSP_WORD_MASK; break;          // absolute address or immediate
+    case 7:                                             // -(Rn)
+        m_r[reg] = UpdateAddress(reg, -1);
+        addr = m_r[reg];
+        break;
+    }
+    return addr;
+}
+
+// ----- Condition codes ------------------------------------------------------
+
+bool DSP56300::Condition(uint32_t cc) const {
+    bool c = (m_sr & DSP_SR_C) != 0;
+    bool v = (m_sr & DSP_SR_V) != 0;
+    bool z = (m_sr & DSP_SR_Z) != 0;
+    bool n = (m_sr & DSP_SR_N) != 0;
+    bool u = (m_sr & DSP_SR_U) != 0;
+    bool e = (m_sr & DSP_SR_E) != 0;
+    bool l = (m_sr & DSP_SR_L) != 0;
+
+    // Codes 8 to 15 are the negations of codes 0 to 7
+    bool result;
+    switch (cc & 7) {
+    case 0: result = !c; break;                 // CC
+    case 1: result = n == v; break;             // GE
+    case 2: result = !z; break;                 // NE
+    case 3: result = !n; break;                 // PL
+    case 4: result = !(z || (!u && !e)); break; // NN
+    case 5: result = !e; break;                 // EC
+    case 6: result = !l; break;                 // LC
+    default: result = !(z || n != v); break;    // GT
+    }
+    return (cc & 8) ? !result : result;
+}
+
+void DSP56300::SetCarry(bool carry) {
+    m_sr = carry ? (m_sr | DSP_SR_C) : (m_sr & ~DSP_SR_C);
+}
+
+void DSP56300::SetFlags(int64_t result, bool overflow) {
+    m_sr &= ~(DSP_SR_V | DSP_SR_Z | DSP_SR_N | DSP_SR_U | DSP_SR_E);
+    if (overflow) {
+        m_sr |= DSP_SR_V | DSP_SR_L;
+    }
+    if (result == 0) {
+        m_sr |= DSP_SR_Z;
+    }
+    if (result < 0) {
+        m_sr |= DSP_SR_N;
+    }
+
+    // Extension in use if bits 55 to 47 are not all the same
+    int64_t extension = result >> 47;
+    if (extension != 0 && extension != -1) {
+        m_sr |= DSP_SR_E;
+    }
+
+    // Unnormalized if bits 47 and 46 are equal
+    if (((result >> 47) & 1) == ((result >> 46) & 1)) {
+        m_sr |= DSP_SR_U;
+    }
+}
+
+void DSP56300::SetLogicFlags(uint32_t result) {
+    m_sr &= ~(DSP_SR_V | DSP_SR_Z | DSP_SR_N);
+    if (result == 0) {
+        m_sr |= DSP_SR_Z;
+    }
+    if (result & 0x800000) {
+        m_sr |= DSP_SR_N;
+    }
+}
+
+// ----- Decoding -------------------------------------------------------------
+
+const DSPInstruction& DSP56300::Fetch(uint32_t addr) {
+    DSPInstruction& insn = m_cache[addr];
+    if (insn.exec == nullptr) {
+        Decode(addr, insn);
+    }
+    return insn;
+}
+
+bool DSP56300::DecodeParallelMove(uint32_t op, DSPParallelMove& move) {
+    static const uint8_t xRegs[] = { DSP_REG_X0, DSP_REG_X1, DSP_REG_A, DSP_REG_B };
+    static const uint8_t yRegs[] = { DSP_REG_Y0, DSP_REG_Y1, DSP_REG_A, DSP_REG_B };
+
+    move = DSPParallelMove();
+
+    // X:ea,D1 Y:ea,D2 -- 1wmm eeff WrrM MRRR
+    if (op & 0x800000) {
+        uint32_t xreg = (op >> 8) & 7;
+        uint32_t xmode = (op >> 11) & 3;
+        uint32_t yreg = ((op >> 13) & 3) | ((xreg < 4) ? 4 : 0);
+        uint32_t ymode = (op >> 20) & 3;
+
+        // Only (Rn)+Nn, (Rn)-, (Rn)+ and (Rn) are available
+        move.type = DSPParallelMove::Dual;
+        move.ea = ((xmode == 0) ? 0x20 : (xmode << 3)) | xreg;
+        move.reg = xRegs[(op >> 18) & 3];
+        move.read = (op & 0x8000) != 0;
+        move.ea2 = ((ymode == 0) ? 0x20 : (ymode << 3)) | yreg;
+        move.reg2 = yRegs[(op >> 16) & 3];
+        move.read2 = (op & 0x400000) != 0;
+        return true;
+    }
+
+    // X:ea/Y:ea/L:ea <-> D -- 01dd Sddd W1MM MRRR, or W0aa aaaa
+    if ((op & 0xC00000) == 0x400000) {
+        move.type = DSPParallelMove::Memory;
+        move.read = (op & 0x8000) != 0;
+        move.ea = (op & 0x4000) ? ((op >> 8) & 0x3F) : (DSP_EA_SHORT | ((op >> 8) & 0x3F));
+        if ((op & 0x340000) == 0) {
+            move.space = DSP_SPACE_L;
+            move.reg = ((op >> 17) & 4) | ((op >> 16) & 3);
+        }
+        else {
+            move.space = (op & 0x80000) ? DSP_SpaceY : DSP_SpaceX;
+            move.reg = ((op >> 17) & 0x18) | ((op >> 16) & 7);
+        }
+        return true;
+    }
+
+    if ((op & 0xE00000) == 0x200000) {
+        if ((op & 0xFFE000) == 0x204000) {
+            // ea -- 0010 0000 010M MRRR
+            move.type = DSPParallelMove::Update;
+            move.ea = (op >> 8) & 0x1F;
+        }
+        else if ((op & 0xFC0000) == 0x200000) {
+            // S,D -- 0010 00ee eeed dddd
+            move.type = ((op & 0xFFFF00) == 0x200000) ? DSPParallelMove::None : DSPParallelMove::Register;
+            move.src2 = (op >> 13) & 0x1F;
+            move.dst2 = (op >> 8) & 0x1F;
+        }
+        else {
+            // #xx,D -- 001d dddd iiii iiii
+            move.type = DSPParallelMove::Immediate;
+            move.reg = (op >> 16) & 0x1F;
+            move.immediate = (op >> 8) & 0xFF;
+        }
+        return true;
+    }
+
+    if ((op & 0xF00000) == 0x100000) {
+        move.type = DSPParallelMove::MemoryRegister;
+        move.read = (op & 0x8000) != 0;
+        move.ea = (op >> 8) & 0x3F;
+        if (op & 0x4000) {
+            // S1,D1 Y:ea <-> D2 -- 0001 deff W1MM MRRR
+            move.space = DSP_SpaceY;
+            move.reg = yRegs[(op >> 16) & 3];
+            move.src2 = (op & 0x80000) ? DSP_REG_B : DSP_REG_A;
+            move.dst2 = (op & 0x40000) ? DSP_REG_X1 : DSP_REG_X0;
+        }
+        else {
+            // X:ea <-> D1 S2,D2 -- 0001 ffdF W0MM MRRR
+            move.space = DSP_SpaceX;
+            move.reg = xRegs[(op >> 18) & 3];
+            move.src2 = (op & 0x20000) ? DSP_REG_B : DSP_REG_A;
+            move.dst2 = (op & 0x10000) ? DSP_REG_Y1 : DSP_REG_Y0;
+        }
+        return true;
+    }
+
+    // A,X:ea X0,A or A,Y:ea Y0,A -- 0000 100d x0MM MRRR
+    if ((op & 0xFE4000) == 0x080000) {
+        uint32_t acc = (op & 0x10000) ? DSP_REG_B : DSP_REG_A;
+        move.type = DSPParallelMove::MemoryRegister;
+        move.read = false;
+        move.ea = (op >> 8) & 0x3F;
+        move.space = (op & 0x8000) ? DSP_SpaceY : DSP_SpaceX;
+        move.reg = acc;
+        move.src2 = (op & 0x8000) ? DSP_REG_Y0 : DSP_REG_X0;
+        move.dst2 = acc;
+        return true;
+    }
+
+    return false;
+}
+
+void DSP56300::Decode(uint32_t addr, DSPInstruction& insn) {
+    uint32_t op = m_pram[addr];
+    insn = DSPInstruction();
+    insn.opcode = op;
+    insn.ext = (addr + 1 < m_pram.size()) ? m_pram[addr + 1] : 0;
+    insn.words = 1;
+    insn.cycles = 1;
+
+    if (DecodeParallelMove(op, insn.move)) {
+        insn.exec = &DSP56300::ExecParallel;
+        insn.alu = op & 0xFF;
+        if ((insn.move.type == DSPParallelMove::Memory || insn.move.type == DSPParallelMove::MemoryRegister)
+            && !(insn.move.ea & DSP_EA_SHORT) && HasExtensionWord(insn.move.ea)) {
+            insn.words = 2;
+            insn.cycles = 2;
+        }
+        return;
+    }
+
+    DSPHandler exec = nullptr;
+    bool ext = false;
+    uint8_t cycles = 2;
+    uint32_t ea = (op >> 8) & 0x3F;
+    switch ((op >> 16) & 0xFF) {
+    case 0x00:
+        switch (op) {
+        case 0x000000: exec = &DSP56300::ExecNop; cycles = 1; break;
+        case 0x000004: exec = &DSP56300::ExecRti; cycles = 3; break;
+        case 0x00000C: exec = &DSP56300::ExecRts; cycles = 3; break;
+        case 0x000084: exec = &DSP56300::ExecNop; break;  // RESET
+        case 0x000086: exec = &DSP56300::ExecWait; break;
+        case 0x000087: exec = &DSP56300::ExecStop; break;
+        case 0x00008C: exec = &DSP56300::ExecEnddo; break;
+        default:
+            // ANDI/ORI -- 0000 0000 iiii iiii 1x11 10EE
+            if ((op & 0xFF00BC) == 0x0000B8) {
+                exec = &DSP56300::ExecLogicImmediate;
+            }
+            break;
+        }
+        break;
+    case 0x01:
+        // ALU op #xx,D -- 0000 0001 01ii iiii 1000 dkkk, or #xxxxxx,D with 1100 dkkk
+        if ((op & 0xFFC0F0) == 0x014080) {
+            exec = &DSP56300::ExecAluImmediate;
+            cycles = 1;
+        }
+        else if ((op & 0xFFFFF0) == 0x0140C0) {
+            exec = &DSP56300::ExecAluImmediate;
+            ext = true;
+        }
+        break;
+    case 0x04:
+        if ((op & 0xFF40E0) == 0x0440A0) {
+            exec = &DSP56300::ExecMovec;
+            cycles = 1;
+        }
+        else if ((op & 0xFFE0F0) == 0x044010) {
+            exec = &DSP56300::ExecLua;
+            cycles = 3;
+        }
+        break;
+    case 0x05:
+        if ((op & 0x20) == 0) {
+            // Bcc/BSR/BRA with a 9-bit displacement -- 0000 0101 CCCC xxaa aa0a aaaa
+            if (op & 0xC00) {
+                exec = &DSP56300::ExecBranch;
+                cycles = 4;
+            }
+        }
+        else {
+            exec = &DSP56300::ExecMovec;
+            ext = !(op & 0x80) && (op & 0x4000) && HasExtensionWord(ea);
+        }
+        break;
+    case 0x06:
+        // DO and REP; the immediate forms have bit 7 set and the others have
+        // no bits in the low five
+        if ((op & 0x80) || (op & 0x1F) == 0) {
+            if (op & 0x20) {
+                exec = &DSP56300::ExecRep;
+                cycles = 5;
+            }
+            else {
+                exec = &DSP56300::ExecDo;
+                ext = true;
+                cycles = 5;
+            }
+        }
+        break;
+    case 0x08:
+    case 0x09:
+        exec = &DSP56300::ExecMovep;
+        ext = (op & 0x80) && HasExtensionWord(ea);
+        break;
+    case 0x0A:
+    case 0x0B:
+        if ((op & 0xF880) == 0x7080) {
+            // MOVE X:(Rn+xxxx) -- 0000 101x 0111 0RRR 1WDD DDDD
+            exec = &DSP56300::ExecMoveDisplacement;
+            ext = true;
+        }
+        else if ((op & 0xC000) == 0xC000) {
+            switch ((op >> 5) & 7) {
+            case 0:
+            case 1:
+                exec = &DSP56300::ExecBitJump;
+                ext = true;
+                cycles = 4;
+                break;
+            case 2:
+            case 3:
+                exec = &DSP56300::ExecBitOp;
+                break;
+            case 4:
+                if ((op & 0x1F) == 0) {
+                    exec = &DSP56300::ExecJump;
+                    ext = HasExtensionWord(ea);
+                    cycles = 3;
+                }
+                break;
+            case 5:
+                if ((op & 0x10) == 0) {
+                    exec = &DSP56300::ExecJump;
+                    ext = HasExtensionWord(ea);
+                    cycles = 4;
+                }
+                break;
+            }
+        }
+        else if (op & 0x80) {
+            exec = &DSP56300::ExecBitJump;
+            ext = true;
+            cycles = 4;
+        }
+        else {
+            exec = &DSP56300::ExecBitOp;
+            ext = ((op >> 14) & 3) == 1 && HasExtensionWord(ea);
+        }
+        break;
+    case 0x0C:
+    case 0x0D:
+        if ((op & 0xF000) == 0) {
+            exec = &DSP56300::ExecJump;
+            cycles = 3;
+        }
+        else if ((op & 0xFFFFF0) == 0x0D1040 || (op & 0xFFFFFF) == 0x0D10C0 || (op & 0xFFFFFF) == 0x0D1080) {
+            exec = &DSP56300::ExecBranch;
+            ext = true;
+            cycles = 4;
+        }
+        break;
+    case 0x0E:
+    case 0x0F:
+        exec = &DSP56300::ExecJump;
+        cycles = 4;
+        break;
+    }
+
+    if (exec == nullptr) {
+        log_warning("%s: Unimplemented instruction 0x%06x at 0x%04x\n", m_name, op, addr);
+        exec = &DSP56300::ExecUndefined;
+    }
+    insn.exec = exec;
+    insn.words = ext ? 2 : 1;
+    insn.cycles = cycles + (ext ? 1 : 0);
+}
+
+// ----- Execution ------------------------------------------------------------
+
+void DSP56300::Execute(const DSPInstruction& insn) {
+    m_pc = (m_pc + insn.words) & DSP_WORD_MASK;
+    m_jumped = false;
+    (this->*insn.exec)(insn);
+    m_cycles += insn.cycles;
+
+    // Hardware loops go back to the start when the last instruction of the
+    // body completes; a finished loop may uncover an outer loop that ends at
+    // the same address
+    while ((m_sr & DSP_SR_LF) && !m_jumped && m_pc == ((m_la + 1) & DSP_WORD_MASK)) {
+        if (m_lc > 1) {
+            m_lc--;
+            m_pc = m_ssh[m_sp];
+            break;
+        }
+        EndLoop();
+    }
+}
+
+void DSP56300::EndLoop() {
+    uint32_t pc, sr;
+    PopStack(&pc, &sr);
+    m_sr = (m_sr & ~DSP_SR_LF) | (sr & DSP_SR_LF);
+    PopStack(&m_la, &m_lc);
+}
+
+void DSP56300::ExecParallel(const DSPInstruction& insn) {
+    const DSPParallelMove& move = insn.move;
+    uint32_t value = 0, valueY = 0, value2 = 0;
+    uint32_t addr = 0, addrY = 0;
+
+    // Sources are read before the data ALU operation and destinations are
+    // written after it
+    switch (move.type) {
+    case DSPParallelMove::None:
+    case DSPParallelMove::Immediate:
+        break;
+    case DSPParallelMove::Register:
+        value2 = ReadRegister(move.src2);
+        break;
+    case DSPParallelMove::Update:
+        EffectiveAddress(move.ea, 0);
+        break;
+    case DSPParallelMove::Memory:
+    case DSPParallelMove::MemoryRegister:
+        addr = EffectiveAddress(move.ea, insn.ext);
+        if (move.read) {
+            if (IsImmediate(move.ea)) {
+                value = insn.ext & DSP_WORD_MASK;
+            }
+            else if (move.space == DSP_SPACE_L) {
+                value = Read(DSP_SpaceX, addr);
+                valueY = Read(DSP_SpaceY, addr);
+            }
+            else {
+                value = Read((DSPSpace)move.space, addr);
+            }
+        }
+        else if (move.space == DSP_SPACE_L) {
+            ReadLong(move.reg, &value, &valueY);
+        }
+        else {
+            value = ReadRegister(move.reg);
+        }
+        if (move.type == DSPParallelMove::MemoryRegister) {
+            value2 = ReadRegister(move.src2);
+        }
+        break;
+    case DSPParallelMove::Dual:
+        addr = EffectiveAddress(move.ea, 0);
+        addrY = EffectiveAddress(move.ea2, 0);
+        value = move.read ? Read(DSP_SpaceX, addr) : ReadRegister(move.reg);
+        valueY = move.read2 ? Read(DSP_SpaceY, addrY) : ReadRegister(move.reg2);
+        break;
+    }
+
+    Alu(insn.alu);
+
+    switch (move.type) {
+    case DSPParallelMove::None:
+    case DSPParallelMove::Update:
+        break;
+    case DSPParallelMove::Immediate:
+        // Data ALU registers take the immediate as a fraction, the others as
+        // an integer
+        if ((move.reg >= DSP_REG_X0 && move.reg <= DSP_REG_Y1) || move.reg == DSP_REG_A || move.reg == DSP_REG_B) {
+            WriteRegister(move.reg, move.immediate << 16);
+        }
+        else {
+            WriteRegister(move.reg, move.immediate);
+        }
+        break;
+    case DSPParallelMove::Register:
+        WriteRegister(move.dst2, value2);
+        break;
+    case DSPParallelMove::Memory:
+    case DSPParallelMove::MemoryRegister:
+        if (move.read) {
+            if (move.space == DSP_SPACE_L) {
+                WriteLong(move.reg, value, valueY);
+            }
+            else {
+                WriteRegister(move.reg, value);
+            }
+        }
+        else if (move.space == DSP_SPACE_L) {
+            Write(DSP_SpaceX, addr, value);
+            Write(DSP_SpaceY, addr, valueY);
+        }
+        else {
+            Write((DSPSpace)move.space, addr, value);
+        }
+        if (move.type == DSPParallelMove::MemoryRegister) {
+            WriteRegister(move.dst2, value2);
+        }
+        break;
+    case DSPParallelMove::Dual:
+        if (move.read) {
+            WriteRegister(move.reg, value);
+        }
+        else {
+            Write(DSP_SpaceX, addr, value);
+        }
+        if (move.read2) {
+            WriteRegister(move.reg2, valueY);
+        }
+        else {
+            Write(DSP_SpaceY, addrY, valueY);
+        }
+        break;
+    }
+}
+
+int64_t DSP56300::Add(int64_t d, int64_t s, bool carryIn) {
+    int64_t sum = d + s + (carryIn ? 1 : 0);
+    int64_t result = sext56((uint64_t)sum);
+    uint64_t carry = ((uint64_t)d & DSP_ACC_MASK) + ((uint64_t)s & DSP_ACC_MASK) + (carryIn ? 1 : 0);
+    SetCarry(((carry >> 56) & 1) != 0);
+    SetFlags(result, sum != result);
+    return result;
+}
+
+int64_t DSP56300::Sub(int64_t d, int64_t s, bool borrowIn) {
+    int64_t diff = d - s - (borrowIn ? 1 : 0);
+    int64_t result = sext56((uint64_t)diff);
+    SetCarry(((uint64_t)d & DSP_ACC_MASK) < ((uint64_t)s & DSP_ACC_MASK) + (borrowIn ? 1 : 0));
+    SetFlags(result, diff != result);
+    return result;
+}
+
+// Convergent rounding to the most significant portion
+int64_t DSP56300::Round(int64_t value) {
+    int64_t result = value + 0x800000;
+    if ((value & 0xFFFFFF) == 0x800000) {
+        result &= ~0x1000000ll;
+    }
+    return sext56((uint64_t)(result & ~0xFFFFFFll));
+}
+
+void DSP56300::Alu(uint8_t op) {
+    int64_t& d = (op & 0x08) ? m_b : m_a;
+
+    if (op & 0x80) {
+        // MPY/MPYR/MAC/MACR -- 1QQQ dkkk
+        static const uint8_t operands[8][2] = {
+            { DSP_REG_X0, DSP_REG_X0 }, { DSP_REG_Y0, DSP_REG_Y0 }, { DSP_REG_X1, DSP_REG_X0 }, { DSP_REG_Y1, DSP_REG_Y0 },
+            { DSP_REG_X0, DSP_REG_Y1 }, { DSP_REG_Y0, DSP_REG_X0 }, { DSP_REG_X1, DSP_REG_Y0 }, { DSP_REG_Y1, DSP_REG_X1 },
+        };
+        const uint8_t *qq = operands[(op >> 4) & 7];
+        int64_t product = sext24(ReadRegister(qq[0])) * sext24(ReadRegister(qq[1])) * 2;
+        if (op & 0x04) {
+            product = -product;
+        }
+
+        // The carry is not affected
+        bool carry = (m_sr & DSP_SR_C) != 0;
+        int64_t result = product;
+        bool overflow = false;
+        if (op & 0x02) {
+            result = Add(d, product, false);
+            overflow = (m_sr & DSP_SR_V) != 0;
+        }
+        if (op & 0x01) {
+            result = Round(result);
+        }
+        d = result;
+        SetFlags(result, overflow);
+        SetCarry(carry);
+        return;
+    }
+
+    int64_t& other = (op & 0x08) ? m_a : m_b;
+    uint32_t kkk = op & 7;
+    switch ((op >> 4) & 7) {
+    case 0:
+        switch (kkk) {
+        case 0: break;  // MOVE
+        case 1: d = other; break;  // TFR
+        case 2: d = Add(d >> 1, other, false); break;  // ADDR
+        case 3: SetFlags(d, false); SetCarry(false); break;  // TST
+        case 5: Sub(d, other, false); break;  // CMP
+        case 6: d = Sub(d >> 1, other, false); break;  // SUBR
+        case 7: Sub(std::llabs(d), std::llabs(other), false); break;  // CMPM
+        default: log_spew("%s: Undefined data ALU operation 0x%02x\n", m_name, op); break;
+        }
+        break;
+    case 1:
+        switch (kkk) {
+        case 0: d = Add(d, other, false); break;  // ADD
+        case 1: d = Round(d); SetFlags(d, false); break;  // RND
+        case 2: d = Add(sext56((uint64_t)d << 1), other, false); break;  // ADDL
+        case 3:  // CLR
+            d = 0;
+            SetFlags(0, false);
+            break;
+        case 4: d = Sub(d, other, false); break;  // SUB
+        case 6: d = Sub(sext56((uint64_t)d << 1), other, false); break;  // SUBL
+        case 7:  // NOT
+        {
+            uint32_t a1 = ~(uint32_t)(d >> 24) & DSP_WORD_MASK;
+            d = sext56(((uint64_t)d & ~(0xFFFFFFull << 24)) | ((uint64_t)a1 << 24));
+            SetLogicFlags(a1);
+            break;
+        }
+        default: log_spew("%s: Undefined data ALU operation 0x%02x\n", m_name, op); break;
+        }
+        break;
+    case 2:
+    case 3:
+    {
+        // X1:X0 or Y1:Y0 as a 48-bit source
+        bool y = (op & 0x10) != 0;
+        int64_t s = y ? toAccumulator(m_y1) + m_y0 : toAccumulator(m_x1) + m_x0;
+        uint32_t a1 = (uint32_t)(d >> 24) & DSP_WORD_MASK;
+        switch (kkk) {
+        case 0: d = Add(d, s, false); break;  // ADD
+        case 1: d = Add(d, s, (m_sr & DSP_SR_C) != 0); break;  // ADC
+        case 2:
+            if (y) {  // ASL
+                int64_t result = sext56((uint64_t)d << 1);
+                SetCarry((d >> 55) & 1);
+                SetFlags(result, (result ^ d) < 0);
+                d = result;
+            }
+            else {  // ASR
+                SetCarry(d & 1);
+                d >>= 1;
+                SetFlags(d, false);
+            }
+            break;
+        case 3:
+        case 7:
+        {
+            // LSL/LSR and ROL/ROR shift A1 only
+            bool carry = (m_sr & DSP_SR_C) != 0;
+            uint32_t result;
+            if (y) {
+                SetCarry((a1 >> 23) & 1);
+                result = ((a1 << 1) | ((kkk == 7 && carry) ? 1 : 0)) & DSP_WORD_MASK;
+            }
+            else {
+                SetCarry(a1 & 1);
+                result = (a1 >> 1) | ((kkk == 7 && carry) ? 0x800000 : 0);
+            }
+            d = sext56(((uint64_t)d & ~(0xFFFFFFull << 24)) | ((uint64_t)result << 24));
+            SetLogicFlags(result);
+            break;
+        }
+        case 4: d = Sub(d, s, false); break;  // SUB
+        case 5: d = Sub(d, s, (m_sr & DSP_SR_C) != 0); break;  // SBC
+        case 6:
+            if (y) {  // NEG
+                bool carry = (m_sr & DSP_SR_C) != 0;
+                d = Sub(0, d, false);
+                SetCarry(carry);
+            }
+            else if (d < 0) {  // ABS
+                bool carry = (m_sr & DSP_SR_C) != 0;
+                d = Sub(0, d, false);
+                SetCarry(carry);
+            }
+            else {
+                SetFlags(d, false);
+            }
+            break;
+        }
+        break;
+    }
+    default:
+    {
+        // X0, Y0, X1 or Y1 as the source
+        static const uint8_t sources[] = { DSP_REG_X0, DSP_REG_Y0, DSP_REG_X1, DSP_REG_Y1 };
+        uint32_t s24 = ReadRegister(sources[((op >> 4) & 7) - 4]);
+        AluBinary(kkk, d, toAccumulator(s24), s24);
+        break;
+    }
+    }
+}
+
+// ADD, TFR, OR, EOR, SUB, CMP, AND and CMPM with a 24-bit source
+void DSP56300::AluBinary(uint32_t op, int64_t& d, int64_t s, uint32_t s24) {
+    uint32_t a1 = (uint32_t)(d >> 24) & DSP_WORD_MASK;
+    uint32_t result;
+    switch (op & 7) {
+    case 0: d = Add(d, s, false); return;
+    case 1: d = s; return;
+    case 2: result = a1 | s24; break;
+    case 3: result = a1 ^ s24; break;
+    case 4: d = Sub(d, s, false); return;
+    case 5: Sub(d, s, false); return;
+    case 6: result = a1 & s24; break;
+    default: Sub(std::llabs(d), std::llabs(s), false); return;
+    }
+
+    // Logical operations only affect A1
+    d = sext56(((uint64_t)d & ~(0xFFFFFFull << 24)) | ((uint64_t)result << 24));
+    SetLogicFlags(result);
+}
+
+void DSP56300::ExecUndefined(const DSPInstruction& insn) {
+}
+
+void DSP56300::ExecNop(const DSPInstruction& insn) {
+}
+
+void DSP56300::ExecWait(const DSPInstruction& insn) {
+    // Programs wait for the next frame
+    m_waiting = true;
+}
+
+void DSP56300::ExecStop(const DSPInstruction& insn) {
+    log_debug("%s: Stopped at 0x%04x\n", m_name, m_pc - insn.words);
+    m_stopped = true;
+}
+
+void DSP56300::ExecRts(const DSPInstruction& insn) {
+    uint32_t sr;
+    PopStack(&m_pc, &sr);
+    m_jumped = true;
+}
+
+void DSP56300::ExecRti(const DSPInstruction& insn) {
+    PopStack(&m_pc, &m_sr);
+    m_jumped = true;
+}
+
+void DSP56300::ExecEnddo(const DSPInstruction& insn) {
+    EndLoop();
+}
+
+// ANDI/ORI #xx,EE -- 0000 0000 iiii iiii 1x11 10EE
+void DSP56300::ExecLogicImmediate(const DSPInstruction& insn) {
+    uint32_t imm = (insn.opcode >> 8) & 0xFF;
+    bool isOr = (insn.opcode & 0x40) != 0;
+
+    // MR and EOM are the high bytes of SR and OMR, CCR and COM the low bytes
+    uint32_t ee = insn.opcode & 3;
+    uint32_t& reg = (ee & 2) ? m_omr : m_sr;
+    uint32_t shift = (ee == 0 || ee == 3) ? 8 : 0;
+
+    if (isOr) {
+        reg |= imm << shift;
+    }
+    else {
+        reg &= ~((~imm & 0xFF) << shift);
+    }
+}
+
+void DSP56300::ExecAluImmediate(const DSPInstruction& insn) {
+    int64_t& d = (insn.opcode & 0x08) ? m_b : m_a;
+
+    // Short immediates are right-aligned in A1
+    uint32_t imm;
+    int64_t s;
+    if (insn.words == 2) {
+        imm = insn.ext & DSP_WORD_MASK;
+        s = toAccumulator(imm);
+    }
+    else {
+        imm = (insn.opcode >> 8) & 0x3F;
+        s = (int64_t)imm << 24;
+    }
+
+    switch (insn.opcode & 7) {
+    case 0: case 2: case 3: case 4: case 5: case 6:
+        AluBinary(insn.opcode & 7, d, s, imm);
+        break;
+    default:
+        log_spew("%s: Undefined immediate ALU operation 0x%06x\n", m_name, insn.opcode);
+        break;
+    }
+}
+
+// JMP/JSR/Jcc/JScc, with a 12-bit address or an effective address
+void DSP56300::ExecJump(const DSPInstruction& insn) {
+    uint32_t op = insn.opcode;
+    uint32_t group = (op >> 16) & 0xFF;
+    bool subroutine;
+    bool taken;
+    uint32_t target;
+    if (group >= 0x0C) {
+        subroutine = (group & 1) != 0;
+        taken = (group < 0x0E) || Condition((op >> 12) & 0xF);
+        target = op & 0xFFF;
+    }
+    else {
+        subroutine = group == 0x0B;
+        taken = ((op & 0xE0) == 0x80) || Condition(op & 0xF);
+        target = EffectiveAddress((op >> 8) & 0x3F, insn.ext);
+    }
+
+    if (taken) {
+        if (subroutine) {
+            PushStack(m_pc, m_sr);
+        }
+        m_pc = target;
+        m_jumped = true;
+    }
+}
+
+// Bcc/BRA/BSR, relative to the address of the instruction
+void DSP56300::ExecBranch(const DSPInstruction& insn) {
+    uint32_t op = insn.opcode;
+    int32_t disp;
+    bool subroutine = false;
+    bool taken = true;
+    if (((op >> 16) & 0xFF) == 0x05) {
+        disp = (int32_t)(((op >> 1) & 0x1E0) | (op & 0x1F));
+        disp = (disp ^ 0x100) - 0x100;
+        switch ((op >> 10) & 3) {
+        case 1: taken = Condition((op >> 12) & 0xF); break;
+        case 2: subroutine = true; break;
+        }
+    }
+    else {
+        disp = (int32_t)sext24(insn.ext);
+        switch (op & 0xF0) {
+        case 0x40: taken = Condition(op & 0xF); break;
+        case 0x80: subroutine = true; break;
+        }
+    }
+
+    if (taken) {
+        uint32_t addr = m_pc - insn.words;
+        if (subroutine) {
+            PushStack(m_pc, m_sr);
+        }
+        m_pc = (addr + disp) & DSP_WORD_MASK;
+        m_jumped = true;
+    }
+}
+
+// DO #xxx, DO S, DO X:ea and DO X:aa; the extension word holds the address
+// of the last word of the loop
+void DSP56300::ExecDo(const DSPInstruction& insn) {
+    uint32_t op = insn.opcode;
+    DSPSpace space = (op & 0x40) ? DSP_SpaceY : DSP_SpaceX;
+    uint32_t count;
+    if (op & 0x80) {
+        count = ((op >> 8) & 0xFF) | ((op & 0xF) << 8);
+    }
+    else {
+        switch ((op >> 14) & 3) {
+        case 3: count = ReadRegister((op >> 8) & 0x3F); break;
+        case 1: count = Read(space, EffectiveAddress((op >> 8) & 0x3F, 0)); break;
+        default: count = Read(space, (op >> 8) & 0x3F); break;
+        }
+    }
+
+    PushStack(m_la, m_lc);
+    m_la = insn.ext & DSP_WORD_MASK;
+    m_lc = count & DSP_WORD_MASK;
+    PushStack(m_pc, m_sr);
+    m_sr |= DSP_SR_LF;
+
+    // Loops with a count of zero are skipped
+    if (m_lc == 0) {
+        EndLoop();
+        m_pc = (m_la + 1) & DSP_WORD_MASK;
+        m_jumped = true;
+    }
+}
+
+// REP #xxx, REP S, REP X:ea and REP X:aa; the next instruction is executed
+// the given number of times
+void DSP56300::ExecRep(const DSPInstruction& insn) {
+    uint32_t op = insn.opcode;
+    DSPSpace space = (op & 0x40) ? DSP_SpaceY : DSP_SpaceX;
+    uint32_t count;
+    if (op & 0x80) {
+        count = ((op >> 8) & 0xFF) | ((op & 0xF) << 8);
+    }
+    else {
+        switch ((op >> 14) & 3) {
+        case 3: count = ReadRegister((op >> 8) & 0x3F); break;
+        case 1: count = Read(space, EffectiveAddress((op >> 8) & 0x3F, 0)); break;
+        default: count = Read(space, (op >> 8) & 0x3F); break;
+        }
+    }
+    count &= DSP_WORD_MASK;
+
+    if (m_pc >= m_pram.size()) {
+        return;
+    }
+    const DSPInstruction& next = Fetch(m_pc);
+    m_pc = (m_pc + next.words) & DSP_WORD_MASK;
+    for (uint32_t i = 0; i < count; i++) {
+        (this->*next.exec)(next);
+    }
+    m_cycles += count * next.cycles;
+}
+
+// MOVEC between control registers and other registers, memory or immediates
+void DSP56300::ExecMovec(const DSPInstruction& insn) {
+    uint32_t op = insn.opcode;
+    uint32_t ctrl = DSP_REG_M0 | (op & 0x1F);
+    bool toControl = (op & 0x8000) != 0;
+
+    if (((op >> 16) & 0xFF) == 0x04) {
+        // 0000 0100 W1ee eeee 101d dddd
+        uint32_t reg = (op >> 8) & 0x3F;
+        if (toControl) {
+            WriteRegister(ctrl, ReadRegister(reg));
+        }
+        else {
+            WriteRegister(reg, ReadRegister(ctrl));
+        }
+        return;
+    }
+
+    if ((op & 0xE0) == 0xA0) {
+        // 0000 0101 iiii iiii 101d dddd
+        WriteRegister(ctrl, (op >> 8) & 0xFF);
+        return;
+    }
+
+    // 0000 0101 W1MM MRRR 0s1d dddd, or W0aa aaaa
+    DSPSpace space = (op & 0x40) ? DSP_SpaceY : DSP_SpaceX;
+    uint32_t ea = (op & 0x4000) ? ((op >> 8) & 0x3F) : (DSP_EA_SHORT | ((op >> 8) & 0x3F));
+    uint32_t addr = EffectiveAddress(ea, insn.ext);
+    if (toControl) {
+        WriteRegister(ctrl, IsImmediate(ea) ? insn.ext : Read(space, addr));
+    }
+    else {
+        Write(space, addr, ReadRegister(ctrl));
+    }
+}
+
+// MOVE X:(Rn+xxxx),D and MOVE S,X:(Rn+xxxx) -- 0000 101s 0111 0RRR 1WDD DDDD
+void DSP56300::ExecMoveDisplacement(const DSPInstruction& insn) {
+    uint32_t op = insn.opcode;
+    DSPSpace space = (op & 0x10000) ? DSP_SpaceY : DSP_SpaceX;
+    uint32_t addr = (m_r[(op >> 8) & 7] + insn.ext) & DSP_WORD_MASK;
+    uint32_t reg = op & 0x3F;
+    if (op & 0x40) {
+        WriteRegister(reg, Read(space, addr));
+    }
+    else {
+        Write(space, addr, ReadRegister(reg));
+    }
+}
+
+// MOVEP between peripherals and memory or registers
+void DSP56300::ExecMovep(const DSPInstruction& insn) {
+    uint32_t op = insn.opcode;
+    uint32_t periph = DSP_PP_BASE | (op & 0x3F);
+    DSPSpace periphSpace = (op & 0x40) ? DSP_SpaceY : DSP_SpaceX;
+    bool toPeripheral = (op & 0x8000) != 0;
+
+    if (op & 0x80) {
+        // 0000 100s W1MM MRRR 1Spp pppp
+        DSPSpace space = (op & 0x10000) ? DSP_SpaceY : DSP_SpaceX;
+        uint32_t ea = (op >> 8) & 0x3F;
+        uint32_t addr = EffectiveAddress(ea, insn.ext);
+        if (toPeripheral) {
+            Write(periphSpace, periph, IsImmediate(ea) ? insn.ext : Read(space, addr));
+        }
+        else {
+            Write(space, addr, Read(periphSpace, periph));
+        }
+    }
+    else {
+        // 0000 100x W1dd dddd 0Spp pppp
+        uint32_t reg = (op >> 8) & 0x3F;
+        if (toPeripheral) {
+            Write(periphSpace, periph, ReadRegister(reg));
+        }
+        else {
+            WriteRegister(reg, Read(periphSpace, periph));
+        }
+    }
+}
+
+// LUA ea,D -- 0000 0100 010M MRRR 0001 dddd
+void DSP56300::ExecLua(const DSPInstruction& insn) {
+    uint32_t reg = (insn.opcode >> 8) & 7;
+    uint32_t saved = m_r[reg];
+    EffectiveAddress((insn.opcode >> 8) & 0x1F, 0);
+    uint32_t updated = m_r[reg];
+    m_r[reg] = saved;
+    WriteRegister(DSP_REG_R0 | (insn.opcode & 0xF), updated);
+}
+
+// BCLR/BSET/BCHG/BTST on memory, peripherals or registers
+void DSP56300::ExecBitOp(const DSPInstruction& insn) {
+    uint32_t op = insn.opcode;
+    uint32_t mask = 1u << (op & 0x1F);
+    DSPSpace space = (op & 0x40) ? DSP_SpaceY : DSP_SpaceX;
+    uint32_t mode = (op >> 14) & 3;
+    uint32_t addr = 0;
+    uint32_t value;
+    switch (mode) {
+    case 0: addr = (op >> 8) & 0x3F; break;
+    case 1: addr = EffectiveAddress((op >> 8) & 0x3F, insn.ext); break;
+    case 2: addr = DSP_PP_BASE | ((op >> 8) & 0x3F); break;
+    }
+    value = (mode == 3) ? ReadRegister((op >> 8) & 0x3F) : Read(space, addr);
+
+    SetCarry((value & mask) != 0);
+    bool set = (op & 0x20) != 0;
+    if ((op >> 16) & 1) {
+        if (set) {
+            return;  // BTST
+        }
+        value ^= mask;  // BCHG
+    }
+    else {
+        value = set ? (value | mask) : (value & ~mask);  // BSET/BCLR
+    }
+
+    if (mode == 3) {
+        WriteRegister((op >> 8) & 0x3F, value);
+    }
+    else {
+        Write(space, addr, value);
+    }
+}
+
+// JCLR/JSET/JSCLR/JSSET on memory, peripherals or registers
+void DSP56300::ExecBitJump(const DSPInstruction& insn) {
+    uint32_t op = insn.opcode;
+    uint32_t mask = 1u << (op & 0x1F);
+    DSPSpace space = (op & 0x40) ? DSP_SpaceY : DSP_SpaceX;
+    uint32_t value;
+    switch ((op >> 14) & 3) {
+    case 0: value = Read(space, (op >> 8) & 0x3F); break;
+    case 1: value = Read(space, EffectiveAddress((op >> 8) & 0x3F, 0)); break;
+    case 2: value = Read(space, DSP_PP_BASE | ((op >> 8) & 0x3F)); break;
+    default: value = ReadRegister((op >> 8) & 0x3F); break;
+    }
+
+    bool bit = (value & mask) != 0;
+    SetCarry(bit);
+    if (bit == ((op & 0x20) != 0)) {
+        if ((op >> 16) & 1) {
+            PushStack(m_pc, m_sr);
+        }
+        m_pc = insn.ext & DSP_WORD_MASK;
+        m_jumped = true;
+    }
+}
+
+}
+}
+}
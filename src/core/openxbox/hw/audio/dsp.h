@@ -0,0 +1,258 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace openxbox {
+namespace hw {
+namespace audio {
+
+// Memory spaces of the DSP
+enum DSPSpace {
+    DSP_SpaceX,
+    DSP_SpaceY,
+    DSP_SpaceP,
+};
+
+// Number of output and input FIFOs reachable through DMA
+#define DSP_FIFO_COUNT      4
+
+// Peripheral registers at the top of X memory
+#define DSP_PERIPHERAL_BASE 0xFFFF80
+#define DSP_DMA_NEXT_BLOCK  0xFFFFD4
+#define DSP_DMA_START_BLOCK 0xFFFFD5
+#define DSP_DMA_CONTROL     0xFFFFD6
+#   define DSP_DMA_CONTROL_ACTION          0x7
+#       define DSP_DMA_CONTROL_ACTION_NOP       0
+#       define DSP_DMA_CONTROL_ACTION_START     1
+#       define DSP_DMA_CONTROL_ACTION_STOP      2
+#       define DSP_DMA_CONTROL_ACTION_FREEZE    3
+#       define DSP_DMA_CONTROL_ACTION_UNFREEZE  4
+#       define DSP_DMA_CONTROL_ACTION_ABORT     5
+#   define DSP_DMA_CONTROL_FROZEN          (1 << 3)
+#   define DSP_DMA_CONTROL_RUNNING         (1 << 4)
+#   define DSP_DMA_CONTROL_STOPPED         (1 << 5)
+#define DSP_DMA_CONFIGURATION 0xFFFFD7
+
+// DMA block descriptors, seven words in X memory
+#define DSP_DMA_BLOCK_NEXT            0
+#   define DSP_DMA_BLOCK_NEXT_ADDRESS      0x3FFF
+#   define DSP_DMA_BLOCK_NEXT_EOL          (1 << 14)
+#define DSP_DMA_BLOCK_CONTROL         1
+#   define DSP_DMA_BLOCK_CONTROL_TO_MEMORY (1 << 1)
+#   define DSP_DMA_BLOCK_CONTROL_WRITEBACK (1 << 4)
+#   define DSP_DMA_BLOCK_CONTROL_BUFFER    (0xF << 5)
+#       define DSP_DMA_BUFFER_SCRATCH          0xE
+#   define DSP_DMA_BLOCK_CONTROL_FORMAT    (0x7 << 10)
+#       define DSP_DMA_FORMAT_16BIT            1
+#       define DSP_DMA_FORMAT_24BIT            2
+#       define DSP_DMA_FORMAT_32BIT            6
+#define DSP_DMA_BLOCK_COUNT           2
+#define DSP_DMA_BLOCK_DSP_OFFSET      3
+#define DSP_DMA_BLOCK_SCRATCH_OFFSET  4
+#define DSP_DMA_BLOCK_SCRATCH_BASE    5
+#define DSP_DMA_BLOCK_SCRATCH_SIZE    6
+
+class DSP56300;
+
+typedef void (DSP56300::*DSPHandler)(const struct DSPInstruction& insn);
+
+// Parallel data move of an arithmetic instruction, decoded
+struct DSPParallelMove {
+    enum Type : uint8_t {
+        None,
+        Immediate,      // #xx,D
+        Register,       // S,D
+        Update,         // ea
+        Memory,         // X:ea/Y:ea/L:ea <-> D
+        MemoryRegister, // X:ea <-> D1 S2,D2 or S1,D1 Y:ea <-> D2
+        Dual,           // X:ea <-> D1 Y:ea <-> D2
+    };
+    Type type;
+    uint8_t space;      // DSPSpace of the memory access, or 3 for L:
+    bool read;          // memory to register
+    uint8_t ea;         // MMMRRR
+    uint8_t reg;        // register moved to/from memory
+    uint8_t src2;       // second move (register to register)
+    uint8_t dst2;
+    uint8_t ea2;        // Y effective address of dual moves
+    uint8_t reg2;
+    bool read2;
+    uint32_t immediate;
+};
+
+// An instruction decoded for execution
+struct DSPInstruction {
+    DSPHandler exec;
+    uint32_t opcode;
+    uint32_t ext;       // extension word
+    uint8_t words;
+    uint8_t cycles;
+    uint8_t alu;        // data ALU operation of parallel instructions
+    DSPParallelMove move;
+};
+
+/*!
+ * A Motorola DSP56300 core, as used by the global and encode processors of
+ * the MCPX APU.
+ *
+ * Instructions are decoded once into a cache indexed by program address and
+ * executed from there until the program memory is written. The core runs a
+ * frame at a time: RunFrame executes until the program waits for the next
+ * frame with the WAIT instruction or until the cycle budget of the frame is
+ * spent, and resumes from there on the next call.
+ *
+ * The DMA controller moves data between X memory and either the scratch
+ * space in guest memory, addressed through a scatter-gather table, or the
+ * FIFOs that connect the processors to each other and to the audio output.
+ * Transfers complete as soon as they are started.
+ *
+ * The core implements the data ALU, parallel moves, address generation with
+ * linear, modulo and bit-reversed addressing, hardware loops, the system
+ * stack, jumps and branches, bit manipulation and MOVEP. Interrupts, the
+ * instruction cache, DIV, NORM and the other less common instructions are
+ * not implemented and are logged and skipped.
+ */
+class DSP56300 {
+public:
+    // sgeAddr and sgeMax point to the registers that locate the
+    // scatter-gather table of the scratch space
+    DSP56300(const char *name, uint32_t xSize, uint32_t ySize, uint32_t pSize, uint8_t *ram, uint32_t ramSize,
+        const uint32_t *sgeAddr, const uint32_t *sgeMax);
+
+    void Reset();
+
+    // Memory access from the host; values are 24-bit words
+    uint32_t ReadMemory(DSPSpace space, uint32_t addr);
+    void WriteMemory(DSPSpace space, uint32_t addr, uint32_t value);
+
+    // Runs the program until it waits for the next frame or the budget runs
+    // out. Returns the number of cycles executed.
+    uint32_t RunFrame(uint32_t cycleBudget);
+
+    // FIFOs connecting the DSP to the rest of the APU
+    std::deque<uint32_t>& GetOutputFIFO(unsigned int index) { return m_outputFifos[index]; }
+    std::deque<uint32_t>& GetInputFIFO(unsigned int index) { return m_inputFifos[index]; }
+
+    uint32_t GetPC() const { return m_pc; }
+
+private:
+    const char *m_name;
+    uint8_t *m_ram;
+    uint32_t m_ramSize;
+    const uint32_t *m_sgeAddr;
+    const uint32_t *m_sgeMax;
+
+    std::vector<uint32_t> m_xram;
+    std::vector<uint32_t> m_yram;
+    std::vector<uint32_t> m_pram;
+
+    // Decoded instructions; entries with a null handler are decoded on use
+    std::vector<DSPInstruction> m_cache;
+
+    // Data ALU
+    uint32_t m_x0, m_x1, m_y0, m_y1;
+    int64_t m_a, m_b;  // 56-bit, sign extended
+
+    // Address generation unit
+    uint32_t m_r[8], m_n[8], m_m[8];
+
+    // Program control unit
+    uint32_t m_pc;
+    uint32_t m_sr;
+    uint32_t m_omr;
+    uint32_t m_sp;
+    uint32_t m_la;
+    uint32_t m_lc;
+    uint32_t m_ssh[16];
+    uint32_t m_ssl[16];
+    uint32_t m_vba, m_sc, m_sz, m_ep;
+
+    // Execution state
+    uint32_t m_cycles;
+    bool m_jumped;  // the current instruction changed the flow of control
+    bool m_waiting;
+    bool m_stopped;
+
+    // DMA controller
+    uint32_t m_dmaNextBlock;
+    uint32_t m_dmaStartBlock;
+    uint32_t m_dmaControl;
+    uint32_t m_dmaConfiguration;
+
+    std::deque<uint32_t> m_outputFifos[DSP_FIFO_COUNT];
+    std::deque<uint32_t> m_inputFifos[DSP_FIFO_COUNT];
+
+    // Memory
+    uint32_t Read(DSPSpace space, uint32_t addr);
+    void Write(DSPSpace space, uint32_t addr, uint32_t value);
+    uint32_t ReadPeripheral(uint32_t addr);
+    void WritePeripheral(uint32_t addr, uint32_t value);
+
+    // DMA
+    void RunDMA();
+    uint32_t TransferBlock(uint32_t block);
+    bool ScratchAddress(uint32_t offset, uint32_t length, uint8_t **ptr);
+
+    // Registers
+    uint32_t ReadRegister(uint32_t reg);
+    void WriteRegister(uint32_t reg, uint32_t value);
+    uint32_t ReadAccumulator(int64_t acc);
+    void ReadLong(uint32_t reg, uint32_t *x, uint32_t *y);
+    void WriteLong(uint32_t reg, uint32_t x, uint32_t y);
+    void PushStack(uint32_t high, uint32_t low);
+    void PopStack(uint32_t *high, uint32_t *low);
+
+    // Address generation
+    uint32_t EffectiveAddress(uint32_t mode, uint32_t ext);
+    uint32_t UpdateAddress(uint32_t reg, int32_t offset);
+    bool IsImmediate(uint32_t mode) const { return mode == 0x34; }
+
+    // Condition codes
+    bool Condition(uint32_t cc) const;
+    void SetFlags(int64_t result, bool overflow);
+    void SetLogicFlags(uint32_t result);
+    void SetCarry(bool carry);
+
+    // Decoding
+    const DSPInstruction& Fetch(uint32_t addr);
+    void Decode(uint32_t addr, DSPInstruction& insn);
+    bool DecodeParallelMove(uint32_t opcode, DSPParallelMove& move);
+    static bool HasExtensionWord(uint32_t mode) { return (mode & 0x38) == 0x30; }
+
+    // Execution
+    void Execute(const DSPInstruction& insn);
+    void EndLoop();
+
+    void ExecParallel(const DSPInstruction& insn);
+    void Alu(uint8_t op);
+    void AluBinary(uint32_t op, int64_t& d, int64_t s, uint32_t s24);
+    int64_t Add(int64_t d, int64_t s, bool carryIn);
+    int64_t Sub(int64_t d, int64_t s, bool borrowIn);
+    int64_t Round(int64_t value);
+
+    void ExecUndefined(const DSPInstruction& insn);
+    void ExecNop(const DSPInstruction& insn);
+    void ExecWait(const DSPInstruction& insn);
+    void ExecStop(const DSPInstruction& insn);
+    void ExecRts(const DSPInstruction& insn);
+    void ExecRti(const DSPInstruction& insn);
+    void ExecEnddo(const DSPInstruction& insn);
+    void ExecLogicImmediate(const DSPInstruction& insn);
+    void ExecAluImmediate(const DSPInstruction& insn);
+    void ExecJump(const DSPInstruction& insn);
+    void ExecBranch(const DSPInstruction& insn);
+    void ExecDo(const DSPInstruction& insn);
+    void ExecRep(const DSPInstruction& insn);
+    void ExecMovec(const DSPInstruction& insn);
+    void ExecMoveDisplacement(const DSPInstruction& insn);
+    void ExecMovep(const DSPInstruction& insn);
+    void ExecLua(const DSPInstruction& insn);
+    void ExecBitOp(const DSPInstruction& insn);
+    void ExecBitJump(const DSPInstruction& insn);
+};
+
+}
+}
+}
@@ -0,0 +1,67 @@
+#include "mix.h"
+#include "apu_defs.h"
+
+#include <algorithm>
+#include <cmath>
+#include <emmintrin.h>
+
+namespace openxbox {
+namespace hw {
+namespace audio {
+
+void apu_mix_block(float *dest, const float *src, float gain) {
+    const __m128 g = _mm_set1_ps(gain);
+    for (unsigned int i = 0; i < NV_PAPU_FRAME_SAMPLES; i += 8) {
+        __m128 d0 = _mm_load_ps(dest + i);
+        __m128 d1 = _mm_load_ps(dest + i + 4);
+        d0 = _mm_add_ps(d0, _mm_mul_ps(_mm_load_ps(src + i), g));
+        d1 = _mm_add_ps(d1, _mm_mul_ps(_mm_load_ps(src + i + 4), g));
+        _mm_store_ps(dest + i, d0);
+        _mm_store_ps(dest + i + 4, d1);
+    }
+}
+
+void apu_mix_block_scalar(float *dest, const float *src, float gain) {
+    for (unsigned int i = 0; i < NV_PAPU_FRAME_SAMPLES; i++) {
+        dest[i] += src[i] * gain;
+    }
+}
+
+void apu_ramp_block(float *block, float start, float end) {
+    const float step = (end - start) / NV_PAPU_FRAME_SAMPLES;
+    __m128 gain = _mm_setr_ps(start, start + step, start + step * 2, start + step * 3);
+    const __m128 advance = _mm_set1_ps(step * 4);
+    for (unsigned int i = 0; i < NV_PAPU_FRAME_SAMPLES; i += 4) {
+        _mm_store_ps(block + i, _mm_mul_ps(_mm_load_ps(block + i), gain));
+        gain = _mm_add_ps(gain, advance);
+    }
+}
+
+void apu_ramp_block_scalar(float *block, float start, float end) {
+    const float step = (end - start) / NV_PAPU_FRAME_SAMPLES;
+    for (unsigned int i = 0; i < NV_PAPU_FRAME_SAMPLES; i++) {
+        block[i] *= start + step * i;
+    }
+}
+
+void apu_interleave_s16(const float *left, const float *right, int16_t *out) {
+    for (unsigned int i = 0; i < NV_PAPU_FRAME_SAMPLES; i += 4) {
+        // Conversion saturates to 32 bits and packing saturates to 16 bits
+        __m128i l = _mm_cvtps_epi32(_mm_load_ps(left + i));
+        __m128i r = _mm_cvtps_epi32(_mm_load_ps(right + i));
+        __m128i lo = _mm_unpacklo_epi32(l, r);
+        __m128i hi = _mm_unpackhi_epi32(l, r);
+        _mm_storeu_si128((__m128i *)(out + i * 2), _mm_packs_epi32(lo, hi));
+    }
+}
+
+void apu_interleave_s16_scalar(const float *left, const float *right, int16_t *out) {
+    for (unsigned int i = 0; i < NV_PAPU_FRAME_SAMPLES; i++) {
+        out[i * 2 + 0] = (int16_t)lrintf(std::min(std::max(left[i], -32768.0f), 32767.0f));
+        out[i * 2 + 1] = (int16_t)lrintf(std::min(std::max(right[i], -32768.0f), 32767.0f));
+    }
+}
+
+}
+}
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+
+namespace openxbox {
+namespace hw {
+namespace audio {
+
+// Block processing routines of the audio engines. Blocks are
+// NV_PAPU_FRAME_SAMPLES floats long and must be 16-byte aligned. Samples use
+// the 16-bit PCM scale.
+
+// dest += src * gain
+void apu_mix_block(float *dest, const float *src, float gain);
+void apu_mix_block_scalar(float *dest, const float *src, float gain);
+
+// Scales the block by a gain that moves linearly from start towards end
+void apu_ramp_block(float *block, float start, float end);
+void apu_ramp_block_scalar(float *block, float start, float end);
+
+// Converts a pair of blocks into interleaved 16-bit stereo samples, clamping
+// samples that are out of range
+void apu_interleave_s16(const float *left, const float *right, int16_t *out);
+void apu_interleave_s16_scalar(const float *left, const float *right, int16_t *out);
+
+}
+}
+}
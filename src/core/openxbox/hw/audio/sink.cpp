@@ -0,0 +1,207 @@
+#include "sink.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+
+#include "openxbox/log.h"
+#include "openxbox/thread.h"
+
+namespace openxbox {
+namespace hw {
+namespace audio {
+
+// Ring capacity, in frames; about 0.7 seconds at 48 kHz
+#define AUDIO_SINK_RING_FRAMES 32768
+
+// ----- AudioSink ------------------------------------------------------------
+
+AudioSink::AudioSink() {
+}
+
+AudioSink::~AudioSink() {
+}
+
+bool AudioSink::Start(uint32_t sampleRate, uint32_t channels) {
+    Stop();
+
+    if (!Open(sampleRate, channels)) {
+        return false;
+    }
+
+    m_sampleRate = sampleRate;
+    m_channels = channels;
+    m_ring.assign(AUDIO_SINK_RING_FRAMES * channels, 0);
+    m_writePos = 0;
+    m_readPos = 0;
+    m_consumedFrames = 0;
+    m_droppedFrames = 0;
+
+    m_running = true;
+    m_thread = std::thread(ConsumerThread, this);
+    return true;
+}
+
+void AudioSink::Stop() {
+    if (!m_thread.joinable()) {
+        return;
+    }
+
+    m_running = false;
+    m_thread.join();
+    Close();
+
+    if (m_droppedFrames > 0) {
+        log_info("AudioSink: %llu frames were dropped\n", (unsigned long long)m_droppedFrames);
+    }
+}
+
+uint32_t AudioSink::Write(const int16_t *samples, uint32_t frames) {
+    if (m_ring.empty()) {
+        m_droppedFrames += frames;
+        return 0;
+    }
+
+    const uint64_t size = m_ring.size();
+    uint64_t writePos = m_writePos.load(std::memory_order_relaxed);
+    uint32_t queued = std::min(frames, GetFreeFrames());
+
+    // Copy in up to two runs around the end of the ring
+    uint64_t count = (uint64_t)queued * m_channels;
+    uint64_t offset = writePos % size;
+    uint64_t first = std::min(count, size - offset);
+    memcpy(&m_ring[offset], samples, first * sizeof(int16_t));
+    memcpy(&m_ring[0], samples + first, (count - first) * sizeof(int16_t));
+
+    m_writePos.store(writePos + count, std::memory_order_release);
+    if (queued < frames) {
+        m_droppedFrames += frames - queued;
+    }
+    return queued;
+}
+
+uint32_t AudioSink::GetFreeFrames() const {
+    if (m_ring.empty()) {
+        return 0;
+    }
+    uint64_t used = m_writePos.load(std::memory_order_relaxed) - m_readPos.load(std::memory_order_acquire);
+    return (uint32_t)((m_ring.size() - used) / m_channels);
+}
+
+void AudioSink::ConsumerThread(AudioSink *sink) {
+    Thread_SetName("[HW] Audio sink");
+    sink->Drain();
+}
+
+void AudioSink::Drain() {
+    const uint64_t size = m_ring.size();
+    for (;;) {
+        bool running = m_running;
+
+        uint64_t readPos = m_readPos.load(std::memory_order_relaxed);
+        uint64_t writePos = m_writePos.load(std::memory_order_acquire);
+        if (readPos == writePos) {
+            if (!running) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            continue;
+        }
+
+        // Hand over the contiguous run up to the end of the ring
+        uint64_t offset = readPos % size;
+        uint64_t count = std::min(writePos - readPos, size - offset);
+        Consume(&m_ring[offset], (uint32_t)(count / m_channels));
+        m_readPos.store(readPos + count, std::memory_order_release);
+        m_consumedFrames += count / m_channels;
+    }
+}
+
+// ----- NullAudioSink --------------------------------------------------------
+
+NullAudioSink::~NullAudioSink() {
+    Stop();
+}
+
+// ----- WavAudioSink ---------------------------------------------------------
+
+struct WavHeader {
+    char riff[4];
+    uint32_t riffSize;
+    char wave[4];
+    char fmt[4];
+    uint32_t fmtSize;
+    uint16_t format;
+    uint16_t channels;
+    uint32_t sampleRate;
+    uint32_t byteRate;
+    uint16_t blockAlign;
+    uint16_t bitsPerSample;
+    char data[4];
+    uint32_t dataSize;
+};
+
+WavAudioSink::WavAudioSink(const char *path)
+    : m_path(path)
+{
+}
+
+WavAudioSink::~WavAudioSink() {
+    Stop();
+}
+
+bool WavAudioSink::Open(uint32_t sampleRate, uint32_t channels) {
+    m_file = fopen(m_path.c_str(), "wb");
+    if (m_file == nullptr) {
+        log_warning("WavAudioSink: Could not create %s\n", m_path.c_str());
+        return false;
+    }
+    setvbuf(m_file, nullptr, _IOFBF, 256 * 1024);
+
+    // The sizes are filled in when the file is closed
+    WavHeader header;
+    memcpy(header.riff, "RIFF", 4);
+    header.riffSize = 0;
+    memcpy(header.wave, "WAVE", 4);
+    memcpy(header.fmt, "fmt ", 4);
+    header.fmtSize = 16;
+    header.format = 1;  // PCM
+    header.channels = channels;
+    header.sampleRate = sampleRate;
+    header.byteRate = sampleRate * channels * sizeof(int16_t);
+    header.blockAlign = channels * sizeof(int16_t);
+    header.bitsPerSample = 16;
+    memcpy(header.data, "data", 4);
+    header.dataSize = 0;
+    fwrite(&header, sizeof(header), 1, m_file);
+    m_dataSize = 0;
+
+    log_info("WavAudioSink: Writing audio to %s\n", m_path.c_str());
+    return true;
+}
+
+void WavAudioSink::Consume(const int16_t *samples, uint32_t frames) {
+    size_t size = frames * GetChannels() * sizeof(int16_t);
+    if (fwrite(samples, 1, size, m_file) == size) {
+        m_dataSize += size;
+    }
+}
+
+void WavAudioSink::Close() {
+    if (m_file == nullptr) {
+        return;
+    }
+
+    uint32_t riffSize = sizeof(WavHeader) - 8 + m_dataSize;
+    fseek(m_file, offsetof(WavHeader, riffSize), SEEK_SET);
+    fwrite(&riffSize, sizeof(riffSize), 1, m_file);
+    fseek(m_file, offsetof(WavHeader, dataSize), SEEK_SET);
+    fwrite(&m_dataSize, sizeof(m_dataSize), 1, m_file);
+    fclose(m_file);
+    m_file = nullptr;
+}
+
+}
+}
+}
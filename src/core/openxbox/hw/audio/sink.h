@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace openxbox {
+namespace hw {
+namespace audio {
+
+/*!
+ * Base class of the host outputs that receive the audio produced by the
+ * emulated audio devices.
+ *
+ * Devices hand interleaved 16-bit samples to Write, which copies them into a
+ * lock-free ring and never blocks; samples that do not fit are dropped. The
+ * ring is drained by a thread owned by the sink that passes the samples on to
+ * Consume in the largest contiguous runs available.
+ *
+ * Write must only be called from one thread at a time.
+ */
+class AudioSink {
+public:
+    AudioSink();
+    virtual ~AudioSink();
+
+    // Opens the output and starts draining the ring
+    bool Start(uint32_t sampleRate, uint32_t channels);
+
+    // Drains the ring and closes the output
+    void Stop();
+
+    // Queues frames of interleaved samples. Returns the number of frames
+    // queued; the rest are dropped.
+    uint32_t Write(const int16_t *samples, uint32_t frames);
+
+    // Number of frames Write can currently queue without dropping any
+    uint32_t GetFreeFrames() const;
+
+    uint32_t GetSampleRate() const { return m_sampleRate; }
+    uint32_t GetChannels() const { return m_channels; }
+    uint64_t GetConsumedFrames() const { return m_consumedFrames; }
+    uint64_t GetDroppedFrames() const { return m_droppedFrames; }
+
+protected:
+    virtual bool Open(uint32_t sampleRate, uint32_t channels) = 0;
+    virtual void Consume(const int16_t *samples, uint32_t frames) = 0;
+    virtual void Close() = 0;
+
+private:
+    static void ConsumerThread(AudioSink *sink);
+    void Drain();
+
+    uint32_t m_sampleRate = 0;
+    uint32_t m_channels = 0;
+
+    // Ring of samples; positions count samples and only ever increase
+    std::vector<int16_t> m_ring;
+    std::atomic<uint64_t> m_writePos{ 0 };
+    std::atomic<uint64_t> m_readPos{ 0 };
+
+    std::atomic<uint64_t> m_consumedFrames{ 0 };
+    std::atomic<uint64_t> m_droppedFrames{ 0 };
+
+    std::thread m_thread;
+    std::atomic<bool> m_running{ false };
+};
+
+/*!
+ * Discards the audio. Useful to run the audio devices headless.
+ */
+class NullAudioSink : public AudioSink {
+public:
+    ~NullAudioSink();
+
+protected:
+    bool Open(uint32_t sampleRate, uint32_t channels) override { return true; }
+    void Consume(const int16_t *samples, uint32_t frames) override {}
+    void Close() override {}
+};
+
+/*!
+ * Writes the audio to a 16-bit PCM WAV file.
+ */
+class WavAudioSink : public AudioSink {
+public:
+    WavAudioSink(const char *path);
+    ~WavAudioSink();
+
+protected:
+    bool Open(uint32_t sampleRate, uint32_t channels) override;
+    void Consume(const int16_t *samples, uint32_t frames) override;
+    void Close() override;
+
+private:
+    std::string m_path;
+    FILE *m_file = nullptr;
+    uint32_t m_dataSize = 0;
+};
+
+}
+}
+}
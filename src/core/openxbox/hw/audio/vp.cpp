@@ -0,0 +1,540 @@
+#include "vp.h"
+#include "adpcm.h"
+#include "mix.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "openxbox/log.h"
+
+namespace openxbox {
+namespace hw {
+namespace audio {
+
+// Fastest a voice may play relative to the output rate, which bounds the
+// number of source samples fetched per frame
+#define VP_MAX_RATE          16
+#define VP_MAX_FETCH         (NV_PAPU_FRAME_SAMPLES * VP_MAX_RATE + 4)
+
+// Envelope counters count units of 16 samples
+#define VP_ENV_UNITS_PER_FRAME (NV_PAPU_FRAME_SAMPLES / 16)
+
+static inline uint32_t getMask(uint32_t value, uint32_t mask) {
+    return (value & mask) / (mask & (~mask + 1));
+}
+
+static inline uint32_t setMask(uint32_t value, uint32_t mask, uint32_t field) {
+    return (value & ~mask) | ((field * (mask & (~mask + 1))) & mask);
+}
+
+VoiceProcessor::VoiceProcessor(uint8_t *ram, uint32_t ramSize, uint32_t *regs)
+    : m_ram(ram)
+    , m_ramSize(ramSize)
+    , m_regs(regs)
+{
+    // Volumes are attenuations in 1/64 dB steps; the largest one mutes the
+    // voice
+    for (uint32_t i = 0; i < 0xFFF; i++) {
+        m_gainTable[i] = powf(10.0f, -(float)i / 64.0f / 20.0f);
+    }
+    m_gainTable[0xFFF] = 0.0f;
+
+    Reset();
+}
+
+void VoiceProcessor::Reset() {
+    for (uint32_t i = 0; i < NV_PAPU_MAX_VOICES; i++) {
+        m_phase[i] = 0.0;
+    }
+
+    // All voice lists start out empty
+    static const uint32_t listRegs[] = {
+        NV_PAPU_TVL2D, NV_PAPU_CVL2D, NV_PAPU_NVL2D,
+        NV_PAPU_TVL3D, NV_PAPU_CVL3D, NV_PAPU_NVL3D,
+        NV_PAPU_TVLMP, NV_PAPU_CVLMP, NV_PAPU_NVLMP,
+    };
+    for (uint32_t reg : listRegs) {
+        Reg(reg) = NV_PAPU_NO_VOICE;
+    }
+}
+
+// ----- Voice structure access -----------------------------------------------
+
+uint8_t *VoiceProcessor::GetVoice(uint32_t handle) {
+    if (handle >= NV_PAPU_MAX_VOICES) {
+        return nullptr;
+    }
+    uint32_t addr = Reg(NV_PAPU_VPVADDR) + handle * NV_PAVS_SIZE;
+    if (addr >= m_ramSize || m_ramSize - addr < NV_PAVS_SIZE) {
+        return nullptr;
+    }
+    return &m_ram[addr];
+}
+
+uint32_t VoiceProcessor::VoiceGet(uint32_t handle, uint32_t offset, uint32_t mask) {
+    uint8_t *voice = GetVoice(handle);
+    if (voice == nullptr) {
+        return 0;
+    }
+    uint32_t value;
+    memcpy(&value, voice + offset, sizeof(value));
+    return getMask(value, mask);
+}
+
+void VoiceProcessor::VoiceSet(uint32_t handle, uint32_t offset, uint32_t mask, uint32_t field) {
+    uint8_t *voice = GetVoice(handle);
+    if (voice == nullptr) {
+        return;
+    }
+    uint32_t value;
+    memcpy(&value, voice + offset, sizeof(value));
+    value = setMask(value, mask, field);
+    memcpy(voice + offset, &value, sizeof(value));
+}
+
+// ----- Front end methods ----------------------------------------------------
+
+void VoiceProcessor::Method(uint32_t method, uint32_t argument) {
+    uint32_t current = Reg(NV_PAPU_FECV) & 0xFFFF;
+
+    switch (method) {
+    case NV1BA0_PIO_SET_ANTECEDENT_VOICE:
+        Reg(NV_PAPU_FEAV) = argument;
+        return;
+    case NV1BA0_PIO_VOICE_ON:
+        VoiceOn(argument & NV1BA0_PIO_VOICE_ON_HANDLE, getMask(argument, NV1BA0_PIO_VOICE_ON_ENVA));
+        return;
+    case NV1BA0_PIO_VOICE_OFF:
+        VoiceOff(argument & NV1BA0_PIO_VOICE_OFF_HANDLE);
+        return;
+    case NV1BA0_PIO_VOICE_RELEASE:
+        VoiceSet(argument & NV1BA0_PIO_VOICE_RELEASE_HANDLE, NV_PAVS_VOICE_PAR_STATE, NV_PAVS_VOICE_PAR_STATE_EACUR, NV_PAVS_VOICE_ENV_RELEASE);
+        return;
+    case NV1BA0_PIO_VOICE_PAUSE:
+        VoiceSet(argument & NV1BA0_PIO_VOICE_PAUSE_HANDLE, NV_PAVS_VOICE_PAR_STATE, NV_PAVS_VOICE_PAR_STATE_PAUSED,
+            (argument & NV1BA0_PIO_VOICE_PAUSE_ACTION) ? 1 : 0);
+        return;
+    case NV1BA0_PIO_SET_CURRENT_VOICE:
+        Reg(NV_PAPU_FECV) = argument;
+        return;
+    case NV1BA0_PIO_SET_VOICE_CFG_BUF_BASE:
+        VoiceSet(current, NV_PAVS_VOICE_CUR_PSL_START, NV_PAVS_VOICE_CUR_PSL_START_BA, argument);
+        return;
+    case NV1BA0_PIO_SET_VOICE_CFG_BUF_LBO:
+        VoiceSet(current, NV_PAVS_VOICE_CUR_PSH_SAMPLE, NV_PAVS_VOICE_CUR_PSH_SAMPLE_LBO, argument);
+        return;
+    case NV1BA0_PIO_SET_VOICE_BUF_CBO:
+        VoiceSet(current, NV_PAVS_VOICE_PAR_OFFSET, NV_PAVS_VOICE_PAR_OFFSET_CBO, argument);
+        if (current < NV_PAPU_MAX_VOICES) {
+            m_phase[current] = 0.0;
+        }
+        return;
+    case NV1BA0_PIO_SET_VOICE_CFG_BUF_EBO:
+        VoiceSet(current, NV_PAVS_VOICE_PAR_NEXT, NV_PAVS_VOICE_PAR_NEXT_EBO, argument);
+        return;
+    }
+
+    if (method >= NV1BA0_PIO_SET_VOICE_CFG_VBIN && method <= NV1BA0_PIO_SET_VOICE_TAR_PITCH && (method & 3) == 0) {
+        if (method == NV1BA0_PIO_SET_VOICE_TAR_PITCH) {
+            // Only the pitch half is set; the other half links the voice
+            VoiceSet(current, NV_PAVS_VOICE_TAR_PITCH_LINK, NV_PAVS_VOICE_TAR_PITCH_LINK_PITCH, argument >> 16);
+        }
+        else {
+            VoiceSet(current, method - NV1BA0_PIO_SET_VOICE_BASE, 0xFFFFFFFF, argument);
+        }
+        return;
+    }
+
+    log_spew("VoiceProcessor: Unhandled method 0x%x = 0x%x\n", method, argument);
+}
+
+void VoiceProcessor::VoiceOn(uint32_t handle, uint32_t envelope) {
+    if (GetVoice(handle) == nullptr) {
+        log_warning("VoiceProcessor: Invalid voice handle 0x%x\n", handle);
+        return;
+    }
+
+    static const uint32_t topRegs[] = { NV_PAPU_TVL2D, NV_PAPU_TVL3D, NV_PAPU_TVLMP };
+    uint32_t list = getMask(Reg(NV_PAPU_FEAV), NV_PAPU_FEAV_LST);
+    if (list != NV1BA0_PIO_SET_ANTECEDENT_VOICE_LIST_INHERIT) {
+        // The voice goes to the top of the selected list
+        uint32_t& top = Reg(topRegs[list - 1]);
+        VoiceSet(handle, NV_PAVS_VOICE_TAR_PITCH_LINK, NV_PAVS_VOICE_TAR_PITCH_LINK_NEXT_VOICE_HANDLE, top & 0xFFFF);
+        top = handle;
+    }
+    else {
+        // The voice goes after the antecedent voice
+        uint32_t antecedent = getMask(Reg(NV_PAPU_FEAV), NV_PAPU_FEAV_VALUE);
+        uint32_t next = VoiceGet(antecedent, NV_PAVS_VOICE_TAR_PITCH_LINK, NV_PAVS_VOICE_TAR_PITCH_LINK_NEXT_VOICE_HANDLE);
+        VoiceSet(handle, NV_PAVS_VOICE_TAR_PITCH_LINK, NV_PAVS_VOICE_TAR_PITCH_LINK_NEXT_VOICE_HANDLE, next);
+        VoiceSet(antecedent, NV_PAVS_VOICE_TAR_PITCH_LINK, NV_PAVS_VOICE_TAR_PITCH_LINK_NEXT_VOICE_HANDLE, handle);
+    }
+
+    VoiceSet(handle, NV_PAVS_VOICE_PAR_STATE, NV_PAVS_VOICE_PAR_STATE_ACTIVE_VOICE, 1);
+    VoiceSet(handle, NV_PAVS_VOICE_PAR_STATE, NV_PAVS_VOICE_PAR_STATE_NEW_VOICE, 1);
+    VoiceSet(handle, NV_PAVS_VOICE_PAR_STATE, NV_PAVS_VOICE_PAR_STATE_PAUSED, 0);
+    VoiceSet(handle, NV_PAVS_VOICE_PAR_STATE, NV_PAVS_VOICE_PAR_STATE_EACUR, envelope);
+    VoiceSet(handle, NV_PAVS_VOICE_CUR_ECNT, NV_PAVS_VOICE_CUR_ECNT_EACOUNT, 0);
+    VoiceSet(handle, NV_PAVS_VOICE_PAR_OFFSET, NV_PAVS_VOICE_PAR_OFFSET_EALVL, envelope == NV_PAVS_VOICE_ENV_OFF ? 0xFF : 0);
+}
+
+void VoiceProcessor::VoiceOff(uint32_t handle) {
+    VoiceSet(handle, NV_PAVS_VOICE_PAR_STATE, NV_PAVS_VOICE_PAR_STATE_ACTIVE_VOICE, 0);
+}
+
+// ----- Frame processing -----------------------------------------------------
+
+unsigned int VoiceProcessor::ProcessFrame(APUMixBins& mixbins) {
+    unsigned int voices = 0;
+    voices += ProcessList(NV_PAPU_TVL2D, NV_PAPU_CVL2D, NV_PAPU_NVL2D, mixbins);
+    voices += ProcessList(NV_PAPU_TVL3D, NV_PAPU_CVL3D, NV_PAPU_NVL3D, mixbins);
+    voices += ProcessList(NV_PAPU_TVLMP, NV_PAPU_CVLMP, NV_PAPU_NVLMP, mixbins);
+    return voices;
+}
+
+unsigned int VoiceProcessor::ProcessList(uint32_t topReg, uint32_t currentReg, uint32_t nextReg, APUMixBins& mixbins) {
+    unsigned int voices = 0;
+    uint32_t previous = NV_PAPU_NO_VOICE;
+    uint32_t handle = Reg(topReg) & 0xFFFF;
+
+    // The visit count guards against corrupted lists that loop forever
+    for (unsigned int visits = 0; handle != NV_PAPU_NO_VOICE && visits < NV_PAPU_MAX_VOICES; visits++) {
+        if (GetVoice(handle) == nullptr) {
+            log_warning("VoiceProcessor: Voice list links to invalid handle 0x%x\n", handle);
+            break;
+        }
+
+        uint32_t next = VoiceGet(handle, NV_PAVS_VOICE_TAR_PITCH_LINK, NV_PAVS_VOICE_TAR_PITCH_LINK_NEXT_VOICE_HANDLE);
+        Reg(currentReg) = handle;
+        Reg(nextReg) = next;
+
+        bool active = VoiceGet(handle, NV_PAVS_VOICE_PAR_STATE, NV_PAVS_VOICE_PAR_STATE_ACTIVE_VOICE) != 0;
+        if (active) {
+            active = ProcessVoice(handle, mixbins);
+            voices++;
+        }
+
+        if (!active) {
+            // Unlink idle voices
+            if (previous == NV_PAPU_NO_VOICE) {
+                Reg(topReg) = next;
+            }
+            else {
+                VoiceSet(previous, NV_PAVS_VOICE_TAR_PITCH_LINK, NV_PAVS_VOICE_TAR_PITCH_LINK_NEXT_VOICE_HANDLE, next);
+            }
+        }
+        else {
+            previous = handle;
+        }
+        handle = next;
+    }
+
+    Reg(currentReg) = NV_PAPU_NO_VOICE;
+    Reg(nextReg) = NV_PAPU_NO_VOICE;
+    return voices;
+}
+
+bool VoiceProcessor::ProcessVoice(uint32_t handle, APUMixBins& mixbins) {
+    VoiceSet(handle, NV_PAVS_VOICE_PAR_STATE, NV_PAVS_VOICE_PAR_STATE_NEW_VOICE, 0);
+    if (VoiceGet(handle, NV_PAVS_VOICE_PAR_STATE, NV_PAVS_VOICE_PAR_STATE_PAUSED)) {
+        return true;
+    }
+
+    uint32_t fmt = VoiceGet(handle, NV_PAVS_VOICE_CFG_FMT, 0xFFFFFFFF);
+    if (fmt & NV_PAVS_VOICE_CFG_FMT_MULTIPACKET) {
+        log_spew("VoiceProcessor: Multipacket voices are not supported\n");
+        return true;
+    }
+
+    VoiceFormat format;
+    format.base = VoiceGet(handle, NV_PAVS_VOICE_CUR_PSL_START, NV_PAVS_VOICE_CUR_PSL_START_BA);
+    format.loopOffset = VoiceGet(handle, NV_PAVS_VOICE_CUR_PSH_SAMPLE, NV_PAVS_VOICE_CUR_PSH_SAMPLE_LBO);
+    format.endOffset = VoiceGet(handle, NV_PAVS_VOICE_PAR_NEXT, NV_PAVS_VOICE_PAR_NEXT_EBO);
+    format.loop = (fmt & NV_PAVS_VOICE_CFG_FMT_LOOP) != 0 && format.loopOffset <= format.endOffset;
+    format.channels = (fmt & NV_PAVS_VOICE_CFG_FMT_STEREO) ? 2 : 1;
+    format.sampleSize = getMask(fmt, NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE);
+    format.containerSize = getMask(fmt, NV_PAVS_VOICE_CFG_FMT_CONTAINER_SIZE);
+    switch (format.containerSize) {
+    case NV_PAVS_VOICE_CFG_FMT_CONTAINER_SIZE_B8: format.frameBytes = 1 * format.channels; break;
+    case NV_PAVS_VOICE_CFG_FMT_CONTAINER_SIZE_B16: format.frameBytes = 2 * format.channels; break;
+    case NV_PAVS_VOICE_CFG_FMT_CONTAINER_SIZE_B32: format.frameBytes = 4 * format.channels; break;
+    default: format.frameBytes = 0; break;
+    }
+
+    // Pitch is in 1/4096 octaves relative to the output rate
+    int16_t pitch = (int16_t)VoiceGet(handle, NV_PAVS_VOICE_TAR_PITCH_LINK, NV_PAVS_VOICE_TAR_PITCH_LINK_PITCH);
+    double rate = std::min(pow(2.0, pitch / 4096.0), (double)VP_MAX_RATE);
+
+    // Fetch every source sample the frame interpolates between
+    uint32_t position = VoiceGet(handle, NV_PAVS_VOICE_PAR_OFFSET, NV_PAVS_VOICE_PAR_OFFSET_CBO);
+    double phase = m_phase[handle];
+    uint32_t fetch = (uint32_t)(phase + (NV_PAPU_FRAME_SAMPLES - 1) * rate) + 2;
+    float source[2][VP_MAX_FETCH];
+    float *sourcePtrs[2] = { source[0], source[1] };
+    bool ended = !DecodeSamples(format, position, fetch, sourcePtrs);
+
+    // Resample to the output rate
+    alignas(16) float samples[2][NV_PAPU_FRAME_SAMPLES];
+    for (unsigned int c = 0; c < format.channels; c++) {
+        for (unsigned int i = 0; i < NV_PAPU_FRAME_SAMPLES; i++) {
+            double x = phase + i * rate;
+            uint32_t k = (uint32_t)x;
+            float f = (float)(x - k);
+            samples[c][i] = source[c][k] + (source[c][k + 1] - source[c][k]) * f;
+        }
+    }
+
+    // Advance the voice, wrapping around the loop
+    double advance = phase + NV_PAPU_FRAME_SAMPLES * rate;
+    uint32_t whole = (uint32_t)advance;
+    m_phase[handle] = advance - whole;
+    uint64_t newPosition = (uint64_t)position + whole;
+    if (newPosition > format.endOffset) {
+        if (format.loop) {
+            uint32_t loopLength = format.endOffset - format.loopOffset + 1;
+            newPosition = format.loopOffset + (newPosition - format.endOffset - 1) % loopLength;
+        }
+        else {
+            ended = true;
+        }
+    }
+    VoiceSet(handle, NV_PAVS_VOICE_PAR_OFFSET, NV_PAVS_VOICE_PAR_OFFSET_CBO, (uint32_t)newPosition);
+
+    // Apply the amplitude envelope, ramping from the previous level
+    uint8_t previousLevel = (uint8_t)VoiceGet(handle, NV_PAVS_VOICE_PAR_OFFSET, NV_PAVS_VOICE_PAR_OFFSET_EALVL);
+    bool released = false;
+    uint8_t level = StepEnvelope(handle, &released);
+    if (previousLevel != 0xFF || level != 0xFF) {
+        for (unsigned int c = 0; c < format.channels; c++) {
+            apu_ramp_block(samples[c], previousLevel / 255.0f, level / 255.0f);
+        }
+    }
+
+    // Mix into the voice's bins
+    uint32_t vbin = VoiceGet(handle, NV_PAVS_VOICE_CFG_VBIN, 0xFFFFFFFF);
+    uint32_t bins[NV_PAPU_VOICE_BINS] = {
+        getMask(vbin, 0x1F << 0), getMask(vbin, 0x1F << 5), getMask(vbin, 0x1F << 10),
+        getMask(vbin, 0x1F << 16), getMask(vbin, 0x1F << 21), getMask(vbin, 0x1Fu << 26),
+        getMask(fmt, NV_PAVS_VOICE_CFG_FMT_V6BIN), getMask(fmt, NV_PAVS_VOICE_CFG_FMT_V7BIN),
+    };
+    uint32_t vola = VoiceGet(handle, NV_PAVS_VOICE_TAR_VOLA, 0xFFFFFFFF);
+    uint32_t volb = VoiceGet(handle, NV_PAVS_VOICE_TAR_VOLB, 0xFFFFFFFF);
+    uint32_t volc = VoiceGet(handle, NV_PAVS_VOICE_TAR_VOLC, 0xFFFFFFFF);
+    uint32_t volumes[NV_PAPU_VOICE_BINS] = {
+        getMask(vola, NV_PAVS_VOICE_TAR_VOLA_VOLUME0), getMask(vola, NV_PAVS_VOICE_TAR_VOLA_VOLUME1),
+        getMask(volb, NV_PAVS_VOICE_TAR_VOLB_VOLUME2), getMask(volb, NV_PAVS_VOICE_TAR_VOLB_VOLUME3),
+        getMask(volc, NV_PAVS_VOICE_TAR_VOLC_VOLUME4), getMask(volc, NV_PAVS_VOICE_TAR_VOLC_VOLUME5),
+        getMask(vola, NV_PAVS_VOICE_TAR_VOLA_VOLUME6_B3_0) | (getMask(volb, NV_PAVS_VOICE_TAR_VOLB_VOLUME6_B7_4) << 4)
+            | (getMask(volc, NV_PAVS_VOICE_TAR_VOLC_VOLUME6_B11_8) << 8),
+        getMask(vola, NV_PAVS_VOICE_TAR_VOLA_VOLUME7_B3_0) | (getMask(volb, NV_PAVS_VOICE_TAR_VOLB_VOLUME7_B7_4) << 4)
+            | (getMask(volc, NV_PAVS_VOICE_TAR_VOLC_VOLUME7_B11_8) << 8),
+    };
+    for (unsigned int b = 0; b < NV_PAPU_VOICE_BINS; b++) {
+        float gain = m_gainTable[volumes[b]];
+        if (gain == 0.0f) {
+            continue;
+        }
+        // Stereo voices send the left channel to even bins and the right
+        // channel to odd bins
+        const float *channel = samples[format.channels == 2 ? (b & 1) : 0];
+        apu_mix_block(mixbins[bins[b]], channel, gain);
+    }
+
+    if (ended || released) {
+        VoiceOff(handle);
+        return false;
+    }
+    return true;
+}
+
+uint8_t VoiceProcessor::StepEnvelope(uint32_t handle, bool *finished) {
+    uint32_t state = VoiceGet(handle, NV_PAVS_VOICE_PAR_STATE, NV_PAVS_VOICE_PAR_STATE_EACUR);
+    uint32_t count = VoiceGet(handle, NV_PAVS_VOICE_CUR_ECNT, NV_PAVS_VOICE_CUR_ECNT_EACOUNT);
+    uint32_t level = VoiceGet(handle, NV_PAVS_VOICE_PAR_OFFSET, NV_PAVS_VOICE_PAR_OFFSET_EALVL);
+    uint32_t env0 = VoiceGet(handle, NV_PAVS_VOICE_CFG_ENV0, 0xFFFFFFFF);
+    uint32_t enva = VoiceGet(handle, NV_PAVS_VOICE_CFG_ENVA, 0xFFFFFFFF);
+
+    count = std::min(count + VP_ENV_UNITS_PER_FRAME, 0xFFFFu);
+    uint32_t nextState = state;
+    switch (state) {
+    case NV_PAVS_VOICE_ENV_OFF:
+        level = 0xFF;
+        break;
+    case NV_PAVS_VOICE_ENV_DELAY:
+        level = 0;
+        if (count >= getMask(env0, NV_PAVS_VOICE_CFG_ENV0_EA_DELAYTIME)) {
+            nextState = NV_PAVS_VOICE_ENV_ATTACK;
+        }
+        break;
+    case NV_PAVS_VOICE_ENV_ATTACK:
+    {
+        uint32_t attack = getMask(env0, NV_PAVS_VOICE_CFG_ENV0_EA_ATTACKRATE);
+        level = (count >= attack) ? 0xFF : count * 0xFF / attack;
+        if (count >= attack) {
+            nextState = NV_PAVS_VOICE_ENV_HOLD;
+        }
+        break;
+    }
+    case NV_PAVS_VOICE_ENV_HOLD:
+        level = 0xFF;
+        if (count >= getMask(enva, NV_PAVS_VOICE_CFG_ENVA_EA_HOLDTIME)) {
+            nextState = NV_PAVS_VOICE_ENV_DECAY;
+        }
+        break;
+    case NV_PAVS_VOICE_ENV_DECAY:
+    {
+        uint32_t decay = getMask(enva, NV_PAVS_VOICE_CFG_ENVA_EA_DECAYRATE);
+        uint32_t sustain = getMask(enva, NV_PAVS_VOICE_CFG_ENVA_EA_SUSTAINLEVEL);
+        level = (count >= decay) ? sustain : 0xFF - (0xFF - sustain) * count / decay;
+        if (count >= decay) {
+            nextState = NV_PAVS_VOICE_ENV_SUSTAIN;
+        }
+        break;
+    }
+    case NV_PAVS_VOICE_ENV_SUSTAIN:
+        level = getMask(enva, NV_PAVS_VOICE_CFG_ENVA_EA_SUSTAINLEVEL);
+        break;
+    case NV_PAVS_VOICE_ENV_RELEASE:
+    case NV_PAVS_VOICE_ENV_FORCE_RELEASE:
+    {
+        // Fade out from the current level
+        uint32_t release = VoiceGet(handle, NV_PAVS_VOICE_CFG_MISC, NV_PAVS_VOICE_CFG_MISC_EA_RELEASERATE);
+        uint32_t step = (release == 0) ? 0xFF : std::max(1u, 0xFF * VP_ENV_UNITS_PER_FRAME / release);
+        level = (level > step) ? level - step : 0;
+        if (level == 0) {
+            *finished = true;
+        }
+        break;
+    }
+    }
+
+    if (nextState != state) {
+        VoiceSet(handle, NV_PAVS_VOICE_PAR_STATE, NV_PAVS_VOICE_PAR_STATE_EACUR, nextState);
+        count = 0;
+    }
+    VoiceSet(handle, NV_PAVS_VOICE_CUR_ECNT, NV_PAVS_VOICE_CUR_ECNT_EACOUNT, count);
+    VoiceSet(handle, NV_PAVS_VOICE_PAR_OFFSET, NV_PAVS_VOICE_PAR_OFFSET_EALVL, level);
+    return (uint8_t)level;
+}
+
+// ----- Sample fetching ------------------------------------------------------
+
+bool VoiceProcessor::ReadBuffer(uint32_t offset, uint8_t *dest, uint32_t length) {
+    // Voice buffers are scattered across pages listed in the SGE table
+    while (length > 0) {
+        uint32_t entryAddr = Reg(NV_PAPU_VPSGEADDR) + (offset / NV_PAPU_PAGE_SIZE) * 8;
+        if (entryAddr >= m_ramSize || m_ramSize - entryAddr < 4) {
+            return false;
+        }
+        uint32_t page;
+        memcpy(&page, &m_ram[entryAddr], sizeof(page));
+
+        uint32_t pageOffset = offset % NV_PAPU_PAGE_SIZE;
+        uint32_t run = std::min(length, NV_PAPU_PAGE_SIZE - pageOffset);
+        uint32_t addr = page + pageOffset;
+        if (addr >= m_ramSize || m_ramSize - addr < run) {
+            return false;
+        }
+        memcpy(dest, &m_ram[addr], run);
+
+        dest += run;
+        offset += run;
+        length -= run;
+    }
+    return true;
+}
+
+bool VoiceProcessor::DecodeSamples(const VoiceFormat& format, uint32_t position, uint32_t count, float *out[2]) {
+    // Decode in runs up to the end of the buffer, wrapping around the loop
+    uint32_t done = 0;
+    bool ended = false;
+    while (done < count) {
+        if (position > format.endOffset) {
+            if (!format.loop) {
+                ended = true;
+                break;
+            }
+            position = format.loopOffset;
+        }
+        uint32_t run = std::min(count - done, format.endOffset - position + 1);
+        DecodeRun(format, position, run, out, done);
+        done += run;
+        position += run;
+    }
+
+    // Silence past the end of the buffer
+    for (unsigned int c = 0; c < format.channels; c++) {
+        std::fill(out[c] + done, out[c] + count, 0.0f);
+    }
+    return !ended;
+}
+
+void VoiceProcessor::DecodeRun(const VoiceFormat& format, uint32_t position, uint32_t count, float *out[2], uint32_t outOffset) {
+    const unsigned int channels = format.channels;
+
+    if (format.containerSize == NV_PAVS_VOICE_CFG_FMT_CONTAINER_SIZE_ADPCM) {
+        const uint32_t blockSize = NV_PAPU_ADPCM_BLOCK_SIZE * channels;
+        uint8_t block[NV_PAPU_ADPCM_BLOCK_SIZE * 2];
+        int16_t decoded[NV_PAPU_ADPCM_BLOCK_SAMPLES * 2];
+        uint32_t decodedBlock = 0xFFFFFFFF;
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t sample = position + i;
+            uint32_t blockIndex = sample / NV_PAPU_ADPCM_BLOCK_SAMPLES;
+            if (blockIndex != decodedBlock) {
+                if (!ReadBuffer(format.base + blockIndex * blockSize, block, blockSize)) {
+                    memset(block, 0, sizeof(block));
+                }
+                apu_adpcm_decode_block(block, channels, decoded);
+                decodedBlock = blockIndex;
+            }
+            uint32_t index = (sample % NV_PAPU_ADPCM_BLOCK_SAMPLES) * channels;
+            for (unsigned int c = 0; c < channels; c++) {
+                out[c][outOffset + i] = decoded[index + c];
+            }
+        }
+        return;
+    }
+
+    // Read the whole run of PCM samples at once
+    uint8_t raw[VP_MAX_FETCH * 8];
+    uint32_t length = count * format.frameBytes;
+    if (format.frameBytes == 0 || !ReadBuffer(format.base + position * format.frameBytes, raw, length)) {
+        for (unsigned int c = 0; c < channels; c++) {
+            std::fill(out[c] + outOffset, out[c] + outOffset + count, 0.0f);
+        }
+        return;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        for (unsigned int c = 0; c < channels; c++) {
+            const uint8_t *p = raw + i * format.frameBytes + c * (format.frameBytes / channels);
+            float value;
+            switch (format.containerSize) {
+            case NV_PAVS_VOICE_CFG_FMT_CONTAINER_SIZE_B8:
+                value = (format.sampleSize == NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_U8) ? ((int)p[0] - 128) * 256.0f : (int8_t)p[0] * 256.0f;
+                break;
+            case NV_PAVS_VOICE_CFG_FMT_CONTAINER_SIZE_B16:
+            {
+                int16_t s;
+                memcpy(&s, p, sizeof(s));
+                value = s;
+                break;
+            }
+            default:
+            {
+                // 24- and 32-bit samples are left-justified in the container
+                int32_t s;
+                memcpy(&s, p, sizeof(s));
+                value = s / 65536.0f;
+                break;
+            }
+            }
+            out[c][outOffset + i] = value;
+        }
+    }
+}
+
+}
+}
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+
+#include "apu_defs.h"
+
+namespace openxbox {
+namespace hw {
+namespace audio {
+
+// A frame of the 32 mixing buffers the voices are mixed into
+typedef float APUMixBins[NV_PAPU_MIXBINS][NV_PAPU_FRAME_SAMPLES];
+
+/*!
+ * The voice processor of the MCPX APU.
+ *
+ * Voices live in guest memory in an array of NV_PAVS structures and are
+ * chained into three lists (2D, 3D and multipass) by the front end methods.
+ * Every frame, the processor walks the lists and, for each active voice,
+ * fetches and decodes the samples needed from the voice buffer, resamples
+ * them to 48 kHz according to the voice pitch, applies the amplitude
+ * envelope and mixes the result into up to eight of the 32 mixbins with
+ * individual volumes. Voices that go idle are unlinked from their lists.
+ *
+ * Voice buffers are addressed through the scatter-gather table at
+ * NV_PAPU_VPSGEADDR and may hold 8-, 16-, 24- or 32-bit PCM or Xbox ADPCM
+ * samples, mono or stereo. Streaming (multipacket) voices and the filter and
+ * pitch envelopes are not supported.
+ *
+ * The processor is not thread-safe; the device serializes methods and frames.
+ */
+class VoiceProcessor {
+public:
+    // regs points to the global register space of the APU
+    VoiceProcessor(uint8_t *ram, uint32_t ramSize, uint32_t *regs);
+
+    // Executes a front end method written to the VP PIO space
+    void Method(uint32_t method, uint32_t argument);
+
+    // Processes one frame of every active voice, mixing into the mixbins,
+    // which must be cleared beforehand. Returns the number of voices played.
+    unsigned int ProcessFrame(APUMixBins& mixbins);
+
+    // Clears the voice lists in the register space and the voice positions
+    void Reset();
+
+private:
+    struct VoiceFormat {
+        uint32_t base;          // offset of the buffer in the SGE space
+        uint32_t loopOffset;    // sample the buffer loops back to
+        uint32_t endOffset;     // last sample of the buffer
+        bool loop;
+        unsigned int channels;
+        unsigned int sampleSize;
+        unsigned int containerSize;
+        unsigned int frameBytes;  // bytes per sample frame of PCM voices
+    };
+
+    uint8_t *m_ram;
+    uint32_t m_ramSize;
+    uint32_t *m_regs;
+
+    // Fractional sample position of each voice, which has no room in the
+    // voice structure
+    double m_phase[NV_PAPU_MAX_VOICES];
+
+    // Gains for each of the 4096 attenuation levels
+    float m_gainTable[0x1000];
+
+    uint32_t& Reg(uint32_t addr) { return m_regs[addr / 4]; }
+
+    uint8_t *GetVoice(uint32_t handle);
+    uint32_t VoiceGet(uint32_t handle, uint32_t offset, uint32_t mask);
+    void VoiceSet(uint32_t handle, uint32_t offset, uint32_t mask, uint32_t value);
+
+    void VoiceOn(uint32_t handle, uint32_t envelope);
+    void VoiceOff(uint32_t handle);
+
+    unsigned int ProcessList(uint32_t topReg, uint32_t currentReg, uint32_t nextReg, APUMixBins& mixbins);
+    bool ProcessVoice(uint32_t handle, APUMixBins& mixbins);
+    uint8_t StepEnvelope(uint32_t handle, bool *finished);
+
+    bool ReadBuffer(uint32_t offset, uint8_t *dest, uint32_t length);
+    bool DecodeSamples(const VoiceFormat& format, uint32_t position, uint32_t count, float *out[2]);
+    void DecodeRun(const VoiceFormat& format, uint32_t position, uint32_t count, float *out[2], uint32_t outOffset);
+};
+
+}
+}
+}
@@ -42,6 +42,8 @@ typedef void (*EventCallback)(void *userData, int event);
  */
 class CharDriver {
 public:
+    virtual ~CharDriver() {}
+
     virtual bool Init() = 0;
     virtual int Write(const uint8_t *buf, int len) = 0;
     virtual void AcceptInput() = 0;
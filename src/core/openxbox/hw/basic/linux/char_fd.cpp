@@ -0,0 +1,247 @@
+#ifdef __linux__
+
+#include "char_fd.h"
+
+#include "openxbox/log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace openxbox {
+
+FdCharDriver::FdCharDriver(CharEventLoop *loop)
+    : m_loop(loop)
+{
+    m_loop->Register(this);
+}
+
+FdCharDriver::~FdCharDriver() {
+    FdCharDriver::Stop();
+}
+
+int FdCharDriver::Write(const uint8_t *buf, int len) {
+    std::lock_guard<std::mutex> lk(m_outMutex);
+    if (!m_connected) {
+        // Nobody is listening; discard the data
+        return len;
+    }
+    if (m_outBuf.size() + len > CHAR_FD_MAX_PENDING) {
+        m_dropped += len;
+        return len;
+    }
+
+    bool wasEmpty = m_outBuf.empty();
+    m_outBuf.insert(m_outBuf.end(), buf, buf + len);
+    if (wasEmpty) {
+        m_loop->Wake(this);
+    }
+    return len;
+}
+
+void FdCharDriver::AcceptInput() {
+    // Only bother the event loop if there is input waiting for room
+    if (m_inputPending) {
+        m_loop->Wake(this);
+    }
+}
+
+void FdCharDriver::Stop() {
+    m_loop->Unregister(this);
+
+    // Write out what the host takes without blocking
+    if (m_fd >= 0) {
+        Flush();
+    }
+    Disconnect();
+}
+
+// ----- IOCTLs ---------------------------------------------------------------
+
+void FdCharDriver::SetBreakEnable(bool breakEnable) {
+    // Nothing to do
+}
+
+void FdCharDriver::SetSerialParameters(SerialParams *params) {
+    // Nothing to do
+}
+
+// ----- Connection -----------------------------------------------------------
+
+bool FdCharDriver::Connect(int fd) {
+    Disconnect();
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        log_warning("FdCharDriver: Invalid file descriptor: %s\n", strerror(errno));
+        close(fd);
+        return false;
+    }
+    m_pollable = !S_ISREG(st.st_mode);
+    m_socket = S_ISSOCK(st.st_mode);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    m_fd = fd;
+    m_events = m_pollable ? EPOLLIN : 0;
+    if (m_pollable && !m_loop->Watch(fd, this, m_events)) {
+        close(fd);
+        m_fd = -1;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lk(m_outMutex);
+    m_connected = true;
+    return true;
+}
+
+void FdCharDriver::Disconnect() {
+    if (m_fd < 0) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(m_outMutex);
+        m_connected = false;
+        m_outBuf.clear();
+    }
+    if (m_pollable) {
+        m_loop->Unwatch(m_fd);
+    }
+    close(m_fd);
+    m_fd = -1;
+
+    m_sending.clear();
+    m_sendPos = 0;
+    m_inPos = m_inLen = 0;
+    m_inputPending = false;
+}
+
+void FdCharDriver::OnHangup() {
+    Disconnect();
+    Event(CHR_EVENT_CLOSED);
+}
+
+// ----- Event loop -----------------------------------------------------------
+
+void FdCharDriver::HandleEvent(int fd, uint32_t events) {
+    if (fd != m_fd) {
+        OnEvent(fd, events);
+        return;
+    }
+
+    if (events & EPOLLIN) {
+        ReadInput();
+    }
+    if (m_fd >= 0 && (events & EPOLLOUT)) {
+        Flush();
+    }
+    if (m_fd >= 0 && (events & (EPOLLHUP | EPOLLERR)) && !(events & EPOLLIN)) {
+        OnHangup();
+    }
+    if (m_fd >= 0) {
+        UpdateEvents();
+    }
+}
+
+void FdCharDriver::Service() {
+    if (m_fd < 0) {
+        return;
+    }
+    DeliverInput();
+    Flush();
+    if (m_fd >= 0) {
+        UpdateEvents();
+    }
+}
+
+void FdCharDriver::ReadInput() {
+    if (m_inPos < m_inLen) {
+        return;
+    }
+
+    ssize_t len = read(m_fd, m_inBuf, sizeof(m_inBuf));
+    if (len > 0) {
+        m_inPos = 0;
+        m_inLen = (int)len;
+        DeliverInput();
+    }
+    else if (len == 0 || (errno != EAGAIN && errno != EINTR)) {
+        OnHangup();
+    }
+}
+
+void FdCharDriver::DeliverInput() {
+    while (m_inPos < m_inLen) {
+        int len = CanReceive();
+        if (len <= 0) {
+            break;
+        }
+        if (len > m_inLen - m_inPos) {
+            len = m_inLen - m_inPos;
+        }
+        Receive(&m_inBuf[m_inPos], len);
+        m_inPos += len;
+    }
+    m_inputPending = m_inPos < m_inLen;
+}
+
+void FdCharDriver::Flush() {
+    for (;;) {
+        if (m_sendPos == m_sending.size()) {
+            std::lock_guard<std::mutex> lk(m_outMutex);
+            if (m_outBuf.empty()) {
+                break;
+            }
+            m_sending.swap(m_outBuf);
+            m_outBuf.clear();
+            m_sendPos = 0;
+        }
+
+        const uint8_t *data = &m_sending[m_sendPos];
+        size_t size = m_sending.size() - m_sendPos;
+        ssize_t len = m_socket
+            ? send(m_fd, data, size, MSG_NOSIGNAL)
+            : write(m_fd, data, size);
+        if (len > 0) {
+            m_sendPos += len;
+        }
+        else if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        else if (len < 0 && errno == EAGAIN) {
+            // Wait until the host can take more
+            break;
+        }
+        else {
+            log_debug("FdCharDriver: Write failed: %s\n", strerror(errno));
+            OnHangup();
+            break;
+        }
+    }
+}
+
+void FdCharDriver::UpdateEvents() {
+    if (!m_pollable) {
+        return;
+    }
+
+    uint32_t events = 0;
+    if (m_inPos >= m_inLen) {
+        events |= EPOLLIN;
+    }
+    if (m_sendPos < m_sending.size()) {
+        events |= EPOLLOUT;
+    }
+    if (events != m_events) {
+        m_events = events;
+        m_loop->Modify(m_fd, events);
+    }
+}
+
+}
+
+#endif // __linux__
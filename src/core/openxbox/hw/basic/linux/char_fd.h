@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "../char.h"
+#include "char_loop.h"
+
+namespace openxbox {
+
+// Bytes read from the host at once
+#define CHAR_FD_READ_SIZE     4096
+
+// Output buffered for the host before further writes are dropped
+#define CHAR_FD_MAX_PENDING   (1024 * 1024)
+
+/*!
+ * Base class of the character drivers that transfer data through a host
+ * file descriptor serviced by a CharEventLoop.
+ *
+ * Writes never block the caller: data is appended to an output buffer and
+ * the event loop writes it to the host as fast as the file descriptor
+ * accepts it. Output is dropped while the buffer is full or while no host
+ * file is connected. Input is read by the event loop in large chunks and
+ * handed to the receiver as it makes room for it; the file descriptor is
+ * not read again until the previous chunk has been fully delivered.
+ *
+ * Regular files can't be watched with epoll. They are written whenever
+ * there is pending output and are never read.
+ */
+class FdCharDriver : public CharDriver, public ICharEventHandler {
+public:
+    FdCharDriver(CharEventLoop *loop);
+    virtual ~FdCharDriver();
+
+    int Write(const uint8_t *buf, int len) override;
+    void AcceptInput() override;
+    void Stop() override;
+
+    // IOCTLs
+    void SetBreakEnable(bool breakEnable) override;
+    void SetSerialParameters(SerialParams *params) override;
+
+    // Number of bytes dropped because the output buffer was full
+    uint64_t GetDroppedBytes() const { return m_dropped; }
+
+protected:
+    CharEventLoop *m_loop;
+
+    // Starts transferring data through the specified file descriptor, which
+    // is made non-blocking and is owned by the driver from then on
+    bool Connect(int fd);
+
+    // Stops transferring data and closes the file descriptor
+    void Disconnect();
+
+    bool IsConnected() const { return m_fd >= 0; }
+    int GetFd() const { return m_fd; }
+
+    // Invoked from the event loop when the host end is closed or fails. By
+    // default, disconnects and notifies the receiver.
+    virtual void OnHangup();
+
+    // Invoked from the event loop for other file descriptors watched by the
+    // driver
+    virtual void OnEvent(int fd, uint32_t events) {}
+
+private:
+    void HandleEvent(int fd, uint32_t events) override;
+    void Service() override;
+
+    void ReadInput();
+    void DeliverInput();
+    void Flush();
+    void UpdateEvents();
+
+    int m_fd = -1;
+    bool m_pollable = false;
+    bool m_socket = false;
+    uint32_t m_events = 0;
+
+    // Output handed over by Write; guarded by m_outMutex along with
+    // m_connected
+    std::mutex m_outMutex;
+    std::vector<uint8_t> m_outBuf;
+    bool m_connected = false;
+
+    // Output being written by the event loop
+    std::vector<uint8_t> m_sending;
+    size_t m_sendPos = 0;
+
+    // Input read from the host that wasn't delivered yet
+    uint8_t m_inBuf[CHAR_FD_READ_SIZE];
+    int m_inPos = 0;
+    int m_inLen = 0;
+    std::atomic<bool> m_inputPending{ false };
+
+    std::atomic<uint64_t> m_dropped{ 0 };
+};
+
+}
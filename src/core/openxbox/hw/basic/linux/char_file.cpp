@@ -0,0 +1,40 @@
+#ifdef __linux__
+
+#include "char_file.h"
+
+#include "openxbox/log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace openxbox {
+
+FileCharDriver::FileCharDriver(CharEventLoop *loop, const char *path)
+    : FdCharDriver(loop)
+    , m_path(path)
+{
+}
+
+FileCharDriver::~FileCharDriver() {
+    Stop();
+}
+
+bool FileCharDriver::Init() {
+    int fd = open(m_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        log_warning("FileCharDriver: Could not open %s: %s\n", m_path.c_str(), strerror(errno));
+        return false;
+    }
+    if (!Connect(fd)) {
+        return false;
+    }
+    log_info("FileCharDriver: Writing serial output to %s\n", m_path.c_str());
+    Event(CHR_EVENT_OPENED);
+    return true;
+}
+
+}
+
+#endif // __linux__
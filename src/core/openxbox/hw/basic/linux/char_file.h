@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+
+#include "char_fd.h"
+
+namespace openxbox {
+
+/*!
+ * Character driver that appends the output of the serial port to a file.
+ * The serial port receives no input.
+ */
+class FileCharDriver : public FdCharDriver {
+public:
+    FileCharDriver(CharEventLoop *loop, const char *path);
+    virtual ~FileCharDriver();
+
+    bool Init() override;
+
+private:
+    std::string m_path;
+};
+
+}
@@ -0,0 +1,197 @@
+#ifdef __linux__
+
+#include "char_loop.h"
+
+#include "openxbox/log.h"
+#include "openxbox/thread.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace openxbox {
+
+// Events retrieved with every call to epoll_wait
+#define CHAR_LOOP_MAX_EVENTS  32
+
+CharEventLoop::CharEventLoop() {
+}
+
+CharEventLoop::~CharEventLoop() {
+    Stop();
+}
+
+bool CharEventLoop::Start() {
+    if (m_running) {
+        return true;
+    }
+
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epollFd < 0) {
+        log_warning("CharEventLoop: Could not create epoll instance: %s\n", strerror(errno));
+        return false;
+    }
+    m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wakeFd < 0) {
+        log_warning("CharEventLoop: Could not create wake up event: %s\n", strerror(errno));
+        close(m_epollFd);
+        m_epollFd = -1;
+        return false;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = m_wakeFd;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeFd, &ev);
+
+    m_running = true;
+    m_thread = std::thread(LoopThread, this);
+    return true;
+}
+
+void CharEventLoop::Stop() {
+    if (!m_running) {
+        return;
+    }
+
+    m_running = false;
+    uint64_t one = 1;
+    if (write(m_wakeFd, &one, sizeof(one)) < 0) {
+        // The counter is already nonzero, so the thread will wake up anyway
+    }
+    m_thread.join();
+
+    close(m_wakeFd);
+    close(m_epollFd);
+    m_wakeFd = -1;
+    m_epollFd = -1;
+}
+
+void CharEventLoop::Register(ICharEventHandler *handler) {
+    std::lock_guard<std::recursive_mutex> lk(m_dispatchMutex);
+    if (!IsRegistered(handler)) {
+        m_handlers.push_back(handler);
+    }
+}
+
+void CharEventLoop::Unregister(ICharEventHandler *handler) {
+    std::lock_guard<std::recursive_mutex> lk(m_dispatchMutex);
+    for (auto it = m_fds.begin(); it != m_fds.end();) {
+        if (it->second == handler) {
+            epoll_ctl(m_epollFd, EPOLL_CTL_DEL, it->first, nullptr);
+            it = m_fds.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    m_handlers.erase(std::remove(m_handlers.begin(), m_handlers.end(), handler), m_handlers.end());
+
+    std::lock_guard<std::mutex> plk(m_pendingMutex);
+    m_pending.erase(std::remove(m_pending.begin(), m_pending.end(), handler), m_pending.end());
+}
+
+bool CharEventLoop::Watch(int fd, ICharEventHandler *handler, uint32_t events) {
+    std::lock_guard<std::recursive_mutex> lk(m_dispatchMutex);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        log_warning("CharEventLoop: Could not watch file descriptor %d: %s\n", fd, strerror(errno));
+        return false;
+    }
+    m_fds[fd] = handler;
+    return true;
+}
+
+bool CharEventLoop::Modify(int fd, uint32_t events) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    return epoll_ctl(m_epollFd, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+void CharEventLoop::Unwatch(int fd) {
+    std::lock_guard<std::recursive_mutex> lk(m_dispatchMutex);
+    if (m_fds.erase(fd) > 0) {
+        epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+}
+
+void CharEventLoop::Wake(ICharEventHandler *handler) {
+    std::lock_guard<std::mutex> lk(m_pendingMutex);
+    if (std::find(m_pending.begin(), m_pending.end(), handler) != m_pending.end()) {
+        return;
+    }
+    m_pending.push_back(handler);
+    if (m_pending.size() == 1) {
+        uint64_t one = 1;
+        if (write(m_wakeFd, &one, sizeof(one)) < 0) {
+            // The counter is already nonzero, so the thread will wake up anyway
+        }
+    }
+}
+
+// Must be called with m_dispatchMutex held
+bool CharEventLoop::IsRegistered(ICharEventHandler *handler) const {
+    return std::find(m_handlers.begin(), m_handlers.end(), handler) != m_handlers.end();
+}
+
+void CharEventLoop::LoopThread(CharEventLoop *loop) {
+    Thread_SetName("[HW] Char I/O");
+    loop->Run();
+}
+
+void CharEventLoop::Run() {
+    struct epoll_event events[CHAR_LOOP_MAX_EVENTS];
+    std::vector<ICharEventHandler *> pending;
+
+    while (m_running) {
+        int count = epoll_wait(m_epollFd, events, CHAR_LOOP_MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno != EINTR) {
+                log_warning("CharEventLoop: epoll_wait failed: %s\n", strerror(errno));
+                break;
+            }
+            continue;
+        }
+
+        std::lock_guard<std::recursive_mutex> lk(m_dispatchMutex);
+        for (int i = 0; i < count; i++) {
+            int fd = events[i].data.fd;
+            if (fd == m_wakeFd) {
+                uint64_t value;
+                if (read(m_wakeFd, &value, sizeof(value)) < 0) {
+                    // Spurious wake up
+                }
+                std::lock_guard<std::mutex> plk(m_pendingMutex);
+                pending.swap(m_pending);
+                continue;
+            }
+
+            // The file descriptor may have been unwatched by a handler invoked
+            // earlier in this batch
+            auto it = m_fds.find(fd);
+            if (it != m_fds.end()) {
+                it->second->HandleEvent(fd, events[i].events);
+            }
+        }
+
+        for (ICharEventHandler *handler : pending) {
+            if (IsRegistered(handler)) {
+                handler->Service();
+            }
+        }
+        pending.clear();
+    }
+}
+
+}
+
+#endif // __linux__
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace openxbox {
+
+/*!
+ * Receives the events of the file descriptors watched by a CharEventLoop.
+ * All methods are invoked from the event loop thread.
+ */
+class ICharEventHandler {
+public:
+    virtual ~ICharEventHandler() {}
+
+    // One of the file descriptors of the handler is ready; events is a set of
+    // EPOLL* flags
+    virtual void HandleEvent(int fd, uint32_t events) = 0;
+
+    // The handler asked to be serviced with CharEventLoop::Wake
+    virtual void Service() = 0;
+};
+
+/*!
+ * Multiplexes the I/O of the host character drivers on a single thread with
+ * epoll.
+ *
+ * Handlers register themselves with the loop and then ask it to watch any
+ * number of non-blocking file descriptors. Other threads hand work to a
+ * handler by calling Wake, which makes the loop call Service as soon as
+ * possible without blocking the caller.
+ *
+ * Event loops are only supported on Linux.
+ */
+class CharEventLoop {
+public:
+    CharEventLoop();
+    ~CharEventLoop();
+
+    bool Start();
+    void Stop();
+
+    // Handlers must be registered before watching file descriptors, and are
+    // guaranteed not to be invoked again once Unregister returns. Unregister
+    // also stops watching all file descriptors of the handler.
+    void Register(ICharEventHandler *handler);
+    void Unregister(ICharEventHandler *handler);
+
+    // Starts, changes or stops watching the specified file descriptor
+    bool Watch(int fd, ICharEventHandler *handler, uint32_t events);
+    bool Modify(int fd, uint32_t events);
+    void Unwatch(int fd);
+
+    // Schedules a call to the handler's Service method
+    void Wake(ICharEventHandler *handler);
+
+private:
+    static void LoopThread(CharEventLoop *loop);
+    void Run();
+    bool IsRegistered(ICharEventHandler *handler) const;
+
+    int m_epollFd = -1;
+    int m_wakeFd = -1;
+
+    // Held while handlers are invoked; recursive so that handlers can watch
+    // and unwatch file descriptors
+    std::recursive_mutex m_dispatchMutex;
+    std::vector<ICharEventHandler *> m_handlers;
+    std::map<int, ICharEventHandler *> m_fds;
+
+    // Handlers waiting to be serviced
+    std::mutex m_pendingMutex;
+    std::vector<ICharEventHandler *> m_pending;
+
+    std::thread m_thread;
+    std::atomic<bool> m_running{ false };
+};
+
+}
@@ -0,0 +1,75 @@
+#ifdef __linux__
+
+#include "char_pty.h"
+
+#include "openxbox/log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace openxbox {
+
+PtyCharDriver::PtyCharDriver(CharEventLoop *loop)
+    : FdCharDriver(loop)
+{
+}
+
+PtyCharDriver::~PtyCharDriver() {
+    Stop();
+}
+
+bool PtyCharDriver::Init() {
+    int fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0) {
+        log_warning("PtyCharDriver: Could not open a pseudo terminal: %s\n", strerror(errno));
+        return false;
+    }
+
+    char path[64];
+    if (grantpt(fd) < 0 || unlockpt(fd) < 0 || ptsname_r(fd, path, sizeof(path)) != 0) {
+        log_warning("PtyCharDriver: Could not set up the pseudo terminal: %s\n", strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    // Holding the terminal open keeps the master from hanging up whenever
+    // no program is attached to it
+    m_slaveFd = open(path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (m_slaveFd < 0) {
+        log_warning("PtyCharDriver: Could not open %s: %s\n", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    // Pass the data through untouched
+    struct termios tio;
+    tcgetattr(m_slaveFd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(m_slaveFd, TCSANOW, &tio);
+
+    if (!Connect(fd)) {
+        close(m_slaveFd);
+        m_slaveFd = -1;
+        return false;
+    }
+    m_path = path;
+    log_info("PtyCharDriver: Serial port available at %s\n", m_path.c_str());
+    Event(CHR_EVENT_OPENED);
+    return true;
+}
+
+void PtyCharDriver::Stop() {
+    FdCharDriver::Stop();
+    if (m_slaveFd >= 0) {
+        close(m_slaveFd);
+        m_slaveFd = -1;
+    }
+}
+
+}
+
+#endif // __linux__
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+
+#include "char_fd.h"
+
+namespace openxbox {
+
+/*!
+ * Character driver that exposes the serial port as a host pseudo terminal.
+ *
+ * The path of the terminal is logged when the driver is initialized and can
+ * be opened with any terminal program. The driver keeps the terminal open
+ * itself so that programs can attach and detach at will; output produced
+ * while no program is attached is buffered by the host up to its limits.
+ */
+class PtyCharDriver : public FdCharDriver {
+public:
+    PtyCharDriver(CharEventLoop *loop);
+    virtual ~PtyCharDriver();
+
+    bool Init() override;
+    void Stop() override;
+
+    // Path of the terminal, such as /dev/pts/3
+    const char *GetPath() const { return m_path.c_str(); }
+
+private:
+    std::string m_path;
+    int m_slaveFd = -1;
+};
+
+}
@@ -0,0 +1,140 @@
+#ifdef __linux__
+
+#include "char_serial.h"
+
+#include "openxbox/log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace openxbox {
+
+static const struct {
+    int baudRate;
+    speed_t speed;
+} kBaudRates[] = {
+    { 50, B50 }, { 75, B75 }, { 110, B110 }, { 134, B134 }, { 150, B150 },
+    { 200, B200 }, { 300, B300 }, { 600, B600 }, { 1200, B1200 },
+    { 1800, B1800 }, { 2400, B2400 }, { 4800, B4800 }, { 9600, B9600 },
+    { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 },
+    { 115200, B115200 },
+};
+
+// Returns the fastest host baud rate that doesn't exceed the specified rate
+static speed_t ToSpeed(int baudRate) {
+    speed_t speed = kBaudRates[0].speed;
+    for (auto& entry : kBaudRates) {
+        if (entry.baudRate <= baudRate) {
+            speed = entry.speed;
+        }
+    }
+    return speed;
+}
+
+LinuxSerialDriver::LinuxSerialDriver(CharEventLoop *loop, uint8_t portNum)
+    : FdCharDriver(loop)
+{
+    m_path = "/dev/ttyS" + std::to_string(portNum > 0 ? portNum - 1 : 0);
+}
+
+LinuxSerialDriver::~LinuxSerialDriver() {
+    Stop();
+}
+
+bool LinuxSerialDriver::Init() {
+    int fd = open(m_path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        log_warning("LinuxSerialDriver: Could not open %s: %s\n", m_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct termios tio;
+    if (tcgetattr(fd, &tio) < 0) {
+        log_warning("LinuxSerialDriver: %s is not a terminal\n", m_path.c_str());
+        close(fd);
+        return false;
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tcsetattr(fd, TCSANOW, &tio);
+
+    if (!Connect(fd)) {
+        return false;
+    }
+    log_info("LinuxSerialDriver: Connected to %s\n", m_path.c_str());
+    Event(CHR_EVENT_OPENED);
+    return true;
+}
+
+void LinuxSerialDriver::Stop() {
+    // Make sure the event loop is done with the port before closing it
+    m_loop->Unregister(this);
+    std::lock_guard<std::mutex> lk(m_configMutex);
+    Disconnect();
+}
+
+void LinuxSerialDriver::OnHangup() {
+    // Notify the receiver without holding the lock, as it may be changing the
+    // port configuration at the same time
+    {
+        std::lock_guard<std::mutex> lk(m_configMutex);
+        Disconnect();
+    }
+    Event(CHR_EVENT_CLOSED);
+}
+
+// ----- IOCTLs ---------------------------------------------------------------
+
+void LinuxSerialDriver::SetBreakEnable(bool breakEnable) {
+    std::lock_guard<std::mutex> lk(m_configMutex);
+    if (IsConnected()) {
+        ioctl(GetFd(), breakEnable ? TIOCSBRK : TIOCCBRK);
+    }
+}
+
+void LinuxSerialDriver::SetSerialParameters(SerialParams *params) {
+    log_debug("LinuxSerialDriver::SetSerialParameters: Serial port configuration\n");
+    log_debug("  Baud rate: %u bps\n", params->baudRate / params->divider);
+    log_debug("  Data bits: %u\n", params->dataBits);
+    log_debug("  Parity: %c\n", params->parity);
+    log_debug("  Stop bits: %u\n", params->stopBits);
+
+    std::lock_guard<std::mutex> lk(m_configMutex);
+    if (!IsConnected()) {
+        return;
+    }
+
+    struct termios tio;
+    if (tcgetattr(GetFd(), &tio) < 0) {
+        return;
+    }
+
+    speed_t speed = ToSpeed(params->baudRate / params->divider);
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+
+    tio.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB);
+    switch (params->dataBits) {
+    case 5: tio.c_cflag |= CS5; break;
+    case 6: tio.c_cflag |= CS6; break;
+    case 7: tio.c_cflag |= CS7; break;
+    default: tio.c_cflag |= CS8; break;
+    }
+    switch (params->parity) {
+    case 'E': tio.c_cflag |= PARENB; break;
+    case 'O': tio.c_cflag |= PARENB | PARODD; break;
+    }
+    if (params->stopBits == 2) {
+        tio.c_cflag |= CSTOPB;
+    }
+
+    tcsetattr(GetFd(), TCSANOW, &tio);
+}
+
+}
+
+#endif // __linux__
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+
+#include "char_fd.h"
+
+namespace openxbox {
+
+/*!
+ * Character driver that connects the serial port to a host serial port.
+ *
+ * The line parameters and break condition programmed by the guest are
+ * applied to the host port.
+ */
+class LinuxSerialDriver : public FdCharDriver {
+public:
+    // Opens /dev/ttyS<portNum - 1>, numbering ports from 1 like COM ports
+    LinuxSerialDriver(CharEventLoop *loop, uint8_t portNum);
+    virtual ~LinuxSerialDriver();
+
+    bool Init() override;
+    void Stop() override;
+
+    // IOCTLs
+    void SetBreakEnable(bool breakEnable) override;
+    void SetSerialParameters(SerialParams *params) override;
+
+protected:
+    void OnHangup() override;
+
+private:
+    std::string m_path;
+
+    // Guards the configuration of the host port against the event loop
+    // closing it
+    std::mutex m_configMutex;
+};
+
+}
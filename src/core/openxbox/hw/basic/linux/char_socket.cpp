@@ -0,0 +1,197 @@
+#ifdef __linux__
+
+#include "char_socket.h"
+
+#include "openxbox/log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace openxbox {
+
+SocketCharDriver::SocketCharDriver(CharEventLoop *loop, const char *host, uint16_t port, bool server)
+    : FdCharDriver(loop)
+    , m_unix(false)
+    , m_server(server)
+    , m_host(host != nullptr ? host : "")
+    , m_port(port)
+{
+    m_description = "tcp:" + m_host + ":" + std::to_string(port);
+}
+
+SocketCharDriver::SocketCharDriver(CharEventLoop *loop, const char *path, bool server)
+    : FdCharDriver(loop)
+    , m_unix(true)
+    , m_server(server)
+    , m_host(path)
+{
+    m_description = "unix:" + m_host;
+}
+
+SocketCharDriver::~SocketCharDriver() {
+    Stop();
+}
+
+bool SocketCharDriver::Init() {
+    int fd = m_unix ? OpenUnix() : OpenTCP();
+    if (fd < 0) {
+        return false;
+    }
+
+    if (m_server) {
+        m_listenFd = fd;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        if (!m_loop->Watch(fd, this, EPOLLIN)) {
+            Stop();
+            return false;
+        }
+        log_info("SocketCharDriver: Waiting for connections on %s\n", m_description.c_str());
+        return true;
+    }
+
+    if (!Connect(fd)) {
+        return false;
+    }
+    log_info("SocketCharDriver: Connected to %s\n", m_description.c_str());
+    Event(CHR_EVENT_OPENED);
+    return true;
+}
+
+void SocketCharDriver::Stop() {
+    FdCharDriver::Stop();
+    if (m_listenFd >= 0) {
+        close(m_listenFd);
+        m_listenFd = -1;
+        if (m_unix) {
+            unlink(m_host.c_str());
+        }
+    }
+}
+
+void SocketCharDriver::OnHangup() {
+    FdCharDriver::OnHangup();
+    if (m_server) {
+        log_info("SocketCharDriver: Client disconnected from %s\n", m_description.c_str());
+    }
+    else {
+        log_info("SocketCharDriver: Connection to %s closed\n", m_description.c_str());
+    }
+}
+
+void SocketCharDriver::OnEvent(int fd, uint32_t events) {
+    if (fd != m_listenFd) {
+        return;
+    }
+
+    int client = accept4(m_listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client < 0) {
+        return;
+    }
+    if (IsConnected()) {
+        // Only one client at a time
+        log_debug("SocketCharDriver: Rejecting connection on %s\n", m_description.c_str());
+        close(client);
+        return;
+    }
+
+    if (!m_unix) {
+        int one = 1;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    if (Connect(client)) {
+        log_info("SocketCharDriver: Client connected to %s\n", m_description.c_str());
+        Event(CHR_EVENT_OPENED);
+    }
+}
+
+int SocketCharDriver::OpenTCP() {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = m_server ? AI_PASSIVE : 0;
+
+    struct addrinfo *addrs;
+    std::string port = std::to_string(m_port);
+    int err = getaddrinfo(m_host.empty() ? nullptr : m_host.c_str(), port.c_str(), &hints, &addrs);
+    if (err != 0) {
+        log_warning("SocketCharDriver: Could not resolve %s: %s\n", m_description.c_str(), gai_strerror(err));
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *addr = addrs; addr != nullptr && fd < 0; addr = addr->ai_next) {
+        fd = socket(addr->ai_family, addr->ai_socktype | SOCK_CLOEXEC, addr->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+
+        bool ok;
+        if (m_server) {
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            ok = bind(fd, addr->ai_addr, addr->ai_addrlen) == 0 && listen(fd, 1) == 0;
+        }
+        else {
+            ok = connect(fd, addr->ai_addr, addr->ai_addrlen) == 0;
+            if (ok) {
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            }
+        }
+        if (!ok) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd < 0) {
+        log_warning("SocketCharDriver: Could not %s %s: %s\n", m_server ? "listen on" : "connect to", m_description.c_str(), strerror(errno));
+    }
+    freeaddrinfo(addrs);
+    return fd;
+}
+
+int SocketCharDriver::OpenUnix() {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (m_host.size() >= sizeof(addr.sun_path)) {
+        log_warning("SocketCharDriver: Socket path is too long: %s\n", m_host.c_str());
+        return -1;
+    }
+    strcpy(addr.sun_path, m_host.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_warning("SocketCharDriver: Could not create socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    bool ok;
+    if (m_server) {
+        // Replace the socket left behind by a previous run
+        unlink(addr.sun_path);
+        ok = bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 && listen(fd, 1) == 0;
+    }
+    else {
+        ok = connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    }
+    if (!ok) {
+        log_warning("SocketCharDriver: Could not %s %s: %s\n", m_server ? "listen on" : "connect to", m_description.c_str(), strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+}
+
+#endif // __linux__
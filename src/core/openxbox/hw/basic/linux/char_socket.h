@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+
+#include "char_fd.h"
+
+namespace openxbox {
+
+/*!
+ * Character driver that connects the serial port to a TCP or Unix domain
+ * stream socket.
+ *
+ * In server mode, the driver listens for connections and serves one client
+ * at a time; output is discarded while no client is connected, and the
+ * driver goes back to waiting for clients when one disconnects. In client
+ * mode, the driver connects once on initialization.
+ */
+class SocketCharDriver : public FdCharDriver {
+public:
+    // TCP socket. Servers listen on all interfaces if host is nullptr.
+    SocketCharDriver(CharEventLoop *loop, const char *host, uint16_t port, bool server);
+    // Unix domain socket
+    SocketCharDriver(CharEventLoop *loop, const char *path, bool server);
+    virtual ~SocketCharDriver();
+
+    bool Init() override;
+    void Stop() override;
+
+protected:
+    void OnHangup() override;
+    void OnEvent(int fd, uint32_t events) override;
+
+private:
+    bool m_unix;
+    bool m_server;
+    std::string m_host;
+    uint16_t m_port = 0;
+    std::string m_description;
+
+    int m_listenFd = -1;
+
+    int OpenTCP();
+    int OpenUnix();
+};
+
+}
@@ -31,6 +31,8 @@
 #include "openxbox/log.h"
 #include "openxbox/io.h"
 
+#include <algorithm>
+
 namespace openxbox {
 
 
@@ -98,6 +100,10 @@ namespace openxbox {
 
 #define MAX_XMIT_RETRY      4
 
+// Shortest delay worth setting a timer for in burst mode, in nanoseconds.
+// Bursts that take less time than this to shift out complete immediately.
+#define MIN_BURST_DELAY     50000
+
 #define SEC_TO_NANO   1000000000ULL
 
 static inline uint64_t GetNanos() {
@@ -105,23 +111,39 @@ static inline uint64_t GetNanos() {
 }
 
 int Serial::CanReceiveCB(void *userData) {
-    return ((Serial *)userData)->CanReceive();
+    Serial *serial = (Serial *)userData;
+    std::lock_guard<std::mutex> lk(serial->m_mutex);
+    return serial->CanReceive();
 }
 
 void Serial::ReceiveCB(void *userData, const uint8_t *buf, int size) {
-    ((Serial *)userData)->Receive(buf, size);
+    Serial *serial = (Serial *)userData;
+    std::lock_guard<std::mutex> lk(serial->m_mutex);
+    serial->Receive(buf, size);
 }
 
 void Serial::EventCB(void *userData, int event) {
-    ((Serial *)userData)->Event(event);
+    Serial *serial = (Serial *)userData;
+    std::lock_guard<std::mutex> lk(serial->m_mutex);
+    serial->Event(event);
 }
 
 void Serial::UpdateMSLCB(void *userData) {
-    ((Serial *)userData)->UpdateMSL();
+    Serial *serial = (Serial *)userData;
+    std::lock_guard<std::mutex> lk(serial->m_mutex);
+    serial->UpdateMSL();
 }
 
 void Serial::FifoTimeoutInterruptCB(void *userData) {
-    ((Serial *)userData)->FifoTimeoutInterrupt();
+    Serial *serial = (Serial *)userData;
+    std::lock_guard<std::mutex> lk(serial->m_mutex);
+    serial->FifoTimeoutInterrupt();
+}
+
+void Serial::XmitTimerCB(void *userData) {
+    Serial *serial = (Serial *)userData;
+    std::lock_guard<std::mutex> lk(serial->m_mutex);
+    serial->XmitTimer();
 }
 
 Serial::Serial(IRQHandler *irqHandler, uint32_t ioBase)
@@ -131,8 +153,9 @@ Serial::Serial(IRQHandler *irqHandler, uint32_t ioBase)
     m_recvFifo = new Fifo<uint8_t>(UART_FIFO_LENGTH);
     m_xmitFifo = new Fifo<uint8_t>(UART_FIFO_LENGTH);
 
-    m_fifoTimeoutTimer = new InvokeLater(UpdateMSLCB, this);
-    m_modemStatusPoll = new InvokeLater(FifoTimeoutInterruptCB, this);
+    m_fifoTimeoutTimer = new InvokeLater(FifoTimeoutInterruptCB, this);
+    m_modemStatusPoll = new InvokeLater(UpdateMSLCB, this);
+    m_xmitTimer = new InvokeLater(XmitTimerCB, this);
 
     m_baudbase = 115200;
     m_active = false;
@@ -145,9 +168,11 @@ Serial::Serial(IRQHandler *irqHandler, uint32_t ioBase)
 Serial::~Serial() {
     m_fifoTimeoutTimer->Stop();
     m_modemStatusPoll->Stop();
+    m_xmitTimer->Stop();
 
     delete m_fifoTimeoutTimer;
     delete m_modemStatusPoll;
+    delete m_xmitTimer;
     delete m_recvFifo;
     delete m_xmitFifo;
 }
@@ -167,6 +192,7 @@ bool Serial::Init(CharDriver *chr) {
     
     m_fifoTimeoutTimer->Start();
     m_modemStatusPoll->Start();
+    m_xmitTimer->Start();
 
     return true;
 }
@@ -193,6 +219,10 @@ void Serial::Reset() {
 
     m_thr_ipending = 0;
     m_lastBreakEnable = 0;
+
+    m_xmitTimer->Cancel();
+    m_xmitBusy = false;
+    m_xmitBurstLen = 0;
 }
 
 void Serial::Stop() {
@@ -206,6 +236,12 @@ bool Serial::MapIO(IOMapper *mapper) {
 }
 
 bool Serial::IORead(uint32_t port, uint32_t *value, uint8_t size) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (m_xmitBusy && m_xmitBurstLen == 0) {
+        // The guest is done filling the FIFO
+        TransmitBurst();
+    }
+
     port &= 7;
     switch (port) {
     default:
@@ -248,8 +284,13 @@ bool Serial::IORead(uint32_t port, uint32_t *value, uint8_t size) {
 #endif
             }
             UpdateIRQ();
-            if (!(m_mcr & UART_MCR_LOOP)) {
+            if (m_mcr & UART_MCR_LOOP) {
                 // In loopback mode, don't receive any data
+            }
+            else if (m_burstMode && (m_fcr & UART_FCR_FE) && !m_recvFifo->IsEmpty()) {
+                // In burst mode, wait until the guest drains the FIFO
+            }
+            else {
                 m_chr->AcceptInput();
             }
         }
@@ -311,6 +352,7 @@ bool Serial::IORead(uint32_t port, uint32_t *value, uint8_t size) {
 }
 
 bool Serial::IOWrite(uint32_t port, uint32_t value, uint8_t size) {
+    std::lock_guard<std::mutex> lk(m_mutex);
     port &= 7;
     switch (port) {
     default:
@@ -332,7 +374,21 @@ bool Serial::IOWrite(uint32_t port, uint32_t value, uint8_t size) {
             m_thr_ipending = 0;
             m_lsr &= ~UART_LSR_THRE;
             UpdateIRQ();
-            Transmit();
+            if (m_burstMode && (m_fcr & UART_FCR_FE)) {
+                if (!m_xmitBusy) {
+                    // Give the guest the time it takes to shift out the first
+                    // character to fill the FIFO
+                    m_xmitBusy = true;
+                    m_xmitBurstLen = 0;
+                    ScheduleXmit(GetNanos() + std::max<uint64_t>(m_charTransmitTime, MIN_BURST_DELAY));
+                }
+                else if (m_xmitBurstLen == 0 && m_xmitFifo->IsFull()) {
+                    TransmitBurst();
+                }
+            }
+            else {
+                Transmit();
+            }
         }
         break;
     case 1:
@@ -532,9 +588,95 @@ void Serial::Transmit() {
     }
 }
 
+void Serial::TransmitBurst() {
+    uint8_t buf[UART_FIFO_LENGTH];
+    int len = 0;
+    while (!m_xmitFifo->IsEmpty()) {
+        m_xmitFifo->Pop(&buf[len++]);
+    }
+
+    if (len == 0) {
+        // The FIFO was reset while collecting characters
+        m_xmitBusy = false;
+        m_xmitBurstLen = 0;
+        if (!(m_lsr & UART_LSR_THRE)) {
+            m_thr_ipending = 1;
+        }
+        m_lsr |= UART_LSR_THRE | UART_LSR_TEMT;
+        UpdateIRQ();
+        return;
+    }
+
+    if (m_mcr & UART_MCR_LOOP) {
+        // in loopback mode, say that we just received the characters
+        Receive(buf, len);
+    }
+    else {
+        // Character drivers buffer whatever the host can't take right away,
+        // so partial writes are not retried
+        m_chr->Write(buf, len);
+    }
+    uint64_t now = GetNanos();
+    m_lastXmitTs = now;
+
+    // The FIFO can be refilled while the burst is shifted out. Back-to-back
+    // bursts are scheduled from the end of the previous one so that timer
+    // latency doesn't slow down the line, unless we're too far behind.
+    uint64_t shiftTime = m_charTransmitTime * len;
+    uint64_t start = now;
+    if (m_xmitBurstLen > 0 && now - m_xmitDeadline < shiftTime) {
+        start = m_xmitDeadline;
+    }
+    if (shiftTime < MIN_BURST_DELAY) {
+        // Too fast to bother with the timer
+        m_xmitBusy = false;
+        m_xmitBurstLen = 0;
+        m_lsr |= UART_LSR_THRE | UART_LSR_TEMT;
+    }
+    else {
+        m_xmitBusy = true;
+        m_xmitBurstLen = len;
+        m_lsr |= UART_LSR_THRE;
+        ScheduleXmit(start + shiftTime);
+    }
+    m_thr_ipending = 1;
+    UpdateIRQ();
+}
+
+void Serial::ScheduleXmit(uint64_t deadline) {
+    std::chrono::high_resolution_clock::time_point target{ std::chrono::nanoseconds(deadline) };
+    m_xmitDeadline = deadline;
+    m_xmitTimer->Set(target);
+}
+
+void Serial::XmitTimer() {
+    // The timer may have been cancelled or rescheduled while the callback was
+    // waiting for the lock
+    if (!m_xmitBusy || GetNanos() < m_xmitDeadline) {
+        return;
+    }
+
+    if (m_xmitBurstLen == 0 || !m_xmitFifo->IsEmpty()) {
+        // Send the characters collected so far
+        TransmitBurst();
+    }
+    else {
+        // The last burst has been shifted out
+        m_xmitBusy = false;
+        m_xmitBurstLen = 0;
+        m_lsr |= UART_LSR_TEMT;
+    }
+}
+
 int Serial::CanReceive() {
     if (m_fcr & UART_FCR_FE) {
         if (m_recvFifo->Count() < UART_FIFO_LENGTH) {
+            if (m_burstMode) {
+                // Take as much as the FIFO can hold; the data available
+                // interrupt is still raised at the trigger level and the
+                // timeout interrupt takes care of the rest
+                return UART_FIFO_LENGTH - m_recvFifo->Count();
+            }
             // Advertise (fifo.itl - fifo.count) bytes when count < ITL, and 1
             // if above. If UART_FIFO_LENGTH - fifo.count is advertised the
             // effect will be to almost always fill the fifo completely before
@@ -698,7 +840,7 @@ void Serial::UpdateParameters() {
     params.baudRate = m_baudbase;
     params.divider = m_divider;
     frameSize += params.dataBits + params.stopBits;
-    m_charTransmitTime = (GetNanos() / params.baudRate / m_divider) * frameSize;
+    m_charTransmitTime = SEC_TO_NANO * m_divider * frameSize / params.baudRate;
     m_chr->SetSerialParameters(&params);
 }
 
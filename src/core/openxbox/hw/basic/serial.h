@@ -9,6 +9,7 @@
 #include "../basic/irq.h"
 
 #include <chrono>
+#include <mutex>
 
 namespace openxbox {
 
@@ -20,6 +21,19 @@ namespace openxbox {
 #define PORT_SERIAL_COUNT    7
 
 
+/*!
+ * 16550A UART emulation.
+ *
+ * By default, characters are handed to the character driver one at a time
+ * as the guest writes them. In burst mode, the transmitter moves the whole
+ * contents of the transmit FIFO to the character driver at once and then
+ * stays busy for as long as the real UART would take to shift them out, so
+ * the character driver and the timer are invoked once per burst instead of
+ * once per character. The receiver accepts as many characters as the FIFO
+ * can hold, raising the data available interrupt at the trigger level and
+ * the character timeout interrupt for leftovers. Burst mode only applies
+ * while the FIFOs are enabled.
+ */
 class Serial : public IODevice {
 public:
     Serial(IRQHandler *irqHandler, uint32_t ioBase);
@@ -31,6 +45,7 @@ public:
     
     inline void SetIRQ(uint8_t irq) { m_irq = irq; }
     inline void SetBaudBase(int baudBase) { m_baudbase = baudBase; }
+    inline void SetBurstMode(bool burstMode) { m_burstMode = burstMode; }
 
     bool MapIO(IOMapper *mapper);
 
@@ -48,6 +63,9 @@ private:
 
     void RecvFifoPut(uint8_t chr);
     void Transmit();
+    void TransmitBurst();
+    void ScheduleXmit(uint64_t deadline);
+    void XmitTimer();
 
     void FifoTimeoutInterrupt();
     
@@ -60,6 +78,10 @@ private:
     static void EventCB(void *userData, int event);
     static void UpdateMSLCB(void *userData);
     static void FifoTimeoutInterruptCB(void *userData);
+    static void XmitTimerCB(void *userData);
+
+    // Serializes accesses from the CPU, the character driver and the timers
+    std::mutex m_mutex;
 
     IRQHandler *m_irqHandler;
     uint32_t m_ioBase;
@@ -102,6 +124,15 @@ private:
 
     InvokeLater *m_modemStatusPoll;
 
+    bool m_burstMode = false;
+    // Burst mode transmitter state: busy while collecting characters for a
+    // burst (m_xmitBurstLen == 0) or shifting out a burst of m_xmitBurstLen
+    // characters
+    bool m_xmitBusy = false;
+    uint8_t m_xmitBurstLen = 0;
+    uint64_t m_xmitDeadline = 0;
+    InvokeLater *m_xmitTimer;
+
     int lastDir = -1;
 };
 
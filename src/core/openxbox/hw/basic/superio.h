@@ -43,7 +43,7 @@ namespace openxbox {
 
 class SuperIO : public IODevice {
 public:
-    SuperIO(IRQHandler *irqHandler, CharDriver *chrs[SUPERIO_SERIAL_PORT_COUNT]);
+    SuperIO(IRQHandler *irqHandler, CharDriver *chrs[SUPERIO_SERIAL_PORT_COUNT], bool serialBurstMode);
     virtual ~SuperIO();
 
     void Init();
@@ -0,0 +1,25 @@
+#include "net_backend.h"
+
+namespace openxbox {
+namespace hw {
+namespace net {
+
+bool deliverFrame(INetReceiver *receiver, const IoVec *buffers, unsigned int bufferCount, uint32_t length) {
+    uint8_t *buffer;
+    uint32_t capacity;
+    if (!receiver->BeginReceive(&buffer, &capacity)) {
+        return false;
+    }
+    if (length > capacity) {
+        receiver->EndReceive(0);
+        return false;
+    }
+
+    IoVecTobuffer(buffers, bufferCount, 0, buffer, length);
+    receiver->EndReceive(length);
+    return true;
+}
+
+}
+}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+
+#include "openxbox/iovec.h"
+
+namespace openxbox {
+namespace hw {
+namespace net {
+
+// Largest Ethernet frame exchanged with backends, including the header and
+// a VLAN tag but not the FCS
+const uint32_t kMaxFrameSize = 1518;
+
+/*!
+ * Interface for a network controller that accepts frames from a backend.
+ *
+ * Frames are written directly into buffers owned by the receiver: the
+ * backend reserves a buffer with BeginReceive, fills it in and hands it over
+ * with EndReceive. Both calls must be made from the same thread, and the
+ * receiver stays locked in between, so backends must not block while holding
+ * a buffer.
+ */
+class INetReceiver {
+public:
+    virtual ~INetReceiver() {}
+
+    // Returns true if a receive buffer is available
+    virtual bool CanReceive() = 0;
+
+    // Reserves the next receive buffer. Returns false if the receiver has no
+    // free buffers, in which case the frame is dropped and EndReceive must
+    // not be called.
+    virtual bool BeginReceive(uint8_t **buffer, uint32_t *capacity) = 0;
+
+    // Delivers the frame written to the reserved buffer. A length of zero
+    // drops the frame and keeps the buffer available.
+    virtual void EndReceive(uint32_t length) = 0;
+};
+
+/*!
+ * Interface for a network backend.
+ * Backends connect an emulated network controller to the outside world: an
+ * in-process switch, a host network interface, a capture file, etc.
+ */
+class INetBackend {
+public:
+    virtual ~INetBackend() {}
+
+    // Starts delivering incoming frames to the receiver, possibly from a
+    // different thread. Backends deliver frames to only one receiver.
+    virtual bool Start(INetReceiver *receiver) = 0;
+
+    // Stops delivering frames. The receiver is no longer accessed once this
+    // function returns.
+    virtual void Stop() = 0;
+
+    // Transmits a frame gathered from the specified buffers, which are only
+    // accessed for the duration of the call. Returns false if the frame was
+    // dropped.
+    virtual bool Transmit(const IoVec *buffers, unsigned int bufferCount, uint32_t length) = 0;
+};
+
+/*!
+ * Copies a frame gathered from the specified buffers into the next receive
+ * buffer of the receiver. Returns false if the frame was dropped.
+ */
+bool deliverFrame(INetReceiver *receiver, const IoVec *buffers, unsigned int bufferCount, uint32_t length);
+
+}
+}
+}
@@ -0,0 +1,311 @@
+#include "net_capture.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "openxbox/log.h"
+#include "openxbox/thread.h"
+
+namespace openxbox {
+namespace hw {
+namespace net {
+
+#define PCAPNG_BLOCK_SHB        0x0A0D0D0A
+#define PCAPNG_BLOCK_IDB        0x00000001
+#define PCAPNG_BLOCK_EPB        0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_LINKTYPE_ETHERNET 1
+
+#define PCAPNG_OPT_ENDOFOPT     0
+#define PCAPNG_OPT_SHB_USERAPPL 4
+#define PCAPNG_OPT_IF_NAME      2
+#define PCAPNG_OPT_IF_TSRESOL   9
+#define PCAPNG_OPT_EPB_FLAGS    2
+
+// Number of frames the queue holds; must be a power of two
+#define NET_CAPTURE_QUEUE_SIZE  2048
+
+// Size of the writes issued to the capture file
+#define NET_CAPTURE_BUFFER_SIZE (1024 * 1024)
+
+static uint32_t pad4(uint32_t length) {
+    return (length + 3) & ~3;
+}
+
+NetCapture::NetCapture() {
+}
+
+NetCapture::~NetCapture() {
+    Close();
+}
+
+bool NetCapture::Open(const char *path, uint32_t snapLen, uint64_t maxFileSize) {
+    Close();
+
+    // Rotated files get a sequence number before the extension
+    std::string fullPath = path;
+    size_t dot = fullPath.find_last_of('.');
+    size_t slash = fullPath.find_last_of("/\\");
+    if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+        m_pathPrefix = fullPath.substr(0, dot);
+        m_pathSuffix = fullPath.substr(dot);
+    }
+    else {
+        m_pathPrefix = fullPath;
+        m_pathSuffix = "";
+    }
+
+    m_snapLen = (snapLen == 0 || snapLen > kMaxFrameSize) ? kMaxFrameSize : snapLen;
+    m_maxFileSize = maxFileSize;
+    m_fileCount = 0;
+    m_buffer.clear();
+    m_buffer.reserve(NET_CAPTURE_BUFFER_SIZE);
+    if (!OpenFile()) {
+        return false;
+    }
+
+    m_slots = new Slot[NET_CAPTURE_QUEUE_SIZE];
+    for (uint32_t i = 0; i < NET_CAPTURE_QUEUE_SIZE; i++) {
+        m_slots[i].sequence = i;
+    }
+    m_enqueuePos = 0;
+    m_dequeuePos = 0;
+    m_capturedFrames = 0;
+    m_droppedFrames = 0;
+
+    m_running = true;
+    m_thread = std::thread(WriterThread, this);
+
+    log_info("NetCapture: Capturing to %s\n", path);
+    return true;
+}
+
+void NetCapture::Close() {
+    m_running = false;
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+
+    // The file may be missing if a rotation failed
+    if (m_file != nullptr) {
+        fclose(m_file);
+        m_file = nullptr;
+    }
+    if (m_slots == nullptr) {
+        return;
+    }
+    delete[] m_slots;
+    m_slots = nullptr;
+
+    log_info("NetCapture: Captured %llu frames to %u files, %llu dropped\n",
+        (unsigned long long)m_capturedFrames, m_fileCount, (unsigned long long)m_droppedFrames);
+}
+
+void NetCapture::Capture(NetCaptureDirection direction, const IoVec *buffers, unsigned int bufferCount, uint32_t length) {
+    // Claim a slot. Each slot's sequence tells whether it is free for the
+    // position being claimed, or still holds a frame from the previous lap.
+    uint64_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;) {
+        slot = &m_slots[pos & (NET_CAPTURE_QUEUE_SIZE - 1)];
+        int64_t diff = (int64_t)(slot->sequence.load(std::memory_order_acquire) - pos);
+        if (diff == 0) {
+            if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            // The writer fell behind
+            m_droppedFrames++;
+            return;
+        }
+        else {
+            pos = m_enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->timestamp = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    slot->length = length;
+    slot->capturedLength = std::min(length, m_snapLen);
+    slot->direction = direction;
+    IoVecTobuffer(buffers, bufferCount, 0, slot->data, slot->capturedLength);
+
+    // Publish the frame to the writer
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    m_capturedFrames++;
+}
+
+void NetCapture::WriterThread(NetCapture *capture) {
+    Thread_SetName("[HW] NVNet capture");
+    capture->Write();
+}
+
+void NetCapture::Write() {
+    using namespace std::chrono;
+
+    auto lastFlush = steady_clock::now();
+    for (;;) {
+        bool running = m_running;
+        if (Drain()) {
+            continue;
+        }
+        if (!running) {
+            break;
+        }
+
+        // Write out stragglers once traffic calms down
+        if (!m_buffer.empty() && steady_clock::now() - lastFlush >= seconds(1)) {
+            Flush();
+            lastFlush = steady_clock::now();
+        }
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+    Flush();
+}
+
+bool NetCapture::Drain() {
+    bool drained = false;
+    for (;;) {
+        Slot& slot = m_slots[m_dequeuePos & (NET_CAPTURE_QUEUE_SIZE - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != m_dequeuePos + 1) {
+            break;
+        }
+
+        AppendPacket(slot);
+
+        // Free the slot for the next lap
+        slot.sequence.store(m_dequeuePos + NET_CAPTURE_QUEUE_SIZE, std::memory_order_release);
+        m_dequeuePos++;
+        drained = true;
+    }
+    return drained;
+}
+
+void NetCapture::Flush() {
+    if (m_buffer.empty() || m_file == nullptr) {
+        m_buffer.clear();
+        return;
+    }
+    if (fwrite(&m_buffer[0], 1, m_buffer.size(), m_file) != m_buffer.size()) {
+        log_warning("NetCapture: Could not write to the capture file\n");
+    }
+    m_fileSize += m_buffer.size();
+    m_buffer.clear();
+}
+
+bool NetCapture::OpenFile() {
+    std::string path = m_pathPrefix;
+    if (m_fileCount > 0) {
+        path += "." + std::to_string(m_fileCount);
+    }
+    path += m_pathSuffix;
+
+    m_file = fopen(path.c_str(), "wb");
+    if (m_file == nullptr) {
+        log_warning("NetCapture: Could not create %s\n", path.c_str());
+        return false;
+    }
+
+    // Writes are already batched into large blocks
+    setvbuf(m_file, nullptr, _IONBF, 0);
+
+    m_fileCount++;
+    m_fileSize = 0;
+    m_filePackets = 0;
+    AppendHeaders();
+    return true;
+}
+
+void NetCapture::AppendHeaders() {
+    static const char appName[] = "OpenXBOX";
+    static const char ifName[] = "nvnet";
+    static const uint8_t tsResolution = 9;  // 10^-9 seconds
+
+    // Section header block
+    uint32_t length = 28 + 4 + pad4(sizeof(appName) - 1) + 4;
+    Append32(PCAPNG_BLOCK_SHB);
+    Append32(length);
+    Append32(PCAPNG_BYTE_ORDER_MAGIC);
+    Append16(1);
+    Append16(0);
+    Append32(0xFFFFFFFF);  // section length is not specified
+    Append32(0xFFFFFFFF);
+    AppendOption(PCAPNG_OPT_SHB_USERAPPL, appName, sizeof(appName) - 1);
+    Append32(PCAPNG_OPT_ENDOFOPT);
+    Append32(length);
+
+    // Interface description block, with nanosecond timestamps
+    length = 20 + 4 + pad4(sizeof(ifName) - 1) + 8 + 4;
+    Append32(PCAPNG_BLOCK_IDB);
+    Append32(length);
+    Append16(PCAPNG_LINKTYPE_ETHERNET);
+    Append16(0);
+    Append32(m_snapLen);
+    AppendOption(PCAPNG_OPT_IF_NAME, ifName, sizeof(ifName) - 1);
+    AppendOption(PCAPNG_OPT_IF_TSRESOL, &tsResolution, sizeof(tsResolution));
+    Append32(PCAPNG_OPT_ENDOFOPT);
+    Append32(length);
+}
+
+void NetCapture::AppendPacket(const Slot& slot) {
+    uint32_t length = 28 + pad4(slot.capturedLength) + 8 + 4 + 4;
+
+    // The capture stops if a rotation failed
+    if (m_file == nullptr) {
+        return;
+    }
+
+    if (m_buffer.size() + length > NET_CAPTURE_BUFFER_SIZE) {
+        Flush();
+    }
+
+    // Start a new file if this packet would push the current one past the
+    // limit, unless it is the first packet in the file
+    if (m_maxFileSize > 0 && m_filePackets > 0 && m_fileSize + m_buffer.size() + length > m_maxFileSize) {
+        Flush();
+        fclose(m_file);
+        m_file = nullptr;
+        if (!OpenFile()) {
+            log_warning("NetCapture: Stopping the capture\n");
+            m_maxFileSize = 0;
+            m_fileSize = 0;
+            m_filePackets = 0;
+            return;
+        }
+    }
+
+    Append32(PCAPNG_BLOCK_EPB);
+    Append32(length);
+    Append32(0);  // interface
+    Append32((uint32_t)(slot.timestamp >> 32));
+    Append32((uint32_t)slot.timestamp);
+    Append32(slot.capturedLength);
+    Append32(slot.length);
+    AppendPadded(slot.data, slot.capturedLength);
+    AppendOption(PCAPNG_OPT_EPB_FLAGS, &slot.direction, sizeof(slot.direction));
+    Append32(PCAPNG_OPT_ENDOFOPT);
+    Append32(length);
+    m_filePackets++;
+}
+
+void NetCapture::AppendOption(uint16_t code, const void *data, uint16_t length) {
+    Append16(code);
+    Append16(length);
+    AppendPadded(data, length);
+}
+
+void NetCapture::AppendPadded(const void *data, uint32_t length) {
+    static const uint8_t padding[4] = { 0 };
+    Append(data, length);
+    Append(padding, pad4(length) - length);
+}
+
+void NetCapture::Append(const void *data, size_t length) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    m_buffer.insert(m_buffer.end(), bytes, bytes + length);
+}
+
+}
+}
+}
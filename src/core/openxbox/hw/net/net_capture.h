@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "net_backend.h"
+
+namespace openxbox {
+namespace hw {
+namespace net {
+
+// Direction of a captured frame as seen by the guest. The values match the
+// direction bits of the pcapng epb_flags option.
+enum NetCaptureDirection {
+    NCD_Inbound = 1,
+    NCD_Outbound = 2,
+};
+
+/*!
+ * Captures Ethernet frames to pcapng files.
+ *
+ * Capturing never blocks the caller: frames are copied into a lock-free
+ * queue that any number of threads can feed, and a background thread
+ * formats them into a large buffer that is written out in a single call once
+ * full or after a second of inactivity. Frames that find the queue full are
+ * dropped from the capture and counted.
+ *
+ * Frames can be truncated to a snapshot length, and the capture can be
+ * rotated into a new file once it reaches a maximum size. Rotated files are
+ * named after the original path with a sequence number inserted before the
+ * extension (capture.pcapng, capture.1.pcapng, capture.2.pcapng, ...).
+ */
+class NetCapture {
+public:
+    NetCapture();
+    ~NetCapture();
+
+    // Starts capturing to the specified path. A snapLen of zero captures
+    // whole frames, and a maxFileSize of zero disables rotation.
+    bool Open(const char *path, uint32_t snapLen, uint64_t maxFileSize);
+
+    // Writes out every queued frame and closes the capture
+    void Close();
+
+    // Queues a frame gathered from the specified buffers
+    void Capture(NetCaptureDirection direction, const IoVec *buffers, unsigned int bufferCount, uint32_t length);
+
+    uint64_t GetCapturedFrames() const { return m_capturedFrames; }
+    uint64_t GetDroppedFrames() const { return m_droppedFrames; }
+
+private:
+    struct Slot {
+        // Queue position the slot is ready for; see Capture and Drain
+        std::atomic<uint64_t> sequence;
+        uint64_t timestamp;
+        uint32_t length;
+        uint32_t capturedLength;
+        uint32_t direction;
+        uint8_t data[kMaxFrameSize];
+    };
+
+    static void WriterThread(NetCapture *capture);
+    void Write();
+    bool Drain();
+    void Flush();
+    bool OpenFile();
+
+    void AppendHeaders();
+    void AppendPacket(const Slot& slot);
+    void AppendOption(uint16_t code, const void *data, uint16_t length);
+    void AppendPadded(const void *data, uint32_t length);
+    void Append(const void *data, size_t length);
+    void Append16(uint16_t value) { Append(&value, sizeof(value)); }
+    void Append32(uint32_t value) { Append(&value, sizeof(value)); }
+
+    // Producer side
+    Slot *m_slots = nullptr;
+    std::atomic<uint64_t> m_enqueuePos{ 0 };
+    std::atomic<uint64_t> m_capturedFrames{ 0 };
+    std::atomic<uint64_t> m_droppedFrames{ 0 };
+    uint32_t m_snapLen = kMaxFrameSize;
+
+    // Consumer side
+    uint64_t m_dequeuePos = 0;
+    std::vector<uint8_t> m_buffer;
+    FILE *m_file = nullptr;
+    uint64_t m_fileSize = 0;
+    uint64_t m_filePackets = 0;
+    uint32_t m_fileCount = 0;
+    uint64_t m_maxFileSize = 0;
+    std::string m_pathPrefix;
+    std::string m_pathSuffix;
+
+    std::thread m_thread;
+    std::atomic<bool> m_running{ false };
+};
+
+}
+}
+}
@@ -0,0 +1,26 @@
+#include "net_loopback.h"
+
+namespace openxbox {
+namespace hw {
+namespace net {
+
+bool LoopbackNetBackend::Start(INetReceiver *receiver) {
+    m_receiver = receiver;
+    return true;
+}
+
+void LoopbackNetBackend::Stop() {
+    m_receiver = nullptr;
+}
+
+bool LoopbackNetBackend::Transmit(const IoVec *buffers, unsigned int bufferCount, uint32_t length) {
+    // Frames are transmitted and received back on the same thread
+    if (m_receiver == nullptr) {
+        return false;
+    }
+    return deliverFrame(m_receiver, buffers, bufferCount, length);
+}
+
+}
+}
+}
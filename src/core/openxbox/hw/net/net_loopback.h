@@ -0,0 +1,25 @@
+#pragma once
+
+#include "net_backend.h"
+
+namespace openxbox {
+namespace hw {
+namespace net {
+
+/*!
+ * Network backend that sends every transmitted frame back to the receiver,
+ * as if the controller was connected to a loopback plug.
+ */
+class LoopbackNetBackend : public INetBackend {
+public:
+    bool Start(INetReceiver *receiver) override;
+    void Stop() override;
+    bool Transmit(const IoVec *buffers, unsigned int bufferCount, uint32_t length) override;
+
+private:
+    INetReceiver *m_receiver = nullptr;
+};
+
+}
+}
+}
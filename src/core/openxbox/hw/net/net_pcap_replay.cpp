@@ -0,0 +1,195 @@
+#include "net_pcap_replay.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "openxbox/log.h"
+#include "openxbox/thread.h"
+
+namespace openxbox {
+namespace hw {
+namespace net {
+
+#define PCAP_MAGIC_USEC   0xA1B2C3D4
+#define PCAP_MAGIC_NSEC   0xA1B23C4D
+#define PCAP_LINKTYPE_ETHERNET 1
+
+#define PCAP_READ_BUFFER_SIZE (256 * 1024)
+
+struct PcapFileHeader {
+    uint32_t magic;
+    uint16_t versionMajor;
+    uint16_t versionMinor;
+    int32_t thisZone;
+    uint32_t sigFigs;
+    uint32_t snapLen;
+    uint32_t linkType;
+};
+
+struct PcapRecordHeader {
+    uint32_t tsSec;
+    uint32_t tsFrac;
+    uint32_t capturedLength;
+    uint32_t originalLength;
+};
+
+static uint32_t swap32(uint32_t value) {
+    return (value >> 24) | ((value >> 8) & 0xFF00) | ((value << 8) & 0xFF0000) | (value << 24);
+}
+
+PcapReplayNetBackend::~PcapReplayNetBackend() {
+    Stop();
+    Close();
+}
+
+bool PcapReplayNetBackend::Open(const char *path, bool realTime) {
+    Close();
+
+    m_file = fopen(path, "rb");
+    if (m_file == nullptr) {
+        log_warning("PcapReplayNetBackend: Could not open %s\n", path);
+        return false;
+    }
+    setvbuf(m_file, nullptr, _IOFBF, PCAP_READ_BUFFER_SIZE);
+
+    PcapFileHeader header;
+    if (fread(&header, sizeof(header), 1, m_file) != 1) {
+        log_warning("PcapReplayNetBackend: %s is too short to be a pcap file\n", path);
+        Close();
+        return false;
+    }
+
+    switch (header.magic) {
+    case PCAP_MAGIC_USEC: m_swapped = false; m_nanoseconds = false; break;
+    case PCAP_MAGIC_NSEC: m_swapped = false; m_nanoseconds = true; break;
+    default:
+        if (swap32(header.magic) == PCAP_MAGIC_USEC) { m_swapped = true; m_nanoseconds = false; break; }
+        if (swap32(header.magic) == PCAP_MAGIC_NSEC) { m_swapped = true; m_nanoseconds = true; break; }
+        log_warning("PcapReplayNetBackend: %s is not a pcap file\n", path);
+        Close();
+        return false;
+    }
+
+    uint32_t linkType = m_swapped ? swap32(header.linkType) : header.linkType;
+    if (linkType != PCAP_LINKTYPE_ETHERNET) {
+        log_warning("PcapReplayNetBackend: %s does not contain Ethernet frames (link type %u)\n", path, linkType);
+        Close();
+        return false;
+    }
+
+    m_realTime = realTime;
+    m_finished = false;
+    m_deliveredFrames = 0;
+    m_droppedFrames = 0;
+    return true;
+}
+
+void PcapReplayNetBackend::Close() {
+    if (m_file != nullptr) {
+        fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+bool PcapReplayNetBackend::Start(INetReceiver *receiver) {
+    if (m_file == nullptr) {
+        return false;
+    }
+    Stop();
+    m_receiver = receiver;
+    m_running = true;
+    m_thread = std::thread(ReplayThread, this);
+    return true;
+}
+
+void PcapReplayNetBackend::Stop() {
+    m_running = false;
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    m_receiver = nullptr;
+}
+
+bool PcapReplayNetBackend::Transmit(const IoVec *buffers, unsigned int bufferCount, uint32_t length) {
+    return true;
+}
+
+void PcapReplayNetBackend::ReplayThread(PcapReplayNetBackend *backend) {
+    Thread_SetName("[HW] NVNet pcap replay");
+    backend->Replay();
+}
+
+void PcapReplayNetBackend::Replay() {
+    using namespace std::chrono;
+
+    bool first = true;
+    uint64_t firstTimestamp = 0;
+    auto start = steady_clock::now();
+
+    PcapRecordHeader record;
+    while (m_running && fread(&record, sizeof(record), 1, m_file) == 1) {
+        if (m_swapped) {
+            record.tsSec = swap32(record.tsSec);
+            record.tsFrac = swap32(record.tsFrac);
+            record.capturedLength = swap32(record.capturedLength);
+        }
+
+        if (m_realTime) {
+            // Timestamps are converted to nanoseconds relative to the first frame
+            uint64_t timestamp = (uint64_t)record.tsSec * 1000000000ull + (m_nanoseconds ? record.tsFrac : record.tsFrac * 1000ull);
+            if (first) {
+                firstTimestamp = timestamp;
+                first = false;
+            }
+            auto due = start + nanoseconds(timestamp - firstTimestamp);
+            while (m_running && steady_clock::now() < due) {
+                std::this_thread::sleep_for(std::min<steady_clock::duration>(due - steady_clock::now(), milliseconds(10)));
+            }
+        }
+
+        if (!DeliverRecord(record.capturedLength)) {
+            break;
+        }
+    }
+
+    if (m_running) {
+        log_info("PcapReplayNetBackend: Replay finished; %llu frames delivered, %llu dropped\n",
+            (unsigned long long)m_deliveredFrames, (unsigned long long)m_droppedFrames);
+    }
+    m_finished = true;
+}
+
+bool PcapReplayNetBackend::DeliverRecord(uint32_t capturedLength) {
+    // Wait for the guest to hand buffers back to the controller
+    while (!m_realTime && !m_receiver->CanReceive()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (!m_running) {
+            return false;
+        }
+    }
+
+    uint8_t *buffer;
+    uint32_t capacity;
+    if (!m_receiver->BeginReceive(&buffer, &capacity)) {
+        m_droppedFrames++;
+        return fseek(m_file, capturedLength, SEEK_CUR) == 0;
+    }
+
+    if (capturedLength > kMaxFrameSize || capturedLength > capacity) {
+        m_receiver->EndReceive(0);
+        m_droppedFrames++;
+        return fseek(m_file, capturedLength, SEEK_CUR) == 0;
+    }
+
+    if (fread(buffer, 1, capturedLength, m_file) != capturedLength) {
+        m_receiver->EndReceive(0);
+        return false;
+    }
+    m_receiver->EndReceive(capturedLength);
+    m_deliveredFrames++;
+    return true;
+}
+
+}
+}
+}
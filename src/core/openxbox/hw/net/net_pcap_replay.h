@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+#include "net_backend.h"
+
+namespace openxbox {
+namespace hw {
+namespace net {
+
+/*!
+ * Network backend that replays the Ethernet frames of a pcap capture to the
+ * receiver. Frames are read from the file straight into the receive buffers.
+ * Transmitted frames are discarded.
+ *
+ * By default, frames are delivered as fast as the receiver frees up buffers,
+ * so that no frame is lost. In real time mode, frames are delivered at the
+ * pace they were captured at, and dropped if the receiver is not ready.
+ */
+class PcapReplayNetBackend : public INetBackend {
+public:
+    ~PcapReplayNetBackend();
+
+    bool Open(const char *path, bool realTime);
+    void Close();
+
+    bool Start(INetReceiver *receiver) override;
+    void Stop() override;
+    bool Transmit(const IoVec *buffers, unsigned int bufferCount, uint32_t length) override;
+
+    // Frame counters, updated as the replay progresses
+    uint64_t GetDeliveredFrames() const { return m_deliveredFrames; }
+    uint64_t GetDroppedFrames() const { return m_droppedFrames; }
+    bool IsFinished() const { return m_finished; }
+
+private:
+    static void ReplayThread(PcapReplayNetBackend *backend);
+    void Replay();
+    bool DeliverRecord(uint32_t capturedLength);
+
+    FILE *m_file = nullptr;
+    bool m_swapped = false;
+    bool m_nanoseconds = false;
+    bool m_realTime = false;
+
+    INetReceiver *m_receiver = nullptr;
+    std::thread m_thread;
+    std::atomic<bool> m_running{ false };
+    std::atomic<bool> m_finished{ false };
+    std::atomic<uint64_t> m_deliveredFrames{ 0 };
+    std::atomic<uint64_t> m_droppedFrames{ 0 };
+};
+
+}
+}
+}
@@ -0,0 +1,130 @@
+#include "net_switch.h"
+
+#include <map>
+#include <string>
+#include <string.h>
+
+namespace openxbox {
+namespace hw {
+namespace net {
+
+// Entries beyond this are recycled in insertion order
+#define SWITCH_MAC_TABLE_SIZE 256
+
+NetSwitch *NetSwitch::Get(const char *name) {
+    static std::mutex registryMutex;
+    static std::map<std::string, NetSwitch *> registry;
+
+    std::lock_guard<std::mutex> lk(registryMutex);
+    NetSwitch *&netSwitch = registry[name];
+    if (netSwitch == nullptr) {
+        netSwitch = new NetSwitch();
+    }
+    return netSwitch;
+}
+
+unsigned int NetSwitch::GetPortCount() {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return (unsigned int)m_ports.size();
+}
+
+void NetSwitch::Connect(SwitchNetBackend *port) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_ports.push_back(port);
+}
+
+void NetSwitch::Disconnect(SwitchNetBackend *port) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    for (auto it = m_ports.begin(); it != m_ports.end(); ) {
+        it = (*it == port) ? m_ports.erase(it) : it + 1;
+    }
+    for (auto it = m_macTable.begin(); it != m_macTable.end(); ) {
+        it = (it->port == port) ? m_macTable.erase(it) : it + 1;
+    }
+}
+
+bool NetSwitch::Forward(SwitchNetBackend *source, const IoVec *buffers, unsigned int bufferCount, uint32_t length) {
+    // Only the destination and source addresses are needed to route the frame
+    uint8_t header[12];
+    if (length < 14 || IoVecTobuffer(buffers, bufferCount, 0, header, sizeof(header)) != sizeof(header)) {
+        return false;
+    }
+    const uint8_t *dstAddress = &header[0];
+    const uint8_t *srcAddress = &header[6];
+
+    std::lock_guard<std::mutex> lk(m_mutex);
+
+    // Learn the source address unless it is a group address
+    if ((srcAddress[0] & 1) == 0) {
+        bool known = false;
+        for (auto& entry : m_macTable) {
+            if (memcmp(entry.address, srcAddress, 6) == 0) {
+                entry.port = source;
+                known = true;
+                break;
+            }
+        }
+        if (!known) {
+            if (m_macTable.size() >= SWITCH_MAC_TABLE_SIZE) {
+                m_macTable.erase(m_macTable.begin());
+            }
+            MACEntry entry;
+            memcpy(entry.address, srcAddress, 6);
+            entry.port = source;
+            m_macTable.push_back(entry);
+        }
+    }
+
+    // Unicast frames to known addresses go to a single port
+    if ((dstAddress[0] & 1) == 0) {
+        for (auto& entry : m_macTable) {
+            if (memcmp(entry.address, dstAddress, 6) == 0) {
+                if (entry.port == source || entry.port->m_receiver == nullptr) {
+                    return false;
+                }
+                return deliverFrame(entry.port->m_receiver, buffers, bufferCount, length);
+            }
+        }
+    }
+
+    bool delivered = false;
+    for (auto port : m_ports) {
+        if (port != source && port->m_receiver != nullptr) {
+            delivered |= deliverFrame(port->m_receiver, buffers, bufferCount, length);
+        }
+    }
+    return delivered;
+}
+
+// ----- SwitchNetBackend -----------------------------------------------------
+
+SwitchNetBackend::SwitchNetBackend(NetSwitch *netSwitch)
+    : m_switch(netSwitch)
+{
+    m_switch->Connect(this);
+}
+
+SwitchNetBackend::~SwitchNetBackend() {
+    m_switch->Disconnect(this);
+}
+
+bool SwitchNetBackend::Start(INetReceiver *receiver) {
+    std::lock_guard<std::mutex> lk(m_switch->m_mutex);
+    m_receiver = receiver;
+    return true;
+}
+
+void SwitchNetBackend::Stop() {
+    // Frames are delivered with the switch locked, so none are in flight to
+    // the receiver once the lock is acquired
+    std::lock_guard<std::mutex> lk(m_switch->m_mutex);
+    m_receiver = nullptr;
+}
+
+bool SwitchNetBackend::Transmit(const IoVec *buffers, unsigned int bufferCount, uint32_t length) {
+    return m_switch->Forward(this, buffers, bufferCount, length);
+}
+
+}
+}
+}
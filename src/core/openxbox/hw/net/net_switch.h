@@ -0,0 +1,71 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include "net_backend.h"
+
+namespace openxbox {
+namespace hw {
+namespace net {
+
+class SwitchNetBackend;
+
+/*!
+ * An in-process Ethernet switch connecting any number of network
+ * controllers, typically from multiple emulator instances running in the
+ * same process.
+ *
+ * The switch learns which port each source address is behind and forwards
+ * unicast frames to that port only. Broadcasts, multicasts and frames to
+ * unknown addresses are flooded to every other port.
+ */
+class NetSwitch {
+public:
+    // Returns the switch with the specified name, creating it if necessary.
+    // Named switches live until the process exits.
+    static NetSwitch *Get(const char *name);
+
+    unsigned int GetPortCount();
+
+private:
+    struct MACEntry {
+        uint8_t address[6];
+        SwitchNetBackend *port;
+    };
+
+    void Connect(SwitchNetBackend *port);
+    void Disconnect(SwitchNetBackend *port);
+    bool Forward(SwitchNetBackend *source, const IoVec *buffers, unsigned int bufferCount, uint32_t length);
+
+    std::mutex m_mutex;
+    std::vector<SwitchNetBackend *> m_ports;
+    std::vector<MACEntry> m_macTable;
+
+    friend class SwitchNetBackend;
+};
+
+/*!
+ * Network backend that plugs the controller into a port of a NetSwitch.
+ * Frames are copied straight from the sender's transmit buffers into the
+ * receive buffers of the destination controllers.
+ */
+class SwitchNetBackend : public INetBackend {
+public:
+    SwitchNetBackend(NetSwitch *netSwitch);
+    ~SwitchNetBackend();
+
+    bool Start(INetReceiver *receiver) override;
+    void Stop() override;
+    bool Transmit(const IoVec *buffers, unsigned int bufferCount, uint32_t length) override;
+
+private:
+    NetSwitch *m_switch;
+    INetReceiver *m_receiver = nullptr;
+
+    friend class NetSwitch;
+};
+
+}
+}
+}
@@ -0,0 +1,180 @@
+#include "net_tap.h"
+
+#include "openxbox/log.h"
+#include "openxbox/thread.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace openxbox {
+namespace hw {
+namespace net {
+
+TapNetBackend::~TapNetBackend() {
+    Stop();
+    Close();
+}
+
+#ifdef __linux__
+
+static_assert(sizeof(IoVec) == sizeof(struct iovec), "IoVec must match struct iovec");
+
+bool TapNetBackend::Open(const char *name) {
+    Close();
+
+    m_fd = open("/dev/net/tun", O_RDWR | O_CLOEXEC);
+    if (m_fd < 0) {
+        log_warning("TapNetBackend: Could not open /dev/net/tun: %s\n", strerror(errno));
+        return false;
+    }
+
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    if (name != nullptr) {
+        strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+    }
+    if (ioctl(m_fd, TUNSETIFF, &ifr) < 0) {
+        log_warning("TapNetBackend: Could not attach to TAP interface %s: %s\n", name != nullptr ? name : "", strerror(errno));
+        Close();
+        return false;
+    }
+    m_name = ifr.ifr_name;
+
+    // Reads must never block while a receive buffer is reserved
+    fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) | O_NONBLOCK);
+
+    if (pipe(m_wakeFds) < 0) {
+        Close();
+        return false;
+    }
+
+    log_info("TapNetBackend: Attached to TAP interface %s\n", m_name.c_str());
+    return true;
+}
+
+void TapNetBackend::Close() {
+    for (int i = 0; i < 2; i++) {
+        if (m_wakeFds[i] >= 0) {
+            close(m_wakeFds[i]);
+            m_wakeFds[i] = -1;
+        }
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool TapNetBackend::Start(INetReceiver *receiver) {
+    if (m_fd < 0) {
+        return false;
+    }
+    Stop();
+    m_receiver = receiver;
+    m_running = true;
+    m_thread = std::thread(ReceiveThread, this);
+    return true;
+}
+
+void TapNetBackend::Stop() {
+    m_running = false;
+    if (m_thread.joinable()) {
+        uint8_t wake = 0;
+        if (write(m_wakeFds[1], &wake, 1) < 0) {
+            // The thread still notices within one poll timeout
+        }
+        m_thread.join();
+
+        // Drain the wake up byte
+        struct pollfd pfd = { m_wakeFds[0], POLLIN, 0 };
+        while (poll(&pfd, 1, 0) > 0 && read(m_wakeFds[0], &wake, 1) > 0) {}
+    }
+    m_receiver = nullptr;
+}
+
+bool TapNetBackend::Transmit(const IoVec *buffers, unsigned int bufferCount, uint32_t length) {
+    if (m_fd < 0) {
+        return false;
+    }
+    ssize_t written = writev(m_fd, (const struct iovec *)buffers, (int)bufferCount);
+    return written == (ssize_t)length;
+}
+
+void TapNetBackend::Receive() {
+    // Frames are drained into here when the guest has no free buffers
+    uint8_t discard[kMaxFrameSize + 64];
+
+    struct pollfd pfds[2] = {
+        { m_fd, POLLIN, 0 },
+        { m_wakeFds[0], POLLIN, 0 },
+    };
+    while (m_running) {
+        if (poll(pfds, 2, 100) <= 0 || !(pfds[0].revents & POLLIN)) {
+            continue;
+        }
+
+        // Drain all frames that are ready
+        while (m_running) {
+            uint8_t *buffer;
+            uint32_t capacity;
+            if (!m_receiver->BeginReceive(&buffer, &capacity)) {
+                if (read(m_fd, discard, sizeof(discard)) < 0) {
+                    break;
+                }
+                continue;
+            }
+
+            ssize_t length = read(m_fd, buffer, capacity);
+            if (length <= 0) {
+                m_receiver->EndReceive(0);
+                break;
+            }
+            m_receiver->EndReceive((uint32_t)length);
+        }
+    }
+}
+
+#else
+
+bool TapNetBackend::Open(const char *name) {
+    log_warning("TapNetBackend: TAP interfaces are not supported on this platform\n");
+    return false;
+}
+
+void TapNetBackend::Close() {
+}
+
+bool TapNetBackend::Start(INetReceiver *receiver) {
+    return false;
+}
+
+void TapNetBackend::Stop() {
+}
+
+bool TapNetBackend::Transmit(const IoVec *buffers, unsigned int bufferCount, uint32_t length) {
+    return false;
+}
+
+void TapNetBackend::Receive() {
+}
+
+#endif
+
+void TapNetBackend::ReceiveThread(TapNetBackend *backend) {
+    Thread_SetName("[HW] NVNet TAP");
+    backend->Receive();
+}
+
+}
+}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "net_backend.h"
+
+namespace openxbox {
+namespace hw {
+namespace net {
+
+/*!
+ * Network backend that bridges the controller to a host TAP interface.
+ *
+ * Transmitted frames are written to the interface straight from the
+ * transmit buffers with a single gathered write, and incoming frames are
+ * read directly into the receive buffers.
+ *
+ * TAP interfaces are only supported on Linux.
+ */
+class TapNetBackend : public INetBackend {
+public:
+    ~TapNetBackend();
+
+    // Attaches to the TAP interface with the specified name, creating it if
+    // the process is allowed to. If name is nullptr, the host picks a name.
+    bool Open(const char *name);
+    void Close();
+
+    // Name of the attached interface
+    const char *GetInterfaceName() const { return m_name.c_str(); }
+
+    bool Start(INetReceiver *receiver) override;
+    void Stop() override;
+    bool Transmit(const IoVec *buffers, unsigned int bufferCount, uint32_t length) override;
+
+private:
+    static void ReceiveThread(TapNetBackend *backend);
+    void Receive();
+
+    std::string m_name;
+    int m_fd = -1;
+    int m_wakeFds[2] = { -1, -1 };
+
+    INetReceiver *m_receiver = nullptr;
+    std::thread m_thread;
+    std::atomic<bool> m_running{ false };
+};
+
+}
+}
+}
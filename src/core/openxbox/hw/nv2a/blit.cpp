@@ -0,0 +1,668 @@
+#include "blit.h"
+#include "nv2a_int.h"
+#include "openxbox/log.h"
+
+#include <cstring>
+#include <vector>
+
+#include <emmintrin.h>
+
+namespace openxbox {
+
+// Pixels converted per step by the vectorized blend path
+#define BLIT_CHUNK_PIXELS 64
+
+// ----- Pixel formats ---------------------------------------------------------
+
+unsigned int nv2a_blit_bytes_per_pixel(unsigned int colorFormat) {
+    switch (colorFormat) {
+    case NV062_SET_COLOR_FORMAT_LE_Y8:
+        return 1;
+    case NV062_SET_COLOR_FORMAT_LE_X1R5G5B5_Z1R5G5B5:
+    case NV062_SET_COLOR_FORMAT_LE_X1R5G5B5_O1R5G5B5:
+    case NV062_SET_COLOR_FORMAT_LE_R5G6B5:
+    case NV062_SET_COLOR_FORMAT_LE_Y16:
+        return 2;
+    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8_Z8R8G8B8:
+    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8_O8R8G8B8:
+    case NV062_SET_COLOR_FORMAT_LE_X1A7R8G8B8_Z1A7R8G8B8:
+    case NV062_SET_COLOR_FORMAT_LE_X1A7R8G8B8_O1A7R8G8B8:
+    case NV062_SET_COLOR_FORMAT_LE_A8R8G8B8:
+    case NV062_SET_COLOR_FORMAT_LE_Y32:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+// Bits forced on every written pixel: the unused bits of the _Z formats are
+// written as zeros and those of the _O formats as ones.
+static void blit_format_masks(unsigned int colorFormat, uint32_t *andMask, uint32_t *orMask) {
+    *andMask = 0xFFFFFFFF;
+    *orMask = 0;
+    switch (colorFormat) {
+    case NV062_SET_COLOR_FORMAT_LE_X1R5G5B5_Z1R5G5B5:     *andMask = 0x7FFF; break;
+    case NV062_SET_COLOR_FORMAT_LE_X1R5G5B5_O1R5G5B5:     *orMask = 0x8000; break;
+    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8_Z8R8G8B8:     *andMask = 0x00FFFFFF; break;
+    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8_O8R8G8B8:     *orMask = 0xFF000000; break;
+    case NV062_SET_COLOR_FORMAT_LE_X1A7R8G8B8_Z1A7R8G8B8: *andMask = 0x7FFFFFFF; break;
+    case NV062_SET_COLOR_FORMAT_LE_X1A7R8G8B8_O1A7R8G8B8: *orMask = 0x80000000; break;
+    default: break;
+    }
+}
+
+static inline bool blit_is_luminance_wide(unsigned int colorFormat) {
+    return colorFormat == NV062_SET_COLOR_FORMAT_LE_Y16 || colorFormat == NV062_SET_COLOR_FORMAT_LE_Y32;
+}
+
+static inline uint32_t blit_load(const uint8_t *p, unsigned int bpp) {
+    uint32_t value = 0;
+    memcpy(&value, p, bpp);
+    return value;
+}
+
+static inline void blit_store(uint8_t *p, uint32_t value, unsigned int bpp) {
+    memcpy(p, &value, bpp);
+}
+
+static inline uint32_t blit_expand5(uint32_t v) { return (v << 3) | (v >> 2); }
+static inline uint32_t blit_expand6(uint32_t v) { return (v << 2) | (v >> 4); }
+
+// Converts a pixel to A8R8G8B8. Formats without alpha read as opaque; the
+// 8-bit luminance format is replicated into all color channels.
+static uint32_t blit_decode(unsigned int colorFormat, uint32_t p) {
+    switch (colorFormat) {
+    case NV062_SET_COLOR_FORMAT_LE_Y8:
+        return 0xFF000000 | (p * 0x010101);
+    case NV062_SET_COLOR_FORMAT_LE_X1R5G5B5_Z1R5G5B5:
+    case NV062_SET_COLOR_FORMAT_LE_X1R5G5B5_O1R5G5B5:
+        return 0xFF000000
+            | (blit_expand5((p >> 10) & 0x1F) << 16)
+            | (blit_expand5((p >> 5) & 0x1F) << 8)
+            | blit_expand5(p & 0x1F);
+    case NV062_SET_COLOR_FORMAT_LE_R5G6B5:
+        return 0xFF000000
+            | (blit_expand5((p >> 11) & 0x1F) << 16)
+            | (blit_expand6((p >> 5) & 0x3F) << 8)
+            | blit_expand5(p & 0x1F);
+    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8_Z8R8G8B8:
+    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8_O8R8G8B8:
+        return 0xFF000000 | p;
+    case NV062_SET_COLOR_FORMAT_LE_X1A7R8G8B8_Z1A7R8G8B8:
+    case NV062_SET_COLOR_FORMAT_LE_X1A7R8G8B8_O1A7R8G8B8:
+    {
+        uint32_t a7 = (p >> 24) & 0x7F;
+        return (((a7 << 1) | (a7 >> 6)) << 24) | (p & 0x00FFFFFF);
+    }
+    default:
+        return p;
+    }
+}
+
+// Converts an A8R8G8B8 value back into the surface format. The 8-bit
+// luminance format takes the blue channel.
+static uint32_t blit_encode(unsigned int colorFormat, uint32_t c) {
+    uint32_t p;
+    switch (colorFormat) {
+    case NV062_SET_COLOR_FORMAT_LE_Y8:
+        p = c & 0xFF;
+        break;
+    case NV062_SET_COLOR_FORMAT_LE_X1R5G5B5_Z1R5G5B5:
+    case NV062_SET_COLOR_FORMAT_LE_X1R5G5B5_O1R5G5B5:
+        p = ((c >> 9) & 0x7C00) | ((c >> 6) & 0x03E0) | ((c >> 3) & 0x001F);
+        break;
+    case NV062_SET_COLOR_FORMAT_LE_R5G6B5:
+        p = ((c >> 8) & 0xF800) | ((c >> 5) & 0x07E0) | ((c >> 3) & 0x001F);
+        break;
+    case NV062_SET_COLOR_FORMAT_LE_X1A7R8G8B8_Z1A7R8G8B8:
+    case NV062_SET_COLOR_FORMAT_LE_X1A7R8G8B8_O1A7R8G8B8:
+        p = (c & 0x00FFFFFF) | ((c >> 1) & 0x7F000000);
+        break;
+    default:
+        p = c;
+        break;
+    }
+
+    uint32_t andMask, orMask;
+    blit_format_masks(colorFormat, &andMask, &orMask);
+    return (p & andMask) | orMask;
+}
+
+// ----- Scalar operations -----------------------------------------------------
+
+// x * f / 255, rounded to nearest
+static inline uint32_t blit_mul255(uint32_t x, uint32_t f) {
+    uint32_t t = x * f + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+static inline uint32_t blit_beta1_factor(uint32_t beta1) {
+    // 1.31 fixed point; negative values clamp to zero
+    if (beta1 & 0x80000000) {
+        return 0;
+    }
+    return beta1 >> 23;
+}
+
+static uint32_t blit_rop3(uint8_t rop, uint32_t pattern, uint32_t source, uint32_t dest) {
+    uint32_t result = 0;
+    for (int i = 0; i < 8; i++) {
+        if (rop & (1 << i)) {
+            uint32_t p = (i & 4) ? pattern : ~pattern;
+            uint32_t s = (i & 2) ? source : ~source;
+            uint32_t d = (i & 1) ? dest : ~dest;
+            result |= p & s & d;
+        }
+    }
+    return result;
+}
+
+static uint32_t blit_blend_color(const BlitParams& params, uint32_t s, uint32_t d) {
+    uint32_t out = 0;
+    switch (params.operation) {
+    case NV09F_SET_OPERATION_BLEND_AND:
+    {
+        uint32_t f = blit_beta1_factor(params.beta1);
+        for (int shift = 0; shift < 32; shift += 8) {
+            uint32_t c = blit_mul255((s >> shift) & 0xFF, f) + blit_mul255((d >> shift) & 0xFF, 255 - f);
+            out |= (c > 255 ? 255 : c) << shift;
+        }
+        break;
+    }
+    case NV09F_SET_OPERATION_SRCCOPY_PREMULT:
+        for (int shift = 0; shift < 32; shift += 8) {
+            out |= blit_mul255((s >> shift) & 0xFF, (params.beta4 >> shift) & 0xFF) << shift;
+        }
+        break;
+    case NV09F_SET_OPERATION_BLEND_PREMULT:
+    {
+        uint32_t sa = blit_mul255(s >> 24, params.beta4 >> 24);
+        for (int shift = 0; shift < 32; shift += 8) {
+            uint32_t c = blit_mul255((s >> shift) & 0xFF, (params.beta4 >> shift) & 0xFF)
+                + blit_mul255((d >> shift) & 0xFF, 255 - sa);
+            out |= (c > 255 ? 255 : c) << shift;
+        }
+        break;
+    }
+    }
+    return out;
+}
+
+// Y16 and Y32 do not fit the 8-bit channel pipeline; they are blended as a
+// single luminance channel using the blue component of beta4.
+static uint32_t blit_blend_luminance(const BlitParams& params, uint32_t s, uint32_t d) {
+    uint64_t max = (params.colorFormat == NV062_SET_COLOR_FORMAT_LE_Y16) ? 0xFFFF : 0xFFFFFFFF;
+    uint64_t out = 0;
+    switch (params.operation) {
+    case NV09F_SET_OPERATION_BLEND_AND:
+    {
+        uint64_t f = blit_beta1_factor(params.beta1);
+        out = ((uint64_t)s * f + (uint64_t)d * (255 - f) + 127) / 255;
+        break;
+    }
+    case NV09F_SET_OPERATION_SRCCOPY_PREMULT:
+        out = ((uint64_t)s * (params.beta4 & 0xFF) + 127) / 255;
+        break;
+    case NV09F_SET_OPERATION_BLEND_PREMULT:
+        out = ((uint64_t)s * (params.beta4 & 0xFF) + (uint64_t)d * (255 - (params.beta4 >> 24)) + 127) / 255;
+        break;
+    }
+    return (uint32_t)(out > max ? max : out);
+}
+
+static void blit_row_scalar(const BlitParams& params, const uint8_t *source, uint8_t *dest) {
+    unsigned int bpp = nv2a_blit_bytes_per_pixel(params.colorFormat);
+    uint32_t andMask, orMask;
+    blit_format_masks(params.colorFormat, &andMask, &orMask);
+
+    for (unsigned int x = 0; x < params.width; x++) {
+        uint32_t s = blit_load(source + x * bpp, bpp);
+        uint32_t d = blit_load(dest + x * bpp, bpp);
+        uint32_t out;
+
+        switch (params.operation) {
+        case NV09F_SET_OPERATION_SRCCOPY_AND:
+        case NV09F_SET_OPERATION_SRCCOPY:
+            out = (s & andMask) | orMask;
+            break;
+        case NV09F_SET_OPERATION_ROP_AND:
+            out = (blit_rop3(params.rop, 0, s, d) & andMask) | orMask;
+            break;
+        default:
+            if (blit_is_luminance_wide(params.colorFormat)) {
+                out = blit_blend_luminance(params, s, d);
+            }
+            else {
+                out = blit_encode(params.colorFormat,
+                    blit_blend_color(params, blit_decode(params.colorFormat, s), blit_decode(params.colorFormat, d)));
+            }
+            break;
+        }
+
+        blit_store(dest + x * bpp, out, bpp);
+    }
+}
+
+// ----- SSE2 kernels ----------------------------------------------------------
+
+static inline __m128i blit_replicate_mask(uint32_t mask, unsigned int bpp) {
+    if (bpp == 2) {
+        return _mm_set1_epi16((short)mask);
+    }
+    if (bpp == 1) {
+        return _mm_set1_epi8((char)mask);
+    }
+    return _mm_set1_epi32((int)mask);
+}
+
+static void blit_copy_row_simd(const BlitParams& params, const uint8_t *source, uint8_t *dest) {
+    unsigned int bpp = nv2a_blit_bytes_per_pixel(params.colorFormat);
+    unsigned int bytes = params.width * bpp;
+    uint32_t andMask, orMask;
+    blit_format_masks(params.colorFormat, &andMask, &orMask);
+
+    if (andMask == 0xFFFFFFFF && orMask == 0) {
+        memcpy(dest, source, bytes);
+        return;
+    }
+
+    __m128i vand = blit_replicate_mask(andMask, bpp);
+    __m128i vor = blit_replicate_mask(orMask, bpp);
+    unsigned int i = 0;
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(source + i));
+        _mm_storeu_si128((__m128i *)(dest + i), _mm_or_si128(_mm_and_si128(s, vand), vor));
+    }
+    for (; i < bytes; i += bpp) {
+        blit_store(dest + i, (blit_load(source + i, bpp) & andMask) | orMask, bpp);
+    }
+}
+
+static void blit_rop_row_simd(const BlitParams& params, const uint8_t *source, uint8_t *dest) {
+    unsigned int bpp = nv2a_blit_bytes_per_pixel(params.colorFormat);
+    unsigned int bytes = params.width * bpp;
+    uint32_t andMask, orMask;
+    blit_format_masks(params.colorFormat, &andMask, &orMask);
+
+    // No pattern object is supported, so the pattern is all zeros and only
+    // the minterms with P clear contribute.
+    __m128i vand = blit_replicate_mask(andMask, bpp);
+    __m128i vor = blit_replicate_mask(orMask, bpp);
+    __m128i ones = _mm_set1_epi32(-1);
+    unsigned int i = 0;
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(source + i));
+        __m128i d = _mm_loadu_si128((const __m128i *)(dest + i));
+        __m128i ns = _mm_xor_si128(s, ones);
+        __m128i nd = _mm_xor_si128(d, ones);
+        __m128i r = _mm_setzero_si128();
+        if (params.rop & 0x01) r = _mm_or_si128(r, _mm_and_si128(ns, nd));
+        if (params.rop & 0x02) r = _mm_or_si128(r, _mm_and_si128(ns, d));
+        if (params.rop & 0x04) r = _mm_or_si128(r, _mm_and_si128(s, nd));
+        if (params.rop & 0x08) r = _mm_or_si128(r, _mm_and_si128(s, d));
+        _mm_storeu_si128((__m128i *)(dest + i), _mm_or_si128(_mm_and_si128(r, vand), vor));
+    }
+    for (; i < bytes; i += bpp) {
+        uint32_t out = blit_rop3(params.rop, 0, blit_load(source + i, bpp), blit_load(dest + i, bpp));
+        blit_store(dest + i, (out & andMask) | orMask, bpp);
+    }
+}
+
+static inline __m128i blit_expand5_simd(__m128i v) {
+    return _mm_or_si128(_mm_slli_epi16(v, 3), _mm_srli_epi16(v, 2));
+}
+
+static inline __m128i blit_expand6_simd(__m128i v) {
+    return _mm_or_si128(_mm_slli_epi16(v, 2), _mm_srli_epi16(v, 4));
+}
+
+// Decodes count pixels into A8R8G8B8
+static void blit_decode_simd(unsigned int colorFormat, const uint8_t *source, uint32_t *out, unsigned int count) {
+    unsigned int i = 0;
+    const __m128i mask5 = _mm_set1_epi16(0x1F);
+    const __m128i mask6 = _mm_set1_epi16(0x3F);
+    const __m128i alpha16 = _mm_set1_epi16((short)0xFF00);
+
+    switch (colorFormat) {
+    case NV062_SET_COLOR_FORMAT_LE_Y8:
+        for (; i + 16 <= count; i += 16) {
+            __m128i y = _mm_loadu_si128((const __m128i *)(source + i));
+            __m128i ff = _mm_set1_epi8((char)0xFF);
+            __m128i yyLo = _mm_unpacklo_epi8(y, y);
+            __m128i yyHi = _mm_unpackhi_epi8(y, y);
+            __m128i ayLo = _mm_unpacklo_epi8(y, ff);
+            __m128i ayHi = _mm_unpackhi_epi8(y, ff);
+            _mm_storeu_si128((__m128i *)(out + i + 0), _mm_unpacklo_epi16(yyLo, ayLo));
+            _mm_storeu_si128((__m128i *)(out + i + 4), _mm_unpackhi_epi16(yyLo, ayLo));
+            _mm_storeu_si128((__m128i *)(out + i + 8), _mm_unpacklo_epi16(yyHi, ayHi));
+            _mm_storeu_si128((__m128i *)(out + i + 12), _mm_unpackhi_epi16(yyHi, ayHi));
+        }
+        break;
+    case NV062_SET_COLOR_FORMAT_LE_X1R5G5B5_Z1R5G5B5:
+    case NV062_SET_COLOR_FORMAT_LE_X1R5G5B5_O1R5G5B5:
+    case NV062_SET_COLOR_FORMAT_LE_R5G6B5:
+    {
+        bool is565 = colorFormat == NV062_SET_COLOR_FORMAT_LE_R5G6B5;
+        for (; i + 8 <= count; i += 8) {
+            __m128i p = _mm_loadu_si128((const __m128i *)(source + i * 2));
+            __m128i r, g;
+            if (is565) {
+                r = blit_expand5_simd(_mm_srli_epi16(p, 11));
+                g = blit_expand6_simd(_mm_and_si128(_mm_srli_epi16(p, 5), mask6));
+            }
+            else {
+                r = blit_expand5_simd(_mm_and_si128(_mm_srli_epi16(p, 10), mask5));
+                g = blit_expand5_simd(_mm_and_si128(_mm_srli_epi16(p, 5), mask5));
+            }
+            __m128i b = blit_expand5_simd(_mm_and_si128(p, mask5));
+            __m128i gb = _mm_or_si128(_mm_slli_epi16(g, 8), b);
+            __m128i ar = _mm_or_si128(alpha16, r);
+            _mm_storeu_si128((__m128i *)(out + i + 0), _mm_unpacklo_epi16(gb, ar));
+            _mm_storeu_si128((__m128i *)(out + i + 4), _mm_unpackhi_epi16(gb, ar));
+        }
+        break;
+    }
+    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8_Z8R8G8B8:
+    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8_O8R8G8B8:
+    {
+        const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+        for (; i + 4 <= count; i += 4) {
+            __m128i p = _mm_loadu_si128((const __m128i *)(source + i * 4));
+            _mm_storeu_si128((__m128i *)(out + i), _mm_or_si128(p, alpha));
+        }
+        break;
+    }
+    case NV062_SET_COLOR_FORMAT_LE_X1A7R8G8B8_Z1A7R8G8B8:
+    case NV062_SET_COLOR_FORMAT_LE_X1A7R8G8B8_O1A7R8G8B8:
+    {
+        const __m128i rgbMask = _mm_set1_epi32(0x00FFFFFF);
+        const __m128i a7Mask = _mm_set1_epi32(0x7F);
+        for (; i + 4 <= count; i += 4) {
+            __m128i p = _mm_loadu_si128((const __m128i *)(source + i * 4));
+            __m128i a7 = _mm_and_si128(_mm_srli_epi32(p, 24), a7Mask);
+            __m128i a8 = _mm_or_si128(_mm_slli_epi32(a7, 1), _mm_srli_epi32(a7, 6));
+            _mm_storeu_si128((__m128i *)(out + i), _mm_or_si128(_mm_and_si128(p, rgbMask), _mm_slli_epi32(a8, 24)));
+        }
+        break;
+    }
+    case NV062_SET_COLOR_FORMAT_LE_A8R8G8B8:
+        memcpy(out, source, count * 4);
+        i = count;
+        break;
+    }
+
+    unsigned int bpp = nv2a_blit_bytes_per_pixel(colorFormat);
+    for (; i < count; i++) {
+        out[i] = blit_decode(colorFormat, blit_load(source + i * bpp, bpp));
+    }
+}
+
+// Packs 32-bit lanes holding 16-bit values without signed saturation
+static inline __m128i blit_pack_u16(__m128i lo, __m128i hi) {
+    lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+    hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+    return _mm_packs_epi32(lo, hi);
+}
+
+// Encodes count A8R8G8B8 pixels into the surface format
+static void blit_encode_simd(unsigned int colorFormat, const uint32_t *colors, uint8_t *dest, unsigned int count) {
+    unsigned int i = 0;
+    uint32_t andMask, orMask;
+    blit_format_masks(colorFormat, &andMask, &orMask);
+
+    switch (colorFormat) {
+    case NV062_SET_COLOR_FORMAT_LE_Y8:
+    {
+        const __m128i byteMask = _mm_set1_epi32(0xFF);
+        for (; i + 16 <= count; i += 16) {
+            __m128i c0 = _mm_and_si128(_mm_loadu_si128((const __m128i *)(colors + i + 0)), byteMask);
+            __m128i c1 = _mm_and_si128(_mm_loadu_si128((const __m128i *)(colors + i + 4)), byteMask);
+            __m128i c2 = _mm_and_si128(_mm_loadu_si128((const __m128i *)(colors + i + 8)), byteMask);
+            __m128i c3 = _mm_and_si128(_mm_loadu_si128((const __m128i *)(colors + i + 12)), byteMask);
+            __m128i packed = _mm_packus_epi16(_mm_packs_epi32(c0, c1), _mm_packs_epi32(c2, c3));
+            _mm_storeu_si128((__m128i *)(dest + i), packed);
+        }
+        break;
+    }
+    case NV062_SET_COLOR_FORMAT_LE_X1R5G5B5_Z1R5G5B5:
+    case NV062_SET_COLOR_FORMAT_LE_X1R5G5B5_O1R5G5B5:
+    case NV062_SET_COLOR_FORMAT_LE_R5G6B5:
+    {
+        bool is565 = colorFormat == NV062_SET_COLOR_FORMAT_LE_R5G6B5;
+        const __m128i rMask = _mm_set1_epi32(is565 ? 0xF800 : 0x7C00);
+        const __m128i gMask = _mm_set1_epi32(is565 ? 0x07E0 : 0x03E0);
+        const __m128i bMask = _mm_set1_epi32(0x001F);
+        const __m128i vor = _mm_set1_epi16((short)orMask);
+        for (; i + 8 <= count; i += 8) {
+            __m128i packed[2];
+            for (int half = 0; half < 2; half++) {
+                __m128i c = _mm_loadu_si128((const __m128i *)(colors + i + half * 4));
+                __m128i r = _mm_and_si128(is565 ? _mm_srli_epi32(c, 8) : _mm_srli_epi32(c, 9), rMask);
+                __m128i g = _mm_and_si128(is565 ? _mm_srli_epi32(c, 5) : _mm_srli_epi32(c, 6), gMask);
+                __m128i b = _mm_and_si128(_mm_srli_epi32(c, 3), bMask);
+                packed[half] = _mm_or_si128(_mm_or_si128(r, g), b);
+            }
+            __m128i p = _mm_or_si128(blit_pack_u16(packed[0], packed[1]), vor);
+            _mm_storeu_si128((__m128i *)(dest + i * 2), p);
+        }
+        break;
+    }
+    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8_Z8R8G8B8:
+    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8_O8R8G8B8:
+    case NV062_SET_COLOR_FORMAT_LE_A8R8G8B8:
+    {
+        const __m128i vand = _mm_set1_epi32((int)andMask);
+        const __m128i vor = _mm_set1_epi32((int)orMask);
+        for (; i + 4 <= count; i += 4) {
+            __m128i c = _mm_loadu_si128((const __m128i *)(colors + i));
+            _mm_storeu_si128((__m128i *)(dest + i * 4), _mm_or_si128(_mm_and_si128(c, vand), vor));
+        }
+        break;
+    }
+    case NV062_SET_COLOR_FORMAT_LE_X1A7R8G8B8_Z1A7R8G8B8:
+    case NV062_SET_COLOR_FORMAT_LE_X1A7R8G8B8_O1A7R8G8B8:
+    {
+        const __m128i rgbMask = _mm_set1_epi32(0x00FFFFFF);
+        const __m128i a7Mask = _mm_set1_epi32(0x7F000000);
+        const __m128i vor = _mm_set1_epi32((int)orMask);
+        for (; i + 4 <= count; i += 4) {
+            __m128i c = _mm_loadu_si128((const __m128i *)(colors + i));
+            __m128i p = _mm_or_si128(_mm_and_si128(c, rgbMask), _mm_and_si128(_mm_srli_epi32(c, 1), a7Mask));
+            _mm_storeu_si128((__m128i *)(dest + i * 4), _mm_or_si128(p, vor));
+        }
+        break;
+    }
+    }
+
+    unsigned int bpp = nv2a_blit_bytes_per_pixel(colorFormat);
+    for (; i < count; i++) {
+        blit_store(dest + i * bpp, blit_encode(colorFormat, colors[i]), bpp);
+    }
+}
+
+// x * f / 255 on 16-bit lanes, rounded to nearest
+static inline __m128i blit_mul255_simd(__m128i x, __m128i f) {
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(x, f), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+static inline __m128i blit_broadcast_alpha(__m128i x) {
+    x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm_shufflehi_epi16(x, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+// Blends count A8R8G8B8 pixels of source into dest in place
+static void blit_blend_simd(const BlitParams& params, const uint32_t *source, uint32_t *dest, unsigned int count) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i max = _mm_set1_epi16(255);
+
+    uint32_t beta1 = blit_beta1_factor(params.beta1);
+    const __m128i f1 = _mm_set1_epi16((short)beta1);
+    const __m128i f1inv = _mm_set1_epi16((short)(255 - beta1));
+
+    uint32_t b4 = params.beta4;
+    const __m128i f4 = _mm_set_epi16(
+        (short)(b4 >> 24), (short)((b4 >> 16) & 0xFF), (short)((b4 >> 8) & 0xFF), (short)(b4 & 0xFF),
+        (short)(b4 >> 24), (short)((b4 >> 16) & 0xFF), (short)((b4 >> 8) & 0xFF), (short)(b4 & 0xFF));
+
+    unsigned int i = 0;
+    if (params.operation == NV09F_SET_OPERATION_SRCCOPY_PREMULT) {
+        // The destination is overwritten without being read, so it isn't
+        // even decoded by the caller
+        for (; i + 4 <= count; i += 4) {
+            __m128i s = _mm_loadu_si128((const __m128i *)(source + i));
+            __m128i outLo = blit_mul255_simd(_mm_unpacklo_epi8(s, zero), f4);
+            __m128i outHi = blit_mul255_simd(_mm_unpackhi_epi8(s, zero), f4);
+            _mm_storeu_si128((__m128i *)(dest + i), _mm_packus_epi16(outLo, outHi));
+        }
+        for (; i < count; i++) {
+            dest[i] = blit_blend_color(params, source[i], 0);
+        }
+        return;
+    }
+
+    for (; i + 4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(source + i));
+        __m128i d = _mm_loadu_si128((const __m128i *)(dest + i));
+        __m128i sLo = _mm_unpacklo_epi8(s, zero);
+        __m128i sHi = _mm_unpackhi_epi8(s, zero);
+        __m128i dLo = _mm_unpacklo_epi8(d, zero);
+        __m128i dHi = _mm_unpackhi_epi8(d, zero);
+        __m128i outLo, outHi;
+
+        switch (params.operation) {
+        case NV09F_SET_OPERATION_BLEND_AND:
+            outLo = _mm_add_epi16(blit_mul255_simd(sLo, f1), blit_mul255_simd(dLo, f1inv));
+            outHi = _mm_add_epi16(blit_mul255_simd(sHi, f1), blit_mul255_simd(dHi, f1inv));
+            break;
+        default: // NV09F_SET_OPERATION_BLEND_PREMULT
+        {
+            __m128i pLo = blit_mul255_simd(sLo, f4);
+            __m128i pHi = blit_mul255_simd(sHi, f4);
+            outLo = _mm_add_epi16(pLo, blit_mul255_simd(dLo, _mm_sub_epi16(max, blit_broadcast_alpha(pLo))));
+            outHi = _mm_add_epi16(pHi, blit_mul255_simd(dHi, _mm_sub_epi16(max, blit_broadcast_alpha(pHi))));
+            break;
+        }
+        }
+
+        _mm_storeu_si128((__m128i *)(dest + i), _mm_packus_epi16(outLo, outHi));
+    }
+
+    for (; i < count; i++) {
+        dest[i] = blit_blend_color(params, source[i], dest[i]);
+    }
+}
+
+static void blit_blend_row_simd(const BlitParams& params, const uint8_t *source, uint8_t *dest) {
+    if (blit_is_luminance_wide(params.colorFormat)) {
+        blit_row_scalar(params, source, dest);
+        return;
+    }
+
+    unsigned int bpp = nv2a_blit_bytes_per_pixel(params.colorFormat);
+    alignas(16) uint32_t sourceColors[BLIT_CHUNK_PIXELS];
+    alignas(16) uint32_t destColors[BLIT_CHUNK_PIXELS];
+
+    for (unsigned int x = 0; x < params.width; x += BLIT_CHUNK_PIXELS) {
+        unsigned int count = params.width - x;
+        if (count > BLIT_CHUNK_PIXELS) {
+            count = BLIT_CHUNK_PIXELS;
+        }
+        blit_decode_simd(params.colorFormat, source + x * bpp, sourceColors, count);
+        if (params.operation != NV09F_SET_OPERATION_SRCCOPY_PREMULT) {
+            blit_decode_simd(params.colorFormat, dest + x * bpp, destColors, count);
+        }
+        blit_blend_simd(params, sourceColors, destColors, count);
+        blit_encode_simd(params.colorFormat, destColors, dest + x * bpp, count);
+    }
+}
+
+static void blit_row_simd(const BlitParams& params, const uint8_t *source, uint8_t *dest) {
+    switch (params.operation) {
+    case NV09F_SET_OPERATION_SRCCOPY_AND:
+    case NV09F_SET_OPERATION_SRCCOPY:
+        blit_copy_row_simd(params, source, dest);
+        break;
+    case NV09F_SET_OPERATION_ROP_AND:
+        blit_rop_row_simd(params, source, dest);
+        break;
+    default:
+        blit_blend_row_simd(params, source, dest);
+        break;
+    }
+}
+
+// ----- Driver ----------------------------------------------------------------
+
+typedef void (*BlitRowFunc)(const BlitParams& params, const uint8_t *source, uint8_t *dest);
+
+static void blit_rows(const BlitParams& params, BlitRowFunc rowFunc) {
+    unsigned int bpp = nv2a_blit_bytes_per_pixel(params.colorFormat);
+    if (bpp == 0) {
+        log_warning("NV2A blit: Unknown surface format 0x%x\n", params.colorFormat);
+        return;
+    }
+    switch (params.operation) {
+    case NV09F_SET_OPERATION_SRCCOPY_AND:
+    case NV09F_SET_OPERATION_ROP_AND:
+    case NV09F_SET_OPERATION_BLEND_AND:
+    case NV09F_SET_OPERATION_SRCCOPY:
+    case NV09F_SET_OPERATION_SRCCOPY_PREMULT:
+    case NV09F_SET_OPERATION_BLEND_PREMULT:
+        break;
+    default:
+        log_warning("NV2A blit: Unknown operation %u\n", params.operation);
+        return;
+    }
+    if (params.width == 0 || params.height == 0) {
+        return;
+    }
+
+    unsigned int rowBytes = params.width * bpp;
+    const uint8_t *sourceStart = params.source;
+    const uint8_t *sourceEnd = params.source + (params.height - 1) * params.sourcePitch + rowBytes;
+    const uint8_t *destStart = params.dest;
+    const uint8_t *destEnd = params.dest + (params.height - 1) * params.destPitch + rowBytes;
+    bool overlap = sourceStart < destEnd && destStart < sourceEnd;
+
+    if (!overlap) {
+        for (unsigned int y = 0; y < params.height; y++) {
+            rowFunc(params, params.source + y * params.sourcePitch, params.dest + y * params.destPitch);
+        }
+        return;
+    }
+
+    if (params.sourcePitch != params.destPitch) {
+        // Rows interleave in ways that cannot be ordered; copy the whole
+        // source rectangle out first.
+        std::vector<uint8_t> staged(rowBytes * params.height);
+        for (unsigned int y = 0; y < params.height; y++) {
+            memcpy(&staged[y * rowBytes], params.source + y * params.sourcePitch, rowBytes);
+        }
+        for (unsigned int y = 0; y < params.height; y++) {
+            rowFunc(params, &staged[y * rowBytes], params.dest + y * params.destPitch);
+        }
+        return;
+    }
+
+    // With equal pitches, walking the rows away from the destination means
+    // a row is never overwritten before it is read. Each row is staged so
+    // that horizontal overlap within a row is also safe.
+    std::vector<uint8_t> row(rowBytes);
+    bool bottomUp = destStart > sourceStart;
+    for (unsigned int i = 0; i < params.height; i++) {
+        unsigned int y = bottomUp ? params.height - 1 - i : i;
+        memcpy(&row[0], params.source + y * params.sourcePitch, rowBytes);
+        rowFunc(params, &row[0], params.dest + y * params.destPitch);
+    }
+}
+
+void nv2a_blit(const BlitParams& params) {
+    blit_rows(params, blit_row_simd);
+}
+
+void nv2a_blit_scalar(const BlitParams& params) {
+    blit_rows(params, blit_row_scalar);
+}
+
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+namespace openxbox {
+
+/*!
+ * Parameters of a single NV_IMAGE_BLIT operation, resolved to host pointers.
+ * Source and destination may overlap; the result is the same as if the
+ * source rectangle had been copied out before any pixel was written.
+ */
+struct BlitParams {
+    const uint8_t *source = nullptr;  // top-left pixel of the source rectangle
+    uint8_t *dest = nullptr;          // top-left pixel of the destination rectangle
+    unsigned int sourcePitch = 0;
+    unsigned int destPitch = 0;
+    unsigned int width = 0;
+    unsigned int height = 0;
+    unsigned int colorFormat = 0;     // NV062_SET_COLOR_FORMAT_LE_*
+    unsigned int operation = 0;       // NV09F_SET_OPERATION_*
+    uint8_t rop = 0xCC;               // ROP3 code, used by ROP_AND
+    uint32_t beta1 = 0;               // 1.31 fixed point, used by BLEND_AND
+    uint32_t beta4 = 0xFFFFFFFF;      // A8R8G8B8, used by the PREMULT operations
+};
+
+// Returns the size of a pixel in the given 2D surface format, or 0 if the
+// format is unknown.
+unsigned int nv2a_blit_bytes_per_pixel(unsigned int colorFormat);
+
+// Performs the blit using SSE2 row kernels.
+void nv2a_blit(const BlitParams& params);
+
+// Performs the blit one pixel at a time. This is the reference
+// implementation the vectorized path is checked and benchmarked against.
+void nv2a_blit_scalar(const BlitParams& params);
+
+}
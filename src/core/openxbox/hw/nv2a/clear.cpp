@@ -0,0 +1,366 @@
+#include "clear.h"
+#include "nv2a_int.h"
+#include "openxbox/log.h"
+#include "openxbox/thread.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <emmintrin.h>
+
+namespace openxbox {
+
+// ----- Clear values ----------------------------------------------------------
+
+bool nv2a_clear_color_value(unsigned int colorFormat, uint32_t clearValue, uint32_t clearFlags, uint32_t *value, uint32_t *mask) {
+    uint32_t r = 0, g = 0, b = 0, a = 0;  // channel bits
+    uint32_t x = 0, xValue = 0;           // unused bits and the value they're written as
+    switch (colorFormat) {
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_Z1R5G5B5:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_O1R5G5B5:
+        r = 0x7C00; g = 0x03E0; b = 0x001F; x = 0x8000;
+        xValue = (colorFormat == NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_O1R5G5B5) ? x : 0;
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_R5G6B5:
+        r = 0xF800; g = 0x07E0; b = 0x001F;
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X8R8G8B8_Z8R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X8R8G8B8_O8R8G8B8:
+        r = 0x00FF0000; g = 0x0000FF00; b = 0x000000FF; x = 0xFF000000;
+        xValue = (colorFormat == NV097_SET_SURFACE_FORMAT_COLOR_LE_X8R8G8B8_O8R8G8B8) ? x : 0;
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1A7R8G8B8_Z1A7R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1A7R8G8B8_O1A7R8G8B8:
+        r = 0x00FF0000; g = 0x0000FF00; b = 0x000000FF; a = 0x7F000000; x = 0x80000000;
+        xValue = (colorFormat == NV097_SET_SURFACE_FORMAT_COLOR_LE_X1A7R8G8B8_O1A7R8G8B8) ? x : 0;
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_A8R8G8B8:
+        r = 0x00FF0000; g = 0x0000FF00; b = 0x000000FF; a = 0xFF000000;
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_B8:
+        b = 0xFF;
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_G8B8:
+        g = 0xFF00; b = 0x00FF;
+        break;
+    default:
+        return false;
+    }
+
+    uint32_t channels = 0;
+    if (clearFlags & NV097_CLEAR_SURFACE_R) channels |= r;
+    if (clearFlags & NV097_CLEAR_SURFACE_G) channels |= g;
+    if (clearFlags & NV097_CLEAR_SURFACE_B) channels |= b;
+    if (clearFlags & NV097_CLEAR_SURFACE_A) channels |= a;
+
+    // The unused bits are rewritten along with any channel
+    *mask = channels ? (channels | x) : 0;
+    *value = (clearValue & channels) | (channels ? xValue : 0);
+    return true;
+}
+
+bool nv2a_clear_zeta_value(unsigned int zetaFormat, uint32_t clearValue, uint32_t clearFlags, uint32_t *value, uint32_t *mask) {
+    switch (zetaFormat) {
+    case NV097_SET_SURFACE_FORMAT_ZETA_Z16:
+        *mask = (clearFlags & NV097_CLEAR_SURFACE_Z) ? 0xFFFF : 0;
+        *value = clearValue & 0xFFFF;
+        return true;
+    case NV097_SET_SURFACE_FORMAT_ZETA_Z24S8:
+        // Depth lives in the upper 24 bits and stencil in the lower 8
+        *mask = ((clearFlags & NV097_CLEAR_SURFACE_Z) ? 0xFFFFFF00 : 0)
+            | ((clearFlags & NV097_CLEAR_SURFACE_STENCIL) ? 0x000000FF : 0);
+        *value = clearValue;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// ----- Helpers --------------------------------------------------------------
+
+static uint32_t clear_deposit_bits(uint32_t value, uint32_t mask) {
+    uint32_t result = 0;
+    for (uint32_t bit = 1; mask != 0; bit <<= 1) {
+        uint32_t lowest = mask & (~mask + 1);
+        if (value & bit) {
+            result |= lowest;
+        }
+        mask &= mask - 1;
+    }
+    return result;
+}
+
+// Repeats a pixel across 32 bits so that any 32-bit word starting on a
+// pixel boundary holds whole pixels
+static inline uint32_t clear_replicate(uint32_t value, unsigned int bpp) {
+    switch (bpp) {
+    case 1: return (value & 0xFF) * 0x01010101;
+    case 2: return (value & 0xFFFF) * 0x00010001;
+    default: return value;
+    }
+}
+
+static inline void clear_pixel(uint8_t *p, unsigned int bpp, uint32_t value, uint32_t mask) {
+    uint32_t d = 0;
+    memcpy(&d, p, bpp);
+    d = (d & ~mask) | (value & mask);
+    memcpy(p, &d, bpp);
+}
+
+// Fills a contiguous run of pixels. value and mask are replicated.
+static void clear_span(uint8_t *dest, size_t bytes, unsigned int bpp, uint32_t value, uint32_t mask) {
+    size_t i = 0;
+
+    // Step to a 16 byte boundary one pixel at a time, which keeps the
+    // pattern in phase with the pixels
+    bool pixelAligned = ((uintptr_t)dest % bpp) == 0;
+    if (pixelAligned) {
+        while (i < bytes && ((uintptr_t)(dest + i) & 15) != 0) {
+            clear_pixel(dest + i, bpp, value, mask);
+            i += bpp;
+        }
+    }
+
+    size_t end = i + ((bytes - i) & ~(size_t)63);
+    size_t end16 = i + ((bytes - i) & ~(size_t)15);
+    __m128i v = _mm_set1_epi32((int)value);
+    if (mask == 0xFFFFFFFF && pixelAligned) {
+        if (bytes >= NV2A_CLEAR_STREAM_THRESHOLD) {
+            for (; i < end; i += 64) {
+                _mm_stream_si128((__m128i *)(dest + i), v);
+                _mm_stream_si128((__m128i *)(dest + i + 16), v);
+                _mm_stream_si128((__m128i *)(dest + i + 32), v);
+                _mm_stream_si128((__m128i *)(dest + i + 48), v);
+            }
+            _mm_sfence();
+        }
+        else {
+            for (; i < end; i += 64) {
+                _mm_store_si128((__m128i *)(dest + i), v);
+                _mm_store_si128((__m128i *)(dest + i + 16), v);
+                _mm_store_si128((__m128i *)(dest + i + 32), v);
+                _mm_store_si128((__m128i *)(dest + i + 48), v);
+            }
+        }
+        for (; i < end16; i += 16) {
+            _mm_store_si128((__m128i *)(dest + i), v);
+        }
+    }
+    else if (mask == 0xFFFFFFFF) {
+        for (; i < end; i += 64) {
+            _mm_storeu_si128((__m128i *)(dest + i), v);
+            _mm_storeu_si128((__m128i *)(dest + i + 16), v);
+            _mm_storeu_si128((__m128i *)(dest + i + 32), v);
+            _mm_storeu_si128((__m128i *)(dest + i + 48), v);
+        }
+        for (; i < end16; i += 16) {
+            _mm_storeu_si128((__m128i *)(dest + i), v);
+        }
+    }
+    else {
+        __m128i m = _mm_set1_epi32((int)mask);
+        v = _mm_and_si128(v, m);
+        for (; i < end16; i += 16) {
+            __m128i d = _mm_loadu_si128((const __m128i *)(dest + i));
+            _mm_storeu_si128((__m128i *)(dest + i), _mm_or_si128(_mm_andnot_si128(m, d), v));
+        }
+    }
+
+    for (; i + bpp <= bytes; i += bpp) {
+        clear_pixel(dest + i, bpp, value, mask);
+    }
+}
+
+// Clamps the rectangle to the surface. A swizzled surface cleared in its
+// entirety is one contiguous block, so it's turned into a pitch surface
+// with the same footprint.
+static ClearParams clear_normalize(const ClearParams& params) {
+    ClearParams result = params;
+    result.xmax = std::min(result.xmax, result.width);
+    result.ymax = std::min(result.ymax, result.height);
+    if (result.xmin >= result.xmax || result.ymin >= result.ymax) {
+        result.xmax = result.xmin;
+        result.ymax = result.ymin;
+        return result;
+    }
+
+    if (result.swizzled && result.xmin == 0 && result.ymin == 0
+        && result.xmax == result.width && result.ymax == result.height)
+    {
+        result.swizzled = false;
+        result.pitch = result.width * result.bytesPerPixel;
+    }
+    return result;
+}
+
+// Clears rows [y0, y1) of a normalized rectangle
+static void clear_rows(const ClearParams& params, unsigned int y0, unsigned int y1) {
+    unsigned int bpp = params.bytesPerPixel;
+    uint32_t value = clear_replicate(params.value, bpp);
+    uint32_t mask = clear_replicate(params.mask, bpp);
+
+    if (params.swizzled) {
+        uint32_t maskX = params.swizzleMaskX;
+        uint32_t startX = clear_deposit_bits(params.xmin, maskX);
+        for (unsigned int y = y0; y < y1; y++) {
+            uint32_t offsetY = clear_deposit_bits(y, params.swizzleMaskY);
+            uint32_t swizzledX = startX;
+            for (unsigned int x = params.xmin; x < params.xmax; x++) {
+                uint32_t offset = (swizzledX | offsetY) * bpp;
+                if (offset + bpp <= params.size) {
+                    clear_pixel(params.dest + offset, bpp, value, mask);
+                }
+                // Increments the X coordinate within the bits of the mask
+                swizzledX = ((swizzledX | ~maskX) + 1) & maskX;
+            }
+        }
+        return;
+    }
+
+    size_t rowBytes = (size_t)(params.xmax - params.xmin) * bpp;
+
+    // Rows that span the whole pitch form a single run
+    if (params.xmin == 0 && rowBytes == params.pitch) {
+        size_t offset = (size_t)y0 * params.pitch;
+        if (offset < params.size) {
+            size_t bytes = std::min((size_t)(y1 - y0) * params.pitch, params.size - offset);
+            clear_span(params.dest + offset, bytes - bytes % bpp, bpp, value, mask);
+        }
+        return;
+    }
+
+    for (unsigned int y = y0; y < y1; y++) {
+        size_t offset = (size_t)y * params.pitch + (size_t)params.xmin * bpp;
+        if (offset >= params.size) {
+            break;
+        }
+        size_t bytes = std::min(rowBytes, params.size - offset);
+        clear_span(params.dest + offset, bytes - bytes % bpp, bpp, value, mask);
+    }
+}
+
+// ----- Entry points ----------------------------------------------------------
+
+void nv2a_clear(const ClearParams& params) {
+    if (params.mask == 0 || params.bytesPerPixel == 0) {
+        return;
+    }
+
+    ClearParams clear = clear_normalize(params);
+    clear_rows(clear, clear.ymin, clear.ymax);
+}
+
+void nv2a_clear_scalar(const ClearParams& params) {
+    if (params.mask == 0 || params.bytesPerPixel == 0) {
+        return;
+    }
+
+    unsigned int bpp = params.bytesPerPixel;
+    unsigned int xmax = std::min(params.xmax, params.width);
+    unsigned int ymax = std::min(params.ymax, params.height);
+    for (unsigned int y = params.ymin; y < ymax; y++) {
+        for (unsigned int x = params.xmin; x < xmax; x++) {
+            uint32_t offset = params.swizzled
+                ? (clear_deposit_bits(x, params.swizzleMaskX) | clear_deposit_bits(y, params.swizzleMaskY)) * bpp
+                : y * params.pitch + x * bpp;
+            if (offset + bpp <= params.size) {
+                clear_pixel(params.dest + offset, bpp, params.value, params.mask);
+            }
+        }
+    }
+}
+
+// ----- Worker pool -----------------------------------------------------------
+
+ClearEngine::ClearEngine(int workerCount) {
+    if (workerCount < 0) {
+        unsigned int cores = std::thread::hardware_concurrency();
+        workerCount = (cores > 1) ? (int)cores - 1 : 0;
+    }
+    workerCount = std::min(workerCount, NV2A_CLEAR_MAX_WORKERS);
+
+    for (int i = 0; i < workerCount; i++) {
+        m_workers.push_back(std::thread(WorkerThread, this));
+    }
+}
+
+ClearEngine::~ClearEngine() {
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_running = false;
+        m_jobCond.notify_all();
+    }
+    for (std::thread& worker : m_workers) {
+        worker.join();
+    }
+}
+
+void ClearEngine::Clear(const ClearParams& params) {
+    if (params.mask == 0 || params.bytesPerPixel == 0) {
+        return;
+    }
+
+    ClearParams clear = clear_normalize(params);
+    unsigned int rows = clear.ymax - clear.ymin;
+    uint64_t bytes = (uint64_t)rows * (clear.xmax - clear.xmin) * clear.bytesPerPixel;
+    unsigned int bands = std::min((unsigned int)m_workers.size() + 1, rows);
+    if (bands <= 1 || bytes < NV2A_CLEAR_PARALLEL_THRESHOLD) {
+        clear_rows(clear, clear.ymin, clear.ymax);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_job = clear;
+        m_bandCount = bands;
+        m_nextBand = 0;
+        m_pendingBands = bands;
+        m_jobSerial++;
+        m_jobCond.notify_all();
+    }
+
+    // Help out instead of waiting idle
+    RunBands();
+
+    std::unique_lock<std::mutex> lk(m_mutex);
+    m_doneCond.wait(lk, [&]() -> bool { return m_pendingBands == 0; });
+}
+
+void ClearEngine::RunBands() {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    while (m_nextBand < m_bandCount) {
+        unsigned int band = m_nextBand++;
+        unsigned int rows = m_job.ymax - m_job.ymin;
+        unsigned int y0 = m_job.ymin + (unsigned int)((uint64_t)rows * band / m_bandCount);
+        unsigned int y1 = m_job.ymin + (unsigned int)((uint64_t)rows * (band + 1) / m_bandCount);
+        ClearParams job = m_job;
+        lk.unlock();
+
+        clear_rows(job, y0, y1);
+
+        lk.lock();
+        if (--m_pendingBands == 0) {
+            m_doneCond.notify_all();
+        }
+    }
+}
+
+void ClearEngine::WorkerThread(ClearEngine *engine) {
+    Thread_SetName("[HW] NV2A Clear");
+
+    uint64_t lastSerial = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lk(engine->m_mutex);
+            engine->m_jobCond.wait(lk, [&]() -> bool { return engine->m_jobSerial != lastSerial || !engine->m_running; });
+            if (!engine->m_running) {
+                break;
+            }
+            lastSerial = engine->m_jobSerial;
+        }
+
+        engine->RunBands();
+    }
+}
+
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace openxbox {
+
+// Fills at least this large bypass the cache with non-temporal stores
+#define NV2A_CLEAR_STREAM_THRESHOLD    (512 * 1024)
+
+// Clears at least this large are split across the worker threads
+#define NV2A_CLEAR_PARALLEL_THRESHOLD  (256 * 1024)
+#define NV2A_CLEAR_MAX_WORKERS         4
+
+/*!
+ * A rectangle of a color or zeta surface to be filled with a single value,
+ * resolved to host pointers.
+ */
+struct ClearParams {
+    uint8_t *dest = nullptr;        // first byte of the surface
+    uint32_t size = 0;              // bytes of the surface backed by memory
+    unsigned int bytesPerPixel = 0; // 1, 2 or 4
+    unsigned int pitch = 0;         // pitch surfaces only
+    bool swizzled = false;
+    uint32_t swizzleMaskX = 0;      // swizzled surfaces only
+    uint32_t swizzleMaskY = 0;
+    unsigned int width = 0;         // surface size; 1 << log size for swizzled surfaces
+    unsigned int height = 0;
+    unsigned int xmin = 0;          // rectangle to clear, max exclusive
+    unsigned int ymin = 0;
+    unsigned int xmax = 0;
+    unsigned int ymax = 0;
+    uint32_t value = 0;             // pixel value in the surface format
+    uint32_t mask = 0xFFFFFFFF;     // bits of each pixel that are written
+};
+
+// Computes the pixel value and write mask clearing the channels selected by
+// NV097_CLEAR_SURFACE on a color surface. Returns false if the format is
+// unknown.
+bool nv2a_clear_color_value(unsigned int colorFormat, uint32_t clearValue, uint32_t clearFlags, uint32_t *value, uint32_t *mask);
+
+// Same for the depth and stencil parts of a zeta surface. Z16 surfaces have
+// no stencil.
+bool nv2a_clear_zeta_value(unsigned int zetaFormat, uint32_t clearValue, uint32_t clearFlags, uint32_t *value, uint32_t *mask);
+
+// Performs the clear on the calling thread using SSE2 stores.
+void nv2a_clear(const ClearParams& params);
+
+// Performs the clear one pixel at a time. This is the reference
+// implementation the vectorized path is checked and benchmarked against.
+void nv2a_clear_scalar(const ClearParams& params);
+
+/*!
+ * Performs clears, splitting large ones into bands of rows that are filled
+ * in parallel by a small pool of worker threads and the calling thread.
+ */
+class ClearEngine {
+public:
+    // workerCount is capped to NV2A_CLEAR_MAX_WORKERS. By default, one
+    // worker is started for every additional host core.
+    ClearEngine(int workerCount = -1);
+    ~ClearEngine();
+
+    void Clear(const ClearParams& params);
+
+    unsigned int GetWorkerCount() const { return (unsigned int)m_workers.size(); }
+
+private:
+    static void WorkerThread(ClearEngine *engine);
+    void RunBands();
+
+    std::vector<std::thread> m_workers;
+    bool m_running = true;
+
+    std::mutex m_mutex;
+    std::condition_variable m_jobCond;
+    std::condition_variable m_doneCond;
+
+    ClearParams m_job;
+    uint64_t m_jobSerial = 0;
+    unsigned int m_bandCount = 0;
+    unsigned int m_nextBand = 0;
+    unsigned int m_pendingBands = 0;
+};
+
+}
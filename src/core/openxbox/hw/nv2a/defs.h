@@ -1,8 +1,10 @@
 #pragma once
 
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
 #include <queue>
+#include <thread>
 #include "nv2a_int.h"
 
 namespace openxbox {
@@ -70,12 +72,27 @@ typedef struct VGACommonState {
 
 typedef struct ImageBlitState {
     uint32_t context_surfaces;
+    uint32_t context_rop;
+    uint32_t context_beta1;
+    uint32_t context_beta4;
     unsigned int operation;
     unsigned int in_x, in_y;
     unsigned int out_x, out_y;
     unsigned int width, height;
 } ImageBlitState;
 
+typedef struct BetaState {
+    uint32_t beta;
+} BetaState;
+
+typedef struct RopState {
+    uint8_t rop;
+} RopState;
+
+typedef struct Beta4State {
+    uint32_t beta_factor;
+} Beta4State;
+
 typedef struct KelvinState {
     uint32_t dma_notifies;
     uint32_t dma_state;
@@ -105,6 +122,10 @@ typedef struct GraphicsObject {
 
         ImageBlitState image_blit;
 
+        BetaState beta;
+        RopState rop;
+        Beta4State beta4;
+
         KelvinState kelvin;
     } data;
 } GraphicsObject;
@@ -237,6 +258,7 @@ typedef struct NV2APGRAPH {
     //ShaderBinding *shader_binding;
 
     bool texture_matrix_enable[NV2A_MAX_TEXTURES] = { false };
+    bool specular_enable = false;
 
     /* FIXME: Move to NV_PGRAPH_BUMPMAT... */
     float bump_env_matrix[NV2A_MAX_TEXTURES - 1][4]; /* 3 allowed stages with 2x2 matrix each */
@@ -261,8 +283,9 @@ typedef struct NV2APGRAPH {
     unsigned int primitive_mode = 0;
 
     bool enable_vertex_program_write = false;
+    bool vertex_program_dirty = true;
 
-    //uint32_t program_data[NV2A_MAX_TRANSFORM_PROGRAM_LENGTH][VSH_TOKEN_SIZE];
+    uint32_t program_data[NV2A_MAX_TRANSFORM_PROGRAM_LENGTH][VSH_TOKEN_SIZE] = { { 0 } };
 
     uint32_t vsh_constants[NV2A_VERTEXSHADER_CONSTANTS][4] = { { 0 } };
     bool vsh_constants_dirty[NV2A_VERTEXSHADER_CONSTANTS] = { 0 };
@@ -339,6 +362,9 @@ typedef struct CacheEntry {
     uint32_t parameter = 0;
 } CacheEntry;
 
+// Maximum number of commands the DMA pusher hands to the puller at once
+#define PFIFO_PUSHER_BATCH_SIZE 64
+
 typedef struct Cache1State {
     unsigned int channel_id = 0;
     FifoMode mode = FIFO_PIO;
@@ -371,6 +397,13 @@ typedef struct Cache1State {
     std::condition_variable cache_cond;
     std::queue<CacheEntry*> cache;
     std::queue<CacheEntry*> working_cache;
+
+    /* DMA pusher worker */
+    std::mutex pusher_mutex;
+    std::condition_variable pusher_cond;
+    std::condition_variable pusher_idle_cond;
+    bool pusher_kicked = false;
+    bool pusher_busy = false;
 } Cache1State;
 
 typedef struct {
@@ -379,6 +412,7 @@ typedef struct {
     Cache1State cache1;
     uint32_t regs[NV_PFIFO_SIZE] = { 0 };
     std::thread puller_thread;
+    std::thread pusher_thread;
 } NV2APFIFO;
 
 typedef struct {
@@ -386,8 +420,9 @@ typedef struct {
 } NV2APFB;
 
 typedef struct ChannelControl {
-    uint32_t dma_put = 0;
-    uint32_t dma_get = 0;
+    // Written by the guest and the DMA pusher worker respectively
+    std::atomic<uint32_t> dma_put{ 0 };
+    std::atomic<uint32_t> dma_get{ 0 };
     uint32_t ref = 0;
 } ChannelControl;
 
@@ -649,6 +649,27 @@
 #   define NV_PRAMDAC_PLL_TEST_COUNTER_NVPLL_LOCK              (1 << 29)
 #   define NV_PRAMDAC_PLL_TEST_COUNTER_MPLL_LOCK               (1 << 30)
 #   define NV_PRAMDAC_PLL_TEST_COUNTER_VPLL_LOCK               (1 << 31)
+#define NV_PRAMDAC_GENERAL_CONTROL                       0x00000600
+#   define NV_PRAMDAC_GENERAL_CONTROL_ALT_MODE_SEL              (1 << 12)
+#define NV_PRAMDAC_FP_VDISPLAY_END                       0x00000800
+#define NV_PRAMDAC_FP_HDISPLAY_END                       0x00000820
+
+
+/* Extended CRTC registers, accessed through PRMCIO */
+#define NV_CIO_CRE_RPC0_INDEX                            0x19
+#   define NV_CIO_CRE_RPC0_OFFSET_10_8                        0xE0
+#define NV_CIO_CRE_LSR_INDEX                             0x25
+#   define NV_CIO_CRE_LSR_VDE_10                               (1 << 1)
+#define NV_CIO_CRE_PIXEL_INDEX                           0x28
+#   define NV_CIO_CRE_PIXEL_FORMAT                            0x03
+#       define NV_CIO_CRE_PIXEL_FORMAT_VGA                        0
+#       define NV_CIO_CRE_PIXEL_FORMAT_8BPP                       1
+#       define NV_CIO_CRE_PIXEL_FORMAT_16BPP                      2
+#       define NV_CIO_CRE_PIXEL_FORMAT_32BPP                      3
+#define NV_CIO_CRE_HEB__INDEX                            0x2D
+#   define NV_CIO_CRE_HEB_HDE_8                                (1 << 1)
+#define NV_CIO_CRE_42                                    0x42
+#   define NV_CIO_CRE_42_OFFSET_11                             (1 << 6)
 
 
 #define NV_USER_DMA_PUT                                  0x40
@@ -692,23 +713,48 @@
 #define NV_SET_OBJECT                                        0x00000000
 
 
+#define NV_BETA                                          0x0012
+#   define NV012_SET_BETA                                     0x00000300
+
+#define NV_ROP                                           0x0043
+#   define NV043_SET_ROP                                      0x00000300
+
 #define NV_CONTEXT_SURFACES_2D                           0x0062
 #   define NV062_SET_OBJECT                                   0x00000000
 #   define NV062_SET_CONTEXT_DMA_IMAGE_SOURCE                 0x00000184
 #   define NV062_SET_CONTEXT_DMA_IMAGE_DESTIN                 0x00000188
 #   define NV062_SET_COLOR_FORMAT                             0x00000300
 #       define NV062_SET_COLOR_FORMAT_LE_Y8                    0x01
+#       define NV062_SET_COLOR_FORMAT_LE_X1R5G5B5_Z1R5G5B5     0x02
+#       define NV062_SET_COLOR_FORMAT_LE_X1R5G5B5_O1R5G5B5     0x03
 #       define NV062_SET_COLOR_FORMAT_LE_R5G6B5                0x04
+#       define NV062_SET_COLOR_FORMAT_LE_Y16                   0x05
+#       define NV062_SET_COLOR_FORMAT_LE_X8R8G8B8_Z8R8G8B8     0x06
+#       define NV062_SET_COLOR_FORMAT_LE_X8R8G8B8_O8R8G8B8     0x07
+#       define NV062_SET_COLOR_FORMAT_LE_X1A7R8G8B8_Z1A7R8G8B8 0x08
+#       define NV062_SET_COLOR_FORMAT_LE_X1A7R8G8B8_O1A7R8G8B8 0x09
 #       define NV062_SET_COLOR_FORMAT_LE_A8R8G8B8              0x0A
+#       define NV062_SET_COLOR_FORMAT_LE_Y32                   0x0B
 #   define NV062_SET_PITCH                                    0x00000304
 #   define NV062_SET_OFFSET_SOURCE                            0x00000308
 #   define NV062_SET_OFFSET_DESTIN                            0x0000030C
 
+#define NV_BETA4                                         0x0072
+#   define NV072_SET_BETA_FACTOR                              0x00000300
+
 #define NV_IMAGE_BLIT                                    0x009F
 #   define NV09F_SET_OBJECT                                   0x00000000
+#   define NV09F_SET_CONTEXT_ROP                              0x00000190
+#   define NV09F_SET_CONTEXT_BETA1                            0x00000194
+#   define NV09F_SET_CONTEXT_BETA4                            0x00000198
 #   define NV09F_SET_CONTEXT_SURFACES                         0x0000019C
 #   define NV09F_SET_OPERATION                                0x000002FC
+#       define NV09F_SET_OPERATION_SRCCOPY_AND                    0
+#       define NV09F_SET_OPERATION_ROP_AND                        1
+#       define NV09F_SET_OPERATION_BLEND_AND                      2
 #       define NV09F_SET_OPERATION_SRCCOPY                        3
+#       define NV09F_SET_OPERATION_SRCCOPY_PREMULT                4
+#       define NV09F_SET_OPERATION_BLEND_PREMULT                  5
 #   define NV09F_CONTROL_POINT_IN                             0x00000300
 #   define NV09F_CONTROL_POINT_OUT                            0x00000304
 #   define NV09F_SIZE                                         0x00000308
@@ -894,6 +940,7 @@
 #       define NV097_SET_FRONT_FACE_V_CW                           0x900
 #       define NV097_SET_FRONT_FACE_V_CCW                          0x901
 #   define NV097_SET_NORMALIZATION_ENABLE                     0x000003A4
+#   define NV097_SET_SPECULAR_ENABLE                          0x000003B8
 #   define NV097_SET_LIGHT_ENABLE_MASK                        0x000003BC
 #           define NV097_SET_LIGHT_ENABLE_MASK_LIGHT0_OFF           0
 #           define NV097_SET_LIGHT_ENABLE_MASK_LIGHT0_INFINITE      1
@@ -1276,6 +1323,7 @@
 #define NV2A_MAX_TEXTURES 4
 
 #define NV2A_MAX_TRANSFORM_PROGRAM_LENGTH 136
+#define VSH_TOKEN_SIZE 4
 #define NV2A_VERTEXSHADER_CONSTANTS 192
 #define NV2A_MAX_LIGHTS 8
 
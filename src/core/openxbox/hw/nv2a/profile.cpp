@@ -0,0 +1,364 @@
+#include "profile.h"
+#include "nv2a_int.h"
+#include "openxbox/log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace openxbox {
+
+static const char *kClassNames[NV2A_PROFILE_CLASS_COUNT] = {
+    "beta", "surfaces_2d", "beta4", "image_blit", "kelvin", "other",
+};
+
+static const char *kBoundaryNames[] = {
+    "vblank", "flip", "end",
+};
+
+// Only the owning thread writes a counter, so a relaxed load and store is
+// enough and avoids a locked read-modify-write on every update
+static inline void profile_add(std::atomic<uint64_t>& counter, uint64_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+static inline void profile_add(std::atomic<uint32_t>& counter, uint32_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+static NV2AProfileClass profile_class(unsigned int graphicsClass) {
+    switch (graphicsClass) {
+    case NV_BETA: return NV2A_PROFILE_CLASS_BETA;
+    case NV_CONTEXT_SURFACES_2D: return NV2A_PROFILE_CLASS_CONTEXT_SURFACES_2D;
+    case NV_BETA4: return NV2A_PROFILE_CLASS_BETA4;
+    case NV_IMAGE_BLIT: return NV2A_PROFILE_CLASS_IMAGE_BLIT;
+    case NV_KELVIN_PRIMITIVE: return NV2A_PROFILE_CLASS_KELVIN;
+    default: return NV2A_PROFILE_CLASS_OTHER;
+    }
+}
+
+// Number of vertices a Kelvin method emits. Immediate mode vertices are
+// emitted by the last component written to the position attribute.
+static unsigned int profile_kelvin_vertices(unsigned int method, uint32_t parameter) {
+    switch (method) {
+    case NV097_ARRAY_ELEMENT16:
+        return 2;
+    case NV097_ARRAY_ELEMENT32:
+        return 1;
+    case NV097_DRAW_ARRAYS:
+        return ((parameter & NV097_DRAW_ARRAYS_COUNT) >> 24) + 1;
+    case NV097_SET_VERTEX3F + 8:
+    case NV097_SET_VERTEX4F + 12:
+    case NV097_SET_VERTEX_DATA2F_M + 4:
+    case NV097_SET_VERTEX_DATA2S:
+    case NV097_SET_VERTEX_DATA4UB:
+    case NV097_SET_VERTEX_DATA4S_M + 4:
+    case NV097_SET_VERTEX_DATA4F_M + 12:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Methods that feed or trigger rendering rather than change state
+static bool profile_kelvin_is_state(unsigned int method) {
+    if (method < 0x180) {
+        // Object, notification, synchronization and flip methods
+        return false;
+    }
+    if (method >= NV097_SET_VERTEX3F && method < NV097_SET_VERTEX4F + 16) {
+        return false;
+    }
+    if (method >= NV097_SET_BEGIN_END && method <= NV097_INLINE_ARRAY) {
+        return false;
+    }
+    if (method >= NV097_SET_VERTEX_DATA2F_M && method < NV097_SET_TEXTURE_OFFSET) {
+        return false;
+    }
+    return method != NV097_CLEAR_SURFACE;
+}
+
+NV2AProfiler::NV2AProfiler() {
+    for (unsigned int cls = 0; cls < NV2A_PROFILE_CLASS_COUNT; cls++) {
+        for (unsigned int slot = 0; slot < NV2A_PROFILE_METHOD_SLOTS; slot++) {
+            m_puller.methodCounts[cls][slot].store(0, std::memory_order_relaxed);
+        }
+    }
+    memset(m_kelvinState, 0, sizeof(m_kelvinState));
+    memset(m_kelvinStateValid, 0, sizeof(m_kelvinStateValid));
+}
+
+NV2AProfiler::~NV2AProfiler() {
+    Close();
+}
+
+bool NV2AProfiler::Open(const char *path) {
+    Close();
+
+    m_file = fopen(path, "w");
+    if (m_file == nullptr) {
+        log_warning("NV2A profiler: Could not create %s\n", path);
+        return false;
+    }
+
+    size_t length = strlen(path);
+    m_json = length >= 5 && strcmp(path + length - 5, ".json") == 0;
+
+    m_current = new NV2AProfileSnapshot();
+    m_last = new NV2AProfileSnapshot();
+    TakeSnapshot(*m_last);
+    m_frameCount = 0;
+    m_lastFlips = m_last->flips;
+    m_vblanksWithoutFlip = 0;
+    m_flipSeen = false;
+    m_startTime = m_frameStartTime = std::chrono::steady_clock::now();
+
+    if (m_json) {
+        fprintf(m_file, "{\"frames\":[");
+    }
+    else {
+        fprintf(m_file, "frame,boundary,start_ms,duration_ms,pusher_ms,puller_ms,pusher_runs,bytes_parsed,jumps,calls,returns,"
+            "methods,draws,vertices,inline_dwords,state_changes,redundant_state,texture_binds,clears,flips");
+        for (unsigned int cls = 0; cls < NV2A_PROFILE_CLASS_COUNT; cls++) {
+            fprintf(m_file, ",%s", kClassNames[cls]);
+        }
+        fprintf(m_file, "\n");
+    }
+
+    log_info("NV2A profiler: Writing per-frame statistics to %s\n", path);
+    return true;
+}
+
+void NV2AProfiler::Close() {
+    if (m_file == nullptr) {
+        return;
+    }
+
+    EndFrame(NV2A_PROFILE_BOUNDARY_END);
+
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (m_json) {
+        fprintf(m_file, "\n]}\n");
+    }
+    fclose(m_file);
+    m_file = nullptr;
+
+    // Summarize the busiest methods of the whole session
+    struct MethodTotal {
+        unsigned int cls;
+        unsigned int method;
+        uint32_t count;
+    };
+    std::vector<MethodTotal> totals;
+    for (unsigned int cls = 0; cls < NV2A_PROFILE_CLASS_COUNT; cls++) {
+        for (unsigned int slot = 0; slot < NV2A_PROFILE_METHOD_SLOTS; slot++) {
+            if (m_last->methodCounts[cls][slot] != 0) {
+                totals.push_back({ cls, slot * 4, m_last->methodCounts[cls][slot] });
+            }
+        }
+    }
+    std::sort(totals.begin(), totals.end(), [](const MethodTotal& a, const MethodTotal& b) -> bool { return a.count > b.count; });
+
+    log_info("NV2A profiler: %llu frames, %llu methods, %llu draws, %llu vertices\n",
+        (unsigned long long)m_frameCount, (unsigned long long)m_last->methods,
+        (unsigned long long)m_last->draws, (unsigned long long)m_last->vertices);
+    for (size_t i = 0; i < totals.size() && i < 10; i++) {
+        log_info("NV2A profiler:   %-11s 0x%04x  %u\n", kClassNames[totals[i].cls], totals[i].method, totals[i].count);
+    }
+
+    delete m_current;
+    delete m_last;
+    m_current = m_last = nullptr;
+}
+
+void NV2AProfiler::AddPusherRun(uint64_t bytesParsed, uint64_t jumps, uint64_t calls, uint64_t returns, uint64_t timeNs) {
+    profile_add(m_pusher.runs, 1);
+    profile_add(m_pusher.bytesParsed, bytesParsed);
+    profile_add(m_pusher.jumps, jumps);
+    profile_add(m_pusher.calls, calls);
+    profile_add(m_pusher.returns, returns);
+    profile_add(m_pusher.timeNs, timeNs);
+}
+
+void NV2AProfiler::CountMethod(unsigned int graphicsClass, unsigned int method, uint32_t parameter) {
+    NV2AProfileClass cls = profile_class(graphicsClass);
+    unsigned int slot = (method / 4) % NV2A_PROFILE_METHOD_SLOTS;
+
+    profile_add(m_puller.methods, 1);
+    profile_add(m_puller.methodCounts[cls][slot], 1);
+
+    if (cls != NV2A_PROFILE_CLASS_KELVIN) {
+        return;
+    }
+
+    switch (method) {
+    case NV097_FLIP_STALL:
+        profile_add(m_puller.flips, 1);
+        EndFrame(NV2A_PROFILE_BOUNDARY_FLIP);
+        return;
+    case NV097_SET_BEGIN_END:
+        if (parameter != NV097_SET_BEGIN_END_OP_END) {
+            profile_add(m_puller.draws, 1);
+        }
+        return;
+    case NV097_INLINE_ARRAY:
+        profile_add(m_puller.inlineDwords, 1);
+        return;
+    case NV097_CLEAR_SURFACE:
+        profile_add(m_puller.clears, 1);
+        return;
+    default:
+        break;
+    }
+
+    unsigned int vertices = profile_kelvin_vertices(method, parameter);
+    if (vertices != 0) {
+        profile_add(m_puller.vertices, vertices);
+        return;
+    }
+
+    if (!profile_kelvin_is_state(method)) {
+        return;
+    }
+
+    if (method >= NV097_SET_TEXTURE_OFFSET && method < NV097_SET_TEXTURE_OFFSET + 4 * 64 && (method & 0x3f) == 0) {
+        profile_add(m_puller.textureBinds, 1);
+    }
+
+    if (m_kelvinStateValid[slot] && m_kelvinState[slot] == parameter) {
+        profile_add(m_puller.redundantState, 1);
+    }
+    else {
+        profile_add(m_puller.stateChanges, 1);
+        m_kelvinState[slot] = parameter;
+        m_kelvinStateValid[slot] = true;
+    }
+}
+
+void NV2AProfiler::AddPullerTime(uint64_t timeNs) {
+    profile_add(m_puller.timeNs, timeNs);
+}
+
+void NV2AProfiler::VBlank() {
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        if (m_file == nullptr) {
+            return;
+        }
+
+        uint64_t flips = m_puller.flips.load(std::memory_order_relaxed);
+        if (flips != m_lastFlips) {
+            m_lastFlips = flips;
+            m_vblanksWithoutFlip = 0;
+            m_flipSeen = true;
+            return;
+        }
+        if (m_flipSeen && ++m_vblanksWithoutFlip < NV2A_PROFILE_FLIP_TIMEOUT) {
+            return;
+        }
+    }
+
+    EndFrame(NV2A_PROFILE_BOUNDARY_VBLANK);
+}
+
+void NV2AProfiler::EndFrame(NV2AProfileBoundary boundary) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (m_file == nullptr) {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    double startMs = std::chrono::duration<double, std::milli>(m_frameStartTime - m_startTime).count();
+    double durationMs = std::chrono::duration<double, std::milli>(now - m_frameStartTime).count();
+    m_frameStartTime = now;
+
+    TakeSnapshot(*m_current);
+    WriteFrame(boundary, *m_current, *m_last, startMs, durationMs);
+    std::swap(m_current, m_last);
+    m_frameCount++;
+}
+
+void NV2AProfiler::TakeSnapshot(NV2AProfileSnapshot& snapshot) {
+    snapshot.runs = m_pusher.runs.load(std::memory_order_relaxed);
+    snapshot.bytesParsed = m_pusher.bytesParsed.load(std::memory_order_relaxed);
+    snapshot.jumps = m_pusher.jumps.load(std::memory_order_relaxed);
+    snapshot.calls = m_pusher.calls.load(std::memory_order_relaxed);
+    snapshot.returns = m_pusher.returns.load(std::memory_order_relaxed);
+    snapshot.pusherTimeNs = m_pusher.timeNs.load(std::memory_order_relaxed);
+
+    snapshot.methods = m_puller.methods.load(std::memory_order_relaxed);
+    snapshot.draws = m_puller.draws.load(std::memory_order_relaxed);
+    snapshot.vertices = m_puller.vertices.load(std::memory_order_relaxed);
+    snapshot.inlineDwords = m_puller.inlineDwords.load(std::memory_order_relaxed);
+    snapshot.stateChanges = m_puller.stateChanges.load(std::memory_order_relaxed);
+    snapshot.redundantState = m_puller.redundantState.load(std::memory_order_relaxed);
+    snapshot.textureBinds = m_puller.textureBinds.load(std::memory_order_relaxed);
+    snapshot.clears = m_puller.clears.load(std::memory_order_relaxed);
+    snapshot.flips = m_puller.flips.load(std::memory_order_relaxed);
+    snapshot.pullerTimeNs = m_puller.timeNs.load(std::memory_order_relaxed);
+
+    for (unsigned int cls = 0; cls < NV2A_PROFILE_CLASS_COUNT; cls++) {
+        for (unsigned int slot = 0; slot < NV2A_PROFILE_METHOD_SLOTS; slot++) {
+            snapshot.methodCounts[cls][slot] = m_puller.methodCounts[cls][slot].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void NV2AProfiler::WriteFrame(NV2AProfileBoundary boundary, const NV2AProfileSnapshot& current, const NV2AProfileSnapshot& last, double startMs, double durationMs) {
+    unsigned long long frame = (unsigned long long)m_frameCount;
+    double pusherMs = (current.pusherTimeNs - last.pusherTimeNs) / 1000000.0;
+    double pullerMs = (current.pullerTimeNs - last.pullerTimeNs) / 1000000.0;
+
+    uint64_t classTotals[NV2A_PROFILE_CLASS_COUNT];
+    for (unsigned int cls = 0; cls < NV2A_PROFILE_CLASS_COUNT; cls++) {
+        classTotals[cls] = 0;
+        for (unsigned int slot = 0; slot < NV2A_PROFILE_METHOD_SLOTS; slot++) {
+            classTotals[cls] += current.methodCounts[cls][slot] - last.methodCounts[cls][slot];
+        }
+    }
+
+#define DELTA(field) (unsigned long long)(current.field - last.field)
+    if (!m_json) {
+        fprintf(m_file, "%llu,%s,%.3f,%.3f,%.3f,%.3f,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu",
+            frame, kBoundaryNames[boundary], startMs, durationMs, pusherMs, pullerMs,
+            DELTA(runs), DELTA(bytesParsed), DELTA(jumps), DELTA(calls), DELTA(returns),
+            DELTA(methods), DELTA(draws), DELTA(vertices), DELTA(inlineDwords),
+            DELTA(stateChanges), DELTA(redundantState), DELTA(textureBinds), DELTA(clears), DELTA(flips));
+        for (unsigned int cls = 0; cls < NV2A_PROFILE_CLASS_COUNT; cls++) {
+            fprintf(m_file, ",%llu", (unsigned long long)classTotals[cls]);
+        }
+        fprintf(m_file, "\n");
+        return;
+    }
+
+    fprintf(m_file, "%s\n{\"frame\":%llu,\"boundary\":\"%s\",\"start_ms\":%.3f,\"duration_ms\":%.3f,\"pusher_ms\":%.3f,\"puller_ms\":%.3f,"
+        "\"pusher_runs\":%llu,\"bytes_parsed\":%llu,\"jumps\":%llu,\"calls\":%llu,\"returns\":%llu,"
+        "\"methods\":%llu,\"draws\":%llu,\"vertices\":%llu,\"inline_dwords\":%llu,"
+        "\"state_changes\":%llu,\"redundant_state\":%llu,\"texture_binds\":%llu,\"clears\":%llu,\"flips\":%llu,\"classes\":{",
+        (frame == 0) ? "" : ",",
+        frame, kBoundaryNames[boundary], startMs, durationMs, pusherMs, pullerMs,
+        DELTA(runs), DELTA(bytesParsed), DELTA(jumps), DELTA(calls), DELTA(returns),
+        DELTA(methods), DELTA(draws), DELTA(vertices), DELTA(inlineDwords),
+        DELTA(stateChanges), DELTA(redundantState), DELTA(textureBinds), DELTA(clears), DELTA(flips));
+#undef DELTA
+
+    // Only the methods that were used during the frame are listed
+    bool firstClass = true;
+    for (unsigned int cls = 0; cls < NV2A_PROFILE_CLASS_COUNT; cls++) {
+        if (classTotals[cls] == 0) {
+            continue;
+        }
+        fprintf(m_file, "%s\"%s\":{\"total\":%llu", firstClass ? "" : ",", kClassNames[cls], (unsigned long long)classTotals[cls]);
+        firstClass = false;
+        for (unsigned int slot = 0; slot < NV2A_PROFILE_METHOD_SLOTS; slot++) {
+            uint32_t count = current.methodCounts[cls][slot] - last.methodCounts[cls][slot];
+            if (count != 0) {
+                fprintf(m_file, ",\"0x%04x\":%u", slot * 4, count);
+            }
+        }
+        fprintf(m_file, "}");
+    }
+    fprintf(m_file, "}}");
+}
+
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+namespace openxbox {
+
+// Methods are counted per graphics class in tables indexed by method / 4.
+// Every class the NV2A implements uses methods below 0x2000.
+#define NV2A_PROFILE_METHOD_SLOTS   (0x2000 / 4)
+
+// Once the guest has flipped, frames end on flips. VBlanks take over again if
+// this many go by without a flip, e.g. while a title is loading.
+#define NV2A_PROFILE_FLIP_TIMEOUT   30
+
+enum NV2AProfileClass {
+    NV2A_PROFILE_CLASS_BETA,
+    NV2A_PROFILE_CLASS_CONTEXT_SURFACES_2D,
+    NV2A_PROFILE_CLASS_BETA4,
+    NV2A_PROFILE_CLASS_IMAGE_BLIT,
+    NV2A_PROFILE_CLASS_KELVIN,
+    NV2A_PROFILE_CLASS_OTHER,
+
+    NV2A_PROFILE_CLASS_COUNT
+};
+
+enum NV2AProfileBoundary {
+    NV2A_PROFILE_BOUNDARY_VBLANK,
+    NV2A_PROFILE_BOUNDARY_FLIP,
+    NV2A_PROFILE_BOUNDARY_END,      // the final, partial frame written on Close
+};
+
+// Counters owned by the DMA pusher thread
+struct NV2AProfilePusherCounters {
+    std::atomic<uint64_t> runs{ 0 };
+    std::atomic<uint64_t> bytesParsed{ 0 };
+    std::atomic<uint64_t> jumps{ 0 };
+    std::atomic<uint64_t> calls{ 0 };
+    std::atomic<uint64_t> returns{ 0 };
+    std::atomic<uint64_t> timeNs{ 0 };
+};
+
+// Counters owned by the thread executing PGRAPH methods, which is the puller
+// or the trace replayer
+struct NV2AProfilePullerCounters {
+    std::atomic<uint64_t> methods{ 0 };
+    std::atomic<uint64_t> draws{ 0 };
+    std::atomic<uint64_t> vertices{ 0 };
+    std::atomic<uint64_t> inlineDwords{ 0 };
+    std::atomic<uint64_t> stateChanges{ 0 };
+    std::atomic<uint64_t> redundantState{ 0 };
+    std::atomic<uint64_t> textureBinds{ 0 };
+    std::atomic<uint64_t> clears{ 0 };
+    std::atomic<uint64_t> flips{ 0 };
+    std::atomic<uint64_t> timeNs{ 0 };
+
+    std::atomic<uint32_t> methodCounts[NV2A_PROFILE_CLASS_COUNT][NV2A_PROFILE_METHOD_SLOTS];
+};
+
+// A plain copy of every counter, taken at frame boundaries
+struct NV2AProfileSnapshot {
+    uint64_t runs = 0;
+    uint64_t bytesParsed = 0;
+    uint64_t jumps = 0;
+    uint64_t calls = 0;
+    uint64_t returns = 0;
+    uint64_t pusherTimeNs = 0;
+
+    uint64_t methods = 0;
+    uint64_t draws = 0;
+    uint64_t vertices = 0;
+    uint64_t inlineDwords = 0;
+    uint64_t stateChanges = 0;
+    uint64_t redundantState = 0;
+    uint64_t textureBinds = 0;
+    uint64_t clears = 0;
+    uint64_t flips = 0;
+    uint64_t pullerTimeNs = 0;
+
+    uint32_t methodCounts[NV2A_PROFILE_CLASS_COUNT][NV2A_PROFILE_METHOD_SLOTS];
+};
+
+/*!
+ * Per-frame statistics of the NV2A command stream.
+ *
+ * Each counter has exactly one writer thread: the pusher counts what it
+ * parses and the thread executing PGRAPH methods counts what it executes.
+ * Writers update their counters with plain relaxed loads and stores, so
+ * profiling adds no locked instructions to either thread. At every frame
+ * boundary all counters are copied and the difference to the previous
+ * boundary is appended as one row of the time series.
+ *
+ * The time series is written as JSON if the path ends in ".json", and as CSV
+ * otherwise. JSON rows also break the method counts down per class and
+ * method.
+ */
+class NV2AProfiler {
+public:
+    NV2AProfiler();
+    ~NV2AProfiler();
+
+    bool Open(const char *path);
+    void Close();
+
+    // Pusher thread
+    void AddPusherRun(uint64_t bytesParsed, uint64_t jumps, uint64_t calls, uint64_t returns, uint64_t timeNs);
+
+    // PGRAPH thread. A flip ends the current frame.
+    void CountMethod(unsigned int graphicsClass, unsigned int method, uint32_t parameter);
+    void AddPullerTime(uint64_t timeNs);
+
+    // VBlank thread
+    void VBlank();
+
+    uint64_t GetFrameCount() const { return m_frameCount; }
+
+private:
+    void EndFrame(NV2AProfileBoundary boundary);
+    void TakeSnapshot(NV2AProfileSnapshot& snapshot);
+    void WriteFrame(NV2AProfileBoundary boundary, const NV2AProfileSnapshot& current, const NV2AProfileSnapshot& last, double startMs, double durationMs);
+
+    FILE *m_file = nullptr;
+    bool m_json = false;
+
+    NV2AProfilePusherCounters m_pusher;
+    NV2AProfilePullerCounters m_puller;
+
+    // Last value written to each Kelvin method, owned by the PGRAPH thread
+    uint32_t m_kelvinState[NV2A_PROFILE_METHOD_SLOTS];
+    bool m_kelvinStateValid[NV2A_PROFILE_METHOD_SLOTS];
+
+    // Frame boundaries come from both the PGRAPH and the VBlank threads
+    std::mutex m_mutex;
+    NV2AProfileSnapshot *m_current = nullptr;
+    NV2AProfileSnapshot *m_last = nullptr;
+    uint64_t m_frameCount = 0;
+    uint64_t m_lastFlips = 0;
+    unsigned int m_vblanksWithoutFlip = 0;
+    bool m_flipSeen = false;
+
+    std::chrono::steady_clock::time_point m_startTime;
+    std::chrono::steady_clock::time_point m_frameStartTime;
+};
+
+}
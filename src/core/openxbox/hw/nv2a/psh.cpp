@@ -0,0 +1,688 @@
+/*
+ * Portions of the code are based on XQEMU's NV2A pixel shader translator.
+ * The original copyright header is included below.
+ */
+/*
+ * QEMU Geforce NV2A pixel shader translation
+ *
+ * Copyright (c) 2013 espes
+ * Copyright (c) 2015 Jannik Vogel
+ *
+ * Based on:
+ * Cxbx, PixelShader.cpp
+ * Copyright (c) 2004 Aaron Robinson <caustik@caustik.com>
+ *                    Kingofc <kingofc@freenet.de>
+ * Xeon, XBD3DPixelShader.cpp
+ * Copyright (c) 2003 _SF_
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 or
+ * (at your option) version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include "psh.h"
+#include "openxbox/log.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#include <emmintrin.h>
+
+namespace openxbox {
+
+// Flush the program cache when it grows past this many entries
+#define PSH_MAX_CACHED_PROGRAMS 256
+
+// Combiner registers
+enum PS_REGISTER {
+    PS_REGISTER_ZERO = 0x00,
+    PS_REGISTER_DISCARD = 0x00,
+    PS_REGISTER_C0 = 0x01,
+    PS_REGISTER_C1 = 0x02,
+    PS_REGISTER_FOG = 0x03,
+    PS_REGISTER_V0 = 0x04,
+    PS_REGISTER_V1 = 0x05,
+    PS_REGISTER_T0 = 0x08,
+    PS_REGISTER_T1 = 0x09,
+    PS_REGISTER_T2 = 0x0a,
+    PS_REGISTER_T3 = 0x0b,
+    PS_REGISTER_R0 = 0x0c,
+    PS_REGISTER_R1 = 0x0d,
+    PS_REGISTER_V1R0_SUM = 0x0e,
+    PS_REGISTER_EF_PROD = 0x0f,
+};
+
+// Input mappings
+enum PS_INPUTMAPPING {
+    PS_INPUTMAPPING_UNSIGNED_IDENTITY = 0,
+    PS_INPUTMAPPING_UNSIGNED_INVERT,
+    PS_INPUTMAPPING_EXPAND_NORMAL,
+    PS_INPUTMAPPING_EXPAND_NEGATE,
+    PS_INPUTMAPPING_HALFBIAS_NORMAL,
+    PS_INPUTMAPPING_HALFBIAS_NEGATE,
+    PS_INPUTMAPPING_SIGNED_IDENTITY,
+    PS_INPUTMAPPING_SIGNED_NEGATE,
+};
+
+// Combiner output flags (OCW bits 12 and up)
+enum PS_COMBINEROUTPUT {
+    PS_COMBINEROUTPUT_IDENTITY = 0x00,
+    PS_COMBINEROUTPUT_BIAS = 0x08,
+    PS_COMBINEROUTPUT_SHIFTLEFT_1 = 0x10,
+    PS_COMBINEROUTPUT_SHIFTLEFT_1_BIAS = 0x18,
+    PS_COMBINEROUTPUT_SHIFTLEFT_2 = 0x20,
+    PS_COMBINEROUTPUT_SHIFTRIGHT_1 = 0x30,
+
+    PS_COMBINEROUTPUT_CD_DOT_PRODUCT = 0x01,
+    PS_COMBINEROUTPUT_AB_DOT_PRODUCT = 0x02,
+    PS_COMBINEROUTPUT_AB_CD_MUX = 0x04,
+    PS_COMBINEROUTPUT_CD_BLUE_TO_ALPHA = 0x40,
+    PS_COMBINEROUTPUT_AB_BLUE_TO_ALPHA = 0x80,
+};
+
+// Combiner control flags
+#define PS_COMBINERCOUNT_MUX_MSB    (1 << 8)
+#define PS_COMBINERCOUNT_UNIQUE_C0  (1 << 12)
+#define PS_COMBINERCOUNT_UNIQUE_C1  (1 << 16)
+
+// Final combiner flags (low byte of NV_PGRAPH_COMBINESPECFOG1)
+#define PS_FINALCOMBINERSETTING_CLAMP_SUM     0x80
+#define PS_FINALCOMBINERSETTING_COMPLEMENT_V1 0x40
+#define PS_FINALCOMBINERSETTING_COMPLEMENT_R0 0x20
+
+// Register file slots; slots below 16 are the combiner registers
+#define PSH_SLOT_A       16
+#define PSH_SLOT_B       17
+#define PSH_SLOT_C       18
+#define PSH_SLOT_D       19
+#define PSH_SLOT_AB      20
+#define PSH_SLOT_CD      21
+#define PSH_SLOT_SUM     22
+#define PSH_SLOT_E       23
+#define PSH_SLOT_F       24
+#define PSH_SLOT_G       25
+#define PSH_SLOT_RESULT  26
+#define PSH_NUM_SLOTS    27
+
+#define PSH_MASK_RGB     0x7
+#define PSH_MASK_ALPHA   0x8
+#define PSH_MASK_RGBA    0xF
+
+enum PshOpcode : uint8_t {
+    PSH_OP_FACTOR,          // dst = constant factor[param]
+    PSH_OP_INPUT,           // dst = mapping[param](channel(src0))
+    PSH_OP_MUL,             // dst = src0 * src1
+    PSH_OP_DOT,             // dst = dot(src0.rgb, src1.rgb)
+    PSH_OP_ADD,             // dst = src0 + src1
+    PSH_OP_MUX,             // dst = r0.a selects src1 over src0
+    PSH_OP_MAP,             // dst = clamp(output_mapping[param](src0), -1, 1)
+    PSH_OP_MOV,             // dst = src0
+    PSH_OP_BLUE_TO_ALPHA,   // dst.a = src0.b
+    PSH_OP_V1R0_SUM,        // dst = v1 + r0, with param flags
+    PSH_OP_LERP,            // dst = src0 * src1 + (1 - src0) * src2
+};
+
+enum PshChannel : uint8_t {
+    PSH_CHANNEL_RGB,    // component n reads component n
+    PSH_CHANNEL_ALPHA,  // all components read alpha
+    PSH_CHANNEL_BLUE,   // all components read blue
+};
+
+// ----- State ----------------------------------------------------------------
+
+uint64_t PshState::Hash() const {
+    // FNV-1a over the state words
+    uint32_t words[5 + PSH_MAX_STAGES * 4];
+    int n = 0;
+    words[n++] = combinerControl;
+    for (int i = 0; i < PSH_MAX_STAGES; i++) {
+        words[n++] = rgbInputs[i];
+        words[n++] = rgbOutputs[i];
+        words[n++] = alphaInputs[i];
+        words[n++] = alphaOutputs[i];
+    }
+    words[n++] = finalInputsA;
+    words[n++] = finalInputsB;
+    words[n++] = fogEnable;
+    words[n++] = fogMode;
+
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    const uint8_t *bytes = (const uint8_t *)words;
+    for (size_t i = 0; i < n * sizeof(uint32_t); i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+bool PshState::operator==(const PshState& other) const {
+    return combinerControl == other.combinerControl
+        && memcmp(rgbInputs, other.rgbInputs, sizeof(rgbInputs)) == 0
+        && memcmp(rgbOutputs, other.rgbOutputs, sizeof(rgbOutputs)) == 0
+        && memcmp(alphaInputs, other.alphaInputs, sizeof(alphaInputs)) == 0
+        && memcmp(alphaOutputs, other.alphaOutputs, sizeof(alphaOutputs)) == 0
+        && finalInputsA == other.finalInputsA
+        && finalInputsB == other.finalInputsB
+        && fogEnable == other.fogEnable
+        && fogMode == other.fogMode;
+}
+
+// ----- Compilation ----------------------------------------------------------
+
+struct PshInput {
+    uint8_t reg;
+    uint8_t alpha;
+    uint8_t mapping;
+};
+
+static PshInput psh_decode_input(uint32_t control_word, int shift) {
+    uint8_t value = (control_word >> shift) & 0xFF;
+    PshInput input;
+    input.reg = value & 0xF;
+    input.alpha = (value >> 4) & 1;
+    input.mapping = value >> 5;
+    return input;
+}
+
+static PshOp psh_op(uint8_t op, uint8_t dst, uint8_t mask, uint8_t src0, uint8_t src1 = 0, uint8_t src2 = 0) {
+    PshOp pop;
+    pop.op = op;
+    pop.dst = dst;
+    pop.mask = mask;
+    pop.src[0] = src0;
+    pop.src[1] = src1;
+    pop.src[2] = src2;
+    return pop;
+}
+
+static void psh_emit_input(PshProgram *program, uint8_t dst, const PshInput& input, bool alphaPortion) {
+    PshOp pop = psh_op(PSH_OP_INPUT, dst, alphaPortion ? PSH_MASK_ALPHA : PSH_MASK_RGB, input.reg);
+    if (alphaPortion) {
+        pop.channel = input.alpha ? PSH_CHANNEL_ALPHA : PSH_CHANNEL_BLUE;
+    }
+    else {
+        pop.channel = input.alpha ? PSH_CHANNEL_ALPHA : PSH_CHANNEL_RGB;
+    }
+    pop.param = input.mapping;
+    program->ops.push_back(pop);
+    program->readMask |= 1 << input.reg;
+}
+
+static void psh_emit_factors(PshProgram *program, const PshInput *inputs, int count, int stage) {
+    bool readsC0 = false;
+    bool readsC1 = false;
+    for (int i = 0; i < count; i++) {
+        readsC0 |= inputs[i].reg == PS_REGISTER_C0;
+        readsC1 |= inputs[i].reg == PS_REGISTER_C1;
+    }
+
+    uint32_t control = program->state.combinerControl;
+    if (readsC0) {
+        PshOp pop = psh_op(PSH_OP_FACTOR, PS_REGISTER_C0, PSH_MASK_RGBA, 0);
+        pop.param = ((control & PS_COMBINERCOUNT_UNIQUE_C0) ? stage : 0) * 2 + 0;
+        program->ops.push_back(pop);
+    }
+    if (readsC1) {
+        PshOp pop = psh_op(PSH_OP_FACTOR, PS_REGISTER_C1, PSH_MASK_RGBA, 0);
+        pop.param = ((control & PS_COMBINERCOUNT_UNIQUE_C1) ? stage : 0) * 2 + 1;
+        program->ops.push_back(pop);
+    }
+}
+
+// Computes the final combiner's V1R0_SUM and EF_PROD registers when any of the
+// given inputs reads them. General combiner stages see the same values as the
+// final combiner, evaluated against the registers as they are at that stage.
+static void psh_emit_sum_prod(PshProgram *program, const PshInput *inputs, int count) {
+    bool readsSum = false;
+    bool readsProd = false;
+    for (int i = 0; i < count; i++) {
+        readsSum |= inputs[i].reg == PS_REGISTER_V1R0_SUM;
+        readsProd |= inputs[i].reg == PS_REGISTER_EF_PROD;
+    }
+
+    if (readsSum) {
+        PshOp pop = psh_op(PSH_OP_V1R0_SUM, PS_REGISTER_V1R0_SUM, PSH_MASK_RGB, PS_REGISTER_V1, PS_REGISTER_R0);
+        pop.param = program->state.finalInputsB & 0xFF;
+        program->ops.push_back(pop);
+        program->readMask |= 1 << PS_REGISTER_V1;
+    }
+    if (readsProd) {
+        psh_emit_input(program, PSH_SLOT_E, psh_decode_input(program->state.finalInputsB, 24), false);
+        psh_emit_input(program, PSH_SLOT_F, psh_decode_input(program->state.finalInputsB, 16), false);
+        program->ops.push_back(psh_op(PSH_OP_MUL, PS_REGISTER_EF_PROD, PSH_MASK_RGB, PSH_SLOT_E, PSH_SLOT_F));
+    }
+}
+
+// Emits the products, sum and mapping for one portion of a combiner stage
+static void psh_emit_stage_math(PshProgram *program, uint32_t output, bool alphaPortion) {
+    uint8_t mask = alphaPortion ? PSH_MASK_ALPHA : PSH_MASK_RGB;
+    uint8_t flags = output >> 12;
+    bool muxSelectMSB = (program->state.combinerControl & PS_COMBINERCOUNT_MUX_MSB) != 0;
+
+    bool abDot = !alphaPortion && (flags & PS_COMBINEROUTPUT_AB_DOT_PRODUCT);
+    bool cdDot = !alphaPortion && (flags & PS_COMBINEROUTPUT_CD_DOT_PRODUCT);
+
+    program->ops.push_back(psh_op(abDot ? PSH_OP_DOT : PSH_OP_MUL, PSH_SLOT_AB, mask, PSH_SLOT_A, PSH_SLOT_B));
+    program->ops.push_back(psh_op(cdDot ? PSH_OP_DOT : PSH_OP_MUL, PSH_SLOT_CD, mask, PSH_SLOT_C, PSH_SLOT_D));
+
+    if ((output >> 8) & 0xF) {
+        if (flags & PS_COMBINEROUTPUT_AB_CD_MUX) {
+            PshOp pop = psh_op(PSH_OP_MUX, PSH_SLOT_SUM, mask, PSH_SLOT_AB, PSH_SLOT_CD);
+            pop.param = muxSelectMSB;
+            program->ops.push_back(pop);
+        }
+        else {
+            program->ops.push_back(psh_op(PSH_OP_ADD, PSH_SLOT_SUM, mask, PSH_SLOT_AB, PSH_SLOT_CD));
+        }
+    }
+
+    const uint8_t slots[] = { PSH_SLOT_AB, PSH_SLOT_CD, PSH_SLOT_SUM };
+    for (uint8_t slot : slots) {
+        PshOp pop = psh_op(PSH_OP_MAP, slot, mask, slot);
+        pop.param = flags & 0x38;
+        program->ops.push_back(pop);
+    }
+}
+
+static void psh_emit_stage_writes(PshProgram *program, uint32_t output, bool alphaPortion) {
+    uint8_t mask = alphaPortion ? PSH_MASK_ALPHA : PSH_MASK_RGB;
+    uint8_t cd = output & 0xF;
+    uint8_t ab = (output >> 4) & 0xF;
+    uint8_t sum = (output >> 8) & 0xF;
+
+    if (ab != PS_REGISTER_DISCARD) {
+        program->ops.push_back(psh_op(PSH_OP_MOV, ab, mask, PSH_SLOT_AB));
+    }
+    if (cd != PS_REGISTER_DISCARD) {
+        program->ops.push_back(psh_op(PSH_OP_MOV, cd, mask, PSH_SLOT_CD));
+    }
+    if (sum != PS_REGISTER_DISCARD) {
+        program->ops.push_back(psh_op(PSH_OP_MOV, sum, mask, PSH_SLOT_SUM));
+    }
+
+    if (!alphaPortion) {
+        uint8_t flags = output >> 12;
+        if ((flags & PS_COMBINEROUTPUT_AB_BLUE_TO_ALPHA) && ab != PS_REGISTER_DISCARD) {
+            program->ops.push_back(psh_op(PSH_OP_BLUE_TO_ALPHA, ab, PSH_MASK_ALPHA, PSH_SLOT_AB));
+        }
+        if ((flags & PS_COMBINEROUTPUT_CD_BLUE_TO_ALPHA) && cd != PS_REGISTER_DISCARD) {
+            program->ops.push_back(psh_op(PSH_OP_BLUE_TO_ALPHA, cd, PSH_MASK_ALPHA, PSH_SLOT_CD));
+        }
+    }
+}
+
+PshProgram *PshEngine::Compile(const PshState& state) {
+    PshProgram *program = new PshProgram();
+    program->state = state;
+
+    // R0.a is initialized with T0.a
+    program->readMask |= 1 << PS_REGISTER_T0;
+
+    unsigned int numStages = state.combinerControl & 0xFF;
+    if (numStages > PSH_MAX_STAGES) {
+        log_warning("PSH: Invalid combiner stage count %u\n", numStages);
+        numStages = PSH_MAX_STAGES;
+    }
+
+    const uint8_t inputSlots[] = { PSH_SLOT_A, PSH_SLOT_B, PSH_SLOT_C, PSH_SLOT_D };
+
+    for (unsigned int stage = 0; stage < numStages; stage++) {
+        PshInput inputs[8];
+        for (int i = 0; i < 4; i++) {
+            inputs[i] = psh_decode_input(state.rgbInputs[stage], 24 - i * 8);
+            inputs[4 + i] = psh_decode_input(state.alphaInputs[stage], 24 - i * 8);
+        }
+
+        psh_emit_factors(program, inputs, 8, stage);
+        psh_emit_sum_prod(program, inputs, 8);
+
+        // Both portions read their inputs before any register is written
+        for (int i = 0; i < 4; i++) {
+            psh_emit_input(program, inputSlots[i], inputs[i], false);
+            psh_emit_input(program, inputSlots[i], inputs[4 + i], true);
+        }
+
+        psh_emit_stage_math(program, state.rgbOutputs[stage], false);
+        psh_emit_stage_math(program, state.alphaOutputs[stage], true);
+
+        psh_emit_stage_writes(program, state.rgbOutputs[stage], false);
+        psh_emit_stage_writes(program, state.alphaOutputs[stage], true);
+    }
+
+    // The final combiner is always active; with both of its registers at
+    // zero it produces transparent black
+    PshInput a = psh_decode_input(state.finalInputsA, 24);
+    PshInput b = psh_decode_input(state.finalInputsA, 16);
+    PshInput c = psh_decode_input(state.finalInputsA, 8);
+    PshInput d = psh_decode_input(state.finalInputsA, 0);
+    PshInput e = psh_decode_input(state.finalInputsB, 24);
+    PshInput f = psh_decode_input(state.finalInputsB, 16);
+    PshInput g = psh_decode_input(state.finalInputsB, 8);
+
+    // The final combiner always uses the first stage's factors
+    PshInput all[] = { a, b, c, d, e, f, g };
+    psh_emit_factors(program, all, 7, 0);
+    psh_emit_sum_prod(program, all, 7);
+
+    psh_emit_input(program, PSH_SLOT_A, a, false);
+    psh_emit_input(program, PSH_SLOT_B, b, false);
+    psh_emit_input(program, PSH_SLOT_C, c, false);
+    psh_emit_input(program, PSH_SLOT_D, d, false);
+    psh_emit_input(program, PSH_SLOT_G, g, true);
+
+    program->ops.push_back(psh_op(PSH_OP_LERP, PSH_SLOT_RESULT, PSH_MASK_RGB, PSH_SLOT_A, PSH_SLOT_B, PSH_SLOT_C));
+    program->ops.push_back(psh_op(PSH_OP_ADD, PSH_SLOT_RESULT, PSH_MASK_RGB, PSH_SLOT_RESULT, PSH_SLOT_D));
+    program->ops.push_back(psh_op(PSH_OP_MOV, PSH_SLOT_RESULT, PSH_MASK_ALPHA, PSH_SLOT_G));
+
+    log_debug("PSH: Compiled combiner program: %u stages, %zu ops\n", numStages, program->ops.size());
+
+    return program;
+}
+
+// ----- Evaluation -----------------------------------------------------------
+
+struct PshQuadState {
+    __m128 regs[PSH_NUM_SLOTS][4];
+};
+
+static inline __m128 psh_clamp(__m128 x, float lo, float hi) {
+    return _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(lo)), _mm_set1_ps(hi));
+}
+
+static inline __m128 psh_input_mapping(__m128 x, uint8_t mapping) {
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 two = _mm_set1_ps(2.0f);
+
+    switch (mapping) {
+    case PS_INPUTMAPPING_UNSIGNED_IDENTITY: return _mm_max_ps(x, zero);
+    case PS_INPUTMAPPING_UNSIGNED_INVERT:   return _mm_sub_ps(one, psh_clamp(x, 0.0f, 1.0f));
+    case PS_INPUTMAPPING_EXPAND_NORMAL:     return _mm_sub_ps(_mm_mul_ps(two, _mm_max_ps(x, zero)), one);
+    case PS_INPUTMAPPING_EXPAND_NEGATE:     return _mm_sub_ps(one, _mm_mul_ps(two, _mm_max_ps(x, zero)));
+    case PS_INPUTMAPPING_HALFBIAS_NORMAL:   return _mm_sub_ps(_mm_max_ps(x, zero), half);
+    case PS_INPUTMAPPING_HALFBIAS_NEGATE:   return _mm_sub_ps(half, _mm_max_ps(x, zero));
+    case PS_INPUTMAPPING_SIGNED_IDENTITY:   return x;
+    case PS_INPUTMAPPING_SIGNED_NEGATE:     return _mm_sub_ps(zero, x);
+    default:                                return x;
+    }
+}
+
+static inline __m128 psh_output_mapping(__m128 x, uint8_t mapping) {
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    switch (mapping) {
+    case PS_COMBINEROUTPUT_IDENTITY:         break;
+    case PS_COMBINEROUTPUT_BIAS:             x = _mm_sub_ps(x, half); break;
+    case PS_COMBINEROUTPUT_SHIFTLEFT_1:      x = _mm_mul_ps(x, _mm_set1_ps(2.0f)); break;
+    case PS_COMBINEROUTPUT_SHIFTLEFT_1_BIAS: x = _mm_mul_ps(_mm_sub_ps(x, half), _mm_set1_ps(2.0f)); break;
+    case PS_COMBINEROUTPUT_SHIFTLEFT_2:      x = _mm_mul_ps(x, _mm_set1_ps(4.0f)); break;
+    case PS_COMBINEROUTPUT_SHIFTRIGHT_1:     x = _mm_mul_ps(x, half); break;
+    default:                                 break;
+    }
+    return psh_clamp(x, -1.0f, 1.0f);
+}
+
+static float psh_fog_factor(float distance, const PshState& state, const PshConstants& constants) {
+    if (!state.fogEnable) {
+        return distance;
+    }
+
+    float factor;
+    switch (state.fogMode) {
+    case NV_PGRAPH_CONTROL_3_FOG_MODE_LINEAR:
+    case NV_PGRAPH_CONTROL_3_FOG_MODE_LINEAR_ABS:
+        if (state.fogMode == NV_PGRAPH_CONTROL_3_FOG_MODE_LINEAR_ABS) {
+            distance = std::fabs(distance);
+        }
+        factor = constants.fogParam[0] + distance * constants.fogParam[1];
+        factor -= 1.0f;
+        break;
+    case NV_PGRAPH_CONTROL_3_FOG_MODE_EXP:
+    case NV_PGRAPH_CONTROL_3_FOG_MODE_EXP_ABS:
+        if (state.fogMode == NV_PGRAPH_CONTROL_3_FOG_MODE_EXP_ABS) {
+            distance = std::fabs(distance);
+        }
+        factor = constants.fogParam[0] + std::exp2(distance * constants.fogParam[1] * 16.0f);
+        factor -= 1.5f;
+        break;
+    case NV_PGRAPH_CONTROL_3_FOG_MODE_EXP2:
+    case NV_PGRAPH_CONTROL_3_FOG_MODE_EXP2_ABS:
+        if (state.fogMode == NV_PGRAPH_CONTROL_3_FOG_MODE_EXP2_ABS) {
+            distance = std::fabs(distance);
+        }
+        factor = constants.fogParam[0] + std::exp2(-distance * distance * constants.fogParam[1] * constants.fogParam[1] * 32.0f);
+        factor -= 1.5f;
+        break;
+    default:
+        factor = distance;
+        break;
+    }
+    return factor;
+}
+
+static void psh_load_quad(const PshProgram *program, const PshConstants& constants, const PshQuad& quad, PshQuadState& st) {
+    const __m128 zero = _mm_setzero_ps();
+    uint16_t readMask = program->readMask;
+
+    // The unnamed registers 0x6 and 0x7 read as zero, as does the alpha of
+    // V1R0_SUM and EF_PROD, which only ever receive color
+    for (int i = 0; i < 4; i++) {
+        st.regs[PS_REGISTER_ZERO][i] = zero;
+        st.regs[0x6][i] = zero;
+        st.regs[0x7][i] = zero;
+        st.regs[PS_REGISTER_R1][i] = zero;
+        st.regs[PS_REGISTER_V1R0_SUM][i] = zero;
+        st.regs[PS_REGISTER_EF_PROD][i] = zero;
+    }
+
+    if (readMask & (1 << PS_REGISTER_V0)) {
+        for (int i = 0; i < 4; i++) {
+            st.regs[PS_REGISTER_V0][i] = _mm_load_ps(quad.diffuse[i]);
+        }
+    }
+    if (readMask & (1 << PS_REGISTER_V1)) {
+        for (int i = 0; i < 4; i++) {
+            st.regs[PS_REGISTER_V1][i] = _mm_load_ps(quad.specular[i]);
+        }
+    }
+    for (int tex = 0; tex < NV2A_MAX_TEXTURES; tex++) {
+        if (readMask & (1 << (PS_REGISTER_T0 + tex))) {
+            for (int i = 0; i < 4; i++) {
+                st.regs[PS_REGISTER_T0 + tex][i] = _mm_load_ps(quad.texture[tex][i]);
+            }
+        }
+    }
+    if (readMask & (1 << PS_REGISTER_FOG)) {
+        alignas(16) float factor[PSH_QUAD_PIXELS];
+        for (int px = 0; px < PSH_QUAD_PIXELS; px++) {
+            float f = psh_fog_factor(quad.fog[px], program->state, constants);
+            factor[px] = (f < 0.0f) ? 0.0f : (f > 1.0f) ? 1.0f : f;
+        }
+        for (int i = 0; i < 3; i++) {
+            st.regs[PS_REGISTER_FOG][i] = _mm_set1_ps(constants.fogColor[i]);
+        }
+        st.regs[PS_REGISTER_FOG][3] = _mm_load_ps(factor);
+    }
+
+    st.regs[PS_REGISTER_R0][0] = zero;
+    st.regs[PS_REGISTER_R0][1] = zero;
+    st.regs[PS_REGISTER_R0][2] = zero;
+    st.regs[PS_REGISTER_R0][3] = st.regs[PS_REGISTER_T0][3];
+}
+
+static void psh_execute(const PshProgram *program, const PshConstants& constants, PshQuadState& st) {
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    for (const PshOp& pop : program->ops) {
+        __m128 *dst = st.regs[pop.dst];
+        const __m128 *s0 = st.regs[pop.src[0]];
+        const __m128 *s1 = st.regs[pop.src[1]];
+        const __m128 *s2 = st.regs[pop.src[2]];
+
+        switch (pop.op) {
+        case PSH_OP_FACTOR:
+        {
+            const float *factor = (pop.param & 1) ? constants.factor1[pop.param >> 1] : constants.factor0[pop.param >> 1];
+            for (int i = 0; i < 4; i++) {
+                dst[i] = _mm_set1_ps(factor[i]);
+            }
+            break;
+        }
+        case PSH_OP_INPUT:
+            for (int i = 0; i < 4; i++) {
+                if (pop.mask & (1 << i)) {
+                    int c = (pop.channel == PSH_CHANNEL_ALPHA) ? 3 : (pop.channel == PSH_CHANNEL_BLUE) ? 2 : i;
+                    dst[i] = psh_input_mapping(s0[c], pop.param);
+                }
+            }
+            break;
+        case PSH_OP_MUL:
+            for (int i = 0; i < 4; i++) {
+                if (pop.mask & (1 << i)) {
+                    dst[i] = _mm_mul_ps(s0[i], s1[i]);
+                }
+            }
+            break;
+        case PSH_OP_DOT:
+        {
+            __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(s0[0], s1[0]), _mm_mul_ps(s0[1], s1[1])), _mm_mul_ps(s0[2], s1[2]));
+            for (int i = 0; i < 4; i++) {
+                if (pop.mask & (1 << i)) {
+                    dst[i] = dot;
+                }
+            }
+            break;
+        }
+        case PSH_OP_ADD:
+            for (int i = 0; i < 4; i++) {
+                if (pop.mask & (1 << i)) {
+                    dst[i] = _mm_add_ps(s0[i], s1[i]);
+                }
+            }
+            break;
+        case PSH_OP_MUX:
+        {
+            __m128 r0a = st.regs[PS_REGISTER_R0][3];
+            __m128 sel;
+            if (pop.param) {
+                sel = _mm_cmpge_ps(r0a, _mm_set1_ps(0.5f));
+            }
+            else {
+                __m128i bits = _mm_cvttps_epi32(_mm_mul_ps(r0a, _mm_set1_ps(255.0f)));
+                bits = _mm_and_si128(bits, _mm_set1_epi32(1));
+                sel = _mm_castsi128_ps(_mm_cmpeq_epi32(bits, _mm_set1_epi32(1)));
+            }
+            for (int i = 0; i < 4; i++) {
+                if (pop.mask & (1 << i)) {
+                    dst[i] = _mm_or_ps(_mm_and_ps(sel, s1[i]), _mm_andnot_ps(sel, s0[i]));
+                }
+            }
+            break;
+        }
+        case PSH_OP_MAP:
+            for (int i = 0; i < 4; i++) {
+                if (pop.mask & (1 << i)) {
+                    dst[i] = psh_output_mapping(s0[i], pop.param);
+                }
+            }
+            break;
+        case PSH_OP_MOV:
+            for (int i = 0; i < 4; i++) {
+                if (pop.mask & (1 << i)) {
+                    dst[i] = s0[i];
+                }
+            }
+            break;
+        case PSH_OP_BLUE_TO_ALPHA:
+            dst[3] = s0[2];
+            break;
+        case PSH_OP_V1R0_SUM:
+            for (int i = 0; i < 3; i++) {
+                __m128 v1 = (pop.param & PS_FINALCOMBINERSETTING_COMPLEMENT_V1) ? _mm_sub_ps(one, s0[i]) : s0[i];
+                __m128 r0 = (pop.param & PS_FINALCOMBINERSETTING_COMPLEMENT_R0) ? _mm_sub_ps(one, s1[i]) : s1[i];
+                __m128 sum = _mm_add_ps(v1, r0);
+                dst[i] = (pop.param & PS_FINALCOMBINERSETTING_CLAMP_SUM) ? psh_clamp(sum, 0.0f, 1.0f) : sum;
+            }
+            break;
+        case PSH_OP_LERP:
+            for (int i = 0; i < 4; i++) {
+                if (pop.mask & (1 << i)) {
+                    dst[i] = _mm_add_ps(_mm_mul_ps(s0[i], s1[i]), _mm_mul_ps(_mm_sub_ps(one, s0[i]), s2[i]));
+                }
+            }
+            break;
+        default:
+            assert(false);
+            break;
+        }
+    }
+}
+
+// ----- Engine ---------------------------------------------------------------
+
+PshEngine::PshEngine() {
+}
+
+PshEngine::~PshEngine() {
+    Flush();
+}
+
+void PshEngine::Flush() {
+    for (auto& entry : m_programCache) {
+        delete entry.second;
+    }
+    m_programCache.clear();
+}
+
+const PshProgram *PshEngine::GetProgram(const PshState& state) {
+    uint64_t hash = state.Hash();
+
+    auto it = m_programCache.find(hash);
+    if (it != m_programCache.end()) {
+        if (it->second->state == state) {
+            m_cacheHits++;
+            return it->second;
+        }
+
+        // Hash collision; replace the old program
+        delete it->second;
+        m_programCache.erase(it);
+    }
+
+    m_cacheMisses++;
+    if (m_programCache.size() >= PSH_MAX_CACHED_PROGRAMS) {
+        log_debug("PSH: Program cache full, flushing\n");
+        Flush();
+    }
+
+    PshProgram *program = Compile(state);
+    m_programCache[hash] = program;
+    return program;
+}
+
+void PshEngine::ShadeQuads(const PshProgram *program, const PshConstants& constants,
+    const PshQuad *quads, PshQuadOutput *output, unsigned int count)
+{
+    PshQuadState st;
+
+    for (unsigned int q = 0; q < count; q++) {
+        psh_load_quad(program, constants, quads[q], st);
+        psh_execute(program, constants, st);
+
+        for (int i = 0; i < 4; i++) {
+            _mm_store_ps(output[q].color[i], psh_clamp(st.regs[PSH_SLOT_RESULT][i], 0.0f, 1.0f));
+        }
+    }
+}
+
+}
@@ -0,0 +1,141 @@
+/*
+ * Portions of the code are based on XQEMU's NV2A pixel shader translator.
+ * The original copyright header is included below.
+ */
+/*
+ * QEMU Geforce NV2A pixel shader translation
+ *
+ * Copyright (c) 2013 espes
+ * Copyright (c) 2015 Jannik Vogel
+ *
+ * Based on:
+ * Cxbx, PixelShader.cpp
+ * Copyright (c) 2004 Aaron Robinson <caustik@caustik.com>
+ *                    Kingofc <kingofc@freenet.de>
+ * Xeon, XBD3DPixelShader.cpp
+ * Copyright (c) 2003 _SF_
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 or
+ * (at your option) version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "nv2a_int.h"
+
+namespace openxbox {
+
+#define PSH_MAX_STAGES    8
+
+// Number of pixels in a quad (2x2). Each register component of a quad is
+// held in one SSE vector, one lane per pixel.
+#define PSH_QUAD_PIXELS   4
+
+/*!
+ * Combiner state that determines the structure of the evaluated program.
+ * Factor and fog values are passed separately so that changing them does
+ * not require a new program.
+ */
+struct PshState {
+    uint32_t combinerControl = 0;
+    uint32_t rgbInputs[PSH_MAX_STAGES] = { 0 };
+    uint32_t rgbOutputs[PSH_MAX_STAGES] = { 0 };
+    uint32_t alphaInputs[PSH_MAX_STAGES] = { 0 };
+    uint32_t alphaOutputs[PSH_MAX_STAGES] = { 0 };
+    uint32_t finalInputsA = 0; // NV_PGRAPH_COMBINESPECFOG0
+    uint32_t finalInputsB = 0; // NV_PGRAPH_COMBINESPECFOG1
+    bool fogEnable = false;
+    uint32_t fogMode = 0;      // NV_PGRAPH_CONTROL_3_FOG_MODE_*
+
+    uint64_t Hash() const;
+    bool operator==(const PshState& other) const;
+};
+
+/*!
+ * Values referenced by a combiner program that may change between draws.
+ */
+struct PshConstants {
+    float factor0[PSH_MAX_STAGES][4];
+    float factor1[PSH_MAX_STAGES][4];
+    float fogColor[4];
+    float fogParam[2];
+};
+
+/*!
+ * Interpolated inputs for one 2x2 pixel quad, in SoA form: each array
+ * holds one value per pixel. Components are ordered R, G, B, A.
+ */
+struct PshQuad {
+    alignas(16) float diffuse[4][PSH_QUAD_PIXELS];
+    alignas(16) float specular[4][PSH_QUAD_PIXELS];
+    alignas(16) float texture[NV2A_MAX_TEXTURES][4][PSH_QUAD_PIXELS];
+    alignas(16) float fog[PSH_QUAD_PIXELS];
+};
+
+struct PshQuadOutput {
+    alignas(16) float color[4][PSH_QUAD_PIXELS];
+};
+
+struct PshOp {
+    uint8_t op = 0;
+    uint8_t dst = 0;
+    uint8_t src[3] = { 0, 0, 0 };
+    uint8_t mask = 0;     // components written, bit n = component n
+    uint8_t channel = 0;  // input channel selection
+    uint8_t param = 0;    // mapping, constant index or mux selection
+};
+
+/*!
+ * A combiner configuration flattened into a list of ops.
+ */
+struct PshProgram {
+    PshState state;
+    std::vector<PshOp> ops;
+    uint16_t readMask = 0;   // combiner registers read by the program
+};
+
+/*!
+ * Evaluates the register combiners over pixel quads.
+ *
+ * Combiner configurations are specialized into flat op lists, cached by
+ * a hash of the combiner state. A rasterizer shades a 2x2 quad at a time,
+ * or a 4x4 block as four consecutive quads.
+ */
+class PshEngine {
+public:
+    PshEngine();
+    ~PshEngine();
+
+    const PshProgram *GetProgram(const PshState& state);
+
+    void ShadeQuads(const PshProgram *program, const PshConstants& constants,
+        const PshQuad *quads, PshQuadOutput *output, unsigned int count);
+
+    void Flush();
+
+    uint64_t GetCacheHits() const { return m_cacheHits; }
+    uint64_t GetCacheMisses() const { return m_cacheMisses; }
+
+private:
+    PshProgram *Compile(const PshState& state);
+
+    std::unordered_map<uint64_t, PshProgram *> m_programCache;
+
+    uint64_t m_cacheHits = 0;
+    uint64_t m_cacheMisses = 0;
+};
+
+}
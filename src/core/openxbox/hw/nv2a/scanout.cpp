@@ -0,0 +1,523 @@
+#include "scanout.h"
+#include "openxbox/log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <emmintrin.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace openxbox {
+
+#define SCANOUT_PAGE_SIZE 4096
+
+bool ScanoutMode::operator==(const ScanoutMode& other) const {
+    return address == other.address
+        && pitch == other.pitch
+        && width == other.width
+        && height == other.height
+        && format == other.format;
+}
+
+unsigned int nv2a_scanout_bytes_per_pixel(ScanoutFormat format) {
+    switch (format) {
+    case SCANOUT_FORMAT_X1R5G5B5: return 2;
+    case SCANOUT_FORMAT_R5G6B5: return 2;
+    case SCANOUT_FORMAT_X8R8G8B8: return 4;
+    default: return 0;
+    }
+}
+
+// ----- Conversion -----------------------------------------------------------
+
+static inline uint32_t scanout_expand5(uint32_t v) {
+    return (v << 3) | (v >> 2);
+}
+
+static inline uint32_t scanout_expand6(uint32_t v) {
+    return (v << 2) | (v >> 4);
+}
+
+static inline uint32_t scanout_convert_pixel(ScanoutFormat format, const uint8_t *source) {
+    switch (format) {
+    case SCANOUT_FORMAT_X1R5G5B5:
+    {
+        uint16_t p;
+        memcpy(&p, source, 2);
+        return 0xFF000000
+            | (scanout_expand5((p >> 10) & 0x1F) << 16)
+            | (scanout_expand5((p >> 5) & 0x1F) << 8)
+            | scanout_expand5(p & 0x1F);
+    }
+    case SCANOUT_FORMAT_R5G6B5:
+    {
+        uint16_t p;
+        memcpy(&p, source, 2);
+        return 0xFF000000
+            | (scanout_expand5((p >> 11) & 0x1F) << 16)
+            | (scanout_expand6((p >> 5) & 0x3F) << 8)
+            | scanout_expand5(p & 0x1F);
+    }
+    case SCANOUT_FORMAT_X8R8G8B8:
+    {
+        uint32_t p;
+        memcpy(&p, source, 4);
+        return p | 0xFF000000;
+    }
+    default:
+        return 0xFF000000;
+    }
+}
+
+void nv2a_scanout_convert_scalar(const ScanoutMode& mode, const uint8_t *source, uint8_t *dest, uint32_t destPitch) {
+    unsigned int bpp = nv2a_scanout_bytes_per_pixel(mode.format);
+    for (uint32_t y = 0; y < mode.height; y++) {
+        const uint8_t *src = source + y * mode.pitch;
+        uint32_t *dst = (uint32_t *)(dest + y * destPitch);
+        for (uint32_t x = 0; x < mode.width; x++) {
+            dst[x] = scanout_convert_pixel(mode.format, src + x * bpp);
+        }
+    }
+}
+
+// Expands the 5-bit field at the given shift of each 32-bit lane to 8 bits
+static inline __m128i scanout_expand5_epi32(__m128i p, int shift) {
+    __m128i v = _mm_and_si128(_mm_srli_epi32(p, shift), _mm_set1_epi32(0x1F));
+    return _mm_or_si128(_mm_slli_epi32(v, 3), _mm_srli_epi32(v, 2));
+}
+
+static inline __m128i scanout_expand6_epi32(__m128i p, int shift) {
+    __m128i v = _mm_and_si128(_mm_srli_epi32(p, shift), _mm_set1_epi32(0x3F));
+    return _mm_or_si128(_mm_slli_epi32(v, 2), _mm_srli_epi32(v, 4));
+}
+
+static inline __m128i scanout_convert_x1r5g5b5_epi32(__m128i p) {
+    __m128i r = scanout_expand5_epi32(p, 10);
+    __m128i g = scanout_expand5_epi32(p, 5);
+    __m128i b = scanout_expand5_epi32(p, 0);
+    __m128i out = _mm_or_si128(_mm_slli_epi32(r, 16), _mm_slli_epi32(g, 8));
+    return _mm_or_si128(_mm_or_si128(out, b), _mm_set1_epi32((int)0xFF000000));
+}
+
+static inline __m128i scanout_convert_r5g6b5_epi32(__m128i p) {
+    __m128i r = scanout_expand5_epi32(p, 11);
+    __m128i g = scanout_expand6_epi32(p, 5);
+    __m128i b = scanout_expand5_epi32(p, 0);
+    __m128i out = _mm_or_si128(_mm_slli_epi32(r, 16), _mm_slli_epi32(g, 8));
+    return _mm_or_si128(_mm_or_si128(out, b), _mm_set1_epi32((int)0xFF000000));
+}
+
+void nv2a_scanout_convert(const ScanoutMode& mode, const uint8_t *source, uint8_t *dest, uint32_t destPitch) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    unsigned int bpp = nv2a_scanout_bytes_per_pixel(mode.format);
+
+    for (uint32_t y = 0; y < mode.height; y++) {
+        const uint8_t *src = source + y * mode.pitch;
+        uint8_t *dst = dest + y * destPitch;
+        uint32_t x = 0;
+
+        switch (mode.format) {
+        case SCANOUT_FORMAT_X1R5G5B5:
+            for (; x + 8 <= mode.width; x += 8) {
+                __m128i p = _mm_loadu_si128((const __m128i *)(src + x * 2));
+                _mm_storeu_si128((__m128i *)(dst + x * 4), scanout_convert_x1r5g5b5_epi32(_mm_unpacklo_epi16(p, zero)));
+                _mm_storeu_si128((__m128i *)(dst + x * 4 + 16), scanout_convert_x1r5g5b5_epi32(_mm_unpackhi_epi16(p, zero)));
+            }
+            break;
+        case SCANOUT_FORMAT_R5G6B5:
+            for (; x + 8 <= mode.width; x += 8) {
+                __m128i p = _mm_loadu_si128((const __m128i *)(src + x * 2));
+                _mm_storeu_si128((__m128i *)(dst + x * 4), scanout_convert_r5g6b5_epi32(_mm_unpacklo_epi16(p, zero)));
+                _mm_storeu_si128((__m128i *)(dst + x * 4 + 16), scanout_convert_r5g6b5_epi32(_mm_unpackhi_epi16(p, zero)));
+            }
+            break;
+        case SCANOUT_FORMAT_X8R8G8B8:
+            for (; x + 4 <= mode.width; x += 4) {
+                __m128i p = _mm_loadu_si128((const __m128i *)(src + x * 4));
+                _mm_storeu_si128((__m128i *)(dst + x * 4), _mm_or_si128(p, alpha));
+            }
+            break;
+        default:
+            break;
+        }
+
+        // Leftover pixels at the end of the line
+        for (; x < mode.width; x++) {
+            uint32_t p = scanout_convert_pixel(mode.format, src + x * bpp);
+            memcpy(dst + x * 4, &p, 4);
+        }
+    }
+}
+
+// ----- Shared memory --------------------------------------------------------
+
+static size_t scanout_shm_header_size() {
+    return (sizeof(ScanoutShmHeader) + SCANOUT_PAGE_SIZE - 1) & ~(size_t)(SCANOUT_PAGE_SIZE - 1);
+}
+
+static size_t scanout_shm_buffer_size() {
+    return (size_t)NV2A_SCANOUT_MAX_WIDTH * NV2A_SCANOUT_MAX_HEIGHT * 4;
+}
+
+ScanoutSharedMemory::ScanoutSharedMemory() {
+}
+
+ScanoutSharedMemory::~ScanoutSharedMemory() {
+    Close();
+}
+
+bool ScanoutSharedMemory::Map(const char *name, bool create) {
+    Close();
+
+    size_t size = scanout_shm_header_size() + NV2A_SCANOUT_SHM_BUFFERS * scanout_shm_buffer_size();
+
+#ifdef _WIN32
+    HANDLE mapping;
+    if (create) {
+        mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, name);
+    }
+    else {
+        mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+    }
+    if (mapping == NULL) {
+        log_warning("Scanout: Could not %s shared memory %s\n", create ? "create" : "open", name);
+        return false;
+    }
+    void *data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (data == NULL) {
+        CloseHandle(mapping);
+        log_warning("Scanout: Could not map shared memory %s\n", name);
+        return false;
+    }
+    m_mapping = mapping;
+    m_name = name;
+#else
+    // POSIX shared memory object names must start with a slash
+    m_name = (name[0] == '/') ? name : std::string("/") + name;
+
+    int fd = shm_open(m_name.c_str(), create ? (O_CREAT | O_RDWR) : O_RDWR, 0600);
+    if (fd < 0) {
+        log_warning("Scanout: Could not %s shared memory %s\n", create ? "create" : "open", m_name.c_str());
+        return false;
+    }
+    if (create && ftruncate(fd, size) != 0) {
+        close(fd);
+        shm_unlink(m_name.c_str());
+        log_warning("Scanout: Could not resize shared memory %s\n", m_name.c_str());
+        return false;
+    }
+    struct stat st;
+    if (!create && (fstat(fd, &st) != 0 || (size_t)st.st_size < size)) {
+        close(fd);
+        log_warning("Scanout: Shared memory %s is too small\n", m_name.c_str());
+        return false;
+    }
+    void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        if (create) {
+            shm_unlink(m_name.c_str());
+        }
+        log_warning("Scanout: Could not map shared memory %s\n", m_name.c_str());
+        return false;
+    }
+#endif
+
+    m_header = (ScanoutShmHeader *)data;
+    m_size = size;
+    m_owner = create;
+    return true;
+}
+
+bool ScanoutSharedMemory::Create(const char *name) {
+    if (!Map(name, true)) {
+        return false;
+    }
+
+    memset((void *)m_header, 0, sizeof(ScanoutShmHeader));
+    m_header->version = NV2A_SCANOUT_SHM_VERSION;
+    m_header->bufferSize = (uint32_t)scanout_shm_buffer_size();
+    for (uint32_t i = 0; i < NV2A_SCANOUT_SHM_BUFFERS; i++) {
+        m_header->bufferOffset[i] = (uint32_t)(scanout_shm_header_size() + i * scanout_shm_buffer_size());
+    }
+    m_back = 0;
+    m_lastPublished = 1;
+    m_header->middle.store(m_lastPublished, std::memory_order_relaxed);
+    m_header->front.store(2, std::memory_order_relaxed);
+
+    // Viewers check the magic last, so write it once everything else is set
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(m_header->magic, NV2A_SCANOUT_SHM_MAGIC, sizeof(m_header->magic));
+
+    log_info("Scanout: Publishing frames to shared memory %s\n", m_name.c_str());
+    return true;
+}
+
+bool ScanoutSharedMemory::Open(const char *name) {
+    if (!Map(name, false)) {
+        return false;
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (memcmp(m_header->magic, NV2A_SCANOUT_SHM_MAGIC, sizeof(m_header->magic)) != 0
+        || m_header->version != NV2A_SCANOUT_SHM_VERSION)
+    {
+        log_warning("Scanout: %s is not a scanout shared memory region\n", name);
+        Close();
+        return false;
+    }
+    m_front = m_header->front.load(std::memory_order_acquire) & NV2A_SCANOUT_SHM_INDEX_MASK;
+    return true;
+}
+
+void ScanoutSharedMemory::Close() {
+    if (m_header == nullptr) {
+        return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(m_header);
+    CloseHandle((HANDLE)m_mapping);
+    m_mapping = nullptr;
+#else
+    munmap(m_header, m_size);
+    if (m_owner) {
+        shm_unlink(m_name.c_str());
+    }
+#endif
+    m_header = nullptr;
+    m_size = 0;
+    m_owner = false;
+}
+
+uint8_t *ScanoutSharedMemory::GetBackBuffer() {
+    return (uint8_t *)m_header + m_header->bufferOffset[m_back];
+}
+
+uint8_t *ScanoutSharedMemory::GetLastPublishedBuffer() {
+    return (uint8_t *)m_header + m_header->bufferOffset[m_lastPublished];
+}
+
+void ScanoutSharedMemory::Publish(uint32_t width, uint32_t height, uint32_t pitch, uint64_t frameNumber) {
+    ScanoutShmFrame *frame = &m_header->frames[m_back];
+    frame->width = width;
+    frame->height = height;
+    frame->pitch = pitch;
+    frame->frameNumber = frameNumber;
+
+    m_lastPublished = m_back;
+    m_back = m_header->middle.exchange(m_back | NV2A_SCANOUT_SHM_FRESH, std::memory_order_acq_rel) & NV2A_SCANOUT_SHM_INDEX_MASK;
+}
+
+const uint8_t *ScanoutSharedMemory::AcquireFrame(const ScanoutShmFrame **frame) {
+    if ((m_header->middle.load(std::memory_order_relaxed) & NV2A_SCANOUT_SHM_FRESH) == 0) {
+        return nullptr;
+    }
+
+    m_front = m_header->middle.exchange(m_front, std::memory_order_acq_rel) & NV2A_SCANOUT_SHM_INDEX_MASK;
+    m_header->front.store(m_front, std::memory_order_release);
+    *frame = &m_header->frames[m_front];
+    return (const uint8_t *)m_header + m_header->bufferOffset[m_front];
+}
+
+// ----- Scanout --------------------------------------------------------------
+
+static uint64_t scanout_hash_page(const uint8_t *data, uint32_t length) {
+    uint64_t hash = 0x84222325CBF29CE4ULL;
+    uint32_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 29;
+    }
+    for (; i < length; i++) {
+        hash = (hash ^ data[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+Scanout::Scanout(const uint8_t *ram, uint32_t ramSize)
+    : m_ram(ram)
+    , m_ramSize(ramSize)
+{
+}
+
+Scanout::~Scanout() {
+    Close();
+}
+
+bool Scanout::OpenSharedMemory(const char *name) {
+    if (!m_shm.Create(name)) {
+        return false;
+    }
+    m_lastFrame = nullptr;
+    m_enabled.store(true, std::memory_order_release);
+    return true;
+}
+
+bool Scanout::OpenImageOutput(const char *pathPrefix) {
+    m_imagePrefix = pathPrefix;
+    log_info("Scanout: Writing frames to %s*.ppm\n", pathPrefix);
+    m_enabled.store(true, std::memory_order_release);
+    return true;
+}
+
+bool Scanout::OpenVideoOutput(const char *path) {
+    m_videoFile = fopen(path, "wb");
+    if (m_videoFile == nullptr) {
+        log_warning("Scanout: Could not create %s\n", path);
+        return false;
+    }
+    setvbuf(m_videoFile, nullptr, _IOFBF, 4 * 1024 * 1024);
+    log_info("Scanout: Writing raw BGRA video to %s\n", path);
+    m_enabled.store(true, std::memory_order_release);
+    return true;
+}
+
+void Scanout::Close() {
+    m_enabled.store(false, std::memory_order_release);
+
+    m_shm.Close();
+    m_imagePrefix.clear();
+    if (m_videoFile != nullptr) {
+        fclose(m_videoFile);
+        m_videoFile = nullptr;
+    }
+    m_lastFrame = nullptr;
+    m_lastMode = ScanoutMode();
+
+    if (m_framesConverted + m_framesSkipped > 0) {
+        log_info("Scanout: %llu frames converted, %llu unchanged frames skipped\n",
+            (unsigned long long)m_framesConverted, (unsigned long long)m_framesSkipped);
+    }
+}
+
+bool Scanout::Changed(const ScanoutMode& mode) {
+    uint32_t end = mode.address + mode.pitch * (mode.height - 1) + mode.width * nv2a_scanout_bytes_per_pixel(mode.format);
+    uint32_t firstPage = mode.address / SCANOUT_PAGE_SIZE;
+    uint32_t lastPage = (end - 1) / SCANOUT_PAGE_SIZE;
+
+    bool changed = (mode != m_lastMode) || (m_lastFrame == nullptr);
+    if (m_pageHashes.size() != lastPage - firstPage + 1) {
+        m_pageHashes.assign(lastPage - firstPage + 1, 0);
+        changed = true;
+    }
+
+    for (uint32_t page = firstPage; page <= lastPage; page++) {
+        uint32_t pageStart = std::max(page * SCANOUT_PAGE_SIZE, mode.address);
+        uint32_t pageEnd = std::min((page + 1) * SCANOUT_PAGE_SIZE, end);
+        uint64_t hash = scanout_hash_page(m_ram + pageStart, pageEnd - pageStart);
+        if (hash != m_pageHashes[page - firstPage]) {
+            m_pageHashes[page - firstPage] = hash;
+            changed = true;
+        }
+    }
+
+    m_lastMode = mode;
+    return changed;
+}
+
+void Scanout::Present(const ScanoutMode& mode) {
+    if (mode.format == SCANOUT_FORMAT_NONE || mode.width == 0 || mode.height == 0) {
+        return;
+    }
+    if (mode.width > NV2A_SCANOUT_MAX_WIDTH || mode.height > NV2A_SCANOUT_MAX_HEIGHT
+        || mode.pitch < mode.width * nv2a_scanout_bytes_per_pixel(mode.format)
+        || (uint64_t)mode.address + (uint64_t)mode.pitch * mode.height > m_ramSize)
+    {
+        if (mode != m_lastMode) {
+            log_warning("Scanout: Unsupported mode %ux%u, pitch %u at 0x%08x\n", mode.width, mode.height, mode.pitch, mode.address);
+            m_lastMode = mode;
+            m_lastFrame = nullptr;
+        }
+        return;
+    }
+
+    m_frameNumber++;
+
+    if (!Changed(mode)) {
+        m_framesSkipped++;
+
+        // Keep the video stream at a constant frame rate
+        if (m_videoFile != nullptr) {
+            WriteVideo(m_lastFrame, mode.width, mode.height, m_lastPitch);
+        }
+        return;
+    }
+
+    uint32_t destPitch = mode.width * 4;
+    uint8_t *dest;
+    if (m_shm.IsOpen()) {
+        dest = m_shm.GetBackBuffer();
+    }
+    else {
+        m_frame.resize(destPitch * mode.height);
+        dest = &m_frame[0];
+    }
+
+    nv2a_scanout_convert(mode, m_ram + mode.address, dest, destPitch);
+    m_framesConverted++;
+
+    if (!m_imagePrefix.empty()) {
+        WriteImage(dest, mode.width, mode.height, destPitch);
+    }
+    if (m_videoFile != nullptr) {
+        WriteVideo(dest, mode.width, mode.height, destPitch);
+    }
+
+    if (m_shm.IsOpen()) {
+        m_shm.Publish(mode.width, mode.height, destPitch, m_frameNumber);
+        m_lastFrame = m_shm.GetLastPublishedBuffer();
+    }
+    else {
+        m_lastFrame = dest;
+    }
+    m_lastPitch = destPitch;
+}
+
+void Scanout::WriteImage(const uint8_t *frame, uint32_t width, uint32_t height, uint32_t pitch) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s%06llu.ppm", m_imagePrefix.c_str(), (unsigned long long)m_frameNumber);
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr) {
+        log_warning("Scanout: Could not create %s\n", path);
+        return;
+    }
+
+    fprintf(file, "P6\n%u %u\n255\n", width, height);
+    std::vector<uint8_t> line(width * 3);
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t *src = frame + y * pitch;
+        for (uint32_t x = 0; x < width; x++) {
+            line[x * 3 + 0] = src[x * 4 + 2];
+            line[x * 3 + 1] = src[x * 4 + 1];
+            line[x * 3 + 2] = src[x * 4 + 0];
+        }
+        fwrite(&line[0], 1, line.size(), file);
+    }
+    fclose(file);
+}
+
+void Scanout::WriteVideo(const uint8_t *frame, uint32_t width, uint32_t height, uint32_t pitch) {
+    if (width != m_videoWidth || height != m_videoHeight) {
+        // Raw streams carry no framing; players need the size up front
+        log_info("Scanout: Video stream is now %ux%u BGRA at frame %llu\n", width, height, (unsigned long long)m_frameNumber);
+        m_videoWidth = width;
+        m_videoHeight = height;
+    }
+
+    for (uint32_t y = 0; y < height; y++) {
+        fwrite(frame + y * pitch, 4, width, m_videoFile);
+    }
+}
+
+}
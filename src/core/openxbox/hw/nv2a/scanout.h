@@ -0,0 +1,185 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace openxbox {
+
+enum ScanoutFormat {
+    SCANOUT_FORMAT_NONE,      // VGA text/planar or 8-bit palettized modes
+    SCANOUT_FORMAT_X1R5G5B5,
+    SCANOUT_FORMAT_R5G6B5,
+    SCANOUT_FORMAT_X8R8G8B8,
+};
+
+/*!
+ * The framebuffer being scanned out, as programmed through PCRTC, PRMCIO
+ * and PRAMDAC.
+ */
+struct ScanoutMode {
+    uint32_t address = 0;     // guest physical address of the first line
+    uint32_t pitch = 0;       // in bytes
+    uint32_t width = 0;
+    uint32_t height = 0;
+    ScanoutFormat format = SCANOUT_FORMAT_NONE;
+
+    bool operator==(const ScanoutMode& other) const;
+    bool operator!=(const ScanoutMode& other) const { return !(*this == other); }
+};
+
+unsigned int nv2a_scanout_bytes_per_pixel(ScanoutFormat format);
+
+// Converts a guest framebuffer to X8R8G8B8 with the alpha channel set.
+// dest must hold mode.height lines of destPitch bytes.
+void nv2a_scanout_convert(const ScanoutMode& mode, const uint8_t *source, uint8_t *dest, uint32_t destPitch);
+void nv2a_scanout_convert_scalar(const ScanoutMode& mode, const uint8_t *source, uint8_t *dest, uint32_t destPitch);
+
+// ----- Shared memory --------------------------------------------------------
+
+// Layout of the shared memory region frames are published to. The region
+// starts with a ScanoutShmHeader followed by NV2A_SCANOUT_SHM_BUFFERS frame
+// buffers of bufferSize bytes each, starting at page-aligned offsets.
+// Pixels are X8R8G8B8 (B, G, R, A in memory).
+//
+// The buffers are exchanged through a lock-free triple buffer. The producer
+// and the consumer each own one buffer, and the third is published in
+// "middle" along with NV2A_SCANOUT_SHM_FRESH when it holds a frame the
+// consumer has not seen yet:
+//  - the producer fills its buffer and swaps it in with
+//    back = exchange(middle, back | FRESH) & INDEX_MASK
+//  - the consumer checks for FRESH and, if set, swaps its buffer in with
+//    front = exchange(middle, front) & INDEX_MASK
+// Initially the producer owns buffer 0, middle holds buffer 1 and the
+// consumer owns buffer 2. The consumer records the buffer it owns in "front"
+// after every swap, so a viewer that reopens the region resumes with the
+// buffer the previous one left behind. Only one viewer may consume at a time.
+#define NV2A_SCANOUT_SHM_MAGIC       "OXSCANOT"
+#define NV2A_SCANOUT_SHM_VERSION     2
+#define NV2A_SCANOUT_SHM_BUFFERS     3
+#define NV2A_SCANOUT_SHM_INDEX_MASK  0x3
+#define NV2A_SCANOUT_SHM_FRESH       0x4
+#define NV2A_SCANOUT_MAX_WIDTH       1920
+#define NV2A_SCANOUT_MAX_HEIGHT      1080
+
+struct ScanoutShmFrame {
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;
+    uint32_t reserved;
+    uint64_t frameNumber;
+};
+
+struct ScanoutShmHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t bufferSize;
+    uint32_t bufferOffset[NV2A_SCANOUT_SHM_BUFFERS];
+    std::atomic<uint32_t> middle;
+    std::atomic<uint32_t> front;
+    ScanoutShmFrame frames[NV2A_SCANOUT_SHM_BUFFERS];
+};
+
+/*!
+ * A named shared memory region holding a ScanoutShmHeader and its frame
+ * buffers. The emulator creates the region and produces frames; viewers
+ * open it and consume them.
+ */
+class ScanoutSharedMemory {
+public:
+    ScanoutSharedMemory();
+    ~ScanoutSharedMemory();
+
+    bool Create(const char *name);
+    bool Open(const char *name);
+    void Close();
+
+    bool IsOpen() const { return m_header != nullptr; }
+    const ScanoutShmHeader *GetHeader() const { return m_header; }
+
+    // Producer side
+    uint8_t *GetBackBuffer();
+    uint8_t *GetLastPublishedBuffer();
+    void Publish(uint32_t width, uint32_t height, uint32_t pitch, uint64_t frameNumber);
+
+    // Consumer side. Returns the most recent frame, or nullptr if nothing
+    // was published since the last call.
+    const uint8_t *AcquireFrame(const ScanoutShmFrame **frame);
+
+private:
+    bool Map(const char *name, bool create);
+
+    ScanoutShmHeader *m_header = nullptr;
+    size_t m_size = 0;
+    std::string m_name;
+    bool m_owner = false;
+
+    uint32_t m_back = 0;
+    uint32_t m_front = 2;
+    uint32_t m_lastPublished = 1;
+
+#ifdef _WIN32
+    void *m_mapping = nullptr;
+#endif
+};
+
+// ----- Scanout --------------------------------------------------------------
+
+/*!
+ * Captures the displayed framebuffer once per VBlank.
+ *
+ * Frames are converted to X8R8G8B8 and published to shared memory for an
+ * external viewer, and optionally written out as a sequence of PPM images
+ * and/or a raw video stream. The guest pages holding the framebuffer are
+ * fingerprinted on every VBlank, and conversion is skipped entirely if the
+ * mode and the contents did not change.
+ */
+class Scanout {
+public:
+    Scanout(const uint8_t *ram, uint32_t ramSize);
+    ~Scanout();
+
+    bool OpenSharedMemory(const char *name);
+    bool OpenImageOutput(const char *pathPrefix);
+    bool OpenVideoOutput(const char *path);
+    void Close();
+
+    bool IsEnabled() const { return m_enabled.load(std::memory_order_acquire); }
+
+    void Present(const ScanoutMode& mode);
+
+    uint64_t GetFramesConverted() const { return m_framesConverted; }
+    uint64_t GetFramesSkipped() const { return m_framesSkipped; }
+
+private:
+    bool Changed(const ScanoutMode& mode);
+    void WriteImage(const uint8_t *frame, uint32_t width, uint32_t height, uint32_t pitch);
+    void WriteVideo(const uint8_t *frame, uint32_t width, uint32_t height, uint32_t pitch);
+
+    const uint8_t *m_ram;
+    uint32_t m_ramSize;
+
+    std::atomic<bool> m_enabled{ false };
+
+    ScanoutSharedMemory m_shm;
+    std::string m_imagePrefix;
+    FILE *m_videoFile = nullptr;
+    uint32_t m_videoWidth = 0;
+    uint32_t m_videoHeight = 0;
+
+    // Conversion target when shared memory is not in use
+    std::vector<uint8_t> m_frame;
+    const uint8_t *m_lastFrame = nullptr;
+    uint32_t m_lastPitch = 0;
+
+    ScanoutMode m_lastMode;
+    std::vector<uint64_t> m_pageHashes;
+
+    uint64_t m_frameNumber = 0;
+    uint64_t m_framesConverted = 0;
+    uint64_t m_framesSkipped = 0;
+};
+
+}
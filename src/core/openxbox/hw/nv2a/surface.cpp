@@ -0,0 +1,447 @@
+#include "surface.h"
+#include "nv2a_int.h"
+#include "openxbox/log.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace openxbox {
+
+// Flush the surface cache when it grows past this many entries
+#define SURFACE_MAX_CACHED 64
+
+// ----- Key ------------------------------------------------------------------
+
+uint64_t SurfaceKey::Hash() const {
+    uint32_t words[] = {
+        (uint32_t)zeta | ((uint32_t)swizzled << 1),
+        address, pitch, logWidth, logHeight, format,
+        clipX, clipY, clipWidth, clipHeight,
+    };
+
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    const uint8_t *bytes = (const uint8_t *)words;
+    for (size_t i = 0; i < sizeof(words); i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+bool SurfaceKey::operator==(const SurfaceKey& other) const {
+    return zeta == other.zeta
+        && swizzled == other.swizzled
+        && address == other.address
+        && pitch == other.pitch
+        && logWidth == other.logWidth
+        && logHeight == other.logHeight
+        && format == other.format
+        && clipX == other.clipX
+        && clipY == other.clipY
+        && clipWidth == other.clipWidth
+        && clipHeight == other.clipHeight;
+}
+
+// ----- Helpers --------------------------------------------------------------
+
+static unsigned int surface_bytes_per_pixel(const SurfaceKey& key) {
+    if (key.zeta) {
+        switch (key.format) {
+        case NV097_SET_SURFACE_FORMAT_ZETA_Z16: return 2;
+        case NV097_SET_SURFACE_FORMAT_ZETA_Z24S8: return 4;
+        default: return 0;
+        }
+    }
+
+    switch (key.format) {
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_Z1R5G5B5:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_O1R5G5B5:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_R5G6B5:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_G8B8:
+        return 2;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X8R8G8B8_Z8R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X8R8G8B8_O8R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1A7R8G8B8_Z1A7R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1A7R8G8B8_O1A7R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_A8R8G8B8:
+        return 4;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_B8:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Based on XQEMU's swizzle mask generation: bits of the X and Y coordinates
+// are interleaved for as long as both dimensions have bits left.
+static void surface_swizzle_masks(uint32_t width, uint32_t height, uint32_t *maskX, uint32_t *maskY) {
+    uint32_t x = 0, y = 0;
+    uint32_t bit = 1, maskBit = 1;
+    bool done;
+    do {
+        done = true;
+        if (bit < width) { x |= maskBit; maskBit <<= 1; done = false; }
+        if (bit < height) { y |= maskBit; maskBit <<= 1; done = false; }
+        bit <<= 1;
+    } while (!done);
+    *maskX = x;
+    *maskY = y;
+}
+
+static uint32_t surface_deposit_bits(uint32_t value, uint32_t mask) {
+    uint32_t result = 0;
+    for (uint32_t bit = 1; mask != 0; bit <<= 1) {
+        uint32_t lowest = mask & (~mask + 1);
+        if (value & bit) {
+            result |= lowest;
+        }
+        mask &= mask - 1;
+    }
+    return result;
+}
+
+static inline uint32_t surface_expand5(uint32_t v) { return (v << 3) | (v >> 2); }
+static inline uint32_t surface_expand6(uint32_t v) { return (v << 2) | (v >> 4); }
+
+static uint32_t surface_to_host(const SurfaceKey& key, uint32_t p) {
+    if (key.zeta) {
+        if (key.format == NV097_SET_SURFACE_FORMAT_ZETA_Z16) {
+            uint32_t z24 = (p << 8) | (p >> 8);
+            return z24 << 8;
+        }
+        return p;
+    }
+
+    switch (key.format) {
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_Z1R5G5B5:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_O1R5G5B5:
+        return 0xFF000000
+            | (surface_expand5((p >> 10) & 0x1F) << 16)
+            | (surface_expand5((p >> 5) & 0x1F) << 8)
+            | surface_expand5(p & 0x1F);
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_R5G6B5:
+        return 0xFF000000
+            | (surface_expand5((p >> 11) & 0x1F) << 16)
+            | (surface_expand6((p >> 5) & 0x3F) << 8)
+            | surface_expand5(p & 0x1F);
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X8R8G8B8_Z8R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X8R8G8B8_O8R8G8B8:
+        return 0xFF000000 | p;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_G8B8:
+        return 0xFF000000 | p;
+    default:
+        return p;
+    }
+}
+
+static uint32_t surface_to_guest(const SurfaceKey& key, uint32_t p) {
+    if (key.zeta) {
+        if (key.format == NV097_SET_SURFACE_FORMAT_ZETA_Z16) {
+            return p >> 16;
+        }
+        return p;
+    }
+
+    switch (key.format) {
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_Z1R5G5B5:
+        return (((p >> 19) & 0x1F) << 10) | (((p >> 11) & 0x1F) << 5) | ((p >> 3) & 0x1F);
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_O1R5G5B5:
+        return 0x8000 | (((p >> 19) & 0x1F) << 10) | (((p >> 11) & 0x1F) << 5) | ((p >> 3) & 0x1F);
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_R5G6B5:
+        return (((p >> 19) & 0x1F) << 11) | (((p >> 10) & 0x3F) << 5) | ((p >> 3) & 0x1F);
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X8R8G8B8_Z8R8G8B8:
+        return p & 0x00FFFFFF;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X8R8G8B8_O8R8G8B8:
+        return p | 0xFF000000;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_B8:
+        return p & 0xFF;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_G8B8:
+        return p & 0xFFFF;
+    default:
+        return p;
+    }
+}
+
+static uint64_t surface_hash_page(const uint8_t *data, uint32_t length) {
+    uint64_t hash = 0x84222325CBF29CE4ULL;
+    uint32_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 29;
+    }
+    for (; i < length; i++) {
+        hash = (hash ^ data[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+// ----- Manager --------------------------------------------------------------
+
+SurfaceManager::SurfaceManager(uint8_t *ram, uint32_t ramSize)
+    : m_ram(ram)
+    , m_ramSize(ramSize)
+{
+}
+
+SurfaceManager::~SurfaceManager() {
+    if (m_hits + m_misses > 0) {
+        log_info("NV2A surfaces: %llu hits, %llu misses, %llu conversions, %llu skipped uploads\n",
+            (unsigned long long)m_hits, (unsigned long long)m_misses,
+            (unsigned long long)m_conversions, (unsigned long long)m_skippedUploads);
+    }
+
+    for (auto& entry : m_surfaces) {
+        delete entry.second;
+    }
+}
+
+CachedSurface *SurfaceManager::Bind(const SurfaceKey& key) {
+    uint64_t hash = key.Hash();
+
+    auto it = m_surfaces.find(hash);
+    if (it != m_surfaces.end()) {
+        if (it->second->key == key) {
+            m_hits++;
+            return it->second;
+        }
+
+        // Hash collision; write back and replace the old surface
+        Download(it->second);
+        delete it->second;
+        m_surfaces.erase(it);
+    }
+
+    m_misses++;
+    if (m_surfaces.size() >= SURFACE_MAX_CACHED) {
+        log_debug("NV2A surfaces: Cache full, flushing\n");
+        Flush();
+    }
+
+    CachedSurface *surface = new CachedSurface();
+    surface->key = key;
+    surface->bytesPerPixel = surface_bytes_per_pixel(key);
+    surface->width = key.clipX + key.clipWidth;
+    surface->height = key.clipY + key.clipHeight;
+
+    // The clip rectangle may reach past the surface in guest memory. Pixels
+    // out there are never converted, so don't keep host copies of them.
+    uint64_t size;
+    if (surface->bytesPerPixel == 0) {
+        size = 0;
+    }
+    else if (key.swizzled) {
+        uint32_t width = 1 << key.logWidth;
+        uint32_t height = 1 << key.logHeight;
+        surface_swizzle_masks(width, height, &surface->swizzleMaskX, &surface->swizzleMaskY);
+        surface->width = std::min(surface->width, width);
+        surface->height = std::min(surface->height, height);
+        size = (uint64_t)width * height * surface->bytesPerPixel;
+    }
+    else {
+        surface->width = std::min(surface->width, key.pitch / surface->bytesPerPixel);
+        if (surface->width > 0 && surface->height > 0) {
+            size = (uint64_t)(surface->height - 1) * key.pitch + (uint64_t)surface->width * surface->bytesPerPixel;
+        }
+        else {
+            size = 0;
+        }
+    }
+
+    if (key.address >= m_ramSize) {
+        log_warning("NV2A surfaces: Surface at 0x%08x is outside of RAM\n", key.address);
+        size = 0;
+    }
+    else if (key.address + size > m_ramSize) {
+        log_warning("NV2A surfaces: Surface at 0x%08x extends past the end of RAM\n", key.address);
+
+        // Rows past the end of RAM can be dropped, but swizzled pixels are
+        // spread over the whole surface
+        if (key.swizzled) {
+            size = 0;
+        }
+        else {
+            size = m_ramSize - key.address;
+            surface->height = std::min<uint64_t>(surface->height, (size + key.pitch - 1) / key.pitch);
+        }
+    }
+    surface->size = (uint32_t)size;
+    if (surface->size == 0) {
+        surface->width = 0;
+        surface->height = 0;
+    }
+
+    surface->data.resize((size_t)surface->width * surface->height);
+
+    log_debug("NV2A surfaces: New %s surface at 0x%08x, %ux%u, format 0x%x, %u bytes\n",
+        key.zeta ? "zeta" : "color", key.address, surface->width, surface->height, key.format, surface->size);
+
+    m_surfaces[hash] = surface;
+    return surface;
+}
+
+CachedSurface *SurfaceManager::Find(const SurfaceKey& key) {
+    auto it = m_surfaces.find(key.Hash());
+    if (it != m_surfaces.end() && it->second->key == key) {
+        return it->second;
+    }
+    return nullptr;
+}
+
+uint32_t SurfaceManager::GuestOffset(const CachedSurface *surface, unsigned int x, unsigned int y) const {
+    if (surface->key.swizzled) {
+        return (surface_deposit_bits(x, surface->swizzleMaskX) | surface_deposit_bits(y, surface->swizzleMaskY))
+            * surface->bytesPerPixel;
+    }
+    return y * surface->key.pitch + x * surface->bytesPerPixel;
+}
+
+void SurfaceManager::ConvertToHost(CachedSurface *surface) {
+    const uint8_t *base = m_ram + surface->key.address;
+    unsigned int bpp = surface->bytesPerPixel;
+
+    for (unsigned int y = 0; y < surface->height; y++) {
+        uint32_t *row = &surface->data[y * surface->width];
+        for (unsigned int x = 0; x < surface->width; x++) {
+            uint32_t offset = GuestOffset(surface, x, y);
+            uint32_t p = 0;
+            if (offset + bpp <= surface->size) {
+                memcpy(&p, base + offset, bpp);
+            }
+            row[x] = surface_to_host(surface->key, p);
+        }
+    }
+}
+
+void SurfaceManager::ConvertToGuest(CachedSurface *surface) {
+    uint8_t *base = m_ram + surface->key.address;
+    unsigned int bpp = surface->bytesPerPixel;
+
+    // Only the clip rectangle is ever rendered to
+    for (unsigned int y = surface->key.clipY; y < surface->height; y++) {
+        const uint32_t *row = &surface->data[y * surface->width];
+        for (unsigned int x = surface->key.clipX; x < surface->width; x++) {
+            uint32_t offset = GuestOffset(surface, x, y);
+            if (offset + bpp > surface->size) {
+                continue;
+            }
+            uint32_t p = surface_to_guest(surface->key, row[x]);
+            memcpy(base + offset, &p, bpp);
+        }
+    }
+}
+
+bool SurfaceManager::GuestChanged(CachedSurface *surface) {
+    if (surface->size == 0) {
+        return false;
+    }
+
+    uint32_t start = surface->key.address;
+    uint32_t end = start + surface->size;
+    uint32_t firstPage = start >> NV2A_SURFACE_PAGE_SHIFT;
+    uint32_t lastPage = (end - 1) >> NV2A_SURFACE_PAGE_SHIFT;
+
+    if (surface->pageHashes.size() != lastPage - firstPage + 1) {
+        return true;
+    }
+
+    for (uint32_t page = firstPage; page <= lastPage; page++) {
+        uint32_t pageStart = page << NV2A_SURFACE_PAGE_SHIFT;
+        uint32_t pageLength = NV2A_SURFACE_PAGE_SIZE;
+        if (pageStart + pageLength > m_ramSize) {
+            pageLength = m_ramSize - pageStart;
+        }
+        if (surface_hash_page(m_ram + pageStart, pageLength) != surface->pageHashes[page - firstPage]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SurfaceManager::UpdatePageHashes(CachedSurface *surface) {
+    surface->pageHashes.clear();
+    if (surface->size == 0) {
+        return;
+    }
+
+    uint32_t start = surface->key.address;
+    uint32_t end = start + surface->size;
+    uint32_t firstPage = start >> NV2A_SURFACE_PAGE_SHIFT;
+    uint32_t lastPage = (end - 1) >> NV2A_SURFACE_PAGE_SHIFT;
+
+    for (uint32_t page = firstPage; page <= lastPage; page++) {
+        uint32_t pageStart = page << NV2A_SURFACE_PAGE_SHIFT;
+        uint32_t pageLength = NV2A_SURFACE_PAGE_SIZE;
+        if (pageStart + pageLength > m_ramSize) {
+            pageLength = m_ramSize - pageStart;
+        }
+        surface->pageHashes.push_back(surface_hash_page(m_ram + pageStart, pageLength));
+    }
+}
+
+void SurfaceManager::Upload(CachedSurface *surface) {
+    // Rendered data that has not been written back is newer than the guest copy
+    if (surface->hostDirty) {
+        return;
+    }
+
+    if (surface->hostValid && !GuestChanged(surface)) {
+        m_skippedUploads++;
+        return;
+    }
+
+    ConvertToHost(surface);
+    UpdatePageHashes(surface);
+    surface->hostValid = true;
+    m_conversions++;
+}
+
+void SurfaceManager::Download(CachedSurface *surface) {
+    if (!surface->hostDirty) {
+        return;
+    }
+
+    // The CPU wrote to the surface after it was uploaded. Writing the whole
+    // host copy back would undo those writes, so the guest contents win.
+    if (GuestChanged(surface)) {
+        log_debug("NV2A surfaces: Guest wrote to surface at 0x%08x while it was bound; keeping the guest contents\n",
+            surface->key.address);
+        surface->hostDirty = false;
+        surface->hostValid = false;
+        return;
+    }
+
+    ConvertToGuest(surface);
+    UpdatePageHashes(surface);
+    surface->hostDirty = false;
+    surface->hostValid = true;
+    m_conversions++;
+}
+
+void SurfaceManager::InvalidateRange(uint32_t address, uint32_t length) {
+    uint64_t end = (uint64_t)address + length;
+    for (auto& entry : m_surfaces) {
+        CachedSurface *surface = entry.second;
+        uint64_t surfaceEnd = (uint64_t)surface->key.address + surface->size;
+        if (address < surfaceEnd && surface->key.address < end) {
+            if (surface->hostDirty) {
+                log_debug("NV2A surfaces: Guest write to 0x%08x discards rendering to surface at 0x%08x\n",
+                    address, surface->key.address);
+            }
+            surface->hostValid = false;
+            surface->hostDirty = false;
+        }
+    }
+}
+
+void SurfaceManager::Flush() {
+    for (auto& entry : m_surfaces) {
+        Download(entry.second);
+        delete entry.second;
+    }
+    m_surfaces.clear();
+}
+
+}
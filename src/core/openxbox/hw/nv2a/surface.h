@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace openxbox {
+
+#define NV2A_SURFACE_PAGE_SHIFT  12
+#define NV2A_SURFACE_PAGE_SIZE   (1 << NV2A_SURFACE_PAGE_SHIFT)
+
+/*!
+ * Identifies a render target in guest memory. Two bindings with the same
+ * key refer to the same cached surface.
+ */
+struct SurfaceKey {
+    bool zeta = false;
+    bool swizzled = false;
+    uint32_t address = 0;   // guest physical address of the surface
+    uint32_t pitch = 0;     // pitch surfaces only
+    uint32_t logWidth = 0;  // swizzled surfaces only
+    uint32_t logHeight = 0;
+    uint32_t format = 0;    // NV097_SET_SURFACE_FORMAT_COLOR_* or _ZETA_*
+    uint32_t clipX = 0, clipY = 0;
+    uint32_t clipWidth = 0, clipHeight = 0;
+
+    uint64_t Hash() const;
+    bool operator==(const SurfaceKey& other) const;
+};
+
+/*!
+ * Host copy of a render target. Color surfaces are stored as A8R8G8B8 and
+ * zeta surfaces as Z24S8, one 32-bit word per pixel, regardless of the
+ * guest format.
+ */
+struct CachedSurface {
+    SurfaceKey key;
+    unsigned int bytesPerPixel = 0;
+    unsigned int width = 0;    // clip_x + clip_width, limited to guest memory
+    unsigned int height = 0;   // clip_y + clip_height, limited to guest memory
+    uint32_t size = 0;         // guest bytes covered by the surface
+    uint32_t swizzleMaskX = 0;
+    uint32_t swizzleMaskY = 0;
+
+    std::vector<uint32_t> data;
+
+    // Fingerprints of the guest pages as of the last upload or download
+    std::vector<uint64_t> pageHashes;
+
+    bool hostValid = false;    // data holds the current guest contents
+    bool hostDirty = false;    // data was rendered to and must be written back
+};
+
+/*!
+ * Keeps host copies of the color and zeta surfaces in sync with guest RAM.
+ *
+ * Guest pages covered by a surface are fingerprinted whenever the surface
+ * is converted in either direction. An upload is skipped if none of the
+ * pages changed since then, and writers that know which range they touch
+ * can invalidate it directly with InvalidateRange.
+ *
+ * Surfaces are uploaded when a draw begins and marked dirty if the draw may
+ * render into them. They are written back when the binding changes, before
+ * a clear and at flips. If the guest wrote to a dirty surface in the
+ * meantime, its writes are kept and the host copy is discarded.
+ */
+class SurfaceManager {
+public:
+    SurfaceManager(uint8_t *ram, uint32_t ramSize);
+    ~SurfaceManager();
+
+    // Looks up the surface matching the key, creating it on a miss
+    CachedSurface *Bind(const SurfaceKey& key);
+
+    // Looks up the surface matching the key without creating it
+    CachedSurface *Find(const SurfaceKey& key);
+
+    // Converts guest memory into the host copy if the guest pages changed
+    void Upload(CachedSurface *surface);
+
+    // Writes the host copy back to guest memory if it was rendered to
+    void Download(CachedSurface *surface);
+
+    // Marks surfaces overlapping the range as stale
+    void InvalidateRange(uint32_t address, uint32_t length);
+
+    // Downloads all dirty surfaces and drops the cache
+    void Flush();
+
+    uint64_t GetHits() const { return m_hits; }
+    uint64_t GetMisses() const { return m_misses; }
+    uint64_t GetConversions() const { return m_conversions; }
+    uint64_t GetSkippedUploads() const { return m_skippedUploads; }
+
+private:
+    bool GuestChanged(CachedSurface *surface);
+    void UpdatePageHashes(CachedSurface *surface);
+
+    uint32_t GuestOffset(const CachedSurface *surface, unsigned int x, unsigned int y) const;
+    void ConvertToHost(CachedSurface *surface);
+    void ConvertToGuest(CachedSurface *surface);
+
+    uint8_t *m_ram;
+    uint32_t m_ramSize;
+
+    std::unordered_map<uint64_t, CachedSurface *> m_surfaces;
+
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+    uint64_t m_conversions = 0;
+    uint64_t m_skippedUploads = 0;
+};
+
+}
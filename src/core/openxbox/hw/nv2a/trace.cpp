@@ -0,0 +1,288 @@
+#include "trace.h"
+#include "openxbox/log.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace openxbox {
+
+// ----- Writer ----------------------------------------------------------------
+
+// Hashes a page in four independent lanes so that the multiplies don't
+// serialize. Each step is invertible, so a page that differs from the
+// previous contents in a single word always gets a different fingerprint.
+static inline uint64_t FingerprintMix(uint64_t hash, uint64_t word) {
+    hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+    return hash ^ (hash >> 29);
+}
+
+static uint64_t PageFingerprint(const uint8_t *page) {
+    uint64_t lane0 = 1, lane1 = 2, lane2 = 3, lane3 = 4;
+    for (uint32_t offset = 0; offset < NV2A_TRACE_PAGE_SIZE; offset += 4 * sizeof(uint64_t)) {
+        uint64_t words[4];
+        memcpy(words, page + offset, sizeof(words));
+        lane0 = FingerprintMix(lane0, words[0]);
+        lane1 = FingerprintMix(lane1, words[1]);
+        lane2 = FingerprintMix(lane2, words[2]);
+        lane3 = FingerprintMix(lane3, words[3]);
+    }
+
+    uint64_t hash = FingerprintMix(0, lane0);
+    hash = FingerprintMix(hash, lane1);
+    hash = FingerprintMix(hash, lane2);
+    return FingerprintMix(hash, lane3);
+}
+
+NV2ATraceWriter::NV2ATraceWriter() {
+}
+
+NV2ATraceWriter::~NV2ATraceWriter() {
+    Close();
+}
+
+bool NV2ATraceWriter::Open(const char *path, const uint8_t *ram, uint32_t ramSize, const uint8_t *ramin, uint32_t raminSize) {
+    Close();
+
+    m_file = fopen(path, "wb");
+    if (m_file == nullptr) {
+        log_warning("NV2A trace: Could not create %s\n", path);
+        return false;
+    }
+    setvbuf(m_file, nullptr, _IOFBF, 1024 * 1024);
+
+    m_ram = ram;
+    m_ramSize = ramSize;
+    m_ramin = ramin;
+    m_raminSize = raminSize;
+
+    // Replay starts with zeroed memory, so only pages that are not zero
+    // will be written by the first synchronization
+    static const uint8_t zeroPage[NV2A_TRACE_PAGE_SIZE] = { 0 };
+    m_zeroFingerprint = PageFingerprint(zeroPage);
+    m_ramPages.assign(ramSize / NV2A_TRACE_PAGE_SIZE, m_zeroFingerprint);
+    m_raminPages.assign(raminSize / NV2A_TRACE_PAGE_SIZE, m_zeroFingerprint);
+
+    m_methodCount = 0;
+    m_pageCount = 0;
+
+    NV2ATraceHeader header;
+    memcpy(header.magic, NV2A_TRACE_MAGIC, sizeof(header.magic));
+    header.version = NV2A_TRACE_VERSION;
+    header.ramSize = ramSize;
+    header.raminSize = raminSize;
+    header.pageSize = NV2A_TRACE_PAGE_SIZE;
+    fwrite(&header, sizeof(header), 1, m_file);
+
+    log_info("NV2A trace: Capturing to %s\n", path);
+    return true;
+}
+
+void NV2ATraceWriter::Close() {
+    if (m_file == nullptr) {
+        return;
+    }
+
+    fclose(m_file);
+    m_file = nullptr;
+
+    m_ramPages.clear();
+    m_ramPages.shrink_to_fit();
+    m_raminPages.clear();
+    m_raminPages.shrink_to_fit();
+
+    log_info("NV2A trace: Captured %llu methods and %llu pages\n",
+        (unsigned long long)m_methodCount, (unsigned long long)m_pageCount);
+}
+
+void NV2ATraceWriter::SyncSpace(uint8_t space, const uint8_t *data, uint64_t *fingerprints, uint32_t size) {
+    static const uint8_t zeroPage[NV2A_TRACE_PAGE_SIZE] = { 0 };
+    uint8_t page[NV2A_TRACE_PAGE_SIZE];
+
+    for (uint32_t address = 0; address + NV2A_TRACE_PAGE_SIZE <= size; address += NV2A_TRACE_PAGE_SIZE) {
+        uint64_t *fingerprint = &fingerprints[address / NV2A_TRACE_PAGE_SIZE];
+        if (PageFingerprint(data + address) == *fingerprint) {
+            continue;
+        }
+
+        // The guest may still be writing to the page; remember what was
+        // actually captured so that later changes aren't missed
+        memcpy(page, data + address, NV2A_TRACE_PAGE_SIZE);
+        *fingerprint = PageFingerprint(page);
+
+        NV2ATraceMemory record;
+        record.space = space;
+        record.reserved = 0;
+        record.address = address;
+        if (*fingerprint == m_zeroFingerprint && memcmp(page, zeroPage, NV2A_TRACE_PAGE_SIZE) == 0) {
+            record.type = NV2A_TRACE_RECORD_MEMORY_ZERO;
+            fwrite(&record, sizeof(record), 1, m_file);
+        }
+        else {
+            record.type = NV2A_TRACE_RECORD_MEMORY;
+            fwrite(&record, sizeof(record), 1, m_file);
+            fwrite(page, NV2A_TRACE_PAGE_SIZE, 1, m_file);
+        }
+        m_pageCount++;
+    }
+}
+
+void NV2ATraceWriter::SyncMemory() {
+    if (m_file == nullptr) {
+        return;
+    }
+
+    SyncSpace(NV2A_TRACE_SPACE_RAMIN, m_ramin, &m_raminPages[0], m_raminSize);
+    SyncSpace(NV2A_TRACE_SPACE_RAM, m_ram, &m_ramPages[0], m_ramSize);
+}
+
+void NV2ATraceWriter::WriteMethod(unsigned int channel, unsigned int subchannel, unsigned int method, uint32_t parameter) {
+    if (m_file == nullptr) {
+        return;
+    }
+
+    NV2ATraceMethod record;
+    record.type = NV2A_TRACE_RECORD_METHOD;
+    record.channel = channel;
+    record.subchannel = subchannel;
+    record.reserved = 0;
+    record.method = method;
+    record.reserved2 = 0;
+    record.parameter = parameter;
+    fwrite(&record, sizeof(record), 1, m_file);
+    m_methodCount++;
+}
+
+// ----- Reader ----------------------------------------------------------------
+
+NV2ATraceReader::NV2ATraceReader() {
+}
+
+NV2ATraceReader::~NV2ATraceReader() {
+    Close();
+}
+
+bool NV2ATraceReader::Open(const char *path) {
+    Close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        log_warning("NV2A trace: Could not open %s\n", path);
+        return false;
+    }
+    LARGE_INTEGER size;
+    GetFileSizeEx(file, &size);
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        CloseHandle(file);
+        log_warning("NV2A trace: Could not map %s\n", path);
+        return false;
+    }
+    m_data = (uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    m_fileHandle = file;
+    m_mapping = mapping;
+    m_size = (size_t)size.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        log_warning("NV2A trace: Could not open %s\n", path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        log_warning("NV2A trace: Could not read %s\n", path);
+        return false;
+    }
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        log_warning("NV2A trace: Could not map %s\n", path);
+        return false;
+    }
+    m_data = (uint8_t *)data;
+    m_size = st.st_size;
+#endif
+
+    const NV2ATraceHeader *header = GetHeader();
+    if (m_data == nullptr || m_size < sizeof(NV2ATraceHeader)
+        || memcmp(header->magic, NV2A_TRACE_MAGIC, sizeof(header->magic)) != 0
+        || header->version != NV2A_TRACE_VERSION
+        || header->pageSize != NV2A_TRACE_PAGE_SIZE)
+    {
+        log_warning("NV2A trace: %s is not a valid trace file\n", path);
+        Close();
+        return false;
+    }
+
+    Rewind();
+    return true;
+}
+
+void NV2ATraceReader::Close() {
+#ifdef _WIN32
+    if (m_data != nullptr) {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mapping != nullptr) {
+        CloseHandle((HANDLE)m_mapping);
+        m_mapping = nullptr;
+    }
+    if (m_fileHandle != nullptr) {
+        CloseHandle((HANDLE)m_fileHandle);
+        m_fileHandle = nullptr;
+    }
+#else
+    if (m_data != nullptr) {
+        munmap(m_data, m_size);
+    }
+#endif
+    m_data = nullptr;
+    m_size = 0;
+    m_position = 0;
+}
+
+void NV2ATraceReader::Rewind() {
+    m_position = sizeof(NV2ATraceHeader);
+}
+
+const uint8_t *NV2ATraceReader::Next(const uint8_t **pageData) {
+    *pageData = nullptr;
+    if (m_position >= m_size) {
+        return nullptr;
+    }
+
+    const uint8_t *record = m_data + m_position;
+    size_t size;
+    switch (record[0]) {
+    case NV2A_TRACE_RECORD_METHOD: size = sizeof(NV2ATraceMethod); break;
+    case NV2A_TRACE_RECORD_MEMORY: size = sizeof(NV2ATraceMemory) + NV2A_TRACE_PAGE_SIZE; break;
+    case NV2A_TRACE_RECORD_MEMORY_ZERO: size = sizeof(NV2ATraceMemory); break;
+    default:
+        log_warning("NV2A trace: Unknown record type %u at offset 0x%zx\n", record[0], m_position);
+        m_position = m_size;
+        return nullptr;
+    }
+
+    if (m_position + size > m_size) {
+        log_warning("NV2A trace: Truncated record at offset 0x%zx\n", m_position);
+        m_position = m_size;
+        return nullptr;
+    }
+
+    if (record[0] == NV2A_TRACE_RECORD_MEMORY) {
+        *pageData = record + sizeof(NV2ATraceMemory);
+    }
+    m_position += size;
+    return record;
+}
+
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace openxbox {
+
+// A trace file starts with an NV2ATraceHeader followed by a sequence of
+// records. Every record starts with its type; memory records are followed by
+// one page of data. All records are a multiple of 4 bytes long and all fields
+// are little-endian and naturally aligned, so a mapped trace can be read in
+// place.
+#define NV2A_TRACE_MAGIC      "OXNV2ATR"
+#define NV2A_TRACE_VERSION    1
+#define NV2A_TRACE_PAGE_SIZE  4096
+
+enum NV2ATraceRecordType : uint8_t {
+    NV2A_TRACE_RECORD_METHOD = 1,       // a method handed to PGRAPH
+    NV2A_TRACE_RECORD_MEMORY = 2,       // a page of memory, followed by its contents
+    NV2A_TRACE_RECORD_MEMORY_ZERO = 3,  // a page of memory that was cleared
+};
+
+enum NV2ATraceSpace : uint8_t {
+    NV2A_TRACE_SPACE_RAM = 0,
+    NV2A_TRACE_SPACE_RAMIN = 1,
+};
+
+struct NV2ATraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t ramSize;
+    uint32_t raminSize;
+    uint32_t pageSize;
+};
+
+struct NV2ATraceMethod {
+    uint8_t type;
+    uint8_t channel;
+    uint8_t subchannel;
+    uint8_t reserved;
+    uint16_t method;
+    uint16_t reserved2;
+    uint32_t parameter;
+};
+
+struct NV2ATraceMemory {
+    uint8_t type;
+    uint8_t space;
+    uint16_t reserved;
+    uint32_t address;
+};
+
+/*!
+ * Records the PFIFO command stream along with the guest memory it depends
+ * on.
+ *
+ * Every batch of commands the puller picks up is preceded by every page of
+ * RAM and RAMIN that changed since the previous batch, so that replay sees
+ * the memory each method was executed against. Changes are detected by
+ * comparing a fingerprint of each page rather than a full copy of guest
+ * memory, which costs one pass over memory per batch and a few hundred
+ * kilobytes of bookkeeping.
+ */
+class NV2ATraceWriter {
+public:
+    NV2ATraceWriter();
+    ~NV2ATraceWriter();
+
+    bool Open(const char *path, const uint8_t *ram, uint32_t ramSize, const uint8_t *ramin, uint32_t raminSize);
+    void Close();
+
+    void SyncMemory();
+    void WriteMethod(unsigned int channel, unsigned int subchannel, unsigned int method, uint32_t parameter);
+
+    uint64_t GetMethodCount() const { return m_methodCount; }
+    uint64_t GetPageCount() const { return m_pageCount; }
+
+private:
+    void SyncSpace(uint8_t space, const uint8_t *data, uint64_t *fingerprints, uint32_t size);
+
+    FILE *m_file = nullptr;
+
+    const uint8_t *m_ram = nullptr;
+    uint32_t m_ramSize = 0;
+    const uint8_t *m_ramin = nullptr;
+    uint32_t m_raminSize = 0;
+
+    // Fingerprints of every page as of the last synchronization
+    std::vector<uint64_t> m_ramPages;
+    std::vector<uint64_t> m_raminPages;
+    uint64_t m_zeroFingerprint = 0;
+
+    uint64_t m_methodCount = 0;
+    uint64_t m_pageCount = 0;
+};
+
+/*!
+ * Maps a trace file and iterates over its records.
+ */
+class NV2ATraceReader {
+public:
+    NV2ATraceReader();
+    ~NV2ATraceReader();
+
+    bool Open(const char *path);
+    void Close();
+
+    const NV2ATraceHeader *GetHeader() const { return (const NV2ATraceHeader *)m_data; }
+
+    // Returns the record at the current position and advances past it, or
+    // nullptr at the end of the trace. For memory records, pageData points
+    // to the page contents.
+    const uint8_t *Next(const uint8_t **pageData);
+
+    void Rewind();
+
+private:
+    uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_position = 0;
+
+#ifdef _WIN32
+    void *m_fileHandle = nullptr;
+    void *m_mapping = nullptr;
+#endif
+};
+
+}
@@ -0,0 +1,1011 @@
+/*
+ * Portions of the code are based on XQEMU's NV2A vertex shader translator.
+ * The original copyright header is included below.
+ */
+/*
+ * QEMU Geforce NV2A vertex shader translation
+ *
+ * Copyright (c) 2014 Jannik Vogel
+ * Copyright (c) 2012 espes
+ *
+ * Based on:
+ * Cxbx, VertexShader.cpp
+ * Copyright (c) 2004 Aaron Robinson <caustik@caustik.com>
+ *                    Kingofc <kingofc@freenet.de>
+ * Dxbx, uPushBuffer.pas
+ * Copyright (c) 2007 Shadow_tj, PatrickvL
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 or
+ * (at your option) version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include "vsh.h"
+#include "openxbox/log.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace openxbox {
+
+// Flush the program cache when it grows past this many entries
+#define VSH_MAX_CACHED_PROGRAMS 1024
+
+// ----- Instruction decoding -------------------------------------------------
+
+typedef enum {
+    FLD_ILU = 0,
+    FLD_MAC,
+    FLD_CONST,
+    FLD_V,
+    // Input A
+    FLD_A_NEG,
+    FLD_A_SWZ_X,
+    FLD_A_SWZ_Y,
+    FLD_A_SWZ_Z,
+    FLD_A_SWZ_W,
+    FLD_A_R,
+    FLD_A_MUX,
+    // Input B
+    FLD_B_NEG,
+    FLD_B_SWZ_X,
+    FLD_B_SWZ_Y,
+    FLD_B_SWZ_Z,
+    FLD_B_SWZ_W,
+    FLD_B_R,
+    FLD_B_MUX,
+    // Input C
+    FLD_C_NEG,
+    FLD_C_SWZ_X,
+    FLD_C_SWZ_Y,
+    FLD_C_SWZ_Z,
+    FLD_C_SWZ_W,
+    FLD_C_R_HIGH,
+    FLD_C_R_LOW,
+    FLD_C_MUX,
+    // Output
+    FLD_OUT_MAC_MASK,
+    FLD_OUT_R,
+    FLD_OUT_ILU_MASK,
+    FLD_OUT_O_MASK,
+    FLD_OUT_ORB,
+    FLD_OUT_ADDRESS,
+    FLD_OUT_MUX,
+    // Relative addressing
+    FLD_A0X,
+    // Last instruction
+    FLD_FINAL,
+} VshFieldName;
+
+typedef enum {
+    PARAM_UNKNOWN = 0,
+    PARAM_R,
+    PARAM_V,
+    PARAM_C,
+} VshParameterType;
+
+typedef enum {
+    OUTPUT_C = 0,
+    OUTPUT_O,
+} VshOutputType;
+
+typedef enum {
+    OMUX_MAC = 0,
+    OMUX_ILU,
+} VshOutputMux;
+
+typedef enum {
+    ILU_NOP = 0,
+    ILU_MOV,
+    ILU_RCP,
+    ILU_RCC,
+    ILU_RSQ,
+    ILU_EXP,
+    ILU_LOG,
+    ILU_LIT,
+} VshILU;
+
+typedef enum {
+    MAC_NOP = 0,
+    MAC_MOV,
+    MAC_MUL,
+    MAC_ADD,
+    MAC_MAD,
+    MAC_DP3,
+    MAC_DPH,
+    MAC_DP4,
+    MAC_DST,
+    MAC_MIN,
+    MAC_MAX,
+    MAC_SLT,
+    MAC_SGE,
+    MAC_ARL,
+} VshMAC;
+
+typedef struct {
+    uint8_t subtoken;
+    uint8_t start_bit;
+    uint8_t bit_length;
+} VshFieldMapping;
+
+// Indexed by VshFieldName
+static const VshFieldMapping field_mapping[] = {
+    // DWORD BitPos BitSize
+    {  1,   25,     3 }, // FLD_ILU
+    {  1,   21,     4 }, // FLD_MAC
+    {  1,   13,     8 }, // FLD_CONST
+    {  1,    9,     4 }, // FLD_V
+    {  1,    8,     1 }, // FLD_A_NEG
+    {  1,    6,     2 }, // FLD_A_SWZ_X
+    {  1,    4,     2 }, // FLD_A_SWZ_Y
+    {  1,    2,     2 }, // FLD_A_SWZ_Z
+    {  1,    0,     2 }, // FLD_A_SWZ_W
+    {  2,   28,     4 }, // FLD_A_R
+    {  2,   26,     2 }, // FLD_A_MUX
+    {  2,   25,     1 }, // FLD_B_NEG
+    {  2,   23,     2 }, // FLD_B_SWZ_X
+    {  2,   21,     2 }, // FLD_B_SWZ_Y
+    {  2,   19,     2 }, // FLD_B_SWZ_Z
+    {  2,   17,     2 }, // FLD_B_SWZ_W
+    {  2,   13,     4 }, // FLD_B_R
+    {  2,   11,     2 }, // FLD_B_MUX
+    {  2,   10,     1 }, // FLD_C_NEG
+    {  2,    8,     2 }, // FLD_C_SWZ_X
+    {  2,    6,     2 }, // FLD_C_SWZ_Y
+    {  2,    4,     2 }, // FLD_C_SWZ_Z
+    {  2,    2,     2 }, // FLD_C_SWZ_W
+    {  2,    0,     2 }, // FLD_C_R_HIGH
+    {  3,   30,     2 }, // FLD_C_R_LOW
+    {  3,   28,     2 }, // FLD_C_MUX
+    {  3,   24,     4 }, // FLD_OUT_MAC_MASK
+    {  3,   20,     4 }, // FLD_OUT_R
+    {  3,   16,     4 }, // FLD_OUT_ILU_MASK
+    {  3,   12,     4 }, // FLD_OUT_O_MASK
+    {  3,   11,     1 }, // FLD_OUT_ORB
+    {  3,    3,     8 }, // FLD_OUT_ADDRESS
+    {  3,    2,     1 }, // FLD_OUT_MUX
+    {  3,    1,     1 }, // FLD_A0X
+    {  3,    0,     1 }, // FLD_FINAL
+};
+
+static uint8_t vsh_get_field(const uint32_t *shader_token, VshFieldName field_name) {
+    const VshFieldMapping& f = field_mapping[field_name];
+    return (uint8_t)((shader_token[f.subtoken] >> f.start_bit) & ~(0xFFFFFFFF << f.bit_length));
+}
+
+// Hardware masks have X in the most significant bit; micro-ops use bit n for component n
+static uint8_t vsh_convert_mask(uint8_t hw_mask) {
+    return ((hw_mask & 0x8) >> 3) | ((hw_mask & 0x4) >> 1) | ((hw_mask & 0x2) << 1) | ((hw_mask & 0x1) << 3);
+}
+
+static VshSource vsh_decode_source(const uint32_t *shader_token, VshFieldName neg_field, uint8_t reg, uint8_t mux) {
+    VshSource src;
+    src.negate = vsh_get_field(shader_token, neg_field) != 0;
+    for (int i = 0; i < 4; i++) {
+        src.swizzle[i] = vsh_get_field(shader_token, (VshFieldName)(neg_field + 1 + i));
+    }
+
+    switch (mux) {
+    case PARAM_R:
+        if (reg > VSH_TEMP_REGISTERS) {
+            log_warning("VSH: Read from invalid temporary register R%u\n", reg);
+        }
+        src.file = VSH_FILE_REG;
+        src.index = reg; // R12 reads oPos
+        break;
+    case PARAM_V:
+        src.file = VSH_FILE_INPUT;
+        src.index = vsh_get_field(shader_token, FLD_V);
+        break;
+    case PARAM_C:
+        src.file = vsh_get_field(shader_token, FLD_A0X) ? VSH_FILE_CONST_REL : VSH_FILE_CONST;
+        src.index = vsh_get_field(shader_token, FLD_CONST);
+        if (src.file == VSH_FILE_CONST && src.index >= NV2A_VERTEXSHADER_CONSTANTS) {
+            log_warning("VSH: Read from invalid constant register c[%u]\n", src.index);
+            src.index = NV2A_VERTEXSHADER_CONSTANTS - 1;
+        }
+        break;
+    default:
+        log_warning("VSH: Unknown input multiplexer %u\n", mux);
+        src.file = VSH_FILE_REG;
+        src.index = 0;
+        break;
+    }
+
+    return src;
+}
+
+static uint64_t vsh_hash_tokens(const uint32_t *tokens, size_t count) {
+    // FNV-1a
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    const uint8_t *bytes = (const uint8_t *)tokens;
+    for (size_t i = 0; i < count * sizeof(uint32_t); i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static size_t vsh_program_length(const uint32_t (*tokens)[VSH_TOKEN_SIZE], unsigned int start) {
+    size_t length = 0;
+    for (unsigned int pc = start; pc < NV2A_MAX_TRANSFORM_PROGRAM_LENGTH; pc++) {
+        length++;
+        if (vsh_get_field(tokens[pc], FLD_FINAL)) {
+            break;
+        }
+    }
+    return length;
+}
+
+// ----- Micro-op construction ------------------------------------------------
+
+static VshSource vsh_src(uint8_t file, uint8_t index, const char *swizzle = "xyzw", bool negate = false) {
+    VshSource src;
+    src.file = file;
+    src.index = index;
+    src.negate = negate;
+    for (int i = 0; i < 4; i++) {
+        switch (swizzle[i]) {
+        case 'x': src.swizzle[i] = 0; break;
+        case 'y': src.swizzle[i] = 1; break;
+        case 'z': src.swizzle[i] = 2; break;
+        case 'w': src.swizzle[i] = 3; break;
+        default: assert(false); break;
+        }
+    }
+    return src;
+}
+
+static inline VshSource vsh_reg(uint8_t slot, const char *swizzle = "xyzw", bool negate = false) {
+    return vsh_src(VSH_FILE_REG, slot, swizzle, negate);
+}
+
+static inline VshSource vsh_in(uint8_t attr, const char *swizzle = "xyzw") {
+    return vsh_src(VSH_FILE_INPUT, attr, swizzle);
+}
+
+static inline VshSource vsh_const(uint8_t row, const char *swizzle = "xyzw") {
+    return vsh_src(VSH_FILE_CONST, row, swizzle);
+}
+
+static VshMicroOp vsh_op(uint8_t op, uint8_t dst, uint8_t mask, const VshSource& a) {
+    VshMicroOp mop;
+    mop.op = op;
+    mop.numSources = 1;
+    mop.src[0] = a;
+    mop.dst[0] = dst;
+    mop.mask[0] = mask;
+    return mop;
+}
+
+static VshMicroOp vsh_op(uint8_t op, uint8_t dst, uint8_t mask, const VshSource& a, const VshSource& b) {
+    VshMicroOp mop = vsh_op(op, dst, mask, a);
+    mop.numSources = 2;
+    mop.src[1] = b;
+    return mop;
+}
+
+static VshMicroOp vsh_op(uint8_t op, uint8_t dst, uint8_t mask, const VshSource& a, const VshSource& b, const VshSource& c) {
+    VshMicroOp mop = vsh_op(op, dst, mask, a, b);
+    mop.numSources = 3;
+    mop.src[2] = c;
+    return mop;
+}
+
+// Applies the o[]/c[] output of an instruction to the micro-op that produces it
+static void vsh_set_output(VshMicroOp& mop, VshProgram *program, const uint32_t *shader_token) {
+    uint8_t o_mask = vsh_convert_mask(vsh_get_field(shader_token, FLD_OUT_O_MASK));
+    if (o_mask == 0) {
+        return;
+    }
+
+    uint8_t address = vsh_get_field(shader_token, FLD_OUT_ADDRESS);
+    if (vsh_get_field(shader_token, FLD_OUT_ORB) == OUTPUT_O) {
+        address &= 0xF;
+        if (address >= VSH_OUTPUT_REGISTERS) {
+            log_warning("VSH: Write to invalid output register o[%u]\n", address);
+            return;
+        }
+        mop.dst[1] = VSH_SLOT_OUTPUT(address);
+        mop.mask[1] = o_mask;
+    }
+    else {
+        if (address >= NV2A_VERTEXSHADER_CONSTANTS) {
+            log_warning("VSH: Write to invalid constant register c[%u]\n", address);
+            return;
+        }
+        mop.constDst = address;
+        mop.constMask = o_mask;
+        program->writesConstants = true;
+    }
+}
+
+static void vsh_track_inputs(VshProgram *program, const VshMicroOp& mop) {
+    for (int i = 0; i < mop.numSources; i++) {
+        if (mop.src[i].file == VSH_FILE_INPUT) {
+            program->inputMask |= 1 << mop.src[i].index;
+        }
+    }
+}
+
+static void vsh_emit(VshProgram *program, const VshMicroOp& mop) {
+    vsh_track_inputs(program, mop);
+    program->ops.push_back(mop);
+}
+
+static void vsh_decode_instruction(VshProgram *program, const uint32_t *shader_token) {
+    uint8_t ilu = vsh_get_field(shader_token, FLD_ILU);
+    uint8_t mac = vsh_get_field(shader_token, FLD_MAC);
+    uint8_t out_r = vsh_get_field(shader_token, FLD_OUT_R);
+    uint8_t mac_mask = vsh_convert_mask(vsh_get_field(shader_token, FLD_OUT_MAC_MASK));
+    uint8_t ilu_mask = vsh_convert_mask(vsh_get_field(shader_token, FLD_OUT_ILU_MASK));
+    uint8_t out_mux = vsh_get_field(shader_token, FLD_OUT_MUX);
+
+    if (out_r > VSH_TEMP_REGISTERS) {
+        log_warning("VSH: Write to invalid temporary register R%u\n", out_r);
+        out_r = VSH_TEMP_REGISTERS; // R12 is oPos
+    }
+
+    VshSource a = vsh_decode_source(shader_token, FLD_A_NEG,
+        vsh_get_field(shader_token, FLD_A_R), vsh_get_field(shader_token, FLD_A_MUX));
+    VshSource b = vsh_decode_source(shader_token, FLD_B_NEG,
+        vsh_get_field(shader_token, FLD_B_R), vsh_get_field(shader_token, FLD_B_MUX));
+    VshSource c = vsh_decode_source(shader_token, FLD_C_NEG,
+        (vsh_get_field(shader_token, FLD_C_R_HIGH) << 2) | vsh_get_field(shader_token, FLD_C_R_LOW),
+        vsh_get_field(shader_token, FLD_C_MUX));
+
+    // When both units are active, the ILU result goes to R1. Both units read
+    // their inputs before either one writes, so the ILU result is parked in
+    // the scratch slot until the MAC op has executed.
+    bool paired = (ilu != ILU_NOP) && (mac != MAC_NOP);
+
+    VshMicroOp ilu_op;
+    if (ilu != ILU_NOP) {
+        static const uint8_t ilu_ops[] = {
+            VSH_OP_NOP, VSH_OP_MOV, VSH_OP_RCP, VSH_OP_RCC,
+            VSH_OP_RSQ, VSH_OP_EXP, VSH_OP_LOG, VSH_OP_LIT,
+        };
+
+        if (paired) {
+            vsh_emit(program, vsh_op(ilu_ops[ilu], VSH_SLOT_SCRATCH, VSH_MASK_XYZW, c));
+
+            ilu_op = vsh_op(VSH_OP_MOV, VSH_SLOT_TEMP(1), ilu_mask, vsh_reg(VSH_SLOT_SCRATCH));
+        }
+        else {
+            ilu_op = vsh_op(ilu_ops[ilu], VSH_SLOT_TEMP(out_r), ilu_mask, c);
+        }
+        if (out_mux == OMUX_ILU) {
+            vsh_set_output(ilu_op, program, shader_token);
+        }
+    }
+
+    if (mac != MAC_NOP) {
+        VshMicroOp mac_op;
+        switch (mac) {
+        case MAC_MOV: mac_op = vsh_op(VSH_OP_MOV, VSH_SLOT_TEMP(out_r), mac_mask, a); break;
+        case MAC_MUL: mac_op = vsh_op(VSH_OP_MUL, VSH_SLOT_TEMP(out_r), mac_mask, a, b); break;
+        case MAC_ADD: mac_op = vsh_op(VSH_OP_ADD, VSH_SLOT_TEMP(out_r), mac_mask, a, c); break;
+        case MAC_MAD: mac_op = vsh_op(VSH_OP_MAD, VSH_SLOT_TEMP(out_r), mac_mask, a, b, c); break;
+        case MAC_DP3: mac_op = vsh_op(VSH_OP_DP3, VSH_SLOT_TEMP(out_r), mac_mask, a, b); break;
+        case MAC_DPH: mac_op = vsh_op(VSH_OP_DPH, VSH_SLOT_TEMP(out_r), mac_mask, a, b); break;
+        case MAC_DP4: mac_op = vsh_op(VSH_OP_DP4, VSH_SLOT_TEMP(out_r), mac_mask, a, b); break;
+        case MAC_DST: mac_op = vsh_op(VSH_OP_DST, VSH_SLOT_TEMP(out_r), mac_mask, a, b); break;
+        case MAC_MIN: mac_op = vsh_op(VSH_OP_MIN, VSH_SLOT_TEMP(out_r), mac_mask, a, b); break;
+        case MAC_MAX: mac_op = vsh_op(VSH_OP_MAX, VSH_SLOT_TEMP(out_r), mac_mask, a, b); break;
+        case MAC_SLT: mac_op = vsh_op(VSH_OP_SLT, VSH_SLOT_TEMP(out_r), mac_mask, a, b); break;
+        case MAC_SGE: mac_op = vsh_op(VSH_OP_SGE, VSH_SLOT_TEMP(out_r), mac_mask, a, b); break;
+        case MAC_ARL: mac_op = vsh_op(VSH_OP_ARL, 0, 0, a); break;
+        default:
+            log_warning("VSH: Unknown MAC opcode %u\n", mac);
+            return;
+        }
+        if (out_mux == OMUX_MAC) {
+            vsh_set_output(mac_op, program, shader_token);
+        }
+        if (mac_op.op == VSH_OP_ARL || mac_op.mask[0] || mac_op.mask[1] || mac_op.constMask) {
+            vsh_emit(program, mac_op);
+        }
+    }
+
+    if (ilu != ILU_NOP && (ilu_op.mask[0] || ilu_op.mask[1] || ilu_op.constMask)) {
+        vsh_emit(program, ilu_op);
+    }
+}
+
+// ----- SIMD helpers ---------------------------------------------------------
+
+#if VSH_BATCH_SIZE == 8
+static inline VshLane vsh_set1(float f) { return _mm256_set1_ps(f); }
+static inline VshLane vsh_load(const float *p) { return _mm256_load_ps(p); }
+static inline void vsh_store(float *p, VshLane v) { _mm256_store_ps(p, v); }
+static inline VshLane vsh_add(VshLane a, VshLane b) { return _mm256_add_ps(a, b); }
+static inline VshLane vsh_sub(VshLane a, VshLane b) { return _mm256_sub_ps(a, b); }
+static inline VshLane vsh_mul(VshLane a, VshLane b) { return _mm256_mul_ps(a, b); }
+static inline VshLane vsh_min(VshLane a, VshLane b) { return _mm256_min_ps(a, b); }
+static inline VshLane vsh_max(VshLane a, VshLane b) { return _mm256_max_ps(a, b); }
+static inline VshLane vsh_neg(VshLane a) { return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f)); }
+static inline VshLane vsh_slt(VshLane a, VshLane b) { return _mm256_and_ps(_mm256_cmp_ps(a, b, _CMP_LT_OQ), _mm256_set1_ps(1.0f)); }
+static inline VshLane vsh_sge(VshLane a, VshLane b) { return _mm256_and_ps(_mm256_cmp_ps(a, b, _CMP_GE_OQ), _mm256_set1_ps(1.0f)); }
+#else
+static inline VshLane vsh_set1(float f) { return _mm_set1_ps(f); }
+static inline VshLane vsh_load(const float *p) { return _mm_load_ps(p); }
+static inline void vsh_store(float *p, VshLane v) { _mm_store_ps(p, v); }
+static inline VshLane vsh_add(VshLane a, VshLane b) { return _mm_add_ps(a, b); }
+static inline VshLane vsh_sub(VshLane a, VshLane b) { return _mm_sub_ps(a, b); }
+static inline VshLane vsh_mul(VshLane a, VshLane b) { return _mm_mul_ps(a, b); }
+static inline VshLane vsh_min(VshLane a, VshLane b) { return _mm_min_ps(a, b); }
+static inline VshLane vsh_max(VshLane a, VshLane b) { return _mm_max_ps(a, b); }
+static inline VshLane vsh_neg(VshLane a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+static inline VshLane vsh_slt(VshLane a, VshLane b) { return _mm_and_ps(_mm_cmplt_ps(a, b), _mm_set1_ps(1.0f)); }
+static inline VshLane vsh_sge(VshLane a, VshLane b) { return _mm_and_ps(_mm_cmpge_ps(a, b), _mm_set1_ps(1.0f)); }
+#endif
+
+static inline VshLane vsh_dp3(const VshLane *a, const VshLane *b) {
+    return vsh_add(vsh_add(vsh_mul(a[0], b[0]), vsh_mul(a[1], b[1])), vsh_mul(a[2], b[2]));
+}
+
+// ----- ILU functions --------------------------------------------------------
+// These operate on a single scalar per vertex and are evaluated lane by lane.
+
+static void vsh_ilu(uint8_t op, const VshLane *src, VshLane *result) {
+    alignas(sizeof(VshLane)) float x[VSH_BATCH_SIZE];
+    alignas(sizeof(VshLane)) float r[4][VSH_BATCH_SIZE];
+
+    vsh_store(x, src[0]);
+
+    switch (op) {
+    case VSH_OP_RCP:
+        for (int i = 0; i < VSH_BATCH_SIZE; i++) {
+            r[0][i] = r[1][i] = r[2][i] = r[3][i] = 1.0f / x[i];
+        }
+        break;
+    case VSH_OP_RCC:
+        for (int i = 0; i < VSH_BATCH_SIZE; i++) {
+            float t = 1.0f / x[i];
+            if (t > 0.0f) {
+                t = std::fmin(std::fmax(t, 5.42101e-020f), 1.884467e+019f);
+            }
+            else {
+                t = std::fmin(std::fmax(t, -1.884467e+019f), -5.42101e-020f);
+            }
+            r[0][i] = r[1][i] = r[2][i] = r[3][i] = t;
+        }
+        break;
+    case VSH_OP_RSQ:
+        for (int i = 0; i < VSH_BATCH_SIZE; i++) {
+            r[0][i] = r[1][i] = r[2][i] = r[3][i] = 1.0f / std::sqrt(std::fabs(x[i]));
+        }
+        break;
+    case VSH_OP_EXP:
+        for (int i = 0; i < VSH_BATCH_SIZE; i++) {
+            float fl = std::floor(x[i]);
+            r[0][i] = std::exp2(fl);
+            r[1][i] = x[i] - fl;
+            r[2][i] = std::exp2(x[i]);
+            r[3][i] = 1.0f;
+        }
+        break;
+    case VSH_OP_LOG:
+        for (int i = 0; i < VSH_BATCH_SIZE; i++) {
+            float t = std::fabs(x[i]);
+            if (t == 0.0f) {
+                r[0][i] = r[1][i] = r[2][i] = -std::numeric_limits<float>::infinity();
+            }
+            else {
+                float e = std::floor(std::log2(t));
+                r[0][i] = e;
+                r[1][i] = t / std::exp2(e);
+                r[2][i] = std::log2(t);
+            }
+            r[3][i] = 1.0f;
+        }
+        break;
+    case VSH_OP_LIT:
+    {
+        alignas(sizeof(VshLane)) float y[VSH_BATCH_SIZE];
+        alignas(sizeof(VshLane)) float w[VSH_BATCH_SIZE];
+        vsh_store(y, src[1]);
+        vsh_store(w, src[3]);
+        for (int i = 0; i < VSH_BATCH_SIZE; i++) {
+            // The specular power is clamped to 128 - 1/256 in magnitude and the
+            // specular term never goes below zero
+            float power = std::fmin(std::fmax(w[i], -127.99609375f), 127.99609375f);
+            r[0][i] = 1.0f;
+            r[1][i] = std::fmax(x[i], 0.0f);
+            r[2][i] = (x[i] > 0.0f) ? std::pow(std::fmax(y[i], 0.0f), power) : 0.0f;
+            r[3][i] = 1.0f;
+        }
+        break;
+    }
+    default:
+        assert(false);
+        break;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        result[i] = vsh_load(r[i]);
+    }
+}
+
+// ----- Interpreter ----------------------------------------------------------
+
+struct VshBatchState {
+    VshLane regs[VSH_NUM_SLOTS][4];
+    VshLane in[NV2A_VERTEXSHADER_ATTRIBUTES][4];
+    alignas(sizeof(VshLane)) float a0[VSH_BATCH_SIZE];
+    float (*constants)[4];
+    bool constantWrites;
+    unsigned int lanes; // number of valid vertices in this batch
+};
+
+static void vsh_fetch(const VshSource& src, const VshBatchState& st, VshLane *out) {
+    VshLane value[4];
+
+    switch (src.file) {
+    case VSH_FILE_REG:
+        for (int i = 0; i < 4; i++) {
+            value[i] = st.regs[src.index][i];
+        }
+        break;
+    case VSH_FILE_INPUT:
+        for (int i = 0; i < 4; i++) {
+            value[i] = st.in[src.index][i];
+        }
+        break;
+    case VSH_FILE_CONST:
+        for (int i = 0; i < 4; i++) {
+            value[i] = vsh_set1(st.constants[src.index][i]);
+        }
+        break;
+    case VSH_FILE_CONST_REL:
+    {
+        alignas(sizeof(VshLane)) float g[4][VSH_BATCH_SIZE];
+        for (int lane = 0; lane < VSH_BATCH_SIZE; lane++) {
+            int index = src.index + (int)st.a0[lane];
+            if (index < 0 || index >= NV2A_VERTEXSHADER_CONSTANTS) {
+                index = (index < 0) ? 0 : NV2A_VERTEXSHADER_CONSTANTS - 1;
+            }
+            for (int i = 0; i < 4; i++) {
+                g[i][lane] = st.constants[index][i];
+            }
+        }
+        for (int i = 0; i < 4; i++) {
+            value[i] = vsh_load(g[i]);
+        }
+        break;
+    }
+    default:
+        assert(false);
+        break;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        out[i] = value[src.swizzle[i]];
+        if (src.negate) {
+            out[i] = vsh_neg(out[i]);
+        }
+    }
+}
+
+static void vsh_execute(const VshProgram *program, VshBatchState& st) {
+    VshLane s[3][4];
+    VshLane r[4];
+
+    for (const VshMicroOp& mop : program->ops) {
+        for (int i = 0; i < mop.numSources; i++) {
+            vsh_fetch(mop.src[i], st, s[i]);
+        }
+
+        switch (mop.op) {
+        case VSH_OP_MOV:
+            for (int i = 0; i < 4; i++) r[i] = s[0][i];
+            break;
+        case VSH_OP_MUL:
+            for (int i = 0; i < 4; i++) r[i] = vsh_mul(s[0][i], s[1][i]);
+            break;
+        case VSH_OP_ADD:
+            for (int i = 0; i < 4; i++) r[i] = vsh_add(s[0][i], s[1][i]);
+            break;
+        case VSH_OP_MAD:
+            for (int i = 0; i < 4; i++) r[i] = vsh_add(vsh_mul(s[0][i], s[1][i]), s[2][i]);
+            break;
+        case VSH_OP_DP3:
+            r[0] = vsh_dp3(s[0], s[1]);
+            r[1] = r[2] = r[3] = r[0];
+            break;
+        case VSH_OP_DPH:
+            r[0] = vsh_add(vsh_dp3(s[0], s[1]), s[1][3]);
+            r[1] = r[2] = r[3] = r[0];
+            break;
+        case VSH_OP_DP4:
+            r[0] = vsh_add(vsh_dp3(s[0], s[1]), vsh_mul(s[0][3], s[1][3]));
+            r[1] = r[2] = r[3] = r[0];
+            break;
+        case VSH_OP_DST:
+            r[0] = vsh_set1(1.0f);
+            r[1] = vsh_mul(s[0][1], s[1][1]);
+            r[2] = s[0][2];
+            r[3] = s[1][3];
+            break;
+        case VSH_OP_MIN:
+            for (int i = 0; i < 4; i++) r[i] = vsh_min(s[0][i], s[1][i]);
+            break;
+        case VSH_OP_MAX:
+            for (int i = 0; i < 4; i++) r[i] = vsh_max(s[0][i], s[1][i]);
+            break;
+        case VSH_OP_SLT:
+            for (int i = 0; i < 4; i++) r[i] = vsh_slt(s[0][i], s[1][i]);
+            break;
+        case VSH_OP_SGE:
+            for (int i = 0; i < 4; i++) r[i] = vsh_sge(s[0][i], s[1][i]);
+            break;
+        case VSH_OP_ARL:
+        {
+            alignas(sizeof(VshLane)) float x[VSH_BATCH_SIZE];
+            vsh_store(x, s[0][0]);
+            for (int lane = 0; lane < VSH_BATCH_SIZE; lane++) {
+                st.a0[lane] = std::floor(x[lane]);
+            }
+            continue;
+        }
+        case VSH_OP_RCP:
+        case VSH_OP_RCC:
+        case VSH_OP_RSQ:
+        case VSH_OP_EXP:
+        case VSH_OP_LOG:
+        case VSH_OP_LIT:
+            vsh_ilu(mop.op, s[0], r);
+            break;
+        default:
+            continue;
+        }
+
+        for (int d = 0; d < 2; d++) {
+            if (mop.mask[d] == 0) {
+                continue;
+            }
+            for (int i = 0; i < 4; i++) {
+                if (mop.mask[d] & (1 << i)) {
+                    st.regs[mop.dst[d]][i] = r[i];
+                }
+            }
+        }
+
+        if (mop.constMask && st.constantWrites) {
+            // Programs that write c[] run one vertex at a time, see Run
+            for (int i = 0; i < 4; i++) {
+                if (mop.constMask & (1 << i)) {
+                    alignas(sizeof(VshLane)) float v[VSH_BATCH_SIZE];
+                    vsh_store(v, r[i]);
+                    st.constants[mop.constDst][i] = v[st.lanes - 1];
+                }
+            }
+        }
+    }
+}
+
+// ----- Fixed function programs ----------------------------------------------
+
+uint32_t VshFixedFunctionKey::Pack() const {
+    uint32_t key = 0;
+    key |= lighting ? (1 << 0) : 0;
+    key |= normalize ? (1 << 1) : 0;
+    key |= specular ? (1 << 6) : 0;
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        key |= textureMatrix[i] ? (1 << (2 + i)) : 0;
+    }
+    for (int i = 0; i < NV2A_MAX_LIGHTS; i++) {
+        key |= (lightModes[i] & 3) << (8 + i * 2);
+    }
+    return key;
+}
+
+VshProgram *VshEngine::GenerateFixedFunction(const VshFixedFunctionKey& key) {
+    VshProgram *program = new VshProgram();
+
+    const uint8_t N = VSH_SLOT_TEMP(0);      // eye space normal
+    const uint8_t T = VSH_SLOT_TEMP(1);      // scratch scalars
+    const uint8_t P = VSH_SLOT_TEMP(2);      // eye space position
+    const uint8_t COL = VSH_SLOT_TEMP(3);    // accumulated diffuse color
+    const uint8_t L = VSH_SLOT_TEMP(4);      // light vector
+    const uint8_t S = VSH_SLOT_TEMP(5);      // N dot L
+    const uint8_t ATT = VSH_SLOT_TEMP(6);    // attenuation terms
+    const uint8_t SPEC = VSH_SLOT_TEMP(7);   // accumulated specular color
+    const uint8_t H = VSH_SLOT_TEMP(8);      // half vector
+    const uint8_t LT = VSH_SLOT_TEMP(9);     // LIT coefficients
+    const uint8_t POS = VSH_SLOT_OUTPUT(VSH_OUT_POS);
+
+    // Transform position by the composite matrix, which includes the
+    // viewport scale, then apply the perspective divide and viewport offset
+    for (int i = 0; i < 4; i++) {
+        vsh_emit(program, vsh_op(VSH_OP_DP4, POS, 1 << i,
+            vsh_in(NV2A_VERTEX_ATTR_POSITION), vsh_const(NV_IGRAPH_XF_XFCTX_CMAT0 + i)));
+    }
+    vsh_emit(program, vsh_op(VSH_OP_RCC, T, VSH_MASK_X, vsh_reg(POS, "wwww")));
+    vsh_emit(program, vsh_op(VSH_OP_MAD, POS, VSH_MASK_XYZ,
+        vsh_reg(POS), vsh_reg(T, "xxxx"), vsh_const(NV_IGRAPH_XF_XFCTX_VPOFF)));
+
+    uint8_t d0 = VSH_SLOT_OUTPUT(VSH_OUT_D0);
+    uint8_t d1 = VSH_SLOT_OUTPUT(VSH_OUT_D1);
+
+    if (key.lighting) {
+        // Transform the normal to eye space
+        for (int i = 0; i < 3; i++) {
+            vsh_emit(program, vsh_op(VSH_OP_DP3, N, 1 << i,
+                vsh_in(NV2A_VERTEX_ATTR_NORMAL), vsh_const(NV_IGRAPH_XF_XFCTX_IMMAT0 + i)));
+        }
+        if (key.normalize) {
+            vsh_emit(program, vsh_op(VSH_OP_DP3, N, VSH_MASK_W, vsh_reg(N), vsh_reg(N)));
+            vsh_emit(program, vsh_op(VSH_OP_RSQ, T, VSH_MASK_X, vsh_reg(N, "wwww")));
+            vsh_emit(program, vsh_op(VSH_OP_MUL, N, VSH_MASK_XYZ, vsh_reg(N), vsh_reg(T, "xxxx")));
+        }
+
+        bool needsPosition = false;
+        for (int i = 0; i < NV2A_MAX_LIGHTS; i++) {
+            needsPosition |= key.lightModes[i] == NV_PGRAPH_CSV0_D_LIGHT0_LOCAL
+                || key.lightModes[i] == NV_PGRAPH_CSV0_D_LIGHT0_SPOT;
+        }
+        if (needsPosition) {
+            for (int i = 0; i < 4; i++) {
+                vsh_emit(program, vsh_op(VSH_OP_DP4, P, 1 << i,
+                    vsh_in(NV2A_VERTEX_ATTR_POSITION), vsh_const(NV_IGRAPH_XF_XFCTX_MMAT0 + i)));
+            }
+        }
+
+        const VshSource zero = vsh_const(VSH_FF_CONSTANTS_ROW, "xxxx");
+        vsh_emit(program, vsh_op(VSH_OP_MOV, COL, VSH_MASK_XYZ, vsh_const(VSH_FF_SCENE_AMBIENT_ROW)));
+        if (key.specular) {
+            vsh_emit(program, vsh_op(VSH_OP_MOV, SPEC, VSH_MASK_XYZ, zero));
+            // S.w carries the specular power for LIT; S.x and S.y hold N dot L
+            // and N dot H
+            vsh_emit(program, vsh_op(VSH_OP_MOV, S, VSH_MASK_W, vsh_const(VSH_FF_CONSTANTS_ROW, "wwww")));
+        }
+
+        for (int i = 0; i < NV2A_MAX_LIGHTS; i++) {
+            uint8_t base = VSH_FF_LIGHT_BASE_ROW + i * VSH_FF_LIGHT_ROWS;
+
+            switch (key.lightModes[i]) {
+            case NV_PGRAPH_CSV0_D_LIGHT0_OFF:
+                break;
+            case NV_PGRAPH_CSV0_D_LIGHT0_INFINITE:
+                vsh_emit(program, vsh_op(VSH_OP_DP3, S, VSH_MASK_X, vsh_reg(N), vsh_const(base + VSH_FF_LIGHT_DIRECTION)));
+                vsh_emit(program, vsh_op(VSH_OP_MAX, S, VSH_MASK_X, vsh_reg(S), zero));
+                vsh_emit(program, vsh_op(VSH_OP_ADD, COL, VSH_MASK_XYZ, vsh_reg(COL), vsh_const(base + VSH_FF_LIGHT_AMBIENT)));
+                vsh_emit(program, vsh_op(VSH_OP_MAD, COL, VSH_MASK_XYZ,
+                    vsh_const(base + VSH_FF_LIGHT_DIFFUSE), vsh_reg(S, "xxxx"), vsh_reg(COL)));
+                if (key.specular) {
+                    // Infinite lights come with a precomputed half vector
+                    vsh_emit(program, vsh_op(VSH_OP_DP3, S, VSH_MASK_Y, vsh_reg(N), vsh_const(base + VSH_FF_LIGHT_HALF_VECTOR)));
+                    vsh_emit(program, vsh_op(VSH_OP_LIT, LT, VSH_MASK_XYZW, vsh_reg(S)));
+                    vsh_emit(program, vsh_op(VSH_OP_MAD, SPEC, VSH_MASK_XYZ,
+                        vsh_const(base + VSH_FF_LIGHT_SPECULAR), vsh_reg(LT, "zzzz"), vsh_reg(SPEC)));
+                }
+                break;
+            case NV_PGRAPH_CSV0_D_LIGHT0_LOCAL:
+            case NV_PGRAPH_CSV0_D_LIGHT0_SPOT:
+                // Spot lights are lit as local lights; the cone falloff is not applied
+                vsh_emit(program, vsh_op(VSH_OP_ADD, L, VSH_MASK_XYZ, vsh_const(base + VSH_FF_LIGHT_POSITION), vsh_reg(P, "xyzw", true)));
+                vsh_emit(program, vsh_op(VSH_OP_DP3, L, VSH_MASK_W, vsh_reg(L), vsh_reg(L)));
+                vsh_emit(program, vsh_op(VSH_OP_RSQ, T, VSH_MASK_X, vsh_reg(L, "wwww")));
+                vsh_emit(program, vsh_op(VSH_OP_MUL, L, VSH_MASK_XYZ, vsh_reg(L), vsh_reg(T, "xxxx")));
+                // (1, d, d^2, 1/d) dot (k0, k1, k2) gives the attenuation denominator
+                vsh_emit(program, vsh_op(VSH_OP_DST, ATT, VSH_MASK_XYZW, vsh_reg(L, "wwww"), vsh_reg(T, "xxxx")));
+                vsh_emit(program, vsh_op(VSH_OP_DP3, ATT, VSH_MASK_X, vsh_reg(ATT), vsh_const(base + VSH_FF_LIGHT_ATTENUATION)));
+                vsh_emit(program, vsh_op(VSH_OP_RCP, ATT, VSH_MASK_X, vsh_reg(ATT, "xxxx")));
+                vsh_emit(program, vsh_op(VSH_OP_DP3, S, VSH_MASK_X, vsh_reg(N), vsh_reg(L)));
+                vsh_emit(program, vsh_op(VSH_OP_MAX, S, VSH_MASK_X, vsh_reg(S), zero));
+                vsh_emit(program, vsh_op(VSH_OP_MUL, S, VSH_MASK_X, vsh_reg(S), vsh_reg(ATT, "xxxx")));
+                vsh_emit(program, vsh_op(VSH_OP_MAD, COL, VSH_MASK_XYZ,
+                    vsh_const(base + VSH_FF_LIGHT_AMBIENT), vsh_reg(ATT, "xxxx"), vsh_reg(COL)));
+                vsh_emit(program, vsh_op(VSH_OP_MAD, COL, VSH_MASK_XYZ,
+                    vsh_const(base + VSH_FF_LIGHT_DIFFUSE), vsh_reg(S, "xxxx"), vsh_reg(COL)));
+                if (key.specular) {
+                    // Half vector between the light and a viewer looking down +z
+                    vsh_emit(program, vsh_op(VSH_OP_ADD, H, VSH_MASK_XYZ, vsh_reg(L), vsh_const(VSH_FF_CONSTANTS_ROW, "xxyx")));
+                    vsh_emit(program, vsh_op(VSH_OP_DP3, H, VSH_MASK_W, vsh_reg(H), vsh_reg(H)));
+                    vsh_emit(program, vsh_op(VSH_OP_RSQ, T, VSH_MASK_Y, vsh_reg(H, "wwww")));
+                    vsh_emit(program, vsh_op(VSH_OP_MUL, H, VSH_MASK_XYZ, vsh_reg(H), vsh_reg(T, "yyyy")));
+                    vsh_emit(program, vsh_op(VSH_OP_DP3, S, VSH_MASK_Y, vsh_reg(N), vsh_reg(H)));
+                    vsh_emit(program, vsh_op(VSH_OP_LIT, LT, VSH_MASK_XYZW, vsh_reg(S)));
+                    vsh_emit(program, vsh_op(VSH_OP_MUL, LT, VSH_MASK_Z, vsh_reg(LT), vsh_reg(ATT, "xxxx")));
+                    vsh_emit(program, vsh_op(VSH_OP_MAD, SPEC, VSH_MASK_XYZ,
+                        vsh_const(base + VSH_FF_LIGHT_SPECULAR), vsh_reg(LT, "zzzz"), vsh_reg(SPEC)));
+                }
+                break;
+            }
+        }
+
+        vsh_emit(program, vsh_op(VSH_OP_MOV, d0, VSH_MASK_XYZ, vsh_reg(COL)));
+        vsh_emit(program, vsh_op(VSH_OP_MOV, d0, VSH_MASK_W, vsh_in(NV2A_VERTEX_ATTR_DIFFUSE)));
+    }
+    else {
+        vsh_emit(program, vsh_op(VSH_OP_MOV, d0, VSH_MASK_XYZW, vsh_in(NV2A_VERTEX_ATTR_DIFFUSE)));
+    }
+    if (key.lighting && key.specular) {
+        vsh_emit(program, vsh_op(VSH_OP_MOV, d1, VSH_MASK_XYZ, vsh_reg(SPEC)));
+        vsh_emit(program, vsh_op(VSH_OP_MOV, d1, VSH_MASK_W, vsh_in(NV2A_VERTEX_ATTR_SPECULAR)));
+    }
+    else {
+        vsh_emit(program, vsh_op(VSH_OP_MOV, d1, VSH_MASK_XYZW, vsh_in(NV2A_VERTEX_ATTR_SPECULAR)));
+    }
+    vsh_emit(program, vsh_op(VSH_OP_MOV, VSH_SLOT_OUTPUT(VSH_OUT_B0), VSH_MASK_XYZW, vsh_reg(d0)));
+    vsh_emit(program, vsh_op(VSH_OP_MOV, VSH_SLOT_OUTPUT(VSH_OUT_B1), VSH_MASK_XYZW, vsh_reg(d1)));
+    vsh_emit(program, vsh_op(VSH_OP_MOV, VSH_SLOT_OUTPUT(VSH_OUT_FOG), VSH_MASK_XYZW, vsh_in(NV2A_VERTEX_ATTR_FOG)));
+    vsh_emit(program, vsh_op(VSH_OP_MOV, VSH_SLOT_OUTPUT(VSH_OUT_PTS), VSH_MASK_XYZW, vsh_in(NV2A_VERTEX_ATTR_POINT_SIZE)));
+
+    for (int tex = 0; tex < NV2A_MAX_TEXTURES; tex++) {
+        uint8_t out = VSH_SLOT_OUTPUT(VSH_OUT_T0 + tex);
+        if (key.textureMatrix[tex]) {
+            for (int i = 0; i < 4; i++) {
+                vsh_emit(program, vsh_op(VSH_OP_DP4, out, 1 << i,
+                    vsh_in(NV2A_VERTEX_ATTR_TEXTURE0 + tex), vsh_const(NV_IGRAPH_XF_XFCTX_T0MAT + tex * 8 + i)));
+            }
+        }
+        else {
+            vsh_emit(program, vsh_op(VSH_OP_MOV, out, VSH_MASK_XYZW, vsh_in(NV2A_VERTEX_ATTR_TEXTURE0 + tex)));
+        }
+    }
+
+    return program;
+}
+
+// ----- Engine ---------------------------------------------------------------
+
+VshEngine::VshEngine() {
+}
+
+VshEngine::~VshEngine() {
+    Flush();
+}
+
+void VshEngine::Flush() {
+    m_generation++;
+
+    for (auto& entry : m_programCache) {
+        delete entry.second;
+    }
+    m_programCache.clear();
+
+    for (auto& entry : m_fixedFunctionCache) {
+        delete entry.second;
+    }
+    m_fixedFunctionCache.clear();
+}
+
+VshProgram *VshEngine::Compile(const uint32_t (*tokens)[VSH_TOKEN_SIZE], unsigned int start) {
+    VshProgram *program = new VshProgram();
+
+    size_t length = vsh_program_length(tokens, start);
+    program->tokens.assign(&tokens[start][0], &tokens[start][0] + length * VSH_TOKEN_SIZE);
+
+    for (size_t i = 0; i < length; i++) {
+        vsh_decode_instruction(program, tokens[start + i]);
+    }
+
+    log_debug("VSH: Compiled vertex program at slot %u: %zu instructions, %zu micro-ops\n",
+        start, length, program->ops.size());
+
+    return program;
+}
+
+const VshProgram *VshEngine::GetProgram(const uint32_t (*tokens)[VSH_TOKEN_SIZE], unsigned int start) {
+    assert(start < NV2A_MAX_TRANSFORM_PROGRAM_LENGTH);
+
+    size_t length = vsh_program_length(tokens, start);
+    uint64_t hash = vsh_hash_tokens(&tokens[start][0], length * VSH_TOKEN_SIZE);
+
+    auto it = m_programCache.find(hash);
+    if (it != m_programCache.end()) {
+        VshProgram *program = it->second;
+        if (program->tokens.size() == length * VSH_TOKEN_SIZE
+            && memcmp(program->tokens.data(), &tokens[start][0], length * VSH_TOKEN_SIZE * sizeof(uint32_t)) == 0) {
+            m_cacheHits++;
+            return program;
+        }
+
+        // Hash collision; replace the old program
+        m_generation++;
+        delete program;
+        m_programCache.erase(it);
+    }
+
+    m_cacheMisses++;
+    if (m_programCache.size() >= VSH_MAX_CACHED_PROGRAMS) {
+        log_debug("VSH: Program cache full, flushing\n");
+        m_generation++;
+        for (auto& entry : m_programCache) {
+            delete entry.second;
+        }
+        m_programCache.clear();
+    }
+
+    VshProgram *program = Compile(tokens, start);
+    m_programCache[hash] = program;
+    return program;
+}
+
+const VshProgram *VshEngine::GetFixedFunctionProgram(const VshFixedFunctionKey& key) {
+    uint32_t packed = key.Pack();
+
+    auto it = m_fixedFunctionCache.find(packed);
+    if (it != m_fixedFunctionCache.end()) {
+        m_cacheHits++;
+        return it->second;
+    }
+
+    m_cacheMisses++;
+    VshProgram *program = GenerateFixedFunction(key);
+    m_fixedFunctionCache[packed] = program;
+    return program;
+}
+
+void VshEngine::Run(const VshProgram *program, float (*constants)[4], bool constantWrites,
+    const VshVertexInput *input, VshVertexOutput *output, unsigned int count)
+{
+    VshBatchState st;
+    st.constants = constants;
+    st.constantWrites = constantWrites && program->writesConstants;
+
+    // The hardware processes vertices in order, so a vertex sees the
+    // constants written by the ones before it. Programs that write c[]
+    // therefore run one vertex per batch.
+    unsigned int batchSize = st.constantWrites ? 1 : VSH_BATCH_SIZE;
+
+    alignas(sizeof(VshLane)) float lanes[4][VSH_BATCH_SIZE];
+
+    for (unsigned int base = 0; base < count; base += batchSize) {
+        st.lanes = (count - base < batchSize) ? count - base : batchSize;
+
+        // Transpose the attributes read by the program into SoA form. Unused
+        // lanes of a partial batch repeat the last vertex.
+        for (int attr = 0; attr < NV2A_VERTEXSHADER_ATTRIBUTES; attr++) {
+            if (!(program->inputMask & (1 << attr))) {
+                continue;
+            }
+            for (unsigned int lane = 0; lane < VSH_BATCH_SIZE; lane++) {
+                const float *v = input[base + ((lane < st.lanes) ? lane : st.lanes - 1)].v[attr];
+                for (int i = 0; i < 4; i++) {
+                    lanes[i][lane] = v[i];
+                }
+            }
+            for (int i = 0; i < 4; i++) {
+                st.in[attr][i] = vsh_load(lanes[i]);
+            }
+        }
+
+        const VshLane zero = vsh_set1(0.0f);
+        const VshLane one = vsh_set1(1.0f);
+        for (int slot = 0; slot < VSH_NUM_SLOTS; slot++) {
+            bool isOutput = slot >= VSH_SLOT_OUTPUT(0) && slot < VSH_SLOT_SCRATCH;
+            st.regs[slot][0] = st.regs[slot][1] = st.regs[slot][2] = zero;
+            st.regs[slot][3] = isOutput ? one : zero;
+        }
+        memset(st.a0, 0, sizeof(st.a0));
+
+        vsh_execute(program, st);
+
+        for (int reg = 0; reg < VSH_OUTPUT_REGISTERS; reg++) {
+            for (int i = 0; i < 4; i++) {
+                vsh_store(lanes[i], st.regs[VSH_SLOT_OUTPUT(reg)][i]);
+            }
+            for (unsigned int lane = 0; lane < st.lanes; lane++) {
+                float *o = output[base + lane].o[reg];
+                for (int i = 0; i < 4; i++) {
+                    o[i] = lanes[i][lane];
+                }
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,237 @@
+/*
+ * Portions of the code are based on XQEMU's NV2A vertex shader translator.
+ * The original copyright header is included below.
+ */
+/*
+ * QEMU Geforce NV2A vertex shader translation
+ *
+ * Copyright (c) 2014 Jannik Vogel
+ * Copyright (c) 2012 espes
+ *
+ * Based on:
+ * Cxbx, VertexShader.cpp
+ * Copyright (c) 2004 Aaron Robinson <caustik@caustik.com>
+ *                    Kingofc <kingofc@freenet.de>
+ * Dxbx, uPushBuffer.pas
+ * Copyright (c) 2007 Shadow_tj, PatrickvL
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 or
+ * (at your option) version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#else
+#include <emmintrin.h>
+#endif
+
+#include "nv2a_int.h"
+
+namespace openxbox {
+
+// Number of vertices the vertex program engine processes in lockstep.
+// Each register component is stored as one SIMD lane per vertex (SoA).
+#if defined(__AVX__)
+#define VSH_BATCH_SIZE 8
+typedef __m256 VshLane;
+#else
+#define VSH_BATCH_SIZE 4
+typedef __m128 VshLane;
+#endif
+
+#define VSH_TEMP_REGISTERS    12
+#define VSH_OUTPUT_REGISTERS  13
+
+// Output register indices
+#define VSH_OUT_POS   0
+#define VSH_OUT_D0    3
+#define VSH_OUT_D1    4
+#define VSH_OUT_FOG   5
+#define VSH_OUT_PTS   6
+#define VSH_OUT_B0    7
+#define VSH_OUT_B1    8
+#define VSH_OUT_T0    9
+
+// Register slots addressed by micro-ops. Temporaries and outputs share one
+// register space so that R12 naturally aliases oPos, as it does in hardware.
+#define VSH_SLOT_TEMP(n)    (n)
+#define VSH_SLOT_OUTPUT(n)  (VSH_TEMP_REGISTERS + (n))
+#define VSH_SLOT_SCRATCH    (VSH_TEMP_REGISTERS + VSH_OUTPUT_REGISTERS)
+#define VSH_NUM_SLOTS       (VSH_SLOT_SCRATCH + 1)
+
+// Write masks used by micro-ops (bit n = component n)
+#define VSH_MASK_X     0x1
+#define VSH_MASK_Y     0x2
+#define VSH_MASK_Z     0x4
+#define VSH_MASK_W     0x8
+#define VSH_MASK_XYZ   0x7
+#define VSH_MASK_XYZW  0xF
+
+// Constant bank layout used by the fixed function programs. Rows below
+// NV_IGRAPH_XF_XFCTX_PRSPACE hold the transform context as loaded by the
+// Kelvin methods; the rows above are private to the generated programs.
+#define VSH_FF_CONSTANTS_ROW       0x60 // (0.0, 1.0, 0.0, specular power)
+#define VSH_FF_SCENE_AMBIENT_ROW   0x61
+#define VSH_FF_LIGHT_BASE_ROW      0x62
+#define VSH_FF_LIGHT_ROWS          7
+#define VSH_FF_LIGHT_DIRECTION     0
+#define VSH_FF_LIGHT_POSITION      1
+#define VSH_FF_LIGHT_AMBIENT       2
+#define VSH_FF_LIGHT_DIFFUSE       3
+#define VSH_FF_LIGHT_ATTENUATION   4
+#define VSH_FF_LIGHT_SPECULAR      5
+#define VSH_FF_LIGHT_HALF_VECTOR   6
+
+// Exponent of the fixed function specular highlight. The guest supplies the
+// material power as curve fit coefficients (NV097_SET_SPECULAR_PARAMS) that
+// are not decoded yet, so every material uses this power.
+#define VSH_FF_SPECULAR_POWER      16.0f
+
+enum VshOp : uint8_t {
+    VSH_OP_NOP,
+
+    // MAC unit
+    VSH_OP_MOV,
+    VSH_OP_MUL,
+    VSH_OP_ADD,
+    VSH_OP_MAD,
+    VSH_OP_DP3,
+    VSH_OP_DPH,
+    VSH_OP_DP4,
+    VSH_OP_DST,
+    VSH_OP_MIN,
+    VSH_OP_MAX,
+    VSH_OP_SLT,
+    VSH_OP_SGE,
+    VSH_OP_ARL,
+
+    // ILU unit
+    VSH_OP_RCP,
+    VSH_OP_RCC,
+    VSH_OP_RSQ,
+    VSH_OP_EXP,
+    VSH_OP_LOG,
+    VSH_OP_LIT,
+};
+
+enum VshRegisterFile : uint8_t {
+    VSH_FILE_REG,        // temporary or output register slot
+    VSH_FILE_INPUT,      // vertex attribute
+    VSH_FILE_CONST,      // constant register
+    VSH_FILE_CONST_REL,  // constant register indexed by A0.x
+};
+
+struct VshSource {
+    uint8_t file = VSH_FILE_REG;
+    uint8_t index = 0;
+    uint8_t swizzle[4] = { 0, 1, 2, 3 };
+    bool negate = false;
+};
+
+/*!
+ * A single operation of a compiled vertex program. Each NV2A instruction
+ * expands into one to three micro-ops depending on which units it uses.
+ */
+struct VshMicroOp {
+    uint8_t op = VSH_OP_NOP;
+    uint8_t numSources = 0;
+    VshSource src[3];
+
+    // Destination register slots; a zero mask means no write
+    uint8_t dst[2] = { 0, 0 };
+    uint8_t mask[2] = { 0, 0 };
+
+    // Destination constant register for context writes
+    uint8_t constDst = 0;
+    uint8_t constMask = 0;
+};
+
+/*!
+ * A vertex program compiled into a flat list of micro-ops.
+ */
+struct VshProgram {
+    std::vector<uint32_t> tokens;    // source tokens, used to resolve hash collisions
+    std::vector<VshMicroOp> ops;
+    uint16_t inputMask = 0;          // vertex attributes read by the program
+    bool writesConstants = false;
+};
+
+/*!
+ * Fixed function transform and lighting state that selects a generated
+ * program. Changes to any of these fields require a different program.
+ */
+struct VshFixedFunctionKey {
+    bool lighting = false;
+    bool normalize = false;
+    bool specular = false;
+    uint8_t lightModes[NV2A_MAX_LIGHTS] = { 0 };  // NV_PGRAPH_CSV0_D_LIGHT0_*
+    bool textureMatrix[NV2A_MAX_TEXTURES] = { false };
+
+    uint32_t Pack() const;
+};
+
+struct VshVertexInput {
+    float v[NV2A_VERTEXSHADER_ATTRIBUTES][4];
+};
+
+struct VshVertexOutput {
+    float o[VSH_OUTPUT_REGISTERS][4];
+};
+
+/*!
+ * Executes NV2A vertex programs over batches of vertices.
+ *
+ * Programs are decoded once into micro-op lists and cached by a hash of
+ * their tokens. The fixed function pipeline is implemented as generated
+ * micro-op programs that run on the same interpreter.
+ */
+class VshEngine {
+public:
+    VshEngine();
+    ~VshEngine();
+
+    const VshProgram *GetProgram(const uint32_t (*tokens)[VSH_TOKEN_SIZE], unsigned int start);
+    const VshProgram *GetFixedFunctionProgram(const VshFixedFunctionKey& key);
+
+    // Runs the program over count vertices. When constantWrites is true,
+    // writes to c[] are stored back into the constants array.
+    void Run(const VshProgram *program, float (*constants)[4], bool constantWrites,
+        const VshVertexInput *input, VshVertexOutput *output, unsigned int count);
+
+    void Flush();
+
+    uint64_t GetCacheHits() const { return m_cacheHits; }
+    uint64_t GetCacheMisses() const { return m_cacheMisses; }
+
+    // Changes whenever compiled programs are deleted. Callers that hold on
+    // to a program must look it up again when the generation changes.
+    uint64_t GetGeneration() const { return m_generation; }
+
+private:
+    VshProgram *Compile(const uint32_t (*tokens)[VSH_TOKEN_SIZE], unsigned int start);
+    VshProgram *GenerateFixedFunction(const VshFixedFunctionKey& key);
+
+    std::unordered_map<uint64_t, VshProgram *> m_programCache;
+    std::unordered_map<uint32_t, VshProgram *> m_fixedFunctionCache;
+
+    uint64_t m_cacheHits = 0;
+    uint64_t m_cacheMisses = 0;
+    uint64_t m_generation = 0;
+};
+
+}
@@ -1,15 +1,62 @@
 #include "ac97.h"
 #include "openxbox/log.h"
+#include "openxbox/thread.h"
+
+#include <algorithm>
+#include <cstring>
 
 namespace openxbox {
 
-AC97Device::AC97Device(uint16_t vendorID, uint16_t deviceID, uint8_t revisionID)
+// How far an engine may fall behind before it skips ahead
+#define AC97_MAX_LATE   std::chrono::milliseconds(100)
+
+static const uint32_t kEngineBases[AC97_ENGINE_COUNT] = { AC97_PI, AC97_PO, AC97_SO };
+static const char *kEngineNames[AC97_ENGINE_COUNT] = { "PCM in", "PCM out", "SPDIF out" };
+
+// Indices of the engines in m_engines
+#define AC97_ENGINE_PI  0
+#define AC97_ENGINE_PO  1
+#define AC97_ENGINE_SO  2
+
+AC97Device::AC97Device(uint16_t vendorID, uint16_t deviceID, uint8_t revisionID, uint8_t *ram, uint32_t ramSize, IRQHandler *irqHandler)
     : PCIDevice(PCI_HEADER_TYPE_NORMAL, vendorID, deviceID, revisionID,
         0x0f, 0x02, 0x00) // Audio controller
+    , m_ram(ram)
+    , m_ramSize(ramSize)
+    , m_irqHandler(irqHandler)
+    , m_globCnt(0)
 {
+    ResetMixer();
+    for (int i = 0; i < AC97_ENGINE_COUNT; i++) {
+        m_engines[i].name = kEngineNames[i];
+        ResetEngine(m_engines[i]);
+    }
 }
 
 AC97Device::~AC97Device() {
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_running = false;
+        m_cond.notify_all();
+    }
+    if (m_dmaThread.joinable()) {
+        m_dmaThread.join();
+    }
+    SetAudioSink(nullptr);
+}
+
+bool AC97Device::SetAudioSink(hw::audio::AudioSink *sink) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (m_sink != nullptr) {
+        m_sink->Stop();
+    }
+
+    m_sink = sink;
+    if (m_sink != nullptr && !m_sink->Start(AC97_SAMPLE_RATE, 2)) {
+        m_sink = nullptr;
+        return false;
+    }
+    return true;
 }
 
 // PCI Device functions
@@ -18,25 +65,463 @@ void AC97Device::Init() {
 	RegisterBAR(0, 0x100, PCI_BAR_TYPE_IO); // 0xD000 - 0xD0FF
 	RegisterBAR(1, 0x80, PCI_BAR_TYPE_IO); // 0xD200 - 0xD27F
 	RegisterBAR(2, 0x1000, PCI_BAR_TYPE_MEMORY); // 0xFEC00000 - 0xFEC00FFF
+
+    Write8(m_configSpace, PCI_INTERRUPT_PIN, 1);
+
+    m_running = true;
+    m_dmaThread = std::thread(DMAThread, this);
 }
 
 void AC97Device::Reset() {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    ResetMixer();
+    for (int i = 0; i < AC97_ENGINE_COUNT; i++) {
+        ResetEngine(m_engines[i]);
+    }
+    m_globCnt = 0;
+    UpdateIRQ();
+    m_cond.notify_all();
 }
 
 void AC97Device::PCIIORead(int barIndex, uint32_t port, uint32_t *value, uint8_t size) {
-    log_spew("AC97Device::PCIIORead:   Unimplemented!  bar = %d,  port = 0x%x,  size = %u\n", barIndex, port, size);
+    switch (barIndex) {
+    case 0: NAMRead(port, value, size); break;
+    case 1: NABMRead(port, value, size); break;
+    default:
+        log_spew("AC97Device::PCIIORead:   Unimplemented!  bar = %d,  port = 0x%x,  size = %u\n", barIndex, port, size);
+        *value = 0;
+        break;
+    }
 }
 
 void AC97Device::PCIIOWrite(int barIndex, uint32_t port, uint32_t value, uint8_t size) {
-    log_spew("AC97Device::PCIIOWrite:  Unimplemented!  bar = %d,  port = 0x%x,  value = 0x%x,  size = %u\n", barIndex, port, value, size);
+    switch (barIndex) {
+    case 0: NAMWrite(port, value, size); break;
+    case 1: NABMWrite(port, value, size); break;
+    default:
+        log_spew("AC97Device::PCIIOWrite:  Unimplemented!  bar = %d,  port = 0x%x,  value = 0x%x,  size = %u\n", barIndex, port, value, size);
+        break;
+    }
 }
 
 void AC97Device::PCIMMIORead(int barIndex, uint32_t addr, uint32_t *value, uint8_t size) {
-    log_spew("AC97Device::PCIMMIORead:   Unimplemented!  bar = %d,  address = 0x%x,  size = %u\n", barIndex, addr, size);
+    // The memory mapped BAR holds the mixer registers followed by the bus
+    // master registers
+    if (barIndex == 2 && addr < AC97_NAM_SIZE) {
+        NAMRead(addr, value, size);
+    }
+    else if (barIndex == 2 && addr >= AC97_MMIO_NABM && addr < AC97_MMIO_NABM + AC97_NABM_SIZE) {
+        NABMRead(addr - AC97_MMIO_NABM, value, size);
+    }
+    else {
+        log_spew("AC97Device::PCIMMIORead:   Unimplemented!  bar = %d,  address = 0x%x,  size = %u\n", barIndex, addr, size);
+        *value = 0;
+    }
 }
 
 void AC97Device::PCIMMIOWrite(int barIndex, uint32_t addr, uint32_t value, uint8_t size) {
-    log_spew("AC97Device::PCIMMIOWrite:  Unimplemented!  bar = %d,  address = 0x%x,  value = 0x%x,  size = %u\n", barIndex, addr, value, size);
+    if (barIndex == 2 && addr < AC97_NAM_SIZE) {
+        NAMWrite(addr, value, size);
+    }
+    else if (barIndex == 2 && addr >= AC97_MMIO_NABM && addr < AC97_MMIO_NABM + AC97_NABM_SIZE) {
+        NABMWrite(addr - AC97_MMIO_NABM, value, size);
+    }
+    else {
+        log_spew("AC97Device::PCIMMIOWrite:  Unimplemented!  bar = %d,  address = 0x%x,  value = 0x%x,  size = %u\n", barIndex, addr, value, size);
+    }
+}
+
+// Mixer
+
+// Must be called with m_mutex held
+void AC97Device::ResetMixer() {
+    memset(m_mixer, 0, sizeof(m_mixer));
+    m_mixer[AC97_MASTER_VOLUME / 2] = 0x8000;
+    m_mixer[AC97_AUX_OUT_VOLUME / 2] = 0x8000;
+    m_mixer[AC97_MONO_VOLUME / 2] = 0x8000;
+    m_mixer[AC97_PHONE_VOLUME / 2] = 0x8008;
+    m_mixer[AC97_MIC_VOLUME / 2] = 0x8008;
+    m_mixer[AC97_LINE_IN_VOLUME / 2] = 0x8808;
+    m_mixer[AC97_CD_VOLUME / 2] = 0x8808;
+    m_mixer[AC97_VIDEO_VOLUME / 2] = 0x8808;
+    m_mixer[AC97_AUX_IN_VOLUME / 2] = 0x8808;
+    m_mixer[AC97_PCM_OUT_VOLUME / 2] = 0x8808;
+    m_mixer[AC97_RECORD_GAIN / 2] = 0x8000;
+    m_mixer[AC97_POWERDOWN_CTRL / 2] = AC97_POWERDOWN_CTRL_READY;
+    m_mixer[AC97_PCM_FRONT_DAC_RATE / 2] = AC97_SAMPLE_RATE;
+    m_mixer[AC97_PCM_LR_ADC_RATE / 2] = AC97_SAMPLE_RATE;
+}
+
+// Must be called with m_mutex held
+uint16_t AC97Device::ReadMixer(uint32_t offset) {
+    return m_mixer[(offset % AC97_NAM_SIZE) / 2];
+}
+
+// Must be called with m_mutex held
+void AC97Device::WriteMixer(uint32_t offset, uint16_t value) {
+    offset %= AC97_NAM_SIZE;
+    switch (offset) {
+    case AC97_RESET:
+        ResetMixer();
+        break;
+    case AC97_POWERDOWN_CTRL:
+        // The subsections are always ready
+        m_mixer[offset / 2] = (value & ~AC97_POWERDOWN_CTRL_READY) | AC97_POWERDOWN_CTRL_READY;
+        break;
+    case AC97_EXTENDED_AUDIO_ID:
+        break;
+    case AC97_PCM_FRONT_DAC_RATE:
+    case AC97_PCM_LR_ADC_RATE:
+        if (value != AC97_SAMPLE_RATE) {
+            log_debug("AC97Device: Variable rate audio is not supported; ignoring sample rate %u\n", value);
+        }
+        break;
+    default:
+        m_mixer[offset / 2] = value;
+        break;
+    }
+}
+
+void AC97Device::NAMRead(uint32_t offset, uint32_t *value, uint8_t size) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    switch (size) {
+    case 1: *value = (ReadMixer(offset & ~1) >> ((offset & 1) * 8)) & 0xFF; break;
+    case 2: *value = ReadMixer(offset); break;
+    case 4: *value = ReadMixer(offset) | ((uint32_t)ReadMixer(offset + 2) << 16); break;
+    default: *value = 0; break;
+    }
+}
+
+void AC97Device::NAMWrite(uint32_t offset, uint32_t value, uint8_t size) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    switch (size) {
+    case 1: {
+        uint32_t shift = (offset & 1) * 8;
+        uint16_t reg = ReadMixer(offset & ~1);
+        WriteMixer(offset & ~1, (reg & ~(0xFF << shift)) | ((value & 0xFF) << shift));
+        break;
+    }
+    case 2:
+        WriteMixer(offset, value);
+        break;
+    case 4:
+        WriteMixer(offset, value);
+        WriteMixer(offset + 2, value >> 16);
+        break;
+    }
+}
+
+// Bus master
+
+// Must be called with m_mutex held
+void AC97Device::ResetEngine(Engine& engine) {
+    engine.bdbar = 0;
+    engine.civ = 0;
+    engine.lvi = 0;
+    engine.sr = AC97_SR_DCH;
+    engine.piv = 0;
+    engine.cr = 0;
+    engine.length = 0;
+    engine.flags = 0;
+    engine.remaining = Clock::duration::zero();
+    engine.inFlight = false;
+}
+
+AC97Device::Engine *AC97Device::GetEngine(uint32_t offset) {
+    for (int i = 0; i < AC97_ENGINE_COUNT; i++) {
+        if ((offset & ~(AC97_ENGINE_REGS - 1)) == kEngineBases[i]) {
+            return &m_engines[i];
+        }
+    }
+    return nullptr;
+}
+
+// Returns the status bits of the engine that are raising an interrupt
+uint32_t AC97Device::EngineInterrupts(const Engine& engine) const {
+    uint32_t enabled = 0;
+    if (engine.cr & AC97_CR_IOCE) enabled |= AC97_SR_BCIS;
+    if (engine.cr & AC97_CR_LVBIE) enabled |= AC97_SR_LVBCI;
+    if (engine.cr & AC97_CR_FEIE) enabled |= AC97_SR_FIFOE;
+    return engine.sr & enabled;
+}
+
+bool AC97Device::IsRunning(const Engine& engine) const {
+    return (engine.cr & AC97_CR_RPBM) && !(engine.sr & AC97_SR_DCH);
+}
+
+// Must be called with m_mutex held
+void AC97Device::StartEngine(Engine& engine, Clock::time_point now) {
+    if (engine.inFlight) {
+        // Resume the buffer that was playing when the engine was paused
+        engine.sr &= ~AC97_SR_DCH;
+        engine.due = now + engine.remaining;
+    }
+    else if (!(engine.sr & AC97_SR_CELV)) {
+        engine.sr &= ~AC97_SR_DCH;
+        FetchBuffer(engine, now);
+    }
+    m_cond.notify_all();
+}
+
+// Must be called with m_mutex held
+void AC97Device::PauseEngine(Engine& engine, Clock::time_point now) {
+    if (engine.inFlight) {
+        engine.remaining = (engine.due > now) ? engine.due - now : Clock::duration::zero();
+    }
+    engine.sr |= AC97_SR_DCH;
+}
+
+// Transfers the whole buffer the engine is pointing to and schedules its
+// completion. Must be called with m_mutex held.
+void AC97Device::FetchBuffer(Engine& engine, Clock::time_point start) {
+    uint32_t bd = engine.bdbar + engine.civ * 8;
+    uint32_t address = 0;
+    engine.length = 0;
+    engine.flags = 0;
+    if (bd + 8 <= m_ramSize) {
+        memcpy(&address, &m_ram[bd], sizeof(address));
+        memcpy(&engine.length, &m_ram[bd + 4], sizeof(engine.length));
+        memcpy(&engine.flags, &m_ram[bd + 6], sizeof(engine.flags));
+    }
+    else {
+        log_debug("AC97Device: %s buffer descriptor %u at 0x%x is outside of RAM\n", engine.name, engine.civ, bd);
+    }
+
+    // Samples are 16-bit and come in stereo pairs
+    address &= ~1;
+    uint32_t samples = engine.length & ~1;
+    if (address >= m_ramSize || samples * 2 > m_ramSize - address) {
+        log_debug("AC97Device: %s buffer at 0x%x with %u samples is outside of RAM\n", engine.name, address, samples);
+        samples = 0;
+    }
+
+    if (samples > 0) {
+        if (&engine == &m_engines[AC97_ENGINE_PO]) {
+            if (m_sink != nullptr) {
+                m_sink->Write(reinterpret_cast<int16_t *>(&m_ram[address]), samples / 2);
+            }
+        }
+        else if (&engine == &m_engines[AC97_ENGINE_PI]) {
+            // There is no audio input; record silence
+            memset(&m_ram[address], 0, samples * 2);
+        }
+    }
+
+    engine.piv = (engine.civ + 1) % AC97_BDL_ENTRIES;
+    engine.due = start + std::chrono::nanoseconds((uint64_t)engine.length / 2 * 1000000000ull / AC97_SAMPLE_RATE);
+    engine.inFlight = true;
+}
+
+// Must be called with m_mutex held
+void AC97Device::CompleteBuffer(Engine& engine) {
+    engine.inFlight = false;
+    if (engine.flags & AC97_BD_IOC) {
+        engine.sr |= AC97_SR_BCIS;
+    }
+
+    if (engine.civ == engine.lvi) {
+        engine.sr |= AC97_SR_DCH | AC97_SR_CELV | AC97_SR_LVBCI;
+        return;
+    }
+
+    // The next buffer starts when this one ends so that timing errors don't
+    // accumulate
+    engine.civ = engine.piv;
+    FetchBuffer(engine, engine.due);
+}
+
+// Must be called with m_mutex held
+void AC97Device::RunEngine(Engine& engine, Clock::time_point now) {
+    while (IsRunning(engine) && engine.inFlight && engine.due <= now) {
+        if (now - engine.due > AC97_MAX_LATE) {
+            log_debug("AC97Device: %s engine fell behind; skipping ahead\n", engine.name);
+            engine.due = now;
+        }
+        CompleteBuffer(engine);
+    }
+}
+
+// Returns the number of samples left to transfer in the current buffer
+uint16_t AC97Device::GetPosition(const Engine& engine, Clock::time_point now) const {
+    if (!engine.inFlight) {
+        return 0;
+    }
+
+    Clock::duration left;
+    if (IsRunning(engine)) {
+        left = (engine.due > now) ? engine.due - now : Clock::duration::zero();
+    }
+    else {
+        left = engine.remaining;
+    }
+    uint64_t samples = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count() * AC97_SAMPLE_RATE / 1000000000ull * 2;
+    return (uint16_t)std::min<uint64_t>(samples, engine.length & ~1);
+}
+
+// Must be called with m_mutex held
+void AC97Device::UpdateIRQ() {
+    bool level = false;
+    for (int i = 0; i < AC97_ENGINE_COUNT; i++) {
+        if (EngineInterrupts(m_engines[i])) {
+            level = true;
+        }
+    }
+    if (level != m_irqLevel) {
+        m_irqLevel = level;
+        m_irqHandler->HandleIRQ(AC97_IRQ, level);
+    }
+}
+
+// Must be called with m_mutex held
+uint8_t AC97Device::ReadBusMaster(uint32_t offset, Clock::time_point now) {
+    if (offset >= AC97_GLOB_CNT && offset < AC97_GLOB_CNT + 4) {
+        return m_globCnt >> ((offset - AC97_GLOB_CNT) * 8);
+    }
+    if (offset >= AC97_GLOB_STA && offset < AC97_GLOB_STA + 4) {
+        uint32_t sta = AC97_GLOB_STA_PCR;
+        if (EngineInterrupts(m_engines[AC97_ENGINE_PI])) sta |= AC97_GLOB_STA_PIINT;
+        if (EngineInterrupts(m_engines[AC97_ENGINE_PO])) sta |= AC97_GLOB_STA_POINT;
+        if (EngineInterrupts(m_engines[AC97_ENGINE_SO])) sta |= AC97_GLOB_STA_SOINT;
+        return sta >> ((offset - AC97_GLOB_STA) * 8);
+    }
+
+    Engine *engine = GetEngine(offset);
+    if (engine == nullptr) {
+        // The codec access semaphore is always free and the microphone
+        // engine is not present
+        return 0;
+    }
+
+    uint32_t reg = offset & (AC97_ENGINE_REGS - 1);
+    switch (reg) {
+    case AC97_BDBAR: case AC97_BDBAR + 1: case AC97_BDBAR + 2: case AC97_BDBAR + 3:
+        return engine->bdbar >> ((reg - AC97_BDBAR) * 8);
+    case AC97_CIV: return engine->civ;
+    case AC97_LVI: return engine->lvi;
+    case AC97_SR: return engine->sr & 0xFF;
+    case AC97_SR + 1: return engine->sr >> 8;
+    case AC97_PICB: return GetPosition(*engine, now) & 0xFF;
+    case AC97_PICB + 1: return GetPosition(*engine, now) >> 8;
+    case AC97_PIV: return engine->piv;
+    case AC97_CR: return engine->cr;
+    default: return 0;
+    }
+}
+
+// Must be called with m_mutex held
+void AC97Device::WriteBusMaster(uint32_t offset, uint8_t value, Clock::time_point now) {
+    if (offset >= AC97_GLOB_CNT && offset < AC97_GLOB_CNT + 4) {
+        uint32_t shift = (offset - AC97_GLOB_CNT) * 8;
+        m_globCnt = (m_globCnt & ~(0xFFu << shift)) | ((uint32_t)value << shift);
+        if (shift == 0 && !(value & AC97_GLOB_CNT_COLD)) {
+            // Cold reset
+            ResetMixer();
+            for (int i = 0; i < AC97_ENGINE_COUNT; i++) {
+                ResetEngine(m_engines[i]);
+            }
+            UpdateIRQ();
+        }
+        return;
+    }
+
+    Engine *engine = GetEngine(offset);
+    if (engine == nullptr) {
+        return;
+    }
+
+    uint32_t reg = offset & (AC97_ENGINE_REGS - 1);
+    switch (reg) {
+    case AC97_BDBAR: case AC97_BDBAR + 1: case AC97_BDBAR + 2: case AC97_BDBAR + 3: {
+        uint32_t shift = (reg - AC97_BDBAR) * 8;
+        engine->bdbar = ((engine->bdbar & ~(0xFFu << shift)) | ((uint32_t)value << shift)) & ~7;
+        break;
+    }
+    case AC97_LVI:
+        engine->lvi = value % AC97_BDL_ENTRIES;
+        if ((engine->cr & AC97_CR_RPBM) && (engine->sr & AC97_SR_CELV) && !engine->inFlight && engine->lvi != engine->civ) {
+            // The driver queued more buffers after the engine ran dry
+            engine->sr &= ~(AC97_SR_DCH | AC97_SR_CELV);
+            engine->civ = engine->piv;
+            FetchBuffer(*engine, now);
+            m_cond.notify_all();
+        }
+        break;
+    case AC97_SR:
+        engine->sr &= ~(value & AC97_SR_WCLEAR);
+        UpdateIRQ();
+        break;
+    case AC97_CR:
+        if (value & AC97_CR_RR) {
+            ResetEngine(*engine);
+        }
+        else {
+            uint8_t old = engine->cr;
+            engine->cr = value & (AC97_CR_RPBM | AC97_CR_LVBIE | AC97_CR_FEIE | AC97_CR_IOCE);
+            if (!(old & AC97_CR_RPBM) && (engine->cr & AC97_CR_RPBM)) {
+                StartEngine(*engine, now);
+            }
+            else if ((old & AC97_CR_RPBM) && !(engine->cr & AC97_CR_RPBM)) {
+                PauseEngine(*engine, now);
+            }
+        }
+        UpdateIRQ();
+        break;
+    default:
+        break;
+    }
+}
+
+void AC97Device::NABMRead(uint32_t offset, uint32_t *value, uint8_t size) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    auto now = Clock::now();
+    RunEngines(now);
+    *value = 0;
+    for (uint8_t i = 0; i < size; i++) {
+        *value |= (uint32_t)ReadBusMaster((offset + i) % AC97_NABM_SIZE, now) << (i * 8);
+    }
+}
+
+void AC97Device::NABMWrite(uint32_t offset, uint32_t value, uint8_t size) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    auto now = Clock::now();
+    RunEngines(now);
+    for (uint8_t i = 0; i < size; i++) {
+        WriteBusMaster((offset + i) % AC97_NABM_SIZE, value >> (i * 8), now);
+    }
+}
+
+// Must be called with m_mutex held
+void AC97Device::RunEngines(Clock::time_point now) {
+    for (int i = 0; i < AC97_ENGINE_COUNT; i++) {
+        RunEngine(m_engines[i], now);
+    }
+    UpdateIRQ();
+}
+
+void AC97Device::DMAThread(AC97Device *ac97) {
+    Thread_SetName("[HW] AC97");
+
+    std::unique_lock<std::mutex> lk(ac97->m_mutex);
+    while (ac97->m_running) {
+        ac97->RunEngines(Clock::now());
+
+        // Sleep until the next buffer completes or the registers change
+        bool running = false;
+        Clock::time_point next = Clock::time_point::max();
+        for (int i = 0; i < AC97_ENGINE_COUNT; i++) {
+            const Engine& engine = ac97->m_engines[i];
+            if (ac97->IsRunning(engine) && engine.inFlight) {
+                running = true;
+                next = std::min(next, engine.due);
+            }
+        }
+        if (running) {
+            ac97->m_cond.wait_until(lk, next);
+        }
+        else {
+            ac97->m_cond.wait(lk);
+        }
+    }
 }
 
 }
@@ -1,16 +1,122 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <mutex>
+#include <thread>
 
 #include "../defs.h"
 #include "pci.h"
+#include "../basic/irq.h"
+#include "../audio/sink.h"
 
 namespace openxbox {
 
+// Interrupt line the controller is wired to
+#define AC97_IRQ    6
+
+// The codec runs at a fixed 48 kHz; variable rate audio is not supported
+#define AC97_SAMPLE_RATE    48000
+
+// Native audio mixer (NAM) registers
+#define AC97_NAM_SIZE           0x100
+#define AC97_RESET              0x00
+#define AC97_MASTER_VOLUME      0x02
+#define AC97_AUX_OUT_VOLUME     0x04
+#define AC97_MONO_VOLUME        0x06
+#define AC97_PC_BEEP_VOLUME     0x0A
+#define AC97_PHONE_VOLUME       0x0C
+#define AC97_MIC_VOLUME         0x0E
+#define AC97_LINE_IN_VOLUME     0x10
+#define AC97_CD_VOLUME          0x12
+#define AC97_VIDEO_VOLUME       0x14
+#define AC97_AUX_IN_VOLUME      0x16
+#define AC97_PCM_OUT_VOLUME     0x18
+#define AC97_RECORD_SELECT      0x1A
+#define AC97_RECORD_GAIN        0x1C
+#define AC97_GENERAL_PURPOSE    0x20
+#define AC97_POWERDOWN_CTRL     0x26
+#   define AC97_POWERDOWN_CTRL_READY    0x000F
+#define AC97_EXTENDED_AUDIO_ID  0x28
+#define AC97_EXTENDED_AUDIO_CTRL 0x2A
+#define AC97_PCM_FRONT_DAC_RATE 0x2C
+#define AC97_PCM_LR_ADC_RATE    0x32
+
+// Native audio bus master (NABM) registers
+#define AC97_NABM_SIZE          0x80
+
+// Bus master engines
+#define AC97_PI                 0x00    // PCM in
+#define AC97_PO                 0x10    // PCM out
+#define AC97_MC                 0x20    // microphone in, not present
+#define AC97_SO                 0x70    // SPDIF out
+#define AC97_ENGINE_COUNT       3
+
+// Registers of each engine, relative to its base
+#define AC97_BDBAR              0x00    // buffer descriptor list base address
+#define AC97_CIV                0x04    // current index value
+#define AC97_LVI                0x05    // last valid index
+#define AC97_SR                 0x06    // status
+#   define AC97_SR_DCH              (1 << 0)    // DMA controller halted
+#   define AC97_SR_CELV             (1 << 1)    // current equals last valid
+#   define AC97_SR_LVBCI            (1 << 2)    // last valid buffer completion interrupt
+#   define AC97_SR_BCIS             (1 << 3)    // buffer completion interrupt status
+#   define AC97_SR_FIFOE            (1 << 4)    // FIFO error
+#   define AC97_SR_WCLEAR           (AC97_SR_LVBCI | AC97_SR_BCIS | AC97_SR_FIFOE)
+#define AC97_PICB               0x08    // position in current buffer, in samples
+#define AC97_PIV                0x0A    // prefetched index value
+#define AC97_CR                 0x0B    // control
+#   define AC97_CR_RPBM             (1 << 0)    // run/pause bus master
+#   define AC97_CR_RR               (1 << 1)    // reset registers
+#   define AC97_CR_LVBIE            (1 << 2)    // last valid buffer interrupt enable
+#   define AC97_CR_FEIE             (1 << 3)    // FIFO error interrupt enable
+#   define AC97_CR_IOCE             (1 << 4)    // interrupt on completion enable
+#define AC97_ENGINE_REGS        0x10
+
+// Global registers
+#define AC97_GLOB_CNT           0x2C
+#   define AC97_GLOB_CNT_COLD       (1 << 1)
+#   define AC97_GLOB_CNT_WARM       (1 << 2)
+#define AC97_GLOB_STA           0x30
+#   define AC97_GLOB_STA_PIINT      (1 << 5)
+#   define AC97_GLOB_STA_POINT      (1 << 6)
+#   define AC97_GLOB_STA_MINT       (1 << 7)
+#   define AC97_GLOB_STA_PCR        (1 << 8)    // primary codec ready
+#   define AC97_GLOB_STA_SOINT      (1 << 24)   // SPDIF out interrupt (nForce)
+#define AC97_CAS                0x34
+
+// Offset of the NABM registers in the memory mapped BAR
+#define AC97_MMIO_NABM          0x100
+
+// Buffer descriptor list
+#define AC97_BDL_ENTRIES        32
+#define AC97_BD_IOC             (1 << 15)   // interrupt on completion
+#define AC97_BD_BUP             (1 << 14)   // buffer underrun policy
+
+/*!
+ * The AC'97 audio controller of the MCPX.
+ *
+ * The codec exposes the native audio mixer registers, which are kept but
+ * don't affect the output, and the controller has three bus master engines
+ * (PCM out, PCM in and SPDIF out) that walk a list of 32 buffer descriptors
+ * in guest memory.
+ *
+ * The engines run on a DMA thread paced by the 48 kHz codec clock. Whenever
+ * an engine moves to a new buffer, the whole buffer is transferred at once:
+ * PCM out samples are read straight from guest memory into the audio sink,
+ * PCM in buffers are filled with silence and SPDIF buffers are consumed
+ * without being played. The engine then completes the buffer when the time
+ * it takes to play it has elapsed, raising the completion interrupts and
+ * moving on to the next buffer, or halting after the last valid one. The
+ * position within the current buffer is derived from the time left until
+ * then.
+ */
 class AC97Device : public PCIDevice {
 public:
     // constructor
-    AC97Device(uint16_t vendorID, uint16_t deviceID, uint8_t revisionID);
+    AC97Device(uint16_t vendorID, uint16_t deviceID, uint8_t revisionID, uint8_t *ram, uint32_t ramSize, IRQHandler *irqHandler);
     virtual ~AC97Device();
 
     // PCI Device functions
@@ -21,6 +127,77 @@ public:
     void PCIIOWrite(int barIndex, uint32_t port, uint32_t value, uint8_t size) override;
     void PCIMMIORead(int barIndex, uint32_t addr, uint32_t *value, uint8_t size) override;
     void PCIMMIOWrite(int barIndex, uint32_t addr, uint32_t value, uint8_t size) override;
+
+    // Sends the PCM output to the specified sink, or discards it if nullptr.
+    // The sink is started at 48 kHz stereo and stopped when it is replaced or
+    // when the device is destroyed, but it is not owned by the device.
+    bool SetAudioSink(hw::audio::AudioSink *sink);
+
+private:
+    typedef std::chrono::high_resolution_clock Clock;
+
+    struct Engine {
+        const char *name;
+        uint32_t bdbar;
+        uint8_t civ;
+        uint8_t lvi;
+        uint16_t sr;
+        uint8_t piv;
+        uint8_t cr;
+
+        // Length in samples and flags of the buffer in flight, and when it
+        // completes
+        uint16_t length;
+        uint16_t flags;
+        Clock::time_point due;
+        // Time left on the buffer in flight when the engine was paused
+        Clock::duration remaining;
+        bool inFlight;
+    };
+
+    uint8_t *m_ram;
+    uint32_t m_ramSize;
+    IRQHandler *m_irqHandler;
+
+    // Serializes register accesses and the DMA thread
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    uint16_t m_mixer[AC97_NAM_SIZE / 2];
+    Engine m_engines[AC97_ENGINE_COUNT];
+    uint32_t m_globCnt;
+    bool m_irqLevel = false;
+    hw::audio::AudioSink *m_sink = nullptr;
+
+    std::thread m_dmaThread;
+    std::atomic<bool> m_running{ false };
+
+    static void DMAThread(AC97Device *ac97);
+
+    void ResetMixer();
+    void ResetEngine(Engine& engine);
+    Engine *GetEngine(uint32_t offset);
+    uint32_t EngineInterrupts(const Engine& engine) const;
+
+    bool IsRunning(const Engine& engine) const;
+    void StartEngine(Engine& engine, Clock::time_point now);
+    void PauseEngine(Engine& engine, Clock::time_point now);
+    void FetchBuffer(Engine& engine, Clock::time_point start);
+    void CompleteBuffer(Engine& engine);
+    void RunEngine(Engine& engine, Clock::time_point now);
+    void RunEngines(Clock::time_point now);
+    uint16_t GetPosition(const Engine& engine, Clock::time_point now) const;
+    void UpdateIRQ();
+
+    uint16_t ReadMixer(uint32_t offset);
+    void WriteMixer(uint32_t offset, uint16_t value);
+
+    uint8_t ReadBusMaster(uint32_t offset, Clock::time_point now);
+    void WriteBusMaster(uint32_t offset, uint8_t value, Clock::time_point now);
+
+    void NAMRead(uint32_t offset, uint32_t *value, uint8_t size);
+    void NAMWrite(uint32_t offset, uint32_t value, uint8_t size);
+    void NABMRead(uint32_t offset, uint32_t *value, uint8_t size);
+    void NABMWrite(uint32_t offset, uint32_t value, uint8_t size);
 };
 
 }
@@ -3,10 +3,14 @@
 
 namespace openxbox {
 
-IDEDevice::IDEDevice(uint16_t vendorID, uint16_t deviceID, uint8_t revisionID)
+IDEDevice::IDEDevice(uint16_t vendorID, uint16_t deviceID, uint8_t revisionID, uint8_t *ram, uint32_t ramSize, hw::ata::ATA *ata)
     : PCIDevice(PCI_HEADER_TYPE_NORMAL, vendorID, deviceID, revisionID,
         0x01, 0x01, 0x8A) // IDE controller
+    , m_ata(ata)
 {
+    // The bus master engines transfer data directly to and from guest RAM
+    m_ata->GetChannel(hw::ata::ChanPrimary).GetBusMaster().SetMemory(ram, ramSize);
+    m_ata->GetChannel(hw::ata::ChanSecondary).GetBusMaster().SetMemory(ram, ramSize);
 }
 
 IDEDevice::~IDEDevice() {
@@ -22,13 +26,25 @@ void IDEDevice::Reset() {
 }
 
 void IDEDevice::PCIIORead(int barIndex, uint32_t port, uint32_t *value, uint8_t size) {
-    log_spew("IDEDevice::PCIIORead:   Unimplemented!  bar = %d,  port = 0x%x,  size = %u\n", barIndex, port, size);
-
-    *value = 0;
+    if (barIndex != 4) {
+        log_spew("IDEDevice::PCIIORead:   Unimplemented!  bar = %d,  port = 0x%x,  size = %u\n", barIndex, port, size);
+        *value = 0;
+        return;
+    }
+
+    // BAR4 holds the bus master registers of the primary channel followed by the secondary channel's
+    hw::ata::Channel channel = (port < hw::ata::kBusMasterChannelStride) ? hw::ata::ChanPrimary : hw::ata::ChanSecondary;
+    m_ata->GetChannel(channel).GetBusMaster().ReadRegister(port % hw::ata::kBusMasterChannelStride, value, size);
 }
 
 void IDEDevice::PCIIOWrite(int barIndex, uint32_t port, uint32_t value, uint8_t size) {
-    log_spew("IDEDevice::PCIIOWrite:  Unimplemented!  bar = %d,  port = 0x%x,  value = 0x%x,  size = %u\n", barIndex, port, value, size);
+    if (barIndex != 4) {
+        log_spew("IDEDevice::PCIIOWrite:  Unimplemented!  bar = %d,  port = 0x%x,  value = 0x%x,  size = %u\n", barIndex, port, value, size);
+        return;
+    }
+
+    hw::ata::Channel channel = (port < hw::ata::kBusMasterChannelStride) ? hw::ata::ChanPrimary : hw::ata::ChanSecondary;
+    m_ata->GetChannel(channel).GetBusMaster().WriteRegister(port % hw::ata::kBusMasterChannelStride, value, size);
 }
 
 }
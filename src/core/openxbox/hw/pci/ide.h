@@ -4,13 +4,14 @@
 
 #include "../defs.h"
 #include "pci.h"
+#include "../ata/ata.h"
 
 namespace openxbox {
 
 class IDEDevice : public PCIDevice {
 public:
     // constructor
-    IDEDevice(uint16_t vendorID, uint16_t deviceID, uint8_t revisionID);
+    IDEDevice(uint16_t vendorID, uint16_t deviceID, uint8_t revisionID, uint8_t *ram, uint32_t ramSize, hw::ata::ATA *ata);
     virtual ~IDEDevice();
 
     // PCI Device functions
@@ -19,6 +20,10 @@ public:
 
     void PCIIORead(int barIndex, uint32_t port, uint32_t *value, uint8_t size) override;
     void PCIIOWrite(int barIndex, uint32_t port, uint32_t value, uint8_t size) override;
+
+private:
+    // The ATA channels whose bus master engines are exposed through BAR4
+    hw::ata::ATA *m_ata;
 };
 
 }
@@ -25,6 +25,7 @@
 #include "openxbox/log.h"
 #include "openxbox/thread.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 
@@ -67,16 +68,31 @@ NV2ADevice::NV2ADevice(uint16_t vendorID, uint16_t deviceID, uint8_t revisionID,
     , m_pSystemRAM(pSystemRAM)
     , m_systemRAMSize(systemRAMSize)
     , m_irqHandler(irqHandler)
+    , m_surfaces(pSystemRAM, systemRAMSize)
+    , m_scanout(pSystemRAM, systemRAMSize)
 {
+    // RAMIN is just RAM, so we allocate it as such
+    m_pRAMIN = (uint8_t*)malloc(NV_PRAMIN_SIZE);
+
+    memset(m_ffConstants, 0, sizeof(m_ffConstants));
 }
 
 NV2ADevice::~NV2ADevice() {
     m_running = false;
 
     m_PFIFO.cache1.cache_cond.notify_all();
+    {
+        std::lock_guard<std::mutex> lk(m_PFIFO.cache1.pusher_mutex);
+        m_PFIFO.cache1.pusher_cond.notify_all();
+    }
 
+    m_PFIFO.pusher_thread.join();
     m_PFIFO.puller_thread.join();
     m_VblankThread.join();
+
+    StopTrace();
+    StopScanout();
+    StopProfile();
 }
 
 // PCI Device functions
@@ -93,6 +109,7 @@ void NV2ADevice::Init() {
  
     m_running = true;
 
+    m_PFIFO.pusher_thread = std::thread(PFIFO_Pusher_Thread, this);
     m_VblankThread = std::thread(VBlankThread, this);
 
     m_MemoryRegions.clear();
@@ -119,10 +136,6 @@ void NV2ADevice::Init() {
 }
 
 void NV2ADevice::Reset() {
-    // RAMIN is just RAM, so we allocate it as such
-    if (m_pRAMIN == nullptr) {
-        m_pRAMIN = (uint8_t*)malloc(NV_PRAMIN_SIZE);
-    }
     memset(m_pRAMIN, 0, NV_PRAMIN_SIZE);
 
     // VRAM IS System RAM, so we mark it as such
@@ -298,6 +311,20 @@ void NV2ADevice::PFIFORead(NV2ADevice *nv2a, uint32_t addr, uint32_t *value, uin
     // TODO: Acknowledge the size.
     //assert(size == 4);
 
+    // The pusher worker updates the CACHE1 DMA state while it runs, so keep
+    // it stopped while the guest reads it
+    std::unique_lock<std::mutex> pusherLock;
+    switch (addr) {
+    case NV_PFIFO_CACHE1_DMA_STATE:
+    case NV_PFIFO_CACHE1_DMA_SUBROUTINE:
+    case NV_PFIFO_CACHE1_DMA_DCOUNT:
+    case NV_PFIFO_CACHE1_DMA_GET_JMP_SHADOW:
+    case NV_PFIFO_CACHE1_DMA_RSVD_SHADOW:
+    case NV_PFIFO_CACHE1_DMA_DATA_SHADOW:
+        pusherLock = nv2a->pfifo_lock_pusher_idle();
+        break;
+    }
+
     switch (addr) {
     case NV_PFIFO_RAMHT:
         *value = 0x03000100; // = NV_PFIFO_RAMHT_SIZE_4K | NV_PFIFO_RAMHT_BASE_ADDRESS(NumberOfPaddingBytes >> 12) | NV_PFIFO_RAMHT_SEARCH_128
@@ -323,20 +350,25 @@ void NV2ADevice::PFIFORead(NV2ADevice *nv2a, uint32_t addr, uint32_t *value, uin
         break;
     case NV_PFIFO_CACHE1_STATUS:
     {
+        // Commands still being parsed by the pusher count as pending
+        bool pusherIdle = nv2a->pfifo_pusher_idle();
         std::lock_guard<std::mutex> lk(nv2a->m_PFIFO.cache1.mutex);
 
-        if (nv2a->m_PFIFO.cache1.cache.empty()) {
+        if (pusherIdle && nv2a->m_PFIFO.cache1.cache.empty()) {
             *value |= NV_PFIFO_CACHE1_STATUS_LOW_MARK; /* low mark empty */
         }
 
     }	break;
     case NV_PFIFO_CACHE1_DMA_PUSH:
+    {
+        bool pusherIdle = nv2a->pfifo_pusher_idle();
         SET_MASK(*value, NV_PFIFO_CACHE1_DMA_PUSH_ACCESS,
             nv2a->m_PFIFO.cache1.dma_push_enabled);
+        SET_MASK(*value, NV_PFIFO_CACHE1_DMA_PUSH_STATE, !pusherIdle); /* busy */
         SET_MASK(*value, NV_PFIFO_CACHE1_DMA_PUSH_STATUS,
             nv2a->m_PFIFO.cache1.dma_push_suspended);
-        SET_MASK(*value, NV_PFIFO_CACHE1_DMA_PUSH_BUFFER, 1); /* buffer emoty */
-        break;
+        SET_MASK(*value, NV_PFIFO_CACHE1_DMA_PUSH_BUFFER, pusherIdle); /* buffer empty */
+    }   break;
     case NV_PFIFO_CACHE1_DMA_STATE:
         SET_MASK(*value, NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE,
             nv2a->m_PFIFO.cache1.method_nonincreasing);
@@ -397,6 +429,25 @@ void NV2ADevice::PFIFORead(NV2ADevice *nv2a, uint32_t addr, uint32_t *value, uin
 void NV2ADevice::PFIFOWrite(NV2ADevice *nv2a, uint32_t addr, uint32_t value, uint8_t size) {
     assert(size == 4);
 
+    // The pusher worker owns the CACHE1 DMA state while it runs, so let it
+    // finish before the guest modifies it
+    switch (addr) {
+    case NV_PFIFO_CACHE1_PUSH0:
+    case NV_PFIFO_CACHE1_PUSH1:
+    case NV_PFIFO_CACHE1_DMA_PUSH:
+    case NV_PFIFO_CACHE1_DMA_STATE:
+    case NV_PFIFO_CACHE1_DMA_INSTANCE:
+    case NV_PFIFO_CACHE1_DMA_PUT:
+    case NV_PFIFO_CACHE1_DMA_GET:
+    case NV_PFIFO_CACHE1_DMA_SUBROUTINE:
+    case NV_PFIFO_CACHE1_DMA_DCOUNT:
+    case NV_PFIFO_CACHE1_DMA_GET_JMP_SHADOW:
+    case NV_PFIFO_CACHE1_DMA_RSVD_SHADOW:
+    case NV_PFIFO_CACHE1_DMA_DATA_SHADOW:
+        nv2a->pfifo_wait_pusher_idle();
+        break;
+    }
+
     switch (addr) {
     case NV_PFIFO_INTR_0:
         nv2a->m_PFIFO.pending_interrupts &= ~value;
@@ -418,7 +469,7 @@ void NV2ADevice::PFIFOWrite(NV2ADevice *nv2a, uint32_t addr, uint32_t value, uin
         nv2a->m_PFIFO.cache1.dma_push_enabled = GET_MASK(value, NV_PFIFO_CACHE1_DMA_PUSH_ACCESS);
         if (nv2a->m_PFIFO.cache1.dma_push_suspended && !GET_MASK(value, NV_PFIFO_CACHE1_DMA_PUSH_STATUS)) {
             nv2a->m_PFIFO.cache1.dma_push_suspended = false;
-            nv2a->pfifo_run_pusher();
+            nv2a->pfifo_kick_pusher();
         }
         nv2a->m_PFIFO.cache1.dma_push_suspended = GET_MASK(value, NV_PFIFO_CACHE1_DMA_PUSH_STATUS);
         break;
@@ -920,6 +971,11 @@ void NV2ADevice::PRAMDACRead(NV2ADevice *nv2a, uint32_t addr, uint32_t *value, u
             | NV_PRAMDAC_PLL_TEST_COUNTER_MPLL_LOCK
             | NV_PRAMDAC_PLL_TEST_COUNTER_VPLL_LOCK;
         break;
+    case NV_PRAMDAC_GENERAL_CONTROL:
+    case NV_PRAMDAC_FP_VDISPLAY_END:
+    case NV_PRAMDAC_FP_HDISPLAY_END:
+        *value = nv2a->m_PRAMDAC.regs[addr];
+        break;
     default:
         log_warning("NV2ADevice::PRAMDACRead:  Unknown NV2A PRAMDAC read!   addr = 0x%x,  size = %u\n", addr, size);
         *value = 0;
@@ -951,6 +1007,11 @@ void NV2ADevice::PRAMDACWrite(NV2ADevice *nv2a, uint32_t addr, uint32_t value, u
     case NV_PRAMDAC_VPLL_COEFF:
         nv2a->m_PRAMDAC.video_clock_coeff = value;
         break;
+    case NV_PRAMDAC_GENERAL_CONTROL:
+    case NV_PRAMDAC_FP_VDISPLAY_END:
+    case NV_PRAMDAC_FP_HDISPLAY_END:
+        nv2a->m_PRAMDAC.regs[addr] = value;
+        break;
 
     default:
         log_warning("NV2ADevice::PRAMDACWrite: Unknown NV2A PRAMDAC write!  addr = 0x%x,  size: %d,  value: 0x%x\n", addr, size, value);
@@ -1048,13 +1109,16 @@ void NV2ADevice::USERWrite(NV2ADevice *nv2a, uint32_t addr, uint32_t value, uint
         /* DMA Mode */
         switch (addr & 0xFFFF) {
         case NV_USER_DMA_PUT:
+            // Publish the new PUT and let the pusher worker parse the
+            // pushbuffer so that the vCPU can carry on
             control->dma_put = value;
 
             if (nv2a->m_PFIFO.cache1.push_enabled) {
-                nv2a->pfifo_run_pusher();
+                nv2a->pfifo_kick_pusher();
             }
             break;
         case NV_USER_DMA_GET:
+            nv2a->pfifo_wait_pusher_idle();
             control->dma_get = value;
             break;
         case NV_USER_REF:
@@ -1239,6 +1303,297 @@ bool NV2ADevice::pgraph_zeta_write_enabled() {
         | NV_PGRAPH_CONTROL_0_STENCIL_WRITE_ENABLE);
 }
 
+bool NV2ADevice::pgraph_get_surface_key(bool color, SurfaceKey *key) {
+    uint32_t dma_object = color ? m_PGRAPH.dma_color : m_PGRAPH.dma_zeta;
+    Surface *surface = color ? &m_PGRAPH.surface_color : &m_PGRAPH.surface_zeta;
+    SurfaceShape *shape = &m_PGRAPH.surface_shape;
+
+    key->zeta = !color;
+    key->format = color ? shape->color_format : shape->zeta_format;
+    if (dma_object == 0 || key->format == 0 || shape->clip_width == 0 || shape->clip_height == 0) {
+        return false;
+    }
+
+    DMAObject dma = nv_dma_load(dma_object);
+    key->address = (dma.address + surface->offset) & 0x07FFFFFF;
+    key->swizzled = m_PGRAPH.surface_type == NV097_SET_SURFACE_FORMAT_TYPE_SWIZZLE;
+    if (key->swizzled) {
+        key->logWidth = shape->log_width;
+        key->logHeight = shape->log_height;
+    }
+    else {
+        key->pitch = surface->pitch;
+    }
+    key->clipX = shape->clip_x;
+    key->clipY = shape->clip_y;
+    key->clipWidth = shape->clip_width;
+    key->clipHeight = shape->clip_height;
+    return true;
+}
+
+void NV2ADevice::pgraph_update_surface_part(bool upload, bool rebind, bool color, bool write) {
+    SurfaceKey *bound_key = color ? &m_boundColorSurface : &m_boundZetaSurface;
+    bool *bound = color ? &m_colorSurfaceBound : &m_zetaSurfaceBound;
+
+    if (rebind) {
+        SurfaceKey key;
+        bool valid = pgraph_get_surface_key(color, &key);
+
+        // Write back the previous surface if the target changed
+        if (*bound && !(valid && *bound_key == key)) {
+            CachedSurface *previous = m_surfaces.Find(*bound_key);
+            if (previous != nullptr) {
+                m_surfaces.Download(previous);
+            }
+            *bound = false;
+        }
+
+        if (valid) {
+            *bound_key = key;
+            *bound = true;
+        }
+    }
+
+    if (!*bound || (!upload && !write)) {
+        return;
+    }
+
+    CachedSurface *surface = m_surfaces.Bind(*bound_key);
+
+    if (upload) {
+        m_surfaces.Upload(surface);
+
+        // The draw that follows renders into the host copy
+        if (write) {
+            surface->hostDirty = true;
+        }
+    }
+    else if (write) {
+        m_surfaces.Download(surface);
+    }
+}
+
+void NV2ADevice::pgraph_update_surface(bool upload, bool color_write, bool zeta_write) {
+    // Surface methods only mark the bindings as stale. They are resolved
+    // here, once per draw, clear or flip.
+    bool rebind = m_surfacesDirty;
+    m_surfacesDirty = false;
+
+    pgraph_update_surface_part(upload, rebind, true, color_write);
+    pgraph_update_surface_part(upload, rebind, false, zeta_write);
+}
+
+const VshProgram *NV2ADevice::pgraph_get_vertex_program() {
+    bool vertex_program = GET_MASK(m_PGRAPH.regs[NV_PGRAPH_CSV0_D], NV_PGRAPH_CSV0_D_MODE) == 2;
+
+    if (vertex_program) {
+        // Only hash the program again if it was modified or moved, or if the
+        // engine deleted the one we were holding on to
+        if (m_PGRAPH.vertex_program_dirty || m_vertexProgram == nullptr
+            || m_vertexProgramGeneration != m_VSH.GetGeneration())
+        {
+            unsigned int program_start = GET_MASK(m_PGRAPH.regs[NV_PGRAPH_CSV0_C],
+                NV_PGRAPH_CSV0_C_CHEOPS_PROGRAM_START);
+            m_vertexProgram = m_VSH.GetProgram(m_PGRAPH.program_data, program_start);
+            m_vertexProgramGeneration = m_VSH.GetGeneration();
+            m_PGRAPH.vertex_program_dirty = false;
+        }
+        return m_vertexProgram;
+    }
+
+    VshFixedFunctionKey key;
+    key.lighting = GET_MASK(m_PGRAPH.regs[NV_PGRAPH_CSV0_C], NV_PGRAPH_CSV0_C_LIGHTING);
+    key.normalize = GET_MASK(m_PGRAPH.regs[NV_PGRAPH_CSV0_C], NV_PGRAPH_CSV0_C_NORMALIZATION_ENABLE);
+    key.specular = m_PGRAPH.specular_enable;
+    for (int i = 0; i < NV2A_MAX_LIGHTS; i++) {
+        key.lightModes[i] = GET_MASK(m_PGRAPH.regs[NV_PGRAPH_CSV0_D],
+            NV_PGRAPH_CSV0_D_LIGHT0 << (i * 2));
+    }
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        key.textureMatrix[i] = m_PGRAPH.texture_matrix_enable[i];
+    }
+    return m_VSH.GetFixedFunctionProgram(key);
+}
+
+void NV2ADevice::pgraph_load_fixed_function_constants() {
+    // The transform context occupies the first rows of the constant bank;
+    // only copy the rows that were written since the last draw
+    for (unsigned int row = 0; row < VSH_FF_CONSTANTS_ROW; row++) {
+        if (m_PGRAPH.vsh_constants_dirty[row]) {
+            memcpy(m_ffConstants[row], m_PGRAPH.vsh_constants[row], sizeof(m_ffConstants[row]));
+            m_PGRAPH.vsh_constants_dirty[row] = false;
+        }
+    }
+
+    if (!m_ffLightsDirty) {
+        return;
+    }
+    m_ffLightsDirty = false;
+
+    m_ffConstants[VSH_FF_CONSTANTS_ROW][0] = 0.0f;
+    m_ffConstants[VSH_FF_CONSTANTS_ROW][1] = 1.0f;
+    m_ffConstants[VSH_FF_CONSTANTS_ROW][2] = 0.0f;
+    m_ffConstants[VSH_FF_CONSTANTS_ROW][3] = VSH_FF_SPECULAR_POWER;
+    memcpy(m_ffConstants[VSH_FF_SCENE_AMBIENT_ROW], m_PGRAPH.ltctxa[NV_IGRAPH_XF_LTCTXA_FR_AMB], sizeof(float) * 4);
+
+    for (int i = 0; i < NV2A_MAX_LIGHTS; i++) {
+        float (*light)[4] = &m_ffConstants[VSH_FF_LIGHT_BASE_ROW + i * VSH_FF_LIGHT_ROWS];
+        memset(light, 0, sizeof(float) * 4 * VSH_FF_LIGHT_ROWS);
+        memcpy(light[VSH_FF_LIGHT_DIRECTION], m_PGRAPH.light_infinite_direction[i], sizeof(float) * 3);
+        memcpy(light[VSH_FF_LIGHT_POSITION], m_PGRAPH.light_local_position[i], sizeof(float) * 3);
+        memcpy(light[VSH_FF_LIGHT_AMBIENT], m_PGRAPH.ltctxb[NV_IGRAPH_XF_LTCTXB_L0_AMB + i * 6], sizeof(float) * 3);
+        memcpy(light[VSH_FF_LIGHT_DIFFUSE], m_PGRAPH.ltctxb[NV_IGRAPH_XF_LTCTXB_L0_DIF + i * 6], sizeof(float) * 3);
+        memcpy(light[VSH_FF_LIGHT_ATTENUATION], m_PGRAPH.light_local_attenuation[i], sizeof(float) * 3);
+        memcpy(light[VSH_FF_LIGHT_SPECULAR], m_PGRAPH.ltctxb[NV_IGRAPH_XF_LTCTXB_L0_SPC + i * 6], sizeof(float) * 3);
+        memcpy(light[VSH_FF_LIGHT_HALF_VECTOR], m_PGRAPH.light_infinite_half_vector[i], sizeof(float) * 3);
+    }
+}
+
+void NV2ADevice::pgraph_prepare_vertex_program() {
+    // Programs read the constant bank in place, the fixed function programs
+    // read a copy extended with the lighting parameters
+    pgraph_get_vertex_program();
+    if (GET_MASK(m_PGRAPH.regs[NV_PGRAPH_CSV0_D], NV_PGRAPH_CSV0_D_MODE) != 2) {
+        pgraph_load_fixed_function_constants();
+    }
+}
+
+static void pgraph_argb_to_float(uint32_t color, float *out) {
+    out[0] = ((color >> 16) & 0xFF) / 255.0f;
+    out[1] = ((color >> 8) & 0xFF) / 255.0f;
+    out[2] = (color & 0xFF) / 255.0f;
+    out[3] = ((color >> 24) & 0xFF) / 255.0f;
+}
+
+const PshProgram *NV2ADevice::pgraph_get_combiner_program() {
+    PshState state;
+    state.combinerControl = m_PGRAPH.regs[NV_PGRAPH_COMBINECTL];
+
+    // Only the active stages take part in the program key
+    unsigned int num_stages = state.combinerControl & 0xFF;
+    for (unsigned int i = 0; i < num_stages && i < PSH_MAX_STAGES; i++) {
+        state.rgbInputs[i] = m_PGRAPH.regs[NV_PGRAPH_COMBINECOLORI0 + i * 4];
+        state.rgbOutputs[i] = m_PGRAPH.regs[NV_PGRAPH_COMBINECOLORO0 + i * 4];
+        state.alphaInputs[i] = m_PGRAPH.regs[NV_PGRAPH_COMBINEALPHAI0 + i * 4];
+        state.alphaOutputs[i] = m_PGRAPH.regs[NV_PGRAPH_COMBINEALPHAO0 + i * 4];
+    }
+
+    state.finalInputsA = m_PGRAPH.regs[NV_PGRAPH_COMBINESPECFOG0];
+    state.finalInputsB = m_PGRAPH.regs[NV_PGRAPH_COMBINESPECFOG1];
+    state.fogEnable = (m_PGRAPH.regs[NV_PGRAPH_CONTROL_3] & NV_PGRAPH_CONTROL_3_FOGENABLE) != 0;
+    state.fogMode = GET_MASK(m_PGRAPH.regs[NV_PGRAPH_CONTROL_3], NV_PGRAPH_CONTROL_3_FOG_MODE);
+
+    return m_PSH.GetProgram(state);
+}
+
+void NV2ADevice::pgraph_load_combiner_constants(PshConstants *constants) {
+    for (int i = 0; i < PSH_MAX_STAGES; i++) {
+        pgraph_argb_to_float(m_PGRAPH.regs[NV_PGRAPH_COMBINEFACTOR0 + i * 4], constants->factor0[i]);
+        pgraph_argb_to_float(m_PGRAPH.regs[NV_PGRAPH_COMBINEFACTOR1 + i * 4], constants->factor1[i]);
+    }
+    pgraph_argb_to_float(m_PGRAPH.regs[NV_PGRAPH_FOGCOLOR], constants->fogColor);
+    memcpy(&constants->fogParam[0], &m_PGRAPH.regs[NV_PGRAPH_FOGPARAM0], sizeof(float));
+    memcpy(&constants->fogParam[1], &m_PGRAPH.regs[NV_PGRAPH_FOGPARAM1], sizeof(float));
+}
+
+void NV2ADevice::pgraph_prepare_combiners() {
+    m_combinerProgram = pgraph_get_combiner_program();
+    pgraph_load_combiner_constants(&m_combinerConstants);
+}
+
+void NV2ADevice::pgraph_image_blit(ImageBlitState *image_blit) {
+    GraphicsObject *context_surfaces_obj = lookup_graphics_object(image_blit->context_surfaces);
+    assert(context_surfaces_obj);
+    assert(context_surfaces_obj->graphics_class == NV_CONTEXT_SURFACES_2D);
+
+    ContextSurfaces2DState *context_surfaces = &context_surfaces_obj->data.context_surfaces_2d;
+
+    unsigned int bytes_per_pixel = nv2a_blit_bytes_per_pixel(context_surfaces->color_format);
+    if (bytes_per_pixel == 0) {
+        log_warning("Unknown blit surface format: 0x%x\n", context_surfaces->color_format);
+        return;
+    }
+
+    BlitParams params;
+    params.colorFormat = context_surfaces->color_format;
+    params.operation = image_blit->operation;
+    params.width = image_blit->width;
+    params.height = image_blit->height;
+    params.sourcePitch = context_surfaces->source_pitch;
+    params.destPitch = context_surfaces->dest_pitch;
+
+    // Unbound context objects leave the BlitParams defaults in place
+    if (image_blit->context_rop != 0) {
+        GraphicsObject *rop_obj = lookup_graphics_object(image_blit->context_rop);
+        if (rop_obj != NULL && rop_obj->graphics_class == NV_ROP) {
+            params.rop = rop_obj->data.rop.rop;
+        }
+    }
+    if (image_blit->context_beta1 != 0) {
+        GraphicsObject *beta1_obj = lookup_graphics_object(image_blit->context_beta1);
+        if (beta1_obj != NULL && beta1_obj->graphics_class == NV_BETA) {
+            params.beta1 = beta1_obj->data.beta.beta;
+        }
+    }
+    if (image_blit->context_beta4 != 0) {
+        GraphicsObject *beta4_obj = lookup_graphics_object(image_blit->context_beta4);
+        if (beta4_obj != NULL && beta4_obj->graphics_class == NV_BETA4) {
+            params.beta4 = beta4_obj->data.beta4.beta_factor;
+        }
+    }
+
+    uint32_t source_dma_len, dest_dma_len;
+    uint8_t *source, *dest;
+
+    source = (uint8_t*)nv_dma_map(context_surfaces->dma_image_source, &source_dma_len);
+    assert(context_surfaces->source_offset < source_dma_len);
+    source += context_surfaces->source_offset;
+
+    dest = (uint8_t*)nv_dma_map(context_surfaces->dma_image_dest, &dest_dma_len);
+    assert(context_surfaces->dest_offset < dest_dma_len);
+    dest += context_surfaces->dest_offset;
+
+    log_debug("  - 0x%tx -> 0x%tx\n", source - m_VRAM, dest - m_VRAM);
+
+    params.source = source
+        + image_blit->in_y * context_surfaces->source_pitch
+        + image_blit->in_x * bytes_per_pixel;
+    params.dest = dest
+        + image_blit->out_y * context_surfaces->dest_pitch
+        + image_blit->out_x * bytes_per_pixel;
+
+    if (params.width == 0 || params.height == 0) {
+        return;
+    }
+
+    // The vectorized kernels trust their pointers, so both rectangles must
+    // lie within their DMA objects and within guest RAM. DMA limits are
+    // inclusive.
+    auto rect_fits = [&](const uint8_t *surface, uint32_t surface_offset, uint32_t dma_len,
+        unsigned int x, unsigned int y, unsigned int pitch) -> bool
+    {
+        uint64_t offset = (uint64_t)surface_offset + (uint64_t)y * pitch + (uint64_t)x * bytes_per_pixel;
+        uint64_t extent = (uint64_t)(params.height - 1) * pitch + (uint64_t)params.width * bytes_per_pixel;
+        uint64_t dma_base = (uint64_t)(surface - m_VRAM) - surface_offset;
+        return offset + extent <= (uint64_t)dma_len + 1 && dma_base + offset + extent <= m_systemRAMSize;
+    };
+    if (!rect_fits(source, context_surfaces->source_offset, source_dma_len,
+            image_blit->in_x, image_blit->in_y, params.sourcePitch)
+        || !rect_fits(dest, context_surfaces->dest_offset, dest_dma_len,
+            image_blit->out_x, image_blit->out_y, params.destPitch))
+    {
+        log_warning("NV2ADevice::pgraph_image_blit: %ux%u blit from (%u, %u) to (%u, %u) exceeds its surfaces\n",
+            params.width, params.height, image_blit->in_x, image_blit->in_y, image_blit->out_x, image_blit->out_y);
+        return;
+    }
+
+    nv2a_blit(params);
+
+    // Render targets cached from the destination are now stale
+    m_surfaces.InvalidateRange((uint32_t)(params.dest - m_VRAM),
+        (params.height - 1) * params.destPitch + params.width * bytes_per_pixel);
+}
+
 unsigned int NV2ADevice::kelvin_map_stencil_op(uint32_t parameter) {
     unsigned int op;
     switch (parameter) {
@@ -1307,10 +1662,79 @@ unsigned int NV2ADevice::kelvin_map_texgen(uint32_t parameter, unsigned int chan
     return texgen;
 }
 
+void NV2ADevice::pgraph_clear_surface_part(bool color, uint32_t parameter) {
+    SurfaceKey key;
+    if (!pgraph_get_surface_key(color, &key)) {
+        return;
+    }
+
+    ClearParams params;
+    bool valid = color
+        ? nv2a_clear_color_value(key.format, m_PGRAPH.regs[NV_PGRAPH_COLORCLEARVALUE], parameter, &params.value, &params.mask)
+        : nv2a_clear_zeta_value(key.format, m_PGRAPH.regs[NV_PGRAPH_ZSTENCILCLEARVALUE], parameter, &params.value, &params.mask);
+    if (!valid) {
+        log_warning("Unknown %s surface format for clear: 0x%x\n", color ? "color" : "zeta", key.format);
+        return;
+    }
+    if (params.mask == 0) {
+        return;
+    }
+
+    // The cached surface knows the layout and extent of the guest memory
+    CachedSurface *surface = m_surfaces.Bind(key);
+    params.dest = m_pSystemRAM + key.address;
+    params.size = surface->size;
+    params.bytesPerPixel = surface->bytesPerPixel;
+    params.pitch = key.pitch;
+    params.swizzled = key.swizzled;
+    params.swizzleMaskX = surface->swizzleMaskX;
+    params.swizzleMaskY = surface->swizzleMaskY;
+    params.width = key.swizzled ? (1 << key.logWidth) : surface->width;
+    params.height = key.swizzled ? (1 << key.logHeight) : surface->height;
+
+    // The clear rectangle is inclusive and limited to the clip rectangle
+    unsigned int xmin = GET_MASK(m_PGRAPH.regs[NV_PGRAPH_CLEARRECTX], NV_PGRAPH_CLEARRECTX_XMIN);
+    unsigned int xmax = GET_MASK(m_PGRAPH.regs[NV_PGRAPH_CLEARRECTX], NV_PGRAPH_CLEARRECTX_XMAX) + 1;
+    unsigned int ymin = GET_MASK(m_PGRAPH.regs[NV_PGRAPH_CLEARRECTY], NV_PGRAPH_CLEARRECTY_YMIN);
+    unsigned int ymax = GET_MASK(m_PGRAPH.regs[NV_PGRAPH_CLEARRECTY], NV_PGRAPH_CLEARRECTY_YMAX) + 1;
+    params.xmin = std::max(xmin, key.clipX);
+    params.ymin = std::max(ymin, key.clipY);
+    params.xmax = std::min(xmax, key.clipX + key.clipWidth);
+    params.ymax = std::min(ymax, key.clipY + key.clipHeight);
+
+    log_debug("  - clear %s 0x%08x: %u,%u - %u,%u, value 0x%08x, mask 0x%08x\n", color ? "color" : "zeta",
+        key.address, params.xmin, params.ymin, params.xmax, params.ymax, params.value, params.mask);
+
+    m_clear.Clear(params);
+
+    // The host copy no longer matches guest memory
+    m_surfaces.InvalidateRange(key.address, surface->size);
+}
+
+void NV2ADevice::pgraph_clear_surface(uint32_t parameter) {
+    bool color = (parameter & NV097_CLEAR_SURFACE_COLOR) != 0;
+    bool zeta = (parameter & (NV097_CLEAR_SURFACE_Z | NV097_CLEAR_SURFACE_STENCIL)) != 0;
+
+    // Write back anything rendered to the host copies so that a partial
+    // clear leaves the rest of the surface intact
+    pgraph_update_surface(false, color, zeta);
+
+    if (color) {
+        pgraph_clear_surface_part(true, parameter);
+    }
+    if (zeta) {
+        pgraph_clear_surface_part(false, parameter);
+    }
+}
+
 void NV2ADevice::pgraph_method_log(unsigned int subchannel, unsigned int graphics_class, unsigned int method, uint32_t parameter) {
     static unsigned int last = 0;
     static unsigned int count = 0;
 
+    if (m_profiler != nullptr) {
+        m_profiler->CountMethod(graphics_class, method, parameter);
+    }
+
     if (last == 0x1800 && method != last) {
         log_debug("pgraph method (%d) 0x%08X * %d", subchannel, last, count);
     }
@@ -1375,6 +1799,45 @@ void NV2ADevice::pgraph_method(unsigned int subchannel, unsigned int method, uin
     }
 
     switch (object->graphics_class) {
+    case NV_BETA:
+    {
+        switch (method) {
+        case NV012_SET_BETA:
+            object->data.beta.beta = parameter;
+            break;
+        default:
+            log_warning("EmuNV2A: Unknown NV_BETA Method: 0x%08X\n", method);
+        }
+
+        break;
+    }
+
+    case NV_ROP:
+    {
+        switch (method) {
+        case NV043_SET_ROP:
+            object->data.rop.rop = parameter & 0xFF;
+            break;
+        default:
+            log_warning("EmuNV2A: Unknown NV_ROP Method: 0x%08X\n", method);
+        }
+
+        break;
+    }
+
+    case NV_BETA4:
+    {
+        switch (method) {
+        case NV072_SET_BETA_FACTOR:
+            object->data.beta4.beta_factor = parameter;
+            break;
+        default:
+            log_warning("EmuNV2A: Unknown NV_BETA4 Method: 0x%08X\n", method);
+        }
+
+        break;
+    }
+
     case NV_CONTEXT_SURFACES_2D:
     {
         switch (method) {
@@ -1407,6 +1870,15 @@ void NV2ADevice::pgraph_method(unsigned int subchannel, unsigned int method, uin
     case NV_IMAGE_BLIT:
     {
         switch (method) {
+        case NV09F_SET_CONTEXT_ROP:
+            image_blit->context_rop = parameter;
+            break;
+        case NV09F_SET_CONTEXT_BETA1:
+            image_blit->context_beta1 = parameter;
+            break;
+        case NV09F_SET_CONTEXT_BETA4:
+            image_blit->context_beta4 = parameter;
+            break;
         case NV09F_SET_CONTEXT_SURFACES:
             image_blit->context_surfaces = parameter;
             break;
@@ -1426,63 +1898,7 @@ void NV2ADevice::pgraph_method(unsigned int subchannel, unsigned int method, uin
             image_blit->height = parameter >> 16;
 
             /* I guess this kicks it off? */
-            if (image_blit->operation == NV09F_SET_OPERATION_SRCCOPY) {
-
-                log_debug("NV09F_SET_OPERATION_SRCCOPY");
-
-                GraphicsObject *context_surfaces_obj = lookup_graphics_object(image_blit->context_surfaces);
-                assert(context_surfaces_obj);
-                assert(context_surfaces_obj->graphics_class == NV_CONTEXT_SURFACES_2D);
-
-                ContextSurfaces2DState *context_surfaces = &context_surfaces_obj->data.context_surfaces_2d;
-
-                unsigned int bytes_per_pixel;
-                switch (context_surfaces->color_format) {
-                case NV062_SET_COLOR_FORMAT_LE_Y8:
-                    bytes_per_pixel = 1;
-                    break;
-                case NV062_SET_COLOR_FORMAT_LE_R5G6B5:
-                    bytes_per_pixel = 2;
-                    break;
-                case NV062_SET_COLOR_FORMAT_LE_A8R8G8B8:
-                    bytes_per_pixel = 4;
-                    break;
-                default:
-                    log_debug("Unknown blit surface format: 0x%x\n", context_surfaces->color_format);
-                    assert(false);
-                    break;
-                }
-
-                uint32_t source_dma_len, dest_dma_len;
-                uint8_t *source, *dest;
-
-                source = (uint8_t*)nv_dma_map(context_surfaces->dma_image_source, &source_dma_len);
-                assert(context_surfaces->source_offset < source_dma_len);
-                source += context_surfaces->source_offset;
-
-                dest = (uint8_t*)nv_dma_map(context_surfaces->dma_image_dest, &dest_dma_len);
-                assert(context_surfaces->dest_offset < dest_dma_len);
-                dest += context_surfaces->dest_offset;
-
-                log_debug("  - 0x%tx -> 0x%tx\n", source - m_VRAM, dest - m_VRAM);
-
-                for (unsigned int y = 0; y<image_blit->height; y++) {
-                    uint8_t *source_row = source
-                        + (image_blit->in_y + y) * context_surfaces->source_pitch
-                        + image_blit->in_x * bytes_per_pixel;
-
-                    uint8_t *dest_row = dest
-                        + (image_blit->out_y + y) * context_surfaces->dest_pitch
-                        + image_blit->out_x * bytes_per_pixel;
-
-                    memmove(dest_row, source_row,
-                        image_blit->width * bytes_per_pixel);
-                }
-            }
-            else {
-                assert(false);
-            }
-
+            pgraph_image_blit(image_blit);
             break;
         default:
             log_warning("EmuNV2A: Unknown NV_IMAGE_BLIT Method: 0x%08X\n", method);
@@ -1506,13 +1922,13 @@ void NV2ADevice::pgraph_method(unsigned int subchannel, unsigned int method, uin
             kelvin->dma_state = parameter;
             break;
         case NV097_SET_CONTEXT_DMA_COLOR:
-            log_debug("TODO: pgraph_update_surface\n");
-            /* try to get any straggling draws in before the surface's changed :/ */
-            //pgraph_update_surface(d, false, true, true);
+            m_surfacesDirty = true;
 
             m_PGRAPH.dma_color = parameter;
             break;
         case NV097_SET_CONTEXT_DMA_ZETA:
+            m_surfacesDirty = true;
+
             m_PGRAPH.dma_zeta = parameter;
             break;
         case NV097_SET_CONTEXT_DMA_VERTEX_A:
@@ -1528,8 +1944,7 @@ void NV2ADevice::pgraph_method(unsigned int subchannel, unsigned int method, uin
             m_PGRAPH.dma_report = parameter;
             break;
         case NV097_SET_SURFACE_CLIP_HORIZONTAL:
-            log_debug("TODO: pgraph_update_surface\n");
-            //pgraph_update_surface(d, false, true, true);
+            m_surfacesDirty = true;
 
             m_PGRAPH.surface_shape.clip_x =
                 GET_MASK(parameter, NV097_SET_SURFACE_CLIP_HORIZONTAL_X);
@@ -1537,8 +1952,7 @@ void NV2ADevice::pgraph_method(unsigned int subchannel, unsigned int method, uin
                 GET_MASK(parameter, NV097_SET_SURFACE_CLIP_HORIZONTAL_WIDTH);
             break;
         case NV097_SET_SURFACE_CLIP_VERTICAL:
-            log_debug("TODO: pgraph_update_surface\n");
-            //pgraph_update_surface(d, false, true, true);
+            m_surfacesDirty = true;
 
             m_PGRAPH.surface_shape.clip_y =
                 GET_MASK(parameter, NV097_SET_SURFACE_CLIP_VERTICAL_Y);
@@ -1546,8 +1960,7 @@ void NV2ADevice::pgraph_method(unsigned int subchannel, unsigned int method, uin
                 GET_MASK(parameter, NV097_SET_SURFACE_CLIP_VERTICAL_HEIGHT);
             break;
         case NV097_SET_SURFACE_FORMAT:
-            log_debug("TODO: pgraph_update_surface\n");
-            //pgraph_update_surface(d, false, true, true);
+            m_surfacesDirty = true;
 
             m_PGRAPH.surface_shape.color_format =
                 GET_MASK(parameter, NV097_SET_SURFACE_FORMAT_COLOR);
@@ -1563,8 +1976,7 @@ void NV2ADevice::pgraph_method(unsigned int subchannel, unsigned int method, uin
                 GET_MASK(parameter, NV097_SET_SURFACE_FORMAT_HEIGHT);
             break;
         case NV097_SET_SURFACE_PITCH:
-            log_debug("TODO: pgraph_update_surface\n");
-            //pgraph_update_surface(d, false, true, true);
+            m_surfacesDirty = true;
 
             m_PGRAPH.surface_color.pitch =
                 GET_MASK(parameter, NV097_SET_SURFACE_PITCH_COLOR);
@@ -1572,14 +1984,12 @@ void NV2ADevice::pgraph_method(unsigned int subchannel, unsigned int method, uin
                 GET_MASK(parameter, NV097_SET_SURFACE_PITCH_ZETA);
             break;
         case NV097_SET_SURFACE_COLOR_OFFSET:
-            log_debug("TODO: pgraph_update_surface\n");
-            //pgraph_update_surface(d, false, true, true);
+            m_surfacesDirty = true;
 
             m_PGRAPH.surface_color.offset = parameter;
             break;
         case NV097_SET_SURFACE_ZETA_OFFSET:
-            log_debug("TODO: pgraph_update_surface\n");
-            //pgraph_update_surface(d, false, true, true);
+            m_surfacesDirty = true;
 
             m_PGRAPH.surface_zeta.offset = parameter;
             break;
@@ -1589,14 +1999,17 @@ void NV2ADevice::pgraph_method(unsigned int subchannel, unsigned int method, uin
         case NV097_SET_COMBINER_SPECULAR_FOG_CW1:
             m_PGRAPH.regs[NV_PGRAPH_COMBINESPECFOG1] = parameter;
             break;
+
+        case NV097_SET_COMBINER_CONTROL:
+            m_PGRAPH.regs[NV_PGRAPH_COMBINECTL] = parameter;
+            break;
             CASE_4(NV097_SET_TEXTURE_ADDRESS, 64) :
                 slot = (method - NV097_SET_TEXTURE_ADDRESS) / 64;
             m_PGRAPH.regs[NV_PGRAPH_TEXADDRESS0 + slot * 4] = parameter;
             break;
         case NV097_SET_CONTROL0:
         {
-            log_debug("TODO: pgraph_update_surface\n");
-            //pgraph_update_surface(d, false, true, true);
+            m_surfacesDirty = true;
 
             bool stencil_write_enable =
                 parameter & NV097_SET_CONTROL0_STENCIL_WRITE_ENABLE;
@@ -1981,6 +2394,10 @@ void NV2ADevice::pgraph_method(unsigned int subchannel, unsigned int method, uin
                 parameter);
             break;
 
+        case NV097_SET_SPECULAR_ENABLE:
+            m_PGRAPH.specular_enable = parameter != 0;
+            break;
+
         case NV097_SET_LIGHT_ENABLE_MASK:
             SET_MASK(m_PGRAPH.regs[NV_PGRAPH_CSV0_D],
                 NV_PGRAPH_CSV0_D_LIGHTS,
@@ -2031,7 +2448,155 @@ void NV2ADevice::pgraph_method(unsigned int subchannel, unsigned int method, uin
         case NV097_SET_TEXGEN_VIEW_MODEL:
             SET_MASK(m_PGRAPH.regs[NV_PGRAPH_CSV0_D], NV_PGRAPH_CSV0_D_TEXGEN_REF, parameter);
             break;
+        case NV097_SET_TRANSFORM_EXECUTION_MODE:
+            SET_MASK(m_PGRAPH.regs[NV_PGRAPH_CSV0_D], NV_PGRAPH_CSV0_D_MODE,
+                GET_MASK(parameter, NV097_SET_TRANSFORM_EXECUTION_MODE_MODE));
+            SET_MASK(m_PGRAPH.regs[NV_PGRAPH_CSV0_D], NV_PGRAPH_CSV0_D_RANGE_MODE,
+                GET_MASK(parameter, NV097_SET_TRANSFORM_EXECUTION_MODE_RANGE_MODE));
+            break;
+        case NV097_SET_TRANSFORM_PROGRAM_CXT_WRITE_EN:
+            m_PGRAPH.enable_vertex_program_write = parameter;
+            break;
+        case NV097_SET_TRANSFORM_PROGRAM_LOAD:
+            assert(parameter < NV2A_MAX_TRANSFORM_PROGRAM_LENGTH);
+            SET_MASK(m_PGRAPH.regs[NV_PGRAPH_CHEOPS_OFFSET],
+                NV_PGRAPH_CHEOPS_OFFSET_PROG_LD_PTR, parameter);
+            break;
+        case NV097_SET_TRANSFORM_PROGRAM_START:
+            assert(parameter < NV2A_MAX_TRANSFORM_PROGRAM_LENGTH);
+            SET_MASK(m_PGRAPH.regs[NV_PGRAPH_CSV0_C],
+                NV_PGRAPH_CSV0_C_CHEOPS_PROGRAM_START, parameter);
+            m_PGRAPH.vertex_program_dirty = true;
+            break;
+        case NV097_SET_TRANSFORM_CONSTANT_LOAD:
+            assert(parameter < NV2A_VERTEXSHADER_CONSTANTS);
+            SET_MASK(m_PGRAPH.regs[NV_PGRAPH_CHEOPS_OFFSET],
+                NV_PGRAPH_CHEOPS_OFFSET_CONST_LD_PTR, parameter);
+            break;
+        case NV097_SET_ZSTENCIL_CLEAR_VALUE:
+            m_PGRAPH.regs[NV_PGRAPH_ZSTENCILCLEARVALUE] = parameter;
+            break;
+        case NV097_SET_COLOR_CLEAR_VALUE:
+            m_PGRAPH.regs[NV_PGRAPH_COLORCLEARVALUE] = parameter;
+            break;
+        case NV097_SET_BEGIN_END:
+            if (parameter != NV097_SET_BEGIN_END_OP_END) {
+                // The draw reads the host copies and renders into the ones
+                // with writes enabled; bring them up to date with the guest
+                pgraph_update_surface(true, pgraph_color_write_enabled(), pgraph_zeta_write_enabled());
+                pgraph_prepare_vertex_program();
+                pgraph_prepare_combiners();
+            }
+            break;
+        case NV097_CLEAR_SURFACE:
+            pgraph_clear_surface(parameter);
+            break;
+        case NV097_FLIP_STALL:
+            // Write back everything rendered before the frame is shown
+            pgraph_update_surface(false, true, true);
+            break;
+        case NV097_SET_CLEAR_RECT_HORIZONTAL:
+            m_PGRAPH.regs[NV_PGRAPH_CLEARRECTX] = parameter;
+            break;
+        case NV097_SET_CLEAR_RECT_VERTICAL:
+            m_PGRAPH.regs[NV_PGRAPH_CLEARRECTY] = parameter;
+            break;
         default:
+            if (method >= NV097_SET_TRANSFORM_PROGRAM && method <= NV097_SET_TRANSFORM_PROGRAM + 0x7c) {
+                slot = (method - NV097_SET_TRANSFORM_PROGRAM) / 4;
+
+                unsigned int program_load = GET_MASK(m_PGRAPH.regs[NV_PGRAPH_CHEOPS_OFFSET],
+                    NV_PGRAPH_CHEOPS_OFFSET_PROG_LD_PTR);
+
+                assert(program_load < NV2A_MAX_TRANSFORM_PROGRAM_LENGTH);
+                m_PGRAPH.program_data[program_load][slot % 4] = parameter;
+                m_PGRAPH.vertex_program_dirty = true;
+
+                if (slot % 4 == 3) {
+                    SET_MASK(m_PGRAPH.regs[NV_PGRAPH_CHEOPS_OFFSET],
+                        NV_PGRAPH_CHEOPS_OFFSET_PROG_LD_PTR, program_load + 1);
+                }
+                break;
+            }
+
+            if (method >= NV097_SET_TRANSFORM_CONSTANT && method <= NV097_SET_TRANSFORM_CONSTANT + 0x7c) {
+                slot = (method - NV097_SET_TRANSFORM_CONSTANT) / 4;
+
+                unsigned int const_load = GET_MASK(m_PGRAPH.regs[NV_PGRAPH_CHEOPS_OFFSET],
+                    NV_PGRAPH_CHEOPS_OFFSET_CONST_LD_PTR);
+
+                assert(const_load < NV2A_VERTEXSHADER_CONSTANTS);
+                m_PGRAPH.vsh_constants_dirty[const_load] |=
+                    (parameter != m_PGRAPH.vsh_constants[const_load][slot % 4]);
+                m_PGRAPH.vsh_constants[const_load][slot % 4] = parameter;
+
+                if (slot % 4 == 3) {
+                    SET_MASK(m_PGRAPH.regs[NV_PGRAPH_CHEOPS_OFFSET],
+                        NV_PGRAPH_CHEOPS_OFFSET_CONST_LD_PTR, const_load + 1);
+                }
+                break;
+            }
+
+            if (method >= NV097_SET_LIGHT_AMBIENT_COLOR && method <= NV097_SET_LIGHT_AMBIENT_COLOR + NV2A_MAX_LIGHTS * 128 - 4) {
+                slot = (method - NV097_SET_LIGHT_AMBIENT_COLOR) / 4;
+                unsigned int light_index = slot / 32; /* [Light index] */
+                m_ffLightsDirty = true;
+                assert(light_index < NV2A_MAX_LIGHTS);
+                slot %= 32;
+                unsigned int part = NV097_SET_LIGHT_AMBIENT_COLOR / 4 + slot;
+                float value = *(float*)&parameter;
+
+                if (part >= NV097_SET_LIGHT_AMBIENT_COLOR / 4 && part < NV097_SET_LIGHT_AMBIENT_COLOR / 4 + 3) {
+                    part -= NV097_SET_LIGHT_AMBIENT_COLOR / 4;
+                    m_PGRAPH.ltctxb[NV_IGRAPH_XF_LTCTXB_L0_AMB + light_index * 6][part] = parameter;
+                    m_PGRAPH.ltctxb_dirty[NV_IGRAPH_XF_LTCTXB_L0_AMB + light_index * 6] = true;
+                }
+                else if (part >= NV097_SET_LIGHT_DIFFUSE_COLOR / 4 && part < NV097_SET_LIGHT_DIFFUSE_COLOR / 4 + 3) {
+                    part -= NV097_SET_LIGHT_DIFFUSE_COLOR / 4;
+                    m_PGRAPH.ltctxb[NV_IGRAPH_XF_LTCTXB_L0_DIF + light_index * 6][part] = parameter;
+                    m_PGRAPH.ltctxb_dirty[NV_IGRAPH_XF_LTCTXB_L0_DIF + light_index * 6] = true;
+                }
+                else if (part >= NV097_SET_LIGHT_SPECULAR_COLOR / 4 && part < NV097_SET_LIGHT_SPECULAR_COLOR / 4 + 3) {
+                    part -= NV097_SET_LIGHT_SPECULAR_COLOR / 4;
+                    m_PGRAPH.ltctxb[NV_IGRAPH_XF_LTCTXB_L0_SPC + light_index * 6][part] = parameter;
+                    m_PGRAPH.ltctxb_dirty[NV_IGRAPH_XF_LTCTXB_L0_SPC + light_index * 6] = true;
+                }
+                else if (part >= NV097_SET_LIGHT_INFINITE_HALF_VECTOR / 4 && part < NV097_SET_LIGHT_INFINITE_HALF_VECTOR / 4 + 3) {
+                    part -= NV097_SET_LIGHT_INFINITE_HALF_VECTOR / 4;
+                    m_PGRAPH.light_infinite_half_vector[light_index][part] = value;
+                }
+                else if (part >= NV097_SET_LIGHT_INFINITE_DIRECTION / 4 && part < NV097_SET_LIGHT_INFINITE_DIRECTION / 4 + 3) {
+                    part -= NV097_SET_LIGHT_INFINITE_DIRECTION / 4;
+                    m_PGRAPH.light_infinite_direction[light_index][part] = value;
+                }
+                else if (part >= NV097_SET_LIGHT_SPOT_FALLOFF / 4 && part < NV097_SET_LIGHT_SPOT_FALLOFF / 4 + 3) {
+                    part -= NV097_SET_LIGHT_SPOT_FALLOFF / 4;
+                    m_PGRAPH.ltctxa[NV_IGRAPH_XF_LTCTXA_L0_K + light_index * 2][part] = parameter;
+                    m_PGRAPH.ltctxa_dirty[NV_IGRAPH_XF_LTCTXA_L0_K + light_index * 2] = true;
+                }
+                else if (part >= NV097_SET_LIGHT_SPOT_DIRECTION / 4 && part < NV097_SET_LIGHT_SPOT_DIRECTION / 4 + 4) {
+                    part -= NV097_SET_LIGHT_SPOT_DIRECTION / 4;
+                    m_PGRAPH.ltctxa[NV_IGRAPH_XF_LTCTXA_L0_SPT + light_index * 2][part] = parameter;
+                    m_PGRAPH.ltctxa_dirty[NV_IGRAPH_XF_LTCTXA_L0_SPT + light_index * 2] = true;
+                }
+                else if (part >= NV097_SET_LIGHT_LOCAL_POSITION / 4 && part < NV097_SET_LIGHT_LOCAL_POSITION / 4 + 3) {
+                    part -= NV097_SET_LIGHT_LOCAL_POSITION / 4;
+                    m_PGRAPH.light_local_position[light_index][part] = value;
+                }
+                else if (part >= NV097_SET_LIGHT_LOCAL_ATTENUATION / 4 && part < NV097_SET_LIGHT_LOCAL_ATTENUATION / 4 + 3) {
+                    part -= NV097_SET_LIGHT_LOCAL_ATTENUATION / 4;
+                    m_PGRAPH.light_local_attenuation[light_index][part] = value;
+                }
+                else if (part == NV097_SET_LIGHT_LOCAL_RANGE / 4) {
+                    m_PGRAPH.ltc1[NV_IGRAPH_XF_LTC1_r0 + light_index][0] = parameter;
+                    m_PGRAPH.ltc1_dirty[NV_IGRAPH_XF_LTC1_r0 + light_index] = true;
+                }
+                else {
+                    log_warning("EmuNV2A: Unknown light method 0x%08X\n", method);
+                }
+                break;
+            }
+
             if (method >= NV097_SET_COMBINER_ALPHA_ICW && method <= NV097_SET_COMBINER_ALPHA_ICW + 28) {
                 slot = (method - NV097_SET_COMBINER_ALPHA_ICW) / 4;
                 m_PGRAPH.regs[NV_PGRAPH_COMBINEALPHAI0 + slot * 4] = parameter;
@@ -2122,6 +2687,7 @@ void NV2ADevice::pgraph_method(unsigned int subchannel, unsigned int method, uin
                 // ??
                 m_PGRAPH.ltctxa[NV_IGRAPH_XF_LTCTXA_FR_AMB][slot] = parameter;
                 m_PGRAPH.ltctxa_dirty[NV_IGRAPH_XF_LTCTXA_FR_AMB] = true;
+                m_ffLightsDirty = true;
                 break;
             }
 
@@ -2163,6 +2729,12 @@ void NV2ADevice::pgraph_method(unsigned int subchannel, unsigned int method, uin
                 break;
             }
 
+            if (method >= NV097_SET_COMBINER_COLOR_OCW && method <= NV097_SET_COMBINER_COLOR_OCW + 28) {
+                slot = (method - NV097_SET_COMBINER_COLOR_OCW) / 4;
+                m_PGRAPH.regs[NV_PGRAPH_COMBINECOLORO0 + slot * 4] = parameter;
+                break;
+            }
+
             if (method >= NV097_SET_VIEWPORT_SCALE && method <= NV097_SET_VIEWPORT_SCALE + 12) {
                 slot = (method - NV097_SET_VIEWPORT_SCALE) / 4;
                 m_PGRAPH.vsh_constants[NV_IGRAPH_XF_XFCTX_VPSCL][slot] = parameter;
@@ -2189,6 +2761,8 @@ void NV2ADevice::pfifo_run_pusher() {
     uint8_t *dma;
     uint32_t dma_len;
     uint32_t word;
+    uint32_t dma_get;
+    uint32_t dma_put;
 
     /* TODO: How is cache1 selected? */
     state = &m_PFIFO.cache1;
@@ -2212,19 +2786,59 @@ void NV2ADevice::pfifo_run_pusher() {
 
     dma = (uint8_t*)nv_dma_map(state->dma_instance, &dma_len);
 
+    std::chrono::steady_clock::time_point profileStart;
+    if (m_profiler != nullptr) {
+        profileStart = std::chrono::steady_clock::now();
+    }
+    uint32_t wordCount = 0;
+    uint32_t jumpCount = 0;
+    uint32_t callCount = 0;
+    uint32_t returnCount = 0;
+
+    dma_get = control->dma_get.load(std::memory_order_relaxed);
+    dma_put = control->dma_put.load(std::memory_order_acquire);
+
     log_debug("DMA pusher: max 0x%08X, 0x%08X - 0x%08X\n",
-        dma_len, control->dma_get, control->dma_put);
+        dma_len, dma_get, dma_put);
+
+    // Commands are handed to the puller in batches. DMA_GET is only
+    // published after the batch that contains the words before it is in
+    // CACHE1, so the guest never sees GET advance past commands that are
+    // not pending yet.
+    CacheEntry *batch[PFIFO_PUSHER_BATCH_SIZE];
+    unsigned int batchCount = 0;
+    auto flushBatch = [&]() {
+        if (batchCount > 0) {
+            std::lock_guard<std::mutex> lk(state->mutex);
+            for (unsigned int i = 0; i < batchCount; i++) {
+                state->cache.push(batch[i]);
+            }
+            state->cache_cond.notify_all();
+            batchCount = 0;
+        }
+        control->dma_get.store(dma_get, std::memory_order_release);
+    };
 
     /* based on the convenient pseudocode in envytools */
     /* See: http://envytools.readthedocs.io/en/latest/hw/fifo/dma-pusher.html */
-    while (control->dma_get != control->dma_put) {
-        if (control->dma_get >= dma_len) {
+    while (true) {
+        if (dma_get == dma_put) {
+            // Pick up doorbells rung while this batch was being parsed
+            flushBatch();
+            dma_put = control->dma_put.load(std::memory_order_acquire);
+            if (dma_get == dma_put) {
+                break;
+            }
+        }
+
+        if (dma_get >= dma_len) {
             state->error = NV_PFIFO_CACHE1_DMA_STATE_ERROR_PROTECTION;
             break;
         }
 
-        word = ldl_le_p((uint32_t*)(dma + control->dma_get));
-        control->dma_get += 4;
+        word = ldl_le_p((uint32_t*)(dma + dma_get));
+        dma_get += 4;
+        wordCount++;
 
         if (state->method_count) {
             /* data word of methods command */
@@ -2236,9 +2850,10 @@ void NV2ADevice::pfifo_run_pusher() {
             command->nonincreasing = state->method_nonincreasing;
             command->parameter = word;
 
-            std::lock_guard<std::mutex> lk(state->mutex);
-            state->cache.push(command);
-            state->cache_cond.notify_all();
+            batch[batchCount++] = command;
+            if (batchCount == PFIFO_PUSHER_BATCH_SIZE) {
+                flushBatch();
+            }
 
             if (!state->method_nonincreasing) {
                 state->method += 4;
@@ -2253,15 +2868,17 @@ void NV2ADevice::pfifo_run_pusher() {
             /* match all forms */
             if ((word & 0xe0000003) == 0x20000000) {
                 /* old jump */
-                state->get_jmp_shadow = control->dma_get;
-                control->dma_get = word & 0x1fffffff;
-                log_debug("pb OLD_JMP 0x%08X\n", control->dma_get);
+                state->get_jmp_shadow = dma_get;
+                dma_get = word & 0x1fffffff;
+                jumpCount++;
+                log_debug("pb OLD_JMP 0x%08X\n", dma_get);
             }
             else if ((word & 3) == 1) {
                 /* jump */
-                state->get_jmp_shadow = control->dma_get;
-                control->dma_get = word & 0xfffffffc;
-                log_debug("pb JMP 0x%08X\n", control->dma_get);
+                state->get_jmp_shadow = dma_get;
+                dma_get = word & 0xfffffffc;
+                jumpCount++;
+                log_debug("pb JMP 0x%08X\n", dma_get);
             }
             else if ((word & 3) == 2) {
                 /* call */
@@ -2269,10 +2886,11 @@ void NV2ADevice::pfifo_run_pusher() {
                     state->error = NV_PFIFO_CACHE1_DMA_STATE_ERROR_CALL;
                     break;
                 }
-                state->subroutine_return = control->dma_get;
+                state->subroutine_return = dma_get;
                 state->subroutine_active = true;
-                control->dma_get = word & 0xfffffffc;
-                log_debug("pb CALL 0x%08X\n", control->dma_get);
+                dma_get = word & 0xfffffffc;
+                callCount++;
+                log_debug("pb CALL 0x%08X\n", dma_get);
             }
             else if (word == 0x00020000) {
                 /* return */
@@ -2280,9 +2898,10 @@ void NV2ADevice::pfifo_run_pusher() {
                     state->error = NV_PFIFO_CACHE1_DMA_STATE_ERROR_RETURN;
                     break;
                 }
-                control->dma_get = state->subroutine_return;
+                dma_get = state->subroutine_return;
                 state->subroutine_active = false;
-                log_debug("pb RET 0x%08X\n", control->dma_get);
+                returnCount++;
+                log_debug("pb RET 0x%08X\n", dma_get);
             }
             else if ((word & 0xe0030003) == 0) {
                 /* increasing methods */
@@ -2302,15 +2921,22 @@ void NV2ADevice::pfifo_run_pusher() {
             }
             else {
                 log_debug("pb reserved cmd 0x%08X - 0x%08X\n",
-                    control->dma_get, word);
+                    dma_get, word);
                 state->error = NV_PFIFO_CACHE1_DMA_STATE_ERROR_RESERVED_CMD;
                 break;
             }
         }
     }
 
+    flushBatch();
+
+    if (m_profiler != nullptr) {
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - profileStart);
+        m_profiler->AddPusherRun((uint64_t)wordCount * 4, jumpCount, callCount, returnCount, elapsed.count());
+    }
+
     log_debug("DMA pusher done: max 0x%08X, 0x%08X - 0x%08X\n",
-        dma_len, control->dma_get, control->dma_put);
+        dma_len, dma_get, dma_put);
 
     if (state->error) {
         log_warning("pb error: %d\n", state->error);
@@ -2323,6 +2949,62 @@ void NV2ADevice::pfifo_run_pusher() {
     }
 }
 
+void NV2ADevice::pfifo_kick_pusher() {
+    Cache1State *state = &m_PFIFO.cache1;
+
+    std::lock_guard<std::mutex> lk(state->pusher_mutex);
+    state->pusher_kicked = true;
+    state->pusher_cond.notify_one();
+}
+
+void NV2ADevice::pfifo_wait_pusher_idle() {
+    pfifo_lock_pusher_idle();
+}
+
+std::unique_lock<std::mutex> NV2ADevice::pfifo_lock_pusher_idle() {
+    Cache1State *state = &m_PFIFO.cache1;
+
+    std::unique_lock<std::mutex> lk(state->pusher_mutex);
+    state->pusher_idle_cond.wait(lk, [&]() -> bool { return !state->pusher_kicked && !state->pusher_busy; });
+    return lk;
+}
+
+bool NV2ADevice::pfifo_pusher_idle() {
+    Cache1State *state = &m_PFIFO.cache1;
+
+    std::lock_guard<std::mutex> lk(state->pusher_mutex);
+    return !state->pusher_kicked && !state->pusher_busy;
+}
+
+void NV2ADevice::PFIFO_Pusher_Thread(NV2ADevice *nv2a) {
+    Thread_SetName("[HW] NV2A PFIFO Pusher");
+
+    Cache1State *state = &nv2a->m_PFIFO.cache1;
+    std::unique_lock<std::mutex> lk(state->pusher_mutex);
+    while (nv2a->m_running) {
+        state->pusher_cond.wait(lk, [&]() -> bool { return state->pusher_kicked || !nv2a->m_running; });
+        if (!nv2a->m_running) {
+            break;
+        }
+
+        state->pusher_kicked = false;
+        state->pusher_busy = true;
+        lk.unlock();
+
+        nv2a->pfifo_run_pusher();
+
+        lk.lock();
+        state->pusher_busy = false;
+        if (!state->pusher_kicked) {
+            state->pusher_idle_cond.notify_all();
+        }
+    }
+
+    // Don't leave anyone waiting on a pusher that is gone
+    state->pusher_kicked = false;
+    state->pusher_idle_cond.notify_all();
+}
+
 void NV2ADevice::PFIFO_Puller_Thread(NV2ADevice *nv2a) {
     Thread_SetName("[HW] NV2A PFIFO Puller");
 
@@ -2346,6 +3028,16 @@ void NV2ADevice::PFIFO_Puller_Thread(NV2ADevice *nv2a) {
             }
         }
 
+        // Capture the memory the new batch of commands may refer to
+        if (nv2a->m_trace != nullptr) {
+            nv2a->m_trace->SyncMemory();
+        }
+
+        std::chrono::steady_clock::time_point profileStart;
+        if (nv2a->m_profiler != nullptr) {
+            profileStart = std::chrono::steady_clock::now();
+        }
+
         while (!state->working_cache.empty()) {
             CacheEntry* command = state->working_cache.front();
             state->working_cache.pop();
@@ -2362,6 +3054,9 @@ void NV2ADevice::PFIFO_Puller_Thread(NV2ADevice *nv2a) {
                 case ENGINE_GRAPHICS:
                     nv2a->pgraph_context_switch(entry.channel_id);
                     nv2a->pgraph_wait_fifo_access();
+                    if (nv2a->m_trace != nullptr) {
+                        nv2a->m_trace->WriteMethod(entry.channel_id, command->subchannel, 0, entry.instance);
+                    }
                     nv2a->pgraph_method(command->subchannel, 0, entry.instance);
                     break;
                 default:
@@ -2397,6 +3092,9 @@ void NV2ADevice::PFIFO_Puller_Thread(NV2ADevice *nv2a) {
                 switch (engine) {
                 case ENGINE_GRAPHICS:
                     nv2a->pgraph_wait_fifo_access();
+                    if (nv2a->m_trace != nullptr) {
+                        nv2a->m_trace->WriteMethod(state->channel_id, command->subchannel, command->method, parameter);
+                    }
                     nv2a->pgraph_method(command->subchannel, command->method, parameter);
                     break;
                 default:
@@ -2411,6 +3109,111 @@ void NV2ADevice::PFIFO_Puller_Thread(NV2ADevice *nv2a) {
 
             free(command);
         }
+
+        if (nv2a->m_profiler != nullptr) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - profileStart);
+            nv2a->m_profiler->AddPullerTime(elapsed.count());
+        }
+    }
+}
+
+bool NV2ADevice::StartTrace(const char *path) {
+    if (m_running) {
+        log_warning("NV2ADevice::StartTrace: Trace must be started before the device is initialized\n");
+        return false;
+    }
+
+    StopTrace();
+
+    m_trace = new NV2ATraceWriter();
+    if (!m_trace->Open(path, m_pSystemRAM, m_systemRAMSize, m_pRAMIN, NV_PRAMIN_SIZE)) {
+        delete m_trace;
+        m_trace = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void NV2ADevice::StopTrace() {
+    if (m_trace != nullptr) {
+        m_trace->Close();
+        delete m_trace;
+        m_trace = nullptr;
+    }
+}
+
+uint64_t NV2ADevice::ReplayTrace(NV2ATraceReader& reader) {
+    const NV2ATraceHeader *header = reader.GetHeader();
+    if (header->ramSize > m_systemRAMSize || header->raminSize > NV_PRAMIN_SIZE) {
+        log_warning("NV2A trace: Trace requires %u bytes of RAM, but only %u are available\n", header->ramSize, m_systemRAMSize);
+        return 0;
+    }
+
+    uint64_t methodCount = 0;
+    const uint8_t *pageData;
+    const uint8_t *record;
+    while ((record = reader.Next(&pageData)) != nullptr) {
+        switch (record[0]) {
+        case NV2A_TRACE_RECORD_METHOD:
+        {
+            const NV2ATraceMethod *method = (const NV2ATraceMethod *)record;
+
+            // Replay the channel switches the puller would have performed
+            m_PGRAPH.channel_id = method->channel;
+            m_PGRAPH.channel_valid = true;
+            pgraph_method(method->subchannel, method->method, method->parameter);
+            methodCount++;
+            break;
+        }
+        case NV2A_TRACE_RECORD_MEMORY:
+        case NV2A_TRACE_RECORD_MEMORY_ZERO:
+        {
+            const NV2ATraceMemory *memory = (const NV2ATraceMemory *)record;
+            uint8_t *base = (memory->space == NV2A_TRACE_SPACE_RAMIN) ? m_pRAMIN : m_pSystemRAM;
+            uint32_t size = (memory->space == NV2A_TRACE_SPACE_RAMIN) ? NV_PRAMIN_SIZE : m_systemRAMSize;
+            if (memory->address + NV2A_TRACE_PAGE_SIZE > size) {
+                log_warning("NV2A trace: Memory record out of range: 0x%08x\n", memory->address);
+                break;
+            }
+            if (pageData != nullptr) {
+                memcpy(base + memory->address, pageData, NV2A_TRACE_PAGE_SIZE);
+            }
+            else {
+                memset(base + memory->address, 0, NV2A_TRACE_PAGE_SIZE);
+            }
+            break;
+        }
+        default:
+            log_warning("NV2A trace: Unknown record type %u\n", record[0]);
+            break;
+        }
+    }
+
+    return methodCount;
+}
+
+bool NV2ADevice::StartProfile(const char *path) {
+    if (m_running) {
+        log_warning("NV2ADevice::StartProfile: Profiling must be started before the device is initialized\n");
+        return false;
+    }
+
+    StopProfile();
+
+    m_profiler = new NV2AProfiler();
+    if (!m_profiler->Open(path)) {
+        delete m_profiler;
+        m_profiler = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void NV2ADevice::StopProfile() {
+    if (m_profiler != nullptr) {
+        m_profiler->Close();
+        delete m_profiler;
+        m_profiler = nullptr;
     }
 }
 
@@ -2445,6 +3248,75 @@ void NV2ADevice::UpdateIRQ() {
     }
 }
 
+bool NV2ADevice::StartScanout(const char *shmName, const char *imagePrefix, const char *videoPath) {
+    if (m_running) {
+        log_warning("NV2ADevice::StartScanout: Scanout must be started before the device is initialized\n");
+        return false;
+    }
+
+    bool result = true;
+    if (shmName != nullptr) {
+        result &= m_scanout.OpenSharedMemory(shmName);
+    }
+    if (imagePrefix != nullptr) {
+        result &= m_scanout.OpenImageOutput(imagePrefix);
+    }
+    if (videoPath != nullptr) {
+        result &= m_scanout.OpenVideoOutput(videoPath);
+    }
+    return result;
+}
+
+void NV2ADevice::StopScanout() {
+    m_scanout.Close();
+}
+
+ScanoutMode NV2ADevice::pcrtc_get_scanout_mode() {
+    uint8_t *cr = m_PRMCIO.cr;
+    ScanoutMode mode;
+
+    mode.address = m_PCRTC.start;
+
+    switch (cr[NV_CIO_CRE_PIXEL_INDEX] & NV_CIO_CRE_PIXEL_FORMAT) {
+    case NV_CIO_CRE_PIXEL_FORMAT_16BPP:
+        mode.format = (m_PRAMDAC.regs[NV_PRAMDAC_GENERAL_CONTROL] & NV_PRAMDAC_GENERAL_CONTROL_ALT_MODE_SEL)
+            ? SCANOUT_FORMAT_R5G6B5
+            : SCANOUT_FORMAT_X1R5G5B5;
+        break;
+    case NV_CIO_CRE_PIXEL_FORMAT_32BPP:
+        mode.format = SCANOUT_FORMAT_X8R8G8B8;
+        break;
+    default:
+        mode.format = SCANOUT_FORMAT_NONE;
+        break;
+    }
+
+    // The line offset is programmed in units of 8 bytes
+    uint32_t offset = cr[VGA_CRTC_OFFSET]
+        | (((cr[NV_CIO_CRE_RPC0_INDEX] & NV_CIO_CRE_RPC0_OFFSET_10_8) >> 5) << 8)
+        | ((cr[NV_CIO_CRE_42] & NV_CIO_CRE_42_OFFSET_11) ? (1 << 11) : 0);
+    mode.pitch = offset * 8;
+
+    // The flat panel timings hold the active area as programmed for the
+    // video encoder; fall back to the CRTC display end registers
+    if (m_PRAMDAC.regs[NV_PRAMDAC_FP_HDISPLAY_END] != 0 && m_PRAMDAC.regs[NV_PRAMDAC_FP_VDISPLAY_END] != 0) {
+        mode.width = m_PRAMDAC.regs[NV_PRAMDAC_FP_HDISPLAY_END] + 1;
+        mode.height = m_PRAMDAC.regs[NV_PRAMDAC_FP_VDISPLAY_END] + 1;
+    }
+    else {
+        uint32_t hde = cr[VGA_CRTC_H_DISP]
+            | ((cr[NV_CIO_CRE_HEB__INDEX] & NV_CIO_CRE_HEB_HDE_8) ? (1 << 8) : 0);
+        uint32_t vde = cr[VGA_CRTC_V_DISP_END]
+            | ((cr[VGA_CRTC_OVERFLOW] & (1 << 1)) << 7)
+            | ((cr[VGA_CRTC_OVERFLOW] & (1 << 6)) << 3)
+            | ((cr[NV_CIO_CRE_LSR_INDEX] & NV_CIO_CRE_LSR_VDE_10) << 9);
+        mode.width = (hde + 1) * 8;
+        mode.height = vde + 1;
+    }
+
+    return mode;
+}
+
 void NV2ADevice::VBlankThread(NV2ADevice *nv2a) {
     Thread_SetName("[HW] NV2A VBlank");
 
@@ -2459,6 +3331,14 @@ void NV2ADevice::VBlankThread(NV2ADevice *nv2a) {
             nv2a->UpdateIRQ();
         }
 
+        if (nv2a->m_scanout.IsEnabled()) {
+            nv2a->m_scanout.Present(nv2a->pcrtc_get_scanout_mode());
+        }
+
+        if (nv2a->m_profiler != nullptr) {
+            nv2a->m_profiler->VBlank();
+        }
+
         nextStop += interval;
         std::this_thread::sleep_until(nextStop);
     }
@@ -6,6 +6,14 @@
 #include "pci.h"
 #include "../nv2a/defs.h"
 #include "../nv2a/vga.h"
+#include "../nv2a/vsh.h"
+#include "../nv2a/psh.h"
+#include "../nv2a/surface.h"
+#include "../nv2a/blit.h"
+#include "../nv2a/clear.h"
+#include "../nv2a/trace.h"
+#include "../nv2a/scanout.h"
+#include "../nv2a/profile.h"
 #include "../basic/irq.h"
 
 namespace openxbox {
@@ -27,6 +35,30 @@ public:
     void PCIMMIORead(int barIndex, uint32_t addr, uint32_t *value, uint8_t size) override;
     void PCIMMIOWrite(int barIndex, uint32_t addr, uint32_t value, uint8_t size) override;
 
+    // Pushbuffer tracing. Capture must be started before the device is
+    // initialized, since the PFIFO and VBlank threads use the trace writer
+    // without synchronization.
+    bool StartTrace(const char *path);
+    void StopTrace();
+
+    // Feeds a captured trace straight into PGRAPH, bypassing PFIFO. Returns
+    // the number of methods executed.
+    uint64_t ReplayTrace(NV2ATraceReader& reader);
+
+    // Render target cache statistics
+    const SurfaceManager& GetSurfaces() const { return m_surfaces; }
+
+    // Headless display capture. Any of the outputs may be nullptr. Must be
+    // started before the device is initialized, since the VBlank thread
+    // presents frames without synchronization.
+    bool StartScanout(const char *shmName, const char *imagePrefix, const char *videoPath);
+    void StopScanout();
+
+    // Per-frame command stream statistics, written as CSV or JSON. Must be
+    // started before the device is initialized.
+    bool StartProfile(const char *path);
+    void StopProfile();
+
 private:
     const NV2ABlockInfo* FindBlock(uint32_t addr);
 
@@ -100,8 +132,20 @@ private:
     void pgraph_wait_fifo_access();
     void pgraph_method_log(unsigned int subchannel, unsigned int graphics_class, unsigned int method, uint32_t parameter);
     void pgraph_method(unsigned int subchannel, unsigned int method, uint32_t parameter);
+    void pgraph_image_blit(ImageBlitState *image_blit);
+    void pgraph_clear_surface(uint32_t parameter);
+    void pgraph_clear_surface_part(bool color, uint32_t parameter);
     bool pgraph_color_write_enabled();
     bool pgraph_zeta_write_enabled();
+    bool pgraph_get_surface_key(bool color, SurfaceKey *key);
+    void pgraph_update_surface_part(bool upload, bool rebind, bool color, bool write);
+    void pgraph_update_surface(bool upload, bool color_write, bool zeta_write);
+    const VshProgram *pgraph_get_vertex_program();
+    void pgraph_load_fixed_function_constants();
+    void pgraph_prepare_vertex_program();
+    const PshProgram *pgraph_get_combiner_program();
+    void pgraph_load_combiner_constants(PshConstants *constants);
+    void pgraph_prepare_combiners();
 
     unsigned int kelvin_map_stencil_op(uint32_t parameter);
     unsigned int kelvin_map_polygon_mode(uint32_t parameter);
@@ -114,7 +158,14 @@ private:
     void *nv_dma_map(uint32_t dma_obj_address, uint32_t *len);
 
     void pfifo_run_pusher();
-
+    void pfifo_kick_pusher();
+    void pfifo_wait_pusher_idle();
+    // Waits for the pusher to go idle and keeps it from starting again
+    // until the returned lock is released
+    std::unique_lock<std::mutex> pfifo_lock_pusher_idle();
+    bool pfifo_pusher_idle();
+
+    static void PFIFO_Pusher_Thread(NV2ADevice* pNV2a);
     static void PFIFO_Puller_Thread(NV2ADevice* pNV2a);
     static void VBlankThread(NV2ADevice* pNV2A);
 
@@ -139,7 +190,32 @@ private:
 
     VGACommonState m_VGAState;
 
-    bool m_running;
+    VshEngine m_VSH;
+    const VshProgram *m_vertexProgram = nullptr;
+    uint64_t m_vertexProgramGeneration = 0;
+    float m_ffConstants[NV2A_VERTEXSHADER_CONSTANTS][4];
+    bool m_ffLightsDirty = true;    // lighting rows of m_ffConstants are stale
+
+    PshEngine m_PSH;
+    const PshProgram *m_combinerProgram = nullptr;  // valid until the next draw
+    PshConstants m_combinerConstants;
+
+    SurfaceManager m_surfaces;
+    ClearEngine m_clear;
+    SurfaceKey m_boundColorSurface;
+    SurfaceKey m_boundZetaSurface;
+    bool m_colorSurfaceBound = false;
+    bool m_zetaSurfaceBound = false;
+    bool m_surfacesDirty = true;      // surface state changed since the last bind
+
+    NV2ATraceWriter *m_trace = nullptr;
+
+    ScanoutMode pcrtc_get_scanout_mode();
+    Scanout m_scanout;
+
+    NV2AProfiler *m_profiler = nullptr;
+
+    bool m_running = false;
     std::vector<NV2ABlockInfo> m_MemoryRegions;
     std::thread m_VblankThread;
 };
@@ -39,35 +39,98 @@
 // ******************************************************************
 
 #include "nvapu.h"
+#include "../audio/mix.h"
 #include "openxbox/log.h"
+#include "openxbox/thread.h"
+
+#include <chrono>
+#include <cstring>
 
 namespace openxbox {
 
-uint32_t GetAPUTime() {
-    // This timer counts at 48000 Hz
-    auto t = std::chrono::high_resolution_clock::now();
-    return static_cast<uint32_t>(t.time_since_epoch().count() * 0.000048000);
+// Frames processed every time the audio thread wakes up
+#define APU_FRAMES_PER_WAKEUP   4
+
+// How far the audio thread may fall behind before it skips ahead
+#define APU_MAX_LATE_FRAMES     (NV_PAPU_SAMPLE_RATE / NV_PAPU_FRAME_SAMPLES / 10)
+
+// Cycles each DSP may run per frame
+#define APU_DSP_CYCLES_PER_FRAME (NV_PAPU_DSP_CLOCK / NV_PAPU_SAMPLE_RATE * NV_PAPU_FRAME_SAMPLES)
+
+// Words kept in the FIFOs between the DSPs and towards the sink before the
+// oldest are dropped
+#define APU_DSP_FIFO_BACKLOG    (NV_PAPU_FRAME_SAMPLES * 2 * 4)
+
+// A DSP runs when both the processor and its DSP core are out of reset. The
+// GP and EP use the same bits.
+static inline bool dspRunning(uint32_t rst) {
+    const uint32_t mask = NV_PAPU_GPRST_GPRST | NV_PAPU_GPRST_GPDSPRST;
+    return (rst & mask) == mask;
 }
 
-// TODO: Everything :P
-// TODO: Audio Processing/Thread
+static inline void trimFIFO(std::deque<uint32_t>& fifo) {
+    while (fifo.size() > APU_DSP_FIFO_BACKLOG) {
+        fifo.pop_front();
+    }
+}
 
-NVAPUDevice::NVAPUDevice(uint16_t vendorID, uint16_t deviceID, uint8_t revisionID)
+NVAPUDevice::NVAPUDevice(uint16_t vendorID, uint16_t deviceID, uint8_t revisionID, uint8_t *ram, uint32_t ramSize, IRQHandler *irqHandler)
     : PCIDevice(PCI_HEADER_TYPE_NORMAL, vendorID, deviceID, revisionID,
         0x0f, 0x02, 0x00) // Audio controller
+    , m_ram(ram)
+    , m_ramSize(ramSize)
+    , m_irqHandler(irqHandler)
+    , m_vp(ram, ramSize, m_regs)
+    , m_gp("GP", NV_PAPU_GP_XMEM_SIZE, NV_PAPU_GP_YMEM_SIZE, NV_PAPU_GP_PMEM_SIZE, ram, ramSize,
+        &m_regs[NV_PAPU_GPSADDR / 4], &m_regs[NV_PAPU_GPSMAXSGE / 4])
+    , m_ep("EP", NV_PAPU_EP_XMEM_SIZE, NV_PAPU_EP_YMEM_SIZE, NV_PAPU_EP_PMEM_SIZE, ram, ramSize,
+        &m_regs[NV_PAPU_EPSADDR / 4], &m_regs[NV_PAPU_EPSMAXSGE / 4])
 {
+    memset(m_regs, 0, sizeof(m_regs));
+    m_vp.Reset();
 }
 
 NVAPUDevice::~NVAPUDevice() {
+    m_running = false;
+    if (m_audioThread.joinable()) {
+        m_audioThread.join();
+    }
+    SetAudioSink(nullptr);
+}
+
+bool NVAPUDevice::SetAudioSink(hw::audio::AudioSink *sink) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (m_sink != nullptr) {
+        m_sink->Stop();
+    }
+
+    m_sink = sink;
+    if (m_sink != nullptr && !m_sink->Start(NV_PAPU_SAMPLE_RATE, 2)) {
+        m_sink = nullptr;
+        return false;
+    }
+    return true;
 }
 
 // PCI Device functions
 
 void NVAPUDevice::Init() {
     RegisterBAR(0, 0x80000, PCI_BAR_TYPE_MEMORY); // 0xFE800000 - 0xFE87FFFF
+
+    Write8(m_configSpace, PCI_INTERRUPT_PIN, 1);
+
+    m_running = true;
+    m_audioThread = std::thread(AudioThread, this);
 }
 
 void NVAPUDevice::Reset() {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    memset(m_regs, 0, sizeof(m_regs));
+    m_vp.Reset();
+    m_gp.Reset();
+    m_ep.Reset();
+    m_gpRst = 0;
+    m_epRst = 0;
 }
 
 void NVAPUDevice::PCIIORead(int barIndex, uint32_t port, uint32_t *value, uint8_t size) {
@@ -94,12 +157,24 @@ void NVAPUDevice::PCIMMIORead(int barIndex, uint32_t addr, uint32_t *value, uint
         return;
     }
 
-    // FIXME: this satisfies the most basic needs of the guest software
-    if (addr == 0x200C) {
-        *value = GetAPUTime();
+    if (addr >= NV_PAPU_SIZE || size != 4) {
+        log_spew("NVAPUDevice::PCIMMIORead:   Unhandled read!  bar = %d,  address = 0x%x,  size = %u\n", barIndex, addr, size);
+        *value = 0;
+        return;
     }
 
-    log_spew("NVAPUDevice::PCIMMIORead:   Unhandled read!  bar = %d,  address = 0x%x,  size = %u\n", barIndex, addr, size);
+    switch (addr) {
+    case NV_PAPU_XGSCNT:
+        // The audio clock counts samples at 48 kHz
+        *value = (uint32_t)(m_frameCount * NV_PAPU_FRAME_SAMPLES);
+        break;
+    default:
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        *value = m_regs[addr / 4];
+        break;
+    }
+    }
 }
 
 void NVAPUDevice::PCIMMIOWrite(int barIndex, uint32_t addr, uint32_t value, uint8_t size) {
@@ -109,46 +184,275 @@ void NVAPUDevice::PCIMMIOWrite(int barIndex, uint32_t addr, uint32_t value, uint
     }
 
     if (addr >= APU_GP_BASE && addr < APU_GP_BASE + APU_GP_SIZE) {
-        VPWrite(addr - APU_GP_BASE, value, size);
+        GPWrite(addr - APU_GP_BASE, value, size);
         return;
     }
 
     if (addr >= APU_EP_BASE && addr < APU_EP_BASE + APU_EP_SIZE) {
-        VPWrite(addr - APU_EP_BASE, value, size);
+        EPWrite(addr - APU_EP_BASE, value, size);
         return;
     }
 
-    log_spew("NVAPUDevice::PCIMMIOWrite:  Unhandled write!  bar = %d,  address = 0x%x,  value = 0x%x,  size = %u\n", barIndex, addr, value, size);
+    if (addr >= NV_PAPU_SIZE || size != 4) {
+        log_spew("NVAPUDevice::PCIMMIOWrite:  Unhandled write!  bar = %d,  address = 0x%x,  value = 0x%x,  size = %u\n", barIndex, addr, value, size);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lk(m_mutex);
+    switch (addr) {
+    case NV_PAPU_ISTS:
+        // Writing 1 clears the interrupt bits
+        m_regs[addr / 4] &= ~value;
+        UpdateIRQ();
+        break;
+    case NV_PAPU_IEN:
+        m_regs[addr / 4] = value;
+        UpdateIRQ();
+        break;
+    case NV_PAPU_XGSCNT:
+        break;
+    default:
+        m_regs[addr / 4] = value;
+        break;
+    }
 }
 
 void NVAPUDevice::GPRead(uint32_t address, uint32_t *value, uint8_t size) {
-    log_spew("NVAPUDevice::GPRead:   Unimplemented!  address = 0x%x,  size = %u\n", address, size);
+    if (size == 4) {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        if (address == NV_PAPU_GPRST) {
+            *value = m_gpRst;
+            return;
+        }
+        if (DSPRead(m_gp, address, value)) {
+            return;
+        }
+    }
+
+    log_spew("NVAPUDevice::GPRead:   Unhandled read!  address = 0x%x,  size = %u\n", address, size);
+    *value = 0;
 }
 
 void NVAPUDevice::GPWrite(uint32_t address, uint32_t value, uint8_t size) {
-    log_spew("NVAPUDevice::GPWrite:  Unimplemented!  address = 0x%x,  value = 0x%x,  size = %u\n", address, value, size);
+    if (size == 4) {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        if (address == NV_PAPU_GPRST) {
+            m_gpRst = value;
+            if (!dspRunning(m_gpRst)) {
+                m_gp.Reset();
+            }
+            return;
+        }
+        if (DSPWrite(m_gp, address, value)) {
+            return;
+        }
+    }
+
+    log_spew("NVAPUDevice::GPWrite:  Unhandled write!  address = 0x%x,  value = 0x%x,  size = %u\n", address, value, size);
 }
 
 void NVAPUDevice::EPRead(uint32_t address, uint32_t *value, uint8_t size) {
-    log_spew("NVAPUDevice::EPRead:   Unimplemented!  address = 0x%x,  size = %u\n", address, size);
+    if (size == 4) {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        if (address == NV_PAPU_EPRST) {
+            *value = m_epRst;
+            return;
+        }
+        if (DSPRead(m_ep, address, value)) {
+            return;
+        }
+    }
+
+    log_spew("NVAPUDevice::EPRead:   Unhandled read!  address = 0x%x,  size = %u\n", address, size);
+    *value = 0;
 }
 
 void NVAPUDevice::EPWrite(uint32_t address, uint32_t value, uint8_t size) {
-    log_spew("NVAPUDevice::EPWrite:  Unimplemented!  address = 0x%x,  value = 0x%x,  size = %u\n", address, value, size);
+    if (size == 4) {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        if (address == NV_PAPU_EPRST) {
+            m_epRst = value;
+            if (!dspRunning(m_epRst)) {
+                m_ep.Reset();
+            }
+            return;
+        }
+        if (DSPWrite(m_ep, address, value)) {
+            return;
+        }
+    }
+
+    log_spew("NVAPUDevice::EPWrite:  Unhandled write!  address = 0x%x,  value = 0x%x,  size = %u\n", address, value, size);
+}
+
+// DSP memories are mapped one word per register, so the GP mixbuf window at
+// NV_PAPU_GPMIXBUF falls on X memory at NV_PAPU_GP_MIXBUF_BASE. Must be
+// called with m_mutex held.
+bool NVAPUDevice::DSPRead(hw::audio::DSP56300& dsp, uint32_t address, uint32_t *value) {
+    using namespace hw::audio;
+    if (address < NV_PAPU_GPYMEM) {
+        *value = dsp.ReadMemory(DSP_SpaceX, (address - NV_PAPU_GPXMEM) / 4);
+    }
+    else if (address < NV_PAPU_GPPMEM) {
+        *value = dsp.ReadMemory(DSP_SpaceY, (address - NV_PAPU_GPYMEM) / 4);
+    }
+    else if (address < NV_PAPU_GPRST) {
+        *value = dsp.ReadMemory(DSP_SpaceP, (address - NV_PAPU_GPPMEM) / 4);
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+bool NVAPUDevice::DSPWrite(hw::audio::DSP56300& dsp, uint32_t address, uint32_t value) {
+    using namespace hw::audio;
+    if (address < NV_PAPU_GPYMEM) {
+        dsp.WriteMemory(DSP_SpaceX, (address - NV_PAPU_GPXMEM) / 4, value);
+    }
+    else if (address < NV_PAPU_GPPMEM) {
+        dsp.WriteMemory(DSP_SpaceY, (address - NV_PAPU_GPYMEM) / 4, value);
+    }
+    else if (address < NV_PAPU_GPRST) {
+        dsp.WriteMemory(DSP_SpaceP, (address - NV_PAPU_GPPMEM) / 4, value);
+    }
+    else {
+        return false;
+    }
+    return true;
 }
 
 void NVAPUDevice::VPRead(uint32_t address, uint32_t *value, uint8_t size) {
-    // FIXME: HACK: Pretend the FIFO is always empty, bypasses hangs when APU isn't fully implemented
-    if (address == 0x10) {
+    // Methods are executed as soon as they are written, so the FIFO always
+    // has room for more
+    if (address == NV1BA0_PIO_FREE) {
         *value = 0x80;
         return;
     }
 
     log_spew("NVAPUDevice::VPRead:   Unimplemented!  address = 0x%x,  size = %u\n", address, size);
+    *value = 0;
 }
 
 void NVAPUDevice::VPWrite(uint32_t address, uint32_t value, uint8_t size) {
-    log_spew("NVAPUDevice::VPWrite:  Unimplemented!  address = 0x%x,  value = 0x%x,  size = %u\n", address, value, size);
+    if (size != 4) {
+        log_spew("NVAPUDevice::VPWrite:  Unhandled write!  address = 0x%x,  value = 0x%x,  size = %u\n", address, value, size);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_vp.Method(address, value);
+}
+
+// Must be called with m_mutex held
+void NVAPUDevice::UpdateIRQ() {
+    uint32_t& ists = m_regs[NV_PAPU_ISTS / 4];
+    if (ists & ~NV_PAPU_ISTS_GINTSTS & m_regs[NV_PAPU_IEN / 4]) {
+        ists |= NV_PAPU_ISTS_GINTSTS;
+    }
+    else {
+        ists &= ~NV_PAPU_ISTS_GINTSTS;
+    }
+    m_irqHandler->HandleIRQ(NVAPU_IRQ, (ists & NV_PAPU_ISTS_GINTSTS) != 0);
+}
+
+void NVAPUDevice::ProcessFrame() {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    memset(m_mixbins, 0, sizeof(m_mixbins));
+    if ((m_regs[NV_PAPU_SECTL / 4] & NV_PAPU_SECTL_XCNTMODE) != NV_PAPU_SECTL_XCNTMODE_OFF) {
+        m_vp.ProcessFrame(m_mixbins);
+    }
+
+    alignas(16) int16_t output[NV_PAPU_FRAME_SAMPLES * 2];
+    if (dspRunning(m_gpRst) || dspRunning(m_epRst)) {
+        RunDSPs(output);
+    }
+    else {
+        hw::audio::apu_interleave_s16(m_mixbins[0], m_mixbins[1], output);
+    }
+
+    if (m_sink != nullptr) {
+        m_sink->Write(output, NV_PAPU_FRAME_SAMPLES);
+    }
+    m_frameCount++;
+}
+
+// Must be called with m_mutex held
+void NVAPUDevice::RunDSPs(int16_t *output) {
+    using namespace hw::audio;
+
+    std::deque<uint32_t> *fifo = nullptr;
+    if (dspRunning(m_gpRst)) {
+        // The mixbins are handed to the GP as 24-bit samples
+        for (uint32_t bin = 0; bin < NV_PAPU_MIXBINS; bin++) {
+            for (uint32_t i = 0; i < NV_PAPU_FRAME_SAMPLES; i++) {
+                float sample = m_mixbins[bin][i] * 256.0f;
+                if (sample > 8388607.0f) {
+                    sample = 8388607.0f;
+                }
+                else if (sample < -8388608.0f) {
+                    sample = -8388608.0f;
+                }
+                m_gp.WriteMemory(DSP_SpaceX, NV_PAPU_GP_MIXBUF_BASE + bin * NV_PAPU_FRAME_SAMPLES + i, (uint32_t)(int32_t)sample);
+            }
+        }
+        m_gp.RunFrame(APU_DSP_CYCLES_PER_FRAME);
+        fifo = &m_gp.GetOutputFIFO(0);
+    }
+
+    if (dspRunning(m_epRst)) {
+        // The GP output FIFOs feed the EP input FIFOs
+        for (unsigned int i = 0; i < DSP_FIFO_COUNT; i++) {
+            std::deque<uint32_t>& src = m_gp.GetOutputFIFO(i);
+            std::deque<uint32_t>& dst = m_ep.GetInputFIFO(i);
+            dst.insert(dst.end(), src.begin(), src.end());
+            src.clear();
+            trimFIFO(dst);
+        }
+        m_ep.RunFrame(APU_DSP_CYCLES_PER_FRAME);
+        fifo = &m_ep.GetOutputFIFO(0);
+    }
+
+    // Take a frame of interleaved stereo samples, padding with silence if the
+    // program produced less
+    for (uint32_t i = 0; i < NV_PAPU_FRAME_SAMPLES * 2; i++) {
+        int32_t sample = 0;
+        if (!fifo->empty()) {
+            sample = (int32_t)(fifo->front() << 8) >> 16;
+            fifo->pop_front();
+        }
+        output[i] = (int16_t)sample;
+    }
+    trimFIFO(*fifo);
+}
+
+void NVAPUDevice::AudioThread(NVAPUDevice *apu) {
+    Thread_SetName("[HW] APU");
+
+    using namespace std::chrono;
+
+    // Frames are scheduled relative to a base time so that rounding errors
+    // don't accumulate
+    auto baseTime = high_resolution_clock::now();
+    uint64_t frames = 0;
+
+    while (apu->m_running) {
+        for (int i = 0; i < APU_FRAMES_PER_WAKEUP; i++) {
+            apu->ProcessFrame();
+        }
+        frames += APU_FRAMES_PER_WAKEUP;
+
+        auto nextStop = baseTime + nanoseconds(frames * NV_PAPU_FRAME_SAMPLES * 1000000000ull / NV_PAPU_SAMPLE_RATE);
+        auto now = high_resolution_clock::now();
+        if (now - nextStop > nanoseconds(APU_MAX_LATE_FRAMES * NV_PAPU_FRAME_SAMPLES * 1000000000ull / NV_PAPU_SAMPLE_RATE)) {
+            // Skip ahead if the host can't keep up
+            log_debug("NVAPUDevice: Audio thread fell behind; skipping ahead\n");
+            baseTime = now;
+            frames = 0;
+            continue;
+        }
+        std::this_thread::sleep_until(nextStop);
+    }
 }
 
 }
@@ -40,13 +40,22 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <mutex>
+#include <thread>
 
 #include "../defs.h"
 #include "pci.h"
+#include "../basic/irq.h"
+#include "../audio/dsp.h"
+#include "../audio/sink.h"
+#include "../audio/vp.h"
 
 namespace openxbox {
 
+#define NVAPU_IRQ   5
+
 #define APU_VP_BASE 0x20000
 #define APU_VP_SIZE 0x10000
 
@@ -56,10 +65,28 @@ namespace openxbox {
 #define APU_EP_BASE 0x50000
 #define APU_EP_SIZE 0x10000
 
+/*!
+ * The MCPX audio processing unit.
+ *
+ * The voice processor runs on an audio thread that produces one frame of 32
+ * samples for every 32 ticks of the 48 kHz audio clock, which is the clock
+ * the guest reads from NV_PAPU_XGSCNT. The thread processes a few frames
+ * every time it wakes up and is paced so that the audio clock advances in
+ * step with real time, but it skips ahead instead of trying to catch up if
+ * the host falls far behind.
+ *
+ * Every frame, the mixbins are copied into the memory of the global processor
+ * (GP), which runs its DSP program for the frame and feeds the encode
+ * processor (EP) through the DMA FIFOs. The audio sink receives the first
+ * output FIFO of the last processor out of reset, as interleaved stereo
+ * samples, or the first two mixbins as the left and right channels if both
+ * processors are held in reset. Both DSPs are given the number of cycles
+ * their 160 MHz clock allows per frame.
+ */
 class NVAPUDevice : public PCIDevice {
 public:
     // constructor
-    NVAPUDevice(uint16_t vendorID, uint16_t deviceID, uint8_t revisionID);
+    NVAPUDevice(uint16_t vendorID, uint16_t deviceID, uint8_t revisionID, uint8_t *ram, uint32_t ramSize, IRQHandler *irqHandler);
     virtual ~NVAPUDevice();
 
     // PCI Device functions
@@ -71,7 +98,43 @@ public:
     void PCIMMIORead(int barIndex, uint32_t addr, uint32_t *value, uint8_t size) override;
     void PCIMMIOWrite(int barIndex, uint32_t addr, uint32_t value, uint8_t size) override;
 
+    // Sends the audio output to the specified sink, or discards it if
+    // nullptr. The sink is started at 48 kHz stereo and stopped when it is
+    // replaced or when the device is destroyed, but it is not owned by the
+    // device.
+    bool SetAudioSink(hw::audio::AudioSink *sink);
+
+    // Number of frames processed since the device was created
+    uint64_t GetFrameCount() const { return m_frameCount; }
+
 private:
+    uint8_t *m_ram;
+    uint32_t m_ramSize;
+    IRQHandler *m_irqHandler;
+
+    // Serializes register accesses, methods and frame processing
+    std::mutex m_mutex;
+    uint32_t m_regs[NV_PAPU_SIZE / 4];
+    hw::audio::VoiceProcessor m_vp;
+    hw::audio::DSP56300 m_gp;
+    hw::audio::DSP56300 m_ep;
+    uint32_t m_gpRst = 0;
+    uint32_t m_epRst = 0;
+    alignas(16) hw::audio::APUMixBins m_mixbins;
+    hw::audio::AudioSink *m_sink = nullptr;
+
+    std::atomic<uint64_t> m_frameCount{ 0 };
+    std::thread m_audioThread;
+    std::atomic<bool> m_running{ false };
+
+    static void AudioThread(NVAPUDevice *apu);
+    void ProcessFrame();
+    void UpdateIRQ();
+    void RunDSPs(int16_t *output);
+
+    bool DSPRead(hw::audio::DSP56300& dsp, uint32_t address, uint32_t *value);
+    bool DSPWrite(hw::audio::DSP56300& dsp, uint32_t address, uint32_t value);
+
     void GPRead(uint32_t address, uint32_t *value, uint8_t size);
     void GPWrite(uint32_t address, uint32_t value, uint8_t size);
 
@@ -23,6 +23,10 @@
  */
 #include "nvnet.h"
 #include "openxbox/log.h"
+#include "openxbox/thread.h"
+
+#include <algorithm>
+#include <string.h>
 
 namespace openxbox {
 
@@ -248,29 +252,13 @@ enum {
 #define LPA_LPACK    0x4000  /* Link partner acked us       */
 #define LPA_NPAGE    0x8000  /* Next page bit               */
 
-/*******************************************************************************
-* Primary State Structure
-******************************************************************************/
-
-struct NvNetState {
-    uint8_t      regs[MMIO_SIZE / 4];
-    uint32_t     phy_regs[6];
-    uint8_t      tx_ring_index;
-    uint8_t      tx_ring_size;
-    uint8_t      rx_ring_index;
-    uint8_t      rx_ring_size;
-    uint8_t      txrx_dma_buf[RX_ALLOC_BUFSIZE];
-    FILE         *packet_dump_file;
-    char         *packet_dump_path;
-} NvNetState;
-
 struct RingDesc {
     uint32_t packet_buffer;
     uint16_t length;
     uint16_t flags;
 };
 
-const char* EmuNVNet_GetRegisterName(uint32_t addr) {
+static const char* EmuNVNet_GetRegisterName(uint32_t addr) {
     switch (addr) {
     case NvRegIrqStatus:             return "NvRegIrqStatus";
     case NvRegIrqMask:               return "NvRegIrqMask";
@@ -317,7 +305,7 @@ const char* EmuNVNet_GetRegisterName(uint32_t addr) {
     }
 }
 
-const char* EmuNVNet_GetMiiRegisterName(uint8_t reg) {
+static const char* EmuNVNet_GetMiiRegisterName(uint8_t reg) {
     switch (reg) {
     case MII_PHYSID1:   return "MII_PHYSID1";
     case MII_PHYSID2:   return "MII_PHYSID2";
@@ -329,50 +317,222 @@ const char* EmuNVNet_GetMiiRegisterName(uint8_t reg) {
     }
 }
 
-uint32_t EmuNVNet_GetRegister(uint32_t addr, unsigned int size) {
+uint32_t NVNetDevice::GetRegister(uint32_t addr, unsigned int size) {
     switch (size) {
     case sizeof(uint32_t) :
-        return ((uint32_t *)NvNetState.regs)[addr >> 2];
+        return ((uint32_t *)m_state.regs)[addr >> 2];
     case sizeof(uint16_t) :
-        return ((uint16_t *)NvNetState.regs)[addr >> 1];
+        return ((uint16_t *)m_state.regs)[addr >> 1];
     case sizeof(uint8_t) :
-        return NvNetState.regs[addr];
+        return m_state.regs[addr];
     }
 
     return 0;
 }
 
-void EmuNVNet_SetRegister(uint32_t addr, uint32_t value, unsigned int size) {
+void NVNetDevice::SetRegister(uint32_t addr, uint32_t value, unsigned int size) {
     switch (size) {
     case sizeof(uint32_t) :
-        ((uint32_t *)NvNetState.regs)[addr >> 2] = value;
+        ((uint32_t *)m_state.regs)[addr >> 2] = value;
         break;
     case sizeof(uint16_t) :
-        ((uint16_t *)NvNetState.regs)[addr >> 1] = (uint16_t)value;
+        ((uint16_t *)m_state.regs)[addr >> 1] = (uint16_t)value;
         break;
     case sizeof(uint8_t) :
-        NvNetState.regs[addr] = (uint8_t)value;
+        m_state.regs[addr] = (uint8_t)value;
         break;
     }
 }
 
-void EmuNVNet_UpdateIRQ() {
-    if (EmuNVNet_GetRegister(NvRegIrqMask, 4) &&
-        EmuNVNet_GetRegister(NvRegIrqStatus, 4)) {
-        log_debug("EmuNVNet: Asserting IRQ\n");
-        // TODO: HalSystemInterrupts[4].Assert(true);
+void NVNetDevice::RaiseInterrupt(uint32_t status) {
+    std::lock_guard<std::mutex> lk(m_irqMutex);
+    SetRegister(NvRegIrqStatus, GetRegister(NvRegIrqStatus, 4) | status, 4);
+    UpdateIRQ();
+}
+
+// Called with no locks held, or only with m_txMutex held
+void NVNetDevice::QueueInterrupt(uint32_t status, uint32_t frames) {
+    if (!IsCoalescing()) {
+        RaiseInterrupt(status);
+        return;
     }
-    else {
-        // TODO: HalSystemInterrupts[4].Assert(false);
+
+    bool deliver;
+    {
+        std::lock_guard<std::mutex> lk(m_irqMutex);
+        m_pendingStatus |= status;
+        if (m_pendingTxFrames == 0 && m_pendingRxFrames == 0) {
+            m_pendingSince = std::chrono::steady_clock::now();
+            m_moderationCond.notify_one();
+        }
+
+        // Each direction has its own frame count threshold
+        uint32_t& pendingFrames = (status & NVREG_IRQSTAT_BIT1) ? m_pendingRxFrames : m_pendingTxFrames;
+        pendingFrames += frames;
+        deliver = pendingFrames >= m_coalesceFrames;
+    }
+    if (deliver) {
+        DeliverPendingInterrupts(0);
+    }
+}
+
+void NVNetDevice::DeliverPendingInterrupts(uint32_t status) {
+    bool rxDelivered;
+    {
+        std::lock_guard<std::mutex> lk(m_rxMutex);
+        rxDelivered = m_rxBatchCount > 0;
+        WriteBackRxBatch();
+    }
+
+    std::lock_guard<std::mutex> lk(m_irqMutex);
+    status |= m_pendingStatus;
+    if (rxDelivered) {
+        status |= NVREG_IRQSTAT_BIT1;
+    }
+    m_pendingStatus = 0;
+    m_pendingTxFrames = 0;
+    m_pendingRxFrames = 0;
+    if (status != 0) {
+        SetRegister(NvRegIrqStatus, GetRegister(NvRegIrqStatus, 4) | status, 4);
+        UpdateIRQ();
+    }
+}
+
+// Must be called with m_rxMutex held
+void NVNetDevice::WriteBackRxBatch() {
+    for (uint32_t i = 0; i < m_rxBatchCount; i++) {
+        RingDesc *desc = (RingDesc *)GetGuestPointer(m_rxBatch[i].descAddr, sizeof(RingDesc));
+        desc->length = m_rxBatch[i].length;
+        desc->flags = NV_RX_BIT4 | NV_RX_DESCRIPTORVALID;
+    }
+    m_rxBatchCount = 0;
+}
+
+// Must be called with m_rxMutex held
+void NVNetDevice::DiscardRxBatch() {
+    // The descriptors belong to a ring the driver has abandoned, so they must
+    // not be written back, and their interrupt must not be delivered
+    m_rxBatchCount = 0;
+    std::lock_guard<std::mutex> lk(m_irqMutex);
+    m_pendingRxFrames = 0;
+    m_pendingStatus &= ~NVREG_IRQSTAT_BIT1;
+}
+
+// Must be called with m_irqMutex held
+void NVNetDevice::UpdateIRQ() {
+    bool level = (GetRegister(NvRegIrqMask, 4) & GetRegister(NvRegIrqStatus, 4)) != 0;
+    if (level && !m_irqLevel) {
+        log_debug("NVNetDevice: Asserting IRQ\n");
+        m_stats.irqs++;
+    }
+    m_irqLevel = level;
+    m_irqHandler->HandleIRQ(NVNET_IRQ, level);
+}
+
+void NVNetDevice::ModerationThread(NVNetDevice *nvnet) {
+    Thread_SetName("[HW] NVNet");
+    nvnet->Moderate();
+}
+
+void NVNetDevice::Moderate() {
+    using namespace std::chrono;
+    const auto never = steady_clock::time_point::max();
+
+    NVNetStats lastStats = GetStats();
+    auto nextSample = steady_clock::now() + seconds(1);
+    auto nextTimer = never;
+
+    std::unique_lock<std::mutex> lk(m_irqMutex);
+    while (m_running) {
+        auto now = steady_clock::now();
+
+        // The timer interrupt fires every polling interval while unmasked.
+        // According to forcedeth, 97 units make up 1 ms.
+        uint32_t interval = GetRegister(NvRegPollingInterval, 4);
+        auto period = microseconds((uint64_t)interval * 1000 / 97);
+        if (!(GetRegister(NvRegIrqMask, 4) & NVREG_IRQ_TIMER) || period.count() == 0) {
+            nextTimer = never;
+        }
+        else if (nextTimer == never) {
+            nextTimer = now + period;
+        }
+
+        auto pendingDeadline = (m_pendingTxFrames > 0 || m_pendingRxFrames > 0) ? m_pendingSince + microseconds(m_coalesceMicros) : never;
+        if (now >= pendingDeadline || now >= nextTimer) {
+            uint32_t status = 0;
+            if (now >= nextTimer) {
+                status = NVREG_IRQ_TIMER;
+                nextTimer = std::max(nextTimer + period, now);
+            }
+            lk.unlock();
+            DeliverPendingInterrupts(status);
+            lk.lock();
+            continue;
+        }
+
+        if (now >= nextSample) {
+            lk.unlock();
+            NVNetStats stats = GetStats();
+            {
+                std::lock_guard<std::mutex> ratesLock(m_ratesMutex);
+                m_rates.txFrames = stats.txFrames - lastStats.txFrames;
+                m_rates.txBytes = stats.txBytes - lastStats.txBytes;
+                m_rates.txDrops = stats.txDrops - lastStats.txDrops;
+                m_rates.rxFrames = stats.rxFrames - lastStats.rxFrames;
+                m_rates.rxBytes = stats.rxBytes - lastStats.rxBytes;
+                m_rates.rxDrops = stats.rxDrops - lastStats.rxDrops;
+                m_rates.irqs = stats.irqs - lastStats.irqs;
+                if (m_rates.txFrames != 0 || m_rates.rxFrames != 0) {
+                    log_debug("NVNetDevice: TX %llu frames/s %llu bytes/s, RX %llu frames/s %llu bytes/s, %llu IRQs/s, %llu drops/s\n",
+                        (unsigned long long)m_rates.txFrames, (unsigned long long)m_rates.txBytes,
+                        (unsigned long long)m_rates.rxFrames, (unsigned long long)m_rates.rxBytes,
+                        (unsigned long long)m_rates.irqs, (unsigned long long)(m_rates.txDrops + m_rates.rxDrops));
+                }
+            }
+            lastStats = stats;
+            nextSample += seconds(1);
+            lk.lock();
+            continue;
+        }
+
+        m_moderationCond.wait_until(lk, std::min(std::min(nextSample, nextTimer), pendingDeadline));
     }
 }
 
-int EmuNVNet_MiiReadWrite(uint64_t val) {
+void NVNetDevice::SetInterruptCoalescing(uint32_t frames, std::chrono::microseconds time) {
+    {
+        std::lock_guard<std::mutex> lk(m_irqMutex);
+        m_coalesceFrames = std::min<uint32_t>(frames, NVNET_MAX_RX_BATCH);
+        m_coalesceMicros = (uint32_t)time.count();
+    }
+
+    // Don't leave anything behind when moderation is turned off
+    DeliverPendingInterrupts(0);
+}
+
+NVNetStats NVNetDevice::GetStats() {
+    NVNetStats stats;
+    stats.txFrames = m_stats.txFrames;
+    stats.txBytes = m_stats.txBytes;
+    stats.txDrops = m_stats.txDrops;
+    stats.rxFrames = m_stats.rxFrames;
+    stats.rxBytes = m_stats.rxBytes;
+    stats.rxDrops = m_stats.rxDrops;
+    stats.irqs = m_stats.irqs;
+    return stats;
+}
+
+NVNetStats NVNetDevice::GetRates() {
+    std::lock_guard<std::mutex> lk(m_ratesMutex);
+    return m_rates;
+}
+
+int NVNetDevice::MiiReadWrite(uint64_t val) {
     uint32_t mii_ctl;
     int write, retval, phy_addr, reg;
 
     retval = 0;
-    mii_ctl = EmuNVNet_GetRegister(NvRegMIIControl, 4);
+    mii_ctl = GetRegister(NvRegMIIControl, 4);
 
     phy_addr = (mii_ctl >> NVREG_MIICTL_ADDRSHIFT) & 0x1f;
     reg = mii_ctl & ((1 << NVREG_MIICTL_ADDRSHIFT) - 1);
@@ -407,83 +567,359 @@ int EmuNVNet_MiiReadWrite(uint64_t val) {
     return retval;
 }
 
-uint32_t EmuNVNet_Read(uint32_t addr, int size) {
-    log_debug("NET : Read%d: %s (0x%.8X)\n", size, EmuNVNet_GetRegisterName(addr), addr);
+uint32_t NVNetDevice::Read(uint32_t addr, unsigned int size) {
+    log_debug("NET : Read%d: %s (0x%.8X)\n", size * 8, EmuNVNet_GetRegisterName(addr), addr);
 
     switch (addr) {
     case NvRegMIIData:
-        return EmuNVNet_MiiReadWrite(MII_READ);
+        return MiiReadWrite(MII_READ);
     case NvRegMIIControl:
-        return EmuNVNet_GetRegister(addr, size) & ~NVREG_MIICTL_INUSE;
+        return GetRegister(addr, size) & ~NVREG_MIICTL_INUSE;
     case NvRegMIIStatus:
         return 0;
     }
 
-    return EmuNVNet_GetRegister(addr, size);
+    return GetRegister(addr, size);
 }
 
-void EmuNVNet_Write(uint32_t addr, uint32_t value, int size) {
+void NVNetDevice::Write(uint32_t addr, uint32_t value, unsigned int size) {
     switch (addr) {
     case NvRegRingSizes:
-        EmuNVNet_SetRegister(addr, value, size);
-        NvNetState.rx_ring_size = ((value >> NVREG_RINGSZ_RXSHIFT) & 0xffff) + 1;
-        NvNetState.tx_ring_size = ((value >> NVREG_RINGSZ_TXSHIFT) & 0xffff) + 1;
+    {
+        std::lock_guard<std::mutex> txLock(m_txMutex);
+        std::lock_guard<std::mutex> rxLock(m_rxMutex);
+        SetRegister(addr, value, size);
+        DiscardRxBatch();
+        m_state.rx_ring_size = ((value >> NVREG_RINGSZ_RXSHIFT) & 0xffff) + 1;
+        m_state.tx_ring_size = ((value >> NVREG_RINGSZ_TXSHIFT) & 0xffff) + 1;
+        m_state.rx_ring_index %= m_state.rx_ring_size;
+        m_state.tx_ring_index %= m_state.tx_ring_size;
         break;
+    }
+    case NvRegTxRingPhysAddr:
+    {
+        std::lock_guard<std::mutex> lk(m_txMutex);
+        SetRegister(addr, value, size);
+        break;
+    }
+    case NvRegRxRingPhysAddr:
+    {
+        std::lock_guard<std::mutex> lk(m_rxMutex);
+        SetRegister(addr, value, size);
+        DiscardRxBatch();
+        break;
+    }
     case NvRegMIIData:
-        EmuNVNet_MiiReadWrite(value);
+        MiiReadWrite(value);
         break;
     case NvRegTxRxControl:
-        if (value == NVREG_TXRXCTL_KICK) {
+        if (value & NVREG_TXRXCTL_RESET) {
+            // Both rings start over from their first descriptor
+            std::lock_guard<std::mutex> txLock(m_txMutex);
+            std::lock_guard<std::mutex> rxLock(m_rxMutex);
+            m_state.tx_ring_index = 0;
+            m_state.rx_ring_index = 0;
+            DiscardRxBatch();
+        }
+
+        if (value & NVREG_TXRXCTL_KICK) {
             log_debug("NvRegTxRxControl = NVREG_TXRXCTL_KICK!\n");
-            log_warning("TODO: nvnet_dma_packet_from_guest");
-            // nvnet_dma_packet_from_guest(s);
+            ProcessTxRing();
         }
 
         if (value & NVREG_TXRXCTL_BIT2) {
-            EmuNVNet_SetRegister(NvRegTxRxControl, NVREG_TXRXCTL_IDLE, 4);
+            SetRegister(NvRegTxRxControl, NVREG_TXRXCTL_IDLE, 4);
             break;
         }
 
         if (value & NVREG_TXRXCTL_BIT1) {
-            EmuNVNet_SetRegister(NvRegIrqStatus, 0, 4);
+            std::lock_guard<std::mutex> lk(m_irqMutex);
+            SetRegister(NvRegIrqStatus, 0, 4);
+            UpdateIRQ();
             break;
         }
         else if (value == 0) {
-            uint32_t temp = EmuNVNet_GetRegister(NvRegUnknownSetupReg3, 4);
+            uint32_t temp = GetRegister(NvRegUnknownSetupReg3, 4);
             if (temp == NVREG_UNKSETUP3_VAL1) {
                 /* forcedeth waits for this bit to be set... */
-                EmuNVNet_SetRegister(NvRegUnknownSetupReg5,
-                    NVREG_UNKSETUP5_BIT31, 4);
+                SetRegister(NvRegUnknownSetupReg5, NVREG_UNKSETUP5_BIT31, 4);
                 break;
             }
         }
-        EmuNVNet_SetRegister(NvRegTxRxControl, value, size);
+        SetRegister(NvRegTxRxControl, value, size);
         break;
     case NvRegIrqMask:
-        EmuNVNet_SetRegister(addr, value, size);
-        EmuNVNet_UpdateIRQ();
+    {
+        std::lock_guard<std::mutex> lk(m_irqMutex);
+        SetRegister(addr, value, size);
+        UpdateIRQ();
+        m_moderationCond.notify_one();
+        break;
+    }
+    case NvRegPollingInterval:
+    {
+        std::lock_guard<std::mutex> lk(m_irqMutex);
+        SetRegister(addr, value, size);
+        m_moderationCond.notify_one();
         break;
+    }
     case NvRegIrqStatus:
-        EmuNVNet_SetRegister(addr, EmuNVNet_GetRegister(addr, size) & ~value, size);
-        EmuNVNet_UpdateIRQ();
+    {
+        std::lock_guard<std::mutex> lk(m_irqMutex);
+        SetRegister(addr, GetRegister(addr, size) & ~value, size);
+        UpdateIRQ();
         break;
+    }
     default:
-        EmuNVNet_SetRegister(addr, value, size);
+        SetRegister(addr, value, size);
         break;
     }
 
-    log_debug("NET : Write%d: %s (0x%.8X) = 0x%.8X\n", size, EmuNVNet_GetRegisterName(addr), addr, value);
+    log_debug("NET : Write%d: %s (0x%.8X) = 0x%.8X\n", size * 8, EmuNVNet_GetRegisterName(addr), addr, value);
+}
+
+uint8_t *NVNetDevice::GetGuestPointer(uint32_t addr, uint32_t length) {
+    if ((uint64_t)addr + length > m_ramSize) {
+        return nullptr;
+    }
+    return &m_ram[addr];
+}
+
+void NVNetDevice::ProcessTxRing() {
+    std::lock_guard<std::mutex> lk(m_txMutex);
+
+    uint32_t ringAddr = GetRegister(NvRegTxRingPhysAddr, 4);
+    uint32_t ringSize = m_state.tx_ring_size;
+    if (ringSize == 0) {
+        return;
+    }
+
+    // Gather every complete frame in the ring. A frame spans one or more
+    // descriptors, the last of which has NV_TX_LASTPACKET set; frames the
+    // driver is still filling in are left for the next kick.
+    IoVec fragments[NVNET_MAX_TX_FRAGMENTS];
+    unsigned int fragmentCount = 0;
+    uint32_t frameLength = 0;
+    bool frameValid = true;
+    uint32_t gathered = 0;
+    uint32_t completed = 0;
+    uint32_t frames = 0;
+    while (completed + gathered < ringSize) {
+        uint32_t descAddr = ringAddr + ((m_state.tx_ring_index + gathered) % ringSize) * sizeof(RingDesc);
+        RingDesc *desc = (RingDesc *)GetGuestPointer(descAddr, sizeof(RingDesc));
+        if (desc == nullptr || !(desc->flags & NV_TX_VALID)) {
+            break;
+        }
+        gathered++;
+
+        // The driver stores the length minus one
+        uint32_t length = (uint32_t)desc->length + 1;
+        uint8_t *data = GetGuestPointer(desc->packet_buffer, length);
+        if (data == nullptr || fragmentCount == NVNET_MAX_TX_FRAGMENTS) {
+            frameValid = false;
+        }
+        else {
+            fragments[fragmentCount].Iov_Base = data;
+            fragments[fragmentCount].Iov_Len = length;
+            fragmentCount++;
+            frameLength += length;
+        }
+
+        if (!(desc->flags & NV_TX_LASTPACKET)) {
+            continue;
+        }
+
+        if (!frameValid) {
+            log_warning("NVNetDevice: Dropping transmitted frame with invalid buffers\n");
+            m_stats.txDrops++;
+        }
+        else {
+            log_spew("NVNetDevice: Transmitting %u byte frame from %u descriptors\n", frameLength, fragmentCount);
+            if (m_capture != nullptr) {
+                m_capture->Capture(hw::net::NCD_Outbound, fragments, fragmentCount, frameLength);
+            }
+            if (m_backend != nullptr && m_backend->Transmit(fragments, fragmentCount, frameLength)) {
+                m_stats.txFrames++;
+                m_stats.txBytes += frameLength;
+            }
+            else {
+                m_stats.txDrops++;
+            }
+        }
+        frames++;
+
+        // Hand the descriptors back to the driver
+        for (uint32_t i = 0; i < gathered; i++) {
+            RingDesc *done = (RingDesc *)GetGuestPointer(ringAddr + ((m_state.tx_ring_index + i) % ringSize) * sizeof(RingDesc), sizeof(RingDesc));
+            done->flags &= ~(NV_TX_VALID | NV_TX_RETRYERROR | NV_TX_DEFERRED | NV_TX_CARRIERLOST |
+                NV_TX_LATECOLLISION | NV_TX_UNDERFLOW | NV_TX_ERROR);
+            if (!frameValid) {
+                done->flags |= NV_TX_ERROR;
+            }
+        }
+        m_state.tx_ring_index = (m_state.tx_ring_index + gathered) % ringSize;
+        completed += gathered;
+
+        gathered = 0;
+        fragmentCount = 0;
+        frameLength = 0;
+        frameValid = true;
+    }
+
+    if (frames > 0) {
+        QueueInterrupt(NVREG_IRQSTAT_BIT4, frames);
+    }
+}
+
+bool NVNetDevice::CanReceive() {
+    std::lock_guard<std::mutex> lk(m_rxMutex);
+    if (m_state.rx_ring_size == 0 || m_rxBatchCount >= m_state.rx_ring_size) {
+        return false;
+    }
+    uint32_t descAddr = GetRegister(NvRegRxRingPhysAddr, 4) + m_state.rx_ring_index * sizeof(RingDesc);
+    RingDesc *desc = (RingDesc *)GetGuestPointer(descAddr, sizeof(RingDesc));
+    return desc != nullptr && (desc->flags & NV_RX_AVAIL);
+}
+
+bool NVNetDevice::BeginReceive(uint8_t **buffer, uint32_t *capacity) {
+    m_rxMutex.lock();
+
+    if (m_state.rx_ring_size > 0 && m_rxBatchCount >= m_state.rx_ring_size) {
+        // The ring wrapped around onto descriptors that were not handed back
+        // yet; deliver them now, leaving the driver with a full ring
+        WriteBackRxBatch();
+        std::lock_guard<std::mutex> lk(m_irqMutex);
+        SetRegister(NvRegIrqStatus, GetRegister(NvRegIrqStatus, 4) | NVREG_IRQSTAT_BIT1, 4);
+        UpdateIRQ();
+    }
+
+    if (m_state.rx_ring_size > 0) {
+        uint32_t descAddr = GetRegister(NvRegRxRingPhysAddr, 4) + m_state.rx_ring_index * sizeof(RingDesc);
+        RingDesc *desc = (RingDesc *)GetGuestPointer(descAddr, sizeof(RingDesc));
+        if (desc != nullptr && (desc->flags & NV_RX_AVAIL)) {
+            uint8_t *data = GetGuestPointer(desc->packet_buffer, desc->length);
+            if (data != nullptr) {
+                m_rxDescAddr = descAddr;
+                m_rxBuffer = data;
+                *buffer = data;
+                *capacity = desc->length;
+                return true;
+            }
+        }
+    }
+
+    m_rxMutex.unlock();
+    m_stats.rxDrops++;
+    return false;
+}
+
+void NVNetDevice::EndReceive(uint32_t length) {
+    if (length == 0) {
+        m_rxMutex.unlock();
+        m_stats.rxDrops++;
+        return;
+    }
+
+    if (m_capture != nullptr) {
+        IoVec frame = { m_rxBuffer, length };
+        m_capture->Capture(hw::net::NCD_Inbound, &frame, 1, length);
+    }
+
+    // Hand the buffer to the driver, right away or along with the next
+    // interrupt
+    if (m_rxBatchCount == NVNET_MAX_RX_BATCH) {
+        WriteBackRxBatch();
+    }
+    m_rxBatch[m_rxBatchCount].descAddr = m_rxDescAddr;
+    m_rxBatch[m_rxBatchCount].length = (uint16_t)length;
+    m_rxBatchCount++;
+    bool coalescing = IsCoalescing();
+    if (!coalescing) {
+        WriteBackRxBatch();
+    }
+    m_state.rx_ring_index = (m_state.rx_ring_index + 1) % m_state.rx_ring_size;
+    m_rxMutex.unlock();
+
+    m_stats.rxFrames++;
+    m_stats.rxBytes += length;
+    log_spew("NVNetDevice: Received %u byte frame\n", length);
+    if (coalescing) {
+        QueueInterrupt(NVREG_IRQSTAT_BIT1, 1);
+    }
+    else {
+        RaiseInterrupt(NVREG_IRQSTAT_BIT1);
+    }
 }
 
 /* NVNetDevice */
 
-NVNetDevice::NVNetDevice(uint16_t vendorID, uint16_t deviceID, uint8_t revisionID)
+NVNetDevice::NVNetDevice(uint16_t vendorID, uint16_t deviceID, uint8_t revisionID, uint8_t *ram, uint32_t ramSize, IRQHandler *irqHandler)
     : PCIDevice(PCI_HEADER_TYPE_NORMAL, vendorID, deviceID, revisionID,
         0x02, 0x00, 0x00) // Ethernet controller
+    , m_ram(ram)
+    , m_ramSize(ramSize)
+    , m_irqHandler(irqHandler)
 {
+    memset(&m_state, 0, sizeof(m_state));
 }
 
 NVNetDevice::~NVNetDevice() {
+    SetBackend(nullptr);
+    StopCapture();
+
+    {
+        std::lock_guard<std::mutex> lk(m_irqMutex);
+        m_running = false;
+        m_moderationCond.notify_one();
+    }
+    if (m_moderationThread.joinable()) {
+        m_moderationThread.join();
+    }
+}
+
+bool NVNetDevice::SetBackend(hw::net::INetBackend *backend) {
+    if (m_backend != nullptr) {
+        m_backend->Stop();
+    }
+
+    std::lock_guard<std::mutex> lk(m_txMutex);
+    m_backend = backend;
+    if (m_backend != nullptr && !m_backend->Start(this)) {
+        m_backend = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool NVNetDevice::StartCapture(const char *path, uint32_t snapLen, uint64_t maxFileSize) {
+    StopCapture();
+
+    auto capture = new hw::net::NetCapture();
+    if (!capture->Open(path, snapLen, maxFileSize)) {
+        delete capture;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> txLock(m_txMutex);
+    std::lock_guard<std::mutex> rxLock(m_rxMutex);
+    m_capture = capture;
+    return true;
+}
+
+void NVNetDevice::StopCapture() {
+    hw::net::NetCapture *capture;
+    {
+        std::lock_guard<std::mutex> txLock(m_txMutex);
+        std::lock_guard<std::mutex> rxLock(m_rxMutex);
+        capture = m_capture;
+        m_capture = nullptr;
+    }
+
+    // Closing writes out the frames still in the queue
+    if (capture != nullptr) {
+        capture->Close();
+        delete capture;
+    }
 }
 
 // PCI Device functions
@@ -491,9 +927,27 @@ NVNetDevice::~NVNetDevice() {
 void NVNetDevice::Init() {
     RegisterBAR(0, NVNET_SIZE, PCI_BAR_TYPE_MEMORY);  // 0xFEF00000 - 0xFEF003FF
     RegisterBAR(1, 8, PCI_BAR_TYPE_IO); // 0xE000 - 0xE007
+
+    Write8(m_configSpace, PCI_INTERRUPT_PIN, 1);
+
+    m_running = true;
+    m_moderationThread = std::thread(ModerationThread, this);
 }
 
 void NVNetDevice::Reset() {
+    std::lock_guard<std::mutex> txLock(m_txMutex);
+    std::lock_guard<std::mutex> rxLock(m_rxMutex);
+    std::lock_guard<std::mutex> irqLock(m_irqMutex);
+    memset(m_state.regs, 0, sizeof(m_state.regs));
+    m_state.tx_ring_index = 0;
+    m_state.tx_ring_size = 0;
+    m_state.rx_ring_index = 0;
+    m_state.rx_ring_size = 0;
+    m_rxBatchCount = 0;
+    m_pendingStatus = 0;
+    m_pendingTxFrames = 0;
+    m_pendingRxFrames = 0;
+    UpdateIRQ();
 }
 
 void NVNetDevice::PCIIORead(int barIndex, uint32_t port, uint32_t *value, uint8_t size) {
@@ -526,8 +980,7 @@ void NVNetDevice::PCIMMIORead(int barIndex, uint32_t addr, uint32_t *value, uint
         return;
     }
 
-    *value = EmuNVNet_Read(addr, size * 8); // For now, forward
-    return;
+    *value = Read(addr, size);
 }
 
 void NVNetDevice::PCIMMIOWrite(int barIndex, uint32_t addr, uint32_t value, uint8_t size) {
@@ -537,7 +990,7 @@ void NVNetDevice::PCIMMIOWrite(int barIndex, uint32_t addr, uint32_t value, uint
         return;
     }
 
-    EmuNVNet_Write(addr, value, size * 8); // For now, forward
+    Write(addr, value, size);
 }
 
 }
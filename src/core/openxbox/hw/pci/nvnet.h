@@ -1,25 +1,184 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 #include "pci.h"
+#include "../basic/irq.h"
+#include "../net/net_backend.h"
+#include "../net/net_capture.h"
 
 namespace openxbox {
 
-#define NVNET_ADDR  0xFEF00000 
+#define NVNET_ADDR  0xFEF00000
 #define NVNET_SIZE  0x00000400
 
-class NVNetDevice : public PCIDevice {
+// Interrupt line the controller is wired to
+#define NVNET_IRQ   4
+
+// Maximum number of descriptors a transmitted frame may be split across
+#define NVNET_MAX_TX_FRAGMENTS  32
+
+// Maximum number of received frames whose descriptors are written back at once
+#define NVNET_MAX_RX_BATCH      64
+
+struct NvNetState {
+    uint8_t      regs[NVNET_SIZE];
+    uint32_t     phy_regs[6];
+    uint32_t     tx_ring_index;
+    uint32_t     tx_ring_size;
+    uint32_t     rx_ring_index;
+    uint32_t     rx_ring_size;
+};
+
+/*!
+ * Traffic counters of the Ethernet controller.
+ */
+struct NVNetStats {
+    uint64_t txFrames = 0;
+    uint64_t txBytes = 0;
+    uint64_t txDrops = 0;   // frames with invalid buffers or rejected by the backend
+    uint64_t rxFrames = 0;
+    uint64_t rxBytes = 0;
+    uint64_t rxDrops = 0;   // frames that found no free receive buffer
+    uint64_t irqs = 0;      // times the interrupt line was asserted
+};
+
+/*!
+ * The nForce Ethernet controller.
+ *
+ * Frames are moved between the descriptor rings in guest memory and a
+ * network backend without intermediate copies: transmitted frames are handed
+ * to the backend as a list of guest buffers, and received frames are written
+ * by the backend straight into the guest's receive buffers.
+ *
+ * Completion interrupts can be coalesced: the interrupt is raised once a
+ * number of frames have completed or the oldest completion has waited for
+ * some time, whichever comes first. Receive descriptors are handed back to
+ * the driver in batches along with the interrupt. The timer interrupt
+ * programmed through NvRegPollingInterval also delivers pending completions,
+ * as drivers poll the rings from it when packet interrupts are masked.
+ */
+class NVNetDevice : public PCIDevice, public hw::net::INetReceiver {
 public:
-    NVNetDevice(uint16_t vendorID, uint16_t deviceID, uint8_t revisionID);
+    NVNetDevice(uint16_t vendorID, uint16_t deviceID, uint8_t revisionID, uint8_t *ram, uint32_t ramSize, IRQHandler *irqHandler);
     virtual ~NVNetDevice();
 
     // PCI Device functions
     void Init();
     void Reset();
-    
+
     void PCIIORead(int barIndex, uint32_t port, uint32_t *value, uint8_t size) override;
     void PCIIOWrite(int barIndex, uint32_t port, uint32_t value, uint8_t size) override;
     void PCIMMIORead(int barIndex, uint32_t addr, uint32_t *value, uint8_t size) override;
     void PCIMMIOWrite(int barIndex, uint32_t addr, uint32_t value, uint8_t size) override;
+
+    // Plugs the controller into the specified network backend, or unplugs it
+    // if nullptr. The backend is stopped when it is replaced or when the
+    // device is destroyed, but it is not owned by the device.
+    bool SetBackend(hw::net::INetBackend *backend);
+
+    // Captures transmitted and received frames to a pcapng file. Frames are
+    // truncated to snapLen bytes unless it is zero, and the capture moves on
+    // to a new file whenever it would exceed maxFileSize bytes unless it is
+    // zero.
+    bool StartCapture(const char *path, uint32_t snapLen, uint64_t maxFileSize);
+    void StopCapture();
+
+    // Configures interrupt moderation. Interrupts are raised on every frame
+    // if frames is 1 or less or time is zero.
+    void SetInterruptCoalescing(uint32_t frames, std::chrono::microseconds time);
+
+    // Counters since the device was created
+    NVNetStats GetStats();
+
+    // Traffic during the last full second
+    NVNetStats GetRates();
+
+    // Receive path used by the backend
+    bool CanReceive() override;
+    bool BeginReceive(uint8_t **buffer, uint32_t *capacity) override;
+    void EndReceive(uint32_t length) override;
+
+private:
+    uint8_t *m_ram;
+    uint32_t m_ramSize;
+    IRQHandler *m_irqHandler;
+
+    hw::net::INetBackend *m_backend = nullptr;
+    hw::net::NetCapture *m_capture = nullptr;
+
+    NvNetState m_state;
+
+    // Guards the transmit ring
+    std::mutex m_txMutex;
+
+    // Guards the receive ring. Backends hold it while filling in a buffer.
+    std::mutex m_rxMutex;
+    uint32_t m_rxDescAddr;
+    uint8_t *m_rxBuffer;
+
+    // Receive descriptors awaiting write back
+    struct RxCompletion {
+        uint32_t descAddr;
+        uint16_t length;
+    };
+    RxCompletion m_rxBatch[NVNET_MAX_RX_BATCH];
+    uint32_t m_rxBatchCount = 0;
+
+    // Guards the interrupt status and mask registers and the interrupts
+    // being coalesced
+    std::mutex m_irqMutex;
+    bool m_irqLevel = false;
+    uint32_t m_pendingStatus = 0;
+    uint32_t m_pendingTxFrames = 0;
+    uint32_t m_pendingRxFrames = 0;
+    std::chrono::steady_clock::time_point m_pendingSince;
+
+    // Interrupt moderation settings
+    std::atomic<uint32_t> m_coalesceFrames{ 1 };
+    std::atomic<uint32_t> m_coalesceMicros{ 0 };
+
+    // Delivers coalesced interrupts and the timer interrupt, and samples the
+    // traffic rates
+    std::thread m_moderationThread;
+    std::condition_variable m_moderationCond;
+    bool m_running = false;
+
+    struct AtomicStats {
+        std::atomic<uint64_t> txFrames{ 0 };
+        std::atomic<uint64_t> txBytes{ 0 };
+        std::atomic<uint64_t> txDrops{ 0 };
+        std::atomic<uint64_t> rxFrames{ 0 };
+        std::atomic<uint64_t> rxBytes{ 0 };
+        std::atomic<uint64_t> rxDrops{ 0 };
+        std::atomic<uint64_t> irqs{ 0 };
+    } m_stats;
+    std::mutex m_ratesMutex;
+    NVNetStats m_rates;
+
+    uint32_t GetRegister(uint32_t addr, unsigned int size);
+    void SetRegister(uint32_t addr, uint32_t value, unsigned int size);
+    uint32_t Read(uint32_t addr, unsigned int size);
+    void Write(uint32_t addr, uint32_t value, unsigned int size);
+    int MiiReadWrite(uint64_t val);
+
+    bool IsCoalescing() const { return m_coalesceFrames > 1 && m_coalesceMicros > 0; }
+    void RaiseInterrupt(uint32_t status);
+    void QueueInterrupt(uint32_t status, uint32_t frames);
+    void DeliverPendingInterrupts(uint32_t status);
+    void WriteBackRxBatch();
+    void DiscardRxBatch();
+    void UpdateIRQ();
+
+    static void ModerationThread(NVNetDevice *nvnet);
+    void Moderate();
+
+    uint8_t *GetGuestPointer(uint32_t addr, uint32_t length);
+    void ProcessTxRing();
 };
 
 }
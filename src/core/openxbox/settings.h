@@ -7,6 +7,20 @@ namespace openxbox {
 enum CharDriverType {
     CHD_Null,
     CHD_HostSerialPort,
+    CHD_Pty,         // Host pseudo terminal (Linux only)
+    CHD_TcpServer,   // TCP socket accepting one client at a time (Linux only)
+    CHD_TcpClient,   // TCP socket connected to a server (Linux only)
+    CHD_UnixServer,  // Unix domain socket accepting one client at a time (Linux only)
+    CHD_UnixClient,  // Unix domain socket connected to a server (Linux only)
+    CHD_File,        // Output appended to a file (Linux only)
+};
+
+enum NetBackendType {
+    NBT_None,        // No cable plugged in; transmitted frames are discarded
+    NBT_Loopback,    // Transmitted frames are received back
+    NBT_Switch,      // In-process switch shared by emulator instances
+    NBT_PcapReplay,  // Frames are replayed from a pcap capture
+    NBT_Tap,         // Host TAP interface (Linux only)
 };
 
 struct OpenXBOXSettings {
@@ -61,11 +75,121 @@ struct OpenXBOXSettings {
         CharDriverType type;
         union {
             struct {
-                uint8_t portNum;
+                uint8_t portNum;  // COM port number; COMn is /dev/ttyS<n-1> on Linux
             } hostSerialPort;
+            struct {
+                const char *host;  // nullptr to listen on all interfaces
+                uint16_t port;
+            } tcp;
+            struct {
+                const char *path;
+            } unixSocket;
+            struct {
+                const char *path;
+            } file;
         } params;
     } hw_charDrivers[2];
 
+    // Move serial port data to and from the character drivers in FIFO-sized
+    // bursts instead of one character at a time
+    bool hw_serialBurstMode = false;
+
+    // Path to a file that will receive a capture of the NV2A command stream,
+    // or nullptr to disable capturing. Traces can be replayed offline with
+    // nv2a-replay.
+    const char *nv2a_tracePath = nullptr;
+
+    // Headless display capture; each output is disabled when nullptr.
+    // Name of the shared memory region frames are published to
+    const char *nv2a_scanoutShmName = nullptr;
+    // Prefix of the PPM images written for every new frame
+    const char *nv2a_scanoutImagePrefix = nullptr;
+    // Path to a raw BGRA video stream with one frame per VBlank
+    const char *nv2a_scanoutVideoPath = nullptr;
+
+    // Path to the per-frame NV2A command stream statistics, written as JSON
+    // if the path ends in .json and as CSV otherwise. Disabled when nullptr.
+    const char *nv2a_profilePath = nullptr;
+
+    // Path to a raw or compressed disk image attached as the primary master
+    // hard drive, or nullptr to use a dummy drive that reads back zeros
+    const char *hdd_imagePath = nullptr;
+
+    // Path to a host directory served as the hard drive, with one FATX
+    // partition per subdirectory named after the drive letter (C, E, X, Y and
+    // Z). Takes precedence over hdd_imagePath. The directory is never
+    // modified; writes go to the overlay, which defaults to the directory
+    // path with .overlay appended.
+    const char *hdd_hostDirectory = nullptr;
+
+    // Size of the sparse image created if the file at hdd_imagePath does not
+    // exist yet
+    uint64_t hdd_newImageSize = 10ull * 1024 * 1024 * 1024;
+
+    // Path to a copy-on-write overlay for the hard drive image, or nullptr to
+    // write to the image directly. The image is left untouched when an overlay
+    // is used; the overlay's block map is kept in a file with .map appended.
+    const char *hdd_overlayPath = nullptr;
+
+    // Size of the blocks copied into a new overlay. Must be a power of two
+    // multiple of 512 bytes.
+    uint32_t hdd_overlayBlockSize = 64 * 1024;
+
+    // Discard the contents of the overlay, restoring the drive to the state
+    // of the image
+    bool hdd_resetOverlay = false;
+
+    // Path to an XISO or compressed XISO image inserted in the DVD drive attached as the primary
+    // slave, or nullptr to leave the drive empty
+    const char *dvd_imagePath = nullptr;
+
+    // Network backend the Ethernet controller is plugged into
+    NetBackendType net_backend = NBT_None;
+
+    // Name of the switch joined by NBT_Switch. Emulator instances in the
+    // same process that join the same switch can reach each other.
+    const char *net_switchName = "default";
+
+    // Path to the pcap capture replayed by NBT_PcapReplay
+    const char *net_pcapReplayPath = nullptr;
+
+    // true: replay frames at the pace they were captured, dropping them if
+    // the guest is not ready
+    // false: replay frames as fast as the guest consumes them
+    bool net_pcapReplayRealTime = false;
+
+    // Name of the TAP interface used by NBT_Tap, or nullptr to let the host
+    // pick one
+    const char *net_tapInterface = nullptr;
+
+    // Interrupt moderation of the Ethernet controller: completion interrupts
+    // are raised once this many frames have completed...
+    uint32_t net_irqCoalesceFrames = 8;
+
+    // ...or once the oldest completion has waited this many microseconds.
+    // Interrupts are raised for every frame if either is 0.
+    uint32_t net_irqCoalesceTime = 100;
+
+    // Path to a pcapng file that will receive a capture of the network
+    // traffic, or nullptr to disable capturing
+    const char *net_capturePath = nullptr;
+
+    // Number of bytes of each frame kept in the capture, or 0 to keep whole
+    // frames
+    uint32_t net_captureSnapLen = 0;
+
+    // Size in bytes after which the capture moves on to a new file, or 0 to
+    // write a single file
+    uint64_t net_captureMaxFileSize = 0;
+
+    // Path to a WAV file that will receive the audio output of the APU, or
+    // nullptr to discard the audio
+    const char *apu_wavPath = nullptr;
+
+    // Path to a WAV file that will receive the PCM output of the AC'97
+    // controller, or nullptr to discard the audio
+    const char *ac97_wavPath = nullptr;
+
     // Path to MCPX ROM file
     const char *rom_mcpx;
 
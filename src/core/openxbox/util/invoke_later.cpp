@@ -35,8 +35,10 @@ void InvokeLater::Start() {
 }
 
 void InvokeLater::Stop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
     m_running = false;
-    Cancel();
+    m_primed = false;
+    m_cond.notify_one();
 }
 
 void InvokeLater::Set(std::chrono::time_point<std::chrono::high_resolution_clock>& expiration) {
@@ -44,45 +46,43 @@ void InvokeLater::Set(std::chrono::time_point<std::chrono::high_resolution_clock
         return;
     }
 
-    Cancel();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    // Postponing a pending invocation doesn't need to wake up the thread; it
+    // will go back to sleep when the previous expiration time is reached
+    bool wake = !m_primed || expiration < m_targetExpiration;
     m_targetExpiration = expiration;
     m_primed = true;
-    m_setupCond.notify_one();
+    if (wake) {
+        m_cond.notify_one();
+    }
 }
 
 void InvokeLater::Cancel() {
+    // The thread will find nothing to do when it wakes up
+    std::unique_lock<std::mutex> lock(m_mutex);
     m_primed = false;
-    {
-        std::unique_lock<std::mutex> lock(m_setupMutex);
-        m_setupCond.notify_one();
-    }
-    {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        m_cond.notify_one();
-    }
 }
 
 void InvokeLater::Run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
     while (m_running) {
         // Wait for a timer to be set up
-        {
-            std::unique_lock<std::mutex> lock(m_setupMutex);
-            m_setupCond.wait(lock);
+        if (!m_primed) {
+            m_cond.wait(lock);
+            continue;
         }
 
-        // Wait until the expiration time is reached
-        {
-            std::unique_lock<std::mutex> lock(m_mutex);
+        // Wait until the expiration time is reached. The timer may be
+        // cancelled or set to a different time in the meantime.
+        if (std::chrono::high_resolution_clock::now() < m_targetExpiration) {
             m_cond.wait_until(lock, m_targetExpiration);
+            continue;
         }
 
-        if (!m_running) {
-            break;
-        }
-
-        if (m_primed && m_func != nullptr) {
-            m_func(m_userData);
-        }
+        m_primed = false;
+        lock.unlock();
+        m_func(m_userData);
+        lock.lock();
     }
 }
 
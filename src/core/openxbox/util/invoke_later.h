@@ -14,6 +14,9 @@ typedef void (*InvokeLaterFunc)(void *userData);
 /*!
  * An object that invokes a function at a later point in time.
  * The object can be reused multiple times.
+ *
+ * The function is invoked from the timer thread without holding any locks,
+ * so it may set the timer again.
  */
 class InvokeLater {
 public:
@@ -31,7 +34,8 @@ public:
     void Stop();
 
     /*!
-     * Sets the timer to invoke at the specified expiration time.
+     * Sets the timer to invoke at the specified expiration time, replacing
+     * any pending invocation.
      */
     void Set(std::chrono::time_point<std::chrono::high_resolution_clock>& expiration);
 
@@ -48,8 +52,6 @@ private:
     void *m_userData;
 
     std::thread *m_thread;
-    std::mutex m_setupMutex;
-    std::condition_variable m_setupCond;
     std::mutex m_mutex;
     std::condition_variable m_cond;
     std::chrono::time_point<std::chrono::high_resolution_clock> m_targetExpiration;
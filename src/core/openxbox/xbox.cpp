@@ -12,8 +12,24 @@
 #ifdef _WIN32
 #include "openxbox/hw/basic/win32/char_serial.h"
 #endif
+#ifdef __linux__
+#include "openxbox/hw/basic/linux/char_serial.h"
+#include "openxbox/hw/basic/linux/char_pty.h"
+#include "openxbox/hw/basic/linux/char_socket.h"
+#include "openxbox/hw/basic/linux/char_file.h"
+#endif
 
 #include "openxbox/hw/ata/drvs/drv_dummy_hd.h"
+#include "openxbox/hw/ata/drvs/drv_raw_image_hd.h"
+#include "openxbox/hw/ata/drvs/drv_xiso_dvd.h"
+#include "openxbox/hw/ata/drvs/drv_overlay_hd.h"
+#include "openxbox/hw/ata/drvs/drv_compressed_image_hd.h"
+#include "openxbox/hw/ata/drvs/drv_virtual_fatx_hd.h"
+
+#include "openxbox/hw/net/net_loopback.h"
+#include "openxbox/hw/net/net_switch.h"
+#include "openxbox/hw/net/net_pcap_replay.h"
+#include "openxbox/hw/net/net_tap.h"
 
 #ifdef __linux__
 #include <sys/mman.h>
@@ -106,8 +122,11 @@ Xbox::~Xbox() {
     if (m_USB1 != nullptr) delete m_USB1;
     if (m_USB2 != nullptr) delete m_USB2;
     if (m_NVNet != nullptr) delete m_NVNet;
+    if (m_netBackend != nullptr) delete m_netBackend;
     if (m_NVAPU != nullptr) delete m_NVAPU;
+    if (m_apuSink != nullptr) delete m_apuSink;
     if (m_AC97 != nullptr) delete m_AC97;
+    if (m_ac97Sink != nullptr) delete m_ac97Sink;
     if (m_IDE != nullptr) delete m_IDE;
     if (m_NV2A != nullptr) delete m_NV2A;
     
@@ -117,13 +136,23 @@ Xbox::~Xbox() {
     if (m_PCIBridge != nullptr) delete m_PCIBridge;
     if (m_AGPBridge != nullptr) delete m_AGPBridge;
 
+    // Stop the ATA command processors before releasing the drivers they use
+    if (m_ATA != nullptr) delete m_ATA;
     for (int i = 0; i < 2; i++) {
         for (int j = 0; j < 2; j++) {
             delete m_ataDrivers[i][j];
         }
     }
-    if (m_ATA != nullptr) delete m_ATA;
-    if (m_SuperIO != nullptr) delete m_SuperIO;
+    if (m_hddBaseDriver != nullptr) delete m_hddBaseDriver;
+    if (m_SuperIO != nullptr) {
+        delete m_SuperIO;
+        for (int i = 0; i < SUPERIO_SERIAL_PORT_COUNT; i++) {
+            delete m_CharDrivers[i];
+        }
+    }
+#ifdef __linux__
+    if (m_charEventLoop != nullptr) delete m_charEventLoop;
+#endif
     if (m_i8254 != nullptr) delete m_i8254;
     if (m_i8259 != nullptr) delete m_i8259;
     if (m_CMOS != nullptr) delete m_CMOS;
@@ -346,11 +375,83 @@ EmulatorStatus Xbox::InitHardware() {
     m_CMOS = new CMOS();
 
     // TODO: make this configurable, similar to Super I/O port char drivers
-    m_ataDrivers[0][0] = new hw::ata::DummyHardDriveATADeviceDriver();
-    m_ataDrivers[0][1] = new hw::ata::NullATADeviceDriver();
+    m_ataDrivers[0][0] = nullptr;
+    m_ataDrivers[0][1] = nullptr;
     m_ataDrivers[1][0] = new hw::ata::NullATADeviceDriver();
     m_ataDrivers[1][1] = new hw::ata::NullATADeviceDriver();
 
+    // Attach the hard drive image or host directory if one was specified.
+    // With an overlay, the image is opened read-only and all writes go to the
+    // overlay instead. Compressed images and host directories are always
+    // read-only; host directories get an overlay next to them by default.
+    if (m_settings.hdd_hostDirectory != nullptr || m_settings.hdd_imagePath != nullptr) {
+        const char *overlayPath = m_settings.hdd_overlayPath;
+        std::string defaultOverlayPath;
+        bool useOverlay = overlayPath != nullptr || m_settings.hdd_hostDirectory != nullptr;
+        hw::ata::IATADeviceDriver *hdd;
+        if (m_settings.hdd_hostDirectory != nullptr) {
+            if (m_settings.hdd_imagePath != nullptr) {
+                log_warning("Both a hard drive image and a host directory were specified; using the host directory\n");
+            }
+            auto fatx = new hw::ata::VirtualFATXHardDriveATADeviceDriver();
+            if (!fatx->Open(m_settings.hdd_hostDirectory)) {
+                delete fatx;
+                return EMUS_INIT_HDD_DIRECTORY_FAILED;
+            }
+            if (overlayPath == nullptr) {
+                defaultOverlayPath = m_settings.hdd_hostDirectory;
+                while (defaultOverlayPath.size() > 1 && (defaultOverlayPath.back() == '/' || defaultOverlayPath.back() == '\\')) {
+                    defaultOverlayPath.pop_back();
+                }
+                defaultOverlayPath += ".overlay";
+                overlayPath = defaultOverlayPath.c_str();
+            }
+            hdd = fatx;
+        }
+        else if (hw::ata::CompressedImage::IsCompressedImage(m_settings.hdd_imagePath)) {
+            auto compressed = new hw::ata::CompressedImageHardDriveATADeviceDriver();
+            if (!compressed->Open(m_settings.hdd_imagePath)) {
+                delete compressed;
+                return EMUS_INIT_HDD_IMAGE_FAILED;
+            }
+            if (!useOverlay) {
+                log_warning("Compressed hard drive image attached without an overlay; writes will fail\n");
+            }
+            hdd = compressed;
+        }
+        else {
+            auto raw = new hw::ata::RawImageHardDriveATADeviceDriver();
+            if (!raw->Open(m_settings.hdd_imagePath, m_settings.hdd_newImageSize, useOverlay)) {
+                delete raw;
+                return EMUS_INIT_HDD_IMAGE_FAILED;
+            }
+            hdd = raw;
+        }
+        if (useOverlay) {
+            m_hddBaseDriver = hdd;
+            auto overlay = new hw::ata::OverlayHardDriveATADeviceDriver(hdd);
+            if (!overlay->Open(overlayPath, m_settings.hdd_overlayBlockSize, m_settings.hdd_resetOverlay)) {
+                delete overlay;
+                return EMUS_INIT_HDD_OVERLAY_FAILED;
+            }
+            m_ataDrivers[0][0] = overlay;
+        }
+        else {
+            m_ataDrivers[0][0] = hdd;
+        }
+    }
+    else {
+        m_ataDrivers[0][0] = new hw::ata::DummyHardDriveATADeviceDriver();
+    }
+
+    // The DVD drive is always present; insert the disc image if one was specified
+    auto dvd = new hw::ata::XISODVDDriveATADeviceDriver();
+    if (m_settings.dvd_imagePath != nullptr && !dvd->Open(m_settings.dvd_imagePath)) {
+        delete dvd;
+        return EMUS_INIT_DVD_IMAGE_FAILED;
+    }
+    m_ataDrivers[0][1] = dvd;
+
     m_ATA = new hw::ata::ATA(m_i8259);
     m_ATA->GetChannel(hw::ata::ChanPrimary).GetDevice(0).SetDeviceDriver(m_ataDrivers[0][0]);
     m_ATA->GetChannel(hw::ata::ChanPrimary).GetDevice(1).SetDeviceDriver(m_ataDrivers[0][1]);
@@ -358,22 +459,57 @@ EmulatorStatus Xbox::InitHardware() {
     m_ATA->GetChannel(hw::ata::ChanSecondary).GetDevice(1).SetDeviceDriver(m_ataDrivers[1][1]);
 
     if (m_settings.hw_enableSuperIO) {
+#ifdef __linux__
+        // All host character drivers share a single I/O thread
+        m_charEventLoop = new CharEventLoop();
+        if (!m_charEventLoop->Start()) {
+            return EMUS_INIT_CHAR_DRIVER_FAILED;
+        }
+#endif
         for (int i = 0; i < SUPERIO_SERIAL_PORT_COUNT; i++) {
+            auto& params = m_settings.hw_charDrivers[i].params;
             switch (m_settings.hw_charDrivers[i].type) {
-            case CHD_Null:
-                m_CharDrivers[i] = new NullCharDriver();
+#ifdef _WIN32
+            case CHD_HostSerialPort:
+                m_CharDrivers[i] = new Win32SerialDriver(params.hostSerialPort.portNum);
                 break;
+#endif
+#ifdef __linux__
             case CHD_HostSerialPort:
-#ifdef _WIN32
-                m_CharDrivers[i] = new Win32SerialDriver(m_settings.hw_charDrivers[i].params.hostSerialPort.portNum);
-#else
-                m_CharDrivers[i] = new NullCharDriver(); // TODO: LinuxSerialDriver(m_settings.hw_charDrivers[i].params.hostSerialPort.portNum);
+                m_CharDrivers[i] = new LinuxSerialDriver(m_charEventLoop, params.hostSerialPort.portNum);
+                break;
+            case CHD_Pty:
+                m_CharDrivers[i] = new PtyCharDriver(m_charEventLoop);
+                break;
+            case CHD_TcpServer:
+            case CHD_TcpClient:
+                m_CharDrivers[i] = new SocketCharDriver(m_charEventLoop, params.tcp.host, params.tcp.port, m_settings.hw_charDrivers[i].type == CHD_TcpServer);
+                break;
+            case CHD_UnixServer:
+            case CHD_UnixClient:
+                m_CharDrivers[i] = new SocketCharDriver(m_charEventLoop, params.unixSocket.path, m_settings.hw_charDrivers[i].type == CHD_UnixServer);
+                break;
+            case CHD_File:
+                m_CharDrivers[i] = new FileCharDriver(m_charEventLoop, params.file.path);
+                break;
 #endif
+            default:
+                if (m_settings.hw_charDrivers[i].type != CHD_Null) {
+                    log_warning("Serial port %d: Character driver not supported on this platform\n", i + 1);
+                }
+                m_CharDrivers[i] = new NullCharDriver();
                 break;
             }
-            m_CharDrivers[i]->Init();
+            if (!m_CharDrivers[i]->Init()) {
+                for (int j = 0; j <= i; j++) {
+                    delete m_CharDrivers[j];
+                    m_CharDrivers[j] = nullptr;
+                }
+                m_SuperIO = nullptr;
+                return EMUS_INIT_CHAR_DRIVER_FAILED;
+            }
         }
-        m_SuperIO = new SuperIO(m_i8259, m_CharDrivers);
+        m_SuperIO = new SuperIO(m_i8259, m_CharDrivers, m_settings.hw_serialBurstMode);
         m_SuperIO->Init();
     }
     else {
@@ -398,11 +534,11 @@ EmulatorStatus Xbox::InitHardware() {
     m_LPC = new LPCDevice(PCI_VENDOR_ID_NVIDIA, 0x01B2, 0xD4, m_IRQs, m_rom, m_bios, m_biosSize, m_mcpxROM, m_settings.hw_model != DebugKit);
     m_USB1 = new USBPCIDevice(PCI_VENDOR_ID_NVIDIA, 0x02A5, 0xA1, 1, m_cpu);
     m_USB2 = new USBPCIDevice(PCI_VENDOR_ID_NVIDIA, 0x02A5, 0xA1, 9, m_cpu);
-    m_NVNet = new NVNetDevice(PCI_VENDOR_ID_NVIDIA, 0x01C3, 0xD2);
-    m_NVAPU = new NVAPUDevice(PCI_VENDOR_ID_NVIDIA, 0x01B0, 0xD2);
-    m_AC97 = new AC97Device(PCI_VENDOR_ID_NVIDIA, 0x01B1, 0xD2);
+    m_NVNet = new NVNetDevice(PCI_VENDOR_ID_NVIDIA, 0x01C3, 0xD2, (uint8_t*)m_ram, m_ramSize, m_i8259);
+    m_NVAPU = new NVAPUDevice(PCI_VENDOR_ID_NVIDIA, 0x01B0, 0xD2, (uint8_t*)m_ram, m_ramSize, m_i8259);
+    m_AC97 = new AC97Device(PCI_VENDOR_ID_NVIDIA, 0x01B1, 0xD2, (uint8_t*)m_ram, m_ramSize, m_i8259);
     m_PCIBridge = new PCIBridgeDevice(PCI_VENDOR_ID_NVIDIA, 0x01B8, 0xD2);
-    m_IDE = new IDEDevice(PCI_VENDOR_ID_NVIDIA, 0x01BC, 0xD2);
+    m_IDE = new IDEDevice(PCI_VENDOR_ID_NVIDIA, 0x01BC, 0xD2, (uint8_t*)m_ram, m_ramSize, m_ATA);
     m_AGPBridge = new AGPBridgeDevice(PCI_VENDOR_ID_NVIDIA, 0x01B7, 0xA1);
     m_NV2A = new NV2ADevice(PCI_VENDOR_ID_NVIDIA, 0x02A0, 0xA1, (uint8_t*)m_ram, m_ramSize, m_i8259);
 
@@ -453,8 +589,85 @@ EmulatorStatus Xbox::InitHardware() {
     m_PCIBus->ConnectDevice(PCI_DEVID(0, PCI_DEVFN(8, 0)), m_PCIBridge);
     m_PCIBus->ConnectDevice(PCI_DEVID(0, PCI_DEVFN(9, 0)), m_IDE);
     m_PCIBus->ConnectDevice(PCI_DEVID(0, PCI_DEVFN(30, 0)), m_AGPBridge);
+
+    // Start capturing the NV2A command stream if requested. This must be
+    // done before the device is initialized.
+    if (m_settings.nv2a_tracePath != nullptr) {
+        m_NV2A->StartTrace(m_settings.nv2a_tracePath);
+    }
+
+    // Start capturing the display if requested
+    if (m_settings.nv2a_scanoutShmName != nullptr || m_settings.nv2a_scanoutImagePrefix != nullptr || m_settings.nv2a_scanoutVideoPath != nullptr) {
+        m_NV2A->StartScanout(m_settings.nv2a_scanoutShmName, m_settings.nv2a_scanoutImagePrefix, m_settings.nv2a_scanoutVideoPath);
+    }
+
+
+    // Collect command stream statistics if requested
+    if (m_settings.nv2a_profilePath != nullptr) {
+        m_NV2A->StartProfile(m_settings.nv2a_profilePath);
+    }
+
     m_PCIBus->ConnectDevice(PCI_DEVID(1, PCI_DEVFN(0, 0)), m_NV2A);
 
+    // Plug in the network cable
+    m_NVNet->SetInterruptCoalescing(m_settings.net_irqCoalesceFrames, std::chrono::microseconds(m_settings.net_irqCoalesceTime));
+    switch (m_settings.net_backend) {
+    case NBT_None:
+        break;
+    case NBT_Loopback:
+        m_netBackend = new hw::net::LoopbackNetBackend();
+        break;
+    case NBT_Switch:
+        m_netBackend = new hw::net::SwitchNetBackend(hw::net::NetSwitch::Get(m_settings.net_switchName));
+        break;
+    case NBT_PcapReplay:
+    {
+        auto replay = new hw::net::PcapReplayNetBackend();
+        m_netBackend = replay;
+        if (m_settings.net_pcapReplayPath == nullptr || !replay->Open(m_settings.net_pcapReplayPath, m_settings.net_pcapReplayRealTime)) {
+            return EMUS_INIT_NET_BACKEND_FAILED;
+        }
+        break;
+    }
+    case NBT_Tap:
+    {
+        auto tap = new hw::net::TapNetBackend();
+        m_netBackend = tap;
+        if (!tap->Open(m_settings.net_tapInterface)) {
+            return EMUS_INIT_NET_BACKEND_FAILED;
+        }
+        break;
+    }
+    }
+    if (m_netBackend != nullptr && !m_NVNet->SetBackend(m_netBackend)) {
+        return EMUS_INIT_NET_BACKEND_FAILED;
+    }
+
+    // Start capturing network traffic if requested
+    if (m_settings.net_capturePath != nullptr) {
+        m_NVNet->StartCapture(m_settings.net_capturePath, m_settings.net_captureSnapLen, m_settings.net_captureMaxFileSize);
+    }
+
+    // Connect the audio output
+    if (m_settings.apu_wavPath != nullptr) {
+        m_apuSink = new hw::audio::WavAudioSink(m_settings.apu_wavPath);
+    }
+    else {
+        m_apuSink = new hw::audio::NullAudioSink();
+    }
+    if (!m_NVAPU->SetAudioSink(m_apuSink)) {
+        return EMUS_INIT_AUDIO_SINK_FAILED;
+    }
+    if (m_settings.ac97_wavPath != nullptr) {
+        m_ac97Sink = new hw::audio::WavAudioSink(m_settings.ac97_wavPath);
+    }
+    else {
+        m_ac97Sink = new hw::audio::NullAudioSink();
+    }
+    if (!m_AC97->SetAudioSink(m_ac97Sink)) {
+        return EMUS_INIT_AUDIO_SINK_FAILED;
+    }
+
     // Configure PCI Bus IRQ mapper
     m_PCIBus->ConfigureIRQs(new LPCIRQMapper(m_LPC), XBOX_NUM_INT_IRQS + XBOX_NUM_PIRQS);
 
@@ -26,6 +26,9 @@
 #include "openxbox/hw/basic/i8254.h"
 #include "openxbox/hw/basic/i8259.h"
 #include "openxbox/hw/basic/superio.h"
+#ifdef __linux__
+#include "openxbox/hw/basic/linux/char_loop.h"
+#endif
 #include "openxbox/hw/basic/cmos.h"
 
 #include "openxbox/hw/ata/ata.h"
@@ -100,56 +103,63 @@ protected:
     static uint32_t EmuCpuThreadFunc(void *data);
 
     // ----- Modules ----------------------------------------------------------
-    openxbox::modules::cpu::ICPUModule *m_cpuModule;
+    openxbox::modules::cpu::ICPUModule *m_cpuModule = nullptr;
 
     // ----- Hardware ---------------------------------------------------------
-    Cpu              *m_cpu;
-    uint32_t          m_ramSize;
-    uint8_t          *m_ram;
-    uint8_t          *m_rom;
-    uint8_t          *m_bios;
-    uint32_t          m_biosSize;
-    uint8_t          *m_mcpxROM;
-    MemoryRegion     *m_memRegion;
+    Cpu              *m_cpu = nullptr;
+    uint32_t          m_ramSize = 0;
+    uint8_t          *m_ram = nullptr;
+    uint8_t          *m_rom = nullptr;
+    uint8_t          *m_bios = nullptr;
+    uint32_t          m_biosSize = 0;
+    uint8_t          *m_mcpxROM = nullptr;
+    MemoryRegion     *m_memRegion = nullptr;
     IOMapper          m_ioMapper;
     
-    GSI              *m_GSI;
-    IRQ              *m_IRQs;
-    IRQ              *m_acpiIRQs;
-    IRQ              *m_i8259IRQs;
-
-    i8254            *m_i8254;
-    i8259            *m_i8259;
-    CMOS             *m_CMOS;
-    hw::ata::ATA     *m_ATA;
-    hw::ata::IATADeviceDriver *m_ataDrivers[2][2];
-    CharDriver       *m_CharDrivers[SUPERIO_SERIAL_PORT_COUNT];
-    SuperIO          *m_SuperIO;
-
-    SMBus            *m_SMBus;
-    SMCDevice        *m_SMC;
-    EEPROMDevice     *m_EEPROM;
-    TVEncoderDevice  *m_TVEncoder;
-
-    PCIBus           *m_PCIBus;
-    HostBridgeDevice *m_HostBridge;
-    MCPXRAMDevice    *m_MCPXRAM;
-    LPCDevice        *m_LPC;
-    USBPCIDevice     *m_USB1;
-    USBPCIDevice     *m_USB2;
-    NVNetDevice      *m_NVNet;
-    NVAPUDevice      *m_NVAPU;
-    AC97Device       *m_AC97;
-    PCIBridgeDevice  *m_PCIBridge;
-    IDEDevice        *m_IDE;
-    AGPBridgeDevice  *m_AGPBridge;
-    NV2ADevice       *m_NV2A;
+    GSI              *m_GSI = nullptr;
+    IRQ              *m_IRQs = nullptr;
+    IRQ              *m_acpiIRQs = nullptr;
+    IRQ              *m_i8259IRQs = nullptr;
+
+    i8254            *m_i8254 = nullptr;
+    i8259            *m_i8259 = nullptr;
+    CMOS             *m_CMOS = nullptr;
+    hw::ata::ATA     *m_ATA = nullptr;
+    hw::ata::IATADeviceDriver *m_ataDrivers[2][2] = {};
+    hw::ata::IATADeviceDriver *m_hddBaseDriver = nullptr;  // Image under the hard drive overlay, if any
+    hw::net::INetBackend *m_netBackend = nullptr;
+    hw::audio::AudioSink *m_apuSink = nullptr;
+    hw::audio::AudioSink *m_ac97Sink = nullptr;
+    CharDriver       *m_CharDrivers[SUPERIO_SERIAL_PORT_COUNT] = {};
+#ifdef __linux__
+    CharEventLoop    *m_charEventLoop = nullptr;  // Services the host character drivers
+#endif
+    SuperIO          *m_SuperIO = nullptr;
+
+    SMBus            *m_SMBus = nullptr;
+    SMCDevice        *m_SMC = nullptr;
+    EEPROMDevice     *m_EEPROM = nullptr;
+    TVEncoderDevice  *m_TVEncoder = nullptr;
+
+    PCIBus           *m_PCIBus = nullptr;
+    HostBridgeDevice *m_HostBridge = nullptr;
+    MCPXRAMDevice    *m_MCPXRAM = nullptr;
+    LPCDevice        *m_LPC = nullptr;
+    USBPCIDevice     *m_USB1 = nullptr;
+    USBPCIDevice     *m_USB2 = nullptr;
+    NVNetDevice      *m_NVNet = nullptr;
+    NVAPUDevice      *m_NVAPU = nullptr;
+    AC97Device       *m_AC97 = nullptr;
+    PCIBridgeDevice  *m_PCIBridge = nullptr;
+    IDEDevice        *m_IDE = nullptr;
+    AGPBridgeDevice  *m_AGPBridge = nullptr;
+    NV2ADevice       *m_NV2A = nullptr;
 
     // ----- Configuration ----------------------------------------------------
     OpenXBOXSettings  m_settings;
 
     // ----- State ------------------------------------------------------------
-    bool     m_should_run;
+    bool     m_should_run = false;
 
     uint8_t  m_lastSMCErrorCode = 0;
     uint32_t m_lastBugCheckCode = 0x00000000;
@@ -163,7 +173,7 @@ protected:
     bool LocateKernelData();
 
     // ----- Debugger ---------------------------------------------------------
-    GdbServer *m_gdb;
+    GdbServer *m_gdb = nullptr;
 };
 
 }